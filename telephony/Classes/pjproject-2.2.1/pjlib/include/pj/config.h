@@ -714,6 +714,26 @@
 #endif
 
 
+/**
+ * Implement atomic variables (#pj_atomic_t) with the compiler's atomic
+ * builtins instead of guarding the value with a mutex. This makes atomic
+ * operations lock free and creating an atomic variable cheap, which
+ * matters for objects such as transmit buffers that are reference
+ * counted with atomic variables. This is only used by the Unix port.
+ *
+ * Default: 1 if the compiler has the builtins for long integers (GCC or
+ * clang), otherwise 0.
+ */
+#ifndef PJ_ATOMIC_USE_BUILTINS
+#  if defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_4) && \
+      (defined(__GCC_HAVE_SYNC_COMPARE_AND_SWAP_8) || !defined(__LP64__))
+#    define PJ_ATOMIC_USE_BUILTINS  1
+#  else
+#    define PJ_ATOMIC_USE_BUILTINS  0
+#  endif
+#endif
+
+
 /**
  * Maximum file name length.
  */
@@ -521,6 +521,23 @@ PJ_DECL(void) pj_symbianos_set_connection_status(pj_bool_t up);
  */
 PJ_DECL(pj_status_t) pj_thread_local_alloc(long *index);
 
+/**
+ * Allocate thread local storage index with a destructor. When a thread
+ * created with #pj_thread_create() returns from its thread function while
+ * its value at the index is not zero, the destructor is called with that
+ * value in that thread. The thread is still registered to PJLIB then, so
+ * the destructor may use PJLIB functions, but it must not wait for a lock
+ * that may be held by a thread joining this thread. The destructor is not
+ * called for other threads, nor after the index has been freed.
+ *
+ * @param index	    Pointer to hold the return value.
+ * @param destructor The function to be called when a thread exits.
+ * @return	    PJ_SUCCESS on success, PJ_ENOTSUP if the platform can't
+ *		    call the destructor, or the error code.
+ */
+PJ_DECL(pj_status_t) pj_thread_local_alloc2(long *index,
+					    void (*destructor)(void *value));
+
 /**
  * Deallocate thread local variable.
  *
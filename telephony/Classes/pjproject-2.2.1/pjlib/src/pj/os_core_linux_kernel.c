@@ -479,6 +479,14 @@ PJ_DEF(pj_status_t) pj_thread_local_alloc(long *index)
     return PJ_SUCCESS;
 }
 
+PJ_DEF(pj_status_t) pj_thread_local_alloc2(long *index,
+					   void (*destructor)(void *value))
+{
+    PJ_UNUSED_ARG(index);
+    PJ_UNUSED_ARG(destructor);
+    return PJ_ENOTSUP;
+}
+
 PJ_DEF(void) pj_thread_local_free(long index)
 {
     pj_assert(index >= 0 && index < MAX_TLS_ID);
@@ -72,7 +72,7 @@ struct pj_thread_t
 struct pj_atomic_t
 {
     pj_mutex_t	       *mutex;
-    pj_atomic_value_t	value;
+    volatile pj_atomic_value_t value;
 };
 
 struct pj_mutex_t
@@ -122,6 +122,17 @@ static int initialized;
     static pj_thread_t main_thread;
     static long thread_tls_id;
     static pj_mutex_t critical_section;
+
+    /* Thread local variables with destructor, see pj_thread_local_alloc2().
+     * Guarded by the critical section.
+     */
+#   define MAX_TLS_DESTRUCTORS 8
+    static struct tls_destructor
+    {
+	long	  index;
+	void	(*destructor)(void *value);
+    } tls_destructor[MAX_TLS_DESTRUCTORS];
+    static unsigned tls_destructor_cnt;
 #else
 #   define MAX_THREADS 32
     static int tls_flag[MAX_THREADS];
@@ -236,15 +247,15 @@ PJ_DEF(void) pj_shutdown()
     }
 
 #if PJ_HAS_THREADS
-    /* Destroy PJLIB critical section */
-    pj_mutex_destroy(&critical_section);
-
-    /* Free PJLIB TLS */
+    /* Free PJLIB TLS. This needs the critical section. */
     if (thread_tls_id != -1) {
 	pj_thread_local_free(thread_tls_id);
 	thread_tls_id = -1;
     }
 
+    /* Destroy PJLIB critical section */
+    pj_mutex_destroy(&critical_section);
+
     /* Ticket #1132: Assertion when (re)starting PJLIB on different thread */
     pj_bzero(&main_thread, sizeof(main_thread));
 #endif
@@ -490,6 +501,28 @@ pj_status_t pj_thread_init(void)
 }
 
 #if PJ_HAS_THREADS
+/*
+ * Call the destructors of the thread local variables of the calling
+ * thread. This is done before the thread leaves thread_main(), so that
+ * the thread is still registered to PJLIB.
+ */
+static void call_tls_destructors(void)
+{
+    unsigned i;
+
+    pj_enter_critical_section();
+    for (i=0; i<tls_destructor_cnt; ++i) {
+	pthread_key_t key = (pthread_key_t)tls_destructor[i].index;
+	void *value = pthread_getspecific(key);
+
+	if (value) {
+	    pthread_setspecific(key, NULL);
+	    (*tls_destructor[i].destructor)(value);
+	}
+    }
+    pj_leave_critical_section();
+}
+
 /*
  * thread_main()
  *
@@ -522,6 +555,8 @@ static void *thread_main(void *param)
     /* Call user's entry! */
     result = (void*)(long)(*rec->proc)(rec->arg);
 
+    call_tls_destructors();
+
     /* Done. */
     PJ_LOG(6,(rec->obj_name, "Thread quitting"));
 
@@ -828,6 +863,13 @@ PJ_DEF(pj_status_t) pj_thread_get_stack_info( pj_thread_t *thread,
 #endif	/* PJ_OS_HAS_CHECK_STACK */
 
 ///////////////////////////////////////////////////////////////////////////////
+/* Use mutex to guard atomic variable unless compiler builtins are used */
+#if PJ_HAS_THREADS && !PJ_ATOMIC_USE_BUILTINS
+#   define ATOMIC_USE_MUTEX	1
+#else
+#   define ATOMIC_USE_MUTEX	0
+#endif
+
 /*
  * pj_atomic_create()
  */
@@ -842,10 +884,12 @@ PJ_DEF(pj_status_t) pj_atomic_create( pj_pool_t *pool,
 
     PJ_ASSERT_RETURN(atomic_var, PJ_ENOMEM);
 
-#if PJ_HAS_THREADS
+#if ATOMIC_USE_MUTEX
     rc = pj_mutex_create(pool, "atm%p", PJ_MUTEX_SIMPLE, &atomic_var->mutex);
     if (rc != PJ_SUCCESS)
 	return rc;
+#else
+    PJ_UNUSED_ARG(rc);
 #endif
     atomic_var->value = initial;
 
@@ -859,7 +903,7 @@ PJ_DEF(pj_status_t) pj_atomic_create( pj_pool_t *pool,
 PJ_DEF(pj_status_t) pj_atomic_destroy( pj_atomic_t *atomic_var )
 {
     PJ_ASSERT_RETURN(atomic_var, PJ_EINVAL);
-#if PJ_HAS_THREADS
+#if ATOMIC_USE_MUTEX
     return pj_mutex_destroy( atomic_var->mutex );
 #else
     return 0;
@@ -873,12 +917,14 @@ PJ_DEF(void) pj_atomic_set(pj_atomic_t *atomic_var, pj_atomic_value_t value)
 {
     PJ_CHECK_STACK();
 
-#if PJ_HAS_THREADS
+#if ATOMIC_USE_MUTEX
     pj_mutex_lock( atomic_var->mutex );
-#endif
     atomic_var->value = value;
-#if PJ_HAS_THREADS
     pj_mutex_unlock( atomic_var->mutex);
+#elif PJ_ATOMIC_USE_BUILTINS
+    __sync_lock_test_and_set(&atomic_var->value, value);
+#else
+    atomic_var->value = value;
 #endif
 }
 
@@ -891,12 +937,14 @@ PJ_DEF(pj_atomic_value_t) pj_atomic_get(pj_atomic_t *atomic_var)
 
     PJ_CHECK_STACK();
 
-#if PJ_HAS_THREADS
+#if ATOMIC_USE_MUTEX
     pj_mutex_lock( atomic_var->mutex );
-#endif
     oldval = atomic_var->value;
-#if PJ_HAS_THREADS
     pj_mutex_unlock( atomic_var->mutex);
+#elif PJ_ATOMIC_USE_BUILTINS
+    oldval = __sync_add_and_fetch(&atomic_var->value, 0);
+#else
+    oldval = atomic_var->value;
 #endif
     return oldval;
 }
@@ -906,26 +954,14 @@ PJ_DEF(pj_atomic_value_t) pj_atomic_get(pj_atomic_t *atomic_var)
  */
 PJ_DEF(pj_atomic_value_t) pj_atomic_inc_and_get(pj_atomic_t *atomic_var)
 {
-    pj_atomic_value_t new_value;
-
-    PJ_CHECK_STACK();
-
-#if PJ_HAS_THREADS
-    pj_mutex_lock( atomic_var->mutex );
-#endif
-    new_value = ++atomic_var->value;
-#if PJ_HAS_THREADS
-    pj_mutex_unlock( atomic_var->mutex);
-#endif
-
-    return new_value;
+    return pj_atomic_add_and_get(atomic_var, 1);
 }
 /*
  * pj_atomic_inc()
  */
 PJ_DEF(void) pj_atomic_inc(pj_atomic_t *atomic_var)
 {
-    pj_atomic_inc_and_get(atomic_var);
+    pj_atomic_add_and_get(atomic_var, 1);
 }
 
 /*
@@ -933,19 +969,7 @@ PJ_DEF(void) pj_atomic_inc(pj_atomic_t *atomic_var)
  */
 PJ_DEF(pj_atomic_value_t) pj_atomic_dec_and_get(pj_atomic_t *atomic_var)
 {
-    pj_atomic_value_t new_value;
-
-    PJ_CHECK_STACK();
-
-#if PJ_HAS_THREADS
-    pj_mutex_lock( atomic_var->mutex );
-#endif
-    new_value = --atomic_var->value;
-#if PJ_HAS_THREADS
-    pj_mutex_unlock( atomic_var->mutex);
-#endif
-
-    return new_value;
+    return pj_atomic_add_and_get(atomic_var, -1);
 }
 
 /*
@@ -953,7 +977,7 @@ PJ_DEF(pj_atomic_value_t) pj_atomic_dec_and_get(pj_atomic_t *atomic_var)
  */
 PJ_DEF(void) pj_atomic_dec(pj_atomic_t *atomic_var)
 {
-    pj_atomic_dec_and_get(atomic_var);
+    pj_atomic_add_and_get(atomic_var, -1);
 }
 
 /*
@@ -964,15 +988,18 @@ PJ_DEF(pj_atomic_value_t) pj_atomic_add_and_get( pj_atomic_t *atomic_var,
 {
     pj_atomic_value_t new_value;
 
-#if PJ_HAS_THREADS
-    pj_mutex_lock(atomic_var->mutex);
-#endif
+    PJ_CHECK_STACK();
 
+#if ATOMIC_USE_MUTEX
+    pj_mutex_lock(atomic_var->mutex);
     atomic_var->value += value;
     new_value = atomic_var->value;
-
-#if PJ_HAS_THREADS
     pj_mutex_unlock(atomic_var->mutex);
+#elif PJ_ATOMIC_USE_BUILTINS
+    new_value = __sync_add_and_fetch(&atomic_var->value, value);
+#else
+    atomic_var->value += value;
+    new_value = atomic_var->value;
 #endif
 
     return new_value;
@@ -1022,6 +1049,42 @@ PJ_DEF(pj_status_t) pj_thread_local_alloc(long *p_index)
 #endif
 }
 
+/*
+ * pj_thread_local_alloc2()
+ */
+PJ_DEF(pj_status_t) pj_thread_local_alloc2(long *p_index,
+					   void (*destructor)(void *value))
+{
+#if PJ_HAS_THREADS
+    pthread_key_t key;
+    int rc;
+
+    PJ_ASSERT_RETURN(p_index != NULL && destructor != NULL, PJ_EINVAL);
+
+    pj_assert( sizeof(pthread_key_t) <= sizeof(long));
+    if ((rc=pthread_key_create(&key, NULL)) != 0)
+	return PJ_RETURN_OS_ERROR(rc);
+
+    pj_enter_critical_section();
+    if (tls_destructor_cnt == MAX_TLS_DESTRUCTORS) {
+	pj_leave_critical_section();
+	pthread_key_delete(key);
+	return PJ_ETOOMANY;
+    }
+    tls_destructor[tls_destructor_cnt].index = key;
+    tls_destructor[tls_destructor_cnt].destructor = destructor;
+    ++tls_destructor_cnt;
+    pj_leave_critical_section();
+
+    *p_index = key;
+    return PJ_SUCCESS;
+#else
+    /* No other thread to exit */
+    PJ_ASSERT_RETURN(destructor != NULL, PJ_EINVAL);
+    return pj_thread_local_alloc(p_index);
+#endif
+}
+
 /*
  * pj_thread_local_free()
  */
@@ -1029,6 +1092,18 @@ PJ_DEF(void) pj_thread_local_free(long index)
 {
     PJ_CHECK_STACK();
 #if PJ_HAS_THREADS
+    unsigned i;
+
+    /* Once this returns, the destructor of the index is not called */
+    pj_enter_critical_section();
+    for (i=0; i<tls_destructor_cnt; ++i) {
+	if (tls_destructor[i].index == index) {
+	    tls_destructor[i] = tls_destructor[--tls_destructor_cnt];
+	    break;
+	}
+    }
+    pj_leave_critical_section();
+
     pthread_key_delete(index);
 #else
     tls_flag[index] = 0;
@@ -818,6 +818,17 @@ PJ_DEF(pj_status_t) pj_thread_local_alloc(long *index)
         return PJ_SUCCESS;
 }
 
+/*
+ * pj_thread_local_alloc2()
+ */
+PJ_DEF(pj_status_t) pj_thread_local_alloc2(long *index,
+					   void (*destructor)(void *value))
+{
+    PJ_UNUSED_ARG(index);
+    PJ_UNUSED_ARG(destructor);
+    return PJ_ENOTSUP;
+}
+
 /*
  * pj_thread_local_free()
  */
@@ -71,10 +71,12 @@ BINDIR = ..\bin\samples\$(TARGET)
 SAMPLES = $(BINDIR)\auddemo.exe \
 	  $(BINDIR)\aectest.exe \
 	  $(BINDIR)\aviplay.exe \
+	  $(BINDIR)\callbench.exe \
 	  $(BINDIR)\clidemo.exe \
 	  $(BINDIR)\confsample.exe \
 	  $(BINDIR)\confbench.exe \
 	  $(BINDIR)\encdec.exe \
+	  $(BINDIR)\evsubbench.exe \
 	  $(BINDIR)\httpdemo.exe \
 	  $(BINDIR)\icedemo.exe \
 	  $(BINDIR)\jbsim.exe \
@@ -86,6 +88,7 @@ SAMPLES = $(BINDIR)\auddemo.exe \
 	  $(BINDIR)\playfile.exe \
 	  $(BINDIR)\playsine.exe\
 	  $(BINDIR)\recfile.exe  \
+	  $(BINDIR)\regbulk.exe \
 	  $(BINDIR)\resampleplay.exe \
 	  $(BINDIR)\simpleua.exe \
 	  $(BINDIR)\simple_pjsua.exe \
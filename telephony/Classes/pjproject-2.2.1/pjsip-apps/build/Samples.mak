@@ -19,9 +19,11 @@ BINDIR := ../bin/samples/$(TARGET_NAME)
 SAMPLES := auddemo \
 	   aviplay \
 	   aectest \
+	   callbench \
 	   clidemo \
 	   confsample \
 	   encdec \
+	   evsubbench \
 	   httpdemo \
 	   icedemo \
 	   jbsim \
@@ -33,6 +35,7 @@ SAMPLES := auddemo \
 	   playfile \
 	   playsine \
 	   recfile \
+	   regbulk \
 	   resampleplay \
 	   simpleua \
 	   simple_pjsua \
@@ -92,6 +92,8 @@
 #define CMD_CONFIG_DUMP_DETAIL	    ((CMD_CONFIG*10)+2)
 #define CMD_CONFIG_DUMP_CONF	    ((CMD_CONFIG*10)+3)
 #define CMD_CONFIG_WRITE_SETTING    ((CMD_CONFIG*10)+4)
+#define CMD_CONFIG_MOD_STAT	    ((CMD_CONFIG*10)+5)
+#define CMD_CONFIG_DUMP_JSON	    ((CMD_CONFIG*10)+6)
 
 /* video level 2 command */
 #define CMD_VIDEO_ENABLE	    ((CMD_VIDEO*10)+1)
@@ -102,6 +104,11 @@
 #define CMD_VIDEO_CODEC		    ((CMD_VIDEO*10)+6)
 #define CMD_VIDEO_WIN		    ((CMD_VIDEO*10)+7)
 
+/* module statistic level 3 command */
+#define CMD_CONFIG_MOD_STAT_ON	    ((CMD_CONFIG_MOD_STAT*10)+1)
+#define CMD_CONFIG_MOD_STAT_OFF	    ((CMD_CONFIG_MOD_STAT*10)+2)
+#define CMD_CONFIG_MOD_STAT_RESET   ((CMD_CONFIG_MOD_STAT*10)+3)
+
 /* video level 3 command */
 #define CMD_VIDEO_ACC_SHOW	    ((CMD_VIDEO_ACC*10)+1)
 #define CMD_VIDEO_ACC_AUTORX	    ((CMD_VIDEO_ACC*10)+2)
@@ -1431,6 +1438,65 @@ static pj_status_t cmd_write_config(pj_cli_cmd_val *cval)
     return PJ_SUCCESS;
 }
 
+/* Switch module latency statistics on/off */
+static pj_status_t cmd_mod_stat(pj_bool_t enable)
+{
+    pj_status_t status;
+
+    status = pjsip_endpt_enable_mod_stat(pjsua_get_pjsip_endpt(), enable);
+    if (status != PJ_SUCCESS)
+	pjsua_perror(THIS_FILE, "Unable to set module statistics", status);
+    else
+	PJ_LOG(3,(THIS_FILE, "Module statistics %s, use dump_stat to show",
+		  (enable ? "on" : "off")));
+
+    return status;
+}
+
+/* Print the call statistics snapshot as JSON */
+static pj_status_t cmd_stat_json(pj_cli_cmd_val *cval)
+{
+    pjsua_stat_snapshot_info info;
+    pjsua_stream_snapshot *streams;
+    pj_pool_t *pool;
+    unsigned count = 0, maxlen;
+    char *buf;
+    int len;
+    pj_status_t status;
+
+    /* Get the number of entries first */
+    status = pjsua_stat_snapshot(&info, NULL, &count);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    /* Allow some room for calls made in the mean time */
+    count = info.stream_cnt + 4;
+    maxlen = 128 + count * 768;
+
+    pool = pjsua_pool_create("statjson", 1000 + maxlen, 1000);
+    if (!pool)
+	return PJ_ENOMEM;
+
+    streams = (pjsua_stream_snapshot*)
+	      pj_pool_calloc(pool, count, sizeof(pjsua_stream_snapshot));
+    buf = (char*) pj_pool_alloc(pool, maxlen);
+
+    status = pjsua_stat_snapshot(&info, streams, &count);
+    if (status == PJ_SUCCESS) {
+	len = pjsua_stat_snapshot_print_json(&info, streams, count,
+					     buf, maxlen - 1);
+	if (len < 0) {
+	    status = PJ_ETOOSMALL;
+	} else {
+	    buf[len++] = '\n';
+	    pj_cli_sess_write_msg(cval->sess, buf, len);
+	}
+    }
+
+    pj_pool_release(pool);
+    return status;
+}
+
 /* Status and config command handler */
 pj_status_t cmd_config_handler(pj_cli_cmd_val *cval)
 {
@@ -1451,6 +1517,18 @@ pj_status_t cmd_config_handler(pj_cli_cmd_val *cval)
     case CMD_CONFIG_WRITE_SETTING:
 	status = cmd_write_config(cval);
 	break;
+    case CMD_CONFIG_MOD_STAT_ON:
+	status = cmd_mod_stat(PJ_TRUE);
+	break;
+    case CMD_CONFIG_MOD_STAT_OFF:
+	status = cmd_mod_stat(PJ_FALSE);
+	break;
+    case CMD_CONFIG_MOD_STAT_RESET:
+	pjsip_endpt_reset_mod_stat(pjsua_get_pjsip_endpt());
+	break;
+    case CMD_CONFIG_DUMP_JSON:
+	status = cmd_stat_json(cval);
+	break;
     }
 
     return status;
@@ -2883,6 +2961,14 @@ static pj_status_t add_config_command(pj_cli_t *cli)
 	"   desc='Write current configuration file'>"
 	"    <ARG name='output_file' type='string' desc='Output filename'/>"
 	"  </CMD>"
+	"  <CMD name='mod_stat' id='5005' "
+	"   desc='Module latency statistics, shown by dump_stat'>"
+	"    <CMD name='on' id='50051' desc='Start collecting statistics'/>"
+	"    <CMD name='off' id='50052' desc='Stop collecting statistics'/>"
+	"    <CMD name='reset' id='50053' desc='Clear statistics'/>"
+	"  </CMD>"
+	"  <CMD name='dump_json' id='5006' sc='dj' "
+	"   desc='Dump call quality statistics as JSON'/>"
 	"</CMD>";
 
     pj_str_t xml = pj_str(config_command);
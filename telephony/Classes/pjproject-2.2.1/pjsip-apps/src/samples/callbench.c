@@ -0,0 +1,705 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * callbench.c
+ *
+ * Stress test for the locking of pjsua-lib. The program calls itself over
+ * the loopback interface: for each thread count, it starts pjsua with that
+ * many worker threads and runs the same number of application threads,
+ * each of them making calls, hanging them up once they are confirmed and
+ * polling pjsua_call_get_info() and pjsua_acc_get_info() meanwhile. The
+ * incoming calls are answered automatically. It reports the number of
+ * completed calls per second and the average call setup time (from
+ * pjsua_call_make_call() until the call is confirmed) for each thread
+ * count. With --rtp-pool, the media transports are taken from the RTP
+ * pool of the account.
+ *
+ * With --ice, the calls use ICE, and the server reflexive candidates are
+ * gathered from a STUN server stand-in that answers the Binding requests
+ * after the specified delay, to simulate the round trip to a real server.
+ * The post-dial delay (from pjsua_call_make_call() until the INVITE is
+ * sent) is reported too. With --ice-prewarm, the ICE transports of the
+ * calls are gathered in advance by the account.
+ *
+ * With --snapshot, the main thread polls pjsua_stat_snapshot() at the
+ * specified interval while the calls are running, and reports the average
+ * time taken by the snapshot and by printing it as JSON.
+ *
+ * Usage:
+ *   callbench [-n CALLS] [-t 1,2,4,8] [-d MSEC] [-p RTP_POOL_SIZE]
+ *             [-i STUN_DELAY_MSEC [-w ICE_PREWARM_CNT]] [-s MSEC]
+ *
+ * Each call uses two call slots (the outgoing and the incoming call), and
+ * the call table is sized accordingly. Each call also opens four RTP/RTCP
+ * sockets, and the ioqueue keeps the closed sockets for
+ * PJ_IOQUEUE_KEY_FREE_DELAY, so PJ_IOQUEUE_MAX_HANDLES must be increased
+ * (e.g. to 1024) and PJ_IOQUEUE_KEY_FREE_DELAY reduced (e.g. to 50) in
+ * config_site.h to run at full speed.
+ */
+
+#include <pjsua-lib/pjsua.h>
+#include <pjnath.h>
+
+#define THIS_FILE	"callbench.c"
+
+#define MAX_THREADS	64
+
+
+/* Per application thread data */
+struct worker
+{
+    pj_thread_t		*thread;
+    pj_sem_t		*sem;
+    pj_bool_t		 confirmed;
+    pj_bool_t		 disconnected;
+    pj_timestamp	 start;
+    pj_uint32_t		 setup_usec;
+    unsigned		 setup_cnt;
+    pj_bool_t		 calling;
+    pj_uint32_t		 pdd_usec;
+    unsigned		 pdd_cnt;
+};
+
+/* STUN server stand-in */
+struct stun_server
+{
+    pj_pool_t		*pool;
+    pj_sock_t		 sock;
+    pj_activesock_t	*asock;
+    pj_sockaddr		 addr;
+    pj_atomic_t		*pending;
+    pj_bool_t		 quitting;
+};
+
+/* Delayed STUN response */
+struct stun_response
+{
+    pj_pool_t		*pool;
+    pj_sockaddr		 dst;
+    int			 dst_len;
+    pj_uint8_t		 pkt[512];
+    pj_size_t		 len;
+};
+
+static struct app_t
+{
+    /* Settings */
+    unsigned		 count;
+    unsigned		 duration;
+    unsigned		 rtp_pool_size;
+    int			 stun_delay;
+    unsigned		 ice_prewarm_cnt;
+    unsigned		 snapshot_interval;
+    int			 log_level;
+
+    /* Current run */
+    pjsua_acc_id	 acc_id;
+    char		 uri_buf[64];
+    pj_str_t		 uri;
+    pj_atomic_t		*started;
+    pj_atomic_t		*completed;
+    pj_atomic_t		*failed;
+    pj_atomic_t		*info_cnt;
+    struct stun_server	 stun;
+    struct worker	 worker[MAX_THREADS];
+} app;
+
+
+/* Send the delayed STUN response */
+static void stun_send_response(void *user_data)
+{
+    struct stun_response *resp = (struct stun_response*) user_data;
+    pj_ssize_t len = resp->len;
+
+    if (!app.stun.quitting) {
+	pj_sock_sendto(app.stun.sock, resp->pkt, &len, 0, &resp->dst,
+		       resp->dst_len);
+    }
+    pj_pool_release(resp->pool);
+    pj_atomic_dec(app.stun.pending);
+}
+
+/* Answer STUN Binding requests with the source address of the request */
+static pj_bool_t stun_on_data_recvfrom(pj_activesock_t *asock,
+				       void *data,
+				       pj_size_t size,
+				       const pj_sockaddr_t *src_addr,
+				       int addr_len,
+				       pj_status_t status)
+{
+    struct stun_response *resp;
+    pj_stun_msg *req, *msg;
+    pj_pool_t *pool;
+
+    PJ_UNUSED_ARG(asock);
+
+    if (status != PJ_SUCCESS || app.stun.quitting)
+	return PJ_TRUE;
+
+    pool = pjsua_pool_create("stunresp", 1000, 1000);
+    resp = PJ_POOL_ZALLOC_T(pool, struct stun_response);
+    resp->pool = pool;
+
+    if (pj_stun_msg_decode(pool, (pj_uint8_t*)data, size,
+			   PJ_STUN_IS_DATAGRAM | PJ_STUN_CHECK_PACKET,
+			   &req, NULL, NULL) != PJ_SUCCESS ||
+	req->hdr.type != PJ_STUN_BINDING_REQUEST ||
+	pj_stun_msg_create_response(pool, req, 0, NULL, &msg) != PJ_SUCCESS ||
+	pj_stun_msg_add_sockaddr_attr(pool, msg, PJ_STUN_ATTR_XOR_MAPPED_ADDR,
+				      PJ_TRUE, src_addr,
+				      addr_len) != PJ_SUCCESS ||
+	pj_stun_msg_encode(msg, resp->pkt, sizeof(resp->pkt), 0, NULL,
+			   &resp->len) != PJ_SUCCESS)
+    {
+	pj_pool_release(pool);
+	return PJ_TRUE;
+    }
+
+    pj_sockaddr_cp(&resp->dst, src_addr);
+    resp->dst_len = addr_len;
+
+    pj_atomic_inc(app.stun.pending);
+    if (pjsua_schedule_timer2(&stun_send_response, resp,
+			      app.stun_delay) != PJ_SUCCESS)
+    {
+	stun_send_response(resp);
+    }
+
+    return PJ_TRUE;
+}
+
+/* Bind the socket of the STUN server stand-in, before pjsua is started */
+static pj_status_t stun_server_bind(void)
+{
+    pj_str_t localhost = pj_str("127.0.0.1");
+    int addr_len = sizeof(app.stun.addr);
+    pj_status_t status;
+
+    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_DGRAM(), 0,
+			    &app.stun.sock);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    pj_sockaddr_in_init(&app.stun.addr.ipv4, &localhost, 0);
+    status = pj_sock_bind(app.stun.sock, &app.stun.addr, addr_len);
+    if (status == PJ_SUCCESS)
+	status = pj_sock_getsockname(app.stun.sock, &app.stun.addr,
+				     &addr_len);
+    if (status != PJ_SUCCESS) {
+	pj_sock_close(app.stun.sock);
+	app.stun.sock = PJ_INVALID_SOCKET;
+    }
+
+    return status;
+}
+
+/* Start answering the STUN requests in the ioqueue of pjsua */
+static pj_status_t stun_server_start(void)
+{
+    pj_activesock_cb cb;
+    pj_status_t status;
+
+    pj_bzero(&cb, sizeof(cb));
+    cb.on_data_recvfrom = &stun_on_data_recvfrom;
+
+    app.stun.pool = pjsua_pool_create("stunsrv", 1000, 1000);
+
+    status = pj_atomic_create(app.stun.pool, 0, &app.stun.pending);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = pj_activesock_create(app.stun.pool, app.stun.sock,
+				  pj_SOCK_DGRAM(), NULL,
+				  pjsip_endpt_get_ioqueue(
+				      pjsua_get_pjsip_endpt()),
+				  &cb, NULL, &app.stun.asock);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    return pj_activesock_start_recvfrom(app.stun.asock, app.stun.pool,
+					1500, 0);
+}
+
+/* Stop the STUN server stand-in, before pjsua is destroyed */
+static void stun_server_stop(void)
+{
+    app.stun.quitting = PJ_TRUE;
+
+    /* Let the delayed responses be released */
+    while (app.stun.pending && pj_atomic_get(app.stun.pending) > 0)
+	pj_thread_sleep(10);
+
+    if (app.stun.asock) {
+	pj_activesock_close(app.stun.asock);
+    } else if (app.stun.sock != PJ_INVALID_SOCKET) {
+	pj_sock_close(app.stun.sock);
+    }
+    if (app.stun.pending)
+	pj_atomic_destroy(app.stun.pending);
+    if (app.stun.pool)
+	pj_pool_release(app.stun.pool);
+
+    pj_bzero(&app.stun, sizeof(app.stun));
+    app.stun.sock = PJ_INVALID_SOCKET;
+}
+
+
+/* Answer incoming calls */
+static void on_incoming_call(pjsua_acc_id acc_id, pjsua_call_id call_id,
+			     pjsip_rx_data *rdata)
+{
+    PJ_UNUSED_ARG(acc_id);
+    PJ_UNUSED_ARG(rdata);
+
+    pjsua_call_answer(call_id, 200, NULL, NULL);
+}
+
+/* Wake up the thread of the outgoing call */
+static void on_call_state(pjsua_call_id call_id, pjsip_event *e)
+{
+    struct worker *w;
+    pjsua_call_info ci;
+
+    PJ_UNUSED_ARG(e);
+
+    w = (struct worker*) pjsua_call_get_user_data(call_id);
+    if (w == NULL || pjsua_call_get_info(call_id, &ci) != PJ_SUCCESS)
+	return;
+
+    if (ci.state == PJSIP_INV_STATE_CALLING && !w->calling) {
+	pj_timestamp now;
+
+	/* The INVITE has been sent */
+	pj_get_timestamp(&now);
+	w->pdd_usec += pj_elapsed_usec(&w->start, &now);
+	++w->pdd_cnt;
+	w->calling = PJ_TRUE;
+    } else if (ci.state == PJSIP_INV_STATE_CONFIRMED) {
+	pj_timestamp now;
+
+	pj_get_timestamp(&now);
+	w->setup_usec += pj_elapsed_usec(&w->start, &now);
+	++w->setup_cnt;
+	w->confirmed = PJ_TRUE;
+	pj_sem_post(w->sem);
+    } else if (ci.state == PJSIP_INV_STATE_DISCONNECTED) {
+	w->disconnected = PJ_TRUE;
+	pj_sem_post(w->sem);
+    }
+}
+
+/* Make calls until the total count has been reached */
+static int worker_proc(void *arg)
+{
+    struct worker *w = (struct worker*) arg;
+    pjsua_call_info ci;
+    pjsua_acc_info ai;
+
+    while (pj_atomic_inc_and_get(app.started) <= (pj_atomic_value_t)app.count)
+    {
+	pjsua_call_id call_id;
+	pj_status_t status;
+
+	/* Drop the wake ups of an earlier call that failed to start */
+	while (pj_sem_trywait(w->sem) == PJ_SUCCESS)
+	    ;
+	w->confirmed = w->disconnected = w->calling = PJ_FALSE;
+
+	pj_get_timestamp(&w->start);
+	status = pjsua_call_make_call(app.acc_id, &app.uri, NULL, w, NULL,
+				      &call_id);
+	if (status != PJ_SUCCESS) {
+	    pj_atomic_inc(app.failed);
+	    pj_thread_sleep(1);
+	    continue;
+	}
+
+	/* The readers must not wait for the call setup of other threads */
+	if (pjsua_call_get_info(call_id, &ci) == PJ_SUCCESS)
+	    pj_atomic_inc(app.info_cnt);
+	if (pjsua_acc_get_info(app.acc_id, &ai) == PJ_SUCCESS)
+	    pj_atomic_inc(app.info_cnt);
+
+	pj_sem_wait(w->sem);
+	if (!w->disconnected) {
+	    if (app.duration)
+		pj_thread_sleep(app.duration);
+	    pjsua_call_hangup(call_id, 0, NULL, NULL);
+	    pj_sem_wait(w->sem);
+	}
+
+	if (w->confirmed)
+	    pj_atomic_inc(app.completed);
+	else
+	    pj_atomic_inc(app.failed);
+    }
+
+    return 0;
+}
+
+/* Poll the statistics snapshot until all calls have been made */
+static void poll_snapshot(pj_pool_t *pool)
+{
+    pjsua_stat_snapshot_info info;
+    pjsua_stream_snapshot *streams;
+    unsigned max, maxlen, cnt = 0, entries = 0;
+    pj_uint32_t snap_usec = 0, json_usec = 0;
+    char *buf;
+
+    max = pjsua_call_get_max_count() * 2;
+    maxlen = 128 + max * 768;
+    streams = (pjsua_stream_snapshot*)
+	      pj_pool_calloc(pool, max, sizeof(pjsua_stream_snapshot));
+    buf = (char*) pj_pool_alloc(pool, maxlen);
+
+    while ((unsigned)(pj_atomic_get(app.completed) +
+		      pj_atomic_get(app.failed)) < app.count)
+    {
+	pj_timestamp t0, t1, t2;
+	unsigned count = max;
+
+	pj_get_timestamp(&t0);
+	if (pjsua_stat_snapshot(&info, streams, &count) != PJ_SUCCESS)
+	    break;
+	pj_get_timestamp(&t1);
+	pjsua_stat_snapshot_print_json(&info, streams, count, buf, maxlen);
+	pj_get_timestamp(&t2);
+
+	snap_usec += pj_elapsed_usec(&t0, &t1);
+	json_usec += pj_elapsed_usec(&t1, &t2);
+	entries += count;
+	++cnt;
+
+	pj_thread_sleep(app.snapshot_interval);
+    }
+
+    if (cnt) {
+	printf("            snapshot: %u polls, %u streams/poll, "
+	       "%u us/poll, %u us/poll with JSON\n", cnt, entries / cnt,
+	       (unsigned)(snap_usec / cnt),
+	       (unsigned)((snap_usec + json_usec) / cnt));
+    }
+}
+
+/* Start pjsua with the specified number of worker threads */
+static pj_status_t init_pjsua(unsigned thread_cnt)
+{
+    char stun_host[PJ_INET6_ADDRSTRLEN+10];
+    pjsua_config cfg;
+    pjsua_logging_config log_cfg;
+    pjsua_media_config media_cfg;
+    pjsua_transport_config tcfg;
+    pjsua_transport_info ti;
+    pjsua_transport_id tid;
+    pj_status_t status;
+
+    status = pjsua_create();
+    if (status != PJ_SUCCESS)
+	return status;
+
+    pjsua_config_default(&cfg);
+    cfg.thread_cnt = thread_cnt;
+    cfg.max_calls = thread_cnt * 2;
+    cfg.cb.on_incoming_call = &on_incoming_call;
+    cfg.cb.on_call_state = &on_call_state;
+
+    if (app.stun_delay >= 0) {
+	status = stun_server_bind();
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	pj_sockaddr_print(&app.stun.addr, stun_host, sizeof(stun_host), 1);
+	cfg.stun_srv_cnt = 1;
+	cfg.stun_srv[0] = pj_str(stun_host);
+    }
+
+    pjsua_logging_config_default(&log_cfg);
+    log_cfg.console_level = app.log_level;
+    log_cfg.level = app.log_level;
+
+    pjsua_media_config_default(&media_cfg);
+    media_cfg.no_vad = PJ_TRUE;
+    media_cfg.enable_ice = (app.stun_delay >= 0);
+
+    status = pjsua_init(&cfg, &log_cfg, &media_cfg);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if (app.stun_delay >= 0) {
+	status = stun_server_start();
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    pjsua_transport_config_default(&tcfg);
+    tcfg.bound_addr = pj_str("127.0.0.1");
+    tcfg.public_addr = pj_str("127.0.0.1");
+    status = pjsua_transport_create(PJSIP_TRANSPORT_UDP, &tcfg, &tid);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = pjsua_transport_get_info(tid, &ti);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = pjsua_acc_add_local(tid, PJ_TRUE, &app.acc_id);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    if (app.rtp_pool_size || app.ice_prewarm_cnt) {
+	pjsua_acc_config acc_cfg;
+	pj_pool_t *tmp_pool;
+
+	tmp_pool = pjsua_pool_create("callbench", 1000, 1000);
+	pjsua_acc_get_config(app.acc_id, tmp_pool, &acc_cfg);
+	acc_cfg.rtp_pool_size = app.rtp_pool_size;
+	acc_cfg.ice_prewarm_cnt = app.ice_prewarm_cnt;
+	status = pjsua_acc_modify(app.acc_id, &acc_cfg);
+	pj_pool_release(tmp_pool);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    status = pjsua_start();
+    if (status != PJ_SUCCESS)
+	return status;
+
+    pjsua_set_null_snd_dev();
+
+    /* Let the account gather its ICE transports before the first call */
+    if (app.ice_prewarm_cnt) {
+	pjsua_rtp_pool_stat rtp_stat;
+	unsigned i;
+
+	for (i=0; i<500; ++i) {
+	    if (pjsua_acc_get_rtp_pool_stat(app.acc_id, &rtp_stat) ==
+		    PJ_SUCCESS && rtp_stat.idle >= app.ice_prewarm_cnt)
+	    {
+		break;
+	    }
+	    pj_thread_sleep(10);
+	}
+    }
+
+    app.uri.ptr = app.uri_buf;
+    app.uri.slen = pj_ansi_snprintf(app.uri_buf, sizeof(app.uri_buf),
+				    "sip:bench@127.0.0.1:%d",
+				    pj_sockaddr_get_port(&ti.local_addr));
+    return PJ_SUCCESS;
+}
+
+/* Run the calls with the specified number of threads */
+static pj_status_t run(unsigned thread_cnt)
+{
+    pj_pool_t *pool;
+    pj_time_val start, now;
+    unsigned i, elapsed, completed, setup_cnt, pdd_cnt;
+    pj_uint32_t setup_usec, pdd_usec;
+    pjsua_rtp_pool_stat rtp_stat;
+    pj_status_t status;
+
+    status = init_pjsua(thread_cnt);
+    if (status != PJ_SUCCESS) {
+	pjsua_perror(THIS_FILE, "Unable to start pjsua", status);
+	stun_server_stop();
+	pjsua_destroy();
+	return status;
+    }
+
+    pool = pjsua_pool_create("callbench", 1000, 1000);
+    pj_atomic_create(pool, 0, &app.started);
+    pj_atomic_create(pool, 0, &app.completed);
+    pj_atomic_create(pool, 0, &app.failed);
+    pj_atomic_create(pool, 0, &app.info_cnt);
+
+    pj_gettickcount(&start);
+
+    for (i=0; i<thread_cnt; ++i) {
+	struct worker *w = &app.worker[i];
+
+	pj_bzero(w, sizeof(*w));
+	pj_sem_create(pool, "callbench", 0, 2, &w->sem);
+	pj_thread_create(pool, "callbench", &worker_proc, w, 0, 0,
+			 &w->thread);
+    }
+
+    if (app.snapshot_interval)
+	poll_snapshot(pool);
+
+    setup_usec = pdd_usec = 0;
+    setup_cnt = pdd_cnt = 0;
+    for (i=0; i<thread_cnt; ++i) {
+	pj_thread_join(app.worker[i].thread);
+	pj_thread_destroy(app.worker[i].thread);
+	pj_sem_destroy(app.worker[i].sem);
+	setup_usec += app.worker[i].setup_usec;
+	setup_cnt += app.worker[i].setup_cnt;
+	pdd_usec += app.worker[i].pdd_usec;
+	pdd_cnt += app.worker[i].pdd_cnt;
+    }
+
+    pj_gettickcount(&now);
+    PJ_TIME_VAL_SUB(now, start);
+    elapsed = PJ_TIME_VAL_MSEC(now);
+    if (elapsed == 0)
+	elapsed = 1;
+
+    completed = pj_atomic_get(app.completed);
+    printf("%2u threads: %5u calls in %3u.%03u s, %6u calls/s, "
+	   "setup %5u us, pdd %5u us, %u failed, %u get_info\n",
+	   thread_cnt, completed, elapsed / 1000, elapsed % 1000,
+	   completed * 1000 / elapsed,
+	   setup_cnt ? (unsigned)(setup_usec / setup_cnt) : 0,
+	   pdd_cnt ? (unsigned)(pdd_usec / pdd_cnt) : 0,
+	   (unsigned)pj_atomic_get(app.failed),
+	   (unsigned)pj_atomic_get(app.info_cnt));
+
+    if ((app.rtp_pool_size || app.ice_prewarm_cnt) &&
+	pjsua_acc_get_rtp_pool_stat(app.acc_id, &rtp_stat) == PJ_SUCCESS)
+    {
+	printf("            RTP pool: %u taken, %u exhausted, %u recycled, "
+	       "%u discarded, %u refreshed\n", rtp_stat.taken,
+	       rtp_stat.exhausted, rtp_stat.recycled, rtp_stat.discarded,
+	       rtp_stat.refreshed);
+    }
+
+    pj_atomic_destroy(app.started);
+    pj_atomic_destroy(app.completed);
+    pj_atomic_destroy(app.failed);
+    pj_atomic_destroy(app.info_cnt);
+
+    pj_pool_release(pool);
+
+    stun_server_stop();
+    pjsua_destroy();
+    return PJ_SUCCESS;
+}
+
+
+static void usage(void)
+{
+    puts("Usage:");
+    puts("  callbench [OPTIONS]");
+    puts("");
+    puts("Options:");
+    puts("  --count, -n N          Number of calls per run (default: 1000)");
+    puts("  --threads, -t LIST     Comma separated thread counts");
+    puts("                         (default: 1,2,4,8)");
+    puts("  --duration, -d MSEC    Call duration (default: 0)");
+    puts("  --rtp-pool, -p N       RTP pool size of the account (default: 0)");
+    puts("  --ice, -i MSEC         Use ICE, with a local STUN server that");
+    puts("                         answers after MSEC");
+    puts("  --ice-prewarm, -w N    Prewarmed ICE transports of the account");
+    puts("                         (default: 0)");
+    puts("  --snapshot, -s MSEC    Poll the statistics snapshot every MSEC");
+    puts("  --log-level, -l N      Log level (default: 1)");
+    puts("  --help, -h             Show this help page");
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct pj_getopt_option long_options[] = {
+	{ "count",	1, 0, 'n' },
+	{ "threads",	1, 0, 't' },
+	{ "duration",	1, 0, 'd' },
+	{ "rtp-pool",	1, 0, 'p' },
+	{ "ice",	1, 0, 'i' },
+	{ "ice-prewarm",1, 0, 'w' },
+	{ "snapshot",	1, 0, 's' },
+	{ "log-level",	1, 0, 'l' },
+	{ "help",	0, 0, 'h' },
+	{ NULL, 0, 0, 0 }
+    };
+    const char *threads = "1,2,4,8";
+    const char *p;
+    int c, option_index;
+
+    app.count = 1000;
+    app.log_level = 1;
+    app.stun_delay = -1;
+    app.stun.sock = PJ_INVALID_SOCKET;
+
+    pj_optind = 0;
+    while ((c = pj_getopt_long(argc, argv, "n:t:d:p:i:w:s:l:h", long_options,
+			       &option_index)) != -1)
+    {
+	switch (c) {
+	case 'n':
+	    app.count = atoi(pj_optarg);
+	    break;
+	case 't':
+	    threads = pj_optarg;
+	    break;
+	case 'd':
+	    app.duration = atoi(pj_optarg);
+	    break;
+	case 'p':
+	    app.rtp_pool_size = atoi(pj_optarg);
+	    break;
+	case 'i':
+	    app.stun_delay = atoi(pj_optarg);
+	    break;
+	case 'w':
+	    app.ice_prewarm_cnt = atoi(pj_optarg);
+	    break;
+	case 's':
+	    app.snapshot_interval = atoi(pj_optarg);
+	    break;
+	case 'l':
+	    app.log_level = atoi(pj_optarg);
+	    break;
+	case 'h':
+	    usage();
+	    return 0;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+
+    if (pj_optind != argc || app.count == 0 ||
+	(app.ice_prewarm_cnt && app.stun_delay < 0))
+    {
+	usage();
+	return 1;
+    }
+
+    for (p = threads; *p; ) {
+	unsigned cnt = atoi(p);
+
+	if (cnt == 0 || cnt > MAX_THREADS) {
+	    printf("Invalid thread count %u, the maximum is %u\n", cnt,
+		   MAX_THREADS);
+	    return 1;
+	}
+
+	if (run(cnt) != PJ_SUCCESS)
+	    return 1;
+
+	while (*p && *p != ',')
+	    ++p;
+	if (*p == ',')
+	    ++p;
+    }
+
+    return 0;
+}
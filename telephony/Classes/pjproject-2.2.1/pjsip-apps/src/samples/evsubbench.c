@@ -0,0 +1,676 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * evsubbench.c
+ *
+ * Benchmark for NOTIFY fan-out. The program subscribes many watchers to a
+ * few resources of its own notifier over UDP loopback, then changes the
+ * state of all resources a number of times and measures how long it takes
+ * until every watcher has seen the last state.
+ *
+ * The notifier is either the event subscription server (pjsip_evsub_srv),
+ * or, with --evsub, a plain pjsip_evsub session per watcher that renders
+ * and sends the body for every watcher on every change, as an application
+ * would do without the server.
+ *
+ *   evsubbench -n 10000 -r 100 -c 10
+ *   evsubbench -n 10000 -r 100 -c 10 --evsub
+ */
+
+/* Include all headers. */
+#include <pjsip.h>
+#include <pjsip_ua.h>
+#include <pjsip_simple.h>
+#include <pjlib-util.h>
+#include <pjlib.h>
+
+/* For logging purpose. */
+#define THIS_FILE   "evsubbench.c"
+
+#include "util.h"
+
+#define EVENT	    "x-bench"
+#define CONTENT	    "text/plain"
+#define BODY_SIZE   400
+
+
+/* Subscriber side */
+struct watcher
+{
+    pjsip_evsub	*sub;
+    pj_bool_t	 active;
+    unsigned	 version;
+};
+
+/* Notifier side of one watcher with --evsub */
+struct notifier
+{
+    PJ_DECL_LIST_MEMBER(struct notifier);
+    pjsip_evsub	*sub;
+};
+
+static struct app_t
+{
+    pj_caching_pool	 cp;
+    pj_pool_t		*pool;
+    pjsip_endpoint	*sip_endpt;
+
+    /* Settings */
+    unsigned		 count;
+    unsigned		 res_cnt;
+    unsigned		 changes;
+    unsigned		 burst;
+    unsigned		 max_pending;
+    pj_bool_t		 use_evsub;
+    int			 port;
+
+    /* Notifier */
+    pjsip_evsub_srv	*srv;
+    struct notifier	*res_list;
+    unsigned		 version;
+
+    /* Watchers */
+    struct watcher	*watchers;
+    unsigned		 active_cnt;
+    unsigned		 uptodate_cnt;
+
+    /* Results */
+    unsigned		 notify_cnt;
+} app;
+
+
+static pj_bool_t bench_on_rx_request(pjsip_rx_data *rdata);
+
+/* Count the NOTIFY requests that are sent, and serve the subscriptions
+ * with --evsub.
+ */
+static pj_status_t on_tx_request(pjsip_tx_data *tdata)
+{
+    if (pjsip_method_cmp(&tdata->msg->line.req.method,
+			 pjsip_get_notify_method()) == 0)
+    {
+	++app.notify_cnt;
+    }
+    return PJ_SUCCESS;
+}
+
+static pjsip_module mod_bench =
+{
+    NULL, NULL,				/* prev, next.		*/
+    { "mod-evsubbench", 14 },		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_APPLICATION,	/* Priority	        */
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &bench_on_rx_request,		/* on_rx_request()	*/
+    NULL,				/* on_rx_response()	*/
+    &on_tx_request,			/* on_tx_request.	*/
+    NULL,				/* on_tx_response()	*/
+    NULL,				/* on_tsx_state()	*/
+};
+
+
+/* Render the body of a resource, padded to the size of a typical
+ * dialog-info or PIDF document.
+ */
+static void render_body(pj_pool_t *pool, unsigned res, pj_str_t *body)
+{
+    body->ptr = (char*) pj_pool_alloc(pool, BODY_SIZE);
+    body->slen = pj_ansi_snprintf(body->ptr, BODY_SIZE, "res%u v%u\n",
+				  res, app.version);
+    pj_memset(body->ptr + body->slen, '.', BODY_SIZE - body->slen - 1);
+    body->ptr[BODY_SIZE - 1] = '\n';
+    body->slen = BODY_SIZE;
+}
+
+
+/*
+ * Subscriber side.
+ */
+static void uac_on_evsub_state(pjsip_evsub *sub, pjsip_event *event)
+{
+    struct watcher *w;
+
+    PJ_UNUSED_ARG(event);
+
+    w = (struct watcher*) pjsip_evsub_get_mod_data(sub, mod_bench.id);
+    if (!w)
+	return;
+
+    if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_ACTIVE &&
+	!w->active)
+    {
+	w->active = PJ_TRUE;
+	++app.active_cnt;
+    } else if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED) {
+	pjsip_evsub_set_mod_data(sub, mod_bench.id, NULL);
+	w->sub = NULL;
+    }
+}
+
+static void uac_on_rx_notify(pjsip_evsub *sub, pjsip_rx_data *rdata,
+			     int *p_st_code, pj_str_t **p_st_text,
+			     pjsip_hdr *res_hdr, pjsip_msg_body **p_body)
+{
+    struct watcher *w;
+    pjsip_msg_body *body = rdata->msg_info.msg->body;
+    char *v;
+
+    PJ_UNUSED_ARG(p_st_code);
+    PJ_UNUSED_ARG(p_st_text);
+    PJ_UNUSED_ARG(res_hdr);
+    PJ_UNUSED_ARG(p_body);
+
+    w = (struct watcher*) pjsip_evsub_get_mod_data(sub, mod_bench.id);
+    if (!w || !body || body->len < 4)
+	return;
+
+    v = pj_memchr(body->data, 'v', body->len);
+    if (v) {
+	unsigned version = (unsigned) strtoul(v + 1, NULL, 10);
+
+	if (version == app.version && w->version != app.version)
+	    ++app.uptodate_cnt;
+	w->version = version;
+    }
+}
+
+static void uac_on_client_refresh(pjsip_evsub *sub)
+{
+    PJ_UNUSED_ARG(sub);
+}
+
+static pjsip_evsub_user uac_cb =
+{
+    &uac_on_evsub_state,
+    NULL,
+    NULL,
+    &uac_on_rx_notify,
+    &uac_on_client_refresh,
+    NULL
+};
+
+static pj_status_t subscribe(unsigned index)
+{
+    char local[64], target[64];
+    pj_str_t local_uri, target_uri, event = pj_str(EVENT);
+    pjsip_dialog *dlg;
+    pjsip_tx_data *tdata;
+    struct watcher *w = &app.watchers[index];
+    pj_status_t status;
+
+    pj_ansi_snprintf(local, sizeof(local), "<sip:w%u@127.0.0.1:%d>",
+		     index, app.port);
+    pj_ansi_snprintf(target, sizeof(target), "sip:res%u@127.0.0.1:%d",
+		     index % app.res_cnt, app.port);
+    local_uri = pj_str(local);
+    target_uri = pj_str(target);
+
+    status = pjsip_dlg_create_uac(pjsip_ua_instance(), &local_uri,
+				  &local_uri, &target_uri, &target_uri, &dlg);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = pjsip_evsub_create_uac(dlg, &uac_cb, &event, 0, &w->sub);
+    if (status != PJ_SUCCESS) {
+	pjsip_dlg_terminate(dlg);
+	return status;
+    }
+
+    pjsip_evsub_set_mod_data(w->sub, mod_bench.id, w);
+
+    status = pjsip_evsub_initiate(w->sub, NULL, 3600, &tdata);
+    if (status == PJ_SUCCESS)
+	status = pjsip_evsub_send_request(w->sub, tdata);
+
+    return status;
+}
+
+
+/*
+ * Notifier with a plain pjsip_evsub session per watcher (--evsub).
+ */
+static void uas_on_evsub_state(pjsip_evsub *sub, pjsip_event *event)
+{
+    struct notifier *n;
+
+    PJ_UNUSED_ARG(event);
+
+    if (pjsip_evsub_get_state(sub) != PJSIP_EVSUB_STATE_TERMINATED)
+	return;
+
+    n = (struct notifier*) pjsip_evsub_get_mod_data(sub, mod_bench.id);
+    if (n) {
+	pj_list_erase(n);
+	pjsip_evsub_set_mod_data(sub, mod_bench.id, NULL);
+    }
+}
+
+static void uas_on_rx_refresh(pjsip_evsub *sub, pjsip_rx_data *rdata,
+			      int *p_st_code, pj_str_t **p_st_text,
+			      pjsip_hdr *res_hdr, pjsip_msg_body **p_body)
+{
+    PJ_UNUSED_ARG(sub);
+    PJ_UNUSED_ARG(rdata);
+    PJ_UNUSED_ARG(p_st_code);
+    PJ_UNUSED_ARG(p_st_text);
+    PJ_UNUSED_ARG(res_hdr);
+    PJ_UNUSED_ARG(p_body);
+}
+
+static pjsip_evsub_user uas_cb =
+{
+    &uas_on_evsub_state,
+    NULL,
+    &uas_on_rx_refresh,
+    NULL,
+    NULL,
+    NULL
+};
+
+/* Render the body for one watcher and send NOTIFY */
+static pj_status_t uas_notify(pjsip_evsub *sub, unsigned res)
+{
+    pj_str_t type = pj_str("text"), subtype = pj_str("plain"), body;
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    status = pjsip_evsub_notify(sub, PJSIP_EVSUB_STATE_ACTIVE, NULL, NULL,
+				&tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    render_body(tdata->pool, res, &body);
+    tdata->msg->body = pjsip_msg_body_create(tdata->pool, &type, &subtype,
+					     &body);
+
+    return pjsip_evsub_send_request(sub, tdata);
+}
+
+static pj_bool_t bench_on_rx_request(pjsip_rx_data *rdata)
+{
+    pj_str_t contact;
+    char contact_buf[64];
+    pjsip_sip_uri *uri;
+    pjsip_dialog *dlg;
+    struct notifier *n;
+    unsigned res;
+    pj_status_t status;
+
+    if (!app.use_evsub || rdata->msg_info.to->tag.slen ||
+	pjsip_method_cmp(&rdata->msg_info.msg->line.req.method,
+			 pjsip_get_subscribe_method()) != 0)
+    {
+	return PJ_FALSE;
+    }
+
+    uri = (pjsip_sip_uri*)
+	  pjsip_uri_get_uri(rdata->msg_info.msg->line.req.uri);
+    if (uri->user.slen < 4)
+	return PJ_FALSE;
+    res = (unsigned) strtoul(uri->user.ptr + 3, NULL, 10);
+    if (res >= app.res_cnt)
+	return PJ_FALSE;
+
+    pj_ansi_snprintf(contact_buf, sizeof(contact_buf),
+		     "<sip:127.0.0.1:%d>", app.port);
+    contact = pj_str(contact_buf);
+
+    status = pjsip_dlg_create_uas(pjsip_ua_instance(), rdata, &contact,
+				  &dlg);
+    if (status != PJ_SUCCESS) {
+	pjsip_endpt_respond_stateless(app.sip_endpt, rdata, 500, NULL,
+				      NULL, NULL);
+	return PJ_TRUE;
+    }
+
+    n = PJ_POOL_ZALLOC_T(dlg->pool, struct notifier);
+    status = pjsip_evsub_create_uas(dlg, &uas_cb, rdata, 0, &n->sub);
+    if (status != PJ_SUCCESS) {
+	pjsip_dlg_respond(dlg, rdata, 500, NULL, NULL, NULL);
+	return PJ_TRUE;
+    }
+
+    pjsip_evsub_set_mod_data(n->sub, mod_bench.id, n);
+    pj_list_push_back(&app.res_list[res], n);
+
+    status = pjsip_evsub_accept(n->sub, rdata, 200, NULL);
+    if (status == PJ_SUCCESS)
+	uas_notify(n->sub, res);
+
+    return PJ_TRUE;
+}
+
+
+/* Change the state of all resources */
+static void change_state(void)
+{
+    unsigned i;
+
+    ++app.version;
+    app.uptodate_cnt = 0;
+
+    for (i=0; i<app.res_cnt; ++i) {
+	if (app.use_evsub) {
+	    struct notifier *n = app.res_list[i].next;
+
+	    while (n != &app.res_list[i]) {
+		struct notifier *next = n->next;
+		uas_notify(n->sub, i);
+		n = next;
+	    }
+	} else {
+	    char name[64];
+	    pj_str_t res, body;
+	    pj_pool_t *pool;
+
+	    pj_ansi_snprintf(name, sizeof(name), "res%u@127.0.0.1", i);
+	    res = pj_str(name);
+
+	    pool = pj_pool_create(&app.cp.factory, "body", 512, 512, NULL);
+	    render_body(pool, i, &body);
+	    pjsip_evsub_srv_set_state(app.srv, &res, &body);
+	    pj_pool_release(pool);
+	}
+    }
+}
+
+
+static void poll_events(unsigned msec)
+{
+    pj_time_val timeout = { 0, 0 };
+    pj_time_val end, now;
+
+    pj_gettickcount(&end);
+    pj_time_val_normalize(&end);
+    end.msec += msec;
+    pj_time_val_normalize(&end);
+
+    do {
+	timeout.msec = 10;
+	pjsip_endpt_handle_events(app.sip_endpt, &timeout);
+	pj_gettickcount(&now);
+    } while (PJ_TIME_VAL_LT(now, end));
+}
+
+
+static void usage(void)
+{
+    puts("Usage:");
+    puts("  evsubbench [OPTIONS]");
+    puts("");
+    puts("Options:");
+    puts("  --count, -n N          Number of watchers (default: 1000)");
+    puts("  --resources, -r N      Number of resources (default: 10)");
+    puts("  --changes, -c N        Number of state changes (default: 10)");
+    puts("  --burst, -b N          Changes per round, only the last one");
+    puts("                         needs to reach the watchers (default: 1)");
+    puts("  --max-pending, -m N    Maximum outstanding NOTIFY of the");
+    puts("                         subscription server");
+    puts("  --evsub, -e            Use one pjsip_evsub per watcher instead");
+    puts("                         of the subscription server");
+    puts("  --local-port, -p PORT  Local UDP port (default: 5080)");
+    puts("  --help, -h             Show this help page");
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct pj_getopt_option long_options[] = {
+	{ "count",	1, 0, 'n' },
+	{ "resources",	1, 0, 'r' },
+	{ "changes",	1, 0, 'c' },
+	{ "burst",	1, 0, 'b' },
+	{ "max-pending",1, 0, 'm' },
+	{ "evsub",	0, 0, 'e' },
+	{ "local-port",	1, 0, 'p' },
+	{ "help",	0, 0, 'h' },
+	{ NULL, 0, 0, 0 }
+    };
+    pj_sockaddr_in addr;
+    pj_time_val start, now;
+    pj_size_t mem_before;
+    unsigned notify_before, elapsed, i, j;
+    int c, option_index;
+    pj_status_t status;
+
+    app.count = 1000;
+    app.res_cnt = 10;
+    app.changes = 10;
+    app.burst = 1;
+    app.port = 5080;
+
+    pj_optind = 0;
+    while ((c = pj_getopt_long(argc, argv, "n:r:c:b:m:ep:h", long_options,
+			       &option_index)) != -1)
+    {
+	switch (c) {
+	case 'n':
+	    app.count = atoi(pj_optarg);
+	    break;
+	case 'r':
+	    app.res_cnt = atoi(pj_optarg);
+	    break;
+	case 'c':
+	    app.changes = atoi(pj_optarg);
+	    break;
+	case 'b':
+	    app.burst = atoi(pj_optarg);
+	    break;
+	case 'm':
+	    app.max_pending = atoi(pj_optarg);
+	    break;
+	case 'e':
+	    app.use_evsub = PJ_TRUE;
+	    break;
+	case 'p':
+	    app.port = atoi(pj_optarg);
+	    break;
+	case 'h':
+	    usage();
+	    return 0;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+
+    if (pj_optind != argc || app.count == 0 || app.res_cnt == 0 ||
+	app.burst == 0)
+    {
+	usage();
+	return 1;
+    }
+
+    /* Init stack */
+    pj_init();
+    pjlib_util_init();
+    pj_log_set_level(3);
+    pj_caching_pool_init(&app.cp, &pj_pool_factory_default_policy, 0);
+    app.pool = pj_pool_create(&app.cp.factory, "evsubbench", 4000, 4000,
+			      NULL);
+
+    /* Both sides of every subscription are in this process, so size the
+     * transaction table for the NOTIFY transactions of all of them.
+     */
+    if (pjsip_cfg()->tsx.max_count < app.count * 4)
+	pjsip_cfg()->tsx.max_count = app.count * 4;
+
+    status = pjsip_endpt_create(&app.cp.factory, NULL, &app.sip_endpt);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+    pj_sockaddr_in_init(&addr, NULL, (pj_uint16_t)app.port);
+    status = pjsip_udp_transport_start(app.sip_endpt, &addr, NULL, 1, NULL);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to start UDP transport", status);
+	return 1;
+    }
+
+    status = pjsip_tsx_layer_init_module(app.sip_endpt);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+    status = pjsip_ua_init_module(app.sip_endpt, NULL);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+    status = pjsip_evsub_init_module(app.sip_endpt);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+    status = pjsip_endpt_register_module(app.sip_endpt, &mod_bench);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+    /* Create the notifier */
+    if (app.use_evsub) {
+	pj_str_t event = pj_str(EVENT), accept = pj_str(CONTENT);
+
+	status = pjsip_evsub_register_pkg(&mod_bench, &event, 3600, 1,
+					  &accept);
+	app.res_list = (struct notifier*)
+		       pj_pool_calloc(app.pool, app.res_cnt,
+				      sizeof(struct notifier));
+	for (i=0; i<app.res_cnt; ++i)
+	    pj_list_init(&app.res_list[i]);
+    } else {
+	pjsip_evsub_srv_param param;
+
+	pjsip_evsub_srv_param_default(&param);
+	param.event = pj_str(EVENT);
+	param.content_type = pj_str(CONTENT);
+	param.expires = 3600;
+	if (app.max_pending)
+	    param.max_pending = app.max_pending;
+
+	status = pjsip_evsub_srv_create(app.sip_endpt, &param, &app.srv);
+	if (status == PJ_SUCCESS)
+	    change_state();
+    }
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to create notifier", status);
+	return 1;
+    }
+
+    /* Subscribe the watchers, a few at a time */
+    PJ_LOG(3,(THIS_FILE, "Subscribing %u watchers to %u resources with "
+			 "%s..", app.count, app.res_cnt,
+	      (app.use_evsub ? "pjsip_evsub" : "pjsip_evsub_srv")));
+
+    app.watchers = (struct watcher*)
+		   pj_pool_calloc(app.pool, app.count, sizeof(struct watcher));
+    mem_before = app.cp.used_size;
+
+    pj_gettickcount(&start);
+    for (i=0; i<app.count; ++i) {
+	status = subscribe(i);
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Unable to subscribe", status);
+	    return 1;
+	}
+	if (i % 100 == 99) {
+	    do {
+		poll_events(10);
+	    } while (app.active_cnt + 50 < i);
+	}
+    }
+
+    do {
+	poll_events(10);
+	pj_gettickcount(&now);
+	PJ_TIME_VAL_SUB(now, start);
+    } while (app.active_cnt < app.count && now.sec < 120);
+
+    /* Let the initial NOTIFY transactions complete */
+    poll_events(500);
+
+    elapsed = PJ_TIME_VAL_MSEC(now);
+    PJ_LOG(3,(THIS_FILE, "%u of %u watchers subscribed in %u.%03u s, "
+			 "%lu bytes per watcher",
+	      app.active_cnt, app.count, elapsed / 1000, elapsed % 1000,
+	      (unsigned long)(app.cp.used_size - mem_before) / app.count));
+
+    /* Change the states and wait until all watchers are up to date */
+    notify_before = app.notify_cnt;
+    pj_gettickcount(&start);
+
+    for (i=0; i<app.changes; ++i) {
+	for (j=0; j<app.burst; ++j)
+	    change_state();
+
+	do {
+	    pj_time_val timeout = { 0, 1 };
+
+	    pjsip_endpt_handle_events(app.sip_endpt, &timeout);
+	    pj_gettickcount(&now);
+	    PJ_TIME_VAL_SUB(now, start);
+	} while (app.uptodate_cnt < app.active_cnt && now.sec < 120);
+
+	if (app.uptodate_cnt < app.active_cnt) {
+	    PJ_LOG(1,(THIS_FILE, "Timed out, only %u watchers are up to date",
+		      app.uptodate_cnt));
+	    break;
+	}
+    }
+
+    pj_gettickcount(&now);
+    PJ_TIME_VAL_SUB(now, start);
+    elapsed = PJ_TIME_VAL_MSEC(now);
+    if (elapsed == 0)
+	elapsed = 1;
+
+    PJ_LOG(3,(THIS_FILE, "%u rounds of %u changes in %u.%03u s: "
+			 "%u ms per round, %u NOTIFY sent (%u/s)",
+	      i, app.burst, elapsed / 1000, elapsed % 1000,
+	      (i ? elapsed / i : 0), app.notify_cnt - notify_before,
+	      (unsigned)((pj_uint64_t)(app.notify_cnt - notify_before) *
+			 1000 / elapsed)));
+
+    if (app.srv) {
+	pjsip_evsub_srv_stat stat;
+
+	pjsip_evsub_srv_get_stat(app.srv, &stat);
+	PJ_LOG(3,(THIS_FILE, "Server: %u changes coalesced",
+		  stat.coalesced));
+    }
+
+    /* Clean up */
+    if (app.srv)
+	pjsip_evsub_srv_destroy(app.srv);
+    for (i=0; i<app.count; ++i) {
+	if (app.watchers[i].sub)
+	    pjsip_evsub_terminate(app.watchers[i].sub, PJ_FALSE);
+    }
+    if (app.use_evsub) {
+	for (i=0; i<app.res_cnt; ++i) {
+	    while (!pj_list_empty(&app.res_list[i])) {
+		struct notifier *n = app.res_list[i].next;
+
+		pj_list_erase(n);
+		pjsip_evsub_set_mod_data(n->sub, mod_bench.id, NULL);
+		pjsip_evsub_terminate(n->sub, PJ_FALSE);
+	    }
+	}
+    }
+    poll_events(100);
+
+    pjsip_endpt_destroy(app.sip_endpt);
+    pj_pool_release(app.pool);
+    pj_caching_pool_destroy(&app.cp);
+    pj_shutdown();
+
+    return 0;
+}
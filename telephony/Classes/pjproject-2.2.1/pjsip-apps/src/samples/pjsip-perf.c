@@ -49,6 +49,28 @@
  *    Also for every call, server will limit the call duration to
  *    10 seconds, on which the call will be terminated if the client
  *    doesn't hangup the call.
+ *  - URL with "3" as the user part will be forwarded statelessly by
+ *    the server, acting as proxy, to its own "0" URL, by cloning and
+ *    printing the message.
+ *  - URL with "4" as the user part is forwarded as "3", but the received
+ *    message is forwarded with in-place edits, without reprinting it.
+ *    Comparing the request rate of "3" and "4" measures the gain of
+ *    the raw forwarding path.
+ *
+ * With <b>--workers=N</b>, incoming messages are processed by N endpoint
+ * dispatcher workers, with all messages of a call handled by the same
+ * worker (see #pjsip_endpt_start_dispatcher()). Running the call
+ * benchmark against servers started with 1, 4, 8, and 16 workers shows
+ * how call processing scales with the number of workers.
+ *
+ * With <b>--overload</b>, the server runs the overload control (see
+ * #pjsip_overload_init_module()), which rejects excess new requests
+ * statelessly with 503/Retry-After. To see its effect, start the server
+ * with <b>--overload --workers=4</b> and run the client with a large
+ * window and increasing <b>--rate=N</b>: past the saturation point the
+ * goodput (2xx responses per second) reported by the client stays flat,
+ * while the excess requests get 503, instead of collapsing as the server
+ * queues work it can not finish in time.
  *    
  *
  *
@@ -115,6 +137,8 @@ struct srv_state
     unsigned	    stateless_cnt;
     unsigned	    stateful_cnt;
     unsigned	    call_cnt;
+    unsigned	    proxy_cnt;
+    unsigned	    rejected_cnt;
 };
 
 
@@ -135,6 +159,8 @@ struct app
     pj_bool_t		 thread_quit;
     unsigned		 thread_count;
     pj_thread_t		*thread[16];
+    unsigned		 worker_count;
+    pj_bool_t		 overload;
 
     pj_bool_t		 real_sdp;
     pjmedia_sdp_session *dummy_sdp;
@@ -146,6 +172,7 @@ struct app
 	pj_str_t	     dst_uri;
 	pj_bool_t	     stateless;
 	unsigned	     timeout;
+	unsigned	     rate;
 	unsigned	     job_count,
 			     job_submitted, 
 			     job_finished,
@@ -247,6 +274,172 @@ static pj_bool_t mod_stateless_on_rx_request(pjsip_rx_data *rdata)
 }
 
 
+/**************************************************************************
+ * STATELESS PROXY
+ */
+static pj_bool_t mod_proxy_on_rx_request(pjsip_rx_data *rdata);
+static pj_bool_t mod_proxy_on_rx_response(pjsip_rx_data *rdata);
+
+/* Module to forward requests to "3" and "4" URLs to the stateless
+ * server URL of this instance, and to forward their responses back.
+ */
+static pjsip_module mod_proxy =
+{
+    NULL, NULL,			    /* prev, next.		*/
+    { "mod-proxy", 9 },		    /* Name.			*/
+    -1,				    /* Id			*/
+    PJSIP_MOD_PRIORITY_UA_PROXY_LAYER, /* Priority		*/
+    NULL,			    /* load()			*/
+    NULL,			    /* start()			*/
+    NULL,			    /* stop()			*/
+    NULL,			    /* unload()			*/
+    &mod_proxy_on_rx_request,	    /* on_rx_request()		*/
+    &mod_proxy_on_rx_response,	    /* on_rx_response()		*/
+    NULL,			    /* on_tx_request.		*/
+    NULL,			    /* on_tx_response()		*/
+    NULL,			    /* on_tsx_state()		*/
+};
+
+/* Get the proxy mode from the user part of the URI: 3 for the standard
+ * path, 4 for the raw forwarding path, or zero if not to be proxied.
+ */
+static int get_proxy_mode(const pjsip_uri *uri)
+{
+    const pj_str_t std_user = { "3", 1 };
+    const pj_str_t raw_user = { "4", 1 };
+    const pjsip_sip_uri *sip_uri;
+
+    uri = (const pjsip_uri*) pjsip_uri_get_uri(uri);
+    if (!PJSIP_URI_SCHEME_IS_SIP(uri) && !PJSIP_URI_SCHEME_IS_SIPS(uri))
+	return 0;
+
+    sip_uri = (const pjsip_sip_uri*) uri;
+    if (pj_strcmp(&sip_uri->user, &std_user)==0)
+	return 3;
+    if (pj_strcmp(&sip_uri->user, &raw_user)==0)
+	return 4;
+    return 0;
+}
+
+static pj_bool_t mod_proxy_on_rx_request(pjsip_rx_data *rdata)
+{
+    pjsip_transport_type_e tp_type;
+    char target[128];
+    pj_str_t target_uri;
+    int mode;
+    pj_status_t status;
+
+    mode = get_proxy_mode(rdata->msg_info.msg->line.req.uri);
+    if (mode == 0)
+	return PJ_FALSE;
+
+    if (rdata->msg_info.max_fwd && rdata->msg_info.max_fwd->ivalue <= 0) {
+	pjsip_endpt_respond_stateless(app.sip_endpt, rdata, 
+				      PJSIP_SC_TOO_MANY_HOPS, NULL,
+				      NULL, NULL);
+	return PJ_TRUE;
+    }
+
+    /* Forward to the stateless server URL of this instance */
+    tp_type = (app.use_tcp ? PJSIP_TRANSPORT_TCP : PJSIP_TRANSPORT_UDP);
+    target_uri.ptr = target;
+    target_uri.slen = pj_ansi_snprintf(target, sizeof(target),
+				       "sip:0@%.*s:%d%s",
+				       (int)app.local_addr.slen,
+				       app.local_addr.ptr,
+				       app.local_port,
+				       (app.use_tcp ? ";transport=tcp" : ""));
+
+    if (mode == 3) {
+	pjsip_tx_data *tdata;
+	pjsip_uri *uri;
+
+	uri = pjsip_parse_uri(rdata->tp_info.pool, target, target_uri.slen,
+			      0);
+	status = pjsip_endpt_create_request_fwd(app.sip_endpt, rdata, uri,
+						NULL, 0, &tdata);
+	if (status == PJ_SUCCESS) {
+	    status = pjsip_endpt_send_request_stateless(app.sip_endpt, tdata,
+							NULL, NULL);
+	}
+    } else {
+	pjsip_fwd_raw_param param;
+	pj_str_t host = app.local_addr;
+
+	pjsip_fwd_raw_param_default(&param);
+	param.tp_type = tp_type;
+	status = pj_sockaddr_init(pj_AF_INET(), &param.dst_addr, &host,
+				  (pj_uint16_t)app.local_port);
+	param.dst_addr_len = pj_sockaddr_get_len(&param.dst_addr);
+	param.uri = target_uri;
+	if (status == PJ_SUCCESS) {
+	    status = pjsip_endpt_fwd_raw_request(app.sip_endpt, rdata, &param,
+						 NULL, NULL);
+	}
+    }
+
+    if (status != PJ_SUCCESS && status != PJ_EPENDING) {
+	app_perror(THIS_FILE, "Error forwarding request", status);
+	return PJ_TRUE;
+    }
+
+    app.server.cur_state.proxy_cnt++;
+    return PJ_TRUE;
+}
+
+static pj_bool_t mod_proxy_on_rx_response(pjsip_rx_data *rdata)
+{
+    pjsip_msg *msg = rdata->msg_info.msg;
+    int mode;
+    pj_status_t status;
+
+    /* Only responses with our Via on top of the client's */
+    if (pjsip_msg_find_hdr(msg, PJSIP_H_VIA, rdata->msg_info.via->next)==NULL)
+	return PJ_FALSE;
+
+    mode = get_proxy_mode(rdata->msg_info.to->uri);
+    if (mode == 0)
+	return PJ_FALSE;
+
+    if (mode == 3) {
+	pjsip_response_addr res_addr;
+	pjsip_tx_data *tdata;
+	pjsip_via_hdr *hvia;
+
+	/* Strips our Via */
+	status = pjsip_endpt_create_response_fwd(app.sip_endpt, rdata, 0,
+						 &tdata);
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Error creating response", status);
+	    return PJ_TRUE;
+	}
+
+	hvia = (pjsip_via_hdr*) pjsip_msg_find_hdr(tdata->msg, PJSIP_H_VIA,
+						   NULL);
+	pj_bzero(&res_addr, sizeof(res_addr));
+	res_addr.dst_host.type = 
+	    pjsip_transport_get_type_from_name(&hvia->transport);
+	res_addr.dst_host.flag = 
+	    pjsip_transport_get_flag_from_type(res_addr.dst_host.type);
+	res_addr.dst_host.addr.host = hvia->recvd_param.slen ?
+				      hvia->recvd_param : hvia->sent_by.host;
+	res_addr.dst_host.addr.port = hvia->rport_param > 0 ?
+				      hvia->rport_param : hvia->sent_by.port;
+
+	status = pjsip_endpt_send_response(app.sip_endpt, &res_addr, tdata,
+					   NULL, NULL);
+    } else {
+	status = pjsip_endpt_fwd_raw_response(app.sip_endpt, rdata,
+					      NULL, NULL);
+    }
+
+    if (status != PJ_SUCCESS && status != PJ_EPENDING)
+	app_perror(THIS_FILE, "Error forwarding response", status);
+
+    return PJ_TRUE;
+}
+
+
 /**************************************************************************
  * STATEFUL SERVER
  */
@@ -855,6 +1048,10 @@ static pj_status_t init_sip()
     status = pjsip_endpt_register_module( app.sip_endpt, &mod_stateless_server);
     PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
 
+    /* Register stateless proxy module */
+    status = pjsip_endpt_register_module( app.sip_endpt, &mod_proxy);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
+
     /* Register default responder module */
     status = pjsip_endpt_register_module( app.sip_endpt, &mod_responder);
     PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
@@ -868,6 +1065,27 @@ static pj_status_t init_sip()
     status = pjsip_endpt_register_module( app.sip_endpt, &mod_call_server);
     PJ_ASSERT_RETURN(status == PJ_SUCCESS, status);
 
+    /* Start dispatcher workers */
+    if (app.worker_count) {
+	pjsip_endpt_dispatcher_param dsp_param;
+
+	pjsip_endpt_dispatcher_param_default(&dsp_param);
+	dsp_param.worker_cnt = app.worker_count;
+	status = pjsip_endpt_start_dispatcher(app.sip_endpt, &dsp_param);
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Unable to start dispatcher", status);
+	    return status;
+	}
+    }
+
+    /* Start overload control */
+    if (app.overload) {
+	status = pjsip_overload_init_module(app.sip_endpt, NULL);
+	if (status != PJ_SUCCESS) {
+	    app_perror(THIS_FILE, "Unable to init overload control", status);
+	    return status;
+	}
+    }
 
     /* Done */
     return PJ_SUCCESS;
@@ -1132,6 +1350,9 @@ static void usage(void)
 	"                           [default: stateful]\n"
 	"   --timeout=SEC, -t       Set client timeout [default=60 sec]\n"
 	"   --window=COUNT, -w      Set maximum outstanding job [default: %d]\n"
+	"   --rate=N                Send N requests per second regardless of the\n"
+	"                           responses, within the window [default: as\n"
+	"                           fast as the window allows]\n"
 	"\n"
 	"SDP options (client and server):\n"
 	"   --real-sdp              Generate real SDP from pjmedia, and also perform\n"
@@ -1143,9 +1364,14 @@ static void usage(void)
 	"                           client, you must add ;transport=tcp parameter to URL\n"
 	"                           [default: no]\n"
 	"   --thread-count=N        Set number of worker threads [default=1]\n"
+	"   --workers=N             Process incoming messages in N dispatcher\n"
+	"                           workers, keeping each call in one worker\n"
+	"                           [default=0, process in polling threads]\n"
 	"   --trying                Send 100/Trying response (server, default no)\n"
 	"   --ringing               Send 180/Ringing response (server, default no)\n"
 	"   --delay=MS, -d          Delay answering call by MS (server, default no)\n"
+	"   --overload              Reject excess new requests with 503 when\n"
+	"                           overloaded (server, default no)\n"
 	"\n"
 	"Misc options:\n"
 	"   --help, -h              Display this screen\n"
@@ -1154,7 +1380,15 @@ static void usage(void)
 	"When started as server, pjsip-perf can be contacted on the following URIs:\n"
 	"   - sip:0@server-addr     To handle requests statelessly.\n"
 	"   - sip:1@server-addr     To handle requests statefully.\n"
-	"   - sip:2@server-addr     To handle INVITE call.\n",
+	"   - sip:2@server-addr     To handle INVITE call.\n"
+	"   - sip:3@server-addr     To be proxied statelessly to sip:0 by cloning\n"
+	"                           and printing the message.\n"
+	"   - sip:4@server-addr     To be proxied statelessly to sip:0 with raw\n"
+	"                           forwarding (compare the rate with sip:3).\n"
+	"\n"
+	"To test overload control, start the server with --overload --workers=4\n"
+	"and increase the client --rate (with large --window) past the capacity\n"
+	"of the server: the goodput stays flat and the excess gets 503.\n",
 	DEFAULT_COUNT, JOB_WINDOW);
 }
 
@@ -1168,11 +1402,15 @@ static int my_atoi(const char *s)
 
 static pj_status_t init_options(int argc, char *argv[])
 {
-    enum { OPT_THREAD_COUNT = 1, OPT_REAL_SDP, OPT_TRYING, OPT_RINGING };
+    enum { OPT_THREAD_COUNT = 1, OPT_REAL_SDP, OPT_TRYING, OPT_RINGING,
+	   OPT_WORKERS, OPT_OVERLOAD, OPT_RATE };
     struct pj_getopt_option long_options[] = {
 	{ "local-port",	    1, 0, 'p' },
 	{ "count",	    1, 0, 'c' },
 	{ "thread-count",   1, 0, OPT_THREAD_COUNT },
+	{ "workers",	    1, 0, OPT_WORKERS },
+	{ "overload",	    0, 0, OPT_OVERLOAD },
+	{ "rate",	    1, 0, OPT_RATE },
 	{ "method",	    1, 0, 'm' },
 	{ "help",	    0, 0, 'h' },
 	{ "stateless",	    0, 0, 's' },
@@ -1234,6 +1472,26 @@ static pj_status_t init_options(int argc, char *argv[])
 	    }
 	    break;
 
+	case OPT_WORKERS:
+	    app.worker_count = my_atoi(pj_optarg);
+	    if (app.worker_count > 64) {
+		PJ_LOG(3,(THIS_FILE, "Invalid --workers %s", pj_optarg));
+		return -1;
+	    }
+	    break;
+
+	case OPT_OVERLOAD:
+	    app.overload = PJ_TRUE;
+	    break;
+
+	case OPT_RATE:
+	    app.client.rate = my_atoi(pj_optarg);
+	    if (app.client.rate == 0) {
+		PJ_LOG(3,(THIS_FILE, "Invalid --rate %s", pj_optarg));
+		return -1;
+	    }
+	    break;
+
 	case 'm':
 	    {
 		pj_str_t temp = pj_str((char*)pj_optarg);
@@ -1466,6 +1724,30 @@ static int client_thread(void *arg)
 	    ++cycle;
 	}
 
+	/* Pace the requests at the specified rate */
+	if (app.client.rate) {
+	    pj_time_val due = app.client.first_request;
+	    pj_uint64_t msec;
+
+	    msec = (pj_uint64_t)app.client.job_submitted * 1000 /
+		   app.client.rate;
+	    due.sec += (long)(msec / 1000);
+	    due.msec += (long)(msec % 1000);
+	    pj_time_val_normalize(&due);
+
+	    pj_gettimeofday(&now);
+	    while (PJ_TIME_VAL_LT(now, due) && !app.thread_quit) {
+		pj_time_val wait = due;
+
+		PJ_TIME_VAL_SUB(wait, now);
+		if (PJ_TIME_VAL_MSEC(wait) > 10) {
+		    wait.sec = 0;
+		    wait.msec = 10;
+		}
+		pjsip_endpt_handle_events(app.sip_endpt, &wait);
+		pj_gettimeofday(&now);
+	    }
+	}
 
 	/* Submit one job */
 	if (app.client.method.id == PJSIP_INVITE_METHOD) {
@@ -1602,8 +1884,9 @@ static int server_thread(void *arg)
 	    if (PJ_TIME_VAL_GTE(now, next_report)) {
 		pj_time_val tmp;
 		unsigned msec;
-		unsigned stateless, stateful, call;
+		unsigned stateless, stateful, call, proxy;
 		char str_stateless[32], str_stateful[32], str_call[32];
+		char str_proxy[32];
 
 		tmp = now;
 		PJ_TIME_VAL_SUB(tmp, last_report);
@@ -1616,15 +1899,34 @@ static int server_thread(void *arg)
 		stateless = app.server.cur_state.stateless_cnt - app.server.prev_state.stateless_cnt;
 		stateful = app.server.cur_state.stateful_cnt - app.server.prev_state.stateful_cnt;
 		call = app.server.cur_state.call_cnt - app.server.prev_state.call_cnt;
+		proxy = app.server.cur_state.proxy_cnt - app.server.prev_state.proxy_cnt;
 
 		good_number(str_stateless, app.server.cur_state.stateless_cnt);
 		good_number(str_stateful, app.server.cur_state.stateful_cnt);
 		good_number(str_call, app.server.cur_state.call_cnt);
+		good_number(str_proxy, app.server.cur_state.proxy_cnt);
 
-		printf("Total(rate): stateless:%s (%d/s), statefull:%s (%d/s), call:%s (%d/s)       \r",
+		printf("Total(rate): stateless:%s (%d/s), statefull:%s (%d/s), call:%s (%d/s), proxied:%s (%d/s)",
 		       str_stateless, stateless*1000/msec,
 		       str_stateful, stateful*1000/msec,
-		       str_call, call*1000/msec);
+		       str_call, call*1000/msec,
+		       str_proxy, proxy*1000/msec);
+
+		if (app.overload) {
+		    pjsip_overload_stat ovl_stat;
+		    char str_rejected[32];
+		    unsigned rejected;
+
+		    pjsip_overload_get_stat(&ovl_stat);
+		    app.server.cur_state.rejected_cnt = ovl_stat.rejected;
+		    rejected = app.server.cur_state.rejected_cnt -
+			       app.server.prev_state.rejected_cnt;
+		    good_number(str_rejected, ovl_stat.rejected);
+
+		    printf(", rejected:%s (%d/s) level:%d%%", str_rejected,
+			   rejected*1000/msec, ovl_stat.level);
+		}
+		printf("       \r");
 		fflush(stdout);
 
 		app.server.prev_state = app.server.cur_state;
@@ -1796,6 +2098,26 @@ int main(int argc, char *argv[])
 			app.client.stat_max_window);
 	write_report(report);
 
+	/* Goodput, i.e. successful responses, and rejected requests */
+	{
+	    unsigned good_cnt = 0;
+
+	    for (i=200; i<300; ++i)
+		good_cnt += app.client.response_codes[i];
+
+	    pj_ansi_sprintf(report, "Goodput: %d 2xx responses (rate=%d/sec), "
+			    "%d rejected with 503",
+			    good_cnt, good_cnt*1000/msec_res,
+			    app.client.response_codes[503]);
+	    write_report(report);
+	}
+
+	if (app.worker_count) {
+	    pj_ansi_sprintf(report, "Dispatcher workers: %d",
+			    app.worker_count);
+	    write_report(report);
+	}
+
 
     } else {
 	/* Server mode */
@@ -1808,7 +2130,17 @@ int main(int argc, char *argv[])
 	printf("Receiving requests on the following URIs:\n"
 	       "  sip:0@%.*s:%d%s    for stateless handling\n"
 	       "  sip:1@%.*s:%d%s    for stateful handling\n"
-	       "  sip:2@%.*s:%d%s    for call handling\n",
+	       "  sip:2@%.*s:%d%s    for call handling\n"
+	       "  sip:3@%.*s:%d%s    for stateless proxy (standard path)\n"
+	       "  sip:4@%.*s:%d%s    for stateless proxy (raw forwarding)\n",
+	       (int)app.local_addr.slen,
+	       app.local_addr.ptr,
+	       app.local_port,
+	       (app.use_tcp ? ";transport=tcp" : ""),
+	       (int)app.local_addr.slen,
+	       app.local_addr.ptr,
+	       app.local_port,
+	       (app.use_tcp ? ";transport=tcp" : ""),
 	       (int)app.local_addr.slen,
 	       app.local_addr.ptr,
 	       app.local_port,
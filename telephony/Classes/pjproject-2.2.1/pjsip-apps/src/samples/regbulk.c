@@ -0,0 +1,471 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/**
+ * regbulk.c
+ *
+ * Benchmark for registering many lines to one registrar, either with the
+ * bulk registration client (pjsip_regc_bulk) or with one pjsip_regc per
+ * line. It reports the time to register all lines, the number of REGISTER
+ * requests sent, the memory used, and optionally the peak rate of the
+ * refreshes afterwards.
+ *
+ * sipecho can be used as the registrar:
+ *
+ *   sipecho -p 5060 -q -a test
+ *   regbulk -n 1000 -a sip:127.0.0.1:5060
+ */
+
+/* Include all headers. */
+#include <pjsip.h>
+#include <pjsip_ua.h>
+#include <pjlib-util.h>
+#include <pjlib.h>
+
+/* For logging purpose. */
+#define THIS_FILE   "regbulk.c"
+
+#include "util.h"
+
+
+static struct app_t
+{
+    pj_caching_pool	 cp;
+    pj_pool_t		*pool;
+    pjsip_endpoint	*sip_endpt;
+
+    /* Settings */
+    unsigned		 count;
+    pj_bool_t		 use_regc;
+    unsigned		 expires;
+    unsigned		 max_pending;
+    unsigned		 spread;
+    unsigned		 duration;
+    int			 port;
+    pj_bool_t		 auth;
+    pj_str_t		 registrar;
+
+    /* Clients */
+    pjsip_regc_bulk	*bulk;
+    pjsip_regc		**regc;
+
+    /* Results */
+    pj_uint8_t		*registered;
+    unsigned		 reg_cnt;
+    unsigned		 fail_cnt;
+    unsigned		 tx_cnt;
+} app;
+
+
+/* Count the REGISTER requests that are sent */
+static pj_status_t on_tx_request(pjsip_tx_data *tdata)
+{
+    if (tdata->msg->line.req.method.id == PJSIP_REGISTER_METHOD)
+	++app.tx_cnt;
+    return PJ_SUCCESS;
+}
+
+static pjsip_module mod_counter =
+{
+    NULL, NULL,				/* prev, next.		*/
+    { "mod-regbulk-counter", 19 },	/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_TRANSPORT_LAYER-1,/* Priority	        */
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    NULL,				/* on_rx_request()	*/
+    NULL,				/* on_rx_response()	*/
+    &on_tx_request,			/* on_tx_request.	*/
+    NULL,				/* on_tx_response()	*/
+    NULL,				/* on_tsx_state()	*/
+};
+
+
+/* Update the registration state of a line */
+static void set_registered(unsigned index, pj_bool_t registered,
+			   pj_bool_t failed)
+{
+    if (registered && !app.registered[index])
+	++app.reg_cnt;
+    else if (!registered && app.registered[index])
+	--app.reg_cnt;
+    app.registered[index] = (pj_uint8_t)registered;
+
+    if (failed)
+	++app.fail_cnt;
+}
+
+static void bulk_on_state(const pjsip_regc_bulk_cbparam *param)
+{
+    set_registered(param->index,
+		   param->state == PJSIP_REGC_BULK_REGISTERED,
+		   param->state == PJSIP_REGC_BULK_FAILED);
+}
+
+static void regc_cb(struct pjsip_regc_cbparam *param)
+{
+    unsigned index = (unsigned)(pj_ssize_t)param->token;
+
+    set_registered(index, param->code/100 == 2 && param->expiration > 0,
+		   param->code/100 != 2);
+}
+
+
+static pj_status_t create_bulk(const pj_str_t *contact_host)
+{
+    pjsip_regc_bulk_param param;
+    unsigned i;
+    pj_status_t status;
+
+    pjsip_regc_bulk_param_default(&param);
+    param.registrar = app.registrar;
+    param.contact_host = *contact_host;
+    param.expires = app.expires;
+    if (app.max_pending)
+	param.max_pending = app.max_pending;
+    param.on_state = &bulk_on_state;
+
+    status = pjsip_regc_bulk_create(app.sip_endpt, &param, app.count,
+				    &app.bulk);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    for (i=0; i<app.count; ++i) {
+	char user[32];
+	pj_str_t tmp;
+	pjsip_cred_info cred;
+
+	pj_ansi_snprintf(user, sizeof(user), "line%u", i);
+	tmp = pj_str(user);
+
+	pj_bzero(&cred, sizeof(cred));
+	cred.scheme = pj_str("digest");
+	cred.username = tmp;
+	cred.data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+	cred.data = tmp;
+
+	status = pjsip_regc_bulk_add(app.bulk, &tmp,
+				     app.auth ? &cred : NULL, NULL, NULL);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t create_regc(const pj_str_t *contact_host,
+			       const pj_str_t *domain)
+{
+    unsigned i;
+    pj_status_t status;
+
+    app.regc = (pjsip_regc**)
+	       pj_pool_calloc(app.pool, app.count, sizeof(pjsip_regc*));
+
+    for (i=0; i<app.count; ++i) {
+	char user[32], aor_buf[128], contact_buf[128];
+	pj_str_t aor, contact;
+
+	pj_ansi_snprintf(user, sizeof(user), "line%u", i);
+	pj_ansi_snprintf(aor_buf, sizeof(aor_buf), "<sip:%s@%.*s>", user,
+			 (int)domain->slen, domain->ptr);
+	pj_ansi_snprintf(contact_buf, sizeof(contact_buf), "<sip:%s@%.*s>",
+			 user, (int)contact_host->slen, contact_host->ptr);
+	aor = pj_str(aor_buf);
+	contact = pj_str(contact_buf);
+
+	status = pjsip_regc_create(app.sip_endpt, (void*)(pj_ssize_t)i,
+				   &regc_cb, &app.regc[i]);
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	status = pjsip_regc_init(app.regc[i], &app.registrar, &aor, &aor, 1,
+				 &contact, app.expires);
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	if (app.auth) {
+	    pjsip_cred_info cred;
+
+	    pj_bzero(&cred, sizeof(cred));
+	    cred.realm = pj_str("*");
+	    cred.scheme = pj_str("digest");
+	    cred.username = pj_str(user);
+	    cred.data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+	    cred.data = cred.username;
+
+	    status = pjsip_regc_set_credentials(app.regc[i], 1, &cred);
+	    if (status != PJ_SUCCESS)
+		return status;
+	}
+    }
+
+    return PJ_SUCCESS;
+}
+
+static pj_status_t start_regc(void)
+{
+    unsigned i;
+
+    for (i=0; i<app.count; ++i) {
+	pjsip_tx_data *tdata;
+	pj_status_t status;
+
+	status = pjsip_regc_register(app.regc[i], PJ_TRUE, &tdata);
+	if (status == PJ_SUCCESS)
+	    status = pjsip_regc_send(app.regc[i], tdata);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+static void poll_events(unsigned msec)
+{
+    pj_time_val timeout = { 0, 0 };
+    pj_time_val end, now;
+
+    pj_gettickcount(&end);
+    pj_time_val_normalize(&end);
+    end.msec += msec;
+    pj_time_val_normalize(&end);
+
+    do {
+	timeout.msec = 10;
+	pjsip_endpt_handle_events(app.sip_endpt, &timeout);
+	pj_gettickcount(&now);
+    } while (PJ_TIME_VAL_LT(now, end));
+}
+
+
+static void usage(void)
+{
+    puts("Usage:");
+    puts("  regbulk [OPTIONS] REGISTRAR-URI");
+    puts("");
+    puts("Options:");
+    puts("  --count, -n N          Number of lines (default: 1000)");
+    puts("  --regc, -r             Use one pjsip_regc per line instead of");
+    puts("                         the bulk registration client");
+    puts("  --expires, -e SEC      Registration interval (default: 60)");
+    puts("  --max-pending, -m N    Maximum outstanding REGISTER of the bulk");
+    puts("                         client");
+    puts("  --spread, -s MSEC      Spread the initial registrations of the");
+    puts("                         bulk client (default: 0)");
+    puts("  --duration, -d SEC     Keep running after all lines are");
+    puts("                         registered to measure the refreshes");
+    puts("  --auth, -a             Authenticate, the password is the user");
+    puts("  --local-port, -p PORT  Local UDP port (default: 5070)");
+    puts("  --help, -h             Show this help page");
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct pj_getopt_option long_options[] = {
+	{ "count",	1, 0, 'n' },
+	{ "regc",	0, 0, 'r' },
+	{ "expires",	1, 0, 'e' },
+	{ "max-pending",1, 0, 'm' },
+	{ "spread",	1, 0, 's' },
+	{ "duration",	1, 0, 'd' },
+	{ "auth",	0, 0, 'a' },
+	{ "local-port",	1, 0, 'p' },
+	{ "help",	0, 0, 'h' },
+	{ NULL, 0, 0, 0 }
+    };
+    pjsip_sip_uri *srv_uri;
+    pj_str_t contact_host, domain;
+    pj_sockaddr_in addr;
+    pj_time_val start, now;
+    pj_size_t mem_before, mem_after;
+    unsigned tx_before, elapsed, i;
+    int c, option_index;
+    pj_status_t status;
+
+    app.count = 1000;
+    app.expires = 60;
+    app.port = 5070;
+
+    pj_optind = 0;
+    while ((c = pj_getopt_long(argc, argv, "n:re:m:s:d:ap:h", long_options,
+			       &option_index)) != -1)
+    {
+	switch (c) {
+	case 'n':
+	    app.count = atoi(pj_optarg);
+	    break;
+	case 'r':
+	    app.use_regc = PJ_TRUE;
+	    break;
+	case 'e':
+	    app.expires = atoi(pj_optarg);
+	    break;
+	case 'm':
+	    app.max_pending = atoi(pj_optarg);
+	    break;
+	case 's':
+	    app.spread = atoi(pj_optarg);
+	    break;
+	case 'd':
+	    app.duration = atoi(pj_optarg);
+	    break;
+	case 'a':
+	    app.auth = PJ_TRUE;
+	    break;
+	case 'p':
+	    app.port = atoi(pj_optarg);
+	    break;
+	case 'h':
+	    usage();
+	    return 0;
+	default:
+	    usage();
+	    return 1;
+	}
+    }
+
+    if (pj_optind != argc - 1 || app.count == 0 || app.expires == 0) {
+	usage();
+	return 1;
+    }
+    app.registrar = pj_str(argv[pj_optind]);
+
+    /* Init stack */
+    pj_init();
+    pjlib_util_init();
+    pj_log_set_level(3);
+    pj_caching_pool_init(&app.cp, &pj_pool_factory_default_policy, 0);
+    app.pool = pj_pool_create(&app.cp.factory, "regbulk", 4000, 4000, NULL);
+
+    status = pjsip_endpt_create(&app.cp.factory, NULL, &app.sip_endpt);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+    pj_sockaddr_in_init(&addr, NULL, (pj_uint16_t)app.port);
+    status = pjsip_udp_transport_start(app.sip_endpt, &addr, NULL, 1, NULL);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to start UDP transport", status);
+	return 1;
+    }
+
+    status = pjsip_tsx_layer_init_module(app.sip_endpt);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+    status = pjsip_endpt_register_module(app.sip_endpt, &mod_counter);
+    PJ_ASSERT_RETURN(status == PJ_SUCCESS, 1);
+
+    srv_uri = (pjsip_sip_uri*) pjsip_parse_uri(app.pool, app.registrar.ptr,
+					       app.registrar.slen, 0);
+    if (srv_uri == NULL || !PJSIP_URI_SCHEME_IS_SIP(srv_uri)) {
+	PJ_LOG(1,(THIS_FILE, "Invalid registrar URI"));
+	return 1;
+    }
+    domain = srv_uri->host;
+
+    contact_host.ptr = (char*) pj_pool_alloc(app.pool, 32);
+    contact_host.slen = pj_ansi_snprintf(contact_host.ptr, 32,
+					 "127.0.0.1:%d", app.port);
+
+    app.registered = (pj_uint8_t*) pj_pool_zalloc(app.pool, app.count);
+
+    /* Create the clients */
+    mem_before = app.cp.used_size;
+    if (app.use_regc)
+	status = create_regc(&contact_host, &domain);
+    else
+	status = create_bulk(&contact_host);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to create clients", status);
+	return 1;
+    }
+    mem_after = app.cp.used_size;
+
+    PJ_LOG(3,(THIS_FILE, "Registering %u lines with %s..", app.count,
+	      (app.use_regc ? "pjsip_regc" : "pjsip_regc_bulk")));
+
+    /* Register all lines */
+    pj_gettickcount(&start);
+    if (app.use_regc)
+	status = start_regc();
+    else
+	status = pjsip_regc_bulk_start(app.bulk, app.spread);
+    if (status != PJ_SUCCESS) {
+	app_perror(THIS_FILE, "Unable to start registration", status);
+	return 1;
+    }
+
+    do {
+	poll_events(10);
+	pj_gettickcount(&now);
+	PJ_TIME_VAL_SUB(now, start);
+    } while (app.reg_cnt + app.fail_cnt < app.count && now.sec < 120);
+
+    elapsed = PJ_TIME_VAL_MSEC(now);
+
+    PJ_LOG(3,(THIS_FILE, "Registered %u of %u lines in %u.%03u s: "
+			 "%u REGISTER sent, %u failures",
+	      app.reg_cnt, app.count, elapsed / 1000, elapsed % 1000,
+	      app.tx_cnt, app.fail_cnt));
+    PJ_LOG(3,(THIS_FILE, "Memory: %lu bytes per line for the clients, "
+			 "%lu KB peak including transactions",
+	      (unsigned long)(mem_after - mem_before) / app.count,
+	      (unsigned long)(app.cp.peak_used_size - mem_before) / 1024));
+
+    /* Measure the refreshes */
+    if (app.duration) {
+	unsigned peak = 0, peak_sec = 0;
+
+	tx_before = app.tx_cnt;
+	app.fail_cnt = 0;
+	for (i=0; i<app.duration; ++i) {
+	    unsigned cnt = app.tx_cnt;
+
+	    poll_events(1000);
+	    if (app.tx_cnt - cnt > peak) {
+		peak = app.tx_cnt - cnt;
+		peak_sec = i;
+	    }
+	}
+
+	PJ_LOG(3,(THIS_FILE, "In %u s: %u REGISTER sent, peak %u/s at "
+			     "%u s, %u failures, %u lines registered",
+		  app.duration, app.tx_cnt - tx_before, peak, peak_sec,
+		  app.fail_cnt, app.reg_cnt));
+    }
+
+    /* Clean up, without unregistering */
+    if (app.use_regc) {
+	for (i=0; i<app.count; ++i)
+	    pjsip_regc_destroy(app.regc[i]);
+    } else {
+	pjsip_regc_bulk_destroy(app.bulk);
+    }
+    poll_events(100);
+
+    pjsip_endpt_destroy(app.sip_endpt);
+    pj_pool_release(app.pool);
+    pj_caching_pool_destroy(&app.cp);
+    pj_shutdown();
+
+    return 0;
+}
@@ -24,7 +24,9 @@
  *
  * - Accepts incoming calls and echoes back SDP and any media.
  * - Specify URI in cmdline argument to make call
- * - Accepts registration too!
+ * - Accepts registration too! With --auth-realm, registrations are
+ *   authenticated with digest where the password is the user name, so
+ *   it can be used as a stand-in registrar for registration benchmarks.
  */
 
 /* Include all headers. */
@@ -62,6 +64,10 @@ static struct app_t
     pj_thread_t		*worker_thread;
 
     pj_bool_t		 enable_msg_logging;
+
+    pjsip_auth_srv	 auth_srv;
+    pjsip_auth_srv_nonce_store *nonce_store;
+    unsigned		 reg_cnt;
 } app;
 
 /*
@@ -78,6 +84,8 @@ static pj_bool_t on_rx_request( pjsip_rx_data *rdata );
 static int sip_af;
 static int sip_port = 5060;
 static pj_bool_t sip_tcp;
+static pj_str_t auth_realm;
+static pj_bool_t quiet;
 
 /* This is a PJSIP module to be registered by application to handle
  * incoming requests outside any dialogs/transactions. The main purpose
@@ -223,6 +231,9 @@ static void destroy_stack(void)
     if (app.sip_endpt)
 	pjsip_endpt_destroy(app.sip_endpt);
 
+    if (app.nonce_store)
+	pjsip_auth_srv_nonce_store_destroy(app.nonce_store);
+
     if (app.pool)
 	pj_pool_release(app.pool);
 
@@ -232,6 +243,19 @@ static void destroy_stack(void)
 
 #define CHECK_STATUS()	do { if (status != PJ_SUCCESS) return status; } while (0)
 
+/* The password of every account is the account name */
+static pj_status_t lookup_cred(pj_pool_t *pool,
+			       const pjsip_auth_lookup_cred_param *param,
+			       pjsip_cred_info *cred_info)
+{
+    pj_bzero(cred_info, sizeof(*cred_info));
+    pj_strdup(pool, &cred_info->realm, &param->realm);
+    pj_strdup(pool, &cred_info->username, &param->acc_name);
+    cred_info->data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+    cred_info->data = cred_info->username;
+    return PJ_SUCCESS;
+}
+
 static pj_status_t init_stack()
 {
     pj_sockaddr addr;
@@ -273,6 +297,22 @@ static pj_status_t init_stack()
 	     pjsip_ua_init_module( app.sip_endpt, NULL );
     CHECK_STATUS();
 
+    if (auth_realm.slen) {
+	pjsip_auth_srv_init_param param;
+
+	/* Let clients reuse the nonce, like registrars usually do */
+	status = pjsip_auth_srv_nonce_store_create(app.pool, 4096, 300,
+						   &app.nonce_store);
+	CHECK_STATUS();
+
+	pj_bzero(&param, sizeof(param));
+	param.realm = &auth_realm;
+	param.lookup2 = &lookup_cred;
+	param.nonce_store = app.nonce_store;
+	status = pjsip_auth_srv_init2(app.pool, &app.auth_srv, &param);
+	CHECK_STATUS();
+    }
+
     pj_bzero(&inv_cb, sizeof(inv_cb));
     inv_cb.on_state_changed = &call_on_state_changed;
     inv_cb.on_new_session = &call_on_forked;
@@ -425,10 +465,12 @@ static pj_bool_t on_rx_request( pjsip_rx_data *rdata )
     unsigned i;
     pj_status_t status;
 
-    PJ_LOG(3,(THIS_FILE, "RX %.*s from %s",
-	      (int)rdata->msg_info.msg->line.req.method.name.slen,
-	      rdata->msg_info.msg->line.req.method.name.ptr,
-	      rdata->pkt_info.src_name));
+    if (!quiet) {
+	PJ_LOG(3,(THIS_FILE, "RX %.*s from %s",
+		  (int)rdata->msg_info.msg->line.req.method.name.slen,
+		  rdata->msg_info.msg->line.req.method.name.ptr,
+		  rdata->pkt_info.src_name));
+    }
 
     if (rdata->msg_info.msg->line.req.method.id == PJSIP_REGISTER_METHOD) {
 	/* Let me be a registrar! */
@@ -436,13 +478,48 @@ static pj_bool_t on_rx_request( pjsip_rx_data *rdata )
 	pjsip_msg *msg;
 	int expires = -1;
 
+	if (auth_realm.slen) {
+	    pjsip_transaction *tsx;
+	    int code;
+
+	    status = pjsip_auth_srv_verify(&app.auth_srv, rdata, &code);
+	    if (status != PJ_SUCCESS && code != PJSIP_SC_UNAUTHORIZED) {
+		pjsip_endpt_respond(app.sip_endpt, &mod_sipecho, rdata,
+				    code, NULL, NULL, NULL, NULL);
+		return PJ_TRUE;
+	    } else if (status != PJ_SUCCESS) {
+		pj_status_t verify_status = status;
+
+		status = pjsip_endpt_create_response(app.sip_endpt, rdata,
+						     code, NULL, &tdata);
+		if (status != PJ_SUCCESS)
+		    return PJ_TRUE;
+
+		pjsip_auth_srv_challenge(&app.auth_srv, NULL, NULL, NULL,
+					 verify_status==PJSIP_EAUTHSTALENONCE,
+					 tdata);
+
+		status = pjsip_tsx_create_uas(&mod_sipecho, rdata, &tsx);
+		if (status != PJ_SUCCESS) {
+		    pjsip_tx_data_dec_ref(tdata);
+		    return PJ_TRUE;
+		}
+		pjsip_tsx_recv_msg(tsx, rdata);
+		pjsip_tsx_send_msg(tsx, tdata);
+		return PJ_TRUE;
+	    }
+	}
+
+	++app.reg_cnt;
+
 	pj_list_init(&hdr_list);
 	msg = rdata->msg_info.msg;
 	h = (pjsip_hdr*)pjsip_msg_find_hdr(msg, PJSIP_H_EXPIRES, NULL);
 	if (h) {
 	    expires = ((pjsip_expires_hdr*)h)->ivalue;
 	    pj_list_push_back(&hdr_list, pjsip_hdr_clone(rdata->tp_info.pool, h));
-	    PJ_LOG(3,(THIS_FILE, " Expires=%d", expires));
+	    if (!quiet)
+		PJ_LOG(3,(THIS_FILE, " Expires=%d", expires));
 	}
 	if (expires != 0) {
 	    h = (pjsip_hdr*)pjsip_msg_find_hdr(msg, PJSIP_H_CONTACT, NULL);
@@ -550,6 +627,9 @@ static void usage()
     printf("  --local-port, -p PORT        Bind to port PORT.\n");
     printf("  --tcp, -t                    Listen to TCP instead.\n");
     printf("  --ipv6, -6                   Use IPv6 instead.\n");
+    printf("  --auth-realm, -a REALM       Authenticate registrations in REALM,\n");
+    printf("                               the password is the user name.\n");
+    printf("  --quiet, -q                  Don't log every incoming request.\n");
     printf("  --help, -h                   Show this help page.\n");
 }
 
@@ -564,6 +644,8 @@ int main(int argc, char *argv[])
         { "local-port",	1, 0, 'p' },
         { "tcp",	0, 0, 't' },
         { "ipv6",	0, 0, '6' },
+        { "auth-realm",	1, 0, 'a' },
+        { "quiet",	0, 0, 'q' },
         { "help", 	0, 0, 'h' }
     };
     int c, option_index;
@@ -575,7 +657,7 @@ int main(int argc, char *argv[])
     sip_af = pj_AF_INET();
 
     pj_optind = 0;
-    while ((c = pj_getopt_long(argc, argv, "p:t6h", long_options,
+    while ((c = pj_getopt_long(argc, argv, "p:t6a:qh", long_options,
                                &option_index)) != -1)
     {
 	switch (c) {
@@ -591,6 +673,12 @@ int main(int argc, char *argv[])
 	case '6':
 	    sip_af = pj_AF_INET6();
 	    break;
+	case 'a':
+	    auth_realm = pj_str(pj_optarg);
+	    break;
+	case 'q':
+	    quiet = PJ_TRUE;
+	    break;
 	default:
 	    PJ_LOG(1,(THIS_FILE,
 		      "Argument \"%s\" is not valid. Use --help to see help",
@@ -677,6 +765,7 @@ int main(int argc, char *argv[])
 	}
     }
 
+    PJ_LOG(3,(THIS_FILE, "%u registrations accepted", app.reg_cnt));
     destroy_stack();
 
     puts("Bye bye..");
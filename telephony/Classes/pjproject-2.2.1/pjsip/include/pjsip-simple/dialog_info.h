@@ -0,0 +1,284 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __PJSIP_SIMPLE_DIALOG_INFO_H__
+#define __PJSIP_SIMPLE_DIALOG_INFO_H__
+
+/**
+ * @file dialog_info.h
+ * @brief Dialog event package state (RFC 4235)
+ */
+#include <pjsip-simple/types.h>
+#include <pjsip/sip_msg.h>
+
+
+PJ_BEGIN_DECL
+
+
+/**
+ * @defgroup PJSIP_SIMPLE_DIALOG_INFO Dialog Event Package State (RFC 4235)
+ * @ingroup PJSIP_SIMPLE
+ * @brief Parser and state table for application/dialog-info+xml documents
+ * @{
+ *
+ * The notifier of the "dialog" event package may send the full state of
+ * the monitored entity, or only the dialogs that have changed
+ * (state="partial"), and each document carries a version number that is
+ * incremented by one for every notification. This module parses the
+ * documents and applies them to a per entity state table in the order
+ * required by RFC 4235 section 4.1, and derives the compact state of the
+ * entity (e.g. a BLF or shared line) from the table, so that the user is
+ * only bothered when the derived state actually changes.
+ */
+
+
+/**
+ * The compact state of a dialog or of a line.
+ */
+typedef enum pjsip_dialog_info_state
+{
+    /** No dialog, or the dialog has been terminated. */
+    PJSIP_DIALOG_INFO_IDLE,
+
+    /** The dialog is being established ("trying", "proceeding" or
+     *  "early" dialog state).
+     */
+    PJSIP_DIALOG_INFO_EARLY,
+
+    /** The dialog has been established. */
+    PJSIP_DIALOG_INFO_CONFIRMED
+
+} pjsip_dialog_info_state;
+
+
+/**
+ * The direction of a dialog, as seen from the monitored entity.
+ */
+typedef enum pjsip_dialog_info_dir
+{
+    /** The direction is not known. */
+    PJSIP_DIALOG_INFO_DIR_UNKNOWN,
+
+    /** The monitored entity sent the initial request (outgoing call). */
+    PJSIP_DIALOG_INFO_DIR_INITIATOR,
+
+    /** The monitored entity received the initial request (incoming
+     *  call).
+     */
+    PJSIP_DIALOG_INFO_DIR_RECIPIENT
+
+} pjsip_dialog_info_dir;
+
+
+/**
+ * This structure describes one dialog element of a dialog-info document.
+ */
+typedef struct pjsip_dialog_info_dialog
+{
+    /** The "id" attribute of the dialog. */
+    pj_str_t		    id;
+
+    /** The state of the dialog. Terminated dialogs are IDLE. */
+    pjsip_dialog_info_state state;
+
+    /** The direction of the dialog. */
+    pjsip_dialog_info_dir   dir;
+
+    /** The identity of the remote party, may be empty. */
+    pj_str_t		    remote;
+
+    /** The display name of the remote party, may be empty. */
+    pj_str_t		    remote_name;
+
+} pjsip_dialog_info_dialog;
+
+
+/**
+ * This structure describes a parsed dialog-info document. The strings
+ * point to the memory of the pool given to #pjsip_dialog_info_parse().
+ */
+typedef struct pjsip_dialog_info
+{
+    /** The "entity" attribute, i.e. the monitored URI. */
+    pj_str_t		     entity;
+
+    /** The version of the document. */
+    pj_uint32_t		     version;
+
+    /** Whether the document contains full state, or only the dialogs
+     *  that have changed.
+     */
+    pj_bool_t		     full_state;
+
+    /** Number of dialogs in the document. */
+    unsigned		     dlg_cnt;
+
+    /** The dialogs. */
+    pjsip_dialog_info_dialog *dlg;
+
+} pjsip_dialog_info;
+
+
+/**
+ * The compact state of a line, derived from the dialogs in its state
+ * table. When the line has several dialogs, a confirmed dialog wins over
+ * early dialogs, and the most recently updated dialog wins among the
+ * dialogs in the same state. The strings point to the buffers in the
+ * state table, hence they are only valid until the table is updated.
+ */
+typedef struct pjsip_dialog_info_line_state
+{
+    /** The state of the line. */
+    pjsip_dialog_info_state state;
+
+    /** The direction of the dialog that determines the state. */
+    pjsip_dialog_info_dir   dir;
+
+    /** The remote party of the dialog that determines the state. */
+    pj_str_t		    remote;
+
+    /** The display name of the remote party. */
+    pj_str_t		    remote_name;
+
+} pjsip_dialog_info_line_state;
+
+
+/**
+ * One dialog entry in the state table.
+ */
+typedef struct pjsip_dialog_info_entry
+{
+    /** Hash of the dialog "id" attribute. */
+    pj_uint32_t		    id_hash;
+
+    /** The state of the dialog. */
+    pjsip_dialog_info_state state;
+
+    /** The direction of the dialog. */
+    pjsip_dialog_info_dir   dir;
+
+    /** Length of the remote party in \a remote_buf. */
+    unsigned		    remote_len;
+
+    /** Length of the display name in \a name_buf. */
+    unsigned		    name_len;
+
+    /** Remote party, truncated to #PJSIP_DIALOG_INFO_MAX_URI_LEN. */
+    char		    remote_buf[PJSIP_DIALOG_INFO_MAX_URI_LEN];
+
+    /** Display name, truncated to #PJSIP_DIALOG_INFO_MAX_NAME_LEN. */
+    char		    name_buf[PJSIP_DIALOG_INFO_MAX_NAME_LEN];
+
+} pjsip_dialog_info_entry;
+
+
+/**
+ * The dialog state table of one monitored entity. The table is empty when
+ * it is zero initialized, and it must be cleared with pj_bzero() when the
+ * subscription that feeds it is terminated, since the versions of a new
+ * subscription start over.
+ */
+typedef struct pjsip_dialog_info_table
+{
+    /** Whether a document has been applied to the table. */
+    pj_bool_t		    has_version;
+
+    /** The version of the last document applied. */
+    pj_uint32_t		    version;
+
+    /** Number of dialogs in the table. */
+    unsigned		    dlg_cnt;
+
+    /** The dialogs, the most recently updated one last. */
+    pjsip_dialog_info_entry dlg[PJSIP_DIALOG_INFO_MAX_DIALOGS];
+
+} pjsip_dialog_info_table;
+
+
+/**
+ * Parse a dialog-info document. The body may be a raw body, e.g. from
+ * incoming NOTIFY request or from a part of a resource list notification.
+ *
+ * @param pool		Pool to allocate memory.
+ * @param body		The application/dialog-info+xml body.
+ * @param info		To receive the parsed document.
+ *
+ * @return		PJ_SUCCESS if the body is a valid dialog-info
+ *			document, or PJSIP_SIMPLE_EBADCONTENT or
+ *			PJSIP_SIMPLE_EBADDLGINFO.
+ */
+PJ_DECL(pj_status_t) pjsip_dialog_info_parse(pj_pool_t *pool,
+					     const pjsip_msg_body *body,
+					     pjsip_dialog_info *info);
+
+
+/**
+ * Apply a parsed dialog-info document to the state table, according to
+ * its version number: full state replaces the table, partial state with
+ * the next version updates the dialogs it contains, and documents with
+ * older versions are discarded.
+ *
+ * @param table		The state table.
+ * @param info		The parsed document.
+ * @param p_changed	Optional, to receive whether the derived line state
+ *			(see #pjsip_dialog_info_get_line_state()) has changed.
+ *
+ * @return		PJ_SUCCESS if the document has been applied,
+ *			PJ_EIGNORED if it has been discarded because it is
+ *			not newer than the table, or PJSIP_SIMPLE_EDLGINFOGAP
+ *			if it is partial state and some versions are missing.
+ *			In the last case the table is unchanged, and the
+ *			subscriber should refresh the subscription to get
+ *			full state.
+ */
+PJ_DECL(pj_status_t) pjsip_dialog_info_apply(pjsip_dialog_info_table *table,
+					     const pjsip_dialog_info *info,
+					     pj_bool_t *p_changed);
+
+
+/**
+ * Get the compact state of the line from the state table.
+ *
+ * @param table		The state table.
+ * @param st		To receive the line state.
+ */
+PJ_DECL(void) pjsip_dialog_info_get_line_state(
+				    const pjsip_dialog_info_table *table,
+				    pjsip_dialog_info_line_state *st);
+
+
+/**
+ * Get the name of the compact dialog state.
+ *
+ * @param state		The state.
+ *
+ * @return		The name, e.g. "confirmed".
+ */
+PJ_DECL(const char*) pjsip_dialog_info_state_name(
+				    pjsip_dialog_info_state state);
+
+
+/**
+ * @}
+ */
+
+PJ_END_DECL
+
+
+#endif	/* __PJSIP_SIMPLE_DIALOG_INFO_H__ */
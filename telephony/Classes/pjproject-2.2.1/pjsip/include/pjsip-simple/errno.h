@@ -83,6 +83,21 @@ PJ_BEGIN_DECL
  * Bad RPID Message
  */
 #define PJSIP_SIMPLE_EBADRPID	    (PJSIP_SIMPLE_ERRNO_START+26)   /*270026*/
+/**
+ * @hideinitializer
+ * Bad RLMI document or resource list notification
+ */
+#define PJSIP_SIMPLE_EBADRLMI	    (PJSIP_SIMPLE_ERRNO_START+27)   /*270027*/
+/**
+ * @hideinitializer
+ * Bad dialog-info document
+ */
+#define PJSIP_SIMPLE_EBADDLGINFO    (PJSIP_SIMPLE_ERRNO_START+28)   /*270028*/
+/**
+ * @hideinitializer
+ * Missing dialog-info version, full state is needed
+ */
+#define PJSIP_SIMPLE_EDLGINFOGAP    (PJSIP_SIMPLE_ERRNO_START+29)   /*270029*/
 
 
 /************************************************************
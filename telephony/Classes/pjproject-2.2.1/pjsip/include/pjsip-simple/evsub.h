@@ -84,6 +84,15 @@ enum
      * there is an id in the incoming NOTIFY, that id will be used.
      */
     PJSIP_EVSUB_NO_EVENT_ID  = 1,
+
+    /**
+     * If this flag is set, server subscription will not start its own
+     * timer to wait for refresh from the subscriber. The owner of the
+     * subscription is then responsible to terminate it when it expires,
+     * see #pjsip_evsub_get_expires(). This is used by the subscription
+     * server to expire many subscriptions with one timer.
+     */
+    PJSIP_EVSUB_NO_UAS_TIMER = 2,
 };
 
 
@@ -270,6 +279,16 @@ PJ_DECL(pj_status_t) pjsip_evsub_register_pkg( pjsip_module *pkg_mod,
 PJ_DECL(const pjsip_hdr*) pjsip_evsub_get_allow_events_hdr(pjsip_module *m);
 
 
+/**
+ * Check whether an event package has been registered.
+ *
+ * @param event_name	Event package name.
+ *
+ * @return		PJ_TRUE if the package has been registered.
+ */
+PJ_DECL(pj_bool_t) pjsip_evsub_has_pkg(const pj_str_t *event_name);
+
+
 /**
  * Create client subscription session.
  *
@@ -352,6 +371,89 @@ PJ_DECL(const char*) pjsip_evsub_get_state_name(pjsip_evsub *sub);
 PJ_DECL(const pj_str_t*) pjsip_evsub_get_termination_reason(pjsip_evsub *sub);
 
 
+/**
+ * Get the current subscription interval, i.e. the value of the Expires
+ * header of the last (un)SUBSCRIBE request or its response.
+ *
+ * @param sub		Event subscription instance.
+ *
+ * @return		Subscription interval, in seconds.
+ */
+PJ_DECL(unsigned) pjsip_evsub_get_expires(pjsip_evsub *sub);
+
+
+/**
+ * Set the jitter of the refresh of client subscription, as percentage of
+ * the subscription interval. The new value is used when the refresh timer
+ * is scheduled next time, i.e. when the (refresh) SUBSCRIBE is accepted or
+ * NOTIFY updates the interval.
+ *
+ * @param sub		Client subscription instance.
+ * @param percent	The jitter, 0-100. See #PJSIP_EVSUB_UAC_REFRESH_JITTER.
+ */
+PJ_DECL(void) pjsip_evsub_set_refresh_jitter(pjsip_evsub *sub,
+					     unsigned percent);
+
+
+/**
+ * Calculate the delay to refresh client subscription, i.e. the
+ * subscription interval minus #PJSIP_EVSUB_TIME_UAC_REFRESH, minus a
+ * random jitter.
+ *
+ * @param expires	The subscription interval, in seconds.
+ * @param jitter	The jitter, as percentage of the interval.
+ *
+ * @return		The delay, in seconds.
+ */
+PJ_DECL(unsigned) pjsip_evsub_calc_refresh_delay(unsigned expires,
+						 unsigned jitter);
+
+
+/**
+ * Token bucket to pace the requests of many client subscriptions, e.g.
+ * the refreshes of all subscriptions of an account. The requests that
+ * exceed the rate are given a later departure time, in order of arrival,
+ * so the user can queue them.
+ */
+typedef struct pjsip_evsub_pacer
+{
+    unsigned	    rate;	/**< Requests per second, zero disables
+				     pacing.				    */
+    unsigned	    burst;	/**< Number of requests that may be sent
+				     back to back.			    */
+    pj_time_val	    tat;	/**< Departure time of the next request
+				     when the bucket is empty.		    */
+} pjsip_evsub_pacer;
+
+
+/**
+ * Initialize the pacer.
+ *
+ * @param pacer		The pacer.
+ * @param rate		Requests per second, zero disables pacing. The
+ *			resolution is one millisecond, so rates above 1000
+ *			are not honored.
+ * @param burst		Number of requests that may be sent back to back,
+ *			at least one.
+ */
+PJ_DECL(void) pjsip_evsub_pacer_init(pjsip_evsub_pacer *pacer,
+				     unsigned rate, unsigned burst);
+
+
+/**
+ * Reserve the departure time of a request.
+ *
+ * @param pacer		The pacer.
+ * @param now		Current time.
+ *
+ * @return		Delay from now until the request may be sent, in
+ *			milliseconds. Zero means the request may be sent
+ *			now.
+ */
+PJ_DECL(unsigned) pjsip_evsub_pacer_reserve(pjsip_evsub_pacer *pacer,
+					    const pj_time_val *now);
+
+
 /**
  * Call this function to create request to initiate subscription, to 
  * refresh subcription, or to request subscription termination.
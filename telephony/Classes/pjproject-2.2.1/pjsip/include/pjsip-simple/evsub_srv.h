@@ -0,0 +1,268 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __PJSIP_SIMPLE_EVSUB_SRV_H__
+#define __PJSIP_SIMPLE_EVSUB_SRV_H__
+
+/**
+ * @file evsub_srv.h
+ * @brief Event subscription server for large number of watchers
+ */
+#include <pjsip-simple/evsub.h>
+
+
+PJ_BEGIN_DECL
+
+
+/**
+ * @defgroup PJSIP_EVSUB_SRV Event Subscription Server
+ * @ingroup PJSIP_EVENT_NOT
+ * @brief Serve one event package to many watchers
+ * @{
+ *
+ * The event subscription server accepts incoming SUBSCRIBE requests for
+ * one event package (e.g. "presence" or "dialog"), and keeps the state of
+ * each resource (the user part and host of the Request-URI) on behalf of
+ * the application. It is meant for servers such as presence or BLF
+ * servers, where many watchers subscribe to relatively few resources:
+ *
+ *  - the application sets the rendered body of a resource once per state
+ *    change with #pjsip_evsub_srv_set_state(), and the body is sent to
+ *    all watchers of the resource,
+ *  - a watcher only has one NOTIFY outstanding at a time. Changes that
+ *    happen meanwhile are coalesced, and the watcher receives the latest
+ *    state when the NOTIFY completes,
+ *  - the number of outstanding NOTIFY transactions of the server is
+ *    limited (see \a max_pending), the rest are queued,
+ *  - the subscriptions are expired by one timer with a timing wheel,
+ *    instead of one timer per subscription.
+ *
+ * Each watcher still has its own dialog and #pjsip_evsub session, so the
+ * event subscription module and the user agent module must have been
+ * initialized.
+ */
+
+
+/** Opaque type of event subscription server. */
+typedef struct pjsip_evsub_srv pjsip_evsub_srv;
+
+
+/** Callbacks of event subscription server. */
+typedef struct pjsip_evsub_srv_cb
+{
+    /**
+     * Called when a new SUBSCRIBE request is received, so that the
+     * application can authorize the subscription. This callback is
+     * optional, all subscriptions are accepted if it is not set.
+     *
+     * @param srv	The server.
+     * @param resource	The resource being subscribed.
+     * @param rdata	The SUBSCRIBE request.
+     * @param code	The status code to respond with, initialized to
+     *			200. Set to 300-699 to reject the subscription.
+     */
+    void (*on_subscribe)(pjsip_evsub_srv *srv, const pj_str_t *resource,
+			 pjsip_rx_data *rdata, int *code);
+
+    /**
+     * Called when a resource gets its first watcher, or loses the last
+     * one. The application may use this to start or stop tracking the
+     * state of the resource. This callback is optional, and it is called
+     * with the server lock held.
+     *
+     * @param srv	The server.
+     * @param resource	The resource.
+     * @param watched	Whether the resource has any watcher.
+     */
+    void (*on_watched)(pjsip_evsub_srv *srv, const pj_str_t *resource,
+		       pj_bool_t watched);
+
+} pjsip_evsub_srv_cb;
+
+
+/**
+ * Event subscription server parameters, see
+ * #pjsip_evsub_srv_param_default().
+ */
+typedef struct pjsip_evsub_srv_param
+{
+    /** Event package name, e.g. "presence". This must be set. If the
+     *  package has not been registered to the event subscription module,
+     *  the server registers it.
+     */
+    pj_str_t		 event;
+
+    /** Content type of the bodies, e.g. "application/pidf+xml". This
+     *  must be set.
+     */
+    pj_str_t		 content_type;
+
+    /** Maximum subscription interval, in seconds. This is also used when
+     *  the SUBSCRIBE request has no Expires header.
+     *
+     *  Default: PJSIP_PRES_DEFAULT_EXPIRES
+     */
+    unsigned		 expires;
+
+    /** Maximum number of outstanding NOTIFY transactions.
+     *
+     *  Default: PJSIP_EVSUB_SRV_MAX_PENDING
+     */
+    unsigned		 max_pending;
+
+    /** Contact URI of the server, e.g. "<sip:192.168.0.1:5060>". If this
+     *  is empty, the Contact is built from the transport that received
+     *  the SUBSCRIBE request.
+     */
+    pj_str_t		 contact;
+
+    /** Callbacks. */
+    pjsip_evsub_srv_cb	 cb;
+
+    /** Application data, see #pjsip_evsub_srv_get_user_data(). */
+    void		*user_data;
+
+} pjsip_evsub_srv_param;
+
+
+/** Statistics of event subscription server. */
+typedef struct pjsip_evsub_srv_stat
+{
+    /** Number of resources with state or watchers. */
+    unsigned		 resources;
+
+    /** Number of active watchers. */
+    unsigned		 watchers;
+
+    /** Number of outstanding NOTIFY transactions. */
+    unsigned		 pending;
+
+    /** Number of watchers waiting to be notified. */
+    unsigned		 queued;
+
+    /** Total number of NOTIFY requests sent. */
+    pj_uint32_t		 notify_sent;
+
+    /** Total number of state changes that were coalesced with the next
+     *  one, because the watcher was still being notified.
+     */
+    pj_uint32_t		 coalesced;
+
+    /** Total number of subscriptions that have expired. */
+    pj_uint32_t		 expired;
+
+} pjsip_evsub_srv_stat;
+
+
+/**
+ * Initialize the parameters with default values.
+ *
+ * @param param		The parameters.
+ */
+PJ_DECL(void) pjsip_evsub_srv_param_default(pjsip_evsub_srv_param *param);
+
+
+/**
+ * Create event subscription server and start accepting SUBSCRIBE requests
+ * for the event package. Only one server may be created for an event
+ * package.
+ *
+ * @param endpt		The endpoint.
+ * @param param		The parameters.
+ * @param p_srv		To receive the server.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_evsub_srv_create(pjsip_endpoint *endpt,
+					    const pjsip_evsub_srv_param *param,
+					    pjsip_evsub_srv **p_srv);
+
+
+/**
+ * Destroy the server. All subscriptions are terminated with NOTIFY
+ * (reason "noresource").
+ *
+ * @param srv		The server.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_evsub_srv_destroy(pjsip_evsub_srv *srv);
+
+
+/**
+ * Get the application data of the server.
+ *
+ * @param srv		The server.
+ *
+ * @return		The application data.
+ */
+PJ_DECL(void*) pjsip_evsub_srv_get_user_data(pjsip_evsub_srv *srv);
+
+
+/**
+ * Set the state of a resource and notify its watchers. The body is copied
+ * and kept by the server, and it will be sent to watchers that subscribe
+ * later too.
+ *
+ * @param srv		The server.
+ * @param resource	The resource, i.e. "user@host" (or "host") of the
+ *			Request-URI of the SUBSCRIBE requests. It is
+ *			matched case insensitively.
+ * @param body		The rendered body, or NULL to clear the state. A
+ *			resource without state is notified with no body.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_evsub_srv_set_state(pjsip_evsub_srv *srv,
+					       const pj_str_t *resource,
+					       const pj_str_t *body);
+
+
+/**
+ * Get the number of watchers of a resource.
+ *
+ * @param srv		The server.
+ * @param resource	The resource.
+ *
+ * @return		Number of active watchers.
+ */
+PJ_DECL(unsigned) pjsip_evsub_srv_get_watcher_count(pjsip_evsub_srv *srv,
+						    const pj_str_t *resource);
+
+
+/**
+ * Get the statistics of the server.
+ *
+ * @param srv		The server.
+ * @param stat		To receive the statistics.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_evsub_srv_get_stat(pjsip_evsub_srv *srv,
+					      pjsip_evsub_srv_stat *stat);
+
+
+/**
+ * @}
+ */
+
+PJ_END_DECL
+
+
+#endif	/* __PJSIP_SIMPLE_EVSUB_SRV_H__ */
@@ -0,0 +1,152 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __PJSIP_SIMPLE_RLMI_H__
+#define __PJSIP_SIMPLE_RLMI_H__
+
+/**
+ * @file rlmi.h
+ * @brief Resource list subscriptions (RFC 4662)
+ */
+#include <pjsip-simple/types.h>
+#include <pjsip/sip_msg.h>
+#include <pjsip/sip_transport.h>
+
+
+PJ_BEGIN_DECL
+
+
+/**
+ * @defgroup PJSIP_SIMPLE_RLMI Resource List Subscriptions (RFC 4662)
+ * @ingroup PJSIP_SIMPLE
+ * @brief Support for subscriptions to resource lists (RFC 4662)
+ * @{
+ *
+ * With RFC 4662, a subscriber sends one SUBSCRIBE to the URI of a
+ * resource list, and the Resource List Server (RLS) notifies the state
+ * of all resources in the list with multipart/related bodies. The root
+ * part of the body is the Resource List Meta-Information (RLMI,
+ * application/rlmi+xml) document, which refers to the state of each
+ * resource in the other parts by Content-ID.
+ *
+ * The subscription itself is an ordinary subscription of the event
+ * package of the resources (e.g. "presence" or "dialog"), so this module
+ * only provides the tools to add the headers to the SUBSCRIBE request
+ * and to demultiplex the NOTIFY bodies per resource.
+ */
+
+
+/**
+ * This structure describes the state of one resource in a resource list
+ * notification.
+ */
+typedef struct pjsip_rlmi_resource
+{
+    /** URI of the resource. */
+    pj_str_t		 uri;
+
+    /** Display name of the resource, may be empty. */
+    pj_str_t		 name;
+
+    /** State of the subscription to the resource: "active", "pending" or
+     *  "terminated". This is empty if the resource has no instance, e.g.
+     *  when the RLS has not subscribed to it yet.
+     */
+    pj_str_t		 state;
+
+    /** Reason of termination, if state is "terminated". */
+    pj_str_t		 reason;
+
+    /** The state of the resource, i.e. the body part that the instance
+     *  refers to, or NULL if the notification carries no state for the
+     *  resource.
+     */
+    pjsip_msg_body	*body;
+
+} pjsip_rlmi_resource;
+
+
+/**
+ * This structure describes a resource list notification.
+ */
+typedef struct pjsip_rlmi_list
+{
+    /** URI of the list. */
+    pj_str_t		 uri;
+
+    /** Version of the RLMI document. */
+    pj_uint32_t		 version;
+
+    /** Whether the notification contains the state of all resources in
+     *  the list, or only the ones that have changed.
+     */
+    pj_bool_t		 full_state;
+
+    /** Number of resources in the notification. */
+    unsigned		 res_cnt;
+
+    /** The resources. */
+    pjsip_rlmi_resource	*res;
+
+} pjsip_rlmi_list;
+
+
+/**
+ * Add the headers that request a resource list subscription to the
+ * SUBSCRIBE request, i.e. "Supported: eventlist", and an Accept header
+ * with the multipart/related and application/rlmi+xml content types in
+ * addition to the content type of the event package. Any existing Accept
+ * header in the request is replaced.
+ *
+ * @param tdata		The SUBSCRIBE request.
+ * @param content_type	The content type of the state of the resources,
+ *			e.g. "application/dialog-info+xml".
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_rlmi_add_subscribe_hdr(pjsip_tx_data *tdata,
+						  const pj_str_t *content_type);
+
+
+/**
+ * Parse a resource list notification body. The body may be a raw body
+ * (e.g. from incoming message) or a multipart body that has been parsed.
+ * The body of the resources point to the memory allocated from the pool.
+ *
+ * @param pool		Pool to allocate memory.
+ * @param body		The multipart/related body of the NOTIFY request.
+ * @param list		To receive the resource list notification.
+ *
+ * @return		PJ_SUCCESS if the body is a valid resource list
+ *			notification, or PJSIP_SIMPLE_EBADCONTENT or
+ *			PJSIP_SIMPLE_EBADRLMI.
+ */
+PJ_DECL(pj_status_t) pjsip_rlmi_parse(pj_pool_t *pool,
+				      const pjsip_msg_body *body,
+				      pjsip_rlmi_list *list);
+
+
+/**
+ * @}
+ */
+
+PJ_END_DECL
+
+
+#endif	/* __PJSIP_SIMPLE_RLMI_H__ */
@@ -27,6 +27,7 @@
 
 #define PJSIP_SLA_SUBSCRIPTION_TYPE_SLA     PJSUA_SLA_SUBSCRIPTION_TYPE_SLA
 #define PJSIP_SLA_SUBSCRIPTION_TYPE_BLF     PJSUA_SLA_SUBSCRIPTION_TYPE_BLF
+#define PJSIP_SLA_SUBSCRIPTION_TYPE_BLF_LIST PJSUA_SLA_SUBSCRIPTION_TYPE_BLF_LIST
 /**
  * @defgroup sla SIP Message Summary and Message Waiting Indication (RFC 3842)
  * @ingroup PJSIP_SIMPLE
@@ -0,0 +1,386 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __PJSIP_SIP_REGC_BULK_H__
+#define __PJSIP_SIP_REGC_BULK_H__
+
+/**
+ * @file sip_regc_bulk.h
+ * @brief Bulk SIP Registration Client
+ */
+
+#include <pjsip/sip_types.h>
+#include <pjsip/sip_auth.h>
+#include <pjsip/sip_transport.h>
+
+
+/**
+ * @defgroup PJSUA_REGC_BULK Bulk Client Registration
+ * @ingroup PJSIP_HIGH_UA
+ * @brief Register a large number of lines to the same registrar.
+ * @{
+ *
+ * The bulk registration client maintains many registrations (e.g. the
+ * trunk lines of a gateway) to one registrar with much less resources
+ * than one #pjsip_regc per line:
+ *
+ *  - the registrar is resolved once and the result is used for all
+ *    requests, until it expires or a request fails with transport error,
+ *  - all requests are sent over the same transport, which is kept open
+ *    as long as it works,
+ *  - the digest challenge of the registrar is kept, and each line keeps
+ *    the nonce it was last challenged with and its own nonce count, so
+ *    refreshes and unregistrations are authorized in advance and
+ *    normally cost one transaction instead of two,
+ *  - the state of each line is a small entry in one array, and a single
+ *    timer serves all the lines,
+ *  - refreshes are spread randomly (see \a jitter) and the number of
+ *    outstanding requests is limited (see \a max_pending), so the lines
+ *    never hit the registrar all at once.
+ *
+ * Lines are identified by their index in the array, starting from zero
+ * in the order they were added. Application must link with
+ * <b>pjsip-ua</b> static library to use this API.
+ */
+
+
+PJ_BEGIN_DECL
+
+/** Opaque type of bulk registration client. */
+typedef struct pjsip_regc_bulk pjsip_regc_bulk;
+
+
+/** Registration state of a line. */
+typedef enum pjsip_regc_bulk_state
+{
+    /** Not registered, and no registration is pending. */
+    PJSIP_REGC_BULK_IDLE,
+
+    /** Waiting for its turn to send REGISTER. */
+    PJSIP_REGC_BULK_WAITING,
+
+    /** REGISTER request is in progress. */
+    PJSIP_REGC_BULK_REGISTERING,
+
+    /** Registered. */
+    PJSIP_REGC_BULK_REGISTERED,
+
+    /** Registration has failed and will be retried later. */
+    PJSIP_REGC_BULK_FAILED,
+
+    /** Unregistration is pending or in progress. */
+    PJSIP_REGC_BULK_UNREGISTERING
+
+} pjsip_regc_bulk_state;
+
+
+/** Parameter of #pjsip_regc_bulk_on_state() callback. */
+typedef struct pjsip_regc_bulk_cbparam
+{
+    /** The bulk registration client. */
+    pjsip_regc_bulk	*bulk;
+
+    /** Index of the line. */
+    unsigned		 index;
+
+    /** Application data of the line, see #pjsip_regc_bulk_add(). */
+    void		*user_data;
+
+    /** New state of the line. */
+    pjsip_regc_bulk_state state;
+
+    /** Error status, or PJ_SUCCESS if a final response was received. */
+    pj_status_t		 status;
+
+    /** Status code of the final response. */
+    int			 code;
+
+    /** Granted expiration in seconds for successful registration. */
+    unsigned		 expiration;
+
+} pjsip_regc_bulk_cbparam;
+
+
+/**
+ * Callback to receive the result of every REGISTER request of the lines.
+ * It is called without holding the lock of the bulk registration client.
+ */
+typedef void pjsip_regc_bulk_on_state(const pjsip_regc_bulk_cbparam *param);
+
+
+/** Bulk registration client parameters, see #pjsip_regc_bulk_param_default().
+ */
+typedef struct pjsip_regc_bulk_param
+{
+    /** Registrar URI, i.e. the Request-URI of the REGISTER requests,
+     *  e.g. "sip:example.com;transport=tcp". This must be set.
+     */
+    pj_str_t		 registrar;
+
+    /** Domain of the address of record of the lines. The AOR of a line
+     *  is "sip:USER@DOMAIN". If this is empty, the host of the registrar
+     *  URI is used.
+     */
+    pj_str_t		 domain;
+
+    /** Host part of the Contact URI of the lines, optionally with port
+     *  and URI parameters, e.g. "192.168.0.1:5060;transport=tcp". The
+     *  Contact of a line is "<sip:USER@CONTACT_HOST>". This must be set.
+     */
+    pj_str_t		 contact_host;
+
+    /** Requested registration interval, in seconds.
+     *
+     *  Default: 3600
+     */
+    unsigned		 expires;
+
+    /** Number of seconds to refresh the registration before it expires.
+     *
+     *  Default: PJSIP_REGISTER_CLIENT_DELAY_BEFORE_REFRESH
+     */
+    unsigned		 delay_before_refresh;
+
+    /** Random spread of the refresh time, in percent of the registration
+     *  interval. A registration is refreshed at a random time within
+     *  this much before the regular refresh time.
+     *
+     *  Default: PJSIP_REGC_BULK_JITTER
+     */
+    unsigned		 jitter;
+
+    /** Maximum number of outstanding REGISTER transactions.
+     *
+     *  Default: PJSIP_REGC_BULK_MAX_PENDING
+     */
+    unsigned		 max_pending;
+
+    /** Interval, in seconds, to retry failed registrations. The actual
+     *  interval is randomized by \a jitter too, and a longer Retry-After
+     *  from the registrar is honored.
+     *
+     *  Default: PJSIP_REGC_BULK_RETRY_INTERVAL
+     */
+    unsigned		 retry_interval;
+
+    /** Interval, in seconds, to resolve the registrar again.
+     *
+     *  Default: 300
+     */
+    unsigned		 resolve_interval;
+
+    /** Optional transport to send the requests, instead of the transport
+     *  selected by the transport manager.
+     */
+    pjsip_tpselector	 tp_sel;
+
+    /** Callback to receive the registration results, optional. */
+    pjsip_regc_bulk_on_state *on_state;
+
+    /** Application data, see #pjsip_regc_bulk_get_user_data(). */
+    void		*user_data;
+
+} pjsip_regc_bulk_param;
+
+
+/** Registration info of a line, see #pjsip_regc_bulk_get_info(). */
+typedef struct pjsip_regc_bulk_info
+{
+    /** User part of the AOR. */
+    pj_str_t		 user;
+
+    /** Registration state. */
+    pjsip_regc_bulk_state state;
+
+    /** Status code of the last final response, zero if none yet. */
+    int			 code;
+
+    /** Seconds until the registration expires, zero if not registered. */
+    unsigned		 expires;
+
+    /** Seconds until the next REGISTER request is due, zero if it is
+     *  due now, or -1 if nothing is scheduled.
+     */
+    int			 next_reg;
+
+} pjsip_regc_bulk_info;
+
+
+/** Statistics of a bulk registration client. */
+typedef struct pjsip_regc_bulk_stat
+{
+    /** Number of lines. */
+    unsigned		 count;
+
+    /** Number of lines currently registered. */
+    unsigned		 registered;
+
+    /** Number of lines whose last registration failed. */
+    unsigned		 failed;
+
+    /** Number of outstanding REGISTER transactions. */
+    unsigned		 pending;
+
+    /** Total number of REGISTER requests sent, excluding retransmissions.
+     */
+    pj_uint32_t		 requests;
+
+    /** Total number of requests that were challenged by the registrar. */
+    pj_uint32_t		 challenged;
+
+    /** Total number of times the registrar has been resolved. */
+    pj_uint32_t		 resolved;
+
+} pjsip_regc_bulk_stat;
+
+
+/**
+ * Initialize the parameters with default values.
+ *
+ * @param param		The parameters.
+ */
+PJ_DECL(void) pjsip_regc_bulk_param_default(pjsip_regc_bulk_param *param);
+
+
+/**
+ * Create a bulk registration client. Lines are added with
+ * #pjsip_regc_bulk_add(), and the registrations are started with
+ * #pjsip_regc_bulk_start().
+ *
+ * @param endpt		The endpoint. The transaction layer must have been
+ *			initialized.
+ * @param param		The parameters.
+ * @param max_line	Maximum number of lines.
+ * @param p_bulk	To receive the bulk registration client.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_regc_bulk_create(pjsip_endpoint *endpt,
+					    const pjsip_regc_bulk_param *param,
+					    unsigned max_line,
+					    pjsip_regc_bulk **p_bulk);
+
+
+/**
+ * Destroy the bulk registration client. The lines are not unregistered,
+ * use #pjsip_regc_bulk_unregister() and wait for the result first for
+ * that. Pending transactions are left to complete, but the callback will
+ * not be called anymore.
+ *
+ * @param bulk		The bulk registration client.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_regc_bulk_destroy(pjsip_regc_bulk *bulk);
+
+
+/**
+ * Get the application data of the bulk registration client.
+ *
+ * @param bulk		The bulk registration client.
+ *
+ * @return		The application data.
+ */
+PJ_DECL(void*) pjsip_regc_bulk_get_user_data(pjsip_regc_bulk *bulk);
+
+
+/**
+ * Add a line.
+ *
+ * @param bulk		The bulk registration client.
+ * @param user		User part of the AOR and Contact of the line.
+ * @param cred		Credential of the line, or NULL if the registrar
+ *			does not require authentication. The realm of the
+ *			credential is ignored. Only plain text password and
+ *			digest (HA1) data types are supported.
+ * @param user_data	Application data of the line.
+ * @param p_index	Optional pointer to receive the index of the line.
+ *
+ * @return		PJ_SUCCESS on success, or PJ_ETOOMANY if the
+ *			maximum number of lines has been reached.
+ */
+PJ_DECL(pj_status_t) pjsip_regc_bulk_add(pjsip_regc_bulk *bulk,
+					 const pj_str_t *user,
+					 const pjsip_cred_info *cred,
+					 void *user_data,
+					 unsigned *p_index);
+
+
+/**
+ * Start registering the lines that are idle. The registrations of the
+ * lines are spread randomly over \a spread milliseconds, and are paced by
+ * the \a max_pending parameter. Lines that are added afterwards need
+ * another call to this function.
+ *
+ * @param bulk		The bulk registration client.
+ * @param spread	Period to spread the registrations over, in
+ *			milliseconds, zero to start all immediately.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_regc_bulk_start(pjsip_regc_bulk *bulk,
+					   unsigned spread);
+
+
+/**
+ * Unregister a line, or all lines, and stop refreshing them. The result
+ * is reported to the callback with PJSIP_REGC_BULK_IDLE state.
+ *
+ * @param bulk		The bulk registration client.
+ * @param index		Index of the line, or -1 for all lines.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_regc_bulk_unregister(pjsip_regc_bulk *bulk,
+						int index);
+
+
+/**
+ * Get the registration info of a line.
+ *
+ * @param bulk		The bulk registration client.
+ * @param index		Index of the line.
+ * @param info		To receive the info.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_regc_bulk_get_info(pjsip_regc_bulk *bulk,
+					      unsigned index,
+					      pjsip_regc_bulk_info *info);
+
+
+/**
+ * Get the statistics of the bulk registration client.
+ *
+ * @param bulk		The bulk registration client.
+ * @param stat		To receive the statistics.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_regc_bulk_get_stat(pjsip_regc_bulk *bulk,
+					      pjsip_regc_bulk_stat *stat);
+
+
+PJ_END_DECL
+
+/**
+ * @}
+ */
+
+#endif	/* __PJSIP_SIP_REGC_BULK_H__ */
@@ -36,6 +36,7 @@
 #include <pjsip/sip_module.h>
 #include <pjsip/sip_endpoint.h>
 #include <pjsip/sip_util.h>
+#include <pjsip/sip_overload.h>
 
 /* Transport layer */
 #include <pjsip/sip_transport.h>
@@ -43,6 +44,7 @@
 #include <pjsip/sip_transport_loop.h>
 #include <pjsip/sip_transport_tcp.h>
 #include <pjsip/sip_transport_tls.h>
+#include <pjsip/sip_transport_ws.h>
 #include <pjsip/sip_resolve.h>
 
 /* Authentication. */
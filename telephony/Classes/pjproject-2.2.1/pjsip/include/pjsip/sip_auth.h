@@ -306,6 +306,68 @@ typedef pj_status_t pjsip_auth_lookup_cred2(
 				pjsip_cred_info *cred_info );
 
 
+/**
+ * Opaque declaration of pending asynchronous credential lookup.
+ */
+typedef struct pjsip_auth_srv_async_op pjsip_auth_srv_async_op;
+
+
+/**
+ * Type of function to lookup credential asynchronously, e.g. from a
+ * database or a remote credential store. The function should start the
+ * lookup and return PJ_EPENDING, and report the result later (possibly
+ * from another thread) by calling #pjsip_auth_srv_lookup_complete().
+ *
+ * @param param		The input param for credential lookup. The rdata
+ *			is a clone of the request, which stays valid until
+ *			the lookup is completed.
+ * @param op		The operation, to be given to
+ *			#pjsip_auth_srv_lookup_complete().
+ *
+ * @return		PJ_EPENDING if the lookup has been started. Any other
+ *			value means the lookup was not started, and
+ *			#pjsip_auth_srv_lookup_complete() must not be called.
+ */
+typedef pj_status_t pjsip_auth_lookup_cred_async(
+				const pjsip_auth_lookup_cred_param *param,
+				pjsip_auth_srv_async_op *op );
+
+
+/**
+ * Opaque declaration of server credential cache, which keeps the HA1 of
+ * accounts keyed by realm and account name. See
+ * #pjsip_auth_srv_cache_create().
+ */
+typedef struct pjsip_auth_srv_cache pjsip_auth_srv_cache;
+
+
+/**
+ * Opaque declaration of server nonce store, which keeps the nonces issued
+ * in challenges so that clients can reuse them in subsequent requests.
+ * See #pjsip_auth_srv_nonce_store_create().
+ */
+typedef struct pjsip_auth_srv_nonce_store pjsip_auth_srv_nonce_store;
+
+
+/**
+ * This structure describes statistics of server authentication. The
+ * counters are updated without locking, so they are approximate when the
+ * server is used by several threads at the same time.
+ */
+typedef struct pjsip_auth_srv_stat
+{
+    unsigned	challenged;	/**< Number of challenges issued.	    */
+    unsigned	accepted;	/**< Number of authenticated requests.	    */
+    unsigned	accepted_reused;/**< Number of authenticated requests whose
+				     nonce had been used before, i.e.
+				     accepted without new challenge.	    */
+    unsigned	rejected;	/**< Number of requests rejected because of
+				     wrong or unknown credential.	    */
+    unsigned	stale;		/**< Number of requests with unknown,
+				     expired, or replayed nonce.	    */
+} pjsip_auth_srv_stat;
+
+
 /** Flag to specify that server is a proxy. */
 #define PJSIP_AUTH_SRV_IS_PROXY	    1
 
@@ -319,6 +381,11 @@ typedef struct pjsip_auth_srv
     pjsip_auth_lookup_cred  *lookup;	/**< Lookup function.		    */
     pjsip_auth_lookup_cred2 *lookup2;	/**< Lookup function with additional
 					     info in its input param.	    */
+    pjsip_auth_lookup_cred_async *lookup_async; /**< Asynchronous lookup
+						     function.		    */
+    pjsip_auth_srv_cache    *cache;	/**< Credential cache, optional.    */
+    pjsip_auth_srv_nonce_store *nonce_store; /**< Nonce store, optional.   */
+    pjsip_auth_srv_stat	     stat;	/**< Statistics.		    */
 } pjsip_auth_srv;
 
 
@@ -481,6 +548,29 @@ typedef struct pjsip_auth_srv_init_param
      */
     pjsip_auth_lookup_cred2	*lookup2;
 
+    /**
+     * Asynchronous account lookup function, used by
+     * #pjsip_auth_srv_verify_async(). If it is not set, the asynchronous
+     * verification will use \a lookup2 synchronously instead.
+     */
+    pjsip_auth_lookup_cred_async *lookup_async;
+
+    /**
+     * Optional credential cache, which may be shared by several servers.
+     * When it is set, the HA1 of the account is looked up from the cache
+     * before the lookup function is called.
+     */
+    pjsip_auth_srv_cache	*cache;
+
+    /**
+     * Optional nonce store. When it is set, the nonces created by
+     * #pjsip_auth_srv_challenge() are remembered and may be reused by
+     * clients until they expire, and requests with unknown or expired
+     * nonce, or with nonce count that has been used, are rejected with
+     * PJSIP_EAUTHSTALENONCE.
+     */
+    pjsip_auth_srv_nonce_store	*nonce_store;
+
     /**
      * Options, bitmask of:
      * - PJSIP_AUTH_SRV_IS_PROXY: to specify that the server will authorize
@@ -526,17 +616,174 @@ PJ_DECL(pj_status_t) pjsip_auth_srv_init2(
  *			- PJSIP_EAUTHACCDISABLED
  *			- PJSIP_EAUTHINVALIDREALM
  *			- PJSIP_EAUTHINVALIDDIGEST
+ *			- PJSIP_EAUTHSTALENONCE, when nonce store is used.
+ *			  The request should be challenged again with
+ *			  stale set to PJ_TRUE.
  */
 PJ_DECL(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
 					    pjsip_rx_data *rdata,
 					    int *status_code );
 
 
+/**
+ * Type of callback to receive the result of #pjsip_auth_srv_verify_async().
+ *
+ * @param auth_srv	The server authentication structure.
+ * @param rdata		Clone of the request being authenticated. It is only
+ *			valid during the callback; application must clone
+ *			it again with #pjsip_rx_data_clone() to keep it.
+ * @param user_data	The user data given to #pjsip_auth_srv_verify_async().
+ * @param status	PJ_SUCCESS if request is successfully authenticated,
+ *			otherwise the error codes as in
+ *			#pjsip_auth_srv_verify().
+ * @param status_code	Suitable status code to be sent to the client.
+ */
+typedef void pjsip_auth_srv_verify_cb( pjsip_auth_srv *auth_srv,
+				       pjsip_rx_data *rdata,
+				       void *user_data,
+				       pj_status_t status,
+				       int status_code );
+
+
+/**
+ * Asynchronous version of #pjsip_auth_srv_verify(). When the credential
+ * can not be verified immediately (i.e. it is not found in the cache and
+ * the server is configured with asynchronous lookup function), the request
+ * is cloned, the lookup is started, and the function returns PJ_EPENDING
+ * without blocking. The result will then be reported to the callback when
+ * the lookup function calls #pjsip_auth_srv_lookup_complete().
+ *
+ * Note that the callback may be called before this function returns, if
+ * the lookup function completes the lookup immediately.
+ *
+ * @param auth_srv	The server authentication structure.
+ * @param rdata		Incoming request to be authenticated.
+ * @param user_data	Arbitrary user data to be given to the callback.
+ * @param cb		Callback to receive the result.
+ * @param status_code	When not null, it will be filled with suitable 
+ *			status code to be sent to the client, unless the
+ *			function returns PJ_EPENDING.
+ *
+ * @return		PJ_EPENDING if the result will be reported to the
+ *			callback. Otherwise the request has been verified
+ *			(or rejected) synchronously and the callback will not
+ *			be called; the return value is as in
+ *			#pjsip_auth_srv_verify().
+ */
+PJ_DECL(pj_status_t) pjsip_auth_srv_verify_async( pjsip_auth_srv *auth_srv,
+						  pjsip_rx_data *rdata,
+						  void *user_data,
+						  pjsip_auth_srv_verify_cb *cb,
+						  int *status_code );
+
+
+/**
+ * Complete the asynchronous credential lookup started by the
+ * #pjsip_auth_lookup_cred_async function. This will verify the request,
+ * call the verification callback, and release the operation.
+ *
+ * @param op		The operation.
+ * @param status	PJ_SUCCESS if the credential is found, otherwise it
+ *			may be PJSIP_EAUTHACCNOTFOUND or
+ *			PJSIP_EAUTHACCDISABLED.
+ * @param cred_info	The credential, when status is PJ_SUCCESS. It is only
+ *			used during the function call.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_auth_srv_lookup_complete(
+					    pjsip_auth_srv_async_op *op,
+					    pj_status_t status,
+					    const pjsip_cred_info *cred_info );
+
+
+/**
+ * Create credential cache, which can be installed to the authentication
+ * server to keep the HA1 of accounts that have been looked up, so that
+ * subsequent requests can be verified without calling the lookup
+ * function. Entries are kept for at most \a ttl seconds, and when the
+ * cache is full the oldest entry is replaced.
+ *
+ * Only plain text password and digest credentials are cached.
+ *
+ * @param pool		Pool to allocate the cache.
+ * @param max_cnt	Maximum number of entries.
+ * @param ttl		Lifetime of an entry, in seconds.
+ * @param p_cache	Pointer to receive the cache.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_auth_srv_cache_create( pj_pool_t *pool,
+						  unsigned max_cnt,
+						  unsigned ttl,
+						  pjsip_auth_srv_cache **p_cache);
+
+
+/**
+ * Destroy the credential cache. It must not be used by any authentication
+ * server anymore.
+ *
+ * @param cache		The cache.
+ */
+PJ_DECL(void) pjsip_auth_srv_cache_destroy(pjsip_auth_srv_cache *cache);
+
+
+/**
+ * Remove the entry of the specified account from the cache, e.g. when the
+ * password of the account has been changed.
+ *
+ * @param cache		The cache.
+ * @param realm		The realm.
+ * @param acc_name	The account name, or NULL to remove all entries of
+ *			the realm.
+ */
+PJ_DECL(void) pjsip_auth_srv_cache_remove( pjsip_auth_srv_cache *cache,
+					   const pj_str_t *realm,
+					   const pj_str_t *acc_name);
+
+
+/**
+ * Create nonce store for the authentication server. Nonces are valid for
+ * \a expiry seconds after the challenge, during which clients may reuse
+ * them for subsequent requests (e.g. registration refreshes) without
+ * being challenged again. For requests with qop, the nonce count must be
+ * increasing. The store also keeps the last HA2 for each nonce, so that
+ * a refresh only needs to calculate the response digest.
+ *
+ * When the store is full, the oldest nonce is replaced.
+ *
+ * @param pool		Pool to allocate the store.
+ * @param max_cnt	Maximum number of nonces.
+ * @param expiry	Lifetime of a nonce, in seconds.
+ * @param p_store	Pointer to receive the store.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_auth_srv_nonce_store_create(
+					pj_pool_t *pool,
+					unsigned max_cnt,
+					unsigned expiry,
+					pjsip_auth_srv_nonce_store **p_store);
+
+
+/**
+ * Destroy the nonce store. It must not be used by any authentication
+ * server anymore.
+ *
+ * @param store		The nonce store.
+ */
+PJ_DECL(void) pjsip_auth_srv_nonce_store_destroy(
+					pjsip_auth_srv_nonce_store *store);
+
+
+
 /**
  * Add authentication challenge headers to the outgoing response in tdata. 
  * Application may specify its customized nonce and opaque for the challenge, 
  * or can leave the value to NULL to make the function fills them in with 
- * random characters.
+ * random characters. If the server has nonce store, the nonce is added to
+ * the store, and the nonce given by application must not be empty or
+ * longer than PJSIP_AUTH_SRV_NONCE_MAX_LEN.
  *
  * @param auth_srv	The server authentication structure.
  * @param qop		Optional qop value.
@@ -546,7 +793,8 @@ PJ_DECL(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
  * @param tdata		The outgoing response message. The response must have
  *			401 or 407 response code.
  *
- * @return		PJ_SUCCESS on success.
+ * @return		PJ_SUCCESS on success, or PJ_ETOOBIG or PJ_EINVAL
+ *			if the nonce can't be kept in the nonce store.
  */
 PJ_DECL(pj_status_t) pjsip_auth_srv_challenge( pjsip_auth_srv *auth_srv,
 					       const pj_str_t *qop,
@@ -137,6 +137,17 @@ typedef struct pjsip_cfg_t
 	 */
 	pj_bool_t req_has_via_alias;
 
+	/**
+	 * Specify whether an incoming connection may be reused for requests
+	 * to the address in the Via sent-by of a request received on it, when
+	 * that Via contains "alias" param (RFC 5923). The alias is only
+	 * accepted when the sent-by host is the source IP address of the
+	 * connection.
+	 *
+	 * Default is PJSIP_ACCEPT_VIA_ALIAS.
+	 */
+	pj_bool_t accept_via_alias;
+
     } endpt;
 
     /** Transaction layer settings. */
@@ -250,6 +261,20 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Specify the number of stripes of the dialog hash table in the UA layer.
+ * Dialog sets are distributed across the stripes by the hash of their
+ * Call-ID and local tag, and each stripe is protected by its own mutex,
+ * so incoming messages of different dialogs can be matched concurrently.
+ * The value must be a power of two.
+ *
+ * Default value is 16.
+ */
+#ifndef PJSIP_UA_DLG_TABLE_STRIPES
+#   define PJSIP_UA_DLG_TABLE_STRIPES	16
+#endif
+
+
 /**
  * Specify maximum number of transports.
  * Default value is equal to maximum number of handles in ioqueue.
@@ -269,6 +294,16 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Maximum number of connections in a transport manager connection pool
+ * (see #pjsip_tpmgr_set_conn_pool()), including incoming connections
+ * aliased to the destination.
+ */
+#ifndef PJSIP_TPMGR_CONN_POOL_MAX
+#   define PJSIP_TPMGR_CONN_POOL_MAX	16
+#endif
+
+
 /**
  * Specify maximum URL size.
  * This constant is used mainly when printing the URL for logging purpose 
@@ -364,6 +399,21 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Specify whether incoming connection oriented transports may be reused
+ * for requests to the address in the Via sent-by of a request carrying
+ * "alias" param (RFC 5923). See also PJSIP_REQ_HAS_VIA_ALIAS.
+ *
+ * This option can also be controlled at run-time by the
+ * \a accept_via_alias setting in pjsip_cfg_t.
+ *
+ * Default is PJ_FALSE.
+ */
+#ifndef PJSIP_ACCEPT_VIA_ALIAS
+#   define PJSIP_ACCEPT_VIA_ALIAS		    PJ_FALSE
+#endif
+
+
 /**
  * Accept call replace in early state when invite is not initiated
  * by the user agent. RFC 3891 Section 3 disallows this, however,
@@ -446,6 +496,28 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Create requests within established dialog from per-dialog template.
+ * The template keeps the From, To, Contact, Call-ID and Route headers
+ * of the dialog already encoded, so that high volume in-dialog requests
+ * such as subscription refreshes, OPTIONS keep-alives and session timer
+ * UPDATEs only copy these headers shallowly and do not need to print
+ * them again. The template is rebuilt when the dialog's target, route
+ * set, local Contact or remote info changes.
+ *
+ * A request header copied from the template prints its own values once
+ * it has been changed, e.g. when its URI, tag or parameters are replaced.
+ * The URIs of the request, including the Request-URI, are shared with
+ * the template, so they must be replaced rather than modified in place,
+ * as with other shallow copied headers.
+ *
+ * Default is 1 (Yes)
+ */
+#ifndef PJSIP_DLG_USE_REQ_TEMPLATE
+#   define PJSIP_DLG_USE_REQ_TEMPLATE	1
+#endif
+
+
 /**
  * Allow SIP modules removal or insertions during operation?
  * If yes, then locking will be employed when endpoint need to
@@ -541,6 +613,81 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Default maximum number of pending events (incoming messages, jobs, and
+ * timer events) in each worker queue of the endpoint dispatcher. See
+ * #pjsip_endpt_start_dispatcher().
+ *
+ * Default: 1024
+ */
+#ifndef PJSIP_ENDPT_WORKER_QUEUE_SIZE
+#   define PJSIP_ENDPT_WORKER_QUEUE_SIZE	1024
+#endif
+
+
+/**
+ * Default interval, in milliseconds, at which the overload control
+ * samples the load of the endpoint and adjusts the proportion of new
+ * requests that are rejected. See #pjsip_overload_init_module().
+ *
+ * Default: 100
+ */
+#ifndef PJSIP_OVERLOAD_INTERVAL
+#   define PJSIP_OVERLOAD_INTERVAL		100
+#endif
+
+
+/**
+ * Default maximum average latency, in milliseconds, of processing an
+ * incoming message (including the time it waits in the dispatcher
+ * queue) before the overload control starts rejecting new requests.
+ * This should be well below the SIP T1 timer so that clients do not
+ * retransmit requests that are still waiting to be processed.
+ *
+ * Default: 200
+ */
+#ifndef PJSIP_OVERLOAD_MAX_LATENCY
+#   define PJSIP_OVERLOAD_MAX_LATENCY		200
+#endif
+
+
+/**
+ * Default value of Retry-After header, in seconds, in 503 responses sent
+ * by the overload control. A random delay of up to half of this value is
+ * added so that rejected clients do not retry at the same time.
+ *
+ * Default: 5
+ */
+#ifndef PJSIP_OVERLOAD_RETRY_AFTER
+#   define PJSIP_OVERLOAD_RETRY_AFTER		5
+#endif
+
+
+/**
+ * Default validity, in milliseconds, of the RFC 7339 overload control
+ * feedback sent in the Via header of responses.
+ *
+ * Default: 500
+ */
+#ifndef PJSIP_OVERLOAD_OC_VALIDITY
+#   define PJSIP_OVERLOAD_OC_VALIDITY		500
+#endif
+
+
+/**
+ * Enable support for per module latency statistics of incoming messages.
+ * When this is enabled, the statistics can be switched on at run-time
+ * with #pjsip_endpt_enable_mod_stat(); they are collected only while
+ * switched on, so the cost when they are off is a single flag check per
+ * message. Set this to zero to remove the code altogether.
+ *
+ * Default: 1
+ */
+#ifndef PJSIP_ENDPT_HAS_MOD_STAT
+#   define PJSIP_ENDPT_HAS_MOD_STAT		1
+#endif
+
+
 /**
  * Idle timeout interval to be applied to outgoing transports (i.e. client
  * side) with no usage before the transport is destroyed. Value is in
@@ -659,6 +806,59 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Maximum number of bytes of outgoing messages that may be queued on
+ * a single connection while a previous write is still in progress (see
+ * #pjsip_tx_queue). When the limit is reached, further sends on the
+ * connection fail immediately with PJSIP_ETPQUEUEFULL. Set to zero to
+ * disable the limit. This applies to TCP and WebSocket connections, and
+ * to TLS unless #PJSIP_TLS_TX_QUEUE_MAX_BYTES is set.
+ *
+ * This value can be overridden per listener with the \a max_tx_queue_bytes
+ * field of the transport configuration.
+ *
+ * Default: 1 MB
+ */
+#ifndef PJSIP_TCP_TX_QUEUE_MAX_BYTES
+#   define PJSIP_TCP_TX_QUEUE_MAX_BYTES	    (1024 * 1024)
+#endif
+
+
+/**
+ * Size of the buffer used by a TCP connection to coalesce queued
+ * messages into a single write (see #pjsip_tx_queue). Messages larger
+ * than this size are sent on their own. Set to zero to disable
+ * coalescing.
+ *
+ * Default: 16000
+ */
+#ifndef PJSIP_TCP_TX_COALESCE_SIZE
+#   define PJSIP_TCP_TX_COALESCE_SIZE	    16000
+#endif
+
+
+/**
+ * Outgoing queue limit of TLS connections, see
+ * #PJSIP_TCP_TX_QUEUE_MAX_BYTES.
+ *
+ * Default: PJSIP_TCP_TX_QUEUE_MAX_BYTES
+ */
+#ifndef PJSIP_TLS_TX_QUEUE_MAX_BYTES
+#   define PJSIP_TLS_TX_QUEUE_MAX_BYTES	    PJSIP_TCP_TX_QUEUE_MAX_BYTES
+#endif
+
+
+/**
+ * Coalescing buffer size of TLS connections, see
+ * #PJSIP_TCP_TX_COALESCE_SIZE.
+ *
+ * Default: PJSIP_TCP_TX_COALESCE_SIZE
+ */
+#ifndef PJSIP_TLS_TX_COALESCE_SIZE
+#   define PJSIP_TLS_TX_COALESCE_SIZE	    PJSIP_TCP_TX_COALESCE_SIZE
+#endif
+
+
 /**
  * This macro specifies whether full DNS resolution should be used.
  * When enabled, #pjsip_resolve() will perform asynchronous DNS SRV and
@@ -737,6 +937,28 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Enable WebSocket (RFC 7118) SIP transport support. Secure WebSocket
+ * additionally requires PJSIP_HAS_TLS_TRANSPORT.
+ *
+ * Default: 1 (enabled)
+ */
+#ifndef PJSIP_HAS_WS_TRANSPORT
+#   define PJSIP_HAS_WS_TRANSPORT	    1
+#endif
+
+
+/**
+ * Set the interval to send WebSocket ping frame for WS/WSS transports.
+ * If the value is zero, keep-alive will be disabled for WebSocket.
+ *
+ * Default: 90 (seconds)
+ */
+#ifndef PJSIP_WS_KEEP_ALIVE_INTERVAL
+#   define PJSIP_WS_KEEP_ALIVE_INTERVAL	    90
+#endif
+
+
 /* Endpoint. */
 #define PJSIP_MAX_TIMER_COUNT		(2*pjsip_cfg()->tsx.max_count + \
 					 2*PJSIP_MAX_DIALOG_COUNT)
@@ -789,6 +1011,33 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #   define PJSIP_POOL_INC_TDATA		4000
 #endif
 
+/**
+ * Number of released tdata and cloned rdata objects kept by each thread
+ * for reuse. Instead of releasing the pool of the object, the transport
+ * manager resets the pool and keeps it in the free list of the releasing
+ * thread, so that the next #pjsip_tx_data_create() or
+ * #pjsip_rx_data_clone() in that thread does not need to create a new
+ * pool. Set to zero to disable the recycling.
+ *
+ * Default: 16
+ */
+#ifndef PJSIP_TP_DATA_CACHE_SIZE
+#   define PJSIP_TP_DATA_CACHE_SIZE	16
+#endif
+
+/**
+ * Maximum number of threads that get their own tdata/rdata free list
+ * (see #PJSIP_TP_DATA_CACHE_SIZE). Objects created and released by other
+ * threads are not recycled. When a thread exits, its free list is emptied
+ * and given to the next thread that needs one, on platforms where PJLIB
+ * supports #pj_thread_local_alloc2().
+ *
+ * Default: 32
+ */
+#ifndef PJSIP_TP_DATA_CACHE_THREADS
+#   define PJSIP_TP_DATA_CACHE_THREADS	32
+#endif
+
 /**
  * Initial memory size for UA layer
  */
@@ -979,6 +1228,32 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Maximum length of realm plus account name of the entries in the server
+ * credential cache (see #pjsip_auth_srv_cache_create()), and of method
+ * plus request URI whose HA2 is kept in the server nonce store. Longer
+ * values are not cached.
+ *
+ * Default: 128
+ */
+#ifndef PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN
+#   define PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN 128
+#endif
+
+
+/**
+ * Maximum length of nonce that can be kept in the server nonce store
+ * (see #pjsip_auth_srv_nonce_store_create()). Challenges with longer
+ * nonce are rejected, and requests with longer nonce are treated as
+ * having unknown nonce.
+ *
+ * Default: 64
+ */
+#ifndef PJSIP_AUTH_SRV_NONCE_MAX_LEN
+#   define PJSIP_AUTH_SRV_NONCE_MAX_LEN	    64
+#endif
+
+
 /**
  * Specify the number of seconds to refresh the client registration
  * before the registration expires.
@@ -1023,6 +1298,43 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Default maximum number of REGISTER transactions that the bulk
+ * registration client keeps outstanding at the same time. Registrations
+ * that become due while this many transactions are pending wait for a
+ * free slot. See #pjsip_regc_bulk_create().
+ *
+ * Default: 32
+ */
+#ifndef PJSIP_REGC_BULK_MAX_PENDING
+#   define PJSIP_REGC_BULK_MAX_PENDING		32
+#endif
+
+
+/**
+ * Default random spread, in percent of the registration interval, that
+ * the bulk registration client applies when scheduling refreshes, so
+ * that registrations created at the same time do not stay synchronized.
+ *
+ * Default: 10
+ */
+#ifndef PJSIP_REGC_BULK_JITTER
+#   define PJSIP_REGC_BULK_JITTER		10
+#endif
+
+
+/**
+ * Default interval, in seconds, before the bulk registration client
+ * retries a failed registration, unless the registrar specifies a
+ * longer Retry-After.
+ *
+ * Default: 60
+ */
+#ifndef PJSIP_REGC_BULK_RETRY_INTERVAL
+#   define PJSIP_REGC_BULK_RETRY_INTERVAL	60
+#endif
+
+
 /*****************************************************************************
  *  SIP Event framework and presence settings.
  */
@@ -1038,6 +1350,24 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Specify the default jitter of client subscription refresh, as percentage
+ * of the subscription interval. The refresh is sent at a random time
+ * within this part of the interval before #PJSIP_EVSUB_TIME_UAC_REFRESH,
+ * so that subscriptions that have been created at the same time (e.g.
+ * after the phones have registered again) do not refresh in lockstep.
+ * Application may change the value of individual subscription with
+ * #pjsip_evsub_set_refresh_jitter().
+ *
+ * When this is zero, the refresh is only randomized by up to 10 seconds.
+ *
+ * Default: 0
+ */
+#ifndef PJSIP_EVSUB_UAC_REFRESH_JITTER
+#   define PJSIP_EVSUB_UAC_REFRESH_JITTER	0
+#endif
+
+
 /**
  * Specify the time (in seconds) to send PUBLISH to refresh client 
  * publication before the actual interval expires.
@@ -1073,6 +1403,32 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Specify the default maximum number of outstanding NOTIFY transactions
+ * of an event subscription server (see #pjsip_evsub_srv_create()). State
+ * changes for the remaining watchers are queued and sent as the
+ * outstanding transactions complete.
+ *
+ * Default: 256
+ */
+#ifndef PJSIP_EVSUB_SRV_MAX_PENDING
+#   define PJSIP_EVSUB_SRV_MAX_PENDING		256
+#endif
+
+
+/**
+ * Number of one second slots in the expiration wheel of an event
+ * subscription server. Each second the server only checks the watchers
+ * in one slot, so this should be in the order of the typical
+ * subscription interval divided by the acceptable check cost.
+ *
+ * Default: 512
+ */
+#ifndef PJSIP_EVSUB_SRV_WHEEL_SIZE
+#   define PJSIP_EVSUB_SRV_WHEEL_SIZE		512
+#endif
+
+
 /**
  * Specify the default expiration time for presence event subscription, for
  * both client and server subscription. For client subscription, application
@@ -1162,6 +1518,40 @@ PJ_INLINE(pjsip_cfg_t*) pjsip_cfg(void)
 #endif
 
 
+/**
+ * Maximum number of dialogs to keep in the dialog-info (RFC 4235) state
+ * table of a monitored line. Further dialogs in the notifications are
+ * ignored until some of the dialogs have been terminated.
+ *
+ * Default: 4
+ */
+#ifndef PJSIP_DIALOG_INFO_MAX_DIALOGS
+#   define PJSIP_DIALOG_INFO_MAX_DIALOGS	4
+#endif
+
+
+/**
+ * Maximum length of the remote party URI to keep for each dialog in the
+ * dialog-info state table. Longer URIs are truncated.
+ *
+ * Default: 128
+ */
+#ifndef PJSIP_DIALOG_INFO_MAX_URI_LEN
+#   define PJSIP_DIALOG_INFO_MAX_URI_LEN	128
+#endif
+
+
+/**
+ * Maximum length of the remote party display name to keep for each dialog
+ * in the dialog-info state table. Longer names are truncated.
+ *
+ * Default: 64
+ */
+#ifndef PJSIP_DIALOG_INFO_MAX_NAME_LEN
+#   define PJSIP_DIALOG_INFO_MAX_NAME_LEN	64
+#endif
+
+
 /**
  * Specify whether transport manager should maintain a list of transmit
  * buffer instances, so any possible dangling instance can be cleaned up
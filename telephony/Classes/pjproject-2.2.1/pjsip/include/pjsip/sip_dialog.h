@@ -181,6 +181,9 @@ struct pjsip_dialog
      */
     pjsip_host_port     via_addr;   /**< Via address.	                    */
     const void         *via_tp;     /**< Via transport.	                    */
+
+    /** Request template (opaque type). */
+    void	       *req_tpl;
 };
 
 
@@ -538,6 +541,19 @@ PJ_DECL(pj_status_t) pjsip_dlg_create_request(	pjsip_dialog *dlg,
 						pjsip_tx_data **tdata);
 
 
+/**
+ * Discard the request template of the dialog, so that it will be
+ * rebuilt from the current dialog state when the next request is created.
+ * The dialog detects changes made through the dialog API by itself, so
+ * application only needs to call this after modifying the dialog's
+ * target, route set, or local or remote info headers in place.
+ * See #PJSIP_DLG_USE_REQ_TEMPLATE.
+ *
+ * @param dlg		    The dialog instance.
+ */
+PJ_DECL(void) pjsip_dlg_invalidate_req_tpl( pjsip_dialog *dlg );
+
+
 /**
  * Send request message to remote peer. If the request is not an ACK request, 
  * the dialog will send the request statefully, by creating an UAC transaction
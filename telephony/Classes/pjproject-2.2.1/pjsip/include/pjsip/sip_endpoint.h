@@ -285,6 +285,462 @@ PJ_DECL(pj_status_t) pjsip_endpt_process_rx_data(pjsip_endpoint *endpt,
                                                  pjsip_process_rdata_param *p,
                                                  pj_bool_t *p_handled);
 
+
+/**
+ * Type of callback to get the dispatching key of an incoming message.
+ * See #pjsip_endpt_dispatcher_param.
+ *
+ * @param rdata		The incoming message.
+ * @param key		On input it contains the Call-ID of the message.
+ *			Application may change it to another key, or set
+ *			it to empty string to have the message distributed
+ *			to the workers in round-robin fashion.
+ */
+typedef void pjsip_endpt_dispatch_key_cb(pjsip_rx_data *rdata, pj_str_t *key);
+
+
+/**
+ * Type of callback of jobs posted with #pjsip_endpt_dispatch_job().
+ *
+ * @param endpt		The endpoint.
+ * @param user_data	The user data specified when posting the job.
+ */
+typedef void pjsip_endpt_job_cb(pjsip_endpoint *endpt, void *user_data);
+
+
+/**
+ * Parameters of the endpoint worker dispatcher, see
+ * #pjsip_endpt_start_dispatcher(). Application must initialize this
+ * structure with #pjsip_endpt_dispatcher_param_default().
+ */
+typedef struct pjsip_endpt_dispatcher_param
+{
+    /**
+     * Number of worker threads.
+     *
+     * Default: 4
+     */
+    unsigned			 worker_cnt;
+
+    /**
+     * Maximum number of pending events in each worker queue. Incoming
+     * messages that arrive when the queue is full are dropped.
+     *
+     * Default: PJSIP_ENDPT_WORKER_QUEUE_SIZE
+     */
+    unsigned			 queue_size;
+
+    /**
+     * Optional callback to get the dispatching key of incoming messages.
+     * If it is not set, messages are dispatched by their Call-ID.
+     *
+     * Default: NULL
+     */
+    pjsip_endpt_dispatch_key_cb	*on_get_key;
+
+} pjsip_endpt_dispatcher_param;
+
+
+/**
+ * Initialize dispatcher parameters with default values.
+ *
+ * @param param		The parameters.
+ */
+PJ_DECL(void) pjsip_endpt_dispatcher_param_default(
+					pjsip_endpt_dispatcher_param *param);
+
+
+/**
+ * Start worker dispatcher in the endpoint. Once started, incoming messages
+ * are no longer distributed to the modules by the thread that polls the
+ * endpoint; instead they are cloned and queued to one of the worker
+ * threads, selected by hashing the Call-ID (or the key returned by
+ * \a on_get_key). All messages of a dialog are therefore processed by the
+ * same worker, in the order they were received, so that workers rarely
+ * contend for the same dialog and transaction locks. Messages with empty
+ * key are distributed round-robin.
+ *
+ * Transaction timers (retransmission, timeout, and the transport error
+ * events that are posted through them) are run by the worker that
+ * created the transaction, or for transactions created outside the
+ * workers, by the worker of the Call-ID of the request. With a custom
+ * \a on_get_key that does not use the Call-ID, UAC transactions created
+ * outside the workers may therefore run their timers in a different
+ * worker than their responses.
+ *
+ * Other events are still run by the thread that polls the endpoint, and
+ * may run concurrently with the dialog's worker. These are the timers of
+ * the dialog usages (such as the invite session, session timer, 100rel
+ * and event subscription timers), transport callbacks (such as transport
+ * state and the send completion callbacks of transactions), and DNS
+ * resolution callbacks. They are still protected by the dialog and
+ * transaction locks, but they are not ordered with the dialog's
+ * messages. Application timers that need to run in the dialog's worker
+ * can be scheduled with #pjsip_endpt_schedule_worker_timer().
+ *
+ * Application still needs to poll the endpoint with
+ * #pjsip_endpt_handle_events() to receive packets and to run timers.
+ *
+ * The dispatcher should be started before the transports receive traffic,
+ * and it is stopped by #pjsip_endpt_stop_dispatcher() or when the endpoint
+ * is destroyed.
+ *
+ * @param endpt		The endpoint.
+ * @param param		Optional parameters, NULL for default.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_start_dispatcher(
+				    pjsip_endpoint *endpt,
+				    const pjsip_endpt_dispatcher_param *param);
+
+
+/**
+ * Stop the worker dispatcher and wait until all worker threads have quit.
+ * Messages and worker timers that are still queued are discarded, while
+ * pending jobs are run by the calling thread. This must not be called
+ * from a worker thread. Other threads may keep polling the endpoint;
+ * messages they receive after the dispatcher has been stopped are
+ * processed by the polling thread.
+ *
+ * @param endpt		The endpoint.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_stop_dispatcher(pjsip_endpoint *endpt);
+
+
+/**
+ * Get the number of dispatcher worker threads.
+ *
+ * @param endpt		The endpoint.
+ *
+ * @return		Number of workers, or zero if the dispatcher is not
+ *			running.
+ */
+PJ_DECL(unsigned) pjsip_endpt_get_worker_cnt(pjsip_endpoint *endpt);
+
+
+/**
+ * Get the index of the dispatcher worker that is running the calling
+ * thread.
+ *
+ * @param endpt		The endpoint.
+ *
+ * @return		Worker index, or -1 if the calling thread is not a
+ *			dispatcher worker.
+ */
+PJ_DECL(int) pjsip_endpt_get_current_worker(pjsip_endpoint *endpt);
+
+
+/**
+ * Get the index of the dispatcher worker that handles the specified key.
+ *
+ * @param endpt		The endpoint.
+ * @param key		The key, such as the Call-ID of a dialog. If it is
+ *			NULL or empty, a worker is selected in round-robin
+ *			fashion.
+ *
+ * @return		Worker index, or -1 if the dispatcher is not
+ *			running.
+ */
+PJ_DECL(int) pjsip_endpt_get_key_worker(pjsip_endpoint *endpt,
+					const pj_str_t *key);
+
+
+/**
+ * Post a job to the dispatcher worker that handles the specified key
+ * (such as the Call-ID of a dialog), so that it is serialized with the
+ * messages of the same key. If the dispatcher is not running, the job is
+ * called immediately by the calling thread.
+ *
+ * @param endpt		The endpoint.
+ * @param key		The key, or NULL or empty to select the worker in
+ *			round-robin fashion.
+ * @param cb		The job callback.
+ * @param user_data	User data to be given to the callback.
+ *
+ * @return		PJ_SUCCESS on success, or PJ_ETOOMANY if the worker
+ *			queue is full.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_dispatch_job(pjsip_endpoint *endpt,
+					      const pj_str_t *key,
+					      pjsip_endpt_job_cb *cb,
+					      void *user_data);
+
+
+/**
+ * Post a job to the specified dispatcher worker, such as the one returned
+ * by #pjsip_endpt_get_key_worker(). If the dispatcher is not running or
+ * the worker index is negative, the job is called immediately by the
+ * calling thread.
+ *
+ * @param endpt		The endpoint.
+ * @param worker	The worker index.
+ * @param cb		The job callback.
+ * @param user_data	User data to be given to the callback.
+ *
+ * @return		PJ_SUCCESS on success, or PJ_ETOOMANY if the worker
+ *			queue is full.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_dispatch_job_to(pjsip_endpoint *endpt,
+						 int worker,
+						 pjsip_endpt_job_cb *cb,
+						 void *user_data);
+
+
+/**
+ * Forward declaration of worker timer.
+ */
+typedef struct pjsip_worker_timer pjsip_worker_timer;
+
+
+/**
+ * Type of callback of worker timer.
+ *
+ * @param endpt		The endpoint.
+ * @param timer		The timer.
+ */
+typedef void pjsip_worker_timer_cb(pjsip_endpoint *endpt,
+				   pjsip_worker_timer *timer);
+
+
+/**
+ * Timer which callback is called by the dispatcher worker that handles
+ * the key of the timer, see #pjsip_endpt_schedule_worker_timer(). All
+ * fields except \a user_data are private.
+ */
+struct pjsip_worker_timer
+{
+    /** Application data. */
+    void		    *user_data;
+
+    /** Timer callback. */
+    pjsip_worker_timer_cb   *cb;
+
+    /** Internal timer entry. */
+    pj_timer_entry	     entry;
+
+    /** Internal: the endpoint. */
+    pjsip_endpoint	    *endpt;
+
+    /** Internal: index of the worker. */
+    unsigned		     worker;
+
+    /** Internal: schedule sequence, to ignore cancelled events. */
+    unsigned		     seq;
+};
+
+
+/**
+ * Initialize worker timer.
+ *
+ * @param timer		The timer.
+ * @param user_data	Application data.
+ * @param cb		Timer callback.
+ */
+PJ_DECL(void) pjsip_worker_timer_init(pjsip_worker_timer *timer,
+				      void *user_data,
+				      pjsip_worker_timer_cb *cb);
+
+
+/**
+ * Schedule worker timer. When the timer elapses, the callback is called by
+ * the dispatcher worker that handles the specified key, serialized with
+ * the messages and jobs of the same key. If the dispatcher is not running,
+ * the callback is called by the thread that polls the endpoint.
+ *
+ * @param endpt		The endpoint.
+ * @param timer		The timer, which must have been initialized with
+ *			#pjsip_worker_timer_init().
+ * @param key		The key (such as Call-ID), or NULL.
+ * @param delay		The relative delay of the timer.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_schedule_worker_timer(
+					    pjsip_endpoint *endpt,
+					    pjsip_worker_timer *timer,
+					    const pj_str_t *key,
+					    const pj_time_val *delay);
+
+
+/**
+ * Cancel worker timer. The callback will not be called after this function
+ * returns, even when the timer has elapsed and its event is already queued
+ * to the worker.
+ *
+ * @param endpt		The endpoint.
+ * @param timer		The timer.
+ */
+PJ_DECL(void) pjsip_endpt_cancel_worker_timer(pjsip_endpoint *endpt,
+					      pjsip_worker_timer *timer);
+
+
+/**
+ * Load counters of the endpoint, see #pjsip_endpt_get_load(). The
+ * counters are cumulative since the endpoint was created and wrap around,
+ * so callers should sample them periodically and use the difference.
+ * The poll and message counters only advance while an admission callback
+ * is installed (see #pjsip_endpt_set_admission_cb()), so that endpoints
+ * without overload control don't pay for them.
+ */
+typedef struct pjsip_endpt_load
+{
+    /** Number of ioqueue polls done by #pjsip_endpt_handle_events(). */
+    pj_uint32_t	    poll_cnt;
+
+    /** Number of ioqueue polls that found network events already pending,
+     *  without having to wait. When this gets close to \a poll_cnt, the
+     *  polling threads are not keeping up and packets are piling up in
+     *  the sockets.
+     */
+    pj_uint32_t	    busy_poll_cnt;
+
+    /** Number of incoming messages that have been processed. */
+    pj_uint32_t	    rx_msg_cnt;
+
+    /** Sum of the latency of the processed messages, in milliseconds,
+     *  measured from the time the packet was read from the transport
+     *  until all modules have processed the message.
+     */
+    pj_uint32_t	    rx_latency;
+
+    /** Number of events currently queued in the dispatcher workers. */
+    unsigned	    queued;
+
+    /** Total capacity of the dispatcher worker queues, zero if the
+     *  dispatcher is not running.
+     */
+    unsigned	    queue_size;
+
+} pjsip_endpt_load;
+
+
+/**
+ * Get the load counters of the endpoint.
+ *
+ * @param endpt		The endpoint.
+ * @param load		To receive the counters.
+ */
+PJ_DECL(void) pjsip_endpt_get_load(pjsip_endpoint *endpt,
+				   pjsip_endpt_load *load);
+
+
+/**
+ * Type of admission callback, see #pjsip_endpt_set_admission_cb().
+ *
+ * @param endpt		The endpoint.
+ * @param rdata		The incoming message.
+ *
+ * @return		PJ_TRUE to accept the message, or PJ_FALSE if the
+ *			callback has rejected (e.g. responded) the message
+ *			and it must not be processed further.
+ */
+typedef pj_bool_t pjsip_endpt_admission_cb(pjsip_endpoint *endpt,
+					   pjsip_rx_data *rdata);
+
+
+/**
+ * Set the admission callback of the endpoint. The callback is called by
+ * the thread that receives the message, for every valid incoming message
+ * before it is distributed to the modules or queued to the dispatcher
+ * workers, so messages that are rejected do not take any queue space.
+ * This is used by the overload control (see #pjsip_overload_init_module()).
+ *
+ * @param endpt		The endpoint.
+ * @param cb		The callback, or NULL to accept all messages.
+ */
+PJ_DECL(void) pjsip_endpt_set_admission_cb(pjsip_endpoint *endpt,
+					   pjsip_endpt_admission_cb *cb);
+
+
+/**
+ * Latency statistics of a module for one type of incoming message, see
+ * #pjsip_endpt_get_mod_stat(). The latency is the time spent in the
+ * \a on_rx_request() or \a on_rx_response() callback of the module,
+ * which includes the time spent in other modules' callbacks that are
+ * invoked from within it (e.g. the transaction layer calling the
+ * transaction user). The percentiles are taken from a histogram with
+ * four buckets per power of two, so they are accurate to within 25%.
+ */
+typedef struct pjsip_endpt_mod_stat
+{
+    /** Number of messages passed to the module. */
+    pj_uint32_t	    count;
+
+    /** Number of messages consumed (handled) by the module. */
+    pj_uint32_t	    consumed;
+
+    /** Average latency, in microseconds. */
+    pj_uint32_t	    avg;
+
+    /** Median latency, in microseconds. */
+    pj_uint32_t	    p50;
+
+    /** 90th percentile latency, in microseconds. */
+    pj_uint32_t	    p90;
+
+    /** 99th percentile latency, in microseconds. */
+    pj_uint32_t	    p99;
+
+    /** Maximum latency, in microseconds. */
+    pj_uint32_t	    max;
+
+} pjsip_endpt_mod_stat;
+
+
+/**
+ * Switch the collection of per module latency statistics on or off. The
+ * statistics are off initially. When they are on, the endpoint measures
+ * every callback of incoming messages to the modules and records it by
+ * module and by request method (or response). The statistics are printed
+ * by #pjsip_endpt_dump(). Switching them off keeps the statistics that
+ * have been collected. Each thread records into its own histograms
+ * without locking, and reading the statistics adds them up, so a reading
+ * taken while messages are being processed may be slightly inconsistent.
+ *
+ * This requires PJSIP_ENDPT_HAS_MOD_STAT.
+ *
+ * @param endpt		The endpoint.
+ * @param enable	PJ_TRUE to switch the statistics on.
+ *
+ * @return		PJ_SUCCESS, or PJ_ENOTSUP if the support is
+ *			disabled at compile time.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_enable_mod_stat(pjsip_endpoint *endpt,
+						 pj_bool_t enable);
+
+
+/**
+ * Clear the per module latency statistics.
+ *
+ * @param endpt		The endpoint.
+ */
+PJ_DECL(void) pjsip_endpt_reset_mod_stat(pjsip_endpoint *endpt);
+
+
+/**
+ * Get the latency statistics of a module for a type of incoming message.
+ *
+ * @param endpt		The endpoint.
+ * @param mod		The module.
+ * @param msg_type	PJSIP_REQUEST_MSG or PJSIP_RESPONSE_MSG.
+ * @param method	For requests, the method ID of the requests, where
+ *			PJSIP_OTHER_METHOD covers all other methods. Ignored
+ *			for responses.
+ * @param stat		To receive the statistics. All fields are zero if
+ *			the module has not received such messages.
+ *
+ * @return		PJ_SUCCESS, or PJ_ENOTSUP if the support is
+ *			disabled at compile time.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_get_mod_stat(pjsip_endpoint *endpt,
+					      const pjsip_module *mod,
+					      pjsip_msg_type_e msg_type,
+					      pjsip_method_e method,
+					      pjsip_endpt_mod_stat *stat);
+
 /**
  * Create pool from the endpoint. All SIP components should allocate their
  * memory pool by calling this function, to make sure that the pools are
@@ -235,6 +235,24 @@ PJ_BEGIN_DECL
  * application.
  */
 #define PJSIP_ETPNOTAVAIL	(PJSIP_ERRNO_START_PJSIP + 65)	/* 171065 */
+/**
+ * @hideinitializer
+ * Transport transmit queue is full. This error occurs when a connection
+ * oriented transport can not keep up with the outgoing traffic and the
+ * number of bytes waiting to be written has reached the configured limit.
+ */
+#define PJSIP_ETPQUEUEFULL	(PJSIP_ERRNO_START_PJSIP + 66)	/* 171066 */
+/**
+ * @hideinitializer
+ * WebSocket opening handshake has failed, e.g. the HTTP Upgrade request
+ * or response is malformed or the Sec-WebSocket-Accept value mismatches.
+ */
+#define PJSIP_EWSHANDSHAKE	(PJSIP_ERRNO_START_PJSIP + 67)	/* 171067 */
+/**
+ * @hideinitializer
+ * Invalid WebSocket frame received.
+ */
+#define PJSIP_EWSFRAME		(PJSIP_ERRNO_START_PJSIP + 68)	/* 171068 */
 
 /************************************************************
  * TRANSACTION ERRORS
@@ -401,6 +419,13 @@ PJ_BEGIN_DECL
  * No challenge is found in the challenge.
  */
 #define PJSIP_EAUTHNOCHAL	(PJSIP_ERRNO_START_PJSIP + 114)	/* 171114 */
+/**
+ * @hideinitializer
+ * The nonce in the authorization is unknown, expired, or its nonce count
+ * has been used (server side). The request should be challenged again
+ * with stale=true.
+ */
+#define PJSIP_EAUTHSTALENONCE	(PJSIP_ERRNO_START_PJSIP + 115)	/* 171115 */
 
 /************************************************************
  * UA AND DIALOG ERRORS
@@ -0,0 +1,208 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __PJSIP_SIP_OVERLOAD_H__
+#define __PJSIP_SIP_OVERLOAD_H__
+
+/**
+ * @file sip_overload.h
+ * @brief SIP Overload Control Module
+ */
+#include <pjsip/sip_types.h>
+
+
+PJ_BEGIN_DECL
+
+/**
+ * @defgroup PJSIP_OVERLOAD Overload Control
+ * @ingroup PJSIP_CORE_CORE
+ * @brief Reject excess new requests when the endpoint is overloaded.
+ * @{
+ *
+ * The overload control module periodically samples the load of the
+ * endpoint: the number of transactions, the number of messages waiting
+ * in the dispatcher queues (see #pjsip_endpt_start_dispatcher()), the
+ * average latency of processing incoming messages, and how often the
+ * ioqueue polls find packets already waiting in the sockets. From these
+ * it calculates the overload level, which is the percentage of new
+ * requests to reject.
+ *
+ * Only new requests (out of dialog requests other than ACK and CANCEL,
+ * e.g. INVITE and REGISTER) are rejected. Responses and in-dialog
+ * requests are always admitted, so that work which has already been
+ * accepted can complete. Rejected requests are answered statelessly
+ * with 503 (Service Unavailable) and a Retry-After header, before they
+ * are queued or create any transaction, so the cost of rejecting a
+ * request is a fraction of the cost of processing it and the goodput
+ * of the endpoint stays flat beyond its capacity.
+ *
+ * Optionally the module also sends the overload level to clients which
+ * support RFC 7339, in the "oc" parameter of the Via header of the
+ * responses.
+ *
+ * Application initializes the module with #pjsip_overload_init_module().
+ */
+
+/** Overload control parameters, see #pjsip_overload_param_default(). */
+typedef struct pjsip_overload_param
+{
+    /** Interval to sample the load and adjust the overload level, in
+     *  milliseconds.
+     *
+     *  Default: PJSIP_OVERLOAD_INTERVAL
+     */
+    unsigned	interval;
+
+    /** Number of transactions at which the endpoint is considered
+     *  overloaded, zero to disable. Note that non-INVITE server
+     *  transactions over UDP stay in Completed state for 32 seconds
+     *  (Timer J), so the suitable value depends on the request rate
+     *  that the endpoint can handle.
+     *
+     *  Default: 0
+     */
+    unsigned	max_tsx_cnt;
+
+    /** Number of messages waiting in the dispatcher queues at which the
+     *  endpoint is considered overloaded. Zero to use half of the total
+     *  capacity of the queues.
+     *
+     *  Default: 0
+     */
+    unsigned	max_backlog;
+
+    /** Average processing latency of incoming messages, in milliseconds,
+     *  at which the endpoint is considered overloaded. Zero to disable.
+     *
+     *  Default: PJSIP_OVERLOAD_MAX_LATENCY
+     */
+    unsigned	max_latency;
+
+    /** Percentage of ioqueue polls finding packets already pending at
+     *  which the endpoint is considered overloaded. Zero to disable.
+     *
+     *  Default: 90
+     */
+    unsigned	max_busy_poll;
+
+    /** Value of Retry-After header in the 503 response, in seconds.
+     *
+     *  Default: PJSIP_OVERLOAD_RETRY_AFTER
+     */
+    unsigned	retry_after;
+
+    /** Send RFC 7339 overload control feedback in responses to clients
+     *  that have put "oc" parameter in their Via header.
+     *
+     *  Default: PJ_FALSE
+     */
+    pj_bool_t	feedback;
+
+    /** Value of "oc-validity" parameter of the feedback, in milliseconds.
+     *
+     *  Default: PJSIP_OVERLOAD_OC_VALIDITY
+     */
+    unsigned	feedback_validity;
+
+} pjsip_overload_param;
+
+
+/** Overload control statistics, see #pjsip_overload_get_stat(). */
+typedef struct pjsip_overload_stat
+{
+    /** Current overload level, i.e. percentage of new requests rejected. */
+    unsigned	level;
+
+    /** Number of transactions at the last sample. */
+    unsigned	tsx_cnt;
+
+    /** Number of messages in the dispatcher queues at the last sample. */
+    unsigned	backlog;
+
+    /** Average processing latency during the last interval, in msec. */
+    unsigned	latency;
+
+    /** Percentage of ioqueue polls finding packets already pending
+     *  during the last interval.
+     */
+    unsigned	busy_poll;
+
+    /** Total number of new requests admitted. */
+    pj_uint32_t	admitted;
+
+    /** Total number of new requests rejected with 503. */
+    pj_uint32_t	rejected;
+
+} pjsip_overload_stat;
+
+
+/**
+ * Initialize overload control parameters with default values.
+ *
+ * @param param		The parameters.
+ */
+PJ_DECL(void) pjsip_overload_param_default(pjsip_overload_param *param);
+
+
+/**
+ * Initialize the overload control module and register it to the endpoint.
+ * The module installs the admission callback of the endpoint (see
+ * #pjsip_endpt_set_admission_cb()), and it can be unregistered with
+ * #pjsip_endpt_unregister_module(). Since other threads may still be
+ * admitting messages then, the resources of the module are only released
+ * when the endpoint is destroyed, and the module can only be registered
+ * again to the same endpoint.
+ *
+ * @param endpt		The endpoint.
+ * @param param		The parameters, or NULL to use the default values.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_overload_init_module(pjsip_endpoint *endpt,
+					const pjsip_overload_param *param);
+
+
+/**
+ * Get the overload control module instance.
+ *
+ * @return		The module instance.
+ */
+PJ_DECL(pjsip_module*) pjsip_overload_instance(void);
+
+
+/**
+ * Get the overload control statistics.
+ *
+ * @param stat		To receive the statistics.
+ *
+ * @return		PJ_SUCCESS, or PJ_EINVALIDOP if the module is not
+ *			initialized.
+ */
+PJ_DECL(pj_status_t) pjsip_overload_get_stat(pjsip_overload_stat *stat);
+
+
+/**
+ * @}
+ */
+
+PJ_END_DECL
+
+
+#endif	/* __PJSIP_SIP_OVERLOAD_H__ */
+
@@ -28,6 +28,7 @@
 #include <pjsip/sip_msg.h>
 #include <pjsip/sip_util.h>
 #include <pjsip/sip_transport.h>
+#include <pj/hash.h>
 #include <pj/timer.h>
 
 PJ_BEGIN_DECL
@@ -73,6 +74,27 @@ typedef enum pjsip_tsx_state_e
 } pjsip_tsx_state_e;
 
 
+/**
+ * Fixed-width binary transaction key. This is the key that is actually
+ * used to index the transaction table. For RFC 3261 messages it is
+ * derived from the branch parameter (branches generated by PJSIP for UAC
+ * transactions carry their own precomputed hash, so it does not need to
+ * be calculated), and for RFC 2543 messages it is a hash of the string
+ * key. Since it is only a fingerprint, a match is always verified against
+ * the transaction before it is accepted, and transactions whose keys
+ * collide are told apart by the probe value.
+ */
+typedef struct pjsip_tsx_bin_key
+{
+    pj_uint32_t	    hval;	/**< Primary hash, used by the hash table.  */
+    pj_uint32_t	    hval2;	/**< Secondary hash.			    */
+    pj_uint8_t	    role;	/**< Transaction role.			    */
+    pj_uint8_t	    method;	/**< Method id, ACK is stored as INVITE.    */
+    pj_uint8_t	    rfc2543;	/**< Non-zero if this is RFC 2543 key.	    */
+    pj_uint8_t	    probe;	/**< Collision slot, normally zero.	    */
+} pjsip_tsx_bin_key;
+
+
 /**
  * This structure describes SIP transaction object. The transaction object
  * is used to handle both UAS and UAC transaction.
@@ -90,6 +112,9 @@ struct pjsip_transaction
     pj_mutex_t		       *mutex_b;	/**< Second mutex to avoid
 						     deadlock. It is used to
 						     protect timer.	    */
+    int				worker;		/**< Dispatcher worker that
+						     runs the timers, or
+						     -1.		    */
 
     /*
      * Transaction identification.
@@ -98,9 +123,11 @@ struct pjsip_transaction
     pjsip_role_e		role;           /**< Role (UAS or UAC)      */
     pjsip_method		method;         /**< The method.            */
     pj_int32_t			cseq;           /**< The CSeq               */
-    pj_str_t			transaction_key;/**< Hash table key.        */
+    pj_str_t			transaction_key;/**< String key.            */
     pj_uint32_t			hashed_key;	/**< Key's hashed value.    */
     pj_str_t			branch;         /**< The branch Id.         */
+    pjsip_tsx_bin_key		bin_key;	/**< Hash table key.        */
+    pj_hash_entry_buf		hentry;		/**< Hash table entry.      */
 
     /*
      * State and status.
@@ -190,6 +217,30 @@ PJ_DECL(unsigned) pjsip_tsx_layer_get_tsx_count(void);
 PJ_DECL(pjsip_transaction*) pjsip_tsx_layer_find_tsx( const pj_str_t *key,
 						      pj_bool_t lock );
 
+/**
+ * Find the transaction that matches the incoming message. This is
+ * equivalent to creating the key with #pjsip_tsx_create_key() and calling
+ * #pjsip_tsx_layer_find_tsx(), but for RFC 3261 messages the lookup is
+ * done with the binary key calculated directly from the top Via branch,
+ * without building or allocating the string key. This is the preferred
+ * way to match e.g. CANCEL or ACK against the INVITE transaction.
+ *
+ * @param rdata	    The incoming message.
+ * @param role	    The role of the transaction to find.
+ * @param method    The method of the transaction to find.
+ * @param lock	    If non-zero, transaction will be locked before the
+ *		    function returns, to make sure that it's not deleted
+ *		    by other threads.
+ *
+ * @return	    The matching transaction instance, or NULL if transaction
+ *		    can not be found.
+ */
+PJ_DECL(pjsip_transaction*) pjsip_tsx_layer_find_rx_tsx(
+					    const pjsip_rx_data *rdata,
+					    pjsip_role_e role,
+					    const pjsip_method *method,
+					    pj_bool_t lock );
+
 /**
  * Create, initialize, and register a new transaction as UAC from the 
  * specified transmit data (\c tdata). The transmit data must have a valid
@@ -367,6 +418,23 @@ PJ_DECL(pj_status_t) pjsip_tsx_create_key( pj_pool_t *pool,
 				           const pjsip_method *method,
 				           const pjsip_rx_data *rdata );
 
+/**
+ * Create binary transaction key from the branch parameter of RFC 3261
+ * message. This does not allocate memory, and for UAC role, when the
+ * branch was generated by PJSIP the hash is decoded from the branch
+ * itself.
+ *
+ * @param key       Output key.
+ * @param role      The role of the transaction.
+ * @param method    The method to be put as a key.
+ * @param branch    The branch parameter, which must start with
+ *		    #PJSIP_RFC3261_BRANCH_ID.
+ */
+PJ_DECL(void) pjsip_tsx_create_bin_key( pjsip_tsx_bin_key *key,
+					pjsip_role_e role,
+					const pjsip_method *method,
+					const pj_str_t *branch );
+
 /**
  * Force terminate transaction.
  *
@@ -271,6 +271,34 @@ typedef struct pjsip_rx_data_op_key
 } pjsip_rx_data_op_key;
 
 
+/**
+ * Location of a header line in the message buffer of rdata.
+ */
+typedef struct pjsip_rx_hdr_pos
+{
+    int		start;	/**< Offset of the header name from msg_buf.	*/
+    int		end;	/**< Offset past the end of the header line,
+			     including continuation lines, or zero if
+			     the header is not present.			*/
+} pjsip_rx_hdr_pos;
+
+
+/**
+ * Positions of selected parts of the received message, recorded by the
+ * parser. These allow the message to be forwarded with in-place edits,
+ * without printing the parsed message (see #pjsip_endpt_fwd_raw_request()).
+ */
+typedef struct pjsip_rx_raw_pos
+{
+    int			hdr_start;	/**< Offset of the first header line,
+					     i.e. end of start line.	    */
+    pjsip_rx_hdr_pos	via;		/**< First Via header line.	    */
+    pjsip_rx_hdr_pos	max_fwd;	/**< Max-Forwards header line.	    */
+    pjsip_rx_hdr_pos	route;		/**< First Route header line.	    */
+    pjsip_rx_hdr_pos	record_route;	/**< First Record-Route header line.*/
+} pjsip_rx_raw_pos;
+
+
 /**
  * Incoming message buffer.
  * This structure keep all the information regarding the received message. This
@@ -395,6 +423,11 @@ struct pjsip_rx_data
 	 */
 	pjsip_supported_hdr	*supported;
 
+	/** Positions of the start line and selected header lines in
+	 *  msg_buf, as recorded by the parser.
+	 */
+	pjsip_rx_raw_pos	 raw_pos;
+
 	/** The list of error generated by the parser when parsing 
 	    this message. 
 	 */
@@ -628,6 +661,14 @@ struct pjsip_tx_data
      */
     pjsip_host_port          via_addr;      /**< Via address.	        */
     const void              *via_tp;        /**< Via transport.	        */
+
+    /**
+     * Group lock of the object whose memory is shared by the message, such
+     * as the request template of the dialog that created the request. The
+     * message holds a reference to it, which is released when the message
+     * is destroyed.
+     */
+    pj_grp_lock_t	    *shared_grp_lock;
 };
 
 
@@ -768,6 +809,53 @@ typedef enum pjsip_transport_dir
 } pjsip_transport_dir;
 
 
+/**
+ * This structure describes the state of the outgoing message queue of
+ * a connection oriented transport (such as TCP and TLS), as reported by
+ * #pjsip_transport_get_queue_info().
+ */
+typedef struct pjsip_transport_queue_info
+{
+    /**
+     * Number of messages waiting in the queue to be written.
+     */
+    unsigned		    queued_cnt;
+
+    /**
+     * Total size of messages waiting in the queue, in bytes.
+     */
+    pj_size_t		    queued_bytes;
+
+    /**
+     * Number of messages in the write operation currently in progress.
+     */
+    unsigned		    inflight_cnt;
+
+    /**
+     * Number of bytes in the write operation currently in progress.
+     */
+    pj_size_t		    inflight_bytes;
+
+    /**
+     * The queue limit, in bytes. Zero means the queue is not limited.
+     */
+    pj_size_t		    max_queued_bytes;
+
+    /**
+     * Total number of messages that have been sent as part of a
+     * coalesced (multi-message) write.
+     */
+    pj_uint32_t		    coalesced_cnt;
+
+    /**
+     * Total number of messages rejected with PJSIP_ETPQUEUEFULL because
+     * the queue limit has been reached.
+     */
+    pj_uint32_t		    rejected_cnt;
+
+} pjsip_transport_queue_info;
+
+
 /**
  * This structure represent the "public" interface of a SIP transport.
  * Applications normally extend this structure to include transport
@@ -865,6 +953,26 @@ struct pjsip_transport
      */
     pj_status_t (*destroy)(pjsip_transport *transport);
 
+    /**
+     * Optional function to retrieve the state of the outgoing message
+     * queue of this transport. Transports without an outgoing queue
+     * (e.g. UDP) leave this NULL. Application should use
+     * #pjsip_transport_get_queue_info() instead.
+     *
+     * @param transport	    The transport.
+     * @param info	    Structure to be filled with the queue info.
+     *
+     * @return		    PJ_SUCCESS on success.
+     */
+    pj_status_t (*get_queue_info)(pjsip_transport *transport,
+				  pjsip_transport_queue_info *info);
+
+    /**
+     * The connection pool this transport belongs to, if any. This is
+     * maintained by the transport manager.
+     */
+    void		   *conn_pool;
+
     /*
      * Application may extend this structure..
      */
@@ -939,6 +1047,203 @@ PJ_DECL(pj_status_t) pjsip_transport_add_ref( pjsip_transport *tp );
  */
 PJ_DECL(pj_status_t) pjsip_transport_dec_ref( pjsip_transport *tp );
 
+/**
+ * Get the state of the outgoing message queue of the transport, such as
+ * the number of queued messages and the number of bytes currently being
+ * written. This is only supported by connection oriented transports
+ * (TCP and TLS).
+ *
+ * @param tp		The transport instance.
+ * @param info		Structure to receive the queue info.
+ *
+ * @return		PJ_SUCCESS on success, or PJ_ENOTSUP if the
+ *			transport does not have an outgoing queue.
+ */
+PJ_DECL(pj_status_t) pjsip_transport_get_queue_info(
+					pjsip_transport *tp,
+					pjsip_transport_queue_info *info);
+
+
+/*****************************************************************************
+ *
+ * OUTGOING MESSAGE QUEUE.
+ *
+ *****************************************************************************
+ */
+
+/**
+ * An entry of the outgoing message queue (#pjsip_tx_queue).
+ */
+typedef struct pjsip_tx_queue_entry
+{
+    PJ_DECL_LIST_MEMBER(struct pjsip_tx_queue_entry);
+    pjsip_tx_data_op_key    *op_key;	/**< Op key of the transmit data.   */
+} pjsip_tx_queue_entry;
+
+/**
+ * Callbacks to be implemented by the transport that owns the outgoing
+ * message queue.
+ */
+typedef struct pjsip_tx_queue_cb
+{
+    /**
+     * Start writing data to the connection, with the same semantic as
+     * pj_activesock_send(). This is called with the transport lock held.
+     */
+    pj_status_t (*send)(pjsip_transport *tp, pj_ioqueue_op_key_t *op_key,
+			const void *data, pj_ssize_t *size);
+
+    /**
+     * Check whether the connection can be written, i.e. it has been
+     * established and it is not closing. This is called with the
+     * transport lock held.
+     */
+    pj_bool_t (*is_ready)(pjsip_transport *tp);
+
+    /**
+     * Notify the owner of the transmit data that the send has completed,
+     * and shutdown the transport if \a sent is not positive. This should
+     * return PJ_FALSE if the transport has been shutdown.
+     */
+    pj_bool_t (*tx_done)(pjsip_transport *tp, pj_ioqueue_op_key_t *op_key,
+			 pj_ssize_t sent);
+
+    /**
+     * Optional callback to get the size of the frame for a message of the
+     * specified length. When the framing callbacks are set, every message
+     * is framed into the write buffer rather than written directly from
+     * its transmit data buffer.
+     */
+    pj_size_t (*frame_len)(pjsip_transport *tp, pj_size_t len);
+
+    /**
+     * Build the frame for the message into \a buf, and return the size of
+     * the frame. This must be set if \a frame_len is set.
+     */
+    pj_size_t (*build_frame)(pjsip_transport *tp, char *buf,
+			     const char *msg, pj_size_t len);
+
+} pjsip_tx_queue_cb;
+
+/**
+ * The outgoing message queue of connection oriented transports. Messages
+ * sent while a write is still in progress are queued, and once the write
+ * completes the queued messages are copied into one buffer and written
+ * together with a single send operation. Sending fails with
+ * PJSIP_ETPQUEUEFULL once the queue limit is reached. The queue is
+ * protected by the transport lock, which must be recursive.
+ */
+typedef struct pjsip_tx_queue
+{
+    pjsip_transport	    *tp;	    /**< The owner transport.	    */
+    pjsip_tx_queue_cb	     cb;	    /**< The transport callbacks.   */
+    pj_size_t		     max_bytes;	    /**< Queue limit, 0: unlimited. */
+    pj_size_t		     buf_size;	    /**< Write buffer size.	    */
+
+    pjsip_tx_queue_entry     list;	    /**< Queued messages.	    */
+    unsigned		     cnt;	    /**< Number of queued messages. */
+    pj_size_t		     bytes;	    /**< Size of queued messages.   */
+
+    unsigned		     inflight_cnt;  /**< Messages being written.    */
+    pj_size_t		     inflight_bytes;/**< Bytes being written.	    */
+    pjsip_tx_queue_entry     batch;	    /**< Messages in the buffer.    */
+    pjsip_tx_data_op_key     op_key;	    /**< Op key of buffer writes.   */
+    char		    *buf;	    /**< The write buffer.	    */
+
+    pj_uint32_t		     coalesced_cnt; /**< Coalesced messages.	    */
+    pj_uint32_t		     rejected_cnt;  /**< Rejected messages.	    */
+
+} pjsip_tx_queue;
+
+
+/**
+ * Initialize the outgoing message queue of a transport.
+ *
+ * @param q		The queue.
+ * @param tp		The transport that owns the queue.
+ * @param cb		The transport callbacks.
+ * @param max_bytes	The queue limit in bytes, zero for unlimited.
+ * @param buf_size	Size of the write buffer, which is allocated from
+ *			the transport pool on first use. Zero disables
+ *			coalescing, unless framing callbacks are set.
+ */
+PJ_DECL(void) pjsip_tx_queue_init(pjsip_tx_queue *q,
+				  pjsip_transport *tp,
+				  const pjsip_tx_queue_cb *cb,
+				  pj_size_t max_bytes,
+				  pj_size_t buf_size);
+
+/**
+ * Send the transmit data. The message is written right away when no other
+ * write is in progress, otherwise it is queued. The op_key of the transmit
+ * data must have been initialized by the transport.
+ *
+ * @param q		The queue.
+ * @param tdata		The transmit data.
+ *
+ * @return		PJ_EPENDING if the message is being written or has
+ *			been queued, PJ_SUCCESS if it has been written
+ *			immediately, PJSIP_ETPQUEUEFULL if the queue is
+ *			full, or other error code if the write has failed
+ *			immediately, in which case the transport should
+ *			be shutdown.
+ */
+PJ_DECL(pj_status_t) pjsip_tx_queue_send(pjsip_tx_queue *q,
+					 pjsip_tx_data *tdata);
+
+/**
+ * Add the transmit data to the queue regardless of the queue limit and
+ * without writing it, e.g. for messages accumulated while the connection
+ * is being established. Call #pjsip_tx_queue_flush() to write them.
+ *
+ * @param q		The queue.
+ * @param op_key	The op_key of the transmit data.
+ */
+PJ_DECL(void) pjsip_tx_queue_add(pjsip_tx_queue *q,
+				 pjsip_tx_data_op_key *op_key);
+
+/**
+ * Write the queued messages if the connection is ready and no other write
+ * is in progress.
+ *
+ * @param q		The queue.
+ */
+PJ_DECL(void) pjsip_tx_queue_flush(pjsip_tx_queue *q);
+
+/**
+ * The transport must call this function when a write started by the queue
+ * has completed, i.e. for every op_key other than its own.
+ *
+ * @param q		The queue.
+ * @param op_key	The completed op_key.
+ * @param sent		Number of bytes sent, or negative error code.
+ *
+ * @return		PJ_FALSE if the transport has been shutdown.
+ */
+PJ_DECL(pj_bool_t) pjsip_tx_queue_on_data_sent(pjsip_tx_queue *q,
+					       pj_ioqueue_op_key_t *op_key,
+					       pj_ssize_t sent);
+
+/**
+ * Remove all queued messages, including the ones in the buffer being
+ * written, and report them as failed with the specified reason. This is
+ * called when the transport is being destroyed.
+ *
+ * @param q		The queue.
+ * @param reason	The error code to report.
+ */
+PJ_DECL(void) pjsip_tx_queue_cancel(pjsip_tx_queue *q, pj_status_t reason);
+
+/**
+ * Get the state of the queue, to implement the \a get_queue_info
+ * callback of the transport.
+ *
+ * @param q		The queue.
+ * @param info		Structure to receive the queue info.
+ */
+PJ_DECL(void) pjsip_tx_queue_get_info(pjsip_tx_queue *q,
+				      pjsip_transport_queue_info *info);
+
 
 /**
  * This function is called by transport instances to report an incoming 
@@ -1294,6 +1599,121 @@ PJ_DECL(pj_status_t) pjsip_tpmgr_acquire_transport2(pjsip_tpmgr *mgr,
 						    pjsip_tx_data *tdata,
 						    pjsip_transport **tp);
 
+/**
+ * Connection pool settings, see #pjsip_tpmgr_set_conn_pool().
+ */
+typedef struct pjsip_tpmgr_conn_pool_cfg
+{
+    /**
+     * Maximum number of parallel connections to the destination. The
+     * value must not exceed PJSIP_TPMGR_CONN_POOL_MAX.
+     *
+     * Default: 1
+     */
+    unsigned	max_conn;
+
+    /**
+     * Number of connections which are kept open even when they are idle
+     * (warm standby). The pool holds a reference to these connections so
+     * they are not destroyed by the idle timer, and connections which are
+     * lost are established again the next time a transport to the
+     * destination is acquired. Must not exceed \a max_conn.
+     *
+     * Default: 0
+     */
+    unsigned	min_conn;
+
+    /**
+     * A new connection is opened, as long as the pool is not full, when the
+     * least loaded connection has more than this number of bytes queued or
+     * being written.
+     *
+     * Default: 0 (open a new connection whenever all connections are busy)
+     */
+    pj_size_t	grow_bytes;
+
+} pjsip_tpmgr_conn_pool_cfg;
+
+
+/**
+ * Connection pool info, see #pjsip_tpmgr_get_conn_pool_info().
+ */
+typedef struct pjsip_tpmgr_conn_pool_info
+{
+    /**
+     * Number of connections in the pool, including incoming connections
+     * aliased to the destination.
+     */
+    unsigned	conn_cnt;
+
+    /**
+     * Number of connections held open by the pool.
+     */
+    unsigned	standby_cnt;
+
+    /**
+     * Non-zero if the pool was created implicitly by RFC 5923 alias of
+     * incoming connections rather than by #pjsip_tpmgr_set_conn_pool().
+     */
+    pj_bool_t	is_alias;
+
+} pjsip_tpmgr_conn_pool_info;
+
+
+/**
+ * Initialize connection pool settings with default values.
+ *
+ * @param cfg	    The settings to be initialized.
+ */
+PJ_DECL(void) pjsip_tpmgr_conn_pool_cfg_default(pjsip_tpmgr_conn_pool_cfg *cfg);
+
+
+/**
+ * Configure a pool of parallel connections to the specified destination of
+ * connection oriented transport type (e.g. to an upstream proxy). Once
+ * configured, #pjsip_tpmgr_acquire_transport2() to the destination returns
+ * the connection in the pool with the least bytes queued for sending, and
+ * opens another connection when all of them are busy and the pool is not
+ * full. The \a min_conn connections are opened by this function.
+ *
+ * Incoming connections aliased to the destination (RFC 5923, see
+ * \a accept_via_alias in pjsip_cfg_t) are also members of the pool.
+ *
+ * @param mgr	    The transport manager.
+ * @param type	    Transport type, must be connection oriented.
+ * @param remote    The destination address.
+ * @param addr_len  Length of the destination address.
+ * @param cfg	    Pool settings, or NULL (or zero \a max_conn) to remove
+ *		    the pool and release the connections held by the pool.
+ *
+ * @return	    PJ_SUCCESS on success, or the appropriate error code.
+ */
+PJ_DECL(pj_status_t) pjsip_tpmgr_set_conn_pool(pjsip_tpmgr *mgr,
+					pjsip_transport_type_e type,
+					const pj_sockaddr_t *remote,
+					int addr_len,
+					const pjsip_tpmgr_conn_pool_cfg *cfg);
+
+
+/**
+ * Get the info of the connection pool to the specified destination.
+ *
+ * @param mgr	    The transport manager.
+ * @param type	    Transport type.
+ * @param remote    The destination address.
+ * @param addr_len  Length of the destination address.
+ * @param info	    Structure to receive the info.
+ *
+ * @return	    PJ_SUCCESS on success, or PJ_ENOTFOUND if there is no
+ *		    connection pool for the destination.
+ */
+PJ_DECL(pj_status_t) pjsip_tpmgr_get_conn_pool_info(pjsip_tpmgr *mgr,
+					pjsip_transport_type_e type,
+					const pj_sockaddr_t *remote,
+					int addr_len,
+					pjsip_tpmgr_conn_pool_info *info);
+
+
 /**
  * Type of callback to receive notification when message or raw data
  * has been sent.
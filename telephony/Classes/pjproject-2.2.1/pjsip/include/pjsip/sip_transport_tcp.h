@@ -104,6 +104,14 @@ typedef struct pjsip_tcp_transport_cfg
      */
     pj_qos_params	qos_params;
 
+    /**
+     * Outgoing queue limit of each connection, see
+     * #PJSIP_TCP_TX_QUEUE_MAX_BYTES.
+     *
+     * Default: PJSIP_TCP_TX_QUEUE_MAX_BYTES
+     */
+    pj_size_t		max_tx_queue_bytes;
+
 } pjsip_tcp_transport_cfg;
 
 
@@ -205,6 +205,14 @@ typedef struct pjsip_tls_setting
      */
     pj_bool_t qos_ignore_error;
 
+    /**
+     * Outgoing queue limit of each connection, see
+     * #PJSIP_TCP_TX_QUEUE_MAX_BYTES.
+     *
+     * Default: PJSIP_TLS_TX_QUEUE_MAX_BYTES
+     */
+    pj_size_t max_tx_queue_bytes;
+
 } pjsip_tls_setting;
 
 
@@ -234,6 +242,7 @@ PJ_INLINE(void) pjsip_tls_setting_default(pjsip_tls_setting *tls_opt)
     tls_opt->reuse_addr = PJSIP_TLS_TRANSPORT_REUSEADDR;
     tls_opt->qos_type = PJ_QOS_TYPE_BEST_EFFORT;
     tls_opt->qos_ignore_error = PJ_TRUE;
+    tls_opt->max_tx_queue_bytes = PJSIP_TLS_TX_QUEUE_MAX_BYTES;
 }
 
 
@@ -0,0 +1,200 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#ifndef __PJSIP_TRANSPORT_WS_H__
+#define __PJSIP_TRANSPORT_WS_H__
+
+/**
+ * @file sip_transport_ws.h
+ * @brief SIP WebSocket Transport (RFC 7118).
+ */
+
+#include <pjsip/sip_transport.h>
+#include <pjsip/sip_transport_tls.h>
+#include <pj/sock_qos.h>
+
+
+/* Only declare the API if PJ_HAS_TCP and PJSIP_HAS_WS_TRANSPORT are true */
+#if defined(PJ_HAS_TCP) && PJ_HAS_TCP!=0 && \
+    defined(PJSIP_HAS_WS_TRANSPORT) && PJSIP_HAS_WS_TRANSPORT!=0
+
+
+PJ_BEGIN_DECL
+
+/**
+ * @defgroup PJSIP_TRANSPORT_WS WebSocket Transport
+ * @ingroup PJSIP_TRANSPORT
+ * @brief API to create and register WebSocket (WS and WSS) transport.
+ * @{
+ * The functions below are used to create SIP over WebSocket transport
+ * as specified by RFC 7118, and register the transport to the framework.
+ *
+ * The listener accepts HTTP Upgrade requests for the "sip" WebSocket
+ * subprotocol, and the factory can also establish outgoing WebSocket
+ * connections. Each SIP message is carried in one WebSocket message
+ * (which may be fragmented into several frames). WSS runs the same
+ * protocol over TLS, and is only available when PJSIP_HAS_TLS_TRANSPORT
+ * is enabled.
+ *
+ * Note that incoming messages still go through the stream message
+ * parser, so they must contain a Content-Length header.
+ */
+
+/**
+ * Settings to be specified when creating the WebSocket transport.
+ * Application should initialize this structure with its default values
+ * by calling pjsip_ws_transport_cfg_default().
+ */
+typedef struct pjsip_ws_transport_cfg
+{
+    /**
+     * Address family to use. Valid values are pj_AF_INET() and
+     * pj_AF_INET6(). Default is pj_AF_INET().
+     */
+    int			af;
+
+    /**
+     * Create secure WebSocket (WSS) transport instead of plain WS. The
+     * TLS parameters are taken from \a tls_setting.
+     *
+     * Default: PJ_FALSE
+     */
+    pj_bool_t		secure;
+
+    /**
+     * Optional address to bind the socket to. Default is to bind to
+     * PJ_INADDR_ANY and to any available port.
+     */
+    pj_sockaddr		bind_addr;
+
+    /**
+     * Should SO_REUSEADDR be used for the listener socket.
+     * Default value is PJSIP_TCP_TRANSPORT_REUSEADDR.
+     */
+    pj_bool_t		reuse_addr;
+
+    /**
+     * Optional published address, which is the address to be
+     * advertised as the address of this SIP transport.
+     * By default the bound address will be used as the published address.
+     */
+    pjsip_host_port	addr_name;
+
+    /**
+     * Number of simultaneous asynchronous accept() operations to be
+     * supported.
+     *
+     * Default: 1
+     */
+    unsigned	       async_cnt;
+
+    /**
+     * The HTTP resource path. Incoming handshakes for other paths are
+     * rejected with 404, and outgoing handshakes request this path.
+     * Empty means incoming handshakes for any path are accepted.
+     *
+     * Default: "/"
+     */
+    pj_str_t		path;
+
+    /**
+     * QoS traffic type to be set on this transport.
+     *
+     * Default is QoS not set.
+     */
+    pj_qos_type		qos_type;
+
+    /**
+     * Set the low level QoS parameters to the transport.
+     *
+     * Default is QoS not set.
+     */
+    pj_qos_params	qos_params;
+
+    /**
+     * Outgoing queue limit of each connection, see
+     * #PJSIP_TCP_TX_QUEUE_MAX_BYTES.
+     *
+     * Default: PJSIP_TCP_TX_QUEUE_MAX_BYTES
+     */
+    pj_size_t		max_tx_queue_bytes;
+
+    /**
+     * TLS settings for WSS transport. Only the method, ciphers, certificate
+     * and timeout settings are used. Ignored when \a secure is not set.
+     */
+    pjsip_tls_setting	tls_setting;
+
+} pjsip_ws_transport_cfg;
+
+
+/**
+ * Initialize pjsip_ws_transport_cfg structure with default values for
+ * the specifed address family.
+ *
+ * @param cfg		The structure to initialize.
+ * @param af		Address family to be used.
+ */
+PJ_DECL(void) pjsip_ws_transport_cfg_default(pjsip_ws_transport_cfg *cfg,
+					     int af);
+
+
+/**
+ * Register support for SIP WebSocket transport by creating WebSocket
+ * listener on the specified address and port. This function will create
+ * a WS (or WSS) listener and register it to the transport manager, so
+ * that incoming connections are accepted and outgoing connections to
+ * "transport=ws" (or "transport=wss") destinations can be created.
+ *
+ * @param endpt		The SIP endpoint.
+ * @param cfg		WebSocket transport settings.
+ * @param p_factory	Optional pointer to receive the instance of the
+ *			SIP WebSocket transport factory just created.
+ *
+ * @return		PJ_SUCCESS when the transport has been successfully
+ *			started and registered to transport manager, or
+ *			the appropriate error code.
+ */
+PJ_DECL(pj_status_t) pjsip_ws_transport_start(pjsip_endpoint *endpt,
+					      const pjsip_ws_transport_cfg *cfg,
+					      pjsip_tpfactory **p_factory);
+
+
+/**
+ * Compute the value of Sec-WebSocket-Accept header for the specified
+ * Sec-WebSocket-Key, as described by RFC 6455 section 4.2.2.
+ *
+ * @param key		The Sec-WebSocket-Key value.
+ * @param buf		Buffer to receive the null terminated value. The
+ *			buffer must be at least 29 characters long.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsip_ws_calc_accept(const pj_str_t *key, char buf[29]);
+
+
+PJ_END_DECL
+
+/**
+ * @}
+ */
+
+#endif	/* PJ_HAS_TCP && PJSIP_HAS_WS_TRANSPORT */
+
+#endif	/* __PJSIP_TRANSPORT_WS_H__ */
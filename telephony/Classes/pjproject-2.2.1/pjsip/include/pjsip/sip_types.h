@@ -82,6 +82,12 @@ typedef enum pjsip_transport_type_e
     /** Loopback (datagram, unreliable) */
     PJSIP_TRANSPORT_LOOP_DGRAM,
 
+    /** WebSocket (RFC 7118) */
+    PJSIP_TRANSPORT_WS,
+
+    /** Secure WebSocket (RFC 7118) */
+    PJSIP_TRANSPORT_WSS,
+
     /** Start of user defined transport */
     PJSIP_TRANSPORT_START_OTHER,
 
@@ -95,7 +101,13 @@ typedef enum pjsip_transport_type_e
     PJSIP_TRANSPORT_TCP6 = PJSIP_TRANSPORT_TCP + PJSIP_TRANSPORT_IPV6,
 
     /** TLS over IPv6 */
-    PJSIP_TRANSPORT_TLS6 = PJSIP_TRANSPORT_TLS + PJSIP_TRANSPORT_IPV6
+    PJSIP_TRANSPORT_TLS6 = PJSIP_TRANSPORT_TLS + PJSIP_TRANSPORT_IPV6,
+
+    /** WebSocket over IPv6 */
+    PJSIP_TRANSPORT_WS6 = PJSIP_TRANSPORT_WS + PJSIP_TRANSPORT_IPV6,
+
+    /** Secure WebSocket over IPv6 */
+    PJSIP_TRANSPORT_WSS6 = PJSIP_TRANSPORT_WSS + PJSIP_TRANSPORT_IPV6
 
 } pjsip_transport_type_e;
 
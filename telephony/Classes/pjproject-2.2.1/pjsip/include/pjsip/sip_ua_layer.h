@@ -58,6 +58,16 @@ typedef struct pjsip_ua_init_param
      *  dialog has forked.
      */
     pjsip_dialog* (*on_dlg_forked)(pjsip_dialog *first_set, pjsip_rx_data *res);
+
+    /** Expected number of concurrent dialog sets, used to size the
+     *  dialog hash table. The table is split into
+     *  PJSIP_UA_DLG_TABLE_STRIPES stripes, each protected by its own
+     *  mutex.
+     *
+     *  Default: 0 (PJSIP_MAX_DIALOG_COUNT)
+     */
+    unsigned max_dlg_cnt;
+
 } pjsip_ua_init_param;
 
 /**
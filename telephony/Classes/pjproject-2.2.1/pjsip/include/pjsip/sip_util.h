@@ -839,6 +839,132 @@ PJ_DECL(pj_status_t) pjsip_endpt_create_response_fwd( pjsip_endpoint *endpt,
 
 
 
+/**
+ * Parameters for forwarding request with #pjsip_endpt_fwd_raw_request().
+ * Application should initialize this structure with
+ * #pjsip_fwd_raw_param_default().
+ */
+typedef struct pjsip_fwd_raw_param
+{
+    /**
+     * Transport type to forward the request with. This must be specified.
+     */
+    pjsip_transport_type_e  tp_type;
+
+    /**
+     * The resolved address of the next hop. This must be specified.
+     */
+    pj_sockaddr		    dst_addr;
+
+    /**
+     * Length of the address in \a dst_addr.
+     */
+    int			    dst_addr_len;
+
+    /**
+     * Optional transport selector to send the request with.
+     */
+    const pjsip_tpselector *sel;
+
+    /**
+     * Optional new Request-URI, as text. If empty, the Request-URI of
+     * the received request is kept.
+     */
+    pj_str_t		    uri;
+
+    /**
+     * Optional branch parameter for the Via header added by the proxy.
+     * If empty, #pjsip_calculate_branch_id() will be used.
+     */
+    pj_str_t		    branch;
+
+    /**
+     * Remove the top-most Route header value, i.e. when it refers to
+     * this proxy (RFC 3261 section 16.4).
+     *
+     * Default: PJ_FALSE
+     */
+    pj_bool_t		    strip_route;
+
+    /**
+     * Optional Record-Route header value to add as the top-most
+     * Record-Route, e.g. "<sip:proxy.example.com;lr>".
+     */
+    pj_str_t		    record_route;
+
+} pjsip_fwd_raw_param;
+
+
+/**
+ * Initialize #pjsip_fwd_raw_param with default values.
+ *
+ * @param param	    The parameter to be initialized.
+ */
+PJ_DECL(void) pjsip_fwd_raw_param_default(pjsip_fwd_raw_param *param);
+
+
+/**
+ * Forward the request in rdata without creating a new message. Unlike
+ * #pjsip_endpt_create_request_fwd(), which clones the parsed message and
+ * prints it again, this function copies the received packet to a transmit
+ * buffer while applying the proxy changes directly on the text, using the
+ * header positions recorded by the parser:
+ *  - a Via header for the outgoing transport is added,
+ *  - the received and rport parameters of the incoming top-most Via are
+ *    updated,
+ *  - Max-Forwards is decremented (or added with value 70),
+ *  - the top-most Route value is optionally removed, and
+ *  - a Record-Route value and new Request-URI are optionally added.
+ *
+ * The message is then sent with #pjsip_tpmgr_send_raw(), so it will not
+ * be seen by the modules' on_tx_request() callbacks.
+ *
+ * Application must have verified the request (e.g. Max-Forwards and
+ * loop checks) before calling this function.
+ *
+ * @param endpt	    The endpoint instance.
+ * @param rdata	    The incoming request message.
+ * @param param	    Forwarding parameters.
+ * @param token	    Token to be passed to the callback.
+ * @param cb	    Optional callback to be called when the request has
+ *		    been sent.
+ *
+ * @return	    PJ_SUCCESS if the request has been sent, PJ_EPENDING
+ *		    if the callback will be called later, or the appropriate
+ *		    error code.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_fwd_raw_request(pjsip_endpoint *endpt,
+						 pjsip_rx_data *rdata,
+						 const pjsip_fwd_raw_param *param,
+						 void *token,
+						 pjsip_tp_send_callback cb);
+
+
+/**
+ * Forward the response in rdata without creating a new message. The
+ * top-most Via value is removed from the received packet, and the result
+ * is sent with #pjsip_tpmgr_send_raw() to the address in the next Via
+ * header (using its received and rport parameters when present). Note
+ * that if this address is not an IP address, it will be resolved
+ * synchronously.
+ *
+ * @param endpt	    The endpoint instance.
+ * @param rdata	    The incoming response message. Application should have
+ *		    checked that the top-most Via refers to this proxy.
+ * @param token	    Token to be passed to the callback.
+ * @param cb	    Optional callback to be called when the response has
+ *		    been sent.
+ *
+ * @return	    PJ_SUCCESS if the response has been sent, PJ_EPENDING
+ *		    if the callback will be called later, or the appropriate
+ *		    error code.
+ */
+PJ_DECL(pj_status_t) pjsip_endpt_fwd_raw_response(pjsip_endpoint *endpt,
+						  pjsip_rx_data *rdata,
+						  void *token,
+						  pjsip_tp_send_callback cb);
+
+
 /**
  * Create a globally unique branch parameter based on the information in 
  * the incoming request message, for the purpose of creating a new request
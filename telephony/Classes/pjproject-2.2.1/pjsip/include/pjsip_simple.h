@@ -34,13 +34,16 @@
 #ifndef __PJSIP_SIMPLE_H__
 #define __PJSIP_SIMPLE_H__
 
+#include <pjsip-simple/dialog_info.h>
 #include <pjsip-simple/evsub.h>
 #include <pjsip-simple/evsub_msg.h>
+#include <pjsip-simple/evsub_srv.h>
 #include <pjsip-simple/iscomposing.h>
 #include <pjsip-simple/mwi.h>
 #include <pjsip-simple/presence.h>
 #include <pjsip-simple/pidf.h>
 #include <pjsip-simple/publish.h>
+#include <pjsip-simple/rlmi.h>
 #include <pjsip-simple/xpidf.h>
 
 #endif	/* __PJSIP_SIMPLE_H__ */
@@ -478,6 +478,21 @@ typedef struct pjsua_sla_info
     pjsip_rx_data   *rdata;     /**< The received NOTIFY request.       */
     int             line;
     int             type;
+    pjsip_msg_body  *body;      /**< The dialog-info body of the line. For
+				     BLF lines monitored with a resource
+				     list, this is the part of the NOTIFY
+				     body that belongs to the line, and it
+				     is NULL if the NOTIFY has no state
+				     for the line. */
+    pj_bool_t       has_state;  /**< Whether \a state is valid, i.e. the
+				     body is a dialog-info document, or the
+				     subscription has been terminated.	*/
+    pjsip_dialog_info_line_state state;
+				/**< The state of the line, derived from
+				     the full and partial notifications
+				     received so far. The callback is only
+				     called for a valid dialog-info
+				     document when this has changed.	*/
 } pjsua_sla_info;
 
 /**
@@ -1428,14 +1443,22 @@ typedef struct pjsua_config
 {
 
     /** 
-     * Maximum calls to support (default: 4). The value specified here
-     * must be smaller than the compile time maximum settings 
-     * PJSUA_MAX_CALLS, which by default is 32. To increase this 
-     * limit, the library must be recompiled with new PJSUA_MAX_CALLS
-     * value.
+     * Maximum calls to support (default: 4). The call table is allocated
+     * with this size when the library is initialized, while the media
+     * state of a call is only allocated when the call slot is used, with
+     * room for the media lines of the call. Hence large values cost little
+     * memory until the calls are actually made.
      */
     unsigned	    max_calls;
 
+    /**
+     * Maximum number of accounts. The account table is allocated with
+     * this size when the library is initialized.
+     *
+     * Default: PJSUA_MAX_ACC
+     */
+    unsigned	    max_acc;
+
     /** 
      * Number of worker threads. Normally application will want to have at
      * least one worker thread, unless when it wants to poll the library
@@ -2507,8 +2530,11 @@ PJ_DECL(pj_status_t) pjsua_transport_close( pjsua_transport_id id,
  * header in outgoing requests.
  *
  * PJSUA-API supports creating and managing multiple accounts. The maximum
- * number of accounts is limited by a compile time constant
- * <tt>PJSUA_MAX_ACC</tt>.
+ * number of accounts is specified by \a max_acc field of #pjsua_config,
+ * which defaults to the compile time constant <tt>PJSUA_MAX_ACC</tt>.
+ * Incoming requests are matched to the accounts by hash tables of their
+ * user and domain parts, so large number of accounts does not slow down
+ * message processing.
  *
  * Account may or may not have client registration associated with it.
  * An account is also associated with <b>route set</b> and some <b>authentication
@@ -2536,7 +2562,8 @@ PJ_DECL(pj_status_t) pjsua_transport_close( pjsua_transport_id id,
  */
 
 /**
- * Maximum accounts.
+ * Default maximum number of accounts, see \a max_acc field of
+ * #pjsua_config.
  */
 #ifndef PJSUA_MAX_ACC
 #   define PJSUA_MAX_ACC	    8
@@ -2695,6 +2722,9 @@ typedef enum pjsua_call_hold_type
 #ifndef PJSUA_SLA_SUBSCRIPTION_TYPE_BLF
 #   define PJSUA_SLA_SUBSCRIPTION_TYPE_BLF              1
 #endif
+#ifndef PJSUA_SLA_SUBSCRIPTION_TYPE_BLF_LIST
+#   define PJSUA_SLA_SUBSCRIPTION_TYPE_BLF_LIST         2
+#endif
 
 
 /**
@@ -2911,6 +2941,17 @@ typedef struct pjsua_acc_config
     pj_bool_t       blf_enabled[PJSUA_MAX_NUMBER_OF_BLF_DEVICES];
     pj_str_t        blf[PJSUA_MAX_NUMBER_OF_BLF_DEVICES]; // remote uri for blf subscription
 
+    /**
+     * URI of the resource list (RFC 4662) that contains the BLF devices.
+     * If this is set, the enabled BLF lines are monitored with one
+     * subscription to the list instead of one subscription per line. The
+     * resources in the list notifications are matched against \a blf,
+     * and reported to \a on_sla_info callback per line.
+     *
+     * Default: empty (one subscription per BLF line)
+     */
+    pj_str_t        blf_list_uri;
+
     /**
      * Specify the default expiration time for Message Waiting Indication
      * (RFC 3842) event subscription. This must not be zero.
@@ -2919,6 +2960,36 @@ typedef struct pjsua_acc_config
      */
     unsigned	    mwi_expires;
 
+    /**
+     * Maximum rate of the refreshes of the client subscriptions of this
+     * account (buddy presence, MWI, SLA and BLF), in requests per second.
+     * Refreshes that exceed the rate are queued and sent later, so that
+     * the server is not flooded when many subscriptions are due at the
+     * same time. Zero disables the pacing.
+     *
+     * Default: PJSUA_SUB_REFRESH_RATE
+     */
+    unsigned	    sub_refresh_rate;
+
+    /**
+     * Number of subscription refreshes that may be sent back to back
+     * before  sub_refresh_rate is enforced.
+     *
+     * Default: PJSUA_SUB_REFRESH_BURST
+     */
+    unsigned	    sub_refresh_burst;
+
+    /**
+     * Jitter of the refreshes of the client subscriptions of this account,
+     * as percentage of the subscription interval. This spreads the
+     * refreshes of subscriptions that have been created at the same time.
+     * The value is applied to subscriptions that are created after it has
+     * been changed.
+     *
+     * Default: PJSUA_SUB_REFRESH_JITTER
+     */
+    unsigned	    sub_refresh_jitter;
+
     /**
      * If this flag is set, the presence information of this account will
      * be PUBLISH-ed to the server where the account belongs.
@@ -3257,6 +3328,41 @@ typedef struct pjsua_acc_config
      */
     pjsua_transport_config rtp_cfg;
 
+    /**
+     * Number of UDP media transports (RTP/RTCP socket pairs) to keep bound
+     * for the calls of this account. The transports are created when the
+     * account is added, and a transport is returned to the pool when its
+     * call ends, after PJSUA_RTP_POOL_DRAIN_MSEC, instead of being closed.
+     * This saves the socket creation and binding on call setup. When the
+     * pool runs out, the transport is created as usual, and it is kept
+     * when the call ends if there is room in the pool.
+     *
+     * The pool is not used with ICE (see \a ice_prewarm_cnt), when the
+     * media address is resolved with STUN or taken from the registration
+     * (\a allow_sdp_nat_rewrite), or when the application creates its own
+     * media transport with \a on_create_media_transport callback, since
+     * the transports can not be reused then. Zero disables the pool.
+     *
+     * Default: PJSUA_RTP_POOL_SIZE
+     */
+    unsigned	    rtp_pool_size;
+
+    /**
+     * Number of ICE media transports to keep ready for the next calls of
+     * this account, when ICE is enabled. The transports gather their
+     * candidates in the background, so a call that takes one can send
+     * its offer or answer without waiting for the STUN and TURN servers.
+     * A transport is used by one call only, and it is replaced as soon as
+     * it is taken. Transports older than PJSUA_ICE_PREWARM_MAX_AGE are
+     * gathered again. When no transport is ready, the call creates its
+     * own as usual. Zero disables the prewarming.
+     *
+     * The transports are counted in #pjsua_rtp_pool_stat.
+     *
+     * Default: PJSUA_ICE_PREWARM_CNT
+     */
+    unsigned	    ice_prewarm_cnt;
+
     /**
      * Specify whether IPv6 should be used on media.
      */
@@ -3474,6 +3580,62 @@ PJ_DECL(void) pjsua_acc_config_dup(pj_pool_t *pool,
 				   const pjsua_acc_config *src);
 
 
+/**
+ * State and counters of the media transport pool of an account, see
+ * #pjsua_acc_get_rtp_pool_stat(). With ICE, the pool holds the prewarmed
+ * ICE transports of the account (see \a ice_prewarm_cnt in
+ * #pjsua_acc_config), which are never returned to the pool.
+ */
+typedef struct pjsua_rtp_pool_stat
+{
+    /**
+     * Size of the pool, zero if the account does not use the pool.
+     */
+    unsigned	size;
+
+    /**
+     * Number of transports in the pool, including the ones that are
+     * still draining the packets of their previous call. With ICE, the
+     * number of transports that have gathered their candidates.
+     */
+    unsigned	idle;
+
+    /**
+     * Number of ICE transports that are gathering their candidates.
+     */
+    unsigned	gathering;
+
+    /**
+     * Number of ICE transports that have been gathered again because they
+     * were older than PJSUA_ICE_PREWARM_MAX_AGE.
+     */
+    unsigned	refreshed;
+
+    /**
+     * Number of transports taken from the pool.
+     */
+    unsigned	taken;
+
+    /**
+     * Number of transports that have been created because the pool had no
+     * drained transport, or no ready ICE transport.
+     */
+    unsigned	exhausted;
+
+    /**
+     * Number of transports returned to the pool.
+     */
+    unsigned	recycled;
+
+    /**
+     * Number of transports closed at the end of the call because the pool
+     * was full.
+     */
+    unsigned	discarded;
+
+} pjsua_rtp_pool_stat;
+
+
 /**
  * Account info. Application can query account info by calling 
  * #pjsua_acc_get_info().
@@ -3763,6 +3925,19 @@ PJ_DECL(pj_status_t) pjsua_acc_get_info(pjsua_acc_id acc_id,
 					pjsua_acc_info *info);
 
 
+/**
+ * Get the state and the counters of the media transport pool of the
+ * account (see \a rtp_pool_size in #pjsua_acc_config).
+ *
+ * @param acc_id	Account identification.
+ * @param stat		Pointer to receive the pool state.
+ *
+ * @return		PJ_SUCCESS on success, or the appropriate error code.
+ */
+PJ_DECL(pj_status_t) pjsua_acc_get_rtp_pool_stat(pjsua_acc_id acc_id,
+						 pjsua_rtp_pool_stat *stat);
+
+
 /**
  * Enumerate all account currently active in the library. This will fill
  * the array with the account Ids, and application can then query the
@@ -3908,12 +4083,27 @@ PJ_DECL(pj_status_t) pjsua_acc_set_transport(pjsua_acc_id acc_id,
  */
 
 /**
- * Maximum simultaneous calls.
+ * Maximum simultaneous calls of the applications that keep per call
+ * arrays. The library itself is limited by \a max_calls field of
+ * #pjsua_config, whose default is the smaller of this value and 4.
  */
 #ifndef PJSUA_MAX_CALLS
 #   define PJSUA_MAX_CALLS	    32
 #endif
 
+/**
+ * Minimum number of media lines to allocate for a call. The media state
+ * of a call slot is allocated when a call starts, with room for the media
+ * lines of the call but not less than this value. It can only grow while
+ * the call has no media, so an offer that adds more media lines to an
+ * established call is rejected with 488 when the room is exhausted.
+ *
+ * Default: 2 (audio and video)
+ */
+#ifndef PJSUA_MIN_CALL_MEDIA
+#   define PJSUA_MIN_CALL_MEDIA	    2
+#endif
+
 /**
  * Maximum active video windows
  */
@@ -4193,6 +4383,138 @@ typedef struct pjsua_stream_stat
 
 } pjsua_stream_stat;
 
+
+/**
+ * One entry of #pjsua_stat_snapshot(), holding the quality figures of one
+ * media stream of a call. The values are copied out of the RTCP, RTCP XR
+ * and jitter buffer state as they are, without any formatting, so that
+ * all calls can be polled frequently. A call without any active media
+ * is reported with a single entry with \a med_idx set to -1 and all
+ * stream values set to zero.
+ *
+ * All jitter, delay and round-trip values are in microseconds unless
+ * noted otherwise.
+ */
+typedef struct pjsua_stream_snapshot
+{
+    /** Call identification. */
+    pjsua_call_id	call_id;
+
+    /** Media index in the call, or -1 if the call has no active media. */
+    int			med_idx;
+
+    /** Media type. */
+    pjmedia_type	type;
+
+    /** Invite session state of the call. */
+    pjsip_inv_state	call_state;
+
+    /** Last status code of the call. */
+    pjsip_status_code	last_code;
+
+    /** Time since the call was connected, in msec, or zero. */
+    pj_uint32_t		duration_msec;
+
+    /** Number of transactions currently running in the call's dialog. */
+    unsigned		dlg_tsx_cnt;
+
+    /** Number of RTP packets sent. */
+    pj_uint32_t		tx_pkt;
+
+    /** Number of payload bytes sent. */
+    pj_uint32_t		tx_bytes;
+
+    /** Number of packets lost as reported by the remote. */
+    pj_uint32_t		tx_loss;
+
+    /** Last jitter reported by the remote. */
+    pj_uint32_t		tx_jitter;
+
+    /** Number of RTP packets received. */
+    pj_uint32_t		rx_pkt;
+
+    /** Number of payload bytes received. */
+    pj_uint32_t		rx_bytes;
+
+    /** Number of packets lost. */
+    pj_uint32_t		rx_loss;
+
+    /** Number of packets discarded. */
+    pj_uint32_t		rx_discard;
+
+    /** Number of out of order packets. */
+    pj_uint32_t		rx_reorder;
+
+    /** Number of duplicate packets. */
+    pj_uint32_t		rx_dup;
+
+    /** Last calculated receive jitter. */
+    pj_uint32_t		rx_jitter;
+
+    /** Maximum receive jitter. */
+    pj_uint32_t		rx_jitter_max;
+
+    /** Last round-trip delay. */
+    pj_uint32_t		rtt;
+
+    /** Maximum round-trip delay. */
+    pj_uint32_t		rtt_max;
+
+    /** Current jitter buffer size, in frames. */
+    unsigned		jb_size;
+
+    /** Current jitter buffer prefetch, in frames. */
+    unsigned		jb_prefetch;
+
+    /** Average jitter buffer delay, in msec. */
+    unsigned		jb_avg_delay;
+
+    /** Number of frames lost in the jitter buffer. */
+    unsigned		jb_lost;
+
+    /** Number of frames discarded by the jitter buffer. */
+    unsigned		jb_discard;
+
+    /** Number of empty frame retrievals from the jitter buffer. */
+    unsigned		jb_empty;
+
+    /**
+     * MOS-LQ of the sent stream as reported by the remote in RTCP XR,
+     * multiplied by 10, or 127 if not available.
+     */
+    unsigned		tx_mos_lq;
+
+    /**
+     * R factor of the sent stream as reported by the remote in RTCP XR,
+     * or 127 if not available.
+     */
+    unsigned		tx_r_factor;
+
+} pjsua_stream_snapshot;
+
+
+/**
+ * Stack wide counters taken by #pjsua_stat_snapshot().
+ */
+typedef struct pjsua_stat_snapshot_info
+{
+    /** Time when the snapshot was taken. */
+    pj_time_val		timestamp;
+
+    /** Number of active calls. */
+    unsigned		call_cnt;
+
+    /** Number of SIP transactions in the transaction layer. */
+    unsigned		tsx_cnt;
+
+    /**
+     * Number of stream entries available. This may be larger than the
+     * number of entries returned when the array was too small.
+     */
+    unsigned		stream_cnt;
+
+} pjsua_stat_snapshot_info;
+
 /**
  * This enumeration represents video stream operation on a call.
  * See also #pjsua_call_vid_strm_op_param for further info.
@@ -4842,6 +5164,43 @@ PJ_DECL(pj_status_t) pjsua_call_dump(pjsua_call_id call_id,
 				     unsigned maxlen,
 				     const char *indent);
 
+/**
+ * Take a snapshot of the quality statistics of all active calls in one
+ * pass. Unlike #pjsua_call_dump(), no text is formatted, so the function
+ * is cheap enough to be called periodically by a monitoring agent. Use
+ * #pjsua_stat_snapshot_print_json() to export the result.
+ *
+ * @param info		Optional, to receive the stack wide counters.
+ * @param streams	Array to receive the per stream entries.
+ * @param count		On input, the number of elements in the array.
+ *			On output, the number of elements filled.
+ *
+ * @return		PJ_SUCCESS on success.
+ */
+PJ_DECL(pj_status_t) pjsua_stat_snapshot(pjsua_stat_snapshot_info *info,
+					 pjsua_stream_snapshot streams[],
+					 unsigned *count);
+
+/**
+ * Print a snapshot taken by #pjsua_stat_snapshot() as a JSON object.
+ *
+ * @param info		The stack wide counters.
+ * @param streams	The stream entries.
+ * @param count		Number of stream entries.
+ * @param buffer	Buffer where the JSON text is to be written to.
+ * @param maxlen	Maximum length of buffer, including the terminating
+ *			NULL character.
+ *
+ * @return		The length of the text, or -1 if the buffer is
+ *			too small.
+ */
+PJ_DECL(int) pjsua_stat_snapshot_print_json(
+				    const pjsua_stat_snapshot_info *info,
+				    const pjsua_stream_snapshot streams[],
+				    unsigned count,
+				    char *buffer,
+				    unsigned maxlen);
+
 /**
  * Get the media stream index of the default video stream in the call.
  * Typically this will just retrieve the stream index of the first
@@ -4978,6 +5337,87 @@ pjsua_call_get_med_transport_info(pjsua_call_id call_id,
 #endif
 
 
+/**
+ * Default maximum rate of client subscription refreshes of an account, in
+ * requests per second. See \a sub_refresh_rate in #pjsua_acc_config.
+ *
+ * Default: 20
+ */
+#ifndef PJSUA_SUB_REFRESH_RATE
+#   define PJSUA_SUB_REFRESH_RATE   20
+#endif
+
+
+/**
+ * Default number of client subscription refreshes of an account that may
+ * be sent back to back. See \a sub_refresh_burst in #pjsua_acc_config.
+ *
+ * Default: 10
+ */
+#ifndef PJSUA_SUB_REFRESH_BURST
+#   define PJSUA_SUB_REFRESH_BURST  10
+#endif
+
+
+/**
+ * Default jitter of client subscription refreshes, as percentage of the
+ * subscription interval. See \a sub_refresh_jitter in #pjsua_acc_config.
+ *
+ * Default: 20
+ */
+#ifndef PJSUA_SUB_REFRESH_JITTER
+#   define PJSUA_SUB_REFRESH_JITTER 20
+#endif
+
+
+/**
+ * Default number of media transports to keep bound for the calls of an
+ * account. See \a rtp_pool_size in #pjsua_acc_config.
+ *
+ * Default: 0 (disabled)
+ */
+#ifndef PJSUA_RTP_POOL_SIZE
+#   define PJSUA_RTP_POOL_SIZE	    0
+#endif
+
+
+/**
+ * Time to keep a media transport out of use after its call has ended,
+ * in milliseconds, so that the late packets of the call are dropped
+ * rather than delivered to the next call that uses the transport.
+ *
+ * Default: 200
+ */
+#ifndef PJSUA_RTP_POOL_DRAIN_MSEC
+#   define PJSUA_RTP_POOL_DRAIN_MSEC 200
+#endif
+
+
+/**
+ * Default number of ICE media transports to keep ready for the calls of an
+ * account. See \a ice_prewarm_cnt in #pjsua_acc_config.
+ *
+ * Default: 0 (disabled)
+ */
+#ifndef PJSUA_ICE_PREWARM_CNT
+#   define PJSUA_ICE_PREWARM_CNT    0
+#endif
+
+
+/**
+ * Maximum age of a prewarmed ICE media transport, in seconds. Older
+ * transports are closed and gathered again so that their candidates
+ * follow the changes of the network. The pool is checked every half of
+ * this time, and the transports that have failed to gather are retried
+ * then.
+ *
+ * Default: 300
+ */
+#ifndef PJSUA_ICE_PREWARM_MAX_AGE
+#   define PJSUA_ICE_PREWARM_MAX_AGE 300
+#endif
+
+
 /**
  * This structure describes buddy configuration when adding a buddy to
  * the buddy list with #pjsua_buddy_add(). Application MUST initialize
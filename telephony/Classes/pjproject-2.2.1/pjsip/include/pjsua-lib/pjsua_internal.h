@@ -79,6 +79,8 @@ struct pjsua_call_media
     pj_status_t		 tp_result; /**< Media transport creation result.   */
     pjmedia_transport	*tp_orig;   /**< Original media transport	    */
     pj_bool_t		 tp_auto_del; /**< May delete media transport       */
+    unsigned		 rtp_pool_id;/**< Id of the account RTP pool that
+					 tp_orig is returned to, or zero.   */
     pjsua_med_tp_st	 tp_st;     /**< Media transport state		    */
     pj_bool_t            use_custom_med_tp;/**< Use custom media transport? */
     pj_sockaddr		 rtp_addr;  /**< Current RTP source address
@@ -119,6 +121,20 @@ typedef struct call_answer
  */
 struct pjsua_call
 {
+    /* The fields before index belong to the call slot, and they are
+     * not cleared by reset_call().
+     */
+    pj_mutex_t		*lock;	    /**< Call lock, protects inv and
+					 async_call.dlg, see PJSUA_LOCK().  */
+    unsigned		 slot_update;/**< Nesting of setup or teardown of
+					 the call under PJSUA_LOCK().	    */
+    pj_bool_t		 allocated; /**< The slot has been taken by
+					 alloc_call_id().		    */
+    pj_pool_t		*med_pool;  /**< Pool for the media arrays.	    */
+    unsigned		 med_max;   /**< Capacity of the media arrays.	    */
+    pjsua_call_media	*media;	    /**< Array of media.		    */
+    pjsua_call_media	*media_prov;/**< Array of provisional media.	    */
+
     unsigned		 index;	    /**< Index in pjsua array.		    */
     pjsua_call_setting	 opt;	    /**< Call setting.			    */
     pj_bool_t		 opt_inited;/**< Initial call setting has been set,
@@ -138,10 +154,7 @@ struct pjsua_call
     void		*hold_msg;  /**< Outgoing hold tx_data.		    */
 
     unsigned		 med_cnt;   /**< Number of media in SDP.	    */
-    pjsua_call_media     media[PJSUA_MAX_CALL_MEDIA]; /**< Array of media   */
     unsigned		 med_prov_cnt;/**< Number of provisional media.	    */
-    pjsua_call_media	 media_prov[PJSUA_MAX_CALL_MEDIA];
-				    /**< Array of provisional media.	    */
 
     int			 audio_idx; /**< First active audio media.	    */
     pj_mutex_t          *med_ch_mutex;/**< Media channel callback's mutex.  */
@@ -209,6 +222,92 @@ struct pjsua_device_to_index
     int deviceId;
 };
 
+/**
+ * Function to send the refresh of client subscription, called with the
+ * dialog of the subscription locked.
+ */
+typedef void (*pjsua_sub_refresh_cb)(pjsip_evsub *sub);
+
+/**
+ * Queued refresh of client subscription.
+ */
+typedef struct pjsua_sub_refresh
+{
+    PJ_DECL_LIST_MEMBER(struct pjsua_sub_refresh);
+    pjsip_evsub		*sub;	    /**< The subscription, NULL when it
+					 has been terminated.		*/
+    pjsip_dialog	*dlg;	    /**< Dialog of the subscription.	*/
+    pjsua_sub_refresh_cb cb;	    /**< Function to send the refresh.	*/
+    pj_time_val		 departure; /**< Time to send the refresh.	*/
+    pj_bool_t		 claimed;   /**< Being sent by a thread.	*/
+} pjsua_sub_refresh;
+
+/**
+ * Media transport in the RTP pool of an account.
+ */
+typedef struct pjsua_rtp_pool_tp
+{
+    PJ_DECL_LIST_MEMBER(struct pjsua_rtp_pool_tp);
+    pjmedia_transport	*tp;	    /**< The UDP media transport.	*/
+    pj_time_val		 release;   /**< End of the last call.		*/
+} pjsua_rtp_pool_tp;
+
+/**
+ * Prewarmed ICE media transport in the RTP pool of an account.
+ */
+typedef struct pjsua_ice_prewarm_tp
+{
+    PJ_DECL_LIST_MEMBER(struct pjsua_ice_prewarm_tp);
+    pjsua_call_media	 med;	    /**< Call media without call, the user
+					 data of the transport until it is
+					 taken. The transport is med.tp and
+					 the gathering result med.tp_ready.
+					 */
+    pjsua_acc_id	 acc_id;    /**< The account.			*/
+    unsigned		 pool_id;   /**< Id of the pool contents.	*/
+    pj_time_val		 ready;	    /**< End of the gathering.		*/
+} pjsua_ice_prewarm_tp;
+
+/**
+ * RTP pool of an account, protected by pjsua_var.rtp_pool_mutex. With ICE,
+ * the pool keeps the transports that have gathered their candidates for
+ * the next calls instead.
+ */
+typedef struct pjsua_rtp_pool
+{
+    unsigned		 id;	    /**< Unique id of the pool contents,
+					 zero when the pool is unused.	*/
+    unsigned		 size;	    /**< Size of the pool.		*/
+    pjsua_rtp_pool_tp	 idle;	    /**< Idle transports, in the order
+					 of release.			*/
+    unsigned		 idle_cnt;  /**< Number of idle transports.	*/
+    pjsua_ice_prewarm_tp ice_gathering;/**< ICE transports that are
+					 gathering, or have failed.	*/
+    unsigned		 ice_gathering_cnt; /**< Number of gathering ICE
+					 transports.			*/
+    pjsua_ice_prewarm_tp ice_ready; /**< ICE transports with candidates,
+					 in the order of gathering.	*/
+    unsigned		 ice_ready_cnt; /**< Number of ready ICE
+					 transports.			*/
+    pj_timer_entry	 ice_timer; /**< Refill and refresh of the ICE
+					 transports.			*/
+    pjsua_rtp_pool_stat	 stat;	    /**< Counters.			*/
+} pjsua_rtp_pool;
+
+/**
+ * Account indexes, to find the account for a request without comparing
+ * the request URI with every account.
+ */
+typedef enum pjsua_acc_idx_type
+{
+    PJSUA_ACC_IDX_USER_DOMAIN,	    /**< User and domain of account ID.	*/
+    PJSUA_ACC_IDX_DOMAIN,	    /**< Domain of account ID.		*/
+    PJSUA_ACC_IDX_DOMAIN_PORT,	    /**< Domain and registrar port.	*/
+    PJSUA_ACC_IDX_USER,		    /**< User of account ID.		*/
+
+    PJSUA_ACC_IDX_CNT
+} pjsua_acc_idx_type;
+
 /**
  * Account
  */
@@ -217,6 +316,8 @@ typedef struct pjsua_acc
     pj_pool_t	    *pool;	    /**< Pool for this account.		*/
     pjsua_acc_config cfg;	    /**< Account configuration.		*/
     pj_bool_t	     valid;	    /**< Is this account valid?		*/
+    pj_mutex_t	    *lock;	    /**< Account lock, protects what is
+					 read by pjsua_acc_get_info().	*/
 
     int		     index;	    /**< Index in accounts array.	*/
     pj_str_t	     display;	    /**< Display name, if any.		*/
@@ -236,6 +337,9 @@ typedef struct pjsua_acc
     pjsip_regc	    *regc;	    /**< Client registration session.   */
     pj_status_t	     reg_last_err;  /**< Last registration error.	*/
     int		     reg_last_code; /**< Last status last register.	*/
+    pj_time_val	     reg_next;	    /**< Time of next registration
+					 refresh, zero if none is
+					 scheduled.			*/
 
     pj_str_t         reg_mapped_addr;/**< Our addr as seen by reg srv.
                                           Only if allow_sdp_nat_rewrite
@@ -277,6 +381,7 @@ typedef struct pjsua_acc
     pjsip_dialog    *mwi_dlg;	    /**< Dialog for MWI sub.		*/
 
     pj_uint16_t      next_rtp_port; /**< Next RTP port to be used.      */
+    pjsua_rtp_pool   rtp_pool;	    /**< Bound media transports.	*/
     
     pjsip_evsub     *sla_line_sub[PJSUA_MAX_NUMBER_OF_SHARED_LINES];     /**< SLA client line subscription  */
     pjsip_dialog    *sla_line_dlg[PJSUA_MAX_NUMBER_OF_SHARED_LINES];     /**< Dialog for SLA line sub.              */
@@ -284,6 +389,36 @@ typedef struct pjsua_acc
     pjsip_evsub     *blf_line_sub[PJSUA_MAX_NUMBER_OF_BLF_DEVICES];     /**< BLF client subscription      */
     pjsip_dialog    *blf_line_dlg[PJSUA_MAX_NUMBER_OF_BLF_DEVICES];     /**< Dialog for BLF subscription. */
     struct pjsua_device_to_index              blf_deviceIdToIndex[PJSUA_MAX_NUMBER_OF_BLF_DEVICES];
+    pjsip_evsub     *blf_list_sub;  /**< BLF resource list subscription */
+    pjsip_dialog    *blf_list_dlg;  /**< Dialog for BLF list sub.	*/
+
+    /** Dialog-info state of the SLA lines, allocated from the account
+     *  pool on the first notification of the line.
+     */
+    pjsip_dialog_info_table *sla_line_state[PJSUA_MAX_NUMBER_OF_SHARED_LINES];
+
+    /** Dialog-info state of the BLF lines, allocated from the account
+     *  pool on the first notification of the line.
+     */
+    pjsip_dialog_info_table *blf_line_state[PJSUA_MAX_NUMBER_OF_BLF_DEVICES];
+
+    pjsip_evsub_pacer sub_pacer;    /**< Pacer of subscription refreshes*/
+    pj_timer_entry   sub_refresh_timer; /**< Timer to send queued
+					 subscription refreshes.	*/
+    pjsua_sub_refresh sub_refresh_list; /**< Queued refreshes, in the
+					 order of departure.		*/
+    pjsua_sub_refresh sub_refresh_busy; /**< Refreshes being sent.	*/
+
+    pj_str_t	     idx_key[PJSUA_ACC_IDX_CNT]; /**< Keys in the account
+					 indexes, NULL when not indexed.*/
+    pj_hash_entry_buf idx_entry[PJSUA_ACC_IDX_CNT]; /**< Index entries,
+					 used when the account is the
+					 first one with the key.	*/
+    struct pjsua_acc *idx_next[PJSUA_ACC_IDX_CNT]; /**< Next account with
+					 the same key, in the order of
+					 acc_ids.			*/
+    unsigned	     idx_seq;	    /**< Order among accounts with the
+					 same priority in acc_ids.	*/
 } pjsua_acc;
 
 
@@ -325,6 +460,7 @@ typedef struct pjsua_buddy
     pj_bool_t		 monitor;   /**< Should we monitor?		*/
     pjsip_dialog	*dlg;	    /**< The underlying dialog.		*/
     pjsip_evsub		*sub;	    /**< Buddy presence subscription	*/
+    pjsua_acc_id	 acc_id;    /**< Account of the subscription.	*/
     unsigned		 term_code; /**< Subscription termination code	*/
     pj_str_t		 term_reason;/**< Subscription termination reason */
     pjsip_pres_status	 status;    /**< Buddy presence status.		*/
@@ -449,14 +585,21 @@ struct pjsua_data
     /* Account: */
     unsigned		 acc_cnt;	     /**< Number of accounts.	*/
     pjsua_acc_id	 default_acc;	     /**< Default account ID	*/
-    pjsua_acc		 acc[PJSUA_MAX_ACC]; /**< Account array.	*/
-    pjsua_acc_id	 acc_ids[PJSUA_MAX_ACC]; /**< Acc sorted by prio*/
+    unsigned		 acc_max;	     /**< Size of acc array.	*/
+    pjsua_acc		*acc;		     /**< Account array.	*/
+    pjsua_acc_id	*acc_ids;	     /**< Acc sorted by prio	*/
+    pj_hash_table_t	*acc_idx[PJSUA_ACC_IDX_CNT]; /**< Account indexes,
+						 see pjsua_acc_idx_type	*/
+    unsigned		 acc_idx_seq;	     /**< Last idx_seq.		*/
 
     /* Calls: */
     pjsua_config	 ua_cfg;		/**< UA config.		*/
     unsigned		 call_cnt;		/**< Call counter.	*/
-    pjsua_call		 calls[PJSUA_MAX_CALLS];/**< Calls array.	*/
-    pjsua_call_id	 next_call_id;		/**< Next call id to use*/
+    pjsua_call		*calls;			/**< Calls array.	*/
+    pjsua_call_id	*call_free;		/**< Free call slots, in
+						     the order of release.*/
+    unsigned		 call_free_head;	/**< First in call_free.*/
+    unsigned		 call_free_cnt;		/**< Number of free.	*/
 
     /* Buddy; */
     unsigned		 buddy_cnt;		    /**< Buddy count.	*/
@@ -464,8 +607,16 @@ struct pjsua_data
 
     /* Presence: */
     pj_timer_entry	 pres_timer;/**< Presence refresh timer.	*/
+    pj_mutex_t		*sub_refresh_mutex; /**< Protects the subscription
+					 refresh queues of the accounts.*/
+    pjsua_sub_refresh	 sub_refresh_free; /**< Unused queue entries.	*/
 
     /* Media: */
+    pj_mutex_t		*rtp_pool_mutex; /**< Protects the RTP pools of the
+					 accounts.			*/
+    pjsua_rtp_pool_tp	 rtp_pool_free; /**< Unused RTP pool entries.	*/
+    pjsua_ice_prewarm_tp ice_prewarm_free; /**< Unused ICE entries.	*/
+    unsigned		 rtp_pool_seq;	/**< Last RTP pool id.		*/
     pjsua_media_config   media_cfg; /**< Media config.			*/
     pjmedia_endpt	*med_endpt; /**< Media endpoint.		*/
     pjsua_conf_setting	 mconf_cfg; /**< Additionan conf. bridge. param */
@@ -554,6 +705,32 @@ PJ_INLINE(pjsua_im_data*) pjsua_im_data_dup(pj_pool_t *pool,
 }
 
 
+/*
+ * Locking.
+ *
+ * PJSUA_LOCK() protects the state shared by all calls and accounts: the
+ * allocation of the call and account slots, the sound device and the
+ * conference bridge, and the setup and teardown of a call.
+ *
+ * Each call and account also has its own lock, so that operations on
+ * one call or account don't contend with the others:
+ *  - the call lock protects the inv and async_call.dlg pointers, i.e.
+ *    the link from the call to its dialog. acquire_call() uses it to
+ *    find and lock the dialog, and pjsua_call_get_info() to read it.
+ *  - the account lock protects the fields that are read by
+ *    pjsua_acc_get_info().
+ *
+ * PJSUA_LOCK() and the dialog locks may be acquired in either order, so
+ * one of them is always try-locked (see acquire_call()). The call and
+ * account locks are leaf locks: they may be acquired while holding any
+ * other lock, and a thread holding one of them must not block on any
+ * other lock (it may only try-lock a dialog) nor call the application.
+ *
+ * While a call is being set up or torn down under PJSUA_LOCK(), its
+ * dialog may be destroyed before the call is reset. Such sections are
+ * marked by the slot_update counter of the call, and in the mean time
+ * acquire_call() and pjsua_call_get_info() fall back to PJSUA_LOCK().
+ */
 #if 1
 
 PJ_INLINE(void) PJSUA_LOCK()
@@ -665,6 +842,23 @@ void pjsua_set_media_tp_state(pjsua_call_media *call_med, pjsua_med_tp_st tp_st)
 
 void pjsua_media_prov_clean_up(pjsua_call_id call_id);
 
+/* Fill the RTP pool of the account with the configured number of media
+ * transports, closing the transports of its previous configuration. With
+ * ICE, the prewarmed transports are gathered in the background.
+ */
+void pjsua_rtp_pool_init(pjsua_acc_id acc_id);
+
+/* Close the transports in the RTP pool of the account. The transports that
+ * are used by calls are closed when the calls end.
+ */
+void pjsua_rtp_pool_flush(pjsua_acc_id acc_id);
+
+/* Make room for the specified number of media lines in the media arrays of
+ * the call. The arrays may only be moved while the call has no media, see
+ * pjsua_media_channel_init().
+ */
+pj_status_t pjsua_call_media_reserve(pjsua_call *call, unsigned cnt);
+
 /* Callback to receive media events */
 pj_status_t call_media_on_event(pjmedia_event *event,
                                 void *user_data);
@@ -724,13 +918,36 @@ pj_status_t pjsua_im_init(void);
  */
 pj_status_t pjsua_start_mwi(pjsua_acc_id acc_id, pj_bool_t force_renew);
 
+/**
+ * Refresh client subscription through the refresh queue of the account,
+ * which paces the refreshes of the account according to its
+ * sub_refresh_rate and sub_refresh_burst settings. This is called from
+ * the on_client_refresh callback of the subscription, i.e. with the
+ * dialog locked. If the account is not valid, the refresh is sent now.
+ */
+void pjsua_acc_sub_refresh(pjsua_acc_id acc_id, pjsip_evsub *sub,
+			   pjsip_dialog *dlg, pjsua_sub_refresh_cb cb);
+
+/**
+ * Remove the queued refresh of client subscription, if any. This must be
+ * called when the subscription is terminated, with the dialog locked.
+ */
+void pjsua_sub_refresh_cancel(pjsip_evsub *sub);
+
+/**
+ * Apply the subscription refresh settings of the account.
+ */
+void pjsua_acc_update_sub_refresh(pjsua_acc_id acc_id);
+
 /**
  * Start SLA subscription
  */
 void pjsua_start_sla(pjsua_acc *acc, int line);
 
 /**
- * Start BLF subscription
+ * Start BLF subscription. If the account has BLF resource list URI, this
+ * starts the list subscription instead, or stops it when no BLF line is
+ * enabled.
  */
 void pjsua_start_blf(pjsua_acc *acc, int remoteExtensionIndex);
 
@@ -740,6 +957,11 @@ void pjsua_start_blf(pjsua_acc *acc, int remoteExtensionIndex);
  */
 pj_status_t pjsua_call_subsys_init(const pjsua_config *cfg);
 
+/**
+ * Init account subsystem, i.e. allocate the account table.
+ */
+pj_status_t pjsua_acc_subsys_init(const pjsua_config *cfg);
+
 /**
  * Start call subsystem.
  */
@@ -40,6 +40,35 @@
 #endif
 
 
+/**
+ * Specify if the SipRxData and SipTxData given to the callbacks should
+ * contain a copy of the whole message in their \a wholeMsg field. When
+ * disabled, the field is left empty and the message is only copied when
+ * the application calls getWholeMsg() while the callback is running,
+ * which saves a copy of every message for applications that do not look
+ * at the message text. Enable this for applications that read the
+ * \a wholeMsg field directly.
+ */
+#ifndef PJSUA2_SIP_DATA_HAS_WHOLE_MSG
+#   define PJSUA2_SIP_DATA_HAS_WHOLE_MSG	0
+#endif
+
+
+/**
+ * Specify if the library should move, rather than copy, the values it
+ * builds into containers, such as the media list of CallInfo or the
+ * headers of SipTxOption. By default it is enabled when the compiler
+ * supports C++11 rvalue references.
+ */
+#ifndef PJSUA2_HAS_MOVE
+#   if __cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1600)
+#	define PJSUA2_HAS_MOVE			1
+#   else
+#	define PJSUA2_HAS_MOVE			0
+#   endif
+#endif
+
+
 /**
  * @}  PJSUA2_CFG
  */
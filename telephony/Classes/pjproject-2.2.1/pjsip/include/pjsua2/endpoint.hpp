@@ -169,14 +169,20 @@ struct OnSelectAccountParam
 struct UaConfig : public PersistentObject
 {
     /**
-     * Maximum calls to support (default: 4). The value specified here
-     * must be smaller than the compile time maximum settings
-     * PJSUA_MAX_CALLS, which by default is 32. To increase this
-     * limit, the library must be recompiled with new PJSUA_MAX_CALLS
-     * value.
+     * Maximum calls to support (default: 4). The call table is allocated
+     * on library initialization, but the media state of the calls is
+     * only allocated when the calls are made, so large values cost little
+     * memory while idle.
      */
     unsigned		maxCalls;
 
+    /**
+     * Maximum number of accounts to support. The account table is
+     * allocated on library initialization, so this can exceed the
+     * compile time default PJSUA_MAX_ACC, which by default is 8.
+     */
+    unsigned		maxAcc;
+
     /**
      * Number of worker threads. Normally application will want to have at
      * least one worker thread, unless when it wants to poll the library
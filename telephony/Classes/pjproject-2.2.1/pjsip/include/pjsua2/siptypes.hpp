@@ -414,7 +414,8 @@ struct SipRxData
 
     /**
      * The whole message data as a string, containing both the header section
-     * and message body section.
+     * and message body section. This is empty unless
+     * PJSUA2_SIP_DATA_HAS_WHOLE_MSG is enabled, use getWholeMsg() instead.
      */
     string		wholeMsg;
 
@@ -439,6 +440,15 @@ public:
      * Construct from PJSIP's pjsip_rx_data
      */
     void fromPj(pjsip_rx_data &rdata);
+
+    /**
+     * Get the whole message data. If \a wholeMsg has not been filled in,
+     * the message is copied from the original pjsip_rx_data, hence this
+     * must only be called while the callback is running.
+     *
+     * @return		The whole message data.
+     */
+    string getWholeMsg() const;
 };
 
 /**
@@ -455,7 +465,8 @@ struct SipTxData
     
     /**
      * The whole message data as a string, containing both the header section
-     * and message body section.
+     * and message body section. This is empty unless
+     * PJSUA2_SIP_DATA_HAS_WHOLE_MSG is enabled, use getWholeMsg() instead.
      */
     string		wholeMsg;
     
@@ -480,6 +491,15 @@ public:
      * Construct from PJSIP's pjsip_tx_data
      */
     void fromPj(pjsip_tx_data &tdata);
+
+    /**
+     * Get the whole message data. If \a wholeMsg has not been filled in,
+     * the message is encoded and copied from the original pjsip_tx_data,
+     * hence this must only be called while the callback is running.
+     *
+     * @return		The whole message data.
+     */
+    string getWholeMsg() const;
 };
 
 /**
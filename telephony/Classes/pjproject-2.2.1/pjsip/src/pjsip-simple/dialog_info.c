@@ -0,0 +1,354 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <pjsip-simple/dialog_info.h>
+#include <pjsip-simple/errno.h>
+#include <pjlib-util/xml.h>
+#include <pj/array.h>
+#include <pj/assert.h>
+#include <pj/hash.h>
+#include <pj/log.h>
+#include <pj/pool.h>
+#include <pj/string.h>
+
+
+#define THIS_FILE		"dialog_info.c"
+
+
+static const pj_str_t STR_APPLICATION	= { "application", 11 };
+static const pj_str_t STR_DIALOG_INFO_XML = { "dialog-info+xml", 15 };
+
+static const pj_str_t DIALOG_INFO	= { "dialog-info", 11 };
+static const pj_str_t DIALOG		= { "dialog", 6 };
+static const pj_str_t ENTITY		= { "entity", 6 };
+static const pj_str_t VERSION		= { "version", 7 };
+static const pj_str_t STATE		= { "state", 5 };
+static const pj_str_t ID		= { "id", 2 };
+static const pj_str_t DIRECTION		= { "direction", 9 };
+static const pj_str_t REMOTE		= { "remote", 6 };
+static const pj_str_t IDENTITY		= { "identity", 8 };
+static const pj_str_t TARGET		= { "target", 6 };
+static const pj_str_t DISPLAY		= { "display", 7 };
+static const pj_str_t URI		= { "uri", 3 };
+
+static const char *state_names[] =
+{
+    "idle",
+    "early",
+    "confirmed"
+};
+
+
+static void get_attr(const pj_xml_node *node, const pj_str_t *name,
+		     pj_str_t *value)
+{
+    const pj_xml_attr *attr = pj_xml_find_attr(node, name, NULL);
+
+    if (attr)
+	*value = attr->value;
+    else
+	value->slen = 0;
+}
+
+static void parse_dialog(const pj_xml_node *node,
+			 pjsip_dialog_info_dialog *dlg)
+{
+    const pj_xml_node *child, *remote;
+    pj_str_t value;
+
+    pj_bzero(dlg, sizeof(*dlg));
+    get_attr(node, &ID, &dlg->id);
+
+    /* "trying", "proceeding" and "early" are all early */
+    child = pj_xml_find_node(node, &STATE);
+    value = child ? child->content : pj_str("");
+    pj_strtrim(&value);
+    if (pj_stricmp2(&value, "confirmed") == 0)
+	dlg->state = PJSIP_DIALOG_INFO_CONFIRMED;
+    else if (value.slen == 0 || pj_stricmp2(&value, "terminated") == 0)
+	dlg->state = PJSIP_DIALOG_INFO_IDLE;
+    else
+	dlg->state = PJSIP_DIALOG_INFO_EARLY;
+
+    get_attr(node, &DIRECTION, &value);
+    if (pj_stricmp2(&value, "initiator") == 0)
+	dlg->dir = PJSIP_DIALOG_INFO_DIR_INITIATOR;
+    else if (pj_stricmp2(&value, "recipient") == 0)
+	dlg->dir = PJSIP_DIALOG_INFO_DIR_RECIPIENT;
+    else
+	dlg->dir = PJSIP_DIALOG_INFO_DIR_UNKNOWN;
+
+    /* The remote party is the identity, or the target if the notifier
+     * hides the identity.
+     */
+    remote = pj_xml_find_node(node, &REMOTE);
+    if (!remote)
+	return;
+
+    child = pj_xml_find_node(remote, &IDENTITY);
+    if (child) {
+	dlg->remote = child->content;
+	pj_strtrim(&dlg->remote);
+	get_attr(child, &DISPLAY, &dlg->remote_name);
+    }
+    if (dlg->remote.slen == 0) {
+	child = pj_xml_find_node(remote, &TARGET);
+	if (child)
+	    get_attr(child, &URI, &dlg->remote);
+    }
+}
+
+
+/*
+ * Parse dialog-info document.
+ */
+PJ_DEF(pj_status_t) pjsip_dialog_info_parse(pj_pool_t *pool,
+					    const pjsip_msg_body *body,
+					    pjsip_dialog_info *info)
+{
+    pj_xml_node *doc, *node;
+    pj_str_t value;
+    unsigned cnt;
+    char *buf;
+
+    PJ_ASSERT_RETURN(pool && body && info, PJ_EINVAL);
+
+    pj_bzero(info, sizeof(*info));
+
+    if (pj_stricmp(&body->content_type.type, &STR_APPLICATION) != 0 ||
+	pj_stricmp(&body->content_type.subtype, &STR_DIALOG_INFO_XML) != 0)
+    {
+	return PJSIP_SIMPLE_EBADCONTENT;
+    }
+
+    /* The XML parser modifies the buffer */
+    buf = (char*) pj_pool_alloc(pool, body->len + 1);
+    pj_memcpy(buf, body->data, body->len);
+    buf[body->len] = '\0';
+
+    doc = pj_xml_parse(pool, buf, body->len);
+    if (!doc || pj_stricmp(&doc->name, &DIALOG_INFO) != 0)
+	return PJSIP_SIMPLE_EBADDLGINFO;
+
+    get_attr(doc, &ENTITY, &info->entity);
+    get_attr(doc, &VERSION, &value);
+    if (value.slen == 0)
+	return PJSIP_SIMPLE_EBADDLGINFO;
+    info->version = pj_strtoul(&value);
+    get_attr(doc, &STATE, &value);
+    info->full_state = (pj_stricmp2(&value, "partial") != 0);
+
+    cnt = 0;
+    for (node = pj_xml_find_node(doc, &DIALOG); node != NULL;
+	 node = pj_xml_find_next_node(doc, node, &DIALOG))
+    {
+	++cnt;
+    }
+    if (cnt == 0)
+	return PJ_SUCCESS;
+
+    info->dlg = (pjsip_dialog_info_dialog*)
+		pj_pool_calloc(pool, cnt, sizeof(pjsip_dialog_info_dialog));
+
+    for (node = pj_xml_find_node(doc, &DIALOG); node != NULL;
+	 node = pj_xml_find_next_node(doc, node, &DIALOG))
+    {
+	pjsip_dialog_info_dialog *dlg = &info->dlg[info->dlg_cnt];
+
+	parse_dialog(node, dlg);
+	if (dlg->id.slen == 0)
+	    continue;
+
+	++info->dlg_cnt;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/* Find the dialog that determines the state of the line */
+static int find_line_dialog(const pjsip_dialog_info_table *table)
+{
+    int i, found = -1;
+
+    for (i = 0; i < (int)table->dlg_cnt; ++i) {
+	if (found < 0 || table->dlg[i].state >= table->dlg[found].state)
+	    found = i;
+    }
+
+    return found;
+}
+
+static pj_bool_t same_line_dialog(const pjsip_dialog_info_entry *e1,
+				  const pjsip_dialog_info_entry *e2)
+{
+    if (e1 == NULL || e2 == NULL)
+	return e1 == e2;
+
+    return e1->state == e2->state && e1->dir == e2->dir &&
+	   e1->remote_len == e2->remote_len &&
+	   e1->name_len == e2->name_len &&
+	   pj_memcmp(e1->remote_buf, e2->remote_buf, e1->remote_len) == 0 &&
+	   pj_memcmp(e1->name_buf, e2->name_buf, e1->name_len) == 0;
+}
+
+static void remove_entry(pjsip_dialog_info_table *table, unsigned idx)
+{
+    pj_array_erase(table->dlg, sizeof(table->dlg[0]), table->dlg_cnt, idx);
+    --table->dlg_cnt;
+}
+
+static void update_dialog(pjsip_dialog_info_table *table,
+			  const pjsip_dialog_info_dialog *dlg)
+{
+    pjsip_dialog_info_entry *e;
+    pj_uint32_t id_hash;
+    unsigned i;
+
+    id_hash = pj_hash_calc(0, dlg->id.ptr, (unsigned)dlg->id.slen);
+
+    for (i = 0; i < table->dlg_cnt; ++i) {
+	if (table->dlg[i].id_hash == id_hash)
+	    break;
+    }
+
+    if (i < table->dlg_cnt)
+	remove_entry(table, i);
+
+    /* Terminated dialogs are not kept */
+    if (dlg->state == PJSIP_DIALOG_INFO_IDLE)
+	return;
+
+    if (table->dlg_cnt == PJ_ARRAY_SIZE(table->dlg)) {
+	PJ_LOG(4,(THIS_FILE, "Too many dialogs, dialog %.*s is ignored",
+		  (int)dlg->id.slen, dlg->id.ptr));
+	return;
+    }
+
+    /* The most recently updated dialog is the last */
+    e = &table->dlg[table->dlg_cnt++];
+    e->id_hash = id_hash;
+    e->state = dlg->state;
+    e->dir = dlg->dir;
+    e->remote_len = (unsigned)dlg->remote.slen;
+    if (e->remote_len > sizeof(e->remote_buf))
+	e->remote_len = sizeof(e->remote_buf);
+    pj_memcpy(e->remote_buf, dlg->remote.ptr, e->remote_len);
+    e->name_len = (unsigned)dlg->remote_name.slen;
+    if (e->name_len > sizeof(e->name_buf))
+	e->name_len = sizeof(e->name_buf);
+    pj_memcpy(e->name_buf, dlg->remote_name.ptr, e->name_len);
+}
+
+
+/*
+ * Apply dialog-info document to the state table.
+ */
+PJ_DEF(pj_status_t) pjsip_dialog_info_apply(pjsip_dialog_info_table *table,
+					    const pjsip_dialog_info *info,
+					    pj_bool_t *p_changed)
+{
+    pjsip_dialog_info_entry old_entry;
+    pj_bool_t had_line_dialog;
+    unsigned i;
+    int idx;
+
+    PJ_ASSERT_RETURN(table && info, PJ_EINVAL);
+
+    if (p_changed)
+	*p_changed = PJ_FALSE;
+
+    /* RFC 4235 section 4.1.2: documents that are not newer than the
+     * local version are discarded, and partial state is only usable on
+     * top of the previous version.
+     */
+    if (table->has_version && info->version <= table->version) {
+	PJ_LOG(5,(THIS_FILE, "Discarding dialog-info version %u, local "
+		  "version is %u", info->version, table->version));
+	return PJ_EIGNORED;
+    }
+    if (!info->full_state &&
+	(!table->has_version || info->version != table->version + 1))
+    {
+	PJ_LOG(4,(THIS_FILE, "Partial dialog-info version %u does not "
+		  "follow local version %u", info->version, table->version));
+	return PJSIP_SIMPLE_EDLGINFOGAP;
+    }
+
+    idx = find_line_dialog(table);
+    had_line_dialog = (idx >= 0);
+    if (had_line_dialog)
+	pj_memcpy(&old_entry, &table->dlg[idx], sizeof(old_entry));
+
+    if (info->full_state)
+	table->dlg_cnt = 0;
+
+    for (i = 0; i < info->dlg_cnt; ++i)
+	update_dialog(table, &info->dlg[i]);
+
+    table->has_version = PJ_TRUE;
+    table->version = info->version;
+
+    if (p_changed) {
+	idx = find_line_dialog(table);
+	*p_changed = !same_line_dialog(had_line_dialog ? &old_entry : NULL,
+				       idx >= 0 ? &table->dlg[idx] : NULL);
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Get the compact state of the line.
+ */
+PJ_DEF(void) pjsip_dialog_info_get_line_state(
+				    const pjsip_dialog_info_table *table,
+				    pjsip_dialog_info_line_state *st)
+{
+    const pjsip_dialog_info_entry *e;
+    int idx;
+
+    pj_bzero(st, sizeof(*st));
+
+    idx = find_line_dialog(table);
+    if (idx < 0)
+	return;
+
+    e = &table->dlg[idx];
+    st->state = e->state;
+    st->dir = e->dir;
+    st->remote.ptr = (char*)e->remote_buf;
+    st->remote.slen = e->remote_len;
+    st->remote_name.ptr = (char*)e->name_buf;
+    st->remote_name.slen = e->name_len;
+}
+
+
+/*
+ * Get the name of the state.
+ */
+PJ_DEF(const char*) pjsip_dialog_info_state_name(
+				    pjsip_dialog_info_state state)
+{
+    PJ_ASSERT_RETURN(state >= PJSIP_DIALOG_INFO_IDLE &&
+		     state <= PJSIP_DIALOG_INFO_CONFIRMED, "??");
+
+    return state_names[state];
+}
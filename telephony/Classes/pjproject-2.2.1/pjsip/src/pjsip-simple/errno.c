@@ -45,6 +45,9 @@ static const struct
     { PJSIP_SIMPLE_EBADPIDF,	    "Bad PIDF content for presence" },
     { PJSIP_SIMPLE_EBADXPIDF,	    "Bad XPIDF content for presence" },
     { PJSIP_SIMPLE_EBADRPID,	    "Invalid or bad RPID document"},
+    { PJSIP_SIMPLE_EBADRLMI,	    "Invalid or bad RLMI resource list notification"},
+    { PJSIP_SIMPLE_EBADDLGINFO,	    "Invalid or bad dialog-info document"},
+    { PJSIP_SIMPLE_EDLGINFOGAP,	    "Missing dialog-info version, full state is needed"},
 
     /* isComposing errors. */
     { PJSIP_SIMPLE_EBADISCOMPOSE,   "Bad isComposing indication/XML message" },
@@ -231,6 +231,7 @@ struct pjsip_evsub
     pjsip_hdr             sub_hdr_list; /**< User-defined header.           */
 
     pj_time_val		  refresh_time;	/**< Time to refresh.		    */
+    unsigned		  refresh_jitter;/**< Refresh jitter, in percent.   */
     pj_timer_entry	  timer;	/**< Internal timer.		    */
     int			  pending_tsx;	/**< Number of pending transactions.*/
     pjsip_transaction	 *pending_sub;	/**< Pending UAC SUBSCRIBE tsx.	    */
@@ -464,6 +465,20 @@ PJ_DEF(pj_status_t) pjsip_evsub_register_pkg( pjsip_module *pkg_mod,
 }
 
 
+/*
+ * Check if event package has been registered.
+ */
+PJ_DEF(pj_bool_t) pjsip_evsub_has_pkg(const pj_str_t *event_name)
+{
+    PJ_ASSERT_RETURN(event_name, PJ_FALSE);
+
+    if (mod_evsub.mod.id == -1)
+	return PJ_FALSE;
+
+    return find_pkg(event_name) != NULL;
+}
+
+
 /*
  * Retrieve Allow-Events header
  */
@@ -738,6 +753,7 @@ static pj_status_t evsub_create( pjsip_dialog *dlg,
     sub->pkg = pkg;
     sub->role = role;
     sub->call_cb = PJ_TRUE;
+    sub->refresh_jitter = PJSIP_EVSUB_UAC_REFRESH_JITTER;
     sub->option = option;
     sub->state = PJSIP_EVSUB_STATE_NULL;
     sub->state_str = evsub_state_names[sub->state];
@@ -903,11 +919,15 @@ PJ_DEF(pj_status_t) pjsip_evsub_create_uas( pjsip_dialog *dlg,
     pjsip_method_copy(sub->pool, &sub->method, 
 		      &rdata->msg_info.msg->line.req.method);
 
-    /* Update expiration time according to client request: */
+    /* Update expiration time according to client request, but don't
+     * exceed package's expiration time (as with refreshing SUBSCRIBE):
+     */
 
     expires_hdr = (pjsip_expires_hdr*)
 	pjsip_msg_find_hdr(rdata->msg_info.msg, PJSIP_H_EXPIRES, NULL);
-    if (expires_hdr) {
+    if (expires_hdr &&
+	expires_hdr->ivalue < (pj_int32_t)sub->pkg->pkg_expires)
+    {
 	sub->expires->ivalue = expires_hdr->ivalue;
     }
 
@@ -988,6 +1008,107 @@ PJ_DEF(const pj_str_t*) pjsip_evsub_get_termination_reason(pjsip_evsub *sub)
     return &sub->term_reason;
 }
 
+/*
+ * Get subscription interval.
+ */
+PJ_DEF(unsigned) pjsip_evsub_get_expires(pjsip_evsub *sub)
+{
+    return sub->expires->ivalue;
+}
+
+/*
+ * Set refresh jitter.
+ */
+PJ_DEF(void) pjsip_evsub_set_refresh_jitter(pjsip_evsub *sub,
+					    unsigned percent)
+{
+    PJ_ASSERT_ON_FAIL(sub, return);
+
+    sub->refresh_jitter = (percent > 100) ? 100 : percent;
+}
+
+/*
+ * Calculate the delay to refresh client subscription.
+ */
+PJ_DEF(unsigned) pjsip_evsub_calc_refresh_delay(unsigned expires,
+						unsigned jitter)
+{
+    unsigned timeout = (expires > TIME_UAC_REFRESH) ?
+			expires - TIME_UAC_REFRESH : expires;
+
+    if (jitter) {
+	/* Spread the refresh over the last part of the interval */
+	unsigned range = timeout / 100 * jitter +
+			 timeout % 100 * jitter / 100;
+
+	if (jitter > 100)
+	    range = timeout;
+	if (range)
+	    timeout -= (pj_rand() % (range + 1));
+    } else if (timeout > 10) {
+	/* Reduce timeout by about 1 - 10 secs (randomized) */
+	timeout += -10 + (pj_rand() % 10);
+    }
+
+    return timeout;
+}
+
+/*
+ * Initialize pacer.
+ */
+PJ_DEF(void) pjsip_evsub_pacer_init(pjsip_evsub_pacer *pacer,
+				    unsigned rate, unsigned burst)
+{
+    PJ_ASSERT_ON_FAIL(pacer, return);
+
+    pacer->rate = rate;
+    pacer->burst = burst ? burst : 1;
+    pacer->tat.sec = pacer->tat.msec = 0;
+}
+
+/*
+ * Reserve departure time. This is the virtual scheduling algorithm
+ * (GCRA): tat is the departure time of the next request if the bucket
+ * is empty, and a request may depart up to (burst-1) intervals earlier.
+ */
+PJ_DEF(unsigned) pjsip_evsub_pacer_reserve(pjsip_evsub_pacer *pacer,
+					   const pj_time_val *now)
+{
+    pj_time_val depart, interval, tolerance;
+    unsigned delay;
+
+    PJ_ASSERT_RETURN(pacer && now, 0);
+
+    if (pacer->rate == 0)
+	return 0;
+
+    interval.sec = 0;
+    interval.msec = (pacer->rate >= 1000) ? 1 : 1000 / pacer->rate;
+    pj_time_val_normalize(&interval);
+
+    tolerance.sec = 0;
+    tolerance.msec = PJ_TIME_VAL_MSEC(interval) * (pacer->burst - 1);
+    pj_time_val_normalize(&tolerance);
+
+    /* Idle long enough, the bucket is full */
+    if (PJ_TIME_VAL_LT(pacer->tat, *now))
+	pacer->tat = *now;
+
+    depart = pacer->tat;
+    PJ_TIME_VAL_SUB(depart, tolerance);
+
+    if (PJ_TIME_VAL_GT(depart, *now)) {
+	PJ_TIME_VAL_SUB(depart, *now);
+	delay = PJ_TIME_VAL_MSEC(depart);
+    } else {
+	delay = 0;
+    }
+
+    PJ_TIME_VAL_ADD(pacer->tat, interval);
+
+    return delay;
+}
+
 /*
  * Initiate client subscription
  */
@@ -1153,7 +1274,9 @@ PJ_DEF(pj_status_t) pjsip_evsub_accept( pjsip_evsub *sub,
     /* Set UAS timeout timer, when status code is 2xx and state is not
      * terminated.
      */
-    if (st_code/100 == 2 && sub->state != PJSIP_EVSUB_STATE_TERMINATED) {
+    if (st_code/100 == 2 && sub->state != PJSIP_EVSUB_STATE_TERMINATED &&
+	(sub->option & PJSIP_EVSUB_NO_UAS_TIMER) == 0)
+    {
 	PJ_LOG(5,(sub->obj_name, "UAS timeout in %d seconds",
 		  sub->expires->ivalue));
 	set_timer(sub, TIMER_TYPE_UAS_TIMEOUT, sub->expires->ivalue);
@@ -1758,12 +1881,10 @@ static void on_tsx_state_uac( pjsip_evsub *sub, pjsip_transaction *tsx,
 
 	    /* Start UAC refresh timer, only when we're not unsubscribing */
 	    if (sub->expires->ivalue != 0) {
-		unsigned timeout = (sub->expires->ivalue > TIME_UAC_REFRESH) ?
-		    sub->expires->ivalue - TIME_UAC_REFRESH : sub->expires->ivalue;
+		unsigned timeout;
 
-		/* Reduce timeout by about 1 - 10 secs (randomized) */
-		if (timeout > 10)
-		    timeout += -10 + (pj_rand() % 10);
+		timeout = pjsip_evsub_calc_refresh_delay(sub->expires->ivalue,
+							 sub->refresh_jitter);
 
 		PJ_LOG(5,(sub->obj_name, "Will refresh in %d seconds", 
 			  timeout));
@@ -1926,8 +2047,8 @@ static void on_tsx_state_uac( pjsip_evsub *sub, pjsip_transaction *tsx,
 	    update_expires(sub, next_refresh);
 
 	    /* Start UAC refresh timer, only when we're not unsubscribing */
-	    timeout = (next_refresh > TIME_UAC_REFRESH) ?
-			next_refresh - TIME_UAC_REFRESH : next_refresh;
+	    timeout = pjsip_evsub_calc_refresh_delay(next_refresh,
+						     sub->refresh_jitter);
 
 	    PJ_LOG(5,(sub->obj_name, "Will refresh in %d seconds", timeout));
 	    set_timer(sub, TIMER_TYPE_UAC_REFRESH, timeout);
@@ -2086,7 +2207,9 @@ static void on_tsx_state_uas( pjsip_evsub *sub, pjsip_transaction *tsx,
 	    }
 
 	    /* Set UAS timeout timer, when state is not terminated. */
-	    if (sub->state != PJSIP_EVSUB_STATE_TERMINATED) {
+	    if (sub->state != PJSIP_EVSUB_STATE_TERMINATED &&
+		(sub->option & PJSIP_EVSUB_NO_UAS_TIMER) == 0)
+	    {
 		PJ_LOG(5,(sub->obj_name, "UAS timeout in %d seconds",
 			  sub->expires->ivalue));
 		set_timer(sub, TIMER_TYPE_UAS_TIMEOUT, 
@@ -0,0 +1,1159 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <pjsip-simple/evsub_srv.h>
+#include <pjsip-simple/evsub_msg.h>
+#include <pjsip-simple/errno.h>
+#include <pjsip/sip_dialog.h>
+#include <pjsip/sip_endpoint.h>
+#include <pjsip/sip_event.h>
+#include <pjsip/sip_module.h>
+#include <pjsip/sip_transaction.h>
+#include <pjsip/sip_ua_layer.h>
+#include <pjsip/sip_uri.h>
+#include <pj/assert.h>
+#include <pj/hash.h>
+#include <pj/lock.h>
+#include <pj/log.h>
+#include <pj/os.h>
+#include <pj/pool.h>
+#include <pj/string.h>
+
+
+#define THIS_FILE		"evsub_srv.c"
+
+/* Interval of the expiration wheel */
+#define TICK_MSEC		1000
+
+/* Delay to retry notifying watchers whose dialog was busy */
+#define RETRY_MSEC		10
+
+/* Number of buckets of the resource table */
+#define RES_TABLE_SIZE		4095
+
+/* Watcher flags */
+enum watcher_flag
+{
+    W_QUEUED	= 1,	/* In the notification queue			*/
+    W_PENDING	= 2,	/* NOTIFY transaction is outstanding		*/
+    W_FORCE	= 4,	/* Notify even if the state has not changed	*/
+    W_EXPIRED	= 8	/* Terminate the subscription			*/
+};
+
+struct watcher;
+
+/* Node to put a watcher in the wheel or in the queue */
+struct wnode
+{
+    PJ_DECL_LIST_MEMBER(struct wnode);
+    struct watcher	*w;
+};
+
+/* A watcher, allocated from the pool of its dialog. */
+struct watcher
+{
+    PJ_DECL_LIST_MEMBER(struct watcher);
+    pjsip_evsub_srv	*srv;
+    struct resource	*res;		/* NULL once removed		    */
+    pjsip_evsub		*sub;
+    pjsip_dialog	*dlg;
+    struct wnode	 slot_node;
+    struct wnode	 queue_node;
+    pj_uint32_t		 expire;	/* Seconds since server creation    */
+    pj_uint32_t		 version;	/* Last state version notified	    */
+    unsigned		 flags;
+};
+
+/* A resource, with its own pool so that the body can grow. */
+struct resource
+{
+    pj_pool_t		*pool;
+    pj_hash_entry_buf	 hentry;
+    pj_uint32_t		 hval;
+    pj_str_t		 name;
+    pj_bool_t		 has_state;
+    pj_str_t		 body;
+    pj_size_t		 body_cap;
+    pj_uint32_t		 version;
+    unsigned		 watcher_cnt;
+    struct watcher	 watcher_list;
+};
+
+struct pjsip_evsub_srv
+{
+    PJ_DECL_LIST_MEMBER(struct pjsip_evsub_srv);
+    pj_pool_t		*pool;
+    pjsip_endpoint	*endpt;
+    pj_grp_lock_t	*grp_lock;
+    pj_bool_t		 destroying;
+    pjsip_evsub_srv_param param;
+    pjsip_media_type	 content_type;
+    pj_time_val		 epoch;
+
+    pj_hash_table_t	*res_table;
+    struct wnode	*wheel;
+    pj_uint32_t		 wheel_pos;
+    struct wnode	 queue;
+    pj_bool_t		 in_flush;
+
+    pj_timer_entry	 timer;
+    pj_timer_entry	 retry_timer;
+
+    pjsip_evsub_srv_stat stat;
+};
+
+
+static pj_bool_t mod_evsub_srv_on_rx_request(pjsip_rx_data *rdata);
+static pj_status_t mod_evsub_srv_unload(void);
+
+static void srv_on_evsub_state(pjsip_evsub *sub, pjsip_event *event);
+static void srv_on_evsub_tsx_state(pjsip_evsub *sub, pjsip_transaction *tsx,
+				   pjsip_event *event);
+static void srv_on_evsub_rx_refresh(pjsip_evsub *sub,
+				    pjsip_rx_data *rdata,
+				    int *p_st_code,
+				    pj_str_t **p_st_text,
+				    pjsip_hdr *res_hdr,
+				    pjsip_msg_body **p_body);
+
+
+/*
+ * The module to receive new SUBSCRIBE requests, shared by all servers.
+ */
+static struct mod_evsub_srv
+{
+    pjsip_module	 mod;
+    pj_pool_t		*pool;
+    pj_mutex_t		*mutex;
+    struct pjsip_evsub_srv srv_list;
+
+} mod_evsub_srv =
+{
+    {
+	NULL, NULL,			    /* prev, next.		*/
+	{ "mod-evsub-srv", 13 },	    /* Name.			*/
+	-1,				    /* Id			*/
+	PJSIP_MOD_PRIORITY_APPLICATION,	    /* Priority			*/
+	NULL,				    /* load()			*/
+	NULL,				    /* start()			*/
+	NULL,				    /* stop()			*/
+	&mod_evsub_srv_unload,		    /* unload()			*/
+	&mod_evsub_srv_on_rx_request,	    /* on_rx_request()		*/
+	NULL,				    /* on_rx_response()		*/
+	NULL,				    /* on_tx_request.		*/
+	NULL,				    /* on_tx_response()		*/
+	NULL,				    /* on_tsx_state()		*/
+    }
+};
+
+/* Callbacks of the watcher subscriptions */
+static pjsip_evsub_user srv_user =
+{
+    &srv_on_evsub_state,
+    &srv_on_evsub_tsx_state,
+    &srv_on_evsub_rx_refresh,
+    NULL,
+    NULL,
+    NULL
+};
+
+static const pj_str_t STR_EVENT	     = { "Event", 5 };
+static const pj_str_t STR_EVENT_S    = { "o", 1 };
+static const pj_str_t STR_TIMEOUT    = { "timeout", 7 };
+static const pj_str_t STR_NORESOURCE = { "noresource", 10 };
+
+
+static pj_status_t mod_evsub_srv_unload(void)
+{
+    if (mod_evsub_srv.mutex) {
+	pj_mutex_destroy(mod_evsub_srv.mutex);
+	mod_evsub_srv.mutex = NULL;
+    }
+    if (mod_evsub_srv.pool) {
+	pj_pool_release(mod_evsub_srv.pool);
+	mod_evsub_srv.pool = NULL;
+    }
+    return PJ_SUCCESS;
+}
+
+
+/* Seconds since the server was created */
+static pj_uint32_t now_sec(pjsip_evsub_srv *srv)
+{
+    pj_time_val now;
+
+    pj_gettickcount(&now);
+    PJ_TIME_VAL_SUB(now, srv->epoch);
+    return (pj_uint32_t)now.sec;
+}
+
+
+static struct resource *find_res(pjsip_evsub_srv *srv, const pj_str_t *name,
+				 pj_bool_t create)
+{
+    struct resource *res;
+    pj_pool_t *pool;
+    pj_uint32_t hval = 0;
+
+    res = (struct resource*)
+	  pj_hash_get_lower(srv->res_table, name->ptr,
+			    (unsigned)name->slen, &hval);
+    if (res || !create)
+	return res;
+
+    pool = pjsip_endpt_create_pool(srv->endpt, "evres%p", 512, 512);
+    if (!pool)
+	return NULL;
+
+    res = PJ_POOL_ZALLOC_T(pool, struct resource);
+    res->pool = pool;
+    res->hval = hval;
+    pj_strdup(pool, &res->name, name);
+    pj_list_init(&res->watcher_list);
+
+    pj_hash_set_np_lower(srv->res_table, res->name.ptr,
+			 (unsigned)res->name.slen, res->hval,
+			 res->hentry, res);
+    ++srv->stat.resources;
+
+    return res;
+}
+
+
+static void destroy_res(pjsip_evsub_srv *srv, struct resource *res)
+{
+    pj_assert(res->watcher_cnt == 0);
+
+    pj_hash_set_np_lower(srv->res_table, res->name.ptr,
+			 (unsigned)res->name.slen, res->hval,
+			 res->hentry, NULL);
+    --srv->stat.resources;
+    pj_pool_release(res->pool);
+}
+
+
+/* Put the watcher in the queue if it needs to be notified. Watchers with
+ * outstanding NOTIFY are queued again when the transaction completes.
+ */
+static void queue_watcher(pjsip_evsub_srv *srv, struct watcher *w)
+{
+    if (w->flags & (W_QUEUED | W_PENDING))
+	return;
+
+    if ((w->flags & (W_FORCE | W_EXPIRED)) == 0 &&
+	w->version == w->res->version)
+    {
+	return;
+    }
+
+    pj_list_push_back(&srv->queue, &w->queue_node);
+    w->flags |= W_QUEUED;
+    ++srv->stat.queued;
+}
+
+
+static void unqueue_watcher(pjsip_evsub_srv *srv, struct watcher *w)
+{
+    if (w->flags & W_QUEUED) {
+	pj_list_erase(&w->queue_node);
+	w->flags &= ~W_QUEUED;
+	--srv->stat.queued;
+    }
+}
+
+
+/* Update the expiration of the watcher and move it in the wheel. */
+static void update_expiry(pjsip_evsub_srv *srv, struct watcher *w)
+{
+    if (!pj_list_empty(&w->slot_node)) {
+	pj_list_erase(&w->slot_node);
+	pj_list_init(&w->slot_node);
+    }
+
+    w->expire = now_sec(srv) + pjsip_evsub_get_expires(w->sub);
+    pj_list_push_back(&srv->wheel[w->expire % PJSIP_EVSUB_SRV_WHEEL_SIZE],
+		      &w->slot_node);
+}
+
+
+static void add_watcher(pjsip_evsub_srv *srv, struct watcher *w,
+			struct resource *res)
+{
+    w->srv = srv;
+    w->res = res;
+    w->version = res->version;
+    w->flags |= W_FORCE;
+    pj_list_push_back(&res->watcher_list, w);
+    ++srv->stat.watchers;
+
+    if (res->watcher_cnt++ == 0 && srv->param.cb.on_watched)
+	(*srv->param.cb.on_watched)(srv, &res->name, PJ_TRUE);
+}
+
+
+static void remove_watcher(pjsip_evsub_srv *srv, struct watcher *w)
+{
+    struct resource *res = w->res;
+
+    unqueue_watcher(srv, w);
+    if (w->flags & W_PENDING) {
+	w->flags &= ~W_PENDING;
+	--srv->stat.pending;
+    }
+    if (!pj_list_empty(&w->slot_node)) {
+	pj_list_erase(&w->slot_node);
+	pj_list_init(&w->slot_node);
+    }
+
+    pj_list_erase(w);
+    w->res = NULL;
+    --srv->stat.watchers;
+
+    if (--res->watcher_cnt == 0) {
+	if (srv->param.cb.on_watched && !srv->destroying)
+	    (*srv->param.cb.on_watched)(srv, &res->name, PJ_FALSE);
+	if (!res->has_state)
+	    destroy_res(srv, res);
+    }
+}
+
+
+/* Send NOTIFY with the current state of the resource. Both the server and
+ * the dialog of the watcher must have been locked.
+ */
+static void send_notify(pjsip_evsub_srv *srv, struct watcher *w)
+{
+    struct resource *res = w->res;
+    pjsip_evsub_state state;
+    const pj_str_t *reason = NULL;
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    if (w->flags & W_EXPIRED) {
+	state = PJSIP_EVSUB_STATE_TERMINATED;
+	reason = &STR_TIMEOUT;
+    } else {
+	state = PJSIP_EVSUB_STATE_ACTIVE;
+    }
+
+    status = pjsip_evsub_notify(w->sub, state, NULL, reason, &tdata);
+    if (status == PJ_SUCCESS && res->has_state) {
+	tdata->msg->body = pjsip_msg_body_create(tdata->pool,
+						 &srv->content_type.type,
+						 &srv->content_type.subtype,
+						 &res->body);
+    }
+    if (status != PJ_SUCCESS) {
+	PJ_PERROR(3,(THIS_FILE, status, "Unable to create NOTIFY for %.*s",
+		     (int)res->name.slen, res->name.ptr));
+	if (w->flags & W_EXPIRED)
+	    pjsip_evsub_terminate(w->sub, PJ_TRUE);
+	return;
+    }
+
+    if (res->version - w->version > 1)
+	srv->stat.coalesced += res->version - w->version - 1;
+    w->version = res->version;
+    w->flags &= ~W_FORCE;
+    w->flags |= W_PENDING;
+    ++srv->stat.pending;
+    ++srv->stat.notify_sent;
+
+    /* Terminating NOTIFY removes the watcher when it is sent */
+    status = pjsip_evsub_send_request(w->sub, tdata);
+    if (status != PJ_SUCCESS) {
+	PJ_PERROR(3,(THIS_FILE, status, "Unable to send NOTIFY for %.*s",
+		     (int)res->name.slen, res->name.ptr));
+	if (w->res && (w->flags & W_PENDING)) {
+	    w->flags &= ~W_PENDING;
+	    --srv->stat.pending;
+	}
+	if (w->res && (w->flags & W_EXPIRED))
+	    pjsip_evsub_terminate(w->sub, PJ_TRUE);
+    }
+}
+
+
+static void on_retry_timer(pj_timer_heap_t *th, pj_timer_entry *entry);
+
+/* Notify queued watchers, as long as the pending limit allows. The dialog
+ * locks are only tried, because other threads may hold a dialog lock
+ * while waiting for the server lock.
+ */
+static void flush(pjsip_evsub_srv *srv)
+{
+    unsigned cnt, busy = 0;
+
+    if (srv->in_flush || srv->destroying)
+	return;
+
+    srv->in_flush = PJ_TRUE;
+
+    cnt = srv->stat.queued;
+    while (cnt-- && srv->stat.pending < srv->param.max_pending &&
+	   !pj_list_empty(&srv->queue))
+    {
+	struct watcher *w = srv->queue.next->w;
+	pjsip_dialog *dlg = w->dlg;
+
+	unqueue_watcher(srv, w);
+
+	if (pjsip_dlg_try_inc_lock(dlg) != PJ_SUCCESS) {
+	    pj_list_push_back(&srv->queue, &w->queue_node);
+	    w->flags |= W_QUEUED;
+	    ++srv->stat.queued;
+	    ++busy;
+	    continue;
+	}
+
+	send_notify(srv, w);
+
+	/* This may destroy the dialog, along with the watcher */
+	pjsip_dlg_dec_lock(dlg);
+    }
+
+    srv->in_flush = PJ_FALSE;
+
+    if (busy && srv->retry_timer.id == 0) {
+	pj_time_val delay = { 0, RETRY_MSEC };
+
+	pj_grp_lock_add_ref(srv->grp_lock);
+	srv->retry_timer.id = 1;
+	if (pjsip_endpt_schedule_timer(srv->endpt, &srv->retry_timer,
+				       &delay) != PJ_SUCCESS)
+	{
+	    srv->retry_timer.id = 0;
+	    pj_grp_lock_dec_ref(srv->grp_lock);
+	}
+    }
+}
+
+
+static void on_retry_timer(pj_timer_heap_t *th, pj_timer_entry *entry)
+{
+    pjsip_evsub_srv *srv = (pjsip_evsub_srv*) entry->user_data;
+
+    PJ_UNUSED_ARG(th);
+
+    pj_grp_lock_acquire(srv->grp_lock);
+    entry->id = 0;
+    flush(srv);
+    pj_grp_lock_release(srv->grp_lock);
+    pj_grp_lock_dec_ref(srv->grp_lock);
+}
+
+
+/* Expire the watchers of one slot of the wheel. */
+static void expire_slot(pjsip_evsub_srv *srv, unsigned slot,
+			pj_uint32_t now)
+{
+    struct wnode *head = &srv->wheel[slot], *node, *next;
+
+    for (node = head->next; node != head; node = next) {
+	struct watcher *w = node->w;
+
+	next = node->next;
+	if ((pj_int32_t)(w->expire - now) > 0)
+	    continue;
+
+	pj_list_erase(node);
+	pj_list_init(node);
+	w->flags |= W_EXPIRED;
+	++srv->stat.expired;
+	queue_watcher(srv, w);
+    }
+}
+
+
+static void on_timer(pj_timer_heap_t *th, pj_timer_entry *entry)
+{
+    pjsip_evsub_srv *srv = (pjsip_evsub_srv*) entry->user_data;
+    pj_time_val delay = { 0, TICK_MSEC };
+    pj_uint32_t now;
+
+    PJ_UNUSED_ARG(th);
+
+    pj_grp_lock_acquire(srv->grp_lock);
+    entry->id = 0;
+
+    if (srv->destroying) {
+	pj_grp_lock_release(srv->grp_lock);
+	pj_grp_lock_dec_ref(srv->grp_lock);
+	return;
+    }
+
+    now = now_sec(srv);
+    if (now - srv->wheel_pos >= PJSIP_EVSUB_SRV_WHEEL_SIZE) {
+	unsigned i;
+
+	for (i=0; i<PJSIP_EVSUB_SRV_WHEEL_SIZE; ++i)
+	    expire_slot(srv, i, now);
+    } else {
+	pj_uint32_t t;
+
+	for (t=srv->wheel_pos+1; t!=now+1; ++t)
+	    expire_slot(srv, t % PJSIP_EVSUB_SRV_WHEEL_SIZE, now);
+    }
+    srv->wheel_pos = now;
+
+    flush(srv);
+
+    /* Reuse the reference of this timer */
+    entry->id = 1;
+    if (pjsip_endpt_schedule_timer(srv->endpt, entry, &delay) != PJ_SUCCESS)
+    {
+	entry->id = 0;
+	pj_grp_lock_release(srv->grp_lock);
+	pj_grp_lock_dec_ref(srv->grp_lock);
+	return;
+    }
+
+    pj_grp_lock_release(srv->grp_lock);
+}
+
+
+/*
+ * Subscription callbacks. They are called with the dialog locked.
+ */
+static void srv_on_evsub_state(pjsip_evsub *sub, pjsip_event *event)
+{
+    struct watcher *w;
+    pjsip_evsub_srv *srv;
+
+    PJ_UNUSED_ARG(event);
+
+    if (pjsip_evsub_get_state(sub) != PJSIP_EVSUB_STATE_TERMINATED)
+	return;
+
+    w = (struct watcher*) pjsip_evsub_get_mod_data(sub, mod_evsub_srv.mod.id);
+    if (!w)
+	return;
+
+    srv = w->srv;
+    pj_grp_lock_acquire(srv->grp_lock);
+    if (w->res)
+	remove_watcher(srv, w);
+    pjsip_evsub_set_mod_data(sub, mod_evsub_srv.mod.id, NULL);
+    pj_grp_lock_release(srv->grp_lock);
+}
+
+
+static void srv_on_evsub_tsx_state(pjsip_evsub *sub, pjsip_transaction *tsx,
+				   pjsip_event *event)
+{
+    struct watcher *w;
+    pjsip_evsub_srv *srv;
+
+    if (tsx->role != PJSIP_ROLE_UAC ||
+	pjsip_method_cmp(&tsx->method, pjsip_get_notify_method()) != 0)
+    {
+	return;
+    }
+
+    /* Only the first final state of the transaction */
+    if (tsx->state != PJSIP_TSX_STATE_COMPLETED &&
+	(tsx->state != PJSIP_TSX_STATE_TERMINATED ||
+	 event->body.tsx_state.prev_state == PJSIP_TSX_STATE_COMPLETED))
+    {
+	return;
+    }
+
+    w = (struct watcher*) pjsip_evsub_get_mod_data(sub, mod_evsub_srv.mod.id);
+    if (!w)
+	return;
+
+    srv = w->srv;
+    pj_grp_lock_acquire(srv->grp_lock);
+
+    if (w->res && (w->flags & W_PENDING)) {
+	w->flags &= ~W_PENDING;
+	--srv->stat.pending;
+
+	/* Send the changes that happened meanwhile. The subscription is
+	 * terminated after failed NOTIFY, except when it is challenged.
+	 */
+	if (tsx->status_code/100 == 2)
+	    queue_watcher(srv, w);
+    }
+
+    flush(srv);
+    pj_grp_lock_release(srv->grp_lock);
+}
+
+
+static void srv_on_evsub_rx_refresh(pjsip_evsub *sub,
+				    pjsip_rx_data *rdata,
+				    int *p_st_code,
+				    pj_str_t **p_st_text,
+				    pjsip_hdr *res_hdr,
+				    pjsip_msg_body **p_body)
+{
+    struct watcher *w;
+    pjsip_evsub_srv *srv;
+
+    PJ_UNUSED_ARG(rdata);
+    PJ_UNUSED_ARG(p_st_code);
+    PJ_UNUSED_ARG(p_st_text);
+    PJ_UNUSED_ARG(res_hdr);
+    PJ_UNUSED_ARG(p_body);
+
+    w = (struct watcher*) pjsip_evsub_get_mod_data(sub, mod_evsub_srv.mod.id);
+    if (!w)
+	return;
+
+    srv = w->srv;
+    pj_grp_lock_acquire(srv->grp_lock);
+
+    if (w->res == NULL) {
+	/* Already removed */
+    } else if (pjsip_evsub_get_expires(sub) == 0) {
+	/* Unsubscription. The subscription is terminated right after this
+	 * callback, so the final NOTIFY can't wait in the queue.
+	 */
+	unqueue_watcher(srv, w);
+	w->flags |= W_EXPIRED;
+	send_notify(srv, w);
+    } else {
+	update_expiry(srv, w);
+	w->flags |= W_FORCE;
+	queue_watcher(srv, w);
+	flush(srv);
+    }
+
+    pj_grp_lock_release(srv->grp_lock);
+}
+
+
+/* Get the resource name from the Request-URI, i.e. "user@host". */
+static pj_status_t get_res_name(pjsip_rx_data *rdata, char *buf,
+				pj_size_t size, pj_str_t *name)
+{
+    pjsip_uri *uri = rdata->msg_info.msg->line.req.uri;
+    pjsip_sip_uri *sip_uri;
+    int len;
+
+    if (!PJSIP_URI_SCHEME_IS_SIP(uri) && !PJSIP_URI_SCHEME_IS_SIPS(uri))
+	return PJSIP_ERRNO_FROM_SIP_STATUS(PJSIP_SC_UNSUPPORTED_URI_SCHEME);
+
+    sip_uri = (pjsip_sip_uri*) pjsip_uri_get_uri(uri);
+    if (sip_uri->user.slen) {
+	len = pj_ansi_snprintf(buf, size, "%.*s@%.*s",
+			       (int)sip_uri->user.slen, sip_uri->user.ptr,
+			       (int)sip_uri->host.slen, sip_uri->host.ptr);
+    } else {
+	len = pj_ansi_snprintf(buf, size, "%.*s",
+			       (int)sip_uri->host.slen, sip_uri->host.ptr);
+    }
+    if (len < 0 || len >= (int)size)
+	return PJSIP_ERRNO_FROM_SIP_STATUS(PJSIP_SC_REQUEST_URI_TOO_LONG);
+
+    pj_strset(name, buf, len);
+    return PJ_SUCCESS;
+}
+
+
+/* Get the Contact of the server, from the transport if it's not set. */
+static void get_contact(pjsip_evsub_srv *srv, pjsip_rx_data *rdata,
+			char *buf, pj_size_t size, pj_str_t *contact)
+{
+    pjsip_transport *tp = rdata->tp_info.transport;
+    const pj_str_t *host = &tp->local_name.host;
+    pj_bool_t ipv6;
+    int len;
+
+    if (srv->param.contact.slen) {
+	*contact = srv->param.contact;
+	return;
+    }
+
+    ipv6 = pj_memchr(host->ptr, ':', host->slen) != NULL;
+    len = pj_ansi_snprintf(buf, size, "<sip:%s%.*s%s:%d%s%s>",
+			   (ipv6 ? "[" : ""),
+			   (int)host->slen, host->ptr,
+			   (ipv6 ? "]" : ""),
+			   tp->local_name.port,
+			   (tp->key.type == PJSIP_TRANSPORT_UDP ||
+			    tp->key.type == PJSIP_TRANSPORT_UDP6 ?
+				"" : ";transport="),
+			   (tp->key.type == PJSIP_TRANSPORT_UDP ||
+			    tp->key.type == PJSIP_TRANSPORT_UDP6 ?
+				"" : tp->type_name));
+    if (len < 0 || len >= (int)size)
+	len = 0;
+    pj_strset(contact, buf, len);
+}
+
+
+/* Handle new SUBSCRIBE request. */
+static void on_subscribe(pjsip_evsub_srv *srv, pjsip_rx_data *rdata)
+{
+    char name_buf[PJSIP_MAX_URL_SIZE];
+    char contact_buf[PJSIP_MAX_URL_SIZE];
+    pj_str_t name, contact;
+    pjsip_dialog *dlg;
+    pjsip_evsub *sub;
+    struct watcher *w;
+    struct resource *res;
+    int code = 200;
+    pj_status_t status;
+
+    status = get_res_name(rdata, name_buf, sizeof(name_buf), &name);
+    if (status != PJ_SUCCESS) {
+	pjsip_endpt_respond_stateless(srv->endpt, rdata,
+				      PJSIP_ERRNO_TO_SIP_STATUS(status),
+				      NULL, NULL, NULL);
+	return;
+    }
+
+    if (srv->param.cb.on_subscribe)
+	(*srv->param.cb.on_subscribe)(srv, &name, rdata, &code);
+
+    if (code >= 300 || srv->destroying) {
+	pjsip_endpt_respond_stateless(srv->endpt, rdata,
+				      (code >= 300 ? code : 503),
+				      NULL, NULL, NULL);
+	return;
+    }
+    if (code/100 != 2)
+	code = 200;
+
+    get_contact(srv, rdata, contact_buf, sizeof(contact_buf), &contact);
+
+    status = pjsip_dlg_create_uas(pjsip_ua_instance(), rdata,
+				  (contact.slen ? &contact : NULL), &dlg);
+    if (status != PJ_SUCCESS) {
+	PJ_PERROR(3,(THIS_FILE, status, "Unable to create dialog for %.*s",
+		     (int)name.slen, name.ptr));
+	pjsip_endpt_respond_stateless(srv->endpt, rdata, 500, NULL,
+				      NULL, NULL);
+	return;
+    }
+
+    pjsip_dlg_inc_lock(dlg);
+
+    status = pjsip_evsub_create_uas(dlg, &srv_user, rdata,
+				    PJSIP_EVSUB_NO_UAS_TIMER, &sub);
+    if (status != PJ_SUCCESS) {
+	PJ_PERROR(3,(THIS_FILE, status,
+		     "Unable to create subscription for %.*s",
+		     (int)name.slen, name.ptr));
+	pjsip_dlg_respond(dlg, rdata, 500, NULL, NULL, NULL);
+	pjsip_dlg_dec_lock(dlg);
+	return;
+    }
+
+    status = pjsip_evsub_accept(sub, rdata, code, NULL);
+    if (status != PJ_SUCCESS) {
+	pjsip_evsub_terminate(sub, PJ_FALSE);
+	pjsip_dlg_dec_lock(dlg);
+	return;
+    }
+
+    w = PJ_POOL_ZALLOC_T(dlg->pool, struct watcher);
+    w->sub = sub;
+    w->dlg = dlg;
+    w->slot_node.w = w->queue_node.w = w;
+    pj_list_init(&w->slot_node);
+    pj_list_init(&w->queue_node);
+
+    pj_grp_lock_acquire(srv->grp_lock);
+
+    res = srv->destroying ? NULL : find_res(srv, &name, PJ_TRUE);
+    if (res == NULL) {
+	pj_grp_lock_release(srv->grp_lock);
+	pjsip_evsub_terminate(sub, PJ_FALSE);
+	pjsip_dlg_dec_lock(dlg);
+	return;
+    }
+
+    add_watcher(srv, w, res);
+    pjsip_evsub_set_mod_data(sub, mod_evsub_srv.mod.id, w);
+
+    /* Expires 0 only fetches the state */
+    if (pjsip_evsub_get_expires(sub) == 0)
+	w->flags |= W_EXPIRED;
+    else
+	update_expiry(srv, w);
+
+    queue_watcher(srv, w);
+    flush(srv);
+
+    pj_grp_lock_release(srv->grp_lock);
+    pjsip_dlg_dec_lock(dlg);
+}
+
+
+static pj_bool_t mod_evsub_srv_on_rx_request(pjsip_rx_data *rdata)
+{
+    pjsip_msg *msg = rdata->msg_info.msg;
+    pjsip_event_hdr *event_hdr;
+    pjsip_evsub_srv *srv;
+
+    if (pjsip_method_cmp(&msg->line.req.method,
+			 pjsip_get_subscribe_method()) != 0 ||
+	rdata->msg_info.to->tag.slen != 0)
+    {
+	return PJ_FALSE;
+    }
+
+    event_hdr = (pjsip_event_hdr*)
+		pjsip_msg_find_hdr_by_names(msg, &STR_EVENT, &STR_EVENT_S,
+					    NULL);
+    if (!event_hdr)
+	return PJ_FALSE;
+
+    pj_mutex_lock(mod_evsub_srv.mutex);
+    srv = mod_evsub_srv.srv_list.next;
+    while (srv != &mod_evsub_srv.srv_list) {
+	if (pj_stricmp(&srv->param.event, &event_hdr->event_type) == 0)
+	    break;
+	srv = srv->next;
+    }
+    if (srv == &mod_evsub_srv.srv_list) {
+	pj_mutex_unlock(mod_evsub_srv.mutex);
+	return PJ_FALSE;
+    }
+    pj_grp_lock_add_ref(srv->grp_lock);
+    pj_mutex_unlock(mod_evsub_srv.mutex);
+
+    on_subscribe(srv, rdata);
+
+    pj_grp_lock_dec_ref(srv->grp_lock);
+    return PJ_TRUE;
+}
+
+
+/*
+ * Public API
+ */
+
+PJ_DEF(void) pjsip_evsub_srv_param_default(pjsip_evsub_srv_param *param)
+{
+    pj_bzero(param, sizeof(*param));
+    param->expires = PJSIP_PRES_DEFAULT_EXPIRES;
+    param->max_pending = PJSIP_EVSUB_SRV_MAX_PENDING;
+}
+
+
+static void srv_on_destroy(void *arg)
+{
+    pjsip_evsub_srv *srv = (pjsip_evsub_srv*) arg;
+    pj_hash_iterator_t it_buf, *it;
+
+    PJ_LOG(5,(THIS_FILE, "Subscription server %p destroyed", srv));
+
+    it = pj_hash_first(srv->res_table, &it_buf);
+    while (it) {
+	struct resource *res;
+
+	res = (struct resource*) pj_hash_this(srv->res_table, it);
+	it = pj_hash_next(srv->res_table, it);
+	destroy_res(srv, res);
+    }
+    pj_pool_release(srv->pool);
+}
+
+
+PJ_DEF(pj_status_t) pjsip_evsub_srv_create(pjsip_endpoint *endpt,
+					   const pjsip_evsub_srv_param *param,
+					   pjsip_evsub_srv **p_srv)
+{
+    pj_pool_t *pool;
+    pjsip_evsub_srv *srv;
+    pj_str_t accept, tmp;
+    char *slash;
+    unsigned i;
+    pj_time_val delay = { 0, TICK_MSEC };
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(endpt && param && p_srv, PJ_EINVAL);
+    PJ_ASSERT_RETURN(param->event.slen && param->content_type.slen &&
+		     param->expires && param->max_pending, PJ_EINVAL);
+    PJ_ASSERT_RETURN(pjsip_ua_instance()->id != -1, PJ_EINVALIDOP);
+
+    slash = pj_memchr(param->content_type.ptr, '/', param->content_type.slen);
+    PJ_ASSERT_RETURN(slash != NULL, PJ_EINVAL);
+
+    /* Register the module with the first server */
+    if (mod_evsub_srv.mod.id == -1) {
+	mod_evsub_srv.pool = pjsip_endpt_create_pool(endpt, "evsubsrv",
+						     256, 256);
+	if (!mod_evsub_srv.pool)
+	    return PJ_ENOMEM;
+
+	status = pj_mutex_create_simple(mod_evsub_srv.pool, "evsubsrv",
+					&mod_evsub_srv.mutex);
+	if (status == PJ_SUCCESS) {
+	    pj_list_init(&mod_evsub_srv.srv_list);
+	    status = pjsip_endpt_register_module(endpt, &mod_evsub_srv.mod);
+	}
+	if (status != PJ_SUCCESS) {
+	    mod_evsub_srv_unload();
+	    return status;
+	}
+    }
+
+    pj_mutex_lock(mod_evsub_srv.mutex);
+    for (srv = mod_evsub_srv.srv_list.next;
+	 srv != &mod_evsub_srv.srv_list;
+	 srv = srv->next)
+    {
+	if (pj_stricmp(&srv->param.event, &param->event) == 0) {
+	    pj_mutex_unlock(mod_evsub_srv.mutex);
+	    return PJ_EEXISTS;
+	}
+    }
+    pj_mutex_unlock(mod_evsub_srv.mutex);
+
+    pool = pjsip_endpt_create_pool(endpt, "evsubsrv%p", 1024, 1024);
+    PJ_ASSERT_RETURN(pool != NULL, PJ_ENOMEM);
+
+    srv = PJ_POOL_ZALLOC_T(pool, pjsip_evsub_srv);
+    srv->pool = pool;
+    srv->endpt = endpt;
+    pj_memcpy(&srv->param, param, sizeof(*param));
+    pj_strdup_with_null(pool, &srv->param.event, &param->event);
+    pj_strdup_with_null(pool, &srv->param.content_type,
+			&param->content_type);
+    pj_strdup_with_null(pool, &srv->param.contact, &param->contact);
+
+    accept = srv->param.content_type;
+    tmp.ptr = accept.ptr + (slash - param->content_type.ptr);
+    pj_strset3(&srv->content_type.type, accept.ptr, tmp.ptr);
+    pj_strset3(&srv->content_type.subtype, tmp.ptr + 1,
+	       accept.ptr + accept.slen);
+    pj_list_init(&srv->content_type.param);
+
+    /* Register the package, unless another module (such as presence) has
+     * registered it. Either way only the server creates subscriptions.
+     */
+    if (!pjsip_evsub_has_pkg(&srv->param.event)) {
+	status = pjsip_evsub_register_pkg(&mod_evsub_srv.mod,
+					  &srv->param.event,
+					  srv->param.expires, 1, &accept);
+	if (status != PJ_SUCCESS) {
+	    pj_pool_release(pool);
+	    return status;
+	}
+    }
+
+    srv->res_table = pj_hash_create(pool, RES_TABLE_SIZE);
+    srv->wheel = (struct wnode*)
+		 pj_pool_calloc(pool, PJSIP_EVSUB_SRV_WHEEL_SIZE,
+				sizeof(struct wnode));
+    for (i=0; i<PJSIP_EVSUB_SRV_WHEEL_SIZE; ++i)
+	pj_list_init(&srv->wheel[i]);
+    pj_list_init(&srv->queue);
+    pj_gettickcount(&srv->epoch);
+
+    status = pj_grp_lock_create(pool, NULL, &srv->grp_lock);
+    if (status != PJ_SUCCESS) {
+	pj_pool_release(pool);
+	return status;
+    }
+    pj_grp_lock_add_ref(srv->grp_lock);
+    pj_grp_lock_add_handler(srv->grp_lock, pool, srv, &srv_on_destroy);
+
+    pj_timer_entry_init(&srv->timer, 0, srv, &on_timer);
+    pj_timer_entry_init(&srv->retry_timer, 0, srv, &on_retry_timer);
+
+    pj_grp_lock_add_ref(srv->grp_lock);
+    srv->timer.id = 1;
+    status = pjsip_endpt_schedule_timer(endpt, &srv->timer, &delay);
+    if (status != PJ_SUCCESS) {
+	srv->timer.id = 0;
+	pj_grp_lock_dec_ref(srv->grp_lock);
+	pj_grp_lock_dec_ref(srv->grp_lock);
+	return status;
+    }
+
+    pj_mutex_lock(mod_evsub_srv.mutex);
+    pj_list_push_back(&mod_evsub_srv.srv_list, srv);
+    pj_mutex_unlock(mod_evsub_srv.mutex);
+
+    PJ_LOG(4,(THIS_FILE, "Subscription server %p created for event %.*s",
+	      srv, (int)srv->param.event.slen, srv->param.event.ptr));
+
+    *p_srv = srv;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_evsub_srv_destroy(pjsip_evsub_srv *srv)
+{
+    pj_timer_heap_t *th;
+    pj_hash_iterator_t it_buf, *it;
+
+    PJ_ASSERT_RETURN(srv, PJ_EINVAL);
+
+    pj_mutex_lock(mod_evsub_srv.mutex);
+    pj_list_erase(srv);
+    pj_mutex_unlock(mod_evsub_srv.mutex);
+
+    pj_grp_lock_acquire(srv->grp_lock);
+    srv->destroying = PJ_TRUE;
+
+    th = pjsip_endpt_get_timer_heap(srv->endpt);
+    if (pj_timer_heap_cancel_if_active(th, &srv->timer, 0) > 0)
+	pj_grp_lock_dec_ref(srv->grp_lock);
+    if (pj_timer_heap_cancel_if_active(th, &srv->retry_timer, 0) > 0)
+	pj_grp_lock_dec_ref(srv->grp_lock);
+
+    /* Terminate the watchers. A busy dialog may be waiting for our lock,
+     * so let it go and start over.
+     */
+    it = pj_hash_first(srv->res_table, &it_buf);
+    while (it) {
+	struct resource *res;
+	struct watcher *w;
+	pjsip_dialog *dlg;
+	pjsip_evsub *sub;
+	pjsip_tx_data *tdata;
+
+	res = (struct resource*) pj_hash_this(srv->res_table, it);
+	if (pj_list_empty(&res->watcher_list)) {
+	    it = pj_hash_next(srv->res_table, it);
+	    continue;
+	}
+
+	w = res->watcher_list.next;
+	dlg = w->dlg;
+	sub = w->sub;
+	if (pjsip_dlg_try_inc_lock(dlg) != PJ_SUCCESS) {
+	    pj_grp_lock_release(srv->grp_lock);
+	    pj_thread_sleep(1);
+	    pj_grp_lock_acquire(srv->grp_lock);
+	    it = pj_hash_first(srv->res_table, &it_buf);
+	    continue;
+	}
+
+	/* Detach first, the server is gone when the NOTIFY completes */
+	remove_watcher(srv, w);
+	pjsip_evsub_set_mod_data(sub, mod_evsub_srv.mod.id, NULL);
+
+	if (pjsip_evsub_notify(sub, PJSIP_EVSUB_STATE_TERMINATED, NULL,
+			       &STR_NORESOURCE, &tdata) != PJ_SUCCESS ||
+	    pjsip_evsub_send_request(sub, tdata) != PJ_SUCCESS)
+	{
+	    pjsip_evsub_terminate(sub, PJ_FALSE);
+	}
+
+	pjsip_dlg_dec_lock(dlg);
+
+	/* The resource may have been destroyed with its last watcher */
+	it = pj_hash_first(srv->res_table, &it_buf);
+    }
+
+    pj_grp_lock_release(srv->grp_lock);
+    pj_grp_lock_dec_ref(srv->grp_lock);
+
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(void*) pjsip_evsub_srv_get_user_data(pjsip_evsub_srv *srv)
+{
+    PJ_ASSERT_RETURN(srv, NULL);
+    return srv->param.user_data;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_evsub_srv_set_state(pjsip_evsub_srv *srv,
+					      const pj_str_t *resource,
+					      const pj_str_t *body)
+{
+    struct resource *res;
+    struct watcher *w;
+
+    PJ_ASSERT_RETURN(srv && resource && resource->slen, PJ_EINVAL);
+
+    pj_grp_lock_acquire(srv->grp_lock);
+
+    if (srv->destroying) {
+	pj_grp_lock_release(srv->grp_lock);
+	return PJ_EINVALIDOP;
+    }
+
+    res = find_res(srv, resource, body != NULL);
+    if (!res) {
+	pj_grp_lock_release(srv->grp_lock);
+	return body ? PJ_ENOMEM : PJ_SUCCESS;
+    }
+
+    if (body) {
+	if ((pj_size_t)body->slen > res->body_cap) {
+	    res->body_cap *= 2;
+	    if (res->body_cap < (pj_size_t)body->slen)
+		res->body_cap = body->slen;
+	    res->body.ptr = (char*) pj_pool_alloc(res->pool, res->body_cap);
+	}
+	pj_memcpy(res->body.ptr, body->ptr, body->slen);
+	res->body.slen = body->slen;
+	res->has_state = PJ_TRUE;
+    } else {
+	res->body.slen = 0;
+	res->has_state = PJ_FALSE;
+    }
+    ++res->version;
+
+    if (res->watcher_cnt == 0) {
+	if (!res->has_state)
+	    destroy_res(srv, res);
+	pj_grp_lock_release(srv->grp_lock);
+	return PJ_SUCCESS;
+    }
+
+    for (w = res->watcher_list.next; w != &res->watcher_list; w = w->next)
+	queue_watcher(srv, w);
+
+    flush(srv);
+
+    pj_grp_lock_release(srv->grp_lock);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(unsigned) pjsip_evsub_srv_get_watcher_count(pjsip_evsub_srv *srv,
+						   const pj_str_t *resource)
+{
+    struct resource *res;
+    unsigned cnt;
+
+    PJ_ASSERT_RETURN(srv && resource, 0);
+
+    pj_grp_lock_acquire(srv->grp_lock);
+    res = find_res(srv, resource, PJ_FALSE);
+    cnt = res ? res->watcher_cnt : 0;
+    pj_grp_lock_release(srv->grp_lock);
+
+    return cnt;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_evsub_srv_get_stat(pjsip_evsub_srv *srv,
+					     pjsip_evsub_srv_stat *stat)
+{
+    PJ_ASSERT_RETURN(srv && stat, PJ_EINVAL);
+
+    pj_grp_lock_acquire(srv->grp_lock);
+    pj_memcpy(stat, &srv->stat, sizeof(*stat));
+    pj_grp_lock_release(srv->grp_lock);
+
+    return PJ_SUCCESS;
+}
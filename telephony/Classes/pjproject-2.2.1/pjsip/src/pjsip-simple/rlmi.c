@@ -0,0 +1,338 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <pjsip-simple/rlmi.h>
+#include <pjsip-simple/errno.h>
+#include <pjsip/sip_multipart.h>
+#include <pjlib-util/xml.h>
+#include <pj/assert.h>
+#include <pj/log.h>
+#include <pj/pool.h>
+#include <pj/string.h>
+
+
+#define THIS_FILE		"rlmi.c"
+
+
+static const pj_str_t STR_MULTIPART	= { "multipart", 9 };
+static const pj_str_t STR_RELATED	= { "related", 7 };
+static const pj_str_t STR_APPLICATION	= { "application", 11 };
+static const pj_str_t STR_RLMI_XML	= { "rlmi+xml", 8 };
+static const pj_str_t STR_START		= { "start", 5 };
+static const pj_str_t STR_CONTENT_ID	= { "Content-ID", 10 };
+static const pj_str_t STR_EVENTLIST	= { "eventlist", 9 };
+static const pj_str_t STR_MULTIPART_RELATED = { "multipart/related", 17 };
+static const pj_str_t STR_APP_RLMI_XML	= { "application/rlmi+xml", 20 };
+
+static const pj_str_t LIST		= { "list", 4 };
+static const pj_str_t RESOURCE		= { "resource", 8 };
+static const pj_str_t INSTANCE		= { "instance", 8 };
+static const pj_str_t NAME		= { "name", 4 };
+static const pj_str_t URI		= { "uri", 3 };
+static const pj_str_t VERSION		= { "version", 7 };
+static const pj_str_t FULL_STATE	= { "fullState", 9 };
+static const pj_str_t STATE		= { "state", 5 };
+static const pj_str_t REASON		= { "reason", 6 };
+static const pj_str_t CID		= { "cid", 3 };
+
+
+/*
+ * Add Supported and Accept headers to SUBSCRIBE.
+ */
+PJ_DEF(pj_status_t) pjsip_rlmi_add_subscribe_hdr(pjsip_tx_data *tdata,
+						 const pj_str_t *content_type)
+{
+    pjsip_supported_hdr *sup_hdr;
+    pjsip_accept_hdr *accept;
+    pjsip_hdr *hdr;
+
+    PJ_ASSERT_RETURN(tdata && content_type, PJ_EINVAL);
+
+    hdr = (pjsip_hdr*) pjsip_msg_find_hdr(tdata->msg, PJSIP_H_ACCEPT, NULL);
+    if (hdr)
+	pj_list_erase(hdr);
+
+    accept = pjsip_accept_hdr_create(tdata->pool);
+    pj_strdup(tdata->pool, &accept->values[0], content_type);
+    accept->values[1] = STR_MULTIPART_RELATED;
+    accept->values[2] = STR_APP_RLMI_XML;
+    accept->count = 3;
+    pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)accept);
+
+    sup_hdr = (pjsip_supported_hdr*)
+	      pjsip_msg_find_hdr(tdata->msg, PJSIP_H_SUPPORTED, NULL);
+    if (!sup_hdr) {
+	sup_hdr = pjsip_supported_hdr_create(tdata->pool);
+	pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)sup_hdr);
+    } else {
+	unsigned i;
+
+	for (i=0; i<sup_hdr->count; ++i) {
+	    if (pj_stricmp(&sup_hdr->values[i], &STR_EVENTLIST) == 0)
+		return PJ_SUCCESS;
+	}
+    }
+
+    PJ_ASSERT_RETURN(sup_hdr->count < PJ_ARRAY_SIZE(sup_hdr->values),
+		     PJ_ETOOMANY);
+    sup_hdr->values[sup_hdr->count++] = STR_EVENTLIST;
+
+    return PJ_SUCCESS;
+}
+
+
+/* Parts of the notification, indexed by Content-ID */
+struct part_index
+{
+    unsigned		  cnt;
+    pj_str_t		 *cid;
+    pjsip_multipart_part **part;
+};
+
+/* Get the Content-ID of the part, without the angle brackets. */
+static void get_part_cid(const pjsip_multipart_part *part, pj_str_t *cid)
+{
+    const pjsip_hdr *hdr;
+
+    cid->slen = 0;
+
+    for (hdr = part->hdr.next; hdr != &part->hdr; hdr = hdr->next) {
+	if (pj_stricmp(&hdr->name, &STR_CONTENT_ID) == 0)
+	    break;
+    }
+    if (hdr == &part->hdr || hdr->type != PJSIP_H_OTHER)
+	return;
+
+    *cid = ((const pjsip_generic_string_hdr*)hdr)->hvalue;
+    pj_strtrim(cid);
+    if (cid->slen >= 2 && cid->ptr[0] == '<' &&
+	cid->ptr[cid->slen-1] == '>')
+    {
+	cid->ptr++;
+	cid->slen -= 2;
+    }
+}
+
+static void build_part_index(pj_pool_t *pool, const pjsip_msg_body *mp,
+			     struct part_index *idx)
+{
+    pjsip_multipart_part *first, *head, *part;
+    unsigned cnt = 0;
+
+    pj_bzero(idx, sizeof(*idx));
+
+    first = pjsip_multipart_get_first_part(mp);
+    if (!first)
+	return;
+
+    /* The parts are kept in a circular list, walk it directly since
+     * pjsip_multipart_get_next_part() searches the list on every step.
+     */
+    head = first->prev;
+    for (part = first; part != head; part = part->next)
+	++cnt;
+
+    idx->cid = (pj_str_t*) pj_pool_calloc(pool, cnt, sizeof(pj_str_t));
+    idx->part = (pjsip_multipart_part**)
+		pj_pool_calloc(pool, cnt, sizeof(pjsip_multipart_part*));
+
+    for (part = first; part != head; part = part->next) {
+	idx->part[idx->cnt] = part;
+	get_part_cid(part, &idx->cid[idx->cnt]);
+	++idx->cnt;
+    }
+}
+
+/* Find part by Content-ID. The "cid:" URL scheme prefix is optional. */
+static pjsip_multipart_part *find_part_by_cid(const struct part_index *idx,
+					      const pj_str_t *cid)
+{
+    pj_str_t id = *cid;
+    unsigned i;
+
+    if (id.slen > 4 && pj_strnicmp2(&id, "cid:", 4) == 0) {
+	id.ptr += 4;
+	id.slen -= 4;
+    }
+
+    for (i=0; i<idx->cnt; ++i) {
+	if (pj_strcmp(&idx->cid[i], &id) == 0)
+	    return idx->part[i];
+    }
+
+    return NULL;
+}
+
+static void get_attr(const pj_xml_node *node, const pj_str_t *name,
+		     pj_str_t *value)
+{
+    const pj_xml_attr *attr = pj_xml_find_attr(node, name, NULL);
+
+    if (attr)
+	*value = attr->value;
+    else
+	value->slen = 0;
+}
+
+
+/*
+ * Parse resource list notification.
+ */
+PJ_DEF(pj_status_t) pjsip_rlmi_parse(pj_pool_t *pool,
+				     const pjsip_msg_body *body,
+				     pjsip_rlmi_list *list)
+{
+    const pjsip_msg_body *mp = body;
+    const pjsip_param *start_param;
+    pjsip_multipart_part *root;
+    struct part_index idx;
+    pj_xml_node *doc, *node;
+    pj_str_t value;
+    unsigned cnt;
+    char *buf;
+
+    PJ_ASSERT_RETURN(pool && body && list, PJ_EINVAL);
+
+    pj_bzero(list, sizeof(*list));
+
+    if (pj_stricmp(&body->content_type.type, &STR_MULTIPART) != 0 ||
+	pj_stricmp(&body->content_type.subtype, &STR_RELATED) != 0)
+    {
+	return PJSIP_SIMPLE_EBADCONTENT;
+    }
+
+    /* Incoming multipart bodies are already parsed by the message parser,
+     * but the application may give us a raw body too.
+     */
+    if (body->print_body == &pjsip_print_text_body) {
+	buf = (char*) pj_pool_alloc(pool, body->len + 1);
+	pj_memcpy(buf, body->data, body->len);
+	buf[body->len] = '\0';
+	mp = pjsip_multipart_parse(pool, buf, body->len,
+				   &body->content_type, 0);
+	if (!mp)
+	    return PJSIP_SIMPLE_EBADCONTENT;
+    }
+
+    build_part_index(pool, mp, &idx);
+    if (idx.cnt == 0)
+	return PJSIP_SIMPLE_EBADRLMI;
+
+    /* The root part is the one named by the "start" parameter, or the
+     * first part.
+     */
+    start_param = pjsip_param_cfind(&body->content_type.param, &STR_START);
+    if (start_param) {
+	pj_str_t start = start_param->value;
+
+	if (start.slen >= 2 && start.ptr[0] == '"') {
+	    start.ptr++;
+	    start.slen -= 2;
+	}
+	if (start.slen >= 2 && start.ptr[0] == '<') {
+	    start.ptr++;
+	    start.slen -= 2;
+	}
+	root = find_part_by_cid(&idx, &start);
+    } else {
+	root = idx.part[0];
+    }
+
+    if (!root || !root->body ||
+	pj_stricmp(&root->body->content_type.type, &STR_APPLICATION) != 0 ||
+	pj_stricmp(&root->body->content_type.subtype, &STR_RLMI_XML) != 0)
+    {
+	return PJSIP_SIMPLE_EBADRLMI;
+    }
+
+    /* The XML parser modifies the buffer */
+    buf = (char*) pj_pool_alloc(pool, root->body->len + 1);
+    pj_memcpy(buf, root->body->data, root->body->len);
+    buf[root->body->len] = '\0';
+
+    doc = pj_xml_parse(pool, buf, root->body->len);
+    if (!doc || pj_stricmp(&doc->name, &LIST) != 0)
+	return PJSIP_SIMPLE_EBADRLMI;
+
+    get_attr(doc, &URI, &list->uri);
+    get_attr(doc, &VERSION, &value);
+    if (list->uri.slen == 0 || value.slen == 0)
+	return PJSIP_SIMPLE_EBADRLMI;
+    list->version = pj_strtoul(&value);
+    get_attr(doc, &FULL_STATE, &value);
+    list->full_state = (pj_stricmp2(&value, "true") == 0 ||
+			pj_strcmp2(&value, "1") == 0);
+
+    cnt = 0;
+    for (node = pj_xml_find_node(doc, &RESOURCE); node != NULL;
+	 node = pj_xml_find_next_node(doc, node, &RESOURCE))
+    {
+	++cnt;
+    }
+    if (cnt == 0)
+	return PJ_SUCCESS;
+
+    list->res = (pjsip_rlmi_resource*)
+		pj_pool_calloc(pool, cnt, sizeof(pjsip_rlmi_resource));
+
+    for (node = pj_xml_find_node(doc, &RESOURCE); node != NULL;
+	 node = pj_xml_find_next_node(doc, node, &RESOURCE))
+    {
+	pjsip_rlmi_resource *res = &list->res[list->res_cnt];
+	pj_xml_node *child;
+
+	get_attr(node, &URI, &res->uri);
+	if (res->uri.slen == 0)
+	    continue;
+
+	child = pj_xml_find_node(node, &NAME);
+	if (child)
+	    res->name = child->content;
+
+	/* A resource may have several instances. Use the first one that
+	 * carries state in this notification, or the first one if none
+	 * does.
+	 */
+	for (child = pj_xml_find_node(node, &INSTANCE); child != NULL;
+	     child = pj_xml_find_next_node(node, child, &INSTANCE))
+	{
+	    pjsip_multipart_part *part = NULL;
+
+	    get_attr(child, &CID, &value);
+	    if (value.slen)
+		part = find_part_by_cid(&idx, &value);
+
+	    if (part || res->state.slen == 0) {
+		get_attr(child, &STATE, &res->state);
+		get_attr(child, &REASON, &res->reason);
+		res->body = part ? part->body : NULL;
+	    }
+	    if (part)
+		break;
+	}
+
+	++list->res_cnt;
+    }
+
+    PJ_LOG(5,(THIS_FILE, "RLMI %.*s version %u: %u resource(s)%s",
+	      (int)list->uri.slen, list->uri.ptr, list->version,
+	      list->res_cnt, (list->full_state ? ", full state" : "")));
+
+    return PJ_SUCCESS;
+}
@@ -18,11 +18,14 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA 
  */
 #include <pjsip-simple/sla.h>
+#include <pjsip-simple/dialog_info.h>
 #include <pjsip-simple/errno.h>
 #include <pjsip-simple/evsub_msg.h>
+#include <pjsip-simple/rlmi.h>
 #include <pjsip/sip_module.h>
 #include <pjsip/sip_endpoint.h>
 #include <pjsip/sip_dialog.h>
+#include <pjsip/sip_uri.h>
 #include <pjsua-lib/pjsua.h>
 #include <pjsua-lib/pjsua_internal.h>
 #include <pj/assert.h>
@@ -63,7 +66,7 @@ static struct pjsip_module mod_sla =
  */
 typedef struct pjsip_sla
 {
-    int                 type;    // 0:SLA     1:BLF
+    int                 type;    // 0:SLA     1:BLF     2:BLF list
     int                 line;
     pjsip_evsub		*sub;		/**< Event subscribtion record.	    */
     pjsip_dialog	*dlg;		/**< The dialog.		    */
@@ -224,8 +227,25 @@ PJ_DEF(pj_status_t) pjsip_sla_initiate( pjsip_evsub *sub,
 					pj_int32_t expires,
 					pjsip_tx_data **p_tdata)
 {
-    return pjsip_evsub_initiate(sub, &pjsip_subscribe_method, expires, 
-				p_tdata);
+    pjsip_sla *sla;
+    pj_status_t status;
+
+    status = pjsip_evsub_initiate(sub, &pjsip_subscribe_method, expires, 
+				  p_tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    /* Resource list subscription must say so in every SUBSCRIBE */
+    sla = (pjsip_sla*) pjsip_evsub_get_mod_data(sub, mod_sla.id);
+    if (sla && sla->type == PJSIP_SLA_SUBSCRIPTION_TYPE_BLF_LIST) {
+	status = pjsip_rlmi_add_subscribe_hdr(*p_tdata, &STR_APP_DIALOG_XML);
+	if (status != PJ_SUCCESS) {
+	    pjsip_tx_data_dec_ref(*p_tdata);
+	    *p_tdata = NULL;
+	}
+    }
+
+    return status;
 }
 
 /*
@@ -482,7 +502,8 @@ static void sla_on_evsub_client_refresh(pjsip_evsub *sub)
 	pj_status_t status;
 	pjsip_tx_data *tdata;
 
-        if(sla->type == PJSIP_SLA_SUBSCRIPTION_TYPE_BLF)
+        if(sla->type == PJSIP_SLA_SUBSCRIPTION_TYPE_BLF ||
+           sla->type == PJSIP_SLA_SUBSCRIPTION_TYPE_BLF_LIST)
         {
 	    status = pjsip_sla_initiate(sub, BLF_DEFAULT_EXPIRES, &tdata);
         }
@@ -522,6 +543,124 @@ static void sla_on_evsub_server_timeout(pjsip_evsub *sub)
 /***************************************************************************
  * Shared Line Appearance
  */
+/* Get the dialog-info state table of the line */
+static pjsip_dialog_info_table *get_line_state(pjsua_acc *acc, int type,
+					       int line, pj_bool_t create)
+{
+    pjsip_dialog_info_table **p_table;
+
+    if (type == PJSIP_SLA_SUBSCRIPTION_TYPE_SLA) {
+	if (line < 0 || line >= PJSUA_MAX_NUMBER_OF_SHARED_LINES)
+	    return NULL;
+	p_table = &acc->sla_line_state[line];
+    } else {
+	if (line < 0 || line >= PJSUA_MAX_NUMBER_OF_BLF_DEVICES)
+	    return NULL;
+	p_table = &acc->blf_line_state[line];
+    }
+
+    if (*p_table == NULL && create && acc->pool)
+	*p_table = PJ_POOL_ZALLOC_T(acc->pool, pjsip_dialog_info_table);
+
+    return *p_table;
+}
+
+/* Forget the dialogs of the line, since the versions of the next
+ * subscription start over. Returns whether the line was not idle.
+ */
+static pj_bool_t reset_line_state(pjsua_acc *acc, int type, int line)
+{
+    pjsip_dialog_info_table *table;
+    pjsip_dialog_info_line_state st;
+
+    table = get_line_state(acc, type, line, PJ_FALSE);
+    if (!table)
+	return PJ_FALSE;
+
+    pjsip_dialog_info_get_line_state(table, &st);
+    pj_bzero(table, sizeof(*table));
+
+    return st.state != PJSIP_DIALOG_INFO_IDLE;
+}
+
+/* Report terminated line, which is idle from now on */
+static void line_on_terminated(pjsua_acc *acc, pjsip_evsub *sub,
+			       int type, int line)
+{
+    pjsua_sla_info sla_info;
+
+    reset_line_state(acc, type, line);
+
+    if (pjsua_var.ua_cfg.cb.on_sla_info) {
+	pj_bzero(&sla_info, sizeof(sla_info));
+	sla_info.evsub = sub;
+	sla_info.line  = line;
+	sla_info.type  = type;
+	sla_info.has_state = PJ_TRUE;
+	(*pjsua_var.ua_cfg.cb.on_sla_info)(acc->index, &sla_info);
+    }
+}
+
+/* Request full state after missing some partial notifications */
+static void refresh_full_state(pjsip_evsub *sub, int type)
+{
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    status = pjsip_sla_initiate(sub, (type == PJSIP_SLA_SUBSCRIPTION_TYPE_SLA ?
+				      -1 : BLF_DEFAULT_EXPIRES), &tdata);
+    if (status == PJ_SUCCESS)
+	status = pjsip_sla_send_request(sub, tdata);
+    if (status != PJ_SUCCESS)
+	pjsua_perror(THIS_FILE, "Unable to refresh subscription for full "
+		     "dialog state", status);
+}
+
+/* Apply the dialog-info body of the line to its state table, and report
+ * the line when its derived state has changed. Bodies that are not
+ * dialog-info documents are reported as they are.
+ */
+static pj_status_t line_on_rx_state(pjsua_acc *acc, pjsip_evsub *sub,
+				    pjsip_rx_data *rdata, int type, int line,
+				    pjsip_msg_body *body)
+{
+    pjsip_dialog_info_table *table;
+    pjsip_dialog_info info;
+    pjsua_sla_info sla_info;
+    pj_bool_t changed;
+    pj_status_t status = PJ_ENOTFOUND;
+
+    pj_bzero(&sla_info, sizeof(sla_info));
+    sla_info.evsub = sub;
+    sla_info.rdata = rdata;
+    sla_info.line  = line;
+    sla_info.type  = type;
+    sla_info.body  = body;
+
+    table = get_line_state(acc, type, line, PJ_TRUE);
+    if (body && table)
+	status = pjsip_dialog_info_parse(rdata->tp_info.pool, body, &info);
+
+    if (status == PJ_SUCCESS) {
+	status = pjsip_dialog_info_apply(table, &info, &changed);
+	if (status != PJ_SUCCESS || !changed)
+	    return status;
+
+	sla_info.has_state = PJ_TRUE;
+	pjsip_dialog_info_get_line_state(table, &sla_info.state);
+
+	PJ_LOG(5,(THIS_FILE, "%s line%d of %.*s is %s",
+		  (type == PJSIP_SLA_SUBSCRIPTION_TYPE_SLA ? "SLA" : "BLF"),
+		  line, (int)acc->cfg.id.slen, acc->cfg.id.ptr,
+		  pjsip_dialog_info_state_name(sla_info.state.state)));
+    }
+
+    if (pjsua_var.ua_cfg.cb.on_sla_info)
+	(*pjsua_var.ua_cfg.cb.on_sla_info)(acc->index, &sla_info);
+
+    return PJ_SUCCESS;
+}
+
 /* Callback called when *client* subscription state has changed. */
 static void sla_evsub_on_state( pjsip_evsub *sub, pjsip_event *event)
 {
@@ -530,6 +669,9 @@ static void sla_evsub_on_state( pjsip_evsub *sub, pjsip_event *event)
     int setModData = 1, i;
 	
     PJ_UNUSED_ARG(event);
+
+    if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED)
+	pjsua_sub_refresh_cancel(sub);
 	
     /* Note: #937: no need to acuire PJSUA_LOCK here. Since the buddy has
      *   a dialog attached to it, lock_buddy() will use the dialog
@@ -549,6 +691,15 @@ static void sla_evsub_on_state( pjsip_evsub *sub, pjsip_event *event)
 			  (int)acc->cfg.id.slen, acc->cfg.id.ptr, 
 			  pjsip_evsub_get_state_name(sub)));
     }
+    else if(sla->type == PJSIP_SLA_SUBSCRIPTION_TYPE_BLF_LIST)
+    {
+         PJ_LOG(4,(THIS_FILE, 
+			  "BLF list %.*s subscription for %.*s is %s",
+			  (int)acc->cfg.blf_list_uri.slen,
+			  acc->cfg.blf_list_uri.ptr, 
+			  (int)acc->cfg.id.slen, acc->cfg.id.ptr, 
+			  pjsip_evsub_get_state_name(sub)));
+    }
     else
     {
          PJ_LOG(4,(THIS_FILE, 
@@ -558,16 +709,24 @@ static void sla_evsub_on_state( pjsip_evsub *sub, pjsip_event *event)
 			  pjsip_evsub_get_state_name(sub)));
     }
 	
-    if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED) {
-	pjsua_sla_info sla_info;
+    if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED &&
+	sla->type == PJSIP_SLA_SUBSCRIPTION_TYPE_BLF_LIST)
+    {
+	/* Every line of the list is terminated */
+	for(i = 0; i < PJSUA_MAX_NUMBER_OF_BLF_DEVICES; i++) {
+	    if (acc->cfg.blf_enabled[i])
+		line_on_terminated(acc, sub, PJSIP_SLA_SUBSCRIPTION_TYPE_BLF, i);
+	}
+
+	if (acc->blf_list_sub == sub) {
+	    acc->blf_list_sub = NULL;
+	    acc->blf_list_dlg = NULL;
+	}
+	pjsip_evsub_set_mod_data(sub, pjsua_var.mod.id, NULL);
+
+    } else if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED) {
 	/* Call callback */
-	if (pjsua_var.ua_cfg.cb.on_sla_info) {
-		sla_info.evsub = sub;
-		sla_info.rdata = NULL;
-		sla_info.line  = sla->line;
-                sla_info.type  = sla->type;
-		(*pjsua_var.ua_cfg.cb.on_sla_info)(acc->index, &sla_info);
-	}		
+	line_on_terminated(acc, sub, sla->type, sla->line);
 
         if(sla->type == PJSIP_SLA_SUBSCRIPTION_TYPE_SLA)
         {
@@ -611,6 +770,82 @@ static void sla_evsub_on_state( pjsip_evsub *sub, pjsip_event *event)
     }
 }
 
+/* Parse the URI of a BLF line or list resource for comparison */
+static pjsip_uri *blf_parse_uri(pj_pool_t *pool, const pj_str_t *uri)
+{
+    pj_str_t tmp;
+    pjsip_uri *p;
+
+    if (uri->slen == 0)
+	return NULL;
+
+    pj_strdup_with_null(pool, &tmp, uri);
+    p = pjsip_parse_uri(pool, tmp.ptr, tmp.slen, 0);
+    return p ? (pjsip_uri*) pjsip_uri_get_uri(p) : NULL;
+}
+
+/* Demultiplex resource list NOTIFY to the BLF lines */
+static void blf_list_on_rx_notify(pjsua_acc *acc, pjsip_evsub *sub,
+				  pjsip_rx_data *rdata)
+{
+    pjsip_msg_body *body = rdata->msg_info.msg->body;
+    pj_pool_t *pool = rdata->tp_info.pool;
+    pjsip_uri *line_uri[PJSUA_MAX_NUMBER_OF_BLF_DEVICES];
+    pjsip_rlmi_list list;
+    pj_bool_t need_refresh = PJ_FALSE;
+    unsigned i, j;
+    pj_status_t status;
+
+    /* NOTIFY for pending subscription may have no body */
+    if (!body)
+	return;
+
+    status = pjsip_rlmi_parse(pool, body, &list);
+    if (status != PJ_SUCCESS) {
+	pjsua_perror(THIS_FILE, "Invalid BLF resource list NOTIFY", status);
+	return;
+    }
+
+    /* Parse the line URIs once for all resources */
+    for (i = 0; i < PJSUA_MAX_NUMBER_OF_BLF_DEVICES; i++) {
+	line_uri[i] = acc->cfg.blf_enabled[i] ?
+		      blf_parse_uri(pool, &acc->cfg.blf[i]) : NULL;
+    }
+
+    for (j = 0; j < list.res_cnt; j++) {
+	pjsip_rlmi_resource *res = &list.res[j];
+	pjsip_uri *res_uri = blf_parse_uri(pool, &res->uri);
+
+	if (!res_uri)
+	    continue;
+
+	for (i = 0; i < PJSUA_MAX_NUMBER_OF_BLF_DEVICES; i++) {
+	    if (!line_uri[i] ||
+		pjsip_uri_cmp(PJSIP_URI_IN_OTHER, line_uri[i], res_uri) != 0)
+	    {
+		continue;
+	    }
+
+	    /* The RLS has lost the subscription to the resource */
+	    if (!res->body && pj_stricmp2(&res->state, "terminated") == 0) {
+		if (reset_line_state(acc, PJSIP_SLA_SUBSCRIPTION_TYPE_BLF, i))
+		    line_on_terminated(acc, sub,
+				       PJSIP_SLA_SUBSCRIPTION_TYPE_BLF, i);
+		continue;
+	    }
+
+	    status = line_on_rx_state(acc, sub, rdata,
+				      PJSIP_SLA_SUBSCRIPTION_TYPE_BLF, i,
+				      res->body);
+	    if (status == PJSIP_SIMPLE_EDLGINFOGAP)
+		need_refresh = PJ_TRUE;
+	}
+    }
+
+    if (need_refresh)
+	refresh_full_state(sub, PJSIP_SLA_SUBSCRIPTION_TYPE_BLF_LIST);
+}
+
 /* Callback called when we receive NOTIFY */
 static void sla_evsub_on_rx_notify(pjsip_evsub *sub, 
 								   pjsip_rx_data *rdata,
@@ -621,6 +856,8 @@ static void sla_evsub_on_rx_notify(pjsip_evsub *sub,
 {
     pjsua_sla_info sla_info;
     pjsua_acc *acc;
+    pjsip_sla *sla;
+    pj_status_t status;
 	
     PJ_UNUSED_ARG(p_st_code);
     PJ_UNUSED_ARG(p_st_text);
@@ -630,11 +867,26 @@ static void sla_evsub_on_rx_notify(pjsip_evsub *sub,
     acc = (pjsua_acc*) pjsip_evsub_get_mod_data(sub, pjsua_var.mod.id);
     if (!acc)
 		return;
+
+    sla = (pjsip_sla*) pjsip_evsub_get_mod_data(sub, mod_sla.id);
+    if (sla && sla->type == PJSIP_SLA_SUBSCRIPTION_TYPE_BLF_LIST) {
+	blf_list_on_rx_notify(acc, sub, rdata);
+	return;
+    }
 	
+    if (sla) {
+	status = line_on_rx_state(acc, sub, rdata, sla->type, sla->line,
+				  rdata->msg_info.msg->body);
+	if (status == PJSIP_SIMPLE_EDLGINFOGAP)
+	    refresh_full_state(sub, sla->type);
+	return;
+    }
+
     /* Construct sla_info */
     pj_bzero(&sla_info, sizeof(sla_info));
     sla_info.evsub = sub;
     sla_info.rdata = rdata;
+    sla_info.body  = rdata->msg_info.msg->body;
 	
     /* Call callback */
     if (pjsua_var.ua_cfg.cb.on_sla_info) {
@@ -643,6 +895,37 @@ static void sla_evsub_on_rx_notify(pjsip_evsub *sub,
 }
 
 
+/* Send SLA/BLF subscription refresh, called by the refresh queue */
+static void sla_evsub_send_refresh(pjsip_evsub *sub)
+{
+    pjsip_sla *sla;
+
+    /* The line has been disabled while the refresh was queued */
+    if (pjsip_evsub_get_mod_data(sub, pjsua_var.mod.id) == NULL)
+	return;
+
+    sla = (pjsip_sla*) pjsip_evsub_get_mod_data(sub, mod_sla.id);
+    PJ_ASSERT_ON_FAIL(sla!=NULL, {return;});
+
+    refresh_full_state(sub, sla->type);
+}
+
+/* Callback called when it's time to refresh the subscription */
+static void sla_evsub_on_client_refresh(pjsip_evsub *sub)
+{
+    pjsua_acc *acc;
+    pjsip_sla *sla;
+
+    acc = (pjsua_acc*) pjsip_evsub_get_mod_data(sub, pjsua_var.mod.id);
+    if (!acc)
+	return;
+
+    sla = (pjsip_sla*) pjsip_evsub_get_mod_data(sub, mod_sla.id);
+    PJ_ASSERT_ON_FAIL(sla!=NULL, {return;});
+
+    pjsua_acc_sub_refresh(acc->index, sub, sla->dlg, &sla_evsub_send_refresh);
+}
+
 /* Event subscription callback. */
 static pjsip_evsub_user sla_cb = 
 {
@@ -654,8 +937,8 @@ static pjsip_evsub_user sla_cb =
 	
     &sla_evsub_on_rx_notify,
 	
-    NULL,   /* on_client_refresh: Use default behaviour, which is to 
-			 * refresh client subscription. */
+    &sla_evsub_on_client_refresh, /* on_client_refresh: paced by the
+				   * account */
 	
     NULL,   /* on_server_timeout: Use default behaviour, which is to send 
 			 * NOTIFY to terminate. 
@@ -756,6 +1039,8 @@ void pjsua_start_sla(pjsua_acc *acc, int line)
 		if (*sla_dlg) pjsip_dlg_dec_lock(*sla_dlg);
 		return;
     }
+
+    pjsip_evsub_set_refresh_jitter(*sla_sub, acc->cfg.sub_refresh_jitter);
 	
     /* If account is locked to specific transport, then lock dialog
      * to this transport too.
@@ -853,11 +1138,28 @@ static pj_bool_t unsolicited_sla_on_rx_request(pjsip_rx_data *rdata)
     if (pjsua_var.ua_cfg.cb.on_sla_info) {
 		pjsua_acc_id acc_id;
 		pjsua_sla_info sla_info;
+		pjsip_dialog_info info;
+		pjsip_dialog_info_table table;
 		
 		acc_id = pjsua_acc_find_for_incoming(rdata);
 		
 		pj_bzero(&sla_info, sizeof(sla_info));
 		sla_info.rdata = rdata;
+		sla_info.body  = rdata->msg_info.msg->body;
+
+		/* Unsolicited notification is not tied to any line, so it
+		 * is reported with the state of the document alone.
+		 */
+		if (sla_info.body &&
+		    pjsip_dialog_info_parse(rdata->tp_info.pool, sla_info.body,
+					    &info) == PJ_SUCCESS)
+		{
+		    pj_bzero(&table, sizeof(table));
+		    info.full_state = PJ_TRUE;
+		    pjsip_dialog_info_apply(&table, &info, NULL);
+		    pjsip_dialog_info_get_line_state(&table, &sla_info.state);
+		    sla_info.has_state = PJ_TRUE;
+		}
 		
 		(*pjsua_var.ua_cfg.cb.on_sla_info)(acc_id, &sla_info);
     }
@@ -897,6 +1199,154 @@ static pj_status_t enable_unsolicited_sla(void)
     return status;
 }
 
+/* BLF resource list */
+static void start_blf_list(pjsua_acc *acc)
+{
+    pj_pool_t         *tmp_pool = NULL;
+    pj_str_t          contact;
+    pjsip_tx_data     *tdata;
+    pjsip_dialog      *dlg;
+    pj_status_t       status;
+    pj_bool_t         enabled = PJ_FALSE;
+    int               i;
+
+    for (i = 0; i < PJSUA_MAX_NUMBER_OF_BLF_DEVICES; i++) {
+	if (acc->cfg.blf_enabled[i]) {
+	    enabled = PJ_TRUE;
+	    break;
+	}
+    }
+
+    if (!enabled) {
+	if (acc->blf_list_sub) {
+	    pjsip_evsub *sub = acc->blf_list_sub;
+
+	    /* Detach sub from this account */
+	    acc->blf_list_sub = NULL;
+	    acc->blf_list_dlg = NULL;
+	    pjsip_evsub_set_mod_data(sub, pjsua_var.mod.id, NULL);
+
+	    /* Unsubscribe */
+	    status = pjsip_sla_initiate(sub, 0, &tdata);
+	    if (status == PJ_SUCCESS)
+		pjsip_sla_send_request(sub, tdata);
+	}
+	return;
+    }
+
+    if (acc->blf_list_sub) {
+	/* Subscription is already active, the lines are reported from
+	 * the notifications of the list.
+	 */
+	return;
+    }
+
+    PJ_LOG(4,(THIS_FILE, "BLF Subscribe Local %.*s list %.*s",
+	      (int)acc->cfg.id.slen, acc->cfg.id.ptr,
+	      (int)acc->cfg.blf_list_uri.slen, acc->cfg.blf_list_uri.ptr));
+
+    /* Generate suitable Contact header unless one is already set in
+     * the account
+     */
+    if (acc->contact.slen) {
+	contact = acc->contact;
+    } else {
+	tmp_pool = pjsua_pool_create("tmpblf", 512, 256);
+	status = pjsua_acc_create_uac_contact(tmp_pool, &contact,
+					      acc->index, &acc->cfg.id);
+	if (status != PJ_SUCCESS) {
+	    pjsua_perror(THIS_FILE, "Unable to generate Contact header",
+			 status);
+	    pj_pool_release(tmp_pool);
+	    return;
+	}
+    }
+
+    /* Create UAC dialog */
+    status = pjsip_dlg_create_uac(pjsip_ua_instance(), &acc->cfg.id,
+				  &contact, &acc->cfg.blf_list_uri,
+				  NULL, &acc->blf_list_dlg);
+    if (status != PJ_SUCCESS) {
+	pjsua_perror(THIS_FILE, "Unable to create dialog", status);
+	if (tmp_pool) pj_pool_release(tmp_pool);
+	return;
+    }
+
+    /* Increment the dialog's lock otherwise when subscription creation
+     * fails the dialog will be destroyed prematurely.
+     */
+    dlg = acc->blf_list_dlg;
+    pjsip_dlg_inc_lock(dlg);
+
+    /* Create UAC subscription. The line of list subscription is not
+     * used, the lines are found from the notifications.
+     */
+    status = pjsip_sla_create_uac(dlg, &sla_cb,
+				  PJSIP_EVSUB_NO_EVENT_ID, &acc->blf_list_sub,
+				  -1, PJSIP_SLA_SUBSCRIPTION_TYPE_BLF_LIST);
+    if (status != PJ_SUCCESS) {
+	pjsua_perror(THIS_FILE, "Error creating BLF list subscription",
+		     status);
+	acc->blf_list_dlg = NULL;
+	pjsip_dlg_dec_lock(dlg);
+	if (tmp_pool) pj_pool_release(tmp_pool);
+	return;
+    }
+
+    pjsip_evsub_set_refresh_jitter(acc->blf_list_sub,
+				   acc->cfg.sub_refresh_jitter);
+
+    /* If account is locked to specific transport, then lock dialog
+     * to this transport too.
+     */
+    if (acc->cfg.transport_id != PJSUA_INVALID_ID) {
+	pjsip_tpselector tp_sel;
+
+	pjsua_init_tpselector(acc->cfg.transport_id, &tp_sel);
+	pjsip_dlg_set_transport(dlg, &tp_sel);
+    }
+
+    /* Set route-set */
+    if (!pj_list_empty(&acc->route_set)) {
+	pjsip_dlg_set_route_set(dlg, &acc->route_set);
+    }
+
+    /* Set credentials */
+    if (acc->cred_cnt) {
+	pjsip_auth_clt_set_credentials(&dlg->auth_sess,
+				       acc->cred_cnt, acc->cred);
+    }
+
+    /* Set authentication preference */
+    pjsip_auth_clt_set_prefs(&dlg->auth_sess,
+			     &acc->cfg.auth_pref);
+
+    pjsip_evsub_set_mod_data(acc->blf_list_sub, pjsua_var.mod.id, acc);
+
+    status = pjsip_sla_initiate(acc->blf_list_sub, BLF_DEFAULT_EXPIRES,
+				&tdata);
+    if (status == PJ_SUCCESS) {
+	pjsua_process_msg_data(tdata, NULL);
+	status = pjsip_sla_send_request(acc->blf_list_sub, tdata);
+    }
+    if (status != PJ_SUCCESS) {
+	pjsip_evsub *sub = acc->blf_list_sub;
+
+	acc->blf_list_sub = NULL;
+	acc->blf_list_dlg = NULL;
+	pjsip_evsub_set_mod_data(sub, pjsua_var.mod.id, NULL);
+	pjsip_sla_terminate(sub, PJ_FALSE);
+	pjsip_dlg_dec_lock(dlg);
+	pjsua_perror(THIS_FILE, "Unable to send initial BLF list SUBSCRIBE",
+		     status);
+	if (tmp_pool) pj_pool_release(tmp_pool);
+	return;
+    }
+
+    pjsip_dlg_dec_lock(dlg);
+    if (tmp_pool) pj_pool_release(tmp_pool);
+}
+
 /* BLF  */
 void pjsua_start_blf(pjsua_acc *acc, int line)
 {
@@ -921,6 +1371,12 @@ void pjsua_start_blf(pjsua_acc *acc, int line)
         return;
     }
 
+    /* All lines are monitored with one subscription to the list */
+    if (acc->cfg.blf_list_uri.slen) {
+        start_blf_list(acc);
+        return;
+    }
+
     PJ_LOG(4,(THIS_FILE, "BLF Subscribe Local %s",acc->cfg.id.ptr));
     PJ_LOG(4,(THIS_FILE, "BLF Subscribe Remote %s",remote->ptr));
     if (!sla_enabled) {
@@ -992,6 +1448,8 @@ void pjsua_start_blf(pjsua_acc *acc, int line)
                 return;
     }
 
+    pjsip_evsub_set_refresh_jitter(*sla_sub, acc->cfg.sub_refresh_jitter);
+
     /* If account is locked to specific transport, then lock dialog
      * to this transport too.
      */
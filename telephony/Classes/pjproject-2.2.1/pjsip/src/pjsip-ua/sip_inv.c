@@ -3025,7 +3025,6 @@ static void inv_respond_incoming_cancel(pjsip_inv_session *inv,
     pjsip_tx_data *tdata;
     pjsip_transaction *invite_tsx;
     pjsip_rx_data *rdata;
-    pj_str_t key;
     pj_status_t status;
 
     pj_assert(e->body.tsx_state.type == PJSIP_EVENT_RX_MSG);
@@ -3045,9 +3044,9 @@ static void inv_respond_incoming_cancel(pjsip_inv_session *inv,
 
     /* See if we have matching INVITE server transaction: */
 
-    pjsip_tsx_create_key(rdata->tp_info.pool, &key, PJSIP_ROLE_UAS,
-			 pjsip_get_invite_method(), rdata);
-    invite_tsx = pjsip_tsx_layer_find_tsx(&key, PJ_TRUE);
+    invite_tsx = pjsip_tsx_layer_find_rx_tsx(rdata, PJSIP_ROLE_UAS,
+					     pjsip_get_invite_method(),
+					     PJ_TRUE);
 
     if (invite_tsx == NULL) {
 
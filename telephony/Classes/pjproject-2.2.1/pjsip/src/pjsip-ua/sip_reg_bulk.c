@@ -0,0 +1,1175 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <pjsip-ua/sip_regc_bulk.h>
+#include <pjsip/sip_auth_msg.h>
+#include <pjsip/sip_auth_parser.h>
+#include <pjsip/sip_endpoint.h>
+#include <pjsip/sip_errno.h>
+#include <pjsip/sip_event.h>
+#include <pjsip/sip_parser.h>
+#include <pjsip/sip_transaction.h>
+#include <pjsip/sip_util.h>
+#include <pj/assert.h>
+#include <pj/guid.h>
+#include <pj/lock.h>
+#include <pj/log.h>
+#include <pj/os.h>
+#include <pj/pool.h>
+#include <pj/rand.h>
+#include <pj/string.h>
+
+
+#define THIS_FILE		"sip_reg_bulk.c"
+
+/* Time is kept in ticks of this many milliseconds since creation. */
+#define TICK_MSEC		100
+#define TICKS_PER_SEC		(1000 / TICK_MSEC)
+
+/* Tick value for "not scheduled". */
+#define NEVER			((pj_uint32_t)0xFFFFFFFFUL)
+
+/* Lines that are due within this many ticks are sent together, so the
+ * timer does not fire for every single line.
+ */
+#define DUE_WINDOW		5
+
+/* Maximum number of requests to create before releasing the lock to
+ * send them.
+ */
+#define SEND_BATCH		16
+
+#define PASSWD_MASK		0x000F
+
+/* Line flags */
+enum line_flag
+{
+    LINE_HA1	= 1,	/* Secret is digest (HA1) instead of password	*/
+    LINE_UNREG	= 2,	/* Unregistration is requested			*/
+    LINE_BUSY	= 4,	/* REGISTER transaction is in progress		*/
+    LINE_RETRY	= 8	/* Next request is a retry after 401/407/423	*/
+};
+
+/* Per line state, kept as small as possible. The Call-ID of a line is
+ * derived from its index.
+ */
+typedef struct bulk_line
+{
+    pj_str_t		 user;
+    pj_str_t		 auth_user;
+    pj_str_t		 secret;
+    char		*nonce;		/* Nonce and opaque of the last
+					   challenge			*/
+    pj_uint16_t		 nonce_len;
+    pj_uint16_t		 opaque_len;
+    pj_uint32_t		 nonce_cap;
+    pj_uint32_t		 nc;		/* Nonce count for the nonce	*/
+    void		*user_data;
+    pj_uint32_t		 due;
+    pj_uint32_t		 expires_at;
+    pj_uint32_t		 cseq;
+    pj_uint16_t		 code;
+    pj_uint8_t		 state;
+    pj_uint8_t		 flags;
+} bulk_line;
+
+/* Token of an outstanding REGISTER request. */
+typedef struct bulk_req
+{
+    pjsip_regc_bulk	*bulk;
+    unsigned		 index;
+    pj_bool_t		 unreg;
+    pj_bool_t		 retry;
+    pj_bool_t		 done;
+} bulk_req;
+
+struct pjsip_regc_bulk
+{
+    pj_pool_t			*pool;
+    pjsip_endpoint		*endpt;
+    pj_grp_lock_t		*grp_lock;
+    pj_bool_t			 destroying;
+    pjsip_regc_bulk_param	 param;
+    pj_time_val			 epoch;
+
+    /* Message templates */
+    pjsip_uri			*srv_uri;
+    pj_str_t			 srv_str;
+    pjsip_sip_uri		*aor_uri;
+    pjsip_sip_uri		*contact_uri;
+    pjsip_from_hdr		*from_hdr;
+    pjsip_to_hdr		*to_hdr;
+    pjsip_contact_hdr		*contact_hdr;
+    pj_str_t			 cid_prefix;
+    pj_uint32_t			 expires;
+
+    /* Lines */
+    bulk_line			*lines;
+    unsigned			 max_line;
+    unsigned			 line_cnt;
+    unsigned			 cursor;
+    unsigned			 pending;
+    pj_bool_t			 backlog;
+    pj_bool_t			 in_pump;
+
+    /* The one timer for all lines */
+    pj_timer_entry		 timer;
+    pj_uint32_t			 timer_due;
+
+    /* Shared resolution */
+    pjsip_host_info		 dest;
+    pj_pool_t			*res_pool;
+    pj_bool_t			 resolving;
+    pj_bool_t			 resolve_stale;
+    pj_uint32_t			 resolved_at;
+    pjsip_server_addresses	 addr;
+
+    /* Shared transport */
+    pjsip_transport		*transport;
+
+    /* Shared digest challenge. The nonce and opaque are kept by each
+     * line, since the registrar checks the nonce count per nonce and
+     * requests of different lines may be verified in any order.
+     */
+    pj_pool_t			*chal_pool;
+    pjsip_www_authenticate_hdr	*chal;
+    pj_bool_t			 chal_qop;
+    pj_str_t			 cnonce;
+
+    pjsip_regc_bulk_stat	 stat;
+};
+
+
+static void pump(pjsip_regc_bulk *bulk);
+
+
+PJ_DEF(void) pjsip_regc_bulk_param_default(pjsip_regc_bulk_param *param)
+{
+    pj_bzero(param, sizeof(*param));
+    param->expires = 3600;
+    param->delay_before_refresh = PJSIP_REGISTER_CLIENT_DELAY_BEFORE_REFRESH;
+    param->jitter = PJSIP_REGC_BULK_JITTER;
+    param->max_pending = PJSIP_REGC_BULK_MAX_PENDING;
+    param->retry_interval = PJSIP_REGC_BULK_RETRY_INTERVAL;
+    param->resolve_interval = 300;
+}
+
+
+static pj_uint32_t now_tick(const pjsip_regc_bulk *bulk)
+{
+    pj_time_val now;
+
+    pj_gettickcount(&now);
+    PJ_TIME_VAL_SUB(now, bulk->epoch);
+    return (pj_uint32_t)(PJ_TIME_VAL_MSEC(now) / TICK_MSEC);
+}
+
+/* Random value between zero and max, inclusive. */
+static unsigned rand_upto(unsigned max)
+{
+    return max ? (unsigned)pj_rand() % (max + 1) : 0;
+}
+
+/* Ticks until a registration with the specified expiration is to be
+ * refreshed.
+ */
+static pj_uint32_t refresh_ticks(const pjsip_regc_bulk *bulk, unsigned exp)
+{
+    pj_uint32_t ticks;
+
+    if (exp > bulk->param.delay_before_refresh)
+	ticks = (exp - bulk->param.delay_before_refresh) * TICKS_PER_SEC;
+    else
+	ticks = exp * TICKS_PER_SEC / 2;
+
+    ticks -= rand_upto(ticks / 100 * bulk->param.jitter);
+    return ticks < TICKS_PER_SEC ? TICKS_PER_SEC : ticks;
+}
+
+/* Ticks until a failed registration is to be retried. */
+static pj_uint32_t retry_ticks(const pjsip_regc_bulk *bulk,
+			       const pjsip_rx_data *rdata)
+{
+    pj_uint32_t ticks = bulk->param.retry_interval * TICKS_PER_SEC;
+
+    ticks -= rand_upto(ticks / 100 * bulk->param.jitter);
+
+    if (rdata) {
+	const pjsip_retry_after_hdr *hra;
+
+	hra = (const pjsip_retry_after_hdr*)
+	      pjsip_msg_find_hdr(rdata->msg_info.msg, PJSIP_H_RETRY_AFTER,
+				 NULL);
+	if (hra && hra->ivalue * TICKS_PER_SEC > ticks)
+	    ticks = hra->ivalue * TICKS_PER_SEC;
+    }
+
+    return ticks < TICKS_PER_SEC ? TICKS_PER_SEC : ticks;
+}
+
+
+static void on_timer(pj_timer_heap_t *timer_heap, pj_timer_entry *entry)
+{
+    pjsip_regc_bulk *bulk = (pjsip_regc_bulk*) entry->user_data;
+
+    PJ_UNUSED_ARG(timer_heap);
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+    bulk->timer_due = NEVER;
+    pump(bulk);
+    pj_grp_lock_release(bulk->grp_lock);
+
+    pj_grp_lock_dec_ref(bulk->grp_lock);
+}
+
+/* Make sure the timer fires not later than the specified tick. The timer
+ * holds a reference to the group lock while it is scheduled.
+ */
+static void arm_timer(pjsip_regc_bulk *bulk, pj_uint32_t due)
+{
+    pj_uint32_t now, ticks;
+    pj_time_val delay;
+
+    if (due == NEVER || bulk->destroying)
+	return;
+
+    if (bulk->timer_due != NEVER) {
+	if (bulk->timer_due <= due)
+	    return;
+
+	/* If the timer has just fired, its callback will reschedule */
+	if (pj_timer_heap_cancel_if_active(
+		pjsip_endpt_get_timer_heap(bulk->endpt), &bulk->timer, 0) < 1)
+	{
+	    return;
+	}
+	bulk->timer_due = NEVER;
+	pj_grp_lock_dec_ref(bulk->grp_lock);
+    }
+
+    now = now_tick(bulk);
+    ticks = (due > now) ? due - now : 0;
+    delay.sec = ticks / TICKS_PER_SEC;
+    delay.msec = (ticks % TICKS_PER_SEC) * TICK_MSEC;
+
+    pj_grp_lock_add_ref(bulk->grp_lock);
+    bulk->timer.id = 1;
+    if (pjsip_endpt_schedule_timer(bulk->endpt, &bulk->timer,
+				   &delay) != PJ_SUCCESS)
+    {
+	bulk->timer.id = 0;
+	pj_grp_lock_dec_ref(bulk->grp_lock);
+	return;
+    }
+    bulk->timer_due = due;
+}
+
+
+static void on_resolved(pj_status_t status, void *token,
+			const struct pjsip_server_addresses *addr)
+{
+    pjsip_regc_bulk *bulk = (pjsip_regc_bulk*) token;
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+
+    bulk->resolving = PJ_FALSE;
+    bulk->resolved_at = now_tick(bulk);
+
+    if (status == PJ_SUCCESS && addr->count) {
+	pj_memcpy(&bulk->addr, addr, sizeof(*addr));
+    } else {
+	/* Let each request resolve the registrar and fail on its own
+	 * until the next attempt, so the lines learn about the failure.
+	 */
+	bulk->addr.count = 0;
+	PJ_PERROR(3,(THIS_FILE, status, "Unable to resolve %.*s",
+		     (int)bulk->dest.addr.host.slen,
+		     bulk->dest.addr.host.ptr));
+    }
+
+    pump(bulk);
+    pj_grp_lock_release(bulk->grp_lock);
+
+    pj_grp_lock_dec_ref(bulk->grp_lock);
+}
+
+static void start_resolve(pjsip_regc_bulk *bulk)
+{
+    bulk->resolving = PJ_TRUE;
+    bulk->resolve_stale = PJ_FALSE;
+    ++bulk->stat.resolved;
+
+    pj_pool_reset(bulk->res_pool);
+    pj_grp_lock_add_ref(bulk->grp_lock);
+    pjsip_endpt_resolve(bulk->endpt, bulk->res_pool, &bulk->dest, bulk,
+			&on_resolved);
+}
+
+
+/* Remember the digest challenge of the registrar, and the nonce and
+ * opaque of the challenge for the line.
+ */
+static void update_challenge(pjsip_regc_bulk *bulk, bulk_line *line,
+			     const pjsip_rx_data *rdata)
+{
+    const pjsip_hdr *hdr = rdata->msg_info.msg->hdr.next;
+    const pjsip_www_authenticate_hdr *hchal = NULL;
+    const pjsip_digest_challenge *d;
+
+    for (; hdr != &rdata->msg_info.msg->hdr; hdr = hdr->next) {
+	if (hdr->type != PJSIP_H_WWW_AUTHENTICATE &&
+	    hdr->type != PJSIP_H_PROXY_AUTHENTICATE)
+	{
+	    continue;
+	}
+	hchal = (const pjsip_www_authenticate_hdr*) hdr;
+	if (pj_stricmp(&hchal->scheme, &pjsip_DIGEST_STR) == 0)
+	    break;
+	hchal = NULL;
+    }
+
+    if (hchal == NULL)
+	return;
+
+    d = &hchal->challenge.digest;
+    line->nonce_len = 0;
+
+    /* Only MD5 with or without qop=auth is supported */
+    if ((d->algorithm.slen && pj_stricmp(&d->algorithm, &pjsip_MD5_STR)) ||
+	(d->qop.slen && pj_strstr(&d->qop, &pjsip_AUTH_STR) == NULL) ||
+	d->nonce.slen == 0 || d->nonce.slen > 0xFFFF || d->opaque.slen > 0xFFFF)
+    {
+	return;
+    }
+
+    /* The buffer of the line is only reallocated when the nonce gets
+     * longer, which normally happens only once.
+     */
+    if ((pj_uint32_t)(d->nonce.slen + d->opaque.slen) > line->nonce_cap) {
+	line->nonce_cap = (pj_uint32_t)(d->nonce.slen + d->opaque.slen);
+	line->nonce = (char*) pj_pool_alloc(bulk->pool, line->nonce_cap);
+    }
+    pj_memcpy(line->nonce, d->nonce.ptr, d->nonce.slen);
+    pj_memcpy(line->nonce + d->nonce.slen, d->opaque.ptr, d->opaque.slen);
+    line->nonce_len = (pj_uint16_t)d->nonce.slen;
+    line->opaque_len = (pj_uint16_t)d->opaque.slen;
+    line->nc = 0;
+
+    /* Keep the rest of the challenge, unless it hasn't changed */
+    if (bulk->chal && bulk->chal->type == hchal->type &&
+	pj_strcmp(&bulk->chal->challenge.digest.realm, &d->realm) == 0 &&
+	pj_strcmp(&bulk->chal->challenge.digest.qop, &d->qop) == 0)
+    {
+	return;
+    }
+
+    pj_pool_reset(bulk->chal_pool);
+    bulk->chal = (pjsip_www_authenticate_hdr*)
+		 pjsip_hdr_clone(bulk->chal_pool, hchal);
+    bulk->chal_qop = (d->qop.slen != 0);
+    pj_create_unique_string(bulk->chal_pool, &bulk->cnonce);
+}
+
+/* Authorize the request with the challenge of the registrar and the
+ * nonce of the line.
+ */
+static void add_authorization(pjsip_regc_bulk *bulk, bulk_line *line,
+			      pjsip_tx_data *tdata)
+{
+    pj_str_t nonce, opaque;
+    const pjsip_digest_challenge *chal = &bulk->chal->challenge.digest;
+    pjsip_authorization_hdr *hauth;
+    pjsip_digest_credential *d;
+    pjsip_cred_info cred;
+
+    if (bulk->chal->type == PJSIP_H_PROXY_AUTHENTICATE)
+	hauth = pjsip_proxy_authorization_hdr_create(tdata->pool);
+    else
+	hauth = pjsip_authorization_hdr_create(tdata->pool);
+
+    hauth->scheme = pjsip_DIGEST_STR;
+    d = &hauth->credential.digest;
+    pj_strdup(tdata->pool, &d->realm, &chal->realm);
+    pj_strdup(tdata->pool, &d->username, &line->auth_user);
+    nonce.ptr = line->nonce;
+    nonce.slen = line->nonce_len;
+    pj_strdup(tdata->pool, &d->nonce, &nonce);
+    opaque.ptr = line->nonce + line->nonce_len;
+    opaque.slen = line->opaque_len;
+    pj_strdup(tdata->pool, &d->opaque, &opaque);
+    pj_strdup(tdata->pool, &d->uri, &bulk->srv_str);
+    d->algorithm = pjsip_MD5_STR;
+
+    if (bulk->chal_qop) {
+	d->qop = pjsip_AUTH_STR;
+	pj_strdup(tdata->pool, &d->cnonce, &bulk->cnonce);
+	d->nc.ptr = (char*) pj_pool_alloc(tdata->pool, 16);
+	d->nc.slen = pj_ansi_snprintf(d->nc.ptr, 16, "%08x", ++line->nc);
+    }
+
+    pj_bzero(&cred, sizeof(cred));
+    cred.username = line->auth_user;
+    cred.data = line->secret;
+    cred.data_type = (line->flags & LINE_HA1) ? PJSIP_CRED_DATA_DIGEST :
+						PJSIP_CRED_DATA_PLAIN_PASSWD;
+
+    d->response.ptr = (char*) pj_pool_alloc(tdata->pool, PJSIP_MD5STRLEN);
+    d->response.slen = PJSIP_MD5STRLEN;
+    pjsip_auth_create_digest(&d->response, &d->nonce, &d->nc, &d->cnonce,
+			     &d->qop, &d->uri, &d->realm, &cred,
+			     &pjsip_get_register_method()->name);
+
+    pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)hauth);
+}
+
+/* Create REGISTER request for a line. Called with the lock held. */
+static pj_status_t create_request(pjsip_regc_bulk *bulk, unsigned index,
+				  pj_bool_t unreg, pjsip_tx_data **p_tdata)
+{
+    bulk_line *line = &bulk->lines[index];
+    pjsip_cid_hdr cid;
+    char cid_buf[PJ_GUID_MAX_LENGTH + 16];
+    pjsip_tx_data *tdata;
+    pjsip_expires_hdr *hexp;
+    pj_status_t status;
+
+    pj_bzero(&cid, sizeof(cid));
+    cid.id.ptr = cid_buf;
+    cid.id.slen = pj_ansi_snprintf(cid_buf, sizeof(cid_buf), "%.*s-%u",
+				   (int)bulk->cid_prefix.slen,
+				   bulk->cid_prefix.ptr, index);
+
+    /* The templates are cloned into the request */
+    bulk->aor_uri->user = line->user;
+    bulk->contact_uri->user = line->user;
+
+    status = pjsip_endpt_create_request_from_hdr(bulk->endpt,
+						 pjsip_get_register_method(),
+						 bulk->srv_uri,
+						 bulk->from_hdr,
+						 bulk->to_hdr,
+						 bulk->contact_hdr,
+						 &cid, ++line->cseq,
+						 NULL, &tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    hexp = pjsip_expires_hdr_create(tdata->pool, unreg ? 0 : bulk->expires);
+    pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)hexp);
+
+    if (bulk->chal && line->auth_user.slen && line->nonce_len)
+	add_authorization(bulk, line, tdata);
+
+    /* Skip resolution */
+    if (bulk->addr.count) {
+	pj_memcpy(&tdata->dest_info.addr, &bulk->addr, sizeof(bulk->addr));
+	pj_strdup(tdata->pool, &tdata->dest_info.name, &bulk->dest.addr.host);
+    }
+
+    if (bulk->param.tp_sel.type != PJSIP_TPSELECTOR_NONE) {
+	pjsip_tx_data_set_transport(tdata, &bulk->param.tp_sel);
+    } else if (bulk->transport) {
+	pjsip_tpselector sel;
+
+	pj_bzero(&sel, sizeof(sel));
+	sel.type = PJSIP_TPSELECTOR_TRANSPORT;
+	sel.u.transport = bulk->transport;
+	pjsip_tx_data_set_transport(tdata, &sel);
+    }
+
+    *p_tdata = tdata;
+    return PJ_SUCCESS;
+}
+
+
+static void on_reg_complete(void *token, pjsip_event *event);
+
+/* Handle the result of a REGISTER request. */
+static void complete_request(bulk_req *req, pj_status_t status, int code,
+			     pjsip_rx_data *rdata, pjsip_transport *tp)
+{
+    pjsip_regc_bulk *bulk = req->bulk;
+    pjsip_regc_bulk_on_state *on_state;
+    pjsip_regc_bulk_cbparam prm;
+    bulk_line *line;
+    pj_uint32_t now;
+    pj_bool_t retry = PJ_FALSE;
+
+    req->done = PJ_TRUE;
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+
+    --bulk->pending;
+    if (bulk->destroying) {
+	pj_grp_lock_release(bulk->grp_lock);
+	pj_grp_lock_dec_ref(bulk->grp_lock);
+	return;
+    }
+
+    line = &bulk->lines[req->index];
+    line->flags &= ~(LINE_BUSY | LINE_RETRY);
+    line->code = (pj_uint16_t)code;
+    now = now_tick(bulk);
+
+    if ((code == PJSIP_SC_UNAUTHORIZED ||
+	 code == PJSIP_SC_PROXY_AUTHENTICATION_REQUIRED) && rdata)
+    {
+	++bulk->stat.challenged;
+	update_challenge(bulk, line, rdata);
+	retry = !req->retry && bulk->chal && line->auth_user.slen &&
+		line->nonce_len;
+
+    } else if (code == PJSIP_SC_INTERVAL_TOO_BRIEF && rdata && !req->unreg) {
+	const pjsip_min_expires_hdr *hme;
+
+	hme = (const pjsip_min_expires_hdr*)
+	      pjsip_msg_find_hdr(rdata->msg_info.msg, PJSIP_H_MIN_EXPIRES,
+				 NULL);
+	if (hme && hme->ivalue > bulk->expires) {
+	    bulk->expires = hme->ivalue;
+	    retry = !req->retry;
+	}
+    }
+
+    if (retry) {
+	line->flags |= LINE_RETRY;
+	line->due = now;
+	arm_timer(bulk, now);
+	pump(bulk);
+	pj_grp_lock_release(bulk->grp_lock);
+	pj_grp_lock_dec_ref(bulk->grp_lock);
+	return;
+    }
+
+    prm.expiration = 0;
+
+    if (req->unreg) {
+	/* Stop refreshing, whether or not it was successful */
+	line->flags &= ~LINE_UNREG;
+	line->state = PJSIP_REGC_BULK_IDLE;
+	line->due = NEVER;
+	if (code/100 == 2)
+	    line->expires_at = 0;
+
+    } else if (code/100 == 2 && rdata) {
+	const pjsip_msg *msg = rdata->msg_info.msg;
+	const pjsip_hdr *hdr;
+	const pjsip_expires_hdr *hexp;
+	pj_int32_t exp = -1;
+
+	/* Find our Contact in the response to get the expiration */
+	for (hdr=msg->hdr.next; hdr!=&msg->hdr; hdr=hdr->next) {
+	    const pjsip_contact_hdr *hc = (const pjsip_contact_hdr*)hdr;
+	    const pjsip_sip_uri *uri;
+
+	    if (hdr->type != PJSIP_H_CONTACT || hc->star ||
+		hc->expires < 0 ||
+		(!PJSIP_URI_SCHEME_IS_SIP(hc->uri) &&
+		 !PJSIP_URI_SCHEME_IS_SIPS(hc->uri)))
+	    {
+		continue;
+	    }
+
+	    uri = (const pjsip_sip_uri*) pjsip_uri_get_uri(hc->uri);
+	    if (pj_strcmp(&uri->user, &line->user) == 0 &&
+		pj_stricmp(&uri->host, &bulk->contact_uri->host) == 0 &&
+		uri->port == bulk->contact_uri->port)
+	    {
+		exp = hc->expires;
+		break;
+	    }
+	}
+
+	if (exp < 0) {
+	    hexp = (const pjsip_expires_hdr*)
+		   pjsip_msg_find_hdr(msg, PJSIP_H_EXPIRES, NULL);
+	    exp = hexp ? hexp->ivalue : (pj_int32_t)bulk->expires;
+	}
+
+	line->state = PJSIP_REGC_BULK_REGISTERED;
+	line->expires_at = now + exp * TICKS_PER_SEC;
+	line->due = now + refresh_ticks(bulk, exp);
+	prm.expiration = exp;
+
+	/* Keep the transport that works */
+	if (tp && tp != bulk->transport &&
+	    bulk->param.tp_sel.type == PJSIP_TPSELECTOR_NONE)
+	{
+	    if (bulk->transport)
+		pjsip_transport_dec_ref(bulk->transport);
+	    bulk->transport = tp;
+	    pjsip_transport_add_ref(tp);
+	}
+
+    } else {
+	line->state = PJSIP_REGC_BULK_FAILED;
+	line->due = now + retry_ticks(bulk, rdata);
+
+	/* No response at all, the registrar may have moved */
+	if (!rdata) {
+	    if (bulk->transport) {
+		pjsip_transport_dec_ref(bulk->transport);
+		bulk->transport = NULL;
+	    }
+	    bulk->resolve_stale = PJ_TRUE;
+	}
+    }
+
+    /* Unregistration was requested while this request was in progress */
+    if ((line->flags & LINE_UNREG) && !req->unreg) {
+	if (line->state == PJSIP_REGC_BULK_REGISTERED) {
+	    line->state = PJSIP_REGC_BULK_UNREGISTERING;
+	    line->due = now;
+	} else {
+	    line->flags &= ~LINE_UNREG;
+	    line->state = PJSIP_REGC_BULK_IDLE;
+	    line->due = NEVER;
+	}
+    }
+
+    arm_timer(bulk, line->due);
+
+    prm.bulk = bulk;
+    prm.index = req->index;
+    prm.user_data = line->user_data;
+    prm.state = (pjsip_regc_bulk_state) line->state;
+    prm.status = status;
+    prm.code = code;
+    on_state = bulk->param.on_state;
+
+    if (bulk->backlog || line->due <= now) {
+	bulk->backlog = PJ_FALSE;
+	pump(bulk);
+    }
+
+    pj_grp_lock_release(bulk->grp_lock);
+
+    if (on_state)
+	(*on_state)(&prm);
+
+    pj_grp_lock_dec_ref(bulk->grp_lock);
+}
+
+static void on_reg_complete(void *token, pjsip_event *event)
+{
+    bulk_req *req = (bulk_req*) token;
+    pjsip_transaction *tsx = event->body.tsx_state.tsx;
+    pjsip_rx_data *rdata = NULL;
+    pj_status_t status = PJ_SUCCESS;
+
+    if (event->body.tsx_state.type == PJSIP_EVENT_RX_MSG)
+	rdata = event->body.tsx_state.src.rdata;
+    else if (tsx->transport_err != PJ_SUCCESS)
+	status = tsx->transport_err;
+    else
+	status = PJSIP_ERRNO_FROM_SIP_STATUS(tsx->status_code);
+
+    complete_request(req, status, tsx->status_code, rdata, tsx->transport);
+}
+
+
+/* Send the REGISTER requests that are due, as far as max_pending allows,
+ * and schedule the timer for the next one. Called with the lock held;
+ * the lock is released while sending.
+ */
+static void pump(pjsip_regc_bulk *bulk)
+{
+    unsigned scanned = 0;
+    pj_uint32_t next = NEVER;
+
+    if (bulk->in_pump || bulk->destroying || bulk->line_cnt == 0)
+	return;
+
+    bulk->in_pump = PJ_TRUE;
+
+    for (;;) {
+	pjsip_tx_data *tdata[SEND_BATCH];
+	bulk_req *req[SEND_BATCH];
+	unsigned i, cnt = 0;
+	pj_uint32_t now = now_tick(bulk);
+
+	if (!bulk->resolving &&
+	    (bulk->resolve_stale ||
+	     now - bulk->resolved_at >=
+		bulk->param.resolve_interval * TICKS_PER_SEC))
+	{
+	    start_resolve(bulk);
+	}
+	if (bulk->resolving || bulk->destroying)
+	    break;
+
+	while (scanned < bulk->line_cnt && cnt < SEND_BATCH) {
+	    unsigned index = bulk->cursor;
+	    bulk_line *line = &bulk->lines[index];
+	    pj_bool_t unreg;
+	    pj_status_t status;
+
+	    if (line->due == NEVER || (line->flags & LINE_BUSY)) {
+		bulk->cursor = (index + 1) % bulk->line_cnt;
+		++scanned;
+		continue;
+	    }
+	    if (line->due > now + DUE_WINDOW) {
+		if (line->due < next)
+		    next = line->due;
+		bulk->cursor = (index + 1) % bulk->line_cnt;
+		++scanned;
+		continue;
+	    }
+
+	    if (bulk->pending >= bulk->param.max_pending) {
+		bulk->backlog = PJ_TRUE;
+		break;
+	    }
+
+	    bulk->cursor = (index + 1) % bulk->line_cnt;
+	    ++scanned;
+
+	    unreg = (line->flags & LINE_UNREG) != 0;
+	    status = create_request(bulk, index, unreg, &tdata[cnt]);
+	    if (status != PJ_SUCCESS) {
+		PJ_PERROR(2,(THIS_FILE, status,
+			     "Unable to create REGISTER for %.*s",
+			     (int)line->user.slen, line->user.ptr));
+		line->due = now + retry_ticks(bulk, NULL);
+		if (line->due < next)
+		    next = line->due;
+		continue;
+	    }
+
+	    req[cnt] = PJ_POOL_ZALLOC_T(tdata[cnt]->pool, bulk_req);
+	    req[cnt]->bulk = bulk;
+	    req[cnt]->index = index;
+	    req[cnt]->unreg = unreg;
+	    req[cnt]->retry = (line->flags & LINE_RETRY) != 0;
+
+	    line->flags |= LINE_BUSY;
+	    line->due = NEVER;
+	    line->state = (pj_uint8_t)(unreg ? PJSIP_REGC_BULK_UNREGISTERING :
+					       PJSIP_REGC_BULK_REGISTERING);
+	    ++bulk->pending;
+	    ++bulk->stat.requests;
+	    pj_grp_lock_add_ref(bulk->grp_lock);
+	    ++cnt;
+	}
+
+	if (cnt == 0)
+	    break;
+
+	/* Send without holding the lock, the result may come right away */
+	pj_grp_lock_release(bulk->grp_lock);
+
+	for (i=0; i<cnt; ++i) {
+	    pj_status_t status;
+
+	    pjsip_tx_data_add_ref(tdata[i]);
+	    status = pjsip_endpt_send_request(bulk->endpt, tdata[i], -1,
+					      req[i], &on_reg_complete);
+	    if (status != PJ_SUCCESS && !req[i]->done) {
+		complete_request(req[i], status,
+				 PJSIP_SC_SERVICE_UNAVAILABLE, NULL, NULL);
+	    }
+	    pjsip_tx_data_dec_ref(tdata[i]);
+	}
+
+	pj_grp_lock_acquire(bulk->grp_lock);
+    }
+
+    bulk->in_pump = PJ_FALSE;
+
+    if (scanned >= bulk->line_cnt)
+	arm_timer(bulk, next);
+}
+
+
+static void bulk_on_destroy(void *arg)
+{
+    pjsip_regc_bulk *bulk = (pjsip_regc_bulk*) arg;
+
+    PJ_LOG(5,(THIS_FILE, "Bulk registration client %p destroyed", bulk));
+
+    if (bulk->transport) {
+	pjsip_transport_dec_ref(bulk->transport);
+	bulk->transport = NULL;
+    }
+    pj_pool_release(bulk->chal_pool);
+    pj_pool_release(bulk->res_pool);
+    pj_pool_release(bulk->pool);
+}
+
+
+PJ_DEF(pj_status_t) pjsip_regc_bulk_create(pjsip_endpoint *endpt,
+					   const pjsip_regc_bulk_param *param,
+					   unsigned max_line,
+					   pjsip_regc_bulk **p_bulk)
+{
+    pj_pool_t *pool;
+    pjsip_regc_bulk *bulk;
+    pjsip_name_addr *aor, *contact;
+    pjsip_tx_data *tdata;
+    pj_str_t tmp;
+    char *buf;
+    int len;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(endpt && param && max_line && p_bulk, PJ_EINVAL);
+    PJ_ASSERT_RETURN(param->registrar.slen && param->contact_host.slen &&
+		     param->expires && param->max_pending, PJ_EINVAL);
+
+    pool = pjsip_endpt_create_pool(endpt, "regcb%p", 1024, 1024);
+    PJ_ASSERT_RETURN(pool != NULL, PJ_ENOMEM);
+
+    bulk = PJ_POOL_ZALLOC_T(pool, pjsip_regc_bulk);
+    bulk->pool = pool;
+    bulk->endpt = endpt;
+    pj_memcpy(&bulk->param, param, sizeof(*param));
+    pj_strdup_with_null(pool, &bulk->param.registrar, &param->registrar);
+    pj_strdup(pool, &bulk->param.domain, &param->domain);
+    pj_strdup(pool, &bulk->param.contact_host, &param->contact_host);
+    bulk->expires = param->expires;
+    bulk->timer_due = NEVER;
+    bulk->resolve_stale = PJ_TRUE;
+    pj_gettickcount(&bulk->epoch);
+    pj_timer_entry_init(&bulk->timer, 0, bulk, &on_timer);
+
+    bulk->lines = (bulk_line*) pj_pool_calloc(pool, max_line,
+					      sizeof(bulk_line));
+    bulk->max_line = max_line;
+
+    /* Registrar URI */
+    bulk->srv_uri = pjsip_parse_uri(pool, bulk->param.registrar.ptr,
+				    bulk->param.registrar.slen, 0);
+    if (bulk->srv_uri == NULL ||
+	(!PJSIP_URI_SCHEME_IS_SIP(bulk->srv_uri) &&
+	 !PJSIP_URI_SCHEME_IS_SIPS(bulk->srv_uri)))
+    {
+	status = PJSIP_EINVALIDURI;
+	goto on_error;
+    }
+
+    buf = (char*) pj_pool_alloc(pool, PJSIP_MAX_URL_SIZE);
+    len = pjsip_uri_print(PJSIP_URI_IN_REQ_URI, bulk->srv_uri, buf,
+			  PJSIP_MAX_URL_SIZE);
+    if (len < 1) {
+	status = PJSIP_EURITOOLONG;
+	goto on_error;
+    }
+    bulk->srv_str.ptr = buf;
+    bulk->srv_str.slen = len;
+
+    /* AOR template */
+    bulk->aor_uri = pjsip_sip_uri_create(pool, PJSIP_URI_SCHEME_IS_SIPS(
+							    bulk->srv_uri));
+    if (bulk->param.domain.slen) {
+	bulk->aor_uri->host = bulk->param.domain;
+    } else {
+	pjsip_sip_uri *srv = (pjsip_sip_uri*)
+			     pjsip_uri_get_uri(bulk->srv_uri);
+	bulk->aor_uri->host = srv->host;
+	bulk->aor_uri->port = srv->port;
+    }
+    aor = pjsip_name_addr_create(pool);
+    aor->uri = (pjsip_uri*) bulk->aor_uri;
+    bulk->from_hdr = pjsip_from_hdr_create(pool);
+    bulk->from_hdr->uri = (pjsip_uri*) aor;
+    bulk->to_hdr = pjsip_to_hdr_create(pool);
+    bulk->to_hdr->uri = (pjsip_uri*) aor;
+
+    /* Contact template, parsed from "sip:x@CONTACT_HOST" */
+    tmp.ptr = (char*) pj_pool_alloc(pool, param->contact_host.slen + 16);
+    tmp.slen = pj_ansi_snprintf(tmp.ptr, param->contact_host.slen + 16,
+				"%s:x@%.*s",
+				PJSIP_URI_SCHEME_IS_SIPS(bulk->srv_uri) ?
+				    "sips" : "sip",
+				(int)param->contact_host.slen,
+				param->contact_host.ptr);
+    contact = (pjsip_name_addr*) pjsip_parse_uri(pool, tmp.ptr, tmp.slen,
+						 PJSIP_PARSE_URI_AS_NAMEADDR);
+    if (contact == NULL) {
+	status = PJSIP_EINVALIDURI;
+	goto on_error;
+    }
+    bulk->contact_uri = (pjsip_sip_uri*) contact->uri;
+    bulk->contact_hdr = pjsip_contact_hdr_create(pool);
+    bulk->contact_hdr->uri = (pjsip_uri*) contact;
+
+    pj_create_unique_string(pool, &bulk->cid_prefix);
+
+    /* Get the destination host from a sample request */
+    bulk->aor_uri->user = pj_str("x");
+    status = pjsip_endpt_create_request_from_hdr(endpt,
+						 pjsip_get_register_method(),
+						 bulk->srv_uri, bulk->from_hdr,
+						 bulk->to_hdr, NULL, NULL, 1,
+						 NULL, &tdata);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+    status = pjsip_get_request_dest(tdata, &bulk->dest);
+    if (status == PJ_SUCCESS)
+	pj_strdup(pool, &bulk->dest.addr.host, &bulk->dest.addr.host);
+    pjsip_tx_data_dec_ref(tdata);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    bulk->res_pool = pjsip_endpt_create_pool(endpt, "regcbr%p", 512, 512);
+    bulk->chal_pool = pjsip_endpt_create_pool(endpt, "regcbc%p", 512, 512);
+    if (!bulk->res_pool || !bulk->chal_pool) {
+	status = PJ_ENOMEM;
+	goto on_error;
+    }
+
+    status = pj_grp_lock_create(pool, NULL, &bulk->grp_lock);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    pj_grp_lock_add_ref(bulk->grp_lock);
+    pj_grp_lock_add_handler(bulk->grp_lock, pool, bulk, &bulk_on_destroy);
+
+    PJ_LOG(5,(THIS_FILE, "Bulk registration client %p created for %.*s, "
+			 "max %u lines", bulk,
+	      (int)bulk->srv_str.slen, bulk->srv_str.ptr, max_line));
+
+    *p_bulk = bulk;
+    return PJ_SUCCESS;
+
+on_error:
+    if (bulk->chal_pool)
+	pj_pool_release(bulk->chal_pool);
+    if (bulk->res_pool)
+	pj_pool_release(bulk->res_pool);
+    pj_pool_release(pool);
+    return status;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_regc_bulk_destroy(pjsip_regc_bulk *bulk)
+{
+    PJ_ASSERT_RETURN(bulk, PJ_EINVAL);
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+    if (bulk->destroying) {
+	pj_grp_lock_release(bulk->grp_lock);
+	return PJ_SUCCESS;
+    }
+    bulk->destroying = PJ_TRUE;
+
+    if (bulk->timer_due != NEVER &&
+	pj_timer_heap_cancel_if_active(pjsip_endpt_get_timer_heap(bulk->endpt),
+				       &bulk->timer, 0) > 0)
+    {
+	pj_grp_lock_dec_ref(bulk->grp_lock);
+    }
+    bulk->timer_due = NEVER;
+    pj_grp_lock_release(bulk->grp_lock);
+
+    pj_grp_lock_dec_ref(bulk->grp_lock);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(void*) pjsip_regc_bulk_get_user_data(pjsip_regc_bulk *bulk)
+{
+    PJ_ASSERT_RETURN(bulk, NULL);
+    return bulk->param.user_data;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_regc_bulk_add(pjsip_regc_bulk *bulk,
+					const pj_str_t *user,
+					const pjsip_cred_info *cred,
+					void *user_data,
+					unsigned *p_index)
+{
+    bulk_line *line;
+
+    PJ_ASSERT_RETURN(bulk && user && user->slen, PJ_EINVAL);
+    PJ_ASSERT_RETURN(!cred ||
+		     (cred->data_type & PASSWD_MASK) == PJSIP_CRED_DATA_PLAIN_PASSWD ||
+		     (cred->data_type & PASSWD_MASK) == PJSIP_CRED_DATA_DIGEST,
+		     PJ_EINVAL);
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+
+    if (bulk->line_cnt == bulk->max_line) {
+	pj_grp_lock_release(bulk->grp_lock);
+	return PJ_ETOOMANY;
+    }
+
+    line = &bulk->lines[bulk->line_cnt];
+    pj_strdup(bulk->pool, &line->user, user);
+    if (cred) {
+	if (pj_strcmp(&cred->username, user) == 0)
+	    line->auth_user = line->user;
+	else
+	    pj_strdup(bulk->pool, &line->auth_user, &cred->username);
+	pj_strdup(bulk->pool, &line->secret, &cred->data);
+	if ((cred->data_type & PASSWD_MASK) == PJSIP_CRED_DATA_DIGEST)
+	    line->flags |= LINE_HA1;
+    }
+    line->user_data = user_data;
+    line->due = NEVER;
+    line->state = PJSIP_REGC_BULK_IDLE;
+
+    if (p_index)
+	*p_index = bulk->line_cnt;
+    ++bulk->line_cnt;
+
+    pj_grp_lock_release(bulk->grp_lock);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_regc_bulk_start(pjsip_regc_bulk *bulk,
+					  unsigned spread)
+{
+    unsigned i;
+    pj_uint32_t now, first = NEVER;
+
+    PJ_ASSERT_RETURN(bulk, PJ_EINVAL);
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+
+    now = now_tick(bulk);
+    for (i=0; i<bulk->line_cnt; ++i) {
+	bulk_line *line = &bulk->lines[i];
+
+	if (line->state != PJSIP_REGC_BULK_IDLE || (line->flags & LINE_BUSY))
+	    continue;
+
+	line->state = PJSIP_REGC_BULK_WAITING;
+	line->due = now + rand_upto(spread / TICK_MSEC);
+	if (line->due < first)
+	    first = line->due;
+    }
+
+    arm_timer(bulk, first);
+    pump(bulk);
+
+    pj_grp_lock_release(bulk->grp_lock);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_regc_bulk_unregister(pjsip_regc_bulk *bulk,
+					       int index)
+{
+    unsigned i, start, end;
+    pj_uint32_t now;
+
+    PJ_ASSERT_RETURN(bulk, PJ_EINVAL);
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+
+    if (index < 0) {
+	start = 0;
+	end = bulk->line_cnt;
+    } else if ((unsigned)index < bulk->line_cnt) {
+	start = index;
+	end = index + 1;
+    } else {
+	pj_grp_lock_release(bulk->grp_lock);
+	return PJ_EINVAL;
+    }
+
+    now = now_tick(bulk);
+    for (i=start; i<end; ++i) {
+	bulk_line *line = &bulk->lines[i];
+
+	if (line->flags & LINE_BUSY) {
+	    /* Handled when the request completes */
+	    line->flags |= LINE_UNREG;
+	} else if (line->expires_at > now) {
+	    line->flags |= LINE_UNREG;
+	    line->flags &= ~LINE_RETRY;
+	    line->state = PJSIP_REGC_BULK_UNREGISTERING;
+	    line->due = now;
+	} else {
+	    line->flags &= ~LINE_RETRY;
+	    line->state = PJSIP_REGC_BULK_IDLE;
+	    line->due = NEVER;
+	}
+    }
+
+    pump(bulk);
+
+    pj_grp_lock_release(bulk->grp_lock);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_regc_bulk_get_info(pjsip_regc_bulk *bulk,
+					     unsigned index,
+					     pjsip_regc_bulk_info *info)
+{
+    const bulk_line *line;
+    pj_uint32_t now;
+
+    PJ_ASSERT_RETURN(bulk && info, PJ_EINVAL);
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+
+    if (index >= bulk->line_cnt) {
+	pj_grp_lock_release(bulk->grp_lock);
+	return PJ_EINVAL;
+    }
+
+    line = &bulk->lines[index];
+    now = now_tick(bulk);
+
+    info->user = line->user;
+    info->state = (pjsip_regc_bulk_state) line->state;
+    info->code = line->code;
+    info->expires = (line->expires_at > now) ?
+		    (line->expires_at - now) / TICKS_PER_SEC : 0;
+    if (line->due == NEVER)
+	info->next_reg = -1;
+    else if (line->due <= now)
+	info->next_reg = 0;
+    else
+	info->next_reg = (line->due - now + TICKS_PER_SEC - 1) /
+			 TICKS_PER_SEC;
+
+    pj_grp_lock_release(bulk->grp_lock);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_regc_bulk_get_stat(pjsip_regc_bulk *bulk,
+					     pjsip_regc_bulk_stat *stat)
+{
+    unsigned i;
+
+    PJ_ASSERT_RETURN(bulk && stat, PJ_EINVAL);
+
+    pj_grp_lock_acquire(bulk->grp_lock);
+
+    pj_memcpy(stat, &bulk->stat, sizeof(*stat));
+    stat->count = bulk->line_cnt;
+    stat->registered = stat->failed = 0;
+    stat->pending = bulk->pending;
+    for (i=0; i<bulk->line_cnt; ++i) {
+	if (bulk->lines[i].state == PJSIP_REGC_BULK_REGISTERED)
+	    ++stat->registered;
+	else if (bulk->lines[i].state == PJSIP_REGC_BULK_FAILED)
+	    ++stat->failed;
+    }
+
+    pj_grp_lock_release(bulk->grp_lock);
+    return PJ_SUCCESS;
+}
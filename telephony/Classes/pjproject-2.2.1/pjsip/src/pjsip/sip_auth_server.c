@@ -23,8 +23,88 @@
 #include <pjsip/sip_auth_msg.h>
 #include <pjsip/sip_errno.h>
 #include <pjsip/sip_transport.h>
+#include <pjlib-util/md5.h>
+#include <pj/ctype.h>
+#include <pj/hash.h>
+#include <pj/list.h>
+#include <pj/os.h>
+#include <pj/pool.h>
 #include <pj/string.h>
 #include <pj/assert.h>
+#include <pj/log.h>
+
+#define THIS_FILE   "sip_auth_server.c"
+
+
+/* Credential cache entry. The key is realm and account name separated
+ * by NULL character.
+ */
+typedef struct cache_entry
+{
+    PJ_DECL_LIST_MEMBER(struct cache_entry);
+    pj_hash_entry_buf	 hentry;
+    pj_time_val		 expire;
+    unsigned		 key_len;
+    char		 key[PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN + 1];
+    char		 ha1[PJSIP_MD5STRLEN];
+} cache_entry;
+
+/* Credential cache. */
+struct pjsip_auth_srv_cache
+{
+    pj_mutex_t		*mutex;
+    pj_hash_table_t	*htable;
+    unsigned		 ttl;
+    cache_entry		 used_list;	/* Oldest entry first	*/
+    cache_entry		 free_list;
+};
+
+/* Nonce store entry. Besides the nonce count, it keeps the HA2 of the
+ * last request which used the nonce, keyed by method and request URI
+ * separated by colon.
+ */
+typedef struct nonce_entry
+{
+    PJ_DECL_LIST_MEMBER(struct nonce_entry);
+    pj_hash_entry_buf	 hentry;
+    pj_time_val		 expire;
+    unsigned long	 last_nc;
+    unsigned		 use_cnt;
+    unsigned		 nonce_len;
+    char		 nonce[PJSIP_AUTH_SRV_NONCE_MAX_LEN];
+    unsigned		 ha2_key_len;
+    char		 ha2_key[PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN];
+    char		 ha2[PJSIP_MD5STRLEN];
+} nonce_entry;
+
+/* Nonce store. */
+struct pjsip_auth_srv_nonce_store
+{
+    pj_mutex_t		*mutex;
+    pj_hash_table_t	*htable;
+    unsigned		 expiry;
+    nonce_entry		 used_list;	/* Oldest entry first	*/
+    nonce_entry		 free_list;
+};
+
+/* State of a verification, kept across asynchronous lookup. */
+typedef struct verify_ctx
+{
+    pjsip_authorization_hdr	*h_auth;
+    const pj_str_t		*method;
+    pj_bool_t			 has_ha2;
+    char			 ha2[PJSIP_MD5STRLEN];
+} verify_ctx;
+
+/* Pending asynchronous lookup. */
+struct pjsip_auth_srv_async_op
+{
+    pjsip_auth_srv		*auth_srv;
+    pjsip_rx_data		*rdata;
+    verify_ctx			 ctx;
+    pjsip_auth_srv_verify_cb	*cb;
+    void			*user_data;
+};
 
 
 /*
@@ -63,12 +143,248 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_init2(
     pj_bzero(auth_srv, sizeof(*auth_srv));
     pj_strdup( pool, &auth_srv->realm, param->realm);
     auth_srv->lookup2 = param->lookup2;
+    auth_srv->lookup_async = param->lookup_async;
+    auth_srv->cache = param->cache;
+    auth_srv->nonce_store = param->nonce_store;
     auth_srv->is_proxy = (param->options & PJSIP_AUTH_SRV_IS_PROXY);
 
     return PJ_SUCCESS;
 }
 
 
+/*
+ * Create credential cache.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_srv_cache_create( pj_pool_t *pool,
+						 unsigned max_cnt,
+						 unsigned ttl,
+						 pjsip_auth_srv_cache **p_cache)
+{
+    pjsip_auth_srv_cache *cache;
+    cache_entry *entries;
+    unsigned i;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && max_cnt && ttl && p_cache, PJ_EINVAL);
+
+    cache = PJ_POOL_ZALLOC_T(pool, pjsip_auth_srv_cache);
+    cache->ttl = ttl;
+    pj_list_init(&cache->used_list);
+    pj_list_init(&cache->free_list);
+
+    entries = (cache_entry*) pj_pool_calloc(pool, max_cnt, sizeof(cache_entry));
+    for (i=0; i<max_cnt; ++i)
+	pj_list_push_back(&cache->free_list, &entries[i]);
+
+    cache->htable = pj_hash_create(pool, max_cnt);
+    status = pj_mutex_create_simple(pool, "authcache", &cache->mutex);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    *p_cache = cache;
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Destroy credential cache.
+ */
+PJ_DEF(void) pjsip_auth_srv_cache_destroy(pjsip_auth_srv_cache *cache)
+{
+    PJ_ASSERT_ON_FAIL(cache, return);
+
+    if (cache->mutex) {
+	pj_mutex_destroy(cache->mutex);
+	cache->mutex = NULL;
+    }
+}
+
+
+/* Build cache key, return the length or zero if the names are too long. */
+static unsigned cache_build_key(char *key, const pj_str_t *realm,
+				const pj_str_t *acc_name)
+{
+    if (realm->slen + acc_name->slen + 1 > PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN)
+	return 0;
+
+    pj_memcpy(key, realm->ptr, realm->slen);
+    key[realm->slen] = '\0';
+    pj_memcpy(key + realm->slen + 1, acc_name->ptr, acc_name->slen);
+    return (unsigned)(realm->slen + 1 + acc_name->slen);
+}
+
+
+/* Remove entry from the cache. Mutex must be held. */
+static void cache_remove_entry(pjsip_auth_srv_cache *cache, cache_entry *e)
+{
+    pj_hash_set(NULL, cache->htable, e->key, e->key_len, 0, NULL);
+    pj_list_erase(e);
+    pj_list_push_back(&cache->free_list, e);
+}
+
+
+/* Get HA1 of the account from the cache. */
+static pj_bool_t cache_get(pjsip_auth_srv_cache *cache,
+			   const pj_str_t *realm,
+			   const pj_str_t *acc_name,
+			   char ha1[PJSIP_MD5STRLEN])
+{
+    char key[PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN + 1];
+    unsigned key_len;
+    cache_entry *e;
+    pj_time_val now;
+    pj_bool_t found = PJ_FALSE;
+
+    key_len = cache_build_key(key, realm, acc_name);
+    if (key_len == 0)
+	return PJ_FALSE;
+
+    pj_gettickcount(&now);
+
+    pj_mutex_lock(cache->mutex);
+    e = (cache_entry*) pj_hash_get(cache->htable, key, key_len, NULL);
+    if (e) {
+	if (PJ_TIME_VAL_GT(now, e->expire)) {
+	    cache_remove_entry(cache, e);
+	} else {
+	    pj_memcpy(ha1, e->ha1, PJSIP_MD5STRLEN);
+	    found = PJ_TRUE;
+	}
+    }
+    pj_mutex_unlock(cache->mutex);
+
+    return found;
+}
+
+
+/* Put HA1 of the account to the cache. */
+static void cache_put(pjsip_auth_srv_cache *cache,
+		      const pj_str_t *realm,
+		      const pj_str_t *acc_name,
+		      const char ha1[PJSIP_MD5STRLEN])
+{
+    char key[PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN + 1];
+    unsigned key_len;
+    cache_entry *e;
+
+    key_len = cache_build_key(key, realm, acc_name);
+    if (key_len == 0)
+	return;
+
+    pj_mutex_lock(cache->mutex);
+
+    e = (cache_entry*) pj_hash_get(cache->htable, key, key_len, NULL);
+    if (e) {
+	pj_list_erase(e);
+    } else {
+	if (pj_list_empty(&cache->free_list)) {
+	    /* Replace the oldest entry */
+	    cache_remove_entry(cache, cache->used_list.next);
+	}
+	e = cache->free_list.next;
+	pj_list_erase(e);
+
+	pj_memcpy(e->key, key, key_len);
+	e->key_len = key_len;
+	pj_hash_set_np(cache->htable, e->key, e->key_len, 0, e->hentry, e);
+    }
+
+    pj_memcpy(e->ha1, ha1, PJSIP_MD5STRLEN);
+    pj_gettickcount(&e->expire);
+    e->expire.sec += cache->ttl;
+    pj_list_push_back(&cache->used_list, e);
+
+    pj_mutex_unlock(cache->mutex);
+}
+
+
+/*
+ * Remove account from the cache.
+ */
+PJ_DEF(void) pjsip_auth_srv_cache_remove( pjsip_auth_srv_cache *cache,
+					  const pj_str_t *realm,
+					  const pj_str_t *acc_name)
+{
+    cache_entry *e;
+
+    PJ_ASSERT_ON_FAIL(cache && realm, return);
+
+    pj_mutex_lock(cache->mutex);
+
+    if (acc_name) {
+	char key[PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN + 1];
+	unsigned key_len;
+
+	key_len = cache_build_key(key, realm, acc_name);
+	e = key_len ? (cache_entry*)
+		      pj_hash_get(cache->htable, key, key_len, NULL) : NULL;
+	if (e)
+	    cache_remove_entry(cache, e);
+
+    } else {
+	e = cache->used_list.next;
+	while (e != &cache->used_list) {
+	    cache_entry *next = e->next;
+	    if ((unsigned)realm->slen < e->key_len &&
+		e->key[realm->slen] == '\0' &&
+		pj_memcmp(e->key, realm->ptr, realm->slen) == 0)
+	    {
+		cache_remove_entry(cache, e);
+	    }
+	    e = next;
+	}
+    }
+
+    pj_mutex_unlock(cache->mutex);
+}
+
+
+/* Transform MD5 digest to (not NULL terminated) string. */
+static void digest2str(const unsigned char digest[16],
+		       char output[PJSIP_MD5STRLEN])
+{
+    unsigned i;
+    for (i=0; i<16; ++i)
+	pj_val_to_hex_digit(digest[i], output + i*2);
+}
+
+
+/* Calculate the HA1 of the credential, return PJ_FALSE if the credential
+ * type is not supported by the cache.
+ */
+static pj_bool_t calc_ha1(const pjsip_cred_info *cred_info,
+			  char ha1[PJSIP_MD5STRLEN])
+{
+    if (cred_info->data_type == PJSIP_CRED_DATA_PLAIN_PASSWD) {
+	pj_md5_context pms;
+	unsigned char digest[16];
+
+	/* ha1 = MD5(username ":" realm ":" password) */
+	pj_md5_init(&pms);
+	pj_md5_update(&pms, (const pj_uint8_t*)cred_info->username.ptr,
+		      (unsigned)cred_info->username.slen);
+	pj_md5_update(&pms, (const pj_uint8_t*)":", 1);
+	pj_md5_update(&pms, (const pj_uint8_t*)cred_info->realm.ptr,
+		      (unsigned)cred_info->realm.slen);
+	pj_md5_update(&pms, (const pj_uint8_t*)":", 1);
+	pj_md5_update(&pms, (const pj_uint8_t*)cred_info->data.ptr,
+		      (unsigned)cred_info->data.slen);
+	pj_md5_final(&pms, digest);
+
+	digest2str(digest, ha1);
+	return PJ_TRUE;
+
+    } else if (cred_info->data_type == PJSIP_CRED_DATA_DIGEST &&
+	       cred_info->data.slen == PJSIP_MD5STRLEN)
+    {
+	pj_memcpy(ha1, cred_info->data.ptr, PJSIP_MD5STRLEN);
+	return PJ_TRUE;
+    }
+
+    return PJ_FALSE;
+}
+
+
 /* Verify incoming Authorization/Proxy-Authorization header against the 
  * specified credential.
  */
@@ -116,30 +432,19 @@ static pj_status_t pjsip_auth_verify( const pjsip_authorization_hdr *hdr,
 }
 
 
-/*
- * Request the authorization server framework to verify the authorization 
- * information in the specified request in rdata.
- */
-PJ_DEF(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
-					   pjsip_rx_data *rdata,
-					   int *status_code)
+/* Find the authorization header for our realm. */
+static pj_status_t find_auth_hdr( pjsip_auth_srv *auth_srv,
+				  pjsip_rx_data *rdata,
+				  pjsip_authorization_hdr **p_h_auth,
+				  int *status_code )
 {
     pjsip_authorization_hdr *h_auth;
     pjsip_msg *msg = rdata->msg_info.msg;
     pjsip_hdr_e htype;
-    pj_str_t acc_name;
-    pjsip_cred_info cred_info;
-    pj_status_t status;
-
-    PJ_ASSERT_RETURN(auth_srv && rdata, PJ_EINVAL);
-    PJ_ASSERT_RETURN(msg->type == PJSIP_REQUEST_MSG, PJSIP_ENOTREQUESTMSG);
 
     htype = auth_srv->is_proxy ? PJSIP_H_PROXY_AUTHORIZATION : 
 				 PJSIP_H_AUTHORIZATION;
 
-    /* Initialize status with 200. */
-    *status_code = 200;
-
     /* Find authorization header for our realm. */
     h_auth = (pjsip_authorization_hdr*) pjsip_msg_find_hdr(msg, htype, NULL);
     while (h_auth) {
@@ -161,13 +466,423 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
     }
 
     /* Check authorization scheme. */
-    if (pj_stricmp(&h_auth->scheme, &pjsip_DIGEST_STR) == 0)
-	acc_name = h_auth->credential.digest.username;
-    else {
+    if (pj_stricmp(&h_auth->scheme, &pjsip_DIGEST_STR) != 0) {
 	*status_code = auth_srv->is_proxy ? 407 : 401;
 	return PJSIP_EINVALIDAUTHSCHEME;
     }
 
+    *p_h_auth = h_auth;
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Nonce store.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_srv_nonce_store_create(
+					pj_pool_t *pool,
+					unsigned max_cnt,
+					unsigned expiry,
+					pjsip_auth_srv_nonce_store **p_store)
+{
+    pjsip_auth_srv_nonce_store *store;
+    nonce_entry *entries;
+    unsigned i;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(pool && max_cnt && expiry && p_store, PJ_EINVAL);
+
+    store = PJ_POOL_ZALLOC_T(pool, pjsip_auth_srv_nonce_store);
+    store->expiry = expiry;
+    pj_list_init(&store->used_list);
+    pj_list_init(&store->free_list);
+
+    entries = (nonce_entry*) pj_pool_calloc(pool, max_cnt, sizeof(nonce_entry));
+    for (i=0; i<max_cnt; ++i)
+	pj_list_push_back(&store->free_list, &entries[i]);
+
+    store->htable = pj_hash_create(pool, max_cnt);
+    status = pj_mutex_create_simple(pool, "authnonce", &store->mutex);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    *p_store = store;
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(void) pjsip_auth_srv_nonce_store_destroy(
+					pjsip_auth_srv_nonce_store *store)
+{
+    PJ_ASSERT_ON_FAIL(store, return);
+
+    if (store->mutex) {
+	pj_mutex_destroy(store->mutex);
+	store->mutex = NULL;
+    }
+}
+
+
+/* Remove entry from the nonce store. Mutex must be held. */
+static void nonce_remove_entry(pjsip_auth_srv_nonce_store *store,
+			       nonce_entry *e)
+{
+    pj_hash_set(NULL, store->htable, e->nonce, e->nonce_len, 0, NULL);
+    pj_list_erase(e);
+    pj_list_push_back(&store->free_list, e);
+}
+
+
+/* Add nonce of a new challenge to the store. */
+static void nonce_add(pjsip_auth_srv_nonce_store *store, const pj_str_t *nonce)
+{
+    nonce_entry *e;
+
+    pj_assert(nonce->slen && nonce->slen <= PJSIP_AUTH_SRV_NONCE_MAX_LEN);
+
+    pj_mutex_lock(store->mutex);
+
+    e = (nonce_entry*) pj_hash_get(store->htable, nonce->ptr,
+				   (unsigned)nonce->slen, NULL);
+    if (e) {
+	pj_list_erase(e);
+    } else {
+	if (pj_list_empty(&store->free_list)) {
+	    /* Replace the oldest nonce */
+	    nonce_remove_entry(store, store->used_list.next);
+	}
+	e = store->free_list.next;
+	pj_list_erase(e);
+
+	pj_memcpy(e->nonce, nonce->ptr, nonce->slen);
+	e->nonce_len = (unsigned)nonce->slen;
+	pj_hash_set_np(store->htable, e->nonce, e->nonce_len, 0, e->hentry, e);
+    }
+
+    e->last_nc = 0;
+    e->use_cnt = 0;
+    e->ha2_key_len = 0;
+    pj_gettickcount(&e->expire);
+    e->expire.sec += store->expiry;
+    pj_list_push_back(&store->used_list, e);
+
+    pj_mutex_unlock(store->mutex);
+}
+
+
+/* Check whether the HA2 key of the entry matches the request. */
+static pj_bool_t nonce_ha2_match(const nonce_entry *e, const pj_str_t *method,
+				 const pj_str_t *uri)
+{
+    return e->ha2_key_len == method->slen + 1 + uri->slen &&
+	   pj_memcmp(e->ha2_key, method->ptr, method->slen) == 0 &&
+	   e->ha2_key[method->slen] == ':' &&
+	   pj_memcmp(e->ha2_key + method->slen + 1, uri->ptr, uri->slen) == 0;
+}
+
+
+/* Find the nonce entry and check the nonce count of the request. Mutex
+ * must be held.
+ */
+static pj_status_t nonce_find(pjsip_auth_srv_nonce_store *store,
+			      const pjsip_digest_credential *dig,
+			      nonce_entry **p_entry,
+			      unsigned long *p_nc)
+{
+    nonce_entry *e;
+    pj_time_val now;
+
+    *p_entry = NULL;
+    *p_nc = 0;
+
+    e = (nonce_entry*) pj_hash_get(store->htable, dig->nonce.ptr,
+				   (unsigned)dig->nonce.slen, NULL);
+    if (!e)
+	return PJSIP_EAUTHSTALENONCE;
+
+    pj_gettickcount(&now);
+    if (PJ_TIME_VAL_GT(now, e->expire)) {
+	nonce_remove_entry(store, e);
+	return PJSIP_EAUTHSTALENONCE;
+    }
+
+    /* With qop, nonce count must be increasing to prevent replay. */
+    if (dig->qop.slen) {
+	*p_nc = dig->nc.slen ? pj_strtoul2(&dig->nc, NULL, 16) : 0;
+	if (*p_nc <= e->last_nc)
+	    return PJSIP_EAUTHSTALENONCE;
+    }
+
+    *p_entry = e;
+    return PJ_SUCCESS;
+}
+
+
+/* Check the nonce of the request before looking up the credential, and
+ * fetch the HA2 saved for the nonce.
+ */
+static pj_status_t nonce_check(pjsip_auth_srv *auth_srv, verify_ctx *ctx,
+			       int *status_code)
+{
+    pjsip_auth_srv_nonce_store *store = auth_srv->nonce_store;
+    const pjsip_digest_credential *dig = &ctx->h_auth->credential.digest;
+    nonce_entry *e;
+    unsigned long nc;
+    pj_status_t status;
+
+    if (!store)
+	return PJ_SUCCESS;
+
+    pj_mutex_lock(store->mutex);
+    status = nonce_find(store, dig, &e, &nc);
+    if (status == PJ_SUCCESS && nonce_ha2_match(e, ctx->method, &dig->uri)) {
+	pj_memcpy(ctx->ha2, e->ha2, PJSIP_MD5STRLEN);
+	ctx->has_ha2 = PJ_TRUE;
+    }
+    pj_mutex_unlock(store->mutex);
+
+    if (status != PJ_SUCCESS) {
+	++auth_srv->stat.stale;
+	*status_code = auth_srv->is_proxy ? 407 : 401;
+    }
+    return status;
+}
+
+
+/* Record the use of the nonce after successful verification. The nonce
+ * count is checked again since the same nonce count may have been used by
+ * another request in the meantime.
+ */
+static pj_status_t nonce_commit(pjsip_auth_srv_nonce_store *store,
+				const verify_ctx *ctx,
+				pj_bool_t *reused)
+{
+    const pjsip_digest_credential *dig = &ctx->h_auth->credential.digest;
+    nonce_entry *e;
+    unsigned long nc;
+    pj_status_t status;
+
+    pj_mutex_lock(store->mutex);
+    status = nonce_find(store, dig, &e, &nc);
+    if (status == PJ_SUCCESS) {
+	*reused = (e->use_cnt > 0);
+	++e->use_cnt;
+	if (nc)
+	    e->last_nc = nc;
+
+	if (ctx->method->slen + 1 + dig->uri.slen <=
+		PJSIP_AUTH_SRV_CACHE_MAX_KEY_LEN)
+	{
+	    pj_memcpy(e->ha2_key, ctx->method->ptr, ctx->method->slen);
+	    e->ha2_key[ctx->method->slen] = ':';
+	    pj_memcpy(e->ha2_key + ctx->method->slen + 1, dig->uri.ptr,
+		      dig->uri.slen);
+	    e->ha2_key_len = (unsigned)(ctx->method->slen + 1 + dig->uri.slen);
+	    pj_memcpy(e->ha2, ctx->ha2, PJSIP_MD5STRLEN);
+	}
+    }
+    pj_mutex_unlock(store->mutex);
+
+    return status;
+}
+
+
+/* Verify the response digest of the request with the HA1, calculating
+ * the HA2 only when it is not known yet.
+ */
+static pj_bool_t verify_digest(verify_ctx *ctx, const char ha1[])
+{
+    const pjsip_digest_credential *dig = &ctx->h_auth->credential.digest;
+    unsigned char digest[16];
+    char response[PJSIP_MD5STRLEN];
+    pj_md5_context pms;
+
+    if (!ctx->has_ha2) {
+	/* ha2 = MD5(method ":" req_uri) */
+	pj_md5_init(&pms);
+	pj_md5_update(&pms, (const pj_uint8_t*)ctx->method->ptr,
+		      (unsigned)ctx->method->slen);
+	pj_md5_update(&pms, (const pj_uint8_t*)":", 1);
+	pj_md5_update(&pms, (const pj_uint8_t*)dig->uri.ptr,
+		      (unsigned)dig->uri.slen);
+	pj_md5_final(&pms, digest);
+	digest2str(digest, ctx->ha2);
+	ctx->has_ha2 = PJ_TRUE;
+    }
+
+    /* response = MD5(ha1 ":" nonce [":" nc ":" cnonce ":" qop] ":" ha2) */
+    pj_md5_init(&pms);
+    pj_md5_update(&pms, (const pj_uint8_t*)ha1, PJSIP_MD5STRLEN);
+    pj_md5_update(&pms, (const pj_uint8_t*)":", 1);
+    pj_md5_update(&pms, (const pj_uint8_t*)dig->nonce.ptr,
+		  (unsigned)dig->nonce.slen);
+    if (dig->qop.slen) {
+	pj_md5_update(&pms, (const pj_uint8_t*)":", 1);
+	pj_md5_update(&pms, (const pj_uint8_t*)dig->nc.ptr,
+		      (unsigned)dig->nc.slen);
+	pj_md5_update(&pms, (const pj_uint8_t*)":", 1);
+	pj_md5_update(&pms, (const pj_uint8_t*)dig->cnonce.ptr,
+		      (unsigned)dig->cnonce.slen);
+	pj_md5_update(&pms, (const pj_uint8_t*)":", 1);
+	pj_md5_update(&pms, (const pj_uint8_t*)dig->qop.ptr,
+		      (unsigned)dig->qop.slen);
+    }
+    pj_md5_update(&pms, (const pj_uint8_t*)":", 1);
+    pj_md5_update(&pms, (const pj_uint8_t*)ctx->ha2, PJSIP_MD5STRLEN);
+    pj_md5_final(&pms, digest);
+    digest2str(digest, response);
+
+    return dig->response.slen == PJSIP_MD5STRLEN &&
+	   pj_ansi_strnicmp(response, dig->response.ptr, PJSIP_MD5STRLEN) == 0;
+}
+
+
+/* Finish successful verification: record the nonce use and update the
+ * statistics.
+ */
+static pj_status_t verify_done( pjsip_auth_srv *auth_srv,
+				const verify_ctx *ctx,
+				int *status_code )
+{
+    pj_bool_t reused = PJ_FALSE;
+
+    if (auth_srv->nonce_store) {
+	pj_status_t status;
+
+	status = nonce_commit(auth_srv->nonce_store, ctx, &reused);
+	if (status != PJ_SUCCESS) {
+	    ++auth_srv->stat.stale;
+	    *status_code = auth_srv->is_proxy ? 407 : 401;
+	    return status;
+	}
+    }
+
+    ++auth_srv->stat.accepted;
+    if (reused)
+	++auth_srv->stat.accepted_reused;
+    return PJ_SUCCESS;
+}
+
+
+/* Verify the request with the HA1 in the cache. */
+static pj_bool_t verify_cached( pjsip_auth_srv *auth_srv,
+				verify_ctx *ctx )
+{
+    const pjsip_digest_credential *dig = &ctx->h_auth->credential.digest;
+    char ha1[PJSIP_MD5STRLEN];
+
+    if (!auth_srv->cache ||
+	!cache_get(auth_srv->cache, &auth_srv->realm, &dig->username, ha1))
+    {
+	return PJ_FALSE;
+    }
+
+    if (verify_digest(ctx, ha1))
+	return PJ_TRUE;
+
+    /* The credential may have been changed, look it up again. */
+    pjsip_auth_srv_cache_remove(auth_srv->cache, &auth_srv->realm,
+				&dig->username);
+    return PJ_FALSE;
+}
+
+
+/* Verify the request with the credential returned by the lookup
+ * function, and put the credential to the cache.
+ */
+static pj_status_t verify_cred( pjsip_auth_srv *auth_srv,
+				verify_ctx *ctx,
+				const pjsip_cred_info *cred_info,
+				int *status_code )
+{
+    char ha1[PJSIP_MD5STRLEN];
+    pj_status_t status;
+
+    if (calc_ha1(cred_info, ha1)) {
+	if (auth_srv->cache) {
+	    cache_put(auth_srv->cache, &auth_srv->realm,
+		      &ctx->h_auth->credential.digest.username, ha1);
+	}
+	status = verify_digest(ctx, ha1) ? PJ_SUCCESS :
+					   PJSIP_EAUTHINVALIDDIGEST;
+    } else {
+	/* Authenticate with the specified credential. */
+	status = pjsip_auth_verify(ctx->h_auth, ctx->method, cred_info);
+    }
+
+    if (status != PJ_SUCCESS) {
+	++auth_srv->stat.rejected;
+	*status_code = PJSIP_SC_FORBIDDEN;
+	return status;
+    }
+
+    return verify_done(auth_srv, ctx, status_code);
+}
+
+
+/* Common part of synchronous and asynchronous verification: find the
+ * authorization header, check the nonce, and try the credential cache.
+ * Returns PJ_SUCCESS with *done set when the request is already verified.
+ */
+static pj_status_t verify_begin( pjsip_auth_srv *auth_srv,
+				 pjsip_rx_data *rdata,
+				 verify_ctx *ctx,
+				 pj_bool_t *done,
+				 int *status_code )
+{
+    pj_status_t status;
+
+    *done = PJ_FALSE;
+
+    /* Initialize status with 200. */
+    *status_code = 200;
+
+    /* Find authorization header for our realm. */
+    pj_bzero(ctx, sizeof(*ctx));
+    ctx->method = &rdata->msg_info.msg->line.req.method.name;
+    status = find_auth_hdr(auth_srv, rdata, &ctx->h_auth, status_code);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    /* Reject unknown or replayed nonce before looking up the account. */
+    status = nonce_check(auth_srv, ctx, status_code);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    /* Try the credential cache. */
+    if (verify_cached(auth_srv, ctx)) {
+	*done = PJ_TRUE;
+	return verify_done(auth_srv, ctx, status_code);
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Request the authorization server framework to verify the authorization 
+ * information in the specified request in rdata.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
+					   pjsip_rx_data *rdata,
+					   int *status_code)
+{
+    pjsip_msg *msg = rdata->msg_info.msg;
+    verify_ctx ctx;
+    pj_bool_t done;
+    pj_str_t acc_name;
+    pjsip_cred_info cred_info;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(auth_srv && rdata, PJ_EINVAL);
+    PJ_ASSERT_RETURN(msg->type == PJSIP_REQUEST_MSG, PJSIP_ENOTREQUESTMSG);
+
+    status = verify_begin(auth_srv, rdata, &ctx, &done, status_code);
+    if (status != PJ_SUCCESS || done)
+	return status;
+
+    acc_name = ctx.h_auth->credential.digest.username;
+
     /* Find the credential information for the account. */
     if (auth_srv->lookup2) {
 	pjsip_auth_lookup_cred_param param;
@@ -178,25 +893,120 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_verify( pjsip_auth_srv *auth_srv,
 	param.rdata = rdata;
 	status = (*auth_srv->lookup2)(rdata->tp_info.pool, &param, &cred_info);
 	if (status != PJ_SUCCESS) {
+	    ++auth_srv->stat.rejected;
 	    *status_code = PJSIP_SC_FORBIDDEN;
 	    return status;
 	}
-    } else {
+    } else if (auth_srv->lookup) {
 	status = (*auth_srv->lookup)(rdata->tp_info.pool, &auth_srv->realm,
 				     &acc_name, &cred_info);
 	if (status != PJ_SUCCESS) {
+	    ++auth_srv->stat.rejected;
 	    *status_code = PJSIP_SC_FORBIDDEN;
 	    return status;
 	}
+    } else {
+	/* Only asynchronous lookup is configured */
+	*status_code = PJSIP_SC_INTERNAL_SERVER_ERROR;
+	return PJ_EINVALIDOP;
     }
 
     /* Authenticate with the specified credential. */
-    status = pjsip_auth_verify(h_auth, &msg->line.req.method.name, 
-			       &cred_info);
+    return verify_cred(auth_srv, &ctx, &cred_info, status_code);
+}
+
+
+/*
+ * Asynchronous version of pjsip_auth_srv_verify().
+ */
+PJ_DEF(pj_status_t) pjsip_auth_srv_verify_async( pjsip_auth_srv *auth_srv,
+						 pjsip_rx_data *rdata,
+						 void *user_data,
+						 pjsip_auth_srv_verify_cb *cb,
+						 int *status_code )
+{
+    pjsip_msg *msg = rdata->msg_info.msg;
+    pjsip_auth_srv_async_op *op;
+    pjsip_auth_lookup_cred_param param;
+    pjsip_rx_data *clone;
+    verify_ctx ctx;
+    pj_bool_t done;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(auth_srv && rdata && cb, PJ_EINVAL);
+    PJ_ASSERT_RETURN(msg->type == PJSIP_REQUEST_MSG, PJSIP_ENOTREQUESTMSG);
+
+    /* Without asynchronous lookup this is just the synchronous verify. */
+    if (!auth_srv->lookup_async)
+	return pjsip_auth_srv_verify(auth_srv, rdata, status_code);
+
+    status = verify_begin(auth_srv, rdata, &ctx, &done, status_code);
+    if (status != PJ_SUCCESS || done)
+	return status;
+
+    /* Keep a clone of the request for the duration of the lookup. */
+    status = pjsip_rx_data_clone(rdata, 0, &clone);
     if (status != PJ_SUCCESS) {
-	*status_code = PJSIP_SC_FORBIDDEN;
+	*status_code = PJSIP_SC_INTERNAL_SERVER_ERROR;
+	return status;
     }
-    return status;
+
+    op = PJ_POOL_ZALLOC_T(clone->tp_info.pool, pjsip_auth_srv_async_op);
+    op->auth_srv = auth_srv;
+    op->rdata = clone;
+    op->cb = cb;
+    op->user_data = user_data;
+    op->ctx = ctx;
+    op->ctx.method = &clone->msg_info.msg->line.req.method.name;
+    status = find_auth_hdr(auth_srv, clone, &op->ctx.h_auth, status_code);
+    pj_assert(status == PJ_SUCCESS);
+
+    pj_bzero(&param, sizeof(param));
+    param.realm = auth_srv->realm;
+    param.acc_name = op->ctx.h_auth->credential.digest.username;
+    param.rdata = clone;
+
+    /* The operation may have been completed (and destroyed) once the
+     * lookup function returns PJ_EPENDING, so don't touch it afterwards.
+     */
+    status = (*auth_srv->lookup_async)(&param, op);
+    if (status == PJ_EPENDING)
+	return PJ_EPENDING;
+
+    pjsip_rx_data_free_cloned(clone);
+    ++auth_srv->stat.rejected;
+    *status_code = PJSIP_SC_FORBIDDEN;
+    return (status == PJ_SUCCESS) ? PJ_EINVALIDOP : status;
+}
+
+
+/*
+ * Complete asynchronous credential lookup.
+ */
+PJ_DEF(pj_status_t) pjsip_auth_srv_lookup_complete(
+					    pjsip_auth_srv_async_op *op,
+					    pj_status_t status,
+					    const pjsip_cred_info *cred_info )
+{
+    pjsip_rx_data *rdata;
+    int status_code = 200;
+
+    PJ_ASSERT_RETURN(op && (status != PJ_SUCCESS || cred_info), PJ_EINVAL);
+
+    rdata = op->rdata;
+
+    if (status == PJ_SUCCESS) {
+	status = verify_cred(op->auth_srv, &op->ctx, cred_info, &status_code);
+    } else {
+	++op->auth_srv->stat.rejected;
+	status_code = PJSIP_SC_FORBIDDEN;
+    }
+
+    (*op->cb)(op->auth_srv, rdata, op->user_data, status, status_code);
+
+    /* This also releases the operation */
+    pjsip_rx_data_free_cloned(rdata);
+    return PJ_SUCCESS;
 }
 
 
@@ -214,11 +1024,23 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_challenge(  pjsip_auth_srv *auth_srv,
 					       pjsip_tx_data *tdata)
 {
     pjsip_www_authenticate_hdr *hdr;
-    char nonce_buf[16];
+    char nonce_buf[32];
     pj_str_t random;
 
     PJ_ASSERT_RETURN( auth_srv && tdata, PJ_EINVAL );
 
+    /* The nonce store can't keep nonce that is empty or too long, and
+     * the client would then be challenged on every request.
+     */
+    if (auth_srv->nonce_store && nonce &&
+	(nonce->slen == 0 || nonce->slen > PJSIP_AUTH_SRV_NONCE_MAX_LEN))
+    {
+	PJ_LOG(2,(THIS_FILE, "Unable to create challenge: nonce length %d "
+		  "is not supported by the nonce store (max %d)",
+		  (int)nonce->slen, PJSIP_AUTH_SRV_NONCE_MAX_LEN));
+	return nonce->slen ? PJ_ETOOBIG : PJ_EINVAL;
+    }
+
     random.ptr = nonce_buf;
     random.slen = sizeof(nonce_buf);
 
@@ -242,7 +1064,8 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_challenge(  pjsip_auth_srv *auth_srv,
     if (opaque) {
 	pj_strdup(tdata->pool, &hdr->challenge.digest.opaque, opaque);
     } else {
-	pj_create_random_string(nonce_buf, sizeof(nonce_buf));
+	random.slen = 16;
+	pj_create_random_string(nonce_buf, (unsigned)random.slen);
 	pj_strdup(tdata->pool, &hdr->challenge.digest.opaque, &random);
     }
     if (qop) {
@@ -255,6 +1078,12 @@ PJ_DEF(pj_status_t) pjsip_auth_srv_challenge(  pjsip_auth_srv *auth_srv,
 
     pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)hdr);
 
+    /* Remember the nonce so that it can be reused by the client. */
+    if (auth_srv->nonce_store)
+	nonce_add(auth_srv->nonce_store, &hdr->challenge.digest.nonce);
+
+    ++auth_srv->stat.challenged;
+
     return PJ_SUCCESS;
 }
 
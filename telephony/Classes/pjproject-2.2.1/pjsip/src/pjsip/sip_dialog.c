@@ -34,6 +34,7 @@
 #include <pj/array.h>
 #include <pj/except.h>
 #include <pj/hash.h>
+#include <pj/lock.h>
 #include <pj/log.h>
 
 #define THIS_FILE	"sip_dialog.c"
@@ -43,9 +44,16 @@ long pjsip_dlg_lock_tls_id;
 /* Config */
 pj_bool_t pjsip_include_allow_hdr_in_dlg = PJSIP_INCLUDE_ALLOW_HDR_IN_DLG;
 
+/* Defined in sip_msg.c */
+extern pj_bool_t pjsip_use_compact_form;
+
 /* Contact header string */
 static const pj_str_t HCONTACT = { "Contact", 7 };
 
+#if PJSIP_DLG_USE_REQ_TEMPLATE
+static void release_req_tpl(pjsip_dialog *dlg);
+#endif
+
 
 PJ_DEF(pj_bool_t) pjsip_method_creates_dialog(const pjsip_method *m)
 {
@@ -110,6 +118,9 @@ on_error:
 
 static void destroy_dialog( pjsip_dialog *dlg )
 {
+#if PJSIP_DLG_USE_REQ_TEMPLATE
+    release_req_tpl(dlg);
+#endif
     if (dlg->mutex_) {
 	pj_mutex_destroy(dlg->mutex_);
 	dlg->mutex_ = NULL;
@@ -1041,6 +1052,449 @@ PJ_DEF(void*) pjsip_dlg_get_mod_data( pjsip_dialog *dlg,
 }
 
 
+#if PJSIP_DLG_USE_REQ_TEMPLATE
+
+/*
+ * Request template.
+ *
+ * Requests within an established dialog carry the same From, To, Contact,
+ * Call-ID and Route headers and Request-URI, and only differ in the
+ * method, CSeq and Via. The template keeps these in its own pool together
+ * with the encoded text of the headers. A request gets shallow copies of
+ * the template headers, which share the URIs and strings with the
+ * template, and which print the encoded text as long as the copy has not
+ * been changed. The request holds a reference to the group lock of the
+ * template, so the template is only destroyed after the dialog and all
+ * requests created from it have released it.
+ *
+ * The template records the dialog state it was created from, and it is
+ * replaced when the target, route set, local Contact or local or remote
+ * info of the dialog changes.
+ */
+struct dlg_req_tpl
+{
+    pj_pool_t		*pool;
+    pjsip_endpoint	*endpt;
+    pj_grp_lock_t	*grp_lock;
+
+    /* From, To, Contact and Call-ID, in order. */
+    pjsip_hdr		 hdr_list;
+    pjsip_hdr		*contact;
+
+    /* Route set. */
+    pjsip_hdr		 route_list;
+
+    /* Request-URI. */
+    pjsip_uri		*target;
+
+    /* Dialog state the template was created from. */
+    const pjsip_uri	*dlg_target;
+    const void		*dlg_route_first;
+    const void		*dlg_route_last;
+    const pjsip_contact_hdr *dlg_contact;
+    const pjsip_fromto_hdr *dlg_local;
+    const pjsip_fromto_hdr *dlg_remote;
+    const char		*dlg_remote_tag;
+    pj_bool_t		 compact_form;
+};
+
+/* Virtual function table of template header. Each template header has
+ * its own table, which is shared by the copies of the header.
+ */
+struct tpl_hdr_vptr
+{
+    pjsip_hdr_vptr	 vptr;	    /* Must be the first member.	    */
+    pjsip_hdr_vptr	*orig;	    /* Table of the header type.	    */
+    const pjsip_hdr	*hdr;	    /* The header in the template.	    */
+    unsigned		 cmp_len;   /* Length of the fixed part.	    */
+    unsigned		 param_ofs; /* Offset of the parameters, or zero.   */
+    pj_bool_t		 compact_form;
+    pj_str_t		 text;	    /* Encoded header.			    */
+};
+
+/* Check if a copy of template header has been changed. The fixed part of
+ * the header after the list links, and the parameters are compared with
+ * the template. Values are compared by their pointers, since the copy
+ * shares them with the template until they are replaced.
+ */
+static pj_bool_t tpl_hdr_changed(const pjsip_hdr *hdr,
+				 const struct tpl_hdr_vptr *tv)
+{
+    const unsigned start = (unsigned)offsetof(pjsip_hdr, type);
+    const pjsip_param *end1, *end2, *p1, *p2;
+
+    if (pj_memcmp((const char*)hdr + start, (const char*)tv->hdr + start,
+		  tv->cmp_len - start) != 0)
+    {
+	return PJ_TRUE;
+    }
+
+    if (tv->param_ofs == 0)
+	return PJ_FALSE;
+
+    end1 = (const pjsip_param*) ((const char*)hdr + tv->param_ofs);
+    end2 = (const pjsip_param*) ((const char*)tv->hdr + tv->param_ofs);
+    for (p1=end1->next, p2=end2->next; p1!=end1 && p2!=end2;
+	 p1=p1->next, p2=p2->next)
+    {
+	if (p1->name.ptr != p2->name.ptr || p1->name.slen != p2->name.slen ||
+	    p1->value.ptr != p2->value.ptr || p1->value.slen != p2->value.slen)
+	{
+	    return PJ_TRUE;
+	}
+    }
+
+    return p1 != end1 || p2 != end2;
+}
+
+static void *tpl_hdr_clone(pj_pool_t *pool, const void *hdr)
+{
+    const struct tpl_hdr_vptr *tv;
+    pjsip_hdr *dst;
+
+    tv = (const struct tpl_hdr_vptr*) ((const pjsip_hdr*)hdr)->vptr;
+
+    /* Full clone may be modified, so it must print its own values. */
+    dst = (pjsip_hdr*) (*tv->orig->clone)(pool, hdr);
+    dst->vptr = tv->orig;
+    return dst;
+}
+
+static void *tpl_hdr_shallow_clone(pj_pool_t *pool, const void *hdr)
+{
+    const struct tpl_hdr_vptr *tv;
+    pjsip_hdr *dst;
+
+    tv = (const struct tpl_hdr_vptr*) ((const pjsip_hdr*)hdr)->vptr;
+
+    /* The clone is not compared with the template when printed. */
+    dst = (pjsip_hdr*) (*tv->orig->shallow_clone)(pool, hdr);
+    dst->vptr = tv->orig;
+    return dst;
+}
+
+static int tpl_hdr_print(void *hdr, char *buf, pj_size_t size)
+{
+    const struct tpl_hdr_vptr *tv;
+
+    tv = (const struct tpl_hdr_vptr*) ((pjsip_hdr*)hdr)->vptr;
+    if (tv->compact_form != pjsip_use_compact_form ||
+	tpl_hdr_changed((const pjsip_hdr*)hdr, tv))
+    {
+	return (*tv->orig->print_on)(hdr, buf, size);
+    }
+
+    if ((pj_ssize_t)size < tv->text.slen)
+	return -1;
+
+    pj_memcpy(buf, tv->text.ptr, tv->text.slen);
+    return (int)tv->text.slen;
+}
+
+/* Add a header, which must have been allocated from the template's pool,
+ * to the template. The fixed part of the header ends at cmp_len, and
+ * param_ofs is the offset of its parameter list, if any.
+ */
+static void tpl_add_hdr(struct dlg_req_tpl *tpl, pjsip_hdr *list,
+			pjsip_hdr *hdr, unsigned cmp_len, unsigned param_ofs)
+{
+    struct tpl_hdr_vptr *tv;
+
+    tv = PJ_POOL_ZALLOC_T(tpl->pool, struct tpl_hdr_vptr);
+    tv->vptr.clone = &tpl_hdr_clone;
+    tv->vptr.shallow_clone = &tpl_hdr_shallow_clone;
+    tv->vptr.print_on = &tpl_hdr_print;
+    tv->orig = hdr->vptr;
+    tv->hdr = hdr;
+    tv->cmp_len = cmp_len;
+    tv->param_ofs = param_ofs;
+    tv->compact_form = pjsip_use_compact_form;
+    hdr->vptr = &tv->vptr;
+
+    pj_list_push_back(list, hdr);
+}
+
+/* Encode the template headers. Header that doesn't fit the buffer is
+ * unusual, and the request is then created without template.
+ */
+static pj_status_t tpl_encode_list(struct dlg_req_tpl *tpl, pjsip_hdr *list)
+{
+    char buf[PJSIP_MAX_URL_SIZE * 4];
+    pjsip_hdr *hdr;
+
+    for (hdr=list->next; hdr!=list; hdr=hdr->next) {
+	struct tpl_hdr_vptr *tv = (struct tpl_hdr_vptr*) hdr->vptr;
+	int len;
+
+	len = (*tv->orig->print_on)(hdr, buf, sizeof(buf));
+	if (len < 0)
+	    return PJSIP_EMSGTOOLONG;
+
+	tv->text.ptr = (char*) pj_pool_alloc(tpl->pool, len);
+	pj_memcpy(tv->text.ptr, buf, len);
+	tv->text.slen = len;
+    }
+
+    return PJ_SUCCESS;
+}
+
+/* Destroy the template, when it has been released by the dialog and all
+ * the requests.
+ */
+static void tpl_on_destroy(void *arg)
+{
+    struct dlg_req_tpl *tpl = (struct dlg_req_tpl*) arg;
+    pjsip_endpt_release_pool(tpl->endpt, tpl->pool);
+}
+
+/* Check if the template still matches the dialog. */
+static pj_bool_t tpl_is_valid(const pjsip_dialog *dlg,
+			      const struct dlg_req_tpl *tpl)
+{
+    return tpl->dlg_target == dlg->target &&
+	   tpl->dlg_route_first == dlg->route_set.next &&
+	   tpl->dlg_route_last == dlg->route_set.prev &&
+	   tpl->dlg_contact == dlg->local.contact &&
+	   tpl->dlg_local == dlg->local.info &&
+	   tpl->dlg_remote == dlg->remote.info &&
+	   tpl->dlg_remote_tag == dlg->remote.info->tag.ptr &&
+	   tpl->compact_form == pjsip_use_compact_form;
+}
+
+/* Create request template. */
+static struct dlg_req_tpl *create_req_tpl(pjsip_dialog *dlg)
+{
+    pj_pool_t *pool;
+    struct dlg_req_tpl *tpl;
+    pjsip_from_hdr *from;
+    pjsip_to_hdr *to;
+    pjsip_cid_hdr *call_id;
+    pjsip_route_hdr *route;
+    pj_status_t status;
+
+    /* Headers from the target URI's header parameters are not kept
+     * in the template.
+     */
+    if (PJSIP_URI_SCHEME_IS_SIP(dlg->target) ||
+	PJSIP_URI_SCHEME_IS_SIPS(dlg->target))
+    {
+	pjsip_sip_uri *uri = (pjsip_sip_uri*) pjsip_uri_get_uri(dlg->target);
+	if (!pj_list_empty(&uri->header_param))
+	    return NULL;
+    }
+
+    pool = pjsip_endpt_create_pool(dlg->endpt, "rtpl%p",
+				   PJSIP_POOL_LEN_TDATA,
+				   PJSIP_POOL_INC_TDATA);
+    if (!pool)
+	return NULL;
+
+    tpl = PJ_POOL_ZALLOC_T(pool, struct dlg_req_tpl);
+    tpl->pool = pool;
+    tpl->endpt = dlg->endpt;
+    pj_list_init(&tpl->hdr_list);
+    pj_list_init(&tpl->route_list);
+
+    status = pj_grp_lock_create(pool, NULL, &tpl->grp_lock);
+    if (status != PJ_SUCCESS) {
+	pjsip_endpt_release_pool(dlg->endpt, pool);
+	return NULL;
+    }
+
+    /* This reference is held by the dialog. */
+    pj_grp_lock_add_ref(tpl->grp_lock);
+    pj_grp_lock_add_handler(tpl->grp_lock, NULL, tpl, &tpl_on_destroy);
+
+    /* Clone the headers like pjsip_endpt_create_request_from_hdr() */
+    tpl->target = (pjsip_uri*) pjsip_uri_clone(pool, dlg->target);
+
+    from = (pjsip_from_hdr*) pjsip_hdr_clone(pool, dlg->local.info);
+    pjsip_fromto_hdr_set_from(from);
+    tpl_add_hdr(tpl, &tpl->hdr_list, (pjsip_hdr*)from,
+		offsetof(pjsip_fromto_hdr, other_param),
+		offsetof(pjsip_fromto_hdr, other_param));
+
+    to = (pjsip_to_hdr*) pjsip_hdr_clone(pool, dlg->remote.info);
+    pjsip_fromto_hdr_set_to(to);
+    tpl_add_hdr(tpl, &tpl->hdr_list, (pjsip_hdr*)to,
+		offsetof(pjsip_fromto_hdr, other_param),
+		offsetof(pjsip_fromto_hdr, other_param));
+
+    if (dlg->local.contact) {
+	tpl->contact = (pjsip_hdr*) pjsip_hdr_clone(pool, dlg->local.contact);
+	tpl_add_hdr(tpl, &tpl->hdr_list, tpl->contact,
+		    offsetof(pjsip_contact_hdr, other_param),
+		    offsetof(pjsip_contact_hdr, other_param));
+    }
+
+    call_id = pjsip_cid_hdr_create(pool);
+    pj_strdup(pool, &call_id->id, &dlg->call_id->id);
+    tpl_add_hdr(tpl, &tpl->hdr_list, (pjsip_hdr*)call_id,
+		sizeof(pjsip_cid_hdr), 0);
+
+    for (route=dlg->route_set.next; route!=&dlg->route_set;
+	 route=route->next)
+    {
+	pjsip_route_hdr *r;
+	r = (pjsip_route_hdr*) pjsip_hdr_clone(pool, route);
+	pjsip_routing_hdr_set_route(r);
+	tpl_add_hdr(tpl, &tpl->route_list, (pjsip_hdr*)r,
+		    offsetof(pjsip_routing_hdr, other_param),
+		    offsetof(pjsip_routing_hdr, other_param));
+    }
+
+    status = tpl_encode_list(tpl, &tpl->hdr_list);
+    if (status == PJ_SUCCESS)
+	status = tpl_encode_list(tpl, &tpl->route_list);
+    if (status != PJ_SUCCESS) {
+	pj_grp_lock_dec_ref(tpl->grp_lock);
+	return NULL;
+    }
+
+    tpl->dlg_target = dlg->target;
+    tpl->dlg_route_first = dlg->route_set.next;
+    tpl->dlg_route_last = dlg->route_set.prev;
+    tpl->dlg_contact = dlg->local.contact;
+    tpl->dlg_local = dlg->local.info;
+    tpl->dlg_remote = dlg->remote.info;
+    tpl->dlg_remote_tag = dlg->remote.info->tag.ptr;
+    tpl->compact_form = pjsip_use_compact_form;
+
+    return tpl;
+}
+
+/* Release the dialog's reference to the request template. */
+static void release_req_tpl(pjsip_dialog *dlg)
+{
+    struct dlg_req_tpl *tpl = (struct dlg_req_tpl*) dlg->req_tpl;
+
+    if (tpl) {
+	dlg->req_tpl = NULL;
+	pj_grp_lock_dec_ref(tpl->grp_lock);
+    }
+}
+
+/* Get the request template, creating it when necessary. Template is only
+ * used for requests within established dialog.
+ */
+static struct dlg_req_tpl *get_req_tpl(pjsip_dialog *dlg)
+{
+    struct dlg_req_tpl *tpl;
+
+    if (dlg->state != PJSIP_DIALOG_STATE_ESTABLISHED ||
+	dlg->remote.info->tag.slen == 0)
+    {
+	return NULL;
+    }
+
+    tpl = (struct dlg_req_tpl*) dlg->req_tpl;
+    if (tpl && tpl_is_valid(dlg, tpl))
+	return tpl;
+
+    release_req_tpl(dlg);
+    tpl = create_req_tpl(dlg);
+    dlg->req_tpl = tpl;
+    return tpl;
+}
+
+/* Copy template header to the request. The copy shares its values with
+ * the template header.
+ */
+static pjsip_hdr *tpl_copy_hdr(pj_pool_t *pool, const pjsip_hdr *hdr)
+{
+    const struct tpl_hdr_vptr *tv = (const struct tpl_hdr_vptr*) hdr->vptr;
+    pjsip_hdr *dst;
+
+    dst = (pjsip_hdr*) (*tv->orig->shallow_clone)(pool, hdr);
+    dst->vptr = hdr->vptr;
+    return dst;
+}
+
+/* Create request from the template. */
+static pj_status_t create_request_from_tpl( pjsip_dialog *dlg,
+					    struct dlg_req_tpl *tpl,
+					    const pjsip_method *method,
+					    int cseq,
+					    pj_bool_t with_contact,
+					    pjsip_tx_data **p_tdata)
+{
+    pjsip_tx_data *tdata;
+    pjsip_msg *msg;
+    pjsip_cseq_hdr *cseq_hdr;
+    pjsip_via_hdr *via;
+    const pjsip_hdr *hdr, *endpt_hdr;
+    pj_status_t status;
+
+    status = pjsip_endpt_create_tdata(dlg->endpt, &tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    pjsip_tx_data_add_ref(tdata);
+    *p_tdata = tdata;
+
+    /* The request shares memory with the template. */
+    pj_grp_lock_add_ref(tpl->grp_lock);
+    tdata->shared_grp_lock = tpl->grp_lock;
+
+    cseq_hdr = pjsip_cseq_hdr_create(tdata->pool);
+    cseq_hdr->cseq = cseq;
+    pjsip_method_copy(tdata->pool, &cseq_hdr->method, method);
+
+    msg = tdata->msg = pjsip_msg_create(tdata->pool, PJSIP_REQUEST_MSG);
+    pj_memcpy(&msg->line.req.method, &cseq_hdr->method,
+	      sizeof(cseq_hdr->method));
+    msg->line.req.uri = tpl->target;
+
+    /* Headers are added in the same order as init_request_throw() in
+     * sip_util.c, followed by the route set.
+     */
+    endpt_hdr = pjsip_endpt_get_request_headers(dlg->endpt)->next;
+    while (endpt_hdr != pjsip_endpt_get_request_headers(dlg->endpt)) {
+	pjsip_msg_add_hdr(msg, (pjsip_hdr*)
+			  pjsip_hdr_shallow_clone(tdata->pool, endpt_hdr));
+	endpt_hdr = endpt_hdr->next;
+    }
+
+    for (hdr=tpl->hdr_list.next; hdr!=&tpl->hdr_list; hdr=hdr->next) {
+	if (hdr == tpl->contact && !with_contact)
+	    continue;
+	pjsip_msg_add_hdr(msg, tpl_copy_hdr(tdata->pool, hdr));
+    }
+
+    pjsip_msg_add_hdr(msg, (pjsip_hdr*)cseq_hdr);
+
+    via = pjsip_via_hdr_create(tdata->pool);
+    via->rport_param = pjsip_cfg()->endpt.disable_rport ? -1 : 0;
+    pjsip_msg_insert_first_hdr(msg, (pjsip_hdr*)via);
+
+    for (hdr=tpl->route_list.next; hdr!=&tpl->route_list; hdr=hdr->next) {
+	pjsip_msg_add_hdr(msg, tpl_copy_hdr(tdata->pool, hdr));
+    }
+
+    PJ_LOG(5,(THIS_FILE, "%s created from template.",
+			 pjsip_tx_data_get_info(tdata)));
+
+    return PJ_SUCCESS;
+}
+
+#endif	/* PJSIP_DLG_USE_REQ_TEMPLATE */
+
+
+/*
+ * Invalidate request template.
+ */
+PJ_DEF(void) pjsip_dlg_invalidate_req_tpl( pjsip_dialog *dlg )
+{
+    PJ_ASSERT_ON_FAIL(dlg, return);
+
+#if PJSIP_DLG_USE_REQ_TEMPLATE
+    pjsip_dlg_inc_lock(dlg);
+    release_req_tpl(dlg);
+    pjsip_dlg_dec_lock(dlg);
+#endif
+}
+
+
 /*
  * Create a new request within dialog (i.e. after the dialog session has been
  * established). The construction of such requests follows the rule in
@@ -1055,6 +1509,9 @@ static pj_status_t dlg_create_request_throw( pjsip_dialog *dlg,
     pjsip_contact_hdr *contact;
     pjsip_route_hdr *route, *end_list;
     pj_status_t status;
+#if PJSIP_DLG_USE_REQ_TEMPLATE
+    struct dlg_req_tpl *tpl;
+#endif
 
     /* Contact Header field.
      * Contact can only be present in requests that establish dialog (in the
@@ -1065,6 +1522,20 @@ static pj_status_t dlg_create_request_throw( pjsip_dialog *dlg,
     else
 	contact = NULL;
 
+#if PJSIP_DLG_USE_REQ_TEMPLATE
+    /* Requests within established dialog are created from the template. */
+    tpl = get_req_tpl(dlg);
+    if (tpl) {
+	status = create_request_from_tpl(dlg, tpl, method, cseq,
+					 contact != NULL, p_tdata);
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	tdata = *p_tdata;
+	goto add_auth;
+    }
+#endif
+
     /*
      * Create the request by cloning from the headers in the
      * dialog.
@@ -1095,6 +1566,9 @@ static pj_status_t dlg_create_request_throw( pjsip_dialog *dlg,
 	pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)r);
     }
 
+#if PJSIP_DLG_USE_REQ_TEMPLATE
+add_auth:
+#endif
     /* Copy authorization headers, if request is not ACK or CANCEL. */
     if (method->id != PJSIP_ACK_METHOD && method->id != PJSIP_CANCEL_METHOD) {
 	status = pjsip_auth_clt_init_req( &dlg->auth_sess, tdata );
@@ -41,6 +41,94 @@
 #define MAX_METHODS   32
 
 
+/* Event queued to a dispatcher worker: an incoming message, a job, or
+ * an elapsed worker timer.
+ */
+typedef struct worker_job
+{
+    pjsip_rx_data	    *rdata;	/* Cloned message	    */
+    pjsip_endpt_job_cb	    *cb;
+    void		    *user_data;
+    pjsip_worker_timer	    *timer;
+    unsigned		     seq;	/* Timer sequence	    */
+} worker_job;
+
+/* Dispatcher worker. */
+typedef struct endpt_worker
+{
+    struct endpt_dispatcher *disp;
+    unsigned		     idx;
+    pj_thread_t		    *thread;
+    pj_mutex_t		    *mutex;
+    pj_sem_t		    *sem;
+    worker_job		    *queue;	/* Circular buffer	    */
+    unsigned		     head;
+    unsigned		     count;
+    unsigned		     processed;
+    unsigned		     dropped;
+} endpt_worker;
+
+/* Worker dispatcher. */
+typedef struct endpt_dispatcher
+{
+    pjsip_endpoint	    *endpt;
+    pj_pool_t		    *pool;
+    pjsip_endpt_dispatcher_param param;
+    long		     tls_id;
+    pj_bool_t		     quit;
+    unsigned		     rr_idx;	/* Round-robin index	    */
+    endpt_worker	    *workers;
+} endpt_dispatcher;
+
+
+#if PJSIP_ENDPT_HAS_MOD_STAT
+/* Module latency histogram: values below MOD_STAT_SUB usec have their own
+ * bucket, above that every power of two is split into MOD_STAT_SUB linear
+ * buckets (the HDR histogram layout), covering up to 2^24 usec.
+ */
+#define MOD_STAT_SUB_BITS   2
+#define MOD_STAT_SUB	    (1 << MOD_STAT_SUB_BITS)
+#define MOD_STAT_BUCKETS    ((24 - MOD_STAT_SUB_BITS + 1) * MOD_STAT_SUB)
+
+/* Statistic types: request methods, and responses. */
+#define MOD_STAT_RESPONSE   (PJSIP_OTHER_METHOD + 1)
+#define MOD_STAT_TYPES	    (PJSIP_OTHER_METHOD + 2)
+
+typedef struct mod_stat_hist
+{
+    pj_uint32_t		     count;
+    pj_uint32_t		     consumed;
+    pj_uint64_t		     total;	/* usec			    */
+    pj_uint32_t		     max;
+    pj_uint32_t		     bucket[MOD_STAT_BUCKETS];
+} mod_stat_hist;
+
+/* Histograms updated by one thread without locking. When the thread
+ * exits, the next new thread takes them over and keeps adding to them.
+ */
+typedef struct mod_stat_thread
+{
+    PJ_DECL_LIST_MEMBER(struct mod_stat_thread);
+    struct endpt_mod_stat   *ms;
+    pj_bool_t		     in_use;
+    mod_stat_hist	    *hist[PJSIP_MAX_MODULE][MOD_STAT_TYPES];
+} mod_stat_thread;
+
+/* Per module latency statistics, allocated when first enabled. The
+ * statistics are the sum of the histograms of all threads. The mutex
+ * protects the thread list and the allocation of histograms.
+ */
+typedef struct endpt_mod_stat
+{
+    pj_pool_t		    *pool;
+    pj_mutex_t		    *mutex;
+    long		     tls;
+    pj_bool_t		     enabled;
+    mod_stat_thread	     thread_list;
+} endpt_mod_stat;
+#endif
+
+
 /* List of SIP endpoint exit callback. */
 typedef struct exit_cb
 {
@@ -98,6 +186,26 @@ struct pjsip_endpoint
 
     /** List of exit callback. */
     exit_cb		 exit_cb_list;
+
+    /** Worker dispatcher, NULL when not started. */
+    endpt_dispatcher	*dispatcher;
+
+    /** Dispatcher lock, held for reading while the dispatcher is used. */
+    pj_rwmutex_t	*disp_lock;
+
+    /** Admission callback for incoming messages. */
+    pjsip_endpt_admission_cb *admission_cb;
+
+    /** Load counters, see pjsip_endpt_get_load(). */
+    pj_atomic_t		*poll_cnt;
+    pj_atomic_t		*busy_poll_cnt;
+    pj_atomic_t		*rx_msg_cnt;
+    pj_atomic_t		*rx_latency;
+
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    /** Module latency statistics, NULL when never enabled. */
+    endpt_mod_stat	*mod_stat;
+#endif
 };
 
 
@@ -109,6 +217,10 @@ struct pjsip_endpoint
 #   define UNLOCK_MODULE_ACCESS(endpt)
 #endif
 
+/* The dispatcher can't be stopped while this lock is held */
+#define LOCK_DISPATCHER(ept)	pj_rwmutex_lock_read(ept->disp_lock)
+#define UNLOCK_DISPATCHER(ept)	pj_rwmutex_unlock_read(ept->disp_lock)
+
 
 
 /*
@@ -120,6 +232,9 @@ static pj_status_t endpt_on_tx_msg( pjsip_endpoint *endpt,
 				    pjsip_tx_data *tdata );
 static pj_status_t unload_module(pjsip_endpoint *endpt,
 				 pjsip_module *mod);
+#if PJSIP_ENDPT_HAS_MOD_STAT
+static void mod_stat_clear(pjsip_endpoint *endpt, int mod_id);
+#endif
 
 /* Defined in sip_parser.c */
 void init_sip_parser(void);
@@ -287,6 +402,11 @@ static pj_status_t unload_module(pjsip_endpoint *endpt,
     /* Remove module from array. */
     endpt->modules[mod->id] = NULL;
 
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    /* The module ID may be reused by another module */
+    mod_stat_clear(endpt, mod->id);
+#endif
+
     /* Remove module from list. */
     pj_list_erase(mod);
 
@@ -465,6 +585,11 @@ PJ_DEF(pj_status_t) pjsip_endpt_create(pj_pool_factory *pf,
     if (status != PJ_SUCCESS)
 	goto on_error;
 
+    /* Create R/W mutex for the dispatcher. */
+    status = pj_rwmutex_create(endpt->pool, "dsp%p", &endpt->disp_lock);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
     /* Init parser. */
     init_sip_parser();
 
@@ -485,6 +610,15 @@ PJ_DEF(pj_status_t) pjsip_endpt_create(pj_pool_factory *pf,
 	goto on_error;
     }
 
+    /* Create load counters. */
+    if ((status=pj_atomic_create(endpt->pool, 0, &endpt->poll_cnt)) != 0 ||
+	(status=pj_atomic_create(endpt->pool, 0, &endpt->busy_poll_cnt)) != 0 ||
+	(status=pj_atomic_create(endpt->pool, 0, &endpt->rx_msg_cnt)) != 0 ||
+	(status=pj_atomic_create(endpt->pool, 0, &endpt->rx_latency)) != 0)
+    {
+	goto on_error;
+    }
+
     /* Create timer heap to manage all timers within this endpoint. */
     status = pj_timer_heap_create( endpt->pool, PJSIP_MAX_TIMER_COUNT, 
                                    &endpt->timer_heap);
@@ -558,7 +692,19 @@ on_error:
 	pj_mutex_destroy(endpt->mutex);
 	endpt->mutex = NULL;
     }
+    if (endpt->poll_cnt)
+	pj_atomic_destroy(endpt->poll_cnt);
+    if (endpt->busy_poll_cnt)
+	pj_atomic_destroy(endpt->busy_poll_cnt);
+    if (endpt->rx_msg_cnt)
+	pj_atomic_destroy(endpt->rx_msg_cnt);
+    if (endpt->rx_latency)
+	pj_atomic_destroy(endpt->rx_latency);
     deinit_sip_parser();
+    if (endpt->disp_lock) {
+	pj_rwmutex_destroy(endpt->disp_lock);
+	endpt->disp_lock = NULL;
+    }
     if (endpt->mod_mutex) {
 	pj_rwmutex_destroy(endpt->mod_mutex);
 	endpt->mod_mutex = NULL;
@@ -579,6 +725,9 @@ PJ_DEF(void) pjsip_endpt_destroy(pjsip_endpoint *endpt)
 
     PJ_LOG(5, (THIS_FILE, "Destroying endpoing instance.."));
 
+    /* Stop the dispatcher workers before the modules go away */
+    pjsip_endpt_stop_dispatcher(endpt);
+
     /* Phase 1: stop all modules */
     mod = endpt->module_list.prev;
     while (mod != &endpt->module_list) {
@@ -622,9 +771,27 @@ PJ_DEF(void) pjsip_endpt_destroy(pjsip_endpoint *endpt)
     /* Delete endpoint mutex. */
     pj_mutex_destroy(endpt->mutex);
 
+    /* Delete load counters. */
+    pj_atomic_destroy(endpt->poll_cnt);
+    pj_atomic_destroy(endpt->busy_poll_cnt);
+    pj_atomic_destroy(endpt->rx_msg_cnt);
+    pj_atomic_destroy(endpt->rx_latency);
+
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    /* Delete module statistics. */
+    if (endpt->mod_stat) {
+	pj_thread_local_free(endpt->mod_stat->tls);
+	pj_mutex_destroy(endpt->mod_stat->mutex);
+	pj_pool_release(endpt->mod_stat->pool);
+    }
+#endif
+
     /* Deinit parser */
     deinit_sip_parser();
 
+    /* Delete dispatcher's mutex */
+    pj_rwmutex_destroy(endpt->disp_lock);
+
     /* Delete module's mutex */
     pj_rwmutex_destroy(endpt->mod_mutex);
 
@@ -736,9 +903,29 @@ PJ_DEF(pj_status_t) pjsip_endpt_handle_events2(pjsip_endpoint *endpt,
      *   reported by ioqueue for the send() completion. If we don't poll
      *   the ioqueue often enough, the send() completion will not be
      *   reported in timely manner.
+     *
+     * While an admission callback is installed (i.e. the overload control
+     * is active), the ioqueue is polled without waiting first, and only if
+     * there is no pending event the poll is repeated with the timeout.
+     * Polls which find events already pending tell that packets are
+     * queueing up in the sockets, see pjsip_endpt_get_load().
      */
     do {
-	c = pj_ioqueue_poll( endpt->ioqueue, &timeout);
+	pj_bool_t waited = PJ_TRUE;
+
+	if (endpt->admission_cb) {
+	    const pj_time_val no_wait = { 0, 0 };
+
+	    c = pj_ioqueue_poll( endpt->ioqueue, &no_wait);
+	    if (c == 0 && (timeout.sec != 0 || timeout.msec != 0))
+		c = pj_ioqueue_poll( endpt->ioqueue, &timeout);
+	    else
+		waited = PJ_FALSE;
+	    pj_atomic_inc(endpt->poll_cnt);
+	} else {
+	    c = pj_ioqueue_poll( endpt->ioqueue, &timeout);
+	}
+
 	if (c < 0) {
 	    pj_status_t err = pj_get_netos_error();
 	    pj_thread_sleep(PJ_TIME_VAL_MSEC(timeout));
@@ -748,6 +935,8 @@ PJ_DEF(pj_status_t) pjsip_endpt_handle_events2(pjsip_endpoint *endpt,
 	} else if (c == 0) {
 	    break;
 	} else {
+	    if (!waited)
+		pj_atomic_inc(endpt->busy_poll_cnt);
 	    net_event_count += c;
 	    timeout.sec = timeout.msec = 0;
 	}
@@ -819,6 +1008,297 @@ PJ_DEF(void) pjsip_process_rdata_param_default(pjsip_process_rdata_param *p)
     pj_bzero(p, sizeof(*p));
 }
 
+#if PJSIP_ENDPT_HAS_MOD_STAT
+/* Get histogram bucket of a latency value. */
+static unsigned mod_stat_bucket(pj_uint32_t usec)
+{
+    unsigned msb = MOD_STAT_SUB_BITS;
+    unsigned idx;
+
+    if (usec < MOD_STAT_SUB)
+	return usec;
+
+    while (usec >> (msb + 1))
+	++msb;
+
+    idx = (msb - MOD_STAT_SUB_BITS + 1) * MOD_STAT_SUB +
+	  ((usec >> (msb - MOD_STAT_SUB_BITS)) & (MOD_STAT_SUB - 1));
+    return idx < MOD_STAT_BUCKETS ? idx : MOD_STAT_BUCKETS - 1;
+}
+
+/* Get the highest latency value that falls in the bucket. */
+static pj_uint32_t mod_stat_bucket_max(unsigned idx)
+{
+    unsigned shift;
+
+    if (idx < MOD_STAT_SUB)
+	return idx;
+
+    shift = idx / MOD_STAT_SUB - 1;
+    return ((MOD_STAT_SUB + idx % MOD_STAT_SUB + 1) << shift) - 1;
+}
+
+/* Give the histograms of an exiting thread to the next new thread. */
+static void mod_stat_on_thread_exit(void *value)
+{
+    mod_stat_thread *t = (mod_stat_thread*)value;
+
+    pj_mutex_lock(t->ms->mutex);
+    t->in_use = PJ_FALSE;
+    pj_mutex_unlock(t->ms->mutex);
+}
+
+/* Get the histograms of the calling thread. */
+static mod_stat_thread *mod_stat_get_thread(endpt_mod_stat *ms)
+{
+    mod_stat_thread *t;
+
+    t = (mod_stat_thread*) pj_thread_local_get(ms->tls);
+    if (t)
+	return t;
+
+    pj_mutex_lock(ms->mutex);
+    for (t=ms->thread_list.next; t!=&ms->thread_list; t=t->next) {
+	if (!t->in_use)
+	    break;
+    }
+    if (t == &ms->thread_list) {
+	t = PJ_POOL_ZALLOC_T(ms->pool, mod_stat_thread);
+	t->ms = ms;
+	pj_list_push_back(&ms->thread_list, t);
+    }
+    t->in_use = PJ_TRUE;
+    pj_mutex_unlock(ms->mutex);
+
+    pj_thread_local_set(ms->tls, t);
+    return t;
+}
+
+/* Record the latency of a module callback. */
+static void mod_stat_update(endpt_mod_stat *ms, int mod_id, unsigned type,
+			    const pj_timestamp *start, pj_bool_t handled)
+{
+    mod_stat_thread *t;
+    mod_stat_hist *h;
+    pj_timestamp now;
+    pj_uint32_t usec;
+
+    pj_get_timestamp(&now);
+    usec = pj_elapsed_usec(start, &now);
+
+    t = mod_stat_get_thread(ms);
+    h = t->hist[mod_id][type];
+    if (!h) {
+	pj_mutex_lock(ms->mutex);
+	h = PJ_POOL_ZALLOC_T(ms->pool, mod_stat_hist);
+	t->hist[mod_id][type] = h;
+	pj_mutex_unlock(ms->mutex);
+    }
+
+    ++h->count;
+    if (handled)
+	++h->consumed;
+    h->total += usec;
+    if (usec > h->max)
+	h->max = usec;
+    ++h->bucket[mod_stat_bucket(usec)];
+}
+
+/* Clear the statistics of a module. Updates that run at the same time
+ * may survive the clearing.
+ */
+static void mod_stat_clear(pjsip_endpoint *endpt, int mod_id)
+{
+    endpt_mod_stat *ms = endpt->mod_stat;
+    mod_stat_thread *t;
+    unsigned i;
+
+    if (!ms)
+	return;
+
+    pj_mutex_lock(ms->mutex);
+    for (t=ms->thread_list.next; t!=&ms->thread_list; t=t->next) {
+	for (i=0; i<MOD_STAT_TYPES; ++i) {
+	    if (t->hist[mod_id][i])
+		pj_bzero(t->hist[mod_id][i], sizeof(mod_stat_hist));
+	}
+    }
+    pj_mutex_unlock(ms->mutex);
+}
+
+/* Sum the histograms of all threads. Statistics mutex must be held. */
+static void mod_stat_sum(endpt_mod_stat *ms, int mod_id, unsigned type,
+			 mod_stat_hist *sum)
+{
+    mod_stat_thread *t;
+    unsigned i;
+
+    pj_bzero(sum, sizeof(*sum));
+    for (t=ms->thread_list.next; t!=&ms->thread_list; t=t->next) {
+	const mod_stat_hist *h = t->hist[mod_id][type];
+
+	if (!h)
+	    continue;
+
+	sum->count += h->count;
+	sum->consumed += h->consumed;
+	sum->total += h->total;
+	if (h->max > sum->max)
+	    sum->max = h->max;
+	for (i=0; i<MOD_STAT_BUCKETS; ++i)
+	    sum->bucket[i] += h->bucket[i];
+    }
+}
+
+/* Calculate the summary of a histogram. */
+static void mod_stat_calc(const mod_stat_hist *h, pjsip_endpt_mod_stat *stat)
+{
+    const unsigned pct[3] = { 50, 90, 99 };
+    pj_uint32_t *val[3];
+    pj_uint32_t sum = 0;
+    unsigned i, p = 0;
+
+    pj_bzero(stat, sizeof(*stat));
+    if (!h || h->count == 0)
+	return;
+
+    stat->count = h->count;
+    stat->consumed = h->consumed;
+    stat->avg = (pj_uint32_t)(h->total / h->count);
+    stat->max = h->max;
+
+    val[0] = &stat->p50;
+    val[1] = &stat->p90;
+    val[2] = &stat->p99;
+    for (i=0; i<MOD_STAT_BUCKETS && p<3; ++i) {
+	sum += h->bucket[i];
+	while (p < 3 && (pj_uint64_t)sum * 100 >=
+			(pj_uint64_t)h->count * pct[p])
+	{
+	    pj_uint32_t v = mod_stat_bucket_max(i);
+	    *val[p++] = v < h->max ? v : h->max;
+	}
+    }
+}
+#endif	/* PJSIP_ENDPT_HAS_MOD_STAT */
+
+
+PJ_DEF(pj_status_t) pjsip_endpt_enable_mod_stat(pjsip_endpoint *endpt,
+						pj_bool_t enable)
+{
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    pj_status_t status = PJ_SUCCESS;
+
+    PJ_ASSERT_RETURN(endpt, PJ_EINVAL);
+
+    pj_mutex_lock(endpt->mutex);
+
+    if (!endpt->mod_stat && enable) {
+	pj_pool_t *pool;
+	endpt_mod_stat *ms;
+
+	pool = pjsip_endpt_create_pool(endpt, "modstat%p", 4000, 4000);
+	if (!pool) {
+	    status = PJ_ENOMEM;
+	    goto on_return;
+	}
+	ms = PJ_POOL_ZALLOC_T(pool, endpt_mod_stat);
+	ms->pool = pool;
+	pj_list_init(&ms->thread_list);
+	status = pj_mutex_create_simple(pool, "modstat%p", &ms->mutex);
+	if (status != PJ_SUCCESS) {
+	    pj_pool_release(pool);
+	    goto on_return;
+	}
+
+	/* Without thread exit callbacks, every new thread gets new
+	 * histograms.
+	 */
+	status = pj_thread_local_alloc2(&ms->tls, &mod_stat_on_thread_exit);
+	if (status == PJ_ENOTSUP)
+	    status = pj_thread_local_alloc(&ms->tls);
+	if (status != PJ_SUCCESS) {
+	    pj_mutex_destroy(ms->mutex);
+	    pj_pool_release(pool);
+	    goto on_return;
+	}
+	endpt->mod_stat = ms;
+    }
+
+    if (endpt->mod_stat)
+	endpt->mod_stat->enabled = enable;
+
+on_return:
+    pj_mutex_unlock(endpt->mutex);
+    return status;
+#else
+    PJ_UNUSED_ARG(endpt);
+    PJ_UNUSED_ARG(enable);
+    return PJ_ENOTSUP;
+#endif
+}
+
+
+PJ_DEF(void) pjsip_endpt_reset_mod_stat(pjsip_endpoint *endpt)
+{
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    unsigned i;
+
+    PJ_ASSERT_ON_FAIL(endpt, return);
+
+    for (i=0; i<PJSIP_MAX_MODULE; ++i)
+	mod_stat_clear(endpt, i);
+#else
+    PJ_UNUSED_ARG(endpt);
+#endif
+}
+
+
+PJ_DEF(pj_status_t) pjsip_endpt_get_mod_stat(pjsip_endpoint *endpt,
+					     const pjsip_module *mod,
+					     pjsip_msg_type_e msg_type,
+					     pjsip_method_e method,
+					     pjsip_endpt_mod_stat *stat)
+{
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    endpt_mod_stat *ms;
+    mod_stat_hist sum;
+    unsigned type;
+
+    PJ_ASSERT_RETURN(endpt && mod && stat, PJ_EINVAL);
+    PJ_ASSERT_RETURN(mod->id >= 0 && mod->id < PJSIP_MAX_MODULE, PJ_EINVAL);
+
+    if (msg_type == PJSIP_RESPONSE_MSG)
+	type = MOD_STAT_RESPONSE;
+    else if (method <= PJSIP_OTHER_METHOD)
+	type = method;
+    else
+	type = PJSIP_OTHER_METHOD;
+
+    ms = endpt->mod_stat;
+    if (!ms) {
+	pj_bzero(stat, sizeof(*stat));
+	return PJ_SUCCESS;
+    }
+
+    pj_mutex_lock(ms->mutex);
+    mod_stat_sum(ms, mod->id, type, &sum);
+    pj_mutex_unlock(ms->mutex);
+
+    mod_stat_calc(&sum, stat);
+
+    return PJ_SUCCESS;
+#else
+    PJ_UNUSED_ARG(endpt);
+    PJ_UNUSED_ARG(mod);
+    PJ_UNUSED_ARG(msg_type);
+    PJ_UNUSED_ARG(method);
+    PJ_UNUSED_ARG(stat);
+    return PJ_ENOTSUP;
+#endif
+}
+
+
 /* Distribute rdata */
 PJ_DEF(pj_status_t) pjsip_endpt_process_rx_data( pjsip_endpoint *endpt,
                                                  pjsip_rx_data *rdata,
@@ -830,6 +1310,11 @@ PJ_DEF(pj_status_t) pjsip_endpt_process_rx_data( pjsip_endpoint *endpt,
     pjsip_module *mod;
     pj_bool_t handled = PJ_FALSE;
     unsigned i;
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    endpt_mod_stat *ms = NULL;
+    unsigned stat_type = 0;
+    pj_timestamp start;
+#endif
     pj_status_t status;
 
     PJ_ASSERT_RETURN(endpt && rdata, PJ_EINVAL);
@@ -879,19 +1364,50 @@ PJ_DEF(pj_status_t) pjsip_endpt_process_rx_data( pjsip_endpoint *endpt,
 	goto on_return;
     }
 
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    if (endpt->mod_stat && endpt->mod_stat->enabled) {
+	ms = endpt->mod_stat;
+	if (msg->type == PJSIP_REQUEST_MSG) {
+	    stat_type = msg->line.req.method.id;
+	    if (stat_type > PJSIP_OTHER_METHOD)
+		stat_type = PJSIP_OTHER_METHOD;
+	} else {
+	    stat_type = MOD_STAT_RESPONSE;
+	}
+    }
+#endif
+
     /* Distribute */
     if (msg->type == PJSIP_REQUEST_MSG) {
 	do {
-	    if (mod->on_rx_request)
+	    if (mod->on_rx_request) {
+#if PJSIP_ENDPT_HAS_MOD_STAT
+		if (ms)
+		    pj_get_timestamp(&start);
+#endif
 		handled = (*mod->on_rx_request)(rdata);
+#if PJSIP_ENDPT_HAS_MOD_STAT
+		if (ms)
+		    mod_stat_update(ms, mod->id, stat_type, &start, handled);
+#endif
+	    }
 	    if (handled)
 		break;
 	    mod = mod->next;
 	} while (mod != &endpt->module_list);
     } else {
 	do {
-	    if (mod->on_rx_response)
+	    if (mod->on_rx_response) {
+#if PJSIP_ENDPT_HAS_MOD_STAT
+		if (ms)
+		    pj_get_timestamp(&start);
+#endif
 		handled = (*mod->on_rx_response)(rdata);
+#if PJSIP_ENDPT_HAS_MOD_STAT
+		if (ms)
+		    mod_stat_update(ms, mod->id, stat_type, &start, handled);
+#endif
+	    }
 	    if (handled)
 		break;
 	    mod = mod->next;
@@ -911,6 +1427,593 @@ on_return:
     return status;
 }
 
+
+/* Account the latency of a processed incoming message. */
+static void update_rx_latency(pjsip_endpoint *endpt,
+			      const pjsip_rx_data *rdata)
+{
+    pj_time_val now;
+    long msec;
+
+    pj_gettimeofday(&now);
+    PJ_TIME_VAL_SUB(now, rdata->pkt_info.timestamp);
+    msec = PJ_TIME_VAL_MSEC(now);
+
+    pj_atomic_inc(endpt->rx_msg_cnt);
+
+    /* Transport may not set the arrival time */
+    if (msec > 0 && rdata->pkt_info.timestamp.sec != 0)
+	pj_atomic_add(endpt->rx_latency, msec);
+}
+
+
+/*****************************************************************************
+ * Worker dispatcher.
+ */
+
+PJ_DEF(void) pjsip_endpt_dispatcher_param_default(
+					pjsip_endpt_dispatcher_param *param)
+{
+    pj_bzero(param, sizeof(*param));
+    param->worker_cnt = 4;
+    param->queue_size = PJSIP_ENDPT_WORKER_QUEUE_SIZE;
+}
+
+
+/* Queue an event to the worker. */
+static pj_status_t worker_post(endpt_worker *w, const worker_job *job)
+{
+    endpt_dispatcher *disp = w->disp;
+
+    pj_mutex_lock(w->mutex);
+    if (disp->quit || w->count == disp->param.queue_size) {
+	++w->dropped;
+	pj_mutex_unlock(w->mutex);
+	return PJ_ETOOMANY;
+    }
+    w->queue[(w->head + w->count) % disp->param.queue_size] = *job;
+    ++w->count;
+    pj_mutex_unlock(w->mutex);
+
+    pj_sem_post(w->sem);
+    return PJ_SUCCESS;
+}
+
+
+/* Select the worker for the key. Empty key selects round-robin; the
+ * round-robin index is not protected, which is fine since it's only a hint.
+ */
+static unsigned worker_select(endpt_dispatcher *disp, const pj_str_t *key)
+{
+    if (key && key->slen)
+	return pj_hash_calc(0, key->ptr, (unsigned)key->slen) %
+	       disp->param.worker_cnt;
+
+    return disp->rr_idx++ % disp->param.worker_cnt;
+}
+
+
+/* Process one event in the worker thread. */
+static void worker_process(endpt_worker *w, worker_job *job)
+{
+    pjsip_endpoint *endpt = w->disp->endpt;
+
+    if (job->rdata) {
+	pjsip_process_rdata_param proc_prm;
+	pj_bool_t handled = PJ_FALSE;
+
+	pjsip_process_rdata_param_default(&proc_prm);
+	proc_prm.silent = PJ_TRUE;
+
+	pjsip_endpt_process_rx_data(endpt, job->rdata, &proc_prm, &handled);
+	if (endpt->admission_cb)
+	    update_rx_latency(endpt, job->rdata);
+
+	if (!handled) {
+	    PJ_LOG(4,(THIS_FILE, "%s from %s:%d was dropped/unhandled by"
+				 " any modules",
+				 pjsip_rx_data_get_info(job->rdata),
+				 job->rdata->pkt_info.src_name,
+				 job->rdata->pkt_info.src_port));
+	}
+	pjsip_rx_data_free_cloned(job->rdata);
+
+    } else if (job->timer) {
+	(*job->timer->cb)(endpt, job->timer);
+
+    } else {
+	(*job->cb)(endpt, job->user_data);
+    }
+}
+
+
+static int PJ_THREAD_FUNC worker_thread(void *arg)
+{
+    endpt_worker *w = (endpt_worker*) arg;
+    endpt_dispatcher *disp = w->disp;
+
+    pj_thread_local_set(disp->tls_id, w);
+
+    for (;;) {
+	worker_job job;
+
+	pj_sem_wait(w->sem);
+	if (disp->quit)
+	    break;
+
+	pj_mutex_lock(w->mutex);
+	if (w->count == 0) {
+	    pj_mutex_unlock(w->mutex);
+	    continue;
+	}
+	job = w->queue[w->head];
+	w->head = (w->head + 1) % disp->param.queue_size;
+	--w->count;
+
+	/* Skip timer which has been cancelled or rescheduled */
+	if (job.timer && job.timer->seq != job.seq) {
+	    pj_mutex_unlock(w->mutex);
+	    continue;
+	}
+	++w->processed;
+	pj_mutex_unlock(w->mutex);
+
+	worker_process(w, &job);
+    }
+
+    return 0;
+}
+
+
+/*
+ * Start worker dispatcher.
+ */
+PJ_DEF(pj_status_t) pjsip_endpt_start_dispatcher(
+				    pjsip_endpoint *endpt,
+				    const pjsip_endpt_dispatcher_param *param)
+{
+    endpt_dispatcher *disp;
+    pj_pool_t *pool;
+    unsigned i;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(endpt, PJ_EINVAL);
+    PJ_ASSERT_RETURN(!param || (param->worker_cnt && param->queue_size),
+		     PJ_EINVAL);
+    PJ_ASSERT_RETURN(endpt->dispatcher == NULL, PJ_EEXISTS);
+
+    pool = pjsip_endpt_create_pool(endpt, "dispatcher", 1000, 1000);
+    if (!pool)
+	return PJ_ENOMEM;
+
+    disp = PJ_POOL_ZALLOC_T(pool, endpt_dispatcher);
+    disp->endpt = endpt;
+    disp->pool = pool;
+    disp->tls_id = -1;
+    if (param)
+	pj_memcpy(&disp->param, param, sizeof(*param));
+    else
+	pjsip_endpt_dispatcher_param_default(&disp->param);
+
+    status = pj_thread_local_alloc(&disp->tls_id);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    disp->workers = (endpt_worker*)
+		    pj_pool_calloc(pool, disp->param.worker_cnt,
+				   sizeof(endpt_worker));
+    for (i=0; i<disp->param.worker_cnt; ++i) {
+	endpt_worker *w = &disp->workers[i];
+
+	w->disp = disp;
+	w->idx = i;
+	w->queue = (worker_job*)
+		   pj_pool_calloc(pool, disp->param.queue_size,
+				  sizeof(worker_job));
+
+	status = pj_mutex_create_simple(pool, "dspw%p", &w->mutex);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	status = pj_sem_create(pool, "dspw%p", 0, disp->param.queue_size + 1,
+			       &w->sem);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    for (i=0; i<disp->param.worker_cnt; ++i) {
+	endpt_worker *w = &disp->workers[i];
+
+	status = pj_thread_create(pool, "sipwrk%p", &worker_thread, w,
+				  0, 0, &w->thread);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    pj_rwmutex_lock_write(endpt->disp_lock);
+    endpt->dispatcher = disp;
+    pj_rwmutex_unlock_write(endpt->disp_lock);
+
+    PJ_LOG(4,(THIS_FILE, "Dispatcher started with %d workers",
+	      disp->param.worker_cnt));
+    return PJ_SUCCESS;
+
+on_error:
+    disp->quit = PJ_TRUE;
+    for (i=0; i<disp->param.worker_cnt; ++i) {
+	endpt_worker *w = &disp->workers[i];
+	if (w->thread) {
+	    pj_sem_post(w->sem);
+	    pj_thread_join(w->thread);
+	    pj_thread_destroy(w->thread);
+	}
+	if (w->sem)
+	    pj_sem_destroy(w->sem);
+	if (w->mutex)
+	    pj_mutex_destroy(w->mutex);
+    }
+    if (disp->tls_id != -1)
+	pj_thread_local_free(disp->tls_id);
+    pj_pool_release(pool);
+    return status;
+}
+
+
+/*
+ * Stop worker dispatcher.
+ */
+PJ_DEF(pj_status_t) pjsip_endpt_stop_dispatcher(pjsip_endpoint *endpt)
+{
+    endpt_dispatcher *disp;
+    unsigned i;
+
+    PJ_ASSERT_RETURN(endpt, PJ_EINVAL);
+
+    /* Wait until no other thread is using the dispatcher, and detach it
+     * so that new events are processed without the workers.
+     */
+    pj_rwmutex_lock_write(endpt->disp_lock);
+    disp = endpt->dispatcher;
+    if (!disp) {
+	pj_rwmutex_unlock_write(endpt->disp_lock);
+	return PJ_SUCCESS;
+    }
+
+    if (pj_thread_local_get(disp->tls_id) != NULL) {
+	pj_rwmutex_unlock_write(endpt->disp_lock);
+	pj_assert(!"Dispatcher can't be stopped from a worker thread");
+	return PJ_EINVALIDOP;
+    }
+
+    /* Stop accepting new events */
+    for (i=0; i<disp->param.worker_cnt; ++i) {
+	pj_mutex_lock(disp->workers[i].mutex);
+	disp->quit = PJ_TRUE;
+	pj_mutex_unlock(disp->workers[i].mutex);
+    }
+    endpt->dispatcher = NULL;
+    pj_rwmutex_unlock_write(endpt->disp_lock);
+
+    for (i=0; i<disp->param.worker_cnt; ++i) {
+	endpt_worker *w = &disp->workers[i];
+
+	pj_sem_post(w->sem);
+	pj_thread_join(w->thread);
+	pj_thread_destroy(w->thread);
+
+	/* Discard pending messages and timers. Jobs are run here, since
+	 * they may hold references (such as transaction timer events).
+	 */
+	while (w->count) {
+	    worker_job job = w->queue[w->head];
+	    w->head = (w->head + 1) % disp->param.queue_size;
+	    --w->count;
+	    if (job.rdata) {
+		pjsip_rx_data_free_cloned(job.rdata);
+		++w->dropped;
+	    } else if (job.timer) {
+		++w->dropped;
+	    } else {
+		++w->processed;
+		(*job.cb)(endpt, job.user_data);
+	    }
+	}
+
+	pj_sem_destroy(w->sem);
+	pj_mutex_destroy(w->mutex);
+    }
+
+    pj_thread_local_free(disp->tls_id);
+    pj_pool_release(disp->pool);
+
+    PJ_LOG(4,(THIS_FILE, "Dispatcher stopped"));
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(unsigned) pjsip_endpt_get_worker_cnt(pjsip_endpoint *endpt)
+{
+    unsigned cnt;
+
+    PJ_ASSERT_RETURN(endpt, 0);
+
+    LOCK_DISPATCHER(endpt);
+    cnt = endpt->dispatcher ? endpt->dispatcher->param.worker_cnt : 0;
+    UNLOCK_DISPATCHER(endpt);
+
+    return cnt;
+}
+
+
+PJ_DEF(int) pjsip_endpt_get_current_worker(pjsip_endpoint *endpt)
+{
+    endpt_worker *w = NULL;
+
+    PJ_ASSERT_RETURN(endpt, -1);
+
+    LOCK_DISPATCHER(endpt);
+    if (endpt->dispatcher)
+	w = (endpt_worker*) pj_thread_local_get(endpt->dispatcher->tls_id);
+    UNLOCK_DISPATCHER(endpt);
+
+    return w ? (int)w->idx : -1;
+}
+
+
+/*
+ * Post job to the worker of the key.
+ */
+PJ_DEF(pj_status_t) pjsip_endpt_dispatch_job(pjsip_endpoint *endpt,
+					     const pj_str_t *key,
+					     pjsip_endpt_job_cb *cb,
+					     void *user_data)
+{
+    endpt_dispatcher *disp;
+    worker_job job;
+    pj_status_t status = PJ_SUCCESS;
+
+    PJ_ASSERT_RETURN(endpt && cb, PJ_EINVAL);
+
+    LOCK_DISPATCHER(endpt);
+    disp = endpt->dispatcher;
+    if (disp) {
+	pj_bzero(&job, sizeof(job));
+	job.cb = cb;
+	job.user_data = user_data;
+	status = worker_post(&disp->workers[worker_select(disp, key)], &job);
+    }
+    UNLOCK_DISPATCHER(endpt);
+
+    if (!disp)
+	(*cb)(endpt, user_data);
+
+    return status;
+}
+
+
+/*
+ * Get the worker of the key.
+ */
+PJ_DEF(int) pjsip_endpt_get_key_worker(pjsip_endpoint *endpt,
+				       const pj_str_t *key)
+{
+    int worker;
+
+    PJ_ASSERT_RETURN(endpt, -1);
+
+    LOCK_DISPATCHER(endpt);
+    worker = endpt->dispatcher ?
+	     (int)worker_select(endpt->dispatcher, key) : -1;
+    UNLOCK_DISPATCHER(endpt);
+
+    return worker;
+}
+
+
+/*
+ * Post job to the specified worker.
+ */
+PJ_DEF(pj_status_t) pjsip_endpt_dispatch_job_to(pjsip_endpoint *endpt,
+						int worker,
+						pjsip_endpt_job_cb *cb,
+						void *user_data)
+{
+    endpt_dispatcher *disp = NULL;
+    worker_job job;
+    pj_status_t status = PJ_SUCCESS;
+
+    PJ_ASSERT_RETURN(endpt && cb, PJ_EINVAL);
+
+    LOCK_DISPATCHER(endpt);
+    if (worker >= 0)
+	disp = endpt->dispatcher;
+    if (disp) {
+	pj_bzero(&job, sizeof(job));
+	job.cb = cb;
+	job.user_data = user_data;
+	status = worker_post(&disp->workers[(unsigned)worker %
+					    disp->param.worker_cnt], &job);
+    }
+    UNLOCK_DISPATCHER(endpt);
+
+    if (!disp)
+	(*cb)(endpt, user_data);
+
+    return status;
+}
+
+
+/* Queue incoming message to the worker. */
+static void dispatch_rx_data(endpt_dispatcher *disp, pjsip_rx_data *rdata)
+{
+    pj_str_t key = rdata->msg_info.cid->id;
+    worker_job job;
+    pj_status_t status;
+
+    if (disp->param.on_get_key)
+	(*disp->param.on_get_key)(rdata, &key);
+
+    pj_bzero(&job, sizeof(job));
+    status = pjsip_rx_data_clone(rdata, 0, &job.rdata);
+    if (status != PJ_SUCCESS) {
+	PJ_PERROR(2,(THIS_FILE, status, "Unable to clone %s",
+		     pjsip_rx_data_get_info(rdata)));
+	return;
+    }
+
+    status = worker_post(&disp->workers[worker_select(disp, &key)], &job);
+    if (status != PJ_SUCCESS) {
+	PJ_LOG(4,(THIS_FILE, "%s from %s:%d was dropped, worker queue is "
+			     "full",
+			     pjsip_rx_data_get_info(rdata),
+			     rdata->pkt_info.src_name,
+			     rdata->pkt_info.src_port));
+	pjsip_rx_data_free_cloned(job.rdata);
+    }
+}
+
+
+/* Elapsed worker timer, called by the thread that polls the timer heap. */
+static void worker_timer_cb(pj_timer_heap_t *th, pj_timer_entry *entry)
+{
+    pjsip_worker_timer *timer = (pjsip_worker_timer*) entry->user_data;
+    pjsip_endpoint *endpt = timer->endpt;
+    endpt_dispatcher *disp;
+    endpt_worker *w;
+    worker_job job;
+
+    LOCK_DISPATCHER(endpt);
+    disp = endpt->dispatcher;
+    if (!disp || timer->worker >= disp->param.worker_cnt) {
+	UNLOCK_DISPATCHER(endpt);
+	(*timer->cb)(endpt, timer);
+	return;
+    }
+
+    w = &disp->workers[timer->worker];
+    pj_bzero(&job, sizeof(job));
+    job.timer = timer;
+    pj_mutex_lock(w->mutex);
+    job.seq = timer->seq;
+    pj_mutex_unlock(w->mutex);
+
+    if (worker_post(w, &job) != PJ_SUCCESS) {
+	/* Worker is busy, try again shortly */
+	pj_time_val delay = { 0, 10 };
+	pj_timer_heap_schedule(th, entry, &delay);
+    }
+    UNLOCK_DISPATCHER(endpt);
+}
+
+
+PJ_DEF(void) pjsip_worker_timer_init(pjsip_worker_timer *timer,
+				     void *user_data,
+				     pjsip_worker_timer_cb *cb)
+{
+    pj_bzero(timer, sizeof(*timer));
+    timer->user_data = user_data;
+    timer->cb = cb;
+    pj_timer_entry_init(&timer->entry, 0, timer, &worker_timer_cb);
+}
+
+
+/* Invalidate events of the timer that are already queued. */
+static void worker_timer_invalidate(pjsip_worker_timer *timer)
+{
+    pjsip_endpoint *endpt = timer->endpt;
+    endpt_dispatcher *disp;
+
+    if (!endpt) {
+	++timer->seq;
+	return;
+    }
+
+    LOCK_DISPATCHER(endpt);
+    disp = endpt->dispatcher;
+    if (disp && timer->worker < disp->param.worker_cnt) {
+	endpt_worker *w = &disp->workers[timer->worker];
+	pj_mutex_lock(w->mutex);
+	++timer->seq;
+	pj_mutex_unlock(w->mutex);
+    } else {
+	++timer->seq;
+    }
+    UNLOCK_DISPATCHER(endpt);
+}
+
+
+PJ_DEF(pj_status_t) pjsip_endpt_schedule_worker_timer(
+					    pjsip_endpoint *endpt,
+					    pjsip_worker_timer *timer,
+					    const pj_str_t *key,
+					    const pj_time_val *delay)
+{
+    PJ_ASSERT_RETURN(endpt && timer && timer->cb && delay, PJ_EINVAL);
+
+    worker_timer_invalidate(timer);
+    timer->endpt = endpt;
+    LOCK_DISPATCHER(endpt);
+    timer->worker = endpt->dispatcher ?
+		    worker_select(endpt->dispatcher, key) : 0;
+    UNLOCK_DISPATCHER(endpt);
+
+    return pjsip_endpt_schedule_timer(endpt, &timer->entry, delay);
+}
+
+
+PJ_DEF(void) pjsip_endpt_cancel_worker_timer(pjsip_endpoint *endpt,
+					     pjsip_worker_timer *timer)
+{
+    PJ_ASSERT_ON_FAIL(endpt && timer, return);
+
+    pjsip_endpt_cancel_timer(endpt, &timer->entry);
+    worker_timer_invalidate(timer);
+}
+
+
+/*
+ * Get load counters.
+ */
+PJ_DEF(void) pjsip_endpt_get_load(pjsip_endpoint *endpt,
+				  pjsip_endpt_load *load)
+{
+    endpt_dispatcher *disp;
+
+    PJ_ASSERT_ON_FAIL(endpt && load, return);
+
+    pj_bzero(load, sizeof(*load));
+    load->poll_cnt = (pj_uint32_t) pj_atomic_get(endpt->poll_cnt);
+    load->busy_poll_cnt = (pj_uint32_t) pj_atomic_get(endpt->busy_poll_cnt);
+    load->rx_msg_cnt = (pj_uint32_t) pj_atomic_get(endpt->rx_msg_cnt);
+    load->rx_latency = (pj_uint32_t) pj_atomic_get(endpt->rx_latency);
+
+    LOCK_DISPATCHER(endpt);
+    disp = endpt->dispatcher;
+    if (disp) {
+	unsigned i;
+
+	for (i=0; i<disp->param.worker_cnt; ++i) {
+	    pj_mutex_lock(disp->workers[i].mutex);
+	    load->queued += disp->workers[i].count;
+	    pj_mutex_unlock(disp->workers[i].mutex);
+	}
+	load->queue_size = disp->param.worker_cnt * disp->param.queue_size;
+    }
+    UNLOCK_DISPATCHER(endpt);
+}
+
+
+/*
+ * Set admission callback.
+ */
+PJ_DEF(void) pjsip_endpt_set_admission_cb(pjsip_endpoint *endpt,
+					  pjsip_endpt_admission_cb *cb)
+{
+    PJ_ASSERT_ON_FAIL(endpt, return);
+    endpt->admission_cb = cb;
+}
+
+
 /*
  * This is the callback that is called by the transport manager when it 
  * receives a message from the network.
@@ -1030,10 +2133,32 @@ static void endpt_on_rx_msg( pjsip_endpoint *endpt,
     }
 #endif
 
+    /* Let the admission control reject the message before it takes any
+     * queue space or processing time.
+     */
+    if (endpt->admission_cb && !(*endpt->admission_cb)(endpt, rdata)) {
+	pj_bzero(&rdata->endpt_info, sizeof(rdata->endpt_info));
+	pj_log_pop_indent();
+	return;
+    }
+
+    /* Let the dispatcher worker process the message */
+    LOCK_DISPATCHER(endpt);
+    if (endpt->dispatcher) {
+	dispatch_rx_data(endpt->dispatcher, rdata);
+	UNLOCK_DISPATCHER(endpt);
+	pj_bzero(&rdata->endpt_info, sizeof(rdata->endpt_info));
+	pj_log_pop_indent();
+	return;
+    }
+    UNLOCK_DISPATCHER(endpt);
+
     pjsip_process_rdata_param_default(&proc_prm);
     proc_prm.silent = PJ_TRUE;
 
     pjsip_endpt_process_rx_data(endpt, rdata, &proc_prm, &handled);
+    if (endpt->admission_cb)
+	update_rx_latency(endpt, rdata);
 
     /* No module is able to handle the message */
     if (!handled) {
@@ -1283,8 +2408,69 @@ PJ_DEF(void) pjsip_endpt_dump( pjsip_endpoint *endpt, pj_bool_t detail )
 			pj_timer_heap_count(endpt->timer_heap)));
 #endif
 
+    /* Dispatcher workers. */
+    LOCK_DISPATCHER(endpt);
+    if (endpt->dispatcher) {
+	endpt_dispatcher *disp = endpt->dispatcher;
+	unsigned i;
+
+	PJ_LOG(3,(THIS_FILE, " Dispatcher has %u workers:",
+		  disp->param.worker_cnt));
+	for (i=0; i<disp->param.worker_cnt; ++i) {
+	    endpt_worker *w = &disp->workers[i];
+	    PJ_LOG(3,(THIS_FILE, "  worker %u: queued=%u, processed=%u, "
+				 "dropped=%u",
+		      i, w->count, w->processed, w->dropped));
+	}
+    }
+    UNLOCK_DISPATCHER(endpt);
+
     /* Unlock mutex. */
     pj_mutex_unlock(endpt->mutex);
+
+#if PJSIP_ENDPT_HAS_MOD_STAT
+    /* Module latency statistics, printed without the endpoint mutex
+     * since the module lock must be taken first.
+     */
+    if (endpt->mod_stat) {
+	static const char *type_names[MOD_STAT_TYPES] =
+	{
+	    "INVITE", "CANCEL", "ACK", "BYE", "REGISTER", "OPTIONS",
+	    "other", "response"
+	};
+	endpt_mod_stat *ms = endpt->mod_stat;
+	pjsip_module *mod;
+
+	PJ_LOG(3,(THIS_FILE, " Module latency statistics (%s), in usec:",
+		  (ms->enabled ? "on" : "off")));
+
+	LOCK_MODULE_ACCESS(endpt);
+	pj_mutex_lock(ms->mutex);
+	for (mod=endpt->module_list.next; mod!=&endpt->module_list;
+	     mod=mod->next)
+	{
+	    unsigned i;
+
+	    for (i=0; i<MOD_STAT_TYPES; ++i) {
+		pjsip_endpt_mod_stat stat;
+		mod_stat_hist sum;
+
+		mod_stat_sum(ms, mod->id, i, &sum);
+		mod_stat_calc(&sum, &stat);
+		if (stat.count == 0)
+		    continue;
+
+		PJ_LOG(3,(THIS_FILE, "  %-20.*s %-8s: count=%u, consumed=%u, "
+				     "avg=%u, p50=%u, p90=%u, p99=%u, max=%u",
+			  (int)mod->name.slen, mod->name.ptr, type_names[i],
+			  stat.count, stat.consumed, stat.avg, stat.p50,
+			  stat.p90, stat.p99, stat.max));
+	    }
+	}
+	pj_mutex_unlock(ms->mutex);
+	UNLOCK_MODULE_ACCESS(endpt);
+    }
+#endif
 #else
     PJ_UNUSED_ARG(endpt);
     PJ_UNUSED_ARG(detail);
@@ -71,6 +71,9 @@ static const struct
     PJ_BUILD_ERR( PJSIP_EBUFDESTROYED,	"Buffer destroyed"),
     PJ_BUILD_ERR( PJSIP_ETPNOTSUITABLE,	"Unsuitable transport selected"),
     PJ_BUILD_ERR( PJSIP_ETPNOTAVAIL,	"Transport not available for use"),
+    PJ_BUILD_ERR( PJSIP_ETPQUEUEFULL,	"Transport transmit queue is full"),
+    PJ_BUILD_ERR( PJSIP_EWSHANDSHAKE,	"WebSocket handshake failed"),
+    PJ_BUILD_ERR( PJSIP_EWSFRAME,	"Invalid WebSocket frame"),
 
     /* Transaction errors */
     PJ_BUILD_ERR( PJSIP_ETSXDESTROYED,	"Transaction has been destroyed"),
@@ -107,6 +110,7 @@ static const struct
     PJ_BUILD_ERR( PJSIP_EAUTHINNONCE,	   "Invalid nonce value in authentication challenge"),
     PJ_BUILD_ERR( PJSIP_EAUTHINAKACRED,	   "Invalid AKA credential"),
     PJ_BUILD_ERR( PJSIP_EAUTHNOCHAL,	   "No challenge is found"),
+    PJ_BUILD_ERR( PJSIP_EAUTHSTALENONCE,   "Stale or unknown nonce in authorization"),
 
     /* UA/dialog layer. */
     PJ_BUILD_ERR( PJSIP_EMISSINGTAG,	"Missing From/To tag parameter" ),
@@ -0,0 +1,529 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <pjsip/sip_overload.h>
+#include <pjsip/sip_endpoint.h>
+#include <pjsip/sip_module.h>
+#include <pjsip/sip_transaction.h>
+#include <pjsip/sip_util.h>
+#include <pjsip/sip_errno.h>
+#include <pj/assert.h>
+#include <pj/log.h>
+#include <pj/os.h>
+#include <pj/pool.h>
+#include <pj/rand.h>
+#include <pj/string.h>
+
+#define THIS_FILE	"sip_overload.c"
+
+/* Minimum number of polls in an interval for the busy poll ratio to be
+ * taken into account, so that a handful of polls of an idle endpoint
+ * does not look like overload.
+ */
+#define MIN_POLL_CNT	    50
+
+/* The overload level is only lowered when the pressure is below this
+ * percentage, to avoid oscillating around the threshold.
+ */
+#define LOW_PRESSURE	    80
+
+/* Maximum increment and decrement of the overload level per interval */
+#define LEVEL_INC_MAX	    20
+#define LEVEL_DEC	    5
+
+
+static pj_status_t mod_ovl_unload(void);
+static pj_status_t mod_ovl_on_tx_response(pjsip_tx_data *tdata);
+static void ovl_destroy(pjsip_endpoint *endpt);
+
+/* The module instance. */
+static struct mod_overload
+{
+    pjsip_module	 mod;
+    pjsip_endpoint	*endpt;
+    pj_pool_t		*pool;
+    pj_mutex_t		*mutex;
+    pjsip_overload_param param;
+    pj_timer_entry	 timer;
+
+    /* Cleared when the module is unloaded, the objects below are kept
+     * until the endpoint is destroyed, since on_admission() and on_timer()
+     * may still be running in other threads.
+     */
+    volatile pj_bool_t	 active;
+    pj_bool_t		 atexit_set;
+
+    /* Counters at the previous sample */
+    pjsip_endpt_load	 last_load;
+
+    /* Current overload level and RFC 7339 sequence number */
+    volatile unsigned	 level;
+    volatile unsigned	 seq;
+
+    /* Level accumulated by new requests, a request is rejected every
+     * time it reaches 100.
+     */
+    pj_atomic_t		*credit;
+    pj_atomic_t		*admitted;
+    pj_atomic_t		*rejected;
+
+    /* Last sample, protected by mutex */
+    pjsip_overload_stat	 stat;
+
+} mod_overload =
+{
+  {
+    NULL, NULL,		    /* prev, next.			*/
+    { "mod-overload", 12 }, /* Name.				*/
+    -1,			    /* Id				*/
+    PJSIP_MOD_PRIORITY_TRANSPORT_LAYER+1,   /* Priority		*/
+    NULL,		    /* load()				*/
+    NULL,		    /* start()				*/
+    NULL,		    /* stop()				*/
+    &mod_ovl_unload,	    /* unload()				*/
+    NULL,		    /* on_rx_request()			*/
+    NULL,		    /* on_rx_response()			*/
+    NULL,		    /* on_tx_request.			*/
+    &mod_ovl_on_tx_response,/* on_tx_response()			*/
+    NULL,		    /* on_tsx_state()			*/
+  }
+};
+
+
+/*
+ * Initialize parameters with default values.
+ */
+PJ_DEF(void) pjsip_overload_param_default(pjsip_overload_param *param)
+{
+    pj_bzero(param, sizeof(*param));
+    param->interval = PJSIP_OVERLOAD_INTERVAL;
+    param->max_latency = PJSIP_OVERLOAD_MAX_LATENCY;
+    param->max_busy_poll = 90;
+    param->retry_after = PJSIP_OVERLOAD_RETRY_AFTER;
+    param->feedback_validity = PJSIP_OVERLOAD_OC_VALIDITY;
+}
+
+
+/* Get the load as percentage of the configured maximum. */
+static unsigned get_pressure(unsigned value, unsigned max)
+{
+    return max ? value * 100 / max : 0;
+}
+
+/*
+ * Timer callback to sample the load and adjust the overload level.
+ */
+static void on_timer(pj_timer_heap_t *th, pj_timer_entry *entry)
+{
+    pjsip_overload_param *param = &mod_overload.param;
+    pjsip_overload_stat *stat = &mod_overload.stat;
+    pjsip_endpt_load load;
+    pj_uint32_t msg_cnt, poll_cnt;
+    unsigned max_backlog, pressure, p, level;
+    pj_time_val delay;
+
+    PJ_UNUSED_ARG(th);
+
+    entry->id = PJ_FALSE;
+
+    if (!mod_overload.active)
+	return;
+
+    pjsip_endpt_get_load(mod_overload.endpt, &load);
+
+    pj_mutex_lock(mod_overload.mutex);
+
+    stat->tsx_cnt = pjsip_tsx_layer_instance()->id == -1 ? 0 :
+		    pjsip_tsx_layer_get_tsx_count();
+    stat->backlog = load.queued;
+
+    msg_cnt = load.rx_msg_cnt - mod_overload.last_load.rx_msg_cnt;
+    if (msg_cnt) {
+	stat->latency = (load.rx_latency -
+			 mod_overload.last_load.rx_latency) / msg_cnt;
+    } else {
+	stat->latency = 0;
+    }
+
+    poll_cnt = load.poll_cnt - mod_overload.last_load.poll_cnt;
+    if (poll_cnt) {
+	stat->busy_poll = (load.busy_poll_cnt -
+			   mod_overload.last_load.busy_poll_cnt) * 100 /
+			  poll_cnt;
+    } else {
+	stat->busy_poll = 0;
+    }
+
+    mod_overload.last_load = load;
+
+    /* The pressure is the highest load relative to its maximum */
+    max_backlog = param->max_backlog ? param->max_backlog :
+		  load.queue_size / 2;
+    pressure = get_pressure(stat->tsx_cnt, param->max_tsx_cnt);
+
+    p = get_pressure(stat->backlog, max_backlog);
+    if (p > pressure) pressure = p;
+
+    p = get_pressure(stat->latency, param->max_latency);
+    if (p > pressure) pressure = p;
+
+    if (poll_cnt >= MIN_POLL_CNT) {
+	p = get_pressure(stat->busy_poll, param->max_busy_poll);
+	if (p > pressure) pressure = p;
+    }
+
+    /* Raise the level faster the further the load is above maximum */
+    level = mod_overload.level;
+    if (pressure > 100) {
+	unsigned inc = (pressure - 100) / 4 + LEVEL_INC_MAX / 4;
+	if (inc > LEVEL_INC_MAX) inc = LEVEL_INC_MAX;
+	level = (level + inc > 100) ? 100 : level + inc;
+    } else if (pressure < LOW_PRESSURE) {
+	level = (level > LEVEL_DEC) ? level - LEVEL_DEC : 0;
+    }
+
+    if (level != mod_overload.level) {
+	PJ_LOG(4,(THIS_FILE, "Overload level %d%% (tsx=%d, backlog=%d, "
+		  "latency=%dms, busy poll=%d%%)", level, stat->tsx_cnt,
+		  stat->backlog, stat->latency, stat->busy_poll));
+	mod_overload.level = level;
+	++mod_overload.seq;
+    }
+    stat->level = level;
+
+    pj_mutex_unlock(mod_overload.mutex);
+
+    delay.sec = 0;
+    delay.msec = param->interval;
+    pj_time_val_normalize(&delay);
+    if (pjsip_endpt_schedule_timer(mod_overload.endpt, entry,
+				   &delay) == PJ_SUCCESS)
+    {
+	entry->id = PJ_TRUE;
+    }
+}
+
+
+/*
+ * Reject new request statelessly with 503/Retry-After.
+ */
+static void reject_request(pjsip_endpoint *endpt, pjsip_rx_data *rdata)
+{
+    pjsip_hdr hdr_list;
+    pjsip_retry_after_hdr *retry_after;
+    unsigned value = mod_overload.param.retry_after;
+    pj_status_t status;
+
+    /* Spread the retries of the rejected clients */
+    if (value > 1)
+	value += (pj_rand() & 0x7FFF) % (value / 2 + 1);
+
+    pj_list_init(&hdr_list);
+    retry_after = pjsip_retry_after_hdr_create(rdata->tp_info.pool, value);
+    pj_list_push_back(&hdr_list, retry_after);
+
+    status = pjsip_endpt_respond_stateless(endpt, rdata,
+					   PJSIP_SC_SERVICE_UNAVAILABLE, NULL,
+					   &hdr_list, NULL);
+    if (status != PJ_SUCCESS) {
+	pjsip_endpt_log_error(endpt, THIS_FILE, status, "Error rejecting %s",
+			      pjsip_rx_data_get_info(rdata));
+    }
+}
+
+
+/*
+ * Endpoint admission callback.
+ */
+static pj_bool_t on_admission(pjsip_endpoint *endpt, pjsip_rx_data *rdata)
+{
+    pjsip_msg *msg = rdata->msg_info.msg;
+    pjsip_method *method;
+
+    /* Work that has already been accepted is always admitted */
+    if (msg->type != PJSIP_REQUEST_MSG)
+	return PJ_TRUE;
+
+    method = &msg->line.req.method;
+    if (method->id == PJSIP_ACK_METHOD || method->id == PJSIP_CANCEL_METHOD ||
+	rdata->msg_info.to->tag.slen != 0)
+    {
+	return PJ_TRUE;
+    }
+
+    /* Admit new request unless the level has accumulated 100 */
+    if (mod_overload.level == 0 ||
+	pj_atomic_add_and_get(mod_overload.credit,
+			      mod_overload.level) < 100)
+    {
+	pj_atomic_inc(mod_overload.admitted);
+	return PJ_TRUE;
+    }
+
+    pj_atomic_add(mod_overload.credit, -100);
+
+    /* Retransmission of a request that has been admitted earlier */
+    if (pjsip_tsx_layer_instance()->id != -1 &&
+	pjsip_tsx_layer_find_rx_tsx(rdata, PJSIP_ROLE_UAS, method, PJ_FALSE))
+    {
+	return PJ_TRUE;
+    }
+
+    PJ_LOG(5,(THIS_FILE, "Overloaded (level %d%%), rejecting %s from %s:%d",
+	      mod_overload.level, pjsip_rx_data_get_info(rdata),
+	      rdata->pkt_info.src_name, rdata->pkt_info.src_port));
+
+    pj_atomic_inc(mod_overload.rejected);
+    reject_request(endpt, rdata);
+
+    return PJ_FALSE;
+}
+
+
+/* Add parameter to the Via header of outgoing response. */
+static void add_via_param(pj_pool_t *pool, pjsip_via_hdr *via,
+			  const char *name, const char *value)
+{
+    pjsip_param *prm = PJ_POOL_ALLOC_T(pool, pjsip_param);
+
+    prm->name = pj_str((char*)name);
+    pj_strdup2(pool, &prm->value, value);
+    pj_list_push_back(&via->other_param, prm);
+}
+
+/*
+ * Add RFC 7339 overload control feedback to outgoing response.
+ */
+static pj_status_t mod_ovl_on_tx_response(pjsip_tx_data *tdata)
+{
+    const pj_str_t STR_OC = { "oc", 2 };
+    pjsip_via_hdr *via;
+    pjsip_param *oc;
+    char buf[16];
+
+    if (!mod_overload.param.feedback)
+	return PJ_SUCCESS;
+
+    /* Only to clients that support it, i.e. have put empty "oc"
+     * parameter in the Via header.
+     */
+    via = (pjsip_via_hdr*) pjsip_msg_find_hdr(tdata->msg, PJSIP_H_VIA, NULL);
+    if (!via)
+	return PJ_SUCCESS;
+
+    oc = pjsip_param_find(&via->other_param, &STR_OC);
+    if (!oc || oc->value.slen != 0)
+	return PJ_SUCCESS;
+
+    pj_ansi_snprintf(buf, sizeof(buf), "%u", mod_overload.level);
+    pj_strdup2(tdata->pool, &oc->value, buf);
+
+    pj_ansi_snprintf(buf, sizeof(buf), "%u",
+		     mod_overload.param.feedback_validity);
+    add_via_param(tdata->pool, via, "oc-validity", buf);
+
+    pj_ansi_snprintf(buf, sizeof(buf), "%u", mod_overload.seq);
+    add_via_param(tdata->pool, via, "oc-seq", buf);
+
+    add_via_param(tdata->pool, via, "oc-algo", "\"loss\"");
+
+    /* Message may have been printed already */
+    pjsip_tx_data_invalidate_msg(tdata);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Destroy the module objects, called when the endpoint is destroyed.
+ */
+static void ovl_destroy(pjsip_endpoint *endpt)
+{
+    PJ_UNUSED_ARG(endpt);
+
+    if (mod_overload.credit) {
+	pj_atomic_destroy(mod_overload.credit);
+	mod_overload.credit = NULL;
+    }
+    if (mod_overload.admitted) {
+	pj_atomic_destroy(mod_overload.admitted);
+	mod_overload.admitted = NULL;
+    }
+    if (mod_overload.rejected) {
+	pj_atomic_destroy(mod_overload.rejected);
+	mod_overload.rejected = NULL;
+    }
+    if (mod_overload.mutex) {
+	pj_mutex_destroy(mod_overload.mutex);
+	mod_overload.mutex = NULL;
+    }
+    if (mod_overload.pool) {
+	pjsip_endpt_release_pool(mod_overload.endpt, mod_overload.pool);
+	mod_overload.pool = NULL;
+    }
+    mod_overload.atexit_set = PJ_FALSE;
+}
+
+
+/*
+ * Module unload.
+ */
+static pj_status_t mod_ovl_unload(void)
+{
+    mod_overload.active = PJ_FALSE;
+    pjsip_endpt_set_admission_cb(mod_overload.endpt, NULL);
+
+    if (mod_overload.timer.id) {
+	pjsip_endpt_cancel_timer(mod_overload.endpt, &mod_overload.timer);
+	mod_overload.timer.id = PJ_FALSE;
+    }
+
+    /* Other threads may still be in on_admission() or on_timer(), so
+     * the objects are destroyed together with the endpoint.
+     */
+    if (!mod_overload.atexit_set) {
+	if (pjsip_endpt_atexit(mod_overload.endpt, &ovl_destroy) !=
+	    PJ_SUCCESS)
+	{
+	    PJ_LOG(3,(THIS_FILE, "Failed to register overload control "
+				 "module destroy."));
+	    return PJ_SUCCESS;
+	}
+	mod_overload.atexit_set = PJ_TRUE;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Initialize and register the module.
+ */
+PJ_DEF(pj_status_t) pjsip_overload_init_module(pjsip_endpoint *endpt,
+					const pjsip_overload_param *param)
+{
+    pj_time_val delay;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(endpt, PJ_EINVAL);
+    PJ_ASSERT_RETURN(mod_overload.mod.id == -1, PJ_EINVALIDOP);
+
+    /* Objects of the previous instance live until its endpoint is gone */
+    PJ_ASSERT_RETURN(!mod_overload.pool || mod_overload.endpt == endpt,
+		     PJ_EINVALIDOP);
+
+    if (param)
+	pj_memcpy(&mod_overload.param, param, sizeof(*param));
+    else
+	pjsip_overload_param_default(&mod_overload.param);
+
+    if (mod_overload.param.interval == 0)
+	mod_overload.param.interval = PJSIP_OVERLOAD_INTERVAL;
+
+    mod_overload.endpt = endpt;
+    mod_overload.level = 0;
+    mod_overload.seq = 0;
+    pj_bzero(&mod_overload.stat, sizeof(mod_overload.stat));
+
+    if (mod_overload.pool) {
+	/* Module is loaded again, reuse the objects */
+	pj_atomic_set(mod_overload.credit, 0);
+	pj_atomic_set(mod_overload.admitted, 0);
+	pj_atomic_set(mod_overload.rejected, 0);
+    } else {
+	mod_overload.pool = pjsip_endpt_create_pool(endpt, "ovlctl",
+						    512, 512);
+	if (!mod_overload.pool)
+	    return PJ_ENOMEM;
+
+	status = pj_mutex_create_simple(mod_overload.pool, "ovlctl",
+					&mod_overload.mutex);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	if ((status=pj_atomic_create(mod_overload.pool, 0,
+				     &mod_overload.credit)) != PJ_SUCCESS ||
+	    (status=pj_atomic_create(mod_overload.pool, 0,
+				     &mod_overload.admitted)) != PJ_SUCCESS ||
+	    (status=pj_atomic_create(mod_overload.pool, 0,
+				     &mod_overload.rejected)) != PJ_SUCCESS)
+	{
+	    goto on_error;
+	}
+    }
+
+    status = pjsip_endpt_register_module(endpt, &mod_overload.mod);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    pjsip_endpt_get_load(endpt, &mod_overload.last_load);
+    mod_overload.active = PJ_TRUE;
+    pjsip_endpt_set_admission_cb(endpt, &on_admission);
+
+    pj_timer_entry_init(&mod_overload.timer, PJ_FALSE, NULL, &on_timer);
+    delay.sec = 0;
+    delay.msec = mod_overload.param.interval;
+    pj_time_val_normalize(&delay);
+    status = pjsip_endpt_schedule_timer(endpt, &mod_overload.timer, &delay);
+    if (status != PJ_SUCCESS) {
+	pjsip_endpt_unregister_module(endpt, &mod_overload.mod);
+	return status;
+    }
+    mod_overload.timer.id = PJ_TRUE;
+
+    return PJ_SUCCESS;
+
+on_error:
+    /* Nobody has seen the objects yet unless they're reused */
+    if (!mod_overload.atexit_set)
+	ovl_destroy(endpt);
+    return status;
+}
+
+
+/*
+ * Get the module instance.
+ */
+PJ_DEF(pjsip_module*) pjsip_overload_instance(void)
+{
+    return &mod_overload.mod;
+}
+
+
+/*
+ * Get statistics.
+ */
+PJ_DEF(pj_status_t) pjsip_overload_get_stat(pjsip_overload_stat *stat)
+{
+    PJ_ASSERT_RETURN(stat, PJ_EINVAL);
+
+    if (mod_overload.mod.id == -1)
+	return PJ_EINVALIDOP;
+
+    pj_mutex_lock(mod_overload.mutex);
+    pj_memcpy(stat, &mod_overload.stat, sizeof(*stat));
+    pj_mutex_unlock(mod_overload.mutex);
+
+    stat->level = mod_overload.level;
+    stat->admitted = (pj_uint32_t) pj_atomic_get(mod_overload.admitted);
+    stat->rejected = (pj_uint32_t) pj_atomic_get(mod_overload.rejected);
+
+    return PJ_SUCCESS;
+}
+
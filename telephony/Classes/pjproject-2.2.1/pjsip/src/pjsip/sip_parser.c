@@ -934,6 +934,37 @@ static pj_bool_t is_next_sip_version(pj_scanner *scanner)
     return c && (c=='/' || c==' ' || c=='\t') && pj_stricmp(&sip, &SIP)==0;
 }
 
+/* Record the position of the header line just parsed in rdata, if this
+ * is the first header of the types that raw forwarding needs to edit.
+ */
+static void record_hdr_pos( pjsip_rx_data *rdata, pjsip_hdr_e type,
+			    const pj_scanner *scanner, const char *hstart )
+{
+    pjsip_rx_hdr_pos *pos;
+
+    switch (type) {
+    case PJSIP_H_VIA:
+	pos = &rdata->msg_info.raw_pos.via;
+	break;
+    case PJSIP_H_MAX_FORWARDS:
+	pos = &rdata->msg_info.raw_pos.max_fwd;
+	break;
+    case PJSIP_H_ROUTE:
+	pos = &rdata->msg_info.raw_pos.route;
+	break;
+    case PJSIP_H_RECORD_ROUTE:
+	pos = &rdata->msg_info.raw_pos.record_route;
+	break;
+    default:
+	return;
+    }
+
+    if (pos->end == 0) {
+	pos->start = (int)(hstart - scanner->begin);
+	pos->end = (int)(scanner->curptr - scanner->begin);
+    }
+}
+
 /* Internal function to parse SIP message */
 static pjsip_msg *int_parse_msg( pjsip_parse_ctx *ctx,
 				 pjsip_parser_err_report *err_list)
@@ -975,6 +1006,11 @@ retry_parse:
 	    int_parse_req_line(scanner, pool, &msg->line.req );
 	}
 
+	if (ctx->rdata) {
+	    ctx->rdata->msg_info.raw_pos.hdr_start = 
+		(int)(scanner->curptr - scanner->begin);
+	}
+
 	parsing_headers = PJ_TRUE;
 
 parse_headers:
@@ -982,6 +1018,7 @@ parse_headers:
 	do {
 	    pjsip_parse_hdr_func * handler;
 	    pjsip_hdr *hdr = NULL;
+	    char *hstart = scanner->curptr;
 
 	    /* Init hname just in case parsing fails.
 	     * Ref: PROTOS #2412
@@ -1032,6 +1069,12 @@ parse_headers:
 	     */
 	    if (hdr)
 		pj_list_insert_nodes_before(&msg->hdr, hdr);
+
+	    /* Record the position of header lines that a proxy may need to
+	     * edit when forwarding the raw message.
+	     */
+	    if (hdr && ctx->rdata)
+		record_hdr_pos(ctx->rdata, hdr->type, scanner, hstart);
 	    
 	    /* Parse until EOF or an empty line is found. */
 	} while (!pj_scan_is_eof(scanner) && !IS_NEWLINE(*scanner->curptr));
@@ -30,6 +30,7 @@
 #include <pj/rand.h>
 #include <pj/string.h>
 #include <pj/assert.h>
+#include <pj/ctype.h>
 #include <pj/guid.h>
 #include <pj/log.h>
 
@@ -41,12 +42,26 @@
 #define TSX_TRACE_(expr)
 #endif
 
-/* When this macro is set, transaction will keep the hashed value
- * so that future lookup (to unregister transaction) does not need
- * to recalculate the hash again. It should gains a little bit of
- * performance, so generally we'd want this.
+/* Branch parameter generated by PJSIP starts with this prefix, followed
+ * by BRANCH_HASH_LEN hex digits which carry the precomputed hash of the
+ * branch, so that responses to UAC transactions can be matched without
+ * hashing. Branches of UAS transactions come from other hosts and are
+ * always hashed.
  */
-#define PRECALC_HASH
+#define BRANCH_PREFIX		PJSIP_RFC3261_BRANCH_ID "Pj"
+#define BRANCH_PREFIX_LEN	(PJSIP_RFC3261_BRANCH_LEN + 2)
+#define BRANCH_HASH_LEN		16
+
+/* Multiplier of the primary hash (the same as pj_hash_calc()), and the
+ * initial value of the secondary (FNV-1a) hash.
+ */
+#define HASH1_MULT		33
+#define HASH2_INIT		2166136261UL
+
+/* Maximum number of colliding transactions sharing the same hash. The
+ * colliding ones are registered with increasing probe value in the key.
+ */
+#define MAX_KEY_PROBE		16
 
 
 /* Defined in sip_util_statefull.c */
@@ -75,6 +90,8 @@ static struct mod_tsx_layer
     pjsip_endpoint	*endpt;
     pj_mutex_t		*mutex;
     pj_hash_table_t	*htable;
+    unsigned		 max_probe;	/* Highest probe value in use.	    */
+    unsigned		 probe_cnt;	/* # of tsx with non-zero probe.    */
 } mod_tsx_layer = 
 {   {
 	NULL, NULL,			/* List's prev and next.    */
@@ -416,6 +433,228 @@ PJ_DEF(pj_status_t) pjsip_tsx_create_key( pj_pool_t *pool, pj_str_t *key,
     }
 }
 
+/*
+ * Update the two hash values of the string, case-insensitively.
+ */
+static void hash_lower2(const char *p, pj_size_t len,
+			pj_uint32_t *h1, pj_uint32_t *h2)
+{
+    const char *end = p + len;
+    pj_uint32_t a = *h1, b = *h2;
+
+    for (; p != end; ++p) {
+	unsigned c = pj_tolower(*p);
+	a = a * HASH1_MULT + c;
+	b = (b ^ c) * 16777619;
+    }
+
+    *h1 = a;
+    *h2 = b;
+}
+
+/*
+ * Get the hash carried by branch parameter generated by PJSIP.
+ */
+static pj_bool_t decode_branch_hash(const pj_str_t *branch,
+				    pj_uint32_t *h1, pj_uint32_t *h2)
+{
+    const char *p;
+    pj_uint32_t val[2];
+    unsigned i, j;
+
+    if (branch->slen < BRANCH_PREFIX_LEN + BRANCH_HASH_LEN ||
+	pj_ansi_strnicmp(branch->ptr, BRANCH_PREFIX, BRANCH_PREFIX_LEN) != 0)
+    {
+	return PJ_FALSE;
+    }
+
+    p = branch->ptr + BRANCH_PREFIX_LEN;
+    for (i=0; i<2; ++i) {
+	val[i] = 0;
+	for (j=0; j<BRANCH_HASH_LEN/2; ++j, ++p) {
+	    if (!pj_isxdigit(*p))
+		return PJ_FALSE;
+	    val[i] = (val[i] << 4) | pj_hex_digit_to_val(*p);
+	}
+    }
+
+    *h1 = val[0];
+    *h2 = val[1];
+    return PJ_TRUE;
+}
+
+/*
+ * Generate new branch parameter, with the hash of the branch embedded
+ * after the prefix.
+ */
+static void generate_branch(pj_pool_t *pool, pj_str_t *branch)
+{
+    char guid[PJ_GUID_MAX_LENGTH];
+    pj_str_t tmp;
+    pj_uint32_t hval[2] = { 0, HASH2_INIT };
+    char *p;
+    unsigned i;
+    pj_ssize_t len;
+
+    tmp.ptr = guid;
+    pj_generate_unique_string(&tmp);
+    hash_lower2(tmp.ptr, tmp.slen, &hval[0], &hval[1]);
+
+    branch->ptr = p = (char*) pj_pool_alloc(pool, PJSIP_MAX_BRANCH_LEN);
+    pj_memcpy(p, BRANCH_PREFIX, BRANCH_PREFIX_LEN);
+    p += BRANCH_PREFIX_LEN;
+    for (i=0; i<2; ++i) {
+	pj_val_to_hex_digit((hval[i] >> 24) & 0xFF, p);
+	pj_val_to_hex_digit((hval[i] >> 16) & 0xFF, p+2);
+	pj_val_to_hex_digit((hval[i] >>  8) & 0xFF, p+4);
+	pj_val_to_hex_digit( hval[i]        & 0xFF, p+6);
+	p += 8;
+    }
+
+    len = PJSIP_MAX_BRANCH_LEN - (p - branch->ptr);
+    if (len > tmp.slen)
+	len = tmp.slen;
+    pj_memcpy(p, tmp.ptr, len);
+    branch->slen = (p + len) - branch->ptr;
+}
+
+/*
+ * Create binary key for RFC 3261 branch. Only the branches of UAC
+ * transactions were generated by us, so only those are decoded.
+ */
+PJ_DEF(void) pjsip_tsx_create_bin_key( pjsip_tsx_bin_key *key,
+				       pjsip_role_e role,
+				       const pjsip_method *method,
+				       const pj_str_t *branch )
+{
+    pj_uint32_t h1 = 0, h2 = HASH2_INIT;
+
+    pj_bzero(key, sizeof(*key));
+
+    if (role != PJSIP_ROLE_UAC || !decode_branch_hash(branch, &h1, &h2))
+	hash_lower2(branch->ptr, branch->slen, &h1, &h2);
+
+    /* INVITE and ACK share the same key, other methods are included
+     * the same way as in the string key.
+     */
+    if (method->id == PJSIP_OTHER_METHOD)
+	hash_lower2(method->name.ptr, method->name.slen, &h1, &h2);
+
+    key->role = (pj_uint8_t)role;
+    key->method = (pj_uint8_t)(method->id==PJSIP_ACK_METHOD ?
+				PJSIP_INVITE_METHOD : method->id);
+
+    /* Zero hash tells the hash table to calculate the hash itself */
+    key->hval = h1 ? h1 : 1;
+    key->hval2 = h2;
+}
+
+/*
+ * Create binary key from RFC 2543 string key.
+ */
+static void create_bin_key_2543(pjsip_tsx_bin_key *key,
+				pjsip_role_e role,
+				const pj_str_t *str_key)
+{
+    pj_uint32_t h1 = 0, h2 = HASH2_INIT;
+
+    pj_bzero(key, sizeof(*key));
+    hash_lower2(str_key->ptr, str_key->slen, &h1, &h2);
+
+    key->role = (pj_uint8_t)role;
+    key->rfc2543 = 1;
+    key->hval = h1 ? h1 : 1;
+    key->hval2 = h2;
+}
+
+/*
+ * Create binary key from string key created by pjsip_tsx_create_key().
+ * The branch and method are returned for the verification.
+ */
+static void create_bin_key_from_str(pjsip_tsx_bin_key *key,
+				    const pj_str_t *str_key,
+				    pj_str_t *branch,
+				    pjsip_method *method)
+{
+    pjsip_role_e role;
+    char *start, *end, *p;
+
+    role = (str_key->slen && *str_key->ptr=='c') ? PJSIP_ROLE_UAC :
+						    PJSIP_ROLE_UAS;
+    branch->ptr = NULL;
+    branch->slen = 0;
+
+    if (str_key->slen > 2) {
+	start = str_key->ptr + 2;
+	end = str_key->ptr + str_key->slen;
+	for (p=end; p!=start && *(p-1)!=SEPARATOR; --p)
+	    ;
+
+	branch->ptr = p;
+	branch->slen = end - p;
+	if (branch->slen >= PJSIP_RFC3261_BRANCH_LEN &&
+	    pj_ansi_strnicmp(p, PJSIP_RFC3261_BRANCH_ID,
+			     PJSIP_RFC3261_BRANCH_LEN)==0)
+	{
+	    if (p == start) {
+		pjsip_method_set(method, PJSIP_INVITE_METHOD);
+	    } else {
+		pj_str_t name;
+		name.ptr = start;
+		name.slen = (p - 1) - start;
+		pjsip_method_init_np(method, &name);
+	    }
+	    pjsip_tsx_create_bin_key(key, role, method, branch);
+	    return;
+	}
+    }
+
+    create_bin_key_2543(key, role, str_key);
+}
+
+/*
+ * Initialize the binary key of a new transaction, after the string key
+ * and the branch have been set.
+ */
+static void tsx_init_bin_key(pjsip_transaction *tsx)
+{
+    if (tsx->branch.slen >= PJSIP_RFC3261_BRANCH_LEN &&
+	pj_ansi_strnicmp(tsx->branch.ptr, PJSIP_RFC3261_BRANCH_ID,
+			 PJSIP_RFC3261_BRANCH_LEN)==0)
+    {
+	pjsip_tsx_create_bin_key(&tsx->bin_key, tsx->role, &tsx->method,
+				 &tsx->branch);
+    } else {
+	create_bin_key_2543(&tsx->bin_key, tsx->role, &tsx->transaction_key);
+    }
+    tsx->hashed_key = tsx->bin_key.hval;
+}
+
+/*
+ * Verify that the transaction found with the binary key really matches
+ * the branch and method (RFC 3261), or the string key (RFC 2543).
+ */
+static pj_bool_t tsx_key_match(const pjsip_transaction *tsx,
+			       const pjsip_tsx_bin_key *key,
+			       const pj_str_t *branch,
+			       const pjsip_method *method,
+			       const pj_str_t *str_key)
+{
+    if (key->rfc2543)
+	return pj_stricmp(&tsx->transaction_key, str_key)==0;
+
+    if (pj_stricmp(&tsx->branch, branch) != 0)
+	return PJ_FALSE;
+
+    if (method->id == PJSIP_OTHER_METHOD &&
+	pj_stricmp(&tsx->method.name, &method->name) != 0)
+    {
+	return PJ_FALSE;
+    }
+
+    return PJ_TRUE;
+}
+
 /*****************************************************************************
  **
  ** Transaction layer module
@@ -530,20 +769,39 @@ PJ_DEF(pj_status_t) pjsip_tsx_layer_destroy(void)
  */
 static pj_status_t mod_tsx_layer_register_tsx( pjsip_transaction *tsx)
 {
+    pjsip_transaction *other;
+    unsigned probe, free_probe = MAX_KEY_PROBE + 1;
+
     pj_assert(tsx->transaction_key.slen != 0);
 
     /* Lock hash table mutex. */
     pj_mutex_lock(mod_tsx_layer.mutex);
 
-    /* Check if no transaction with the same key exists. 
-     * Do not use PJ_ASSERT_RETURN since it evaluates the expression
-     * twice!
+    /* Check if no transaction with the same key exists. Since the binary
+     * key is only a hash, a transaction registered with the same binary
+     * key may be a different one, in which case the first free probe
+     * value is used for this transaction.
      */
-    if(pj_hash_get_lower(mod_tsx_layer.htable, 
-		         tsx->transaction_key.ptr,
-		         (unsigned)tsx->transaction_key.slen, 
-		         NULL))
-    {
+    for (probe=0; probe<=MAX_KEY_PROBE; ++probe) {
+	tsx->bin_key.probe = (pj_uint8_t)probe;
+	other = (pjsip_transaction*)
+		pj_hash_get(mod_tsx_layer.htable, &tsx->bin_key,
+			    sizeof(tsx->bin_key), &tsx->hashed_key);
+	if (other == NULL) {
+	    if (free_probe > MAX_KEY_PROBE)
+		free_probe = probe;
+	    if (probe >= mod_tsx_layer.max_probe)
+		break;
+	} else if (tsx_key_match(other, &tsx->bin_key, &tsx->branch,
+				 &tsx->method, &tsx->transaction_key))
+	{
+	    free_probe = MAX_KEY_PROBE + 1;
+	    break;
+	}
+    }
+
+    if (free_probe > MAX_KEY_PROBE) {
+	tsx->bin_key.probe = 0;
 	pj_mutex_unlock(mod_tsx_layer.mutex);
 	PJ_LOG(2,(THIS_FILE, 
 		  "Unable to register %.*s transaction (key exists)",
@@ -552,22 +810,23 @@ static pj_status_t mod_tsx_layer_register_tsx( pjsip_transaction *tsx)
 	return PJ_EEXISTS;
     }
 
+    tsx->bin_key.probe = (pj_uint8_t)free_probe;
+    if (free_probe) {
+	++mod_tsx_layer.probe_cnt;
+	if (free_probe > mod_tsx_layer.max_probe)
+	    mod_tsx_layer.max_probe = free_probe;
+    }
+
     TSX_TRACE_((THIS_FILE, 
 		"Transaction %p registered with hkey=0x%p and key=%.*s",
 		tsx, tsx->hashed_key, tsx->transaction_key.slen,
 		tsx->transaction_key.ptr));
 
-    /* Register the transaction to the hash table. */
-#ifdef PRECALC_HASH
-    pj_hash_set_lower( tsx->pool, mod_tsx_layer.htable,
-                       tsx->transaction_key.ptr,
-    		       (unsigned)tsx->transaction_key.slen, 
-		       tsx->hashed_key, tsx);
-#else
-    pj_hash_set_lower( tsx->pool, mod_tsx_layer.htable,
-                       tsx->transaction_key.ptr,
-    		       tsx->transaction_key.slen, 0, tsx);
-#endif
+    /* Register the transaction to the hash table. The binary key and
+     * the entry live in the transaction, so nothing is allocated here.
+     */
+    pj_hash_set_np( mod_tsx_layer.htable, &tsx->bin_key, 
+		    sizeof(tsx->bin_key), tsx->hashed_key, tsx->hentry, tsx);
 
     /* Unlock mutex. */
     pj_mutex_unlock(mod_tsx_layer.mutex);
@@ -596,15 +855,12 @@ static void mod_tsx_layer_unregister_tsx( pjsip_transaction *tsx)
     /* Lock hash table mutex. */
     pj_mutex_lock(mod_tsx_layer.mutex);
 
-    /* Register the transaction to the hash table. */
-#ifdef PRECALC_HASH
-    pj_hash_set_lower( NULL, mod_tsx_layer.htable, tsx->transaction_key.ptr,
-    		       (unsigned)tsx->transaction_key.slen, tsx->hashed_key, 
-		       NULL);
-#else
-    pj_hash_set_lower( NULL, mod_tsx_layer.htable, tsx->transaction_key.ptr,
-    		       tsx->transaction_key.slen, 0, NULL);
-#endif
+    /* Unregister the transaction from the hash table. */
+    pj_hash_set( NULL, mod_tsx_layer.htable, &tsx->bin_key, 
+		 sizeof(tsx->bin_key), tsx->hashed_key, NULL);
+
+    if (tsx->bin_key.probe && --mod_tsx_layer.probe_cnt == 0)
+	mod_tsx_layer.max_probe = 0;
 
     TSX_TRACE_((THIS_FILE, 
 		"Transaction %p unregistered, hkey=0x%p and key=%.*s",
@@ -635,6 +891,64 @@ PJ_DEF(unsigned) pjsip_tsx_layer_get_tsx_count(void)
 }
 
 
+/*
+ * Lookup the hash table with the binary key and verify the result. When
+ * there are colliding transactions, all the probe values in use are
+ * tried. Hash table mutex must be held by caller.
+ */
+static pjsip_transaction *tsx_layer_lookup(pjsip_tsx_bin_key *key,
+					   const pj_str_t *branch,
+					   const pjsip_method *method,
+					   const pj_str_t *str_key)
+{
+    pjsip_transaction *tsx;
+    pj_uint32_t hval = key->hval;
+    unsigned probe;
+
+    for (probe=0; probe<=mod_tsx_layer.max_probe; ++probe) {
+	key->probe = (pj_uint8_t)probe;
+	tsx = (pjsip_transaction*)
+	      pj_hash_get( mod_tsx_layer.htable, key, sizeof(*key), &hval );
+	if (tsx && tsx_key_match(tsx, key, branch, method, str_key))
+	    return tsx;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * Lookup the transaction for the incoming message. For RFC 3261 message
+ * the binary key is calculated directly from the branch, otherwise the
+ * string key is created from rdata's pool. Hash table mutex must be held
+ * by caller.
+ */
+static pjsip_transaction *tsx_layer_lookup_rx(const pjsip_rx_data *rdata,
+					      pjsip_role_e role,
+					      const pjsip_method *method,
+					      pjsip_tsx_bin_key *key)
+{
+    const pj_str_t *branch = &rdata->msg_info.via->branch_param;
+    pj_str_t str_key;
+
+    if (branch->slen >= PJSIP_RFC3261_BRANCH_LEN &&
+	pj_ansi_strnicmp(branch->ptr, PJSIP_RFC3261_BRANCH_ID,
+			 PJSIP_RFC3261_BRANCH_LEN)==0)
+    {
+	pjsip_tsx_create_bin_key(key, role, method, branch);
+	return tsx_layer_lookup(key, branch, method, NULL);
+    }
+
+    if (create_tsx_key_2543(rdata->tp_info.pool, &str_key, role, method,
+			    rdata) != PJ_SUCCESS)
+    {
+	return NULL;
+    }
+    create_bin_key_2543(key, role, &str_key);
+    return tsx_layer_lookup(key, branch, method, &str_key);
+}
+
+
 /*
  * Find a transaction.
  */
@@ -642,12 +956,14 @@ PJ_DEF(pjsip_transaction*) pjsip_tsx_layer_find_tsx( const pj_str_t *key,
 						     pj_bool_t lock )
 {
     pjsip_transaction *tsx;
-    pj_uint32_t hval = 0;
+    pjsip_tsx_bin_key bin_key;
+    pj_str_t branch;
+    pjsip_method method;
+
+    create_bin_key_from_str(&bin_key, key, &branch, &method);
 
     pj_mutex_lock(mod_tsx_layer.mutex);
-    tsx = (pjsip_transaction*)
-    	  pj_hash_get_lower( mod_tsx_layer.htable, key->ptr, 
-			     (unsigned)key->slen, &hval );
+    tsx = tsx_layer_lookup(&bin_key, &branch, &method, key);
     
     /* Prevent the transaction to get deleted before we have chance to lock it.
      */
@@ -658,7 +974,48 @@ PJ_DEF(pjsip_transaction*) pjsip_tsx_layer_find_tsx( const pj_str_t *key,
 
     TSX_TRACE_((THIS_FILE, 
 		"Finding tsx with hkey=0x%p and key=%.*s: found %p",
-		hval, key->slen, key->ptr, tsx));
+		bin_key.hval, key->slen, key->ptr, tsx));
+
+    /* Simulate race condition! */
+    PJ_RACE_ME(5);
+
+    if (tsx && lock) {
+	pj_grp_lock_acquire(tsx->grp_lock);
+        pj_grp_lock_dec_ref(tsx->grp_lock);
+    }
+
+    return tsx;
+}
+
+
+/*
+ * Find a transaction for incoming message.
+ */
+PJ_DEF(pjsip_transaction*) pjsip_tsx_layer_find_rx_tsx(
+					    const pjsip_rx_data *rdata,
+					    pjsip_role_e role,
+					    const pjsip_method *method,
+					    pj_bool_t lock )
+{
+    pjsip_transaction *tsx;
+    pjsip_tsx_bin_key key;
+
+    PJ_ASSERT_RETURN(rdata && method, NULL);
+    PJ_ASSERT_RETURN(rdata->msg_info.via, NULL);
+
+    pj_mutex_lock(mod_tsx_layer.mutex);
+    tsx = tsx_layer_lookup_rx(rdata, role, method, &key);
+
+    /* Prevent the transaction to get deleted before we have chance to lock it.
+     */
+    if (tsx && lock)
+        pj_grp_lock_add_ref(tsx->grp_lock);
+    
+    pj_mutex_unlock(mod_tsx_layer.mutex);
+
+    TSX_TRACE_((THIS_FILE, 
+		"Finding tsx for message, hkey=0x%p: found %p",
+		key.hval, tsx));
 
     /* Simulate race condition! */
     PJ_RACE_ME(5);
@@ -774,24 +1131,19 @@ static pj_status_t mod_tsx_layer_unload(void)
  */
 static pj_bool_t mod_tsx_layer_on_rx_request(pjsip_rx_data *rdata)
 {
-    pj_str_t key;
-    pj_uint32_t hval = 0;
+    pjsip_tsx_bin_key key;
     pjsip_transaction *tsx;
 
-    pjsip_tsx_create_key(rdata->tp_info.pool, &key, PJSIP_ROLE_UAS,
-			 &rdata->msg_info.cseq->method, rdata);
-
     /* Find transaction. */
     pj_mutex_lock( mod_tsx_layer.mutex );
 
-    tsx = (pjsip_transaction*) 
-    	  pj_hash_get_lower( mod_tsx_layer.htable, key.ptr, (unsigned)key.slen, 
-			     &hval );
+    tsx = tsx_layer_lookup_rx(rdata, PJSIP_ROLE_UAS, &rdata->msg_info.cseq->method,
+			      &key);
 
 
     TSX_TRACE_((THIS_FILE, 
-		"Finding tsx for request, hkey=0x%p and key=%.*s, found %p",
-		hval, key.slen, key.ptr, tsx));
+		"Finding tsx for request, hkey=0x%p, found %p",
+		key.hval, tsx));
 
 
     if (tsx == NULL || tsx->state == PJSIP_TSX_STATE_TERMINATED) {
@@ -828,24 +1180,19 @@ static pj_bool_t mod_tsx_layer_on_rx_request(pjsip_rx_data *rdata)
  */
 static pj_bool_t mod_tsx_layer_on_rx_response(pjsip_rx_data *rdata)
 {
-    pj_str_t key;
-    pj_uint32_t hval = 0;
+    pjsip_tsx_bin_key key;
     pjsip_transaction *tsx;
 
-    pjsip_tsx_create_key(rdata->tp_info.pool, &key, PJSIP_ROLE_UAC,
-			 &rdata->msg_info.cseq->method, rdata);
-
     /* Find transaction. */
     pj_mutex_lock( mod_tsx_layer.mutex );
 
-    tsx = (pjsip_transaction*) 
-    	  pj_hash_get_lower( mod_tsx_layer.htable, key.ptr, (unsigned)key.slen, 
-			     &hval );
+    tsx = tsx_layer_lookup_rx(rdata, PJSIP_ROLE_UAC, &rdata->msg_info.cseq->method,
+			      &key);
 
 
     TSX_TRACE_((THIS_FILE, 
-		"Finding tsx for response, hkey=0x%p and key=%.*s, found %p",
-		hval, key.slen, key.ptr, tsx));
+		"Finding tsx for response, hkey=0x%p, found %p",
+		key.hval, tsx));
 
 
     if (tsx == NULL || tsx->state == PJSIP_TSX_STATE_TERMINATED) {
@@ -1004,6 +1351,7 @@ static pj_status_t tsx_create( pjsip_module *tsx_user,
     tsx->timeout_timer.id = TIMER_INACTIVE;
     tsx->timeout_timer.user_data = tsx;
     tsx->timeout_timer.cb = &tsx_timer_callback;
+    tsx->worker = -1;
     
     if (grp_lock) {
 	tsx->grp_lock = grp_lock;
@@ -1086,15 +1434,22 @@ static pj_status_t tsx_shutdown( pjsip_transaction *tsx )
 
 
 /*
- * Callback when timer expires. Transport error also piggybacks this event
- * to avoid deadlock (https://trac.pjsip.org/repos/ticket/1646).
+ * Select the dispatcher worker that runs the timers of the transaction:
+ * the worker that is creating it, or the worker of the Call-ID.
  */
-static void tsx_timer_callback( pj_timer_heap_t *theap, pj_timer_entry *entry)
+static void tsx_init_worker(pjsip_transaction *tsx, const pj_str_t *call_id)
 {
-    pjsip_transaction *tsx = (pjsip_transaction*) entry->user_data;
-
-    PJ_UNUSED_ARG(theap);
+    tsx->worker = pjsip_endpt_get_current_worker(tsx->endpt);
+    if (tsx->worker < 0 && call_id)
+	tsx->worker = pjsip_endpt_get_key_worker(tsx->endpt, call_id);
+}
 
+/*
+ * Handle elapsed timer. Transport error also piggybacks this event
+ * to avoid deadlock (https://trac.pjsip.org/repos/ticket/1646).
+ */
+static void tsx_on_timer(pjsip_transaction *tsx, pj_timer_entry *entry)
+{
     if (entry->id == TRANSPORT_ERR_TIMER) {
 	/* Posted transport error event */
 	entry->id = 0;
@@ -1157,6 +1512,71 @@ static void tsx_timer_callback( pj_timer_heap_t *theap, pj_timer_entry *entry)
     }
 }
 
+/*
+ * Elapsed timer, run by the dispatcher worker of the transaction.
+ */
+static void tsx_timer_job(pjsip_endpoint *endpt, void *user_data)
+{
+    pj_timer_entry *entry = (pj_timer_entry*) user_data;
+    pjsip_transaction *tsx = (pjsip_transaction*) entry->user_data;
+    pj_bool_t active;
+
+    PJ_UNUSED_ARG(endpt);
+
+    /* Ignore the event if the timer has been cancelled or rescheduled
+     * while the event was queued.
+     */
+    pj_grp_lock_acquire(tsx->grp_lock);
+    lock_timer(tsx);
+    active = (entry->id != TIMER_INACTIVE && !pj_timer_entry_running(entry));
+    unlock_timer(tsx);
+    pj_grp_lock_release(tsx->grp_lock);
+
+    if (active)
+	tsx_on_timer(tsx, entry);
+
+    pj_grp_lock_dec_ref(tsx->grp_lock);
+}
+
+/*
+ * Callback when timer expires.
+ */
+static void tsx_timer_callback( pj_timer_heap_t *theap, pj_timer_entry *entry)
+{
+    pjsip_transaction *tsx = (pjsip_transaction*) entry->user_data;
+
+    PJ_UNUSED_ARG(theap);
+
+    /* With the endpoint dispatcher, run the timer in the worker of the
+     * transaction so that it is serialized with the dialog's messages.
+     * The reference keeps the transaction while the event is queued.
+     */
+    if (tsx->worker >= 0 &&
+	tsx->worker != pjsip_endpt_get_current_worker(tsx->endpt))
+    {
+	pj_time_val delay = { 0, 10 };
+
+	pj_grp_lock_add_ref(tsx->grp_lock);
+	if (pjsip_endpt_dispatch_job_to(tsx->endpt, tsx->worker,
+					&tsx_timer_job, entry) == PJ_SUCCESS)
+	{
+	    return;
+	}
+	pj_grp_lock_dec_ref(tsx->grp_lock);
+
+	/* Worker is busy, try again shortly */
+	pj_grp_lock_acquire(tsx->grp_lock);
+	lock_timer(tsx);
+	if (entry->id != TIMER_INACTIVE && !pj_timer_entry_running(entry))
+	    tsx_schedule_timer(tsx, entry, &delay, entry->id);
+	unlock_timer(tsx);
+	pj_grp_lock_release(tsx->grp_lock);
+	return;
+    }
+
+    tsx_on_timer(tsx, entry);
+}
+
 
 /*
  * Set transaction state, and inform TU about the transaction state change.
@@ -1320,6 +1740,12 @@ PJ_DEF(pj_status_t) pjsip_tsx_create_uac2(pjsip_module *tsx_user,
     /* Save CSeq. */
     tsx->cseq = cseq->cseq;
 
+    /* Select the worker for the timers. */
+    if (pjsip_endpt_get_worker_cnt(tsx->endpt)) {
+	pjsip_cid_hdr *cid = PJSIP_MSG_CID_HDR(msg);
+	tsx_init_worker(tsx, cid ? &cid->id : NULL);
+    }
+
     /* Generate Via header if it doesn't exist. */
     via = (pjsip_via_hdr*) pjsip_msg_find_hdr(msg, PJSIP_H_VIA, NULL);
     if (via == NULL) {
@@ -1329,15 +1755,7 @@ PJ_DEF(pj_status_t) pjsip_tsx_create_uac2(pjsip_module *tsx_user,
 
     /* Generate branch parameter if it doesn't exist. */
     if (via->branch_param.slen == 0) {
-	pj_str_t tmp;
-	via->branch_param.ptr = (char*)
-				pj_pool_alloc(tsx->pool, PJSIP_MAX_BRANCH_LEN);
-	via->branch_param.slen = PJSIP_MAX_BRANCH_LEN;
-	pj_memcpy(via->branch_param.ptr, PJSIP_RFC3261_BRANCH_ID, 
-		  PJSIP_RFC3261_BRANCH_LEN);
-	tmp.ptr = via->branch_param.ptr + PJSIP_RFC3261_BRANCH_LEN + 2;
-	*(tmp.ptr-2) = 80; *(tmp.ptr-1) = 106;
-	pj_generate_unique_string( &tmp );
+	generate_branch(tsx->pool, &via->branch_param);
 
         /* Save branch parameter. */
         tsx->branch = via->branch_param;
@@ -1352,10 +1770,8 @@ PJ_DEF(pj_status_t) pjsip_tsx_create_uac2(pjsip_module *tsx_user,
 			 PJSIP_ROLE_UAC, &tsx->method, 
 			 &via->branch_param);
 
-    /* Calculate hashed key value. */
-#ifdef PRECALC_HASH
-    tsx->hashed_key = pj_hash_calc_tolower(0, NULL, &tsx->transaction_key);
-#endif
+    /* Calculate binary key. */
+    tsx_init_bin_key(tsx);
 
     PJ_LOG(6, (tsx->obj_name, "tsx_key=%.*s", tsx->transaction_key.slen,
 	       tsx->transaction_key.ptr));
@@ -1480,6 +1896,10 @@ PJ_DEF(pj_status_t) pjsip_tsx_create_uas2(pjsip_module *tsx_user,
     /* Save CSeq */
     tsx->cseq = cseq->cseq;
 
+    /* Select the worker for the timers. */
+    if (pjsip_endpt_get_worker_cnt(tsx->endpt))
+	tsx_init_worker(tsx, &rdata->msg_info.cid->id);
+
     /* Get transaction key either from branch for RFC3261 message, or
      * create transaction key.
      */
@@ -1491,15 +1911,13 @@ PJ_DEF(pj_status_t) pjsip_tsx_create_uas2(pjsip_module *tsx_user,
         return status;
     }
 
-    /* Calculate hashed key value. */
-#ifdef PRECALC_HASH
-    tsx->hashed_key = pj_hash_calc_tolower(0, NULL, &tsx->transaction_key);
-#endif
-
     /* Duplicate branch parameter for transaction. */
     branch = &rdata->msg_info.via->branch_param;
     pj_strdup(tsx->pool, &tsx->branch, branch);
 
+    /* Calculate binary key. */
+    tsx_init_bin_key(tsx);
+
     PJ_LOG(6, (tsx->obj_name, "tsx_key=%.*s", tsx->transaction_key.slen,
 	       tsx->transaction_key.ptr));
 
@@ -2045,7 +2463,29 @@ static pj_status_t tsx_send_msg( pjsip_transaction *tsx,
 	    pj_grp_lock_dec_ref(tsx->grp_lock);
 	}
 
-	if (status != PJ_SUCCESS) {
+	if (status == PJSIP_ETPQUEUEFULL) {
+	    char errmsg[PJ_ERR_MSG_SIZE];
+	    pj_str_t err;
+
+	    /* The transport's outgoing queue is full. Resolving the
+	     * destination again would only give us the same congested
+	     * connection, so fail the transaction now and let the upper
+	     * layer back off.
+	     */
+	    err = pj_strerror(status, errmsg, sizeof(errmsg));
+
+	    PJ_LOG(2,(tsx->obj_name, 
+		      "Transport congested, terminating transaction. "
+		      "Err=%d (%s)",
+		      status, errmsg));
+
+	    tsx_set_status_code(tsx, PJSIP_SC_TSX_TRANSPORT_ERROR, &err);
+	    tsx_set_state( tsx, PJSIP_TSX_STATE_TERMINATED, 
+			   PJSIP_EVENT_TRANSPORT_ERROR, NULL );
+
+	    return status;
+
+	} else if (status != PJ_SUCCESS) {
 	    PJ_PERROR(2,(tsx->obj_name, status,
 		         "Error sending %s",
 		         pjsip_tx_data_get_info(tdata)));
@@ -24,7 +24,9 @@
 #include <pjsip/sip_private.h>
 #include <pjsip/sip_errno.h>
 #include <pjsip/sip_module.h>
+#include <pj/compat/socket.h>
 #include <pj/addr_resolv.h>
+#include <pj/array.h>
 #include <pj/except.h>
 #include <pj/os.h>
 #include <pj/log.h>
@@ -56,6 +58,16 @@ static const char *addr_string(const pj_sockaddr_t *addr)
 
 /* Prototype. */
 static pj_status_t mod_on_tx_msg(pjsip_tx_data *tdata);
+static void conn_pool_on_register(pjsip_tpmgr *mgr, pjsip_transport *tp);
+static void conn_pool_remove(pjsip_tpmgr *mgr, pjsip_transport *tp,
+			     pj_bool_t release);
+static pj_status_t conn_pool_acquire(pjsip_tpmgr *mgr,
+				     pjsip_transport_type_e type,
+				     const pj_sockaddr_t *remote,
+				     int addr_len,
+				     pjsip_tx_data *tdata,
+				     pjsip_transport **tp);
+static void conn_pool_check_alias(pjsip_tpmgr *mgr, pjsip_rx_data *rdata);
 
 /* This module has sole purpose to print transmit data to contigous buffer
  * before actually transmitted to the wire. 
@@ -77,6 +89,29 @@ static pjsip_module mod_msg_print =
     NULL,				/* on_tsx_state()		    */
 };
 
+/*
+ * Connection pool to a destination (see pjsip_tpmgr_set_conn_pool()).
+ */
+struct conn_pool
+{
+    PJ_DECL_LIST_MEMBER(struct conn_pool);
+
+    pjsip_transport_key	      key;
+    int			      key_len;
+    pj_hash_entry_buf	      hentry;
+    pjsip_tpmgr_conn_pool_cfg cfg;
+    pj_bool_t		      is_alias;
+
+    /* Pool members. A reference is held to members with held flag set,
+     * to keep cfg.min_conn connections open.
+     */
+    unsigned		      cnt;
+    struct {
+	pjsip_transport	     *tp;
+	pj_bool_t	      held;
+    } member[PJSIP_TPMGR_CONN_POOL_MAX];
+};
+
 /*
  * Transport manager.
  */
@@ -84,6 +119,7 @@ struct pjsip_tpmgr
 {
     pj_hash_table_t *table;
     pj_lock_t	    *lock;
+    pj_pool_t	    *pool;
     pjsip_endpoint  *endpt;
     pjsip_tpfactory  factory_list;
 #if defined(PJ_DEBUG) && PJ_DEBUG!=0
@@ -97,6 +133,23 @@ struct pjsip_tpmgr
      * is destroyed.
      */
     pjsip_tx_data    tdata_list;
+
+    /* Lock object shared by all transmit buffers */
+    pj_lock_t	    *tdata_lock;
+
+    /* Connection pools indexed by destination, and unused pool entries. */
+    pj_hash_table_t *conn_pools;
+    struct conn_pool free_conn_pools;
+
+#if PJSIP_TP_DATA_CACHE_SIZE
+    /* Per-thread free lists of tdata/rdata pools. The thread local value
+     * is the free list of the thread. The lock only guards the assignment
+     * of the free lists, and nothing else is locked while holding it.
+     */
+    long	     cache_tls;
+    pj_lock_t	    *cache_lock;
+    struct tp_data_cache *caches;
+#endif
 };
 
 
@@ -118,6 +171,9 @@ typedef struct transport_data
     /* Transport listeners */
     tp_state_listener	    st_listeners;
     tp_state_listener	    st_listeners_empty;
+
+    /* Number of listener entries allocated */
+    unsigned		    st_listener_cnt;
 } transport_data;
 
 
@@ -138,7 +194,7 @@ static struct transport_names_t
     const char		  *description;	    /* Longer description   */
     unsigned		   flag;	    /* Flags		    */
     char		   name_buf[16];    /* For user's transport */
-} transport_names[16] = 
+} transport_names[20] = 
 {
     { 
 	PJSIP_TRANSPORT_UNSPECIFIED, 
@@ -189,6 +245,20 @@ static struct transport_names_t
 	"Loopback datagram transport", 
 	PJSIP_TRANSPORT_DATAGRAM
     },
+    {
+	PJSIP_TRANSPORT_WS,
+	80,
+	{"WS", 2},
+	"WebSocket transport",
+	PJSIP_TRANSPORT_RELIABLE
+    },
+    {
+	PJSIP_TRANSPORT_WSS,
+	443,
+	{"WSS", 3},
+	"Secure WebSocket transport",
+	PJSIP_TRANSPORT_RELIABLE | PJSIP_TRANSPORT_SECURE
+    },
     { 
 	PJSIP_TRANSPORT_UDP6, 
 	5060, 
@@ -210,6 +280,20 @@ static struct transport_names_t
 	"TLS IPv6 transport",
 	PJSIP_TRANSPORT_RELIABLE | PJSIP_TRANSPORT_SECURE
     },
+    {
+	PJSIP_TRANSPORT_WS6,
+	80,
+	{"WS", 2},
+	"WebSocket IPv6 transport",
+	PJSIP_TRANSPORT_RELIABLE
+    },
+    {
+	PJSIP_TRANSPORT_WSS6,
+	443,
+	{"WSS", 3},
+	"Secure WebSocket IPv6 transport",
+	PJSIP_TRANSPORT_RELIABLE | PJSIP_TRANSPORT_SECURE
+    },
 };
 
 static void tp_state_callback(pjsip_transport *tp,
@@ -387,6 +471,143 @@ PJ_DEF(void) pjsip_tpselector_dec_ref(pjsip_tpselector *sel)
  *
  *****************************************************************************/
 
+#if PJSIP_TP_DATA_CACHE_SIZE
+
+/* Type of object which pool is recycled */
+enum tp_data_type
+{
+    TP_DATA_TDATA,
+    TP_DATA_RDATA
+};
+
+/* Free list of reset tdata/rdata pools, owned by one thread */
+struct tp_data_cache
+{
+    pjsip_tpmgr	*mgr;
+    pj_bool_t	 in_use;
+    unsigned	 cnt[2];
+    pj_pool_t	*pool[2][PJSIP_TP_DATA_CACHE_SIZE];
+};
+
+/* Thread local value of threads that didn't get a free list */
+static struct tp_data_cache tp_data_no_cache;
+
+/* Release the pools in the free list. */
+static void tp_data_cache_clear(struct tp_data_cache *cache)
+{
+    unsigned i;
+
+    for (i=0; i<cache->cnt[TP_DATA_TDATA]; ++i)
+	pjsip_endpt_release_pool(cache->mgr->endpt,
+				 cache->pool[TP_DATA_TDATA][i]);
+    for (i=0; i<cache->cnt[TP_DATA_RDATA]; ++i)
+	pj_pool_release(cache->pool[TP_DATA_RDATA][i]);
+
+    cache->cnt[TP_DATA_TDATA] = cache->cnt[TP_DATA_RDATA] = 0;
+}
+
+/* Called when a thread that got a free list exits. Release the pools
+ * and give the free list to the next thread that asks for one. This
+ * must not take the manager lock, since the thread may be exiting
+ * because a transport that is being destroyed with the lock held is
+ * waiting for it.
+ */
+static void tp_data_cache_on_thread_exit(void *value)
+{
+    struct tp_data_cache *cache = (struct tp_data_cache*)value;
+
+    if (cache == &tp_data_no_cache)
+	return;
+
+    tp_data_cache_clear(cache);
+
+    pj_lock_acquire(cache->mgr->cache_lock);
+    cache->in_use = PJ_FALSE;
+    pj_lock_release(cache->mgr->cache_lock);
+}
+
+/* Get the free list of the calling thread, NULL if the thread has none. */
+static struct tp_data_cache *get_tp_data_cache(pjsip_tpmgr *mgr)
+{
+    struct tp_data_cache *cache;
+    unsigned i;
+
+    if (mgr->cache_tls == -1)
+	return NULL;
+
+    cache = (struct tp_data_cache*) pj_thread_local_get(mgr->cache_tls);
+    if (cache)
+	return cache==&tp_data_no_cache ? NULL : cache;
+
+    /* First call in this thread, assign a free list if there's still
+     * one available. Otherwise remember that this thread has none.
+     */
+    cache = &tp_data_no_cache;
+    pj_lock_acquire(mgr->cache_lock);
+    for (i=0; i<PJSIP_TP_DATA_CACHE_THREADS; ++i) {
+	if (!mgr->caches[i].in_use) {
+	    cache = &mgr->caches[i];
+	    cache->in_use = PJ_TRUE;
+	    break;
+	}
+    }
+    pj_lock_release(mgr->cache_lock);
+
+    pj_thread_local_set(mgr->cache_tls, cache);
+
+    return cache==&tp_data_no_cache ? NULL : cache;
+}
+
+/* Get a recycled pool from the free list of the calling thread. */
+static pj_pool_t *tp_data_cache_get(pjsip_tpmgr *mgr, enum tp_data_type type)
+{
+    struct tp_data_cache *cache = get_tp_data_cache(mgr);
+
+    if (!cache || cache->cnt[type] == 0)
+	return NULL;
+
+    return cache->pool[type][--cache->cnt[type]];
+}
+
+/* Reset the pool and keep it in the free list of the calling thread.
+ * Returns PJ_FALSE if the pool must be released instead.
+ */
+static pj_bool_t tp_data_cache_put(pjsip_tpmgr *mgr, enum tp_data_type type,
+				   pj_pool_t *pool)
+{
+    struct tp_data_cache *cache = get_tp_data_cache(mgr);
+
+    if (!cache || cache->cnt[type] == PJSIP_TP_DATA_CACHE_SIZE)
+	return PJ_FALSE;
+
+    pj_pool_reset(pool);
+    cache->pool[type][cache->cnt[type]++] = pool;
+    return PJ_TRUE;
+}
+
+/* Release all pools in the free lists. */
+static void tp_data_cache_destroy(pjsip_tpmgr *mgr)
+{
+    unsigned i;
+
+    /* No more thread exit callbacks after the index is freed */
+    if (mgr->cache_tls != -1) {
+	pj_thread_local_set(mgr->cache_tls, NULL);
+	pj_thread_local_free(mgr->cache_tls);
+	mgr->cache_tls = -1;
+    }
+
+    for (i=0; i<PJSIP_TP_DATA_CACHE_THREADS; ++i)
+	tp_data_cache_clear(&mgr->caches[i]);
+
+    if (mgr->cache_lock) {
+	pj_lock_destroy(mgr->cache_lock);
+	mgr->cache_lock = NULL;
+    }
+}
+
+#endif	/* PJSIP_TP_DATA_CACHE_SIZE */
+
 /*
  * Create new transmit buffer.
  */
@@ -399,6 +620,10 @@ PJ_DEF(pj_status_t) pjsip_tx_data_create( pjsip_tpmgr *mgr,
 
     PJ_ASSERT_RETURN(mgr && p_tdata, PJ_EINVAL);
 
+#if PJSIP_TP_DATA_CACHE_SIZE
+    pool = tp_data_cache_get(mgr, TP_DATA_TDATA);
+    if (!pool)
+#endif
     pool = pjsip_endpt_create_pool( mgr->endpt, "tdta%p",
 				    PJSIP_POOL_LEN_TDATA,
 				    PJSIP_POOL_INC_TDATA );
@@ -416,12 +641,7 @@ PJ_DEF(pj_status_t) pjsip_tx_data_create( pjsip_tpmgr *mgr,
 	return status;
     }
     
-    //status = pj_lock_create_simple_mutex(pool, "tdta%p", &tdata->lock);
-    status = pj_lock_create_null_mutex(pool, "tdta%p", &tdata->lock);
-    if (status != PJ_SUCCESS) {
-	pjsip_endpt_release_pool( mgr->endpt, tdata->pool );
-	return status;
-    }
+    tdata->lock = mgr->tdata_lock;
 
     pj_ioqueue_op_key_init(&tdata->op_key.key, sizeof(tdata->op_key.key));
     pj_list_init(tdata);
@@ -467,7 +687,15 @@ static void tx_data_destroy(pjsip_tx_data *tdata)
 #endif
 
     pj_atomic_destroy( tdata->ref_cnt );
-    pj_lock_destroy( tdata->lock );
+
+    if (tdata->shared_grp_lock)
+	pj_grp_lock_dec_ref(tdata->shared_grp_lock);
+
+#if PJSIP_TP_DATA_CACHE_SIZE
+    /* Keep the pool for the next tdata instead of releasing it */
+    if (tp_data_cache_put(tdata->mgr, TP_DATA_TDATA, tdata->pool))
+	return;
+#endif
     pjsip_endpt_release_pool( tdata->mgr->endpt, tdata->pool );
 }
 
@@ -635,12 +863,21 @@ PJ_DEF(pj_status_t) pjsip_rx_data_clone( const pjsip_rx_data *src,
                                          unsigned flags,
                                          pjsip_rx_data **p_rdata)
 {
-    pj_pool_t *pool;
+    pj_pool_t *pool = NULL;
     pjsip_rx_data *dst;
     pjsip_hdr *hdr;
 
     PJ_ASSERT_RETURN(src && flags==0 && p_rdata, PJ_EINVAL);
 
+#if PJSIP_TP_DATA_CACHE_SIZE
+    {
+	pjsip_tpmgr *mgr = src->tp_info.transport->tpmgr;
+
+	if (mgr && mgr->pool->factory == src->tp_info.pool->factory)
+	    pool = tp_data_cache_get(mgr, TP_DATA_RDATA);
+    }
+    if (!pool)
+#endif
     pool = pj_pool_create(src->tp_info.pool->factory,
                           "rtd%p",
                           PJSIP_POOL_RDATA_LEN,
@@ -662,6 +899,7 @@ PJ_DEF(pj_status_t) pjsip_rx_data_clone( const pjsip_rx_data *src,
     dst->msg_info.msg_buf = dst->pkt_info.packet;
     dst->msg_info.len = src->msg_info.len;
     dst->msg_info.msg = pjsip_msg_clone(pool, src->msg_info.msg);
+    dst->msg_info.raw_pos = src->msg_info.raw_pos;
     pj_list_init(&dst->msg_info.parse_err);
 
 #define GET_MSG_HDR2(TYPE, type, var)	\
@@ -705,9 +943,23 @@ PJ_DEF(pj_status_t) pjsip_rx_data_clone( const pjsip_rx_data *src,
 /* Free previously cloned pjsip_rx_data. */
 PJ_DEF(pj_status_t) pjsip_rx_data_free_cloned(pjsip_rx_data *rdata)
 {
+    pjsip_tpmgr *mgr;
+
     PJ_ASSERT_RETURN(rdata, PJ_EINVAL);
 
+    /* Transport may be destroyed once the reference is released */
+    mgr = rdata->tp_info.transport->tpmgr;
     pjsip_transport_dec_ref(rdata->tp_info.transport);
+
+#if PJSIP_TP_DATA_CACHE_SIZE
+    if (mgr && mgr->pool->factory == rdata->tp_info.pool->factory &&
+	tp_data_cache_put(mgr, TP_DATA_RDATA, rdata->tp_info.pool))
+    {
+	return PJ_SUCCESS;
+    }
+#else
+    PJ_UNUSED_ARG(mgr);
+#endif
     pj_pool_release(rdata->tp_info.pool);
 
     return PJ_SUCCESS;
@@ -899,8 +1151,10 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_send_raw(pjsip_tpmgr *mgr,
 	tdata->buf.end = tdata->buf.start + data_len + 1;
     }
  
-    /* Copy data, if any! (application may send zero len packet) */
-    if (data_len) {
+    /* Copy data, if any! (application may send zero len packet). The
+     * data may already be in tdata's buffer.
+     */
+    if (data_len && raw_data != tdata->buf.start) {
 	pj_memcpy(tdata->buf.start, raw_data, data_len);
     }
     tdata->buf.cur = tdata->buf.start + data_len;
@@ -1002,6 +1256,356 @@ PJ_DEF(pj_status_t) pjsip_transport_dec_ref( pjsip_transport *tp )
 }
 
 
+/*
+ * Get outgoing queue info.
+ */
+PJ_DEF(pj_status_t) pjsip_transport_get_queue_info(
+					pjsip_transport *tp,
+					pjsip_transport_queue_info *info)
+{
+    PJ_ASSERT_RETURN(tp && info, PJ_EINVAL);
+
+    pj_bzero(info, sizeof(*info));
+
+    if (tp->get_queue_info == NULL)
+	return PJ_ENOTSUP;
+
+    return (*tp->get_queue_info)(tp, info);
+}
+
+
+/*****************************************************************************
+ *
+ * OUTGOING MESSAGE QUEUE
+ *
+ *****************************************************************************/
+
+/* Get the length of the message in the transmit data op_key */
+#define TX_LEN(op_key)	    ((op_key)->tdata->buf.cur - \
+			     (op_key)->tdata->buf.start)
+
+/*
+ * Initialize the outgoing message queue.
+ */
+PJ_DEF(void) pjsip_tx_queue_init(pjsip_tx_queue *q,
+				 pjsip_transport *tp,
+				 const pjsip_tx_queue_cb *cb,
+				 pj_size_t max_bytes,
+				 pj_size_t buf_size)
+{
+    pj_assert(q && tp && cb && cb->send && cb->is_ready && cb->tx_done);
+    pj_assert((cb->frame_len == NULL) == (cb->build_frame == NULL));
+
+    pj_bzero(q, sizeof(*q));
+    q->tp = tp;
+    pj_memcpy(&q->cb, cb, sizeof(*cb));
+    q->max_bytes = max_bytes;
+    q->buf_size = buf_size;
+    pj_list_init(&q->list);
+    pj_list_init(&q->batch);
+    pj_ioqueue_op_key_init(&q->op_key.key, sizeof(pj_ioqueue_op_key_t));
+}
+
+/* Put the message at the back of the queue. Transport lock must be held. */
+static void tx_queue_push(pjsip_tx_queue *q, pjsip_tx_data_op_key *op_key)
+{
+    pjsip_tx_queue_entry *e;
+
+    e = PJ_POOL_ZALLOC_T(op_key->tdata->pool, pjsip_tx_queue_entry);
+    e->op_key = op_key;
+    pj_list_push_back(&q->list, e);
+    ++q->cnt;
+    q->bytes += TX_LEN(op_key);
+}
+
+/*
+ * Called when a write started by the queue has completed.
+ */
+static pj_bool_t tx_queue_write_done(pjsip_tx_queue *q,
+				     pj_ioqueue_op_key_t *op_key,
+				     pj_ssize_t sent)
+{
+    pj_bool_t ret = PJ_TRUE;
+
+    if (op_key == &q->op_key.key) {
+	pjsip_tx_queue_entry batch;
+
+	/* Buffer write has completed, notify each message in it. */
+	pj_list_init(&batch);
+
+	pj_lock_acquire(q->tp->lock);
+	pj_list_merge_last(&batch, &q->batch);
+	q->inflight_cnt = 0;
+	q->inflight_bytes = 0;
+	pj_lock_release(q->tp->lock);
+
+	while (!pj_list_empty(&batch)) {
+	    pjsip_tx_queue_entry *e = batch.next;
+	    pjsip_tx_data_op_key *tdata_op_key = e->op_key;
+	    pj_ssize_t size;
+
+	    pj_list_erase(e);
+	    size = (sent > 0) ? TX_LEN(tdata_op_key) : sent;
+	    if (!(*q->cb.tx_done)(q->tp, (pj_ioqueue_op_key_t*)tdata_op_key,
+				  size))
+	    {
+		ret = PJ_FALSE;
+	    }
+	}
+
+    } else {
+	pj_lock_acquire(q->tp->lock);
+	q->inflight_cnt = 0;
+	q->inflight_bytes = 0;
+	pj_lock_release(q->tp->lock);
+
+	ret = (*q->cb.tx_done)(q->tp, op_key, sent);
+    }
+
+    return ret;
+}
+
+/*
+ * Send the transmit data, or queue it if a write is in progress.
+ */
+PJ_DEF(pj_status_t) pjsip_tx_queue_send(pjsip_tx_queue *q,
+					pjsip_tx_data *tdata)
+{
+    pj_ssize_t size = tdata->buf.cur - tdata->buf.start;
+    pj_size_t queued_bytes;
+    pj_bool_t flush = PJ_FALSE;
+    pj_status_t status;
+
+    pj_lock_acquire(q->tp->lock);
+
+    if (q->inflight_cnt == 0 && pj_list_empty(&q->list) &&
+	q->cb.build_frame == NULL)
+    {
+	/* Nothing is being written, write the message right away from
+	 * the transmit data buffer.
+	 */
+	q->inflight_cnt = 1;
+	q->inflight_bytes = size;
+	status = (*q->cb.send)(q->tp, (pj_ioqueue_op_key_t*)&tdata->op_key,
+			       tdata->buf.start, &size);
+	if (status != PJ_EPENDING) {
+	    q->inflight_cnt = 0;
+	    q->inflight_bytes = 0;
+	}
+
+	pj_lock_release(q->tp->lock);
+
+	if (status != PJ_EPENDING) {
+	    /* Not pending (could be immediate success or error) */
+	    tdata->op_key.tdata = NULL;
+
+	    if (status == PJ_SUCCESS && size <= 0)
+		status = PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
+	}
+
+	return status;
+    }
+
+    /* A write is still in progress. Queue the message to be written
+     * together with other queued messages once the write completes,
+     * unless the queue is full.
+     */
+    if (q->max_bytes && q->bytes + size > q->max_bytes) {
+	++q->rejected_cnt;
+	tdata->op_key.tdata = NULL;
+	status = PJSIP_ETPQUEUEFULL;
+    } else {
+	tx_queue_push(q, &tdata->op_key);
+	flush = (q->inflight_cnt == 0);
+	status = PJ_EPENDING;
+    }
+    queued_bytes = q->bytes;
+
+    pj_lock_release(q->tp->lock);
+
+    if (status == PJSIP_ETPQUEUEFULL) {
+	PJ_LOG(4,(q->tp->obj_name, "%s send queue full (%lu bytes queued), "
+		  "rejecting %s", q->tp->type_name,
+		  (unsigned long)queued_bytes, pjsip_tx_data_get_info(tdata)));
+    } else if (flush) {
+	pjsip_tx_queue_flush(q);
+    }
+
+    return status;
+}
+
+/*
+ * Add the transmit data to the queue without writing it.
+ */
+PJ_DEF(void) pjsip_tx_queue_add(pjsip_tx_queue *q,
+				pjsip_tx_data_op_key *op_key)
+{
+    pj_lock_acquire(q->tp->lock);
+    tx_queue_push(q, op_key);
+    pj_lock_release(q->tp->lock);
+}
+
+/*
+ * Write the queued messages. Consecutive small messages are copied to
+ * the write buffer and written with a single send operation, so that a
+ * burst of messages (e.g. NOTIFYs or responses) costs one socket
+ * operation.
+ */
+PJ_DEF(void) pjsip_tx_queue_flush(pjsip_tx_queue *q)
+{
+    for (;;) {
+	pjsip_tx_queue_entry *e;
+	pj_ioqueue_op_key_t *op_key;
+	char *buf;
+	pj_ssize_t size;
+	pj_status_t status;
+
+	pj_lock_acquire(q->tp->lock);
+
+	if (q->inflight_cnt || pj_list_empty(&q->list) ||
+	    !(*q->cb.is_ready)(q->tp))
+	{
+	    pj_lock_release(q->tp->lock);
+	    return;
+	}
+
+	e = q->list.next;
+	size = TX_LEN(e->op_key);
+
+	if (q->cb.build_frame == NULL &&
+	    (e->next == &q->list || (pj_size_t)size >= q->buf_size))
+	{
+	    /* Only one message to write, or it's too large to coalesce.
+	     * Write it directly from the transmit data buffer.
+	     */
+	    pj_list_erase(e);
+	    --q->cnt;
+	    q->bytes -= size;
+	    q->inflight_cnt = 1;
+
+	    op_key = (pj_ioqueue_op_key_t*)e->op_key;
+	    buf = e->op_key->tdata->buf.start;
+
+	} else {
+	    if (q->buf == NULL)
+		q->buf = (char*) pj_pool_alloc(q->tp->pool, q->buf_size);
+
+	    /* Copy as many queued messages as would fit in the buffer */
+	    size = 0;
+	    while (!pj_list_empty(&q->list)) {
+		pj_size_t len, frame_len;
+
+		e = q->list.next;
+		len = TX_LEN(e->op_key);
+		frame_len = q->cb.frame_len ? (*q->cb.frame_len)(q->tp, len) :
+					      len;
+		if (size + frame_len > q->buf_size)
+		    break;
+
+		if (q->cb.build_frame) {
+		    (*q->cb.build_frame)(q->tp, q->buf + size,
+					 e->op_key->tdata->buf.start, len);
+		} else {
+		    pj_memcpy(q->buf + size, e->op_key->tdata->buf.start,
+			      len);
+		}
+		size += frame_len;
+
+		pj_list_erase(e);
+		pj_list_push_back(&q->batch, e);
+		--q->cnt;
+		q->bytes -= len;
+		++q->inflight_cnt;
+	    }
+
+	    /* The transport must not queue messages that can never fit */
+	    pj_assert(q->inflight_cnt != 0);
+
+	    if (q->inflight_cnt > 1)
+		q->coalesced_cnt += q->inflight_cnt;
+
+	    op_key = &q->op_key.key;
+	    buf = q->buf;
+	}
+
+	q->inflight_bytes = size;
+	status = (*q->cb.send)(q->tp, op_key, buf, &size);
+
+	pj_lock_release(q->tp->lock);
+
+	if (status == PJ_EPENDING)
+	    return;
+
+	/* Write completed immediately */
+	if (status != PJ_SUCCESS)
+	    size = -status;
+
+	if (tx_queue_write_done(q, op_key, size) == PJ_FALSE)
+	    return;
+    }
+}
+
+/*
+ * Called by the transport when a write has completed.
+ */
+PJ_DEF(pj_bool_t) pjsip_tx_queue_on_data_sent(pjsip_tx_queue *q,
+					      pj_ioqueue_op_key_t *op_key,
+					      pj_ssize_t sent)
+{
+    if (!tx_queue_write_done(q, op_key, sent))
+	return PJ_FALSE;
+
+    /* Write the messages queued while this write was in progress. */
+    pjsip_tx_queue_flush(q);
+
+    return PJ_TRUE;
+}
+
+/*
+ * Cancel all queued messages.
+ */
+PJ_DEF(void) pjsip_tx_queue_cancel(pjsip_tx_queue *q, pj_status_t reason)
+{
+    pjsip_tx_queue_entry list;
+
+    pj_list_init(&list);
+
+    /* Include the messages in the buffer write that is still in
+     * progress.
+     */
+    pj_lock_acquire(q->tp->lock);
+    pj_list_merge_last(&list, &q->batch);
+    pj_list_merge_last(&list, &q->list);
+    q->cnt = 0;
+    q->bytes = 0;
+    pj_lock_release(q->tp->lock);
+
+    while (!pj_list_empty(&list)) {
+	pjsip_tx_queue_entry *e = list.next;
+
+	pj_list_erase(e);
+	(*q->cb.tx_done)(q->tp, (pj_ioqueue_op_key_t*)e->op_key, -reason);
+    }
+}
+
+/*
+ * Get the state of the queue.
+ */
+PJ_DEF(void) pjsip_tx_queue_get_info(pjsip_tx_queue *q,
+				     pjsip_transport_queue_info *info)
+{
+    pj_lock_acquire(q->tp->lock);
+    info->queued_cnt = q->cnt;
+    info->queued_bytes = q->bytes;
+    info->inflight_cnt = q->inflight_cnt;
+    info->inflight_bytes = q->inflight_bytes;
+    info->max_queued_bytes = q->max_bytes;
+    info->coalesced_cnt = q->coalesced_cnt;
+    info->rejected_cnt = q->rejected_cnt;
+    pj_lock_release(q->tp->lock);
+}
+
+
 /**
  * Register a transport.
  */
@@ -1014,6 +1618,7 @@ PJ_DEF(pj_status_t) pjsip_transport_register( pjsip_tpmgr *mgr,
 
     /* Init. */
     tp->tpmgr = mgr;
+    tp->conn_pool = NULL;
     pj_bzero(&tp->idle_timer, sizeof(tp->idle_timer));
     tp->idle_timer.user_data = tp;
     tp->idle_timer.cb = &transport_idle_callback;
@@ -1033,6 +1638,9 @@ PJ_DEF(pj_status_t) pjsip_transport_register( pjsip_tpmgr *mgr,
     /* Register new entry */
     pj_hash_set(tp->pool, mgr->table, &tp->key, key_len, hval, tp);
 
+    /* Add to the connection pool of the destination, if any */
+    conn_pool_on_register(mgr, tp);
+
     pj_lock_release(mgr->lock);
 
     TRACE_((THIS_FILE,"Transport %s registered: type=%s, remote=%s:%d",
@@ -1077,6 +1685,9 @@ static pj_status_t destroy_transport( pjsip_tpmgr *mgr,
     if (entry == (void*)tp)
 	pj_hash_set(NULL, mgr->table, &tp->key, key_len, hval, NULL);
 
+    /* Remove from connection pool */
+    conn_pool_remove(mgr, tp, PJ_FALSE);
+
     pj_lock_release(mgr->lock);
 
     /* Destroy. */
@@ -1126,6 +1737,11 @@ PJ_DEF(pj_status_t) pjsip_transport_shutdown(pjsip_transport *tp)
     if (status == PJ_SUCCESS)
 	tp->is_shutdown = PJ_TRUE;
 
+    /* Don't give this transport from the connection pool anymore, and
+     * release the pool's reference.
+     */
+    conn_pool_remove(mgr, tp, PJ_TRUE);
+
     /* If transport reference count is zero, start timer count-down */
     if (pj_atomic_get(tp->ref_cnt) == 0) {
 	pjsip_transport_add_ref(tp);
@@ -1164,6 +1780,511 @@ PJ_DEF(pj_status_t) pjsip_transport_destroy( pjsip_transport *tp)
 
 
 
+/*****************************************************************************
+ *
+ * CONNECTION POOL
+ *
+ *****************************************************************************/
+
+/* Init transport key for the destination, returning the key length */
+static int conn_pool_init_key(pjsip_transport_key *key,
+			      pjsip_transport_type_e type,
+			      const pj_sockaddr_t *remote,
+			      int addr_len)
+{
+    pj_bzero(key, sizeof(*key));
+    key->type = type;
+    pj_memcpy(&key->rem_addr, remote, addr_len);
+    return sizeof(key->type) + addr_len;
+}
+
+/* Find the pool of the destination. Must be called with mgr->lock held. */
+static struct conn_pool *conn_pool_find(pjsip_tpmgr *mgr,
+					const pjsip_transport_key *key,
+					int key_len)
+{
+    return (struct conn_pool*) pj_hash_get(mgr->conn_pools, key, key_len,
+					   NULL);
+}
+
+/* Create pool for the destination. Must be called with mgr->lock held. */
+static struct conn_pool *conn_pool_create(pjsip_tpmgr *mgr,
+					  const pjsip_transport_key *key,
+					  int key_len)
+{
+    struct conn_pool *cp;
+
+    if (!pj_list_empty(&mgr->free_conn_pools)) {
+	cp = mgr->free_conn_pools.next;
+	pj_list_erase(cp);
+	pj_bzero(cp, sizeof(*cp));
+    } else {
+	cp = PJ_POOL_ZALLOC_T(mgr->pool, struct conn_pool);
+    }
+
+    pj_memcpy(&cp->key, key, key_len);
+    cp->key_len = key_len;
+    pj_hash_set_np(mgr->conn_pools, &cp->key, key_len, 0, cp->hentry, cp);
+
+    return cp;
+}
+
+/* Remove pool from the hash table and keep the entry for reuse. */
+static void conn_pool_free(pjsip_tpmgr *mgr, struct conn_pool *cp)
+{
+    pj_assert(cp->cnt == 0);
+
+    pj_hash_set_np(mgr->conn_pools, &cp->key, cp->key_len, 0, cp->hentry,
+		   NULL);
+    pj_list_push_back(&mgr->free_conn_pools, cp);
+}
+
+/* Hold or release pool members to keep cfg.min_conn connections open. */
+static void conn_pool_update_hold(struct conn_pool *cp)
+{
+    unsigned i, held = 0;
+
+    for (i=0; i<cp->cnt; ++i) {
+	if (cp->member[i].held)
+	    ++held;
+    }
+
+    for (i=0; i<cp->cnt && held < cp->cfg.min_conn; ++i) {
+	if (!cp->member[i].held && !cp->member[i].tp->is_shutdown) {
+	    pjsip_transport_add_ref(cp->member[i].tp);
+	    cp->member[i].held = PJ_TRUE;
+	    ++held;
+	}
+    }
+
+    for (i=cp->cnt; i>0 && held > cp->cfg.min_conn; --i) {
+	if (cp->member[i-1].held) {
+	    cp->member[i-1].held = PJ_FALSE;
+	    --held;
+	    pjsip_transport_dec_ref(cp->member[i-1].tp);
+	}
+    }
+}
+
+/* Add transport to the pool. Must be called with mgr->lock held. */
+static pj_bool_t conn_pool_add(struct conn_pool *cp, pjsip_transport *tp)
+{
+    if (tp->conn_pool || cp->cnt == PJ_ARRAY_SIZE(cp->member))
+	return PJ_FALSE;
+
+    cp->member[cp->cnt].tp = tp;
+    cp->member[cp->cnt].held = PJ_FALSE;
+    ++cp->cnt;
+    tp->conn_pool = cp;
+
+    conn_pool_update_hold(cp);
+
+    return PJ_TRUE;
+}
+
+/* Called when transport is registered, with mgr->lock held. */
+static void conn_pool_on_register(pjsip_tpmgr *mgr, pjsip_transport *tp)
+{
+    struct conn_pool *cp;
+
+    if (pj_hash_count(mgr->conn_pools) == 0 ||
+	(tp->flag & PJSIP_TRANSPORT_DATAGRAM))
+    {
+	return;
+    }
+
+    cp = conn_pool_find(mgr, &tp->key,
+			sizeof(tp->key.type) + tp->addr_len);
+    if (cp)
+	conn_pool_add(cp, tp);
+}
+
+/*
+ * Remove transport from its pool, optionally releasing the reference held
+ * by the pool. Must be called with mgr->lock held.
+ */
+static void conn_pool_remove(pjsip_tpmgr *mgr, pjsip_transport *tp,
+			     pj_bool_t release)
+{
+    struct conn_pool *cp = (struct conn_pool*) tp->conn_pool;
+    pj_bool_t held = PJ_FALSE;
+    unsigned i;
+
+    if (cp == NULL)
+	return;
+
+    for (i=0; i<cp->cnt; ++i) {
+	if (cp->member[i].tp == tp) {
+	    held = cp->member[i].held;
+	    pj_array_erase(cp->member, sizeof(cp->member[0]), cp->cnt, i);
+	    --cp->cnt;
+	    break;
+	}
+    }
+    tp->conn_pool = NULL;
+
+    if (cp->cnt == 0 && cp->is_alias)
+	conn_pool_free(mgr, cp);
+
+    if (held && release)
+	pjsip_transport_dec_ref(tp);
+}
+
+/* Create new connection to the pool destination, with mgr->lock held. */
+static pj_status_t conn_pool_connect(pjsip_tpmgr *mgr,
+				     pjsip_transport_type_e type,
+				     const pj_sockaddr_t *remote,
+				     int addr_len,
+				     pjsip_tx_data *tdata,
+				     pjsip_transport **p_tp)
+{
+    pjsip_tpfactory *factory;
+
+    factory = mgr->factory_list.next;
+    while (factory != &mgr->factory_list) {
+	if (factory->type == type)
+	    break;
+	factory = factory->next;
+    }
+
+    if (factory == &mgr->factory_list)
+	return PJSIP_EUNSUPTRANSPORT;
+
+    if (factory->create_transport2) {
+	return factory->create_transport2(factory, mgr, mgr->endpt,
+					  (const pj_sockaddr*) remote,
+					  addr_len, tdata, p_tp);
+    } else {
+	return factory->create_transport(factory, mgr, mgr->endpt,
+					 (const pj_sockaddr*) remote,
+					 addr_len, p_tp);
+    }
+}
+
+/*
+ * Get the least loaded connection from the pool of the destination, or
+ * open a new one. Returns PJ_ENOTFOUND if there is no usable pool.
+ */
+static pj_status_t conn_pool_acquire(pjsip_tpmgr *mgr,
+				     pjsip_transport_type_e type,
+				     const pj_sockaddr_t *remote,
+				     int addr_len,
+				     pjsip_tx_data *tdata,
+				     pjsip_transport **p_tp)
+{
+    pjsip_transport *cand[PJSIP_TPMGR_CONN_POOL_MAX];
+    pjsip_tpmgr_conn_pool_cfg cfg;
+    pjsip_transport_key key;
+    struct conn_pool *cp;
+    pjsip_transport *best = NULL;
+    pj_size_t best_load = 0;
+    unsigned i, cnt = 0;
+    int key_len;
+    pj_bool_t grow;
+    pj_status_t status;
+
+    if (pjsip_transport_get_flag_from_type(type) & PJSIP_TRANSPORT_DATAGRAM)
+	return PJ_ENOTFOUND;
+
+    key_len = conn_pool_init_key(&key, type, remote, addr_len);
+
+    /* Take a reference to the usable members */
+    pj_lock_acquire(mgr->lock);
+    cp = conn_pool_find(mgr, &key, key_len);
+    if (cp == NULL) {
+	pj_lock_release(mgr->lock);
+	return PJ_ENOTFOUND;
+    }
+
+    cfg = cp->cfg;
+    for (i=0; i<cp->cnt; ++i) {
+	pjsip_transport *tp = cp->member[i].tp;
+
+	if (!tp->is_shutdown && !tp->is_destroying) {
+	    pjsip_transport_add_ref(tp);
+	    cand[cnt++] = tp;
+	}
+    }
+    pj_lock_release(mgr->lock);
+
+    /* Find the least loaded one. The queue info is retrieved without
+     * holding the transport manager lock, as it acquires transport lock.
+     */
+    for (i=0; i<cnt; ++i) {
+	pjsip_transport_queue_info qi;
+	pj_size_t load;
+
+	if (pjsip_transport_get_queue_info(cand[i], &qi) == PJ_SUCCESS) {
+	    /* Skip saturated connection */
+	    if (qi.max_queued_bytes && qi.queued_bytes >= qi.max_queued_bytes)
+		continue;
+	    load = qi.queued_bytes + qi.inflight_bytes;
+	} else {
+	    load = 0;
+	}
+
+	if (best == NULL || load < best_load) {
+	    best = cand[i];
+	    best_load = load;
+	}
+    }
+
+    for (i=0; i<cnt; ++i) {
+	if (cand[i] != best)
+	    pjsip_transport_dec_ref(cand[i]);
+    }
+
+    grow = (cnt < cfg.max_conn) &&
+	   (best == NULL || best_load > cfg.grow_bytes || cnt < cfg.min_conn);
+
+    if (!grow) {
+	if (best == NULL)
+	    return PJ_ENOTFOUND;
+
+	TRACE_((THIS_FILE, "Transport %s acquired from pool", best->obj_name));
+	*p_tp = best;
+	return PJ_SUCCESS;
+    }
+
+    /* Open another connection. The new transport joins the pool when it
+     * registers itself to the transport manager, which happens before the
+     * transport is returned by the factory. The pool size is checked
+     * again and the connection is made with mgr->lock held, so the slot
+     * stays reserved until the transport has joined, and concurrent
+     * callers cannot grow the pool past cfg.max_conn.
+     */
+    pj_lock_acquire(mgr->lock);
+    cp = conn_pool_find(mgr, &key, key_len);
+    if (cp == NULL || cp->cnt >= cp->cfg.max_conn ||
+	cp->cnt >= PJ_ARRAY_SIZE(cp->member))
+    {
+	status = PJ_ETOOMANY;
+    } else {
+	status = conn_pool_connect(mgr, type, remote, addr_len, tdata, p_tp);
+	if (status == PJ_SUCCESS) {
+	    pjsip_transport_add_ref(*p_tp);
+
+	    /* Don't keep a connection that is not owned by the pool */
+	    if ((*p_tp)->conn_pool != cp) {
+		PJ_LOG(4,(THIS_FILE, "Connection %s could not join the pool, "
+			  "closing it", (*p_tp)->obj_name));
+		pjsip_transport_shutdown(*p_tp);
+		pjsip_transport_dec_ref(*p_tp);
+		*p_tp = NULL;
+		status = PJ_ETOOMANY;
+	    } else {
+		cnt = cp->cnt;
+	    }
+	}
+    }
+    pj_lock_release(mgr->lock);
+
+    if (status == PJ_SUCCESS) {
+	PJ_LOG(5,(THIS_FILE, "Pool connection %s created (%d in pool)",
+		  (*p_tp)->obj_name, cnt));
+	if (best)
+	    pjsip_transport_dec_ref(best);
+	return PJ_SUCCESS;
+    }
+
+    /* Use existing connection if new one can't be created */
+    if (best) {
+	*p_tp = best;
+	return PJ_SUCCESS;
+    }
+
+    /* The pool was filled by another caller, and none of its connections
+     * is usable: let the caller find or create a transport as usual.
+     */
+    if (status == PJ_ETOOMANY)
+	return PJ_ENOTFOUND;
+
+    return status;
+}
+
+/*
+ * RFC 5923: add connection which received request with "alias" param in
+ * Via to the pool of the sent-by address. The sent-by host must be the
+ * source address of the connection.
+ */
+static void conn_pool_check_alias(pjsip_tpmgr *mgr, pjsip_rx_data *rdata)
+{
+    const pj_str_t STR_ALIAS = { "alias", 5 };
+    pjsip_transport *tp = rdata->tp_info.transport;
+    pjsip_via_hdr *via = rdata->msg_info.via;
+    pjsip_transport_key key;
+    pj_sockaddr addr;
+    struct conn_pool *cp;
+    int af, port, key_len;
+
+    if (pjsip_param_find(&via->other_param, &STR_ALIAS) == NULL)
+	return;
+
+    /* Only accept IP address of the connection (no DNS lookup) */
+    af = tp->key.rem_addr.addr.sa_family;
+    pj_sockaddr_init(af, &addr, NULL, 0);
+    if (pj_inet_pton(af, &via->sent_by.host,
+		     pj_sockaddr_get_addr(&addr)) != PJ_SUCCESS ||
+	pj_memcmp(pj_sockaddr_get_addr(&addr),
+		  pj_sockaddr_get_addr(&tp->key.rem_addr),
+		  pj_sockaddr_get_addr_len(&addr)) != 0)
+    {
+	return;
+    }
+
+    port = via->sent_by.port;
+    if (port == 0)
+	port = pjsip_transport_get_default_port_for_type(
+				(pjsip_transport_type_e)tp->key.type);
+    pj_sockaddr_set_port(&addr, (pj_uint16_t)port);
+
+    /* Nothing to do if the connection is already the destination */
+    if (pj_sockaddr_cmp(&addr, &tp->key.rem_addr) == 0)
+	return;
+
+    key_len = conn_pool_init_key(&key, (pjsip_transport_type_e)tp->key.type,
+				 &addr, tp->addr_len);
+
+    pj_lock_acquire(mgr->lock);
+
+    if (tp->conn_pool == NULL && !tp->is_shutdown && !tp->is_destroying) {
+	cp = conn_pool_find(mgr, &key, key_len);
+	if (cp == NULL) {
+	    cp = conn_pool_create(mgr, &key, key_len);
+	    cp->is_alias = PJ_TRUE;
+	}
+
+	if (conn_pool_add(cp, tp)) {
+	    char addr_buf[PJ_INET6_ADDRSTRLEN+10];
+
+	    PJ_LOG(5,(tp->obj_name, "Connection is now alias for %s",
+		      pj_sockaddr_print(&addr, addr_buf, sizeof(addr_buf), 3)));
+	}
+    }
+
+    pj_lock_release(mgr->lock);
+}
+
+
+PJ_DEF(void) pjsip_tpmgr_conn_pool_cfg_default(pjsip_tpmgr_conn_pool_cfg *cfg)
+{
+    pj_bzero(cfg, sizeof(*cfg));
+    cfg->max_conn = 1;
+}
+
+
+/*
+ * Configure connection pool to the destination.
+ */
+PJ_DEF(pj_status_t) pjsip_tpmgr_set_conn_pool(pjsip_tpmgr *mgr,
+					pjsip_transport_type_e type,
+					const pj_sockaddr_t *remote,
+					int addr_len,
+					const pjsip_tpmgr_conn_pool_cfg *cfg)
+{
+    pjsip_transport_key key;
+    struct conn_pool *cp;
+    int key_len;
+    pj_status_t status = PJ_SUCCESS;
+
+    PJ_ASSERT_RETURN(mgr && remote && addr_len > 0 &&
+		     addr_len <= (int)sizeof(pj_sockaddr), PJ_EINVAL);
+    PJ_ASSERT_RETURN(!cfg || (cfg->max_conn <= PJSIP_TPMGR_CONN_POOL_MAX &&
+			      cfg->min_conn <= cfg->max_conn), PJ_EINVAL);
+
+    /* Connection pool only makes sense for connection oriented transport */
+    if (pjsip_transport_get_flag_from_type(type) & PJSIP_TRANSPORT_DATAGRAM)
+	return PJSIP_EUNSUPTRANSPORT;
+
+    key_len = conn_pool_init_key(&key, type, remote, addr_len);
+
+    pj_lock_acquire(mgr->lock);
+
+    cp = conn_pool_find(mgr, &key, key_len);
+
+    /* Remove the pool */
+    if (cfg == NULL || cfg->max_conn == 0) {
+	if (cp) {
+	    while (cp->cnt)
+		conn_pool_remove(mgr, cp->member[cp->cnt-1].tp, PJ_TRUE);
+	    if (!cp->is_alias)
+		conn_pool_free(mgr, cp);
+	}
+	pj_lock_release(mgr->lock);
+	return PJ_SUCCESS;
+    }
+
+    if (cp == NULL)
+	cp = conn_pool_create(mgr, &key, key_len);
+
+    pj_memcpy(&cp->cfg, cfg, sizeof(*cfg));
+    cp->is_alias = PJ_FALSE;
+    conn_pool_update_hold(cp);
+
+    /* Open the standby connections */
+    while (cp->cnt < cfg->min_conn) {
+	pjsip_transport *tp;
+	unsigned cnt = cp->cnt;
+
+	status = conn_pool_connect(mgr, type, remote, addr_len, NULL, &tp);
+	if (status != PJ_SUCCESS)
+	    break;
+
+	/* Transport must have joined the pool */
+	if (cp->cnt == cnt) {
+	    pj_assert(!"Transport key doesn't match the pool");
+	    status = PJ_EBUG;
+	    break;
+	}
+    }
+
+    pj_lock_release(mgr->lock);
+
+    return status;
+}
+
+
+/*
+ * Get connection pool info.
+ */
+PJ_DEF(pj_status_t) pjsip_tpmgr_get_conn_pool_info(pjsip_tpmgr *mgr,
+					pjsip_transport_type_e type,
+					const pj_sockaddr_t *remote,
+					int addr_len,
+					pjsip_tpmgr_conn_pool_info *info)
+{
+    pjsip_transport_key key;
+    struct conn_pool *cp;
+    unsigned i;
+    int key_len;
+
+    PJ_ASSERT_RETURN(mgr && remote && addr_len > 0 &&
+		     addr_len <= (int)sizeof(pj_sockaddr) && info, PJ_EINVAL);
+
+    pj_bzero(info, sizeof(*info));
+    key_len = conn_pool_init_key(&key, type, remote, addr_len);
+
+    pj_lock_acquire(mgr->lock);
+
+    cp = conn_pool_find(mgr, &key, key_len);
+    if (cp == NULL) {
+	pj_lock_release(mgr->lock);
+	return PJ_ENOTFOUND;
+    }
+
+    info->conn_cnt = cp->cnt;
+    for (i=0; i<cp->cnt; ++i) {
+	if (cp->member[i].held)
+	    ++info->standby_cnt;
+    }
+    info->is_alias = cp->is_alias;
+
+    pj_lock_release(mgr->lock);
+
+    return PJ_SUCCESS;
+}
+
+
 /*****************************************************************************
  *
  * TRANSPORT FACTORY
@@ -1242,6 +2363,9 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_create( pj_pool_t *pool,
 					pjsip_tpmgr **p_mgr)
 {
     pjsip_tpmgr *mgr;
+#if PJSIP_TP_DATA_CACHE_SIZE
+    unsigned i;
+#endif
     pj_status_t status;
 
     PJ_ASSERT_RETURN(pool && endpt && rx_cb && p_mgr, PJ_EINVAL);
@@ -1253,6 +2377,7 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_create( pj_pool_t *pool,
 
     /* Create and initialize transport manager. */
     mgr = PJ_POOL_ZALLOC_T(pool, pjsip_tpmgr);
+    mgr->pool = pool;
     mgr->endpt = endpt;
     mgr->on_rx_msg = rx_cb;
     mgr->on_tx_msg = tx_cb;
@@ -1263,13 +2388,49 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_create( pj_pool_t *pool,
     if (!mgr->table)
 	return PJ_ENOMEM;
 
+    mgr->conn_pools = pj_hash_create(pool, PJSIP_TPMGR_HTABLE_SIZE);
+    if (!mgr->conn_pools)
+	return PJ_ENOMEM;
+    pj_list_init(&mgr->free_conn_pools);
+
     status = pj_lock_create_recursive_mutex(pool, "tmgr%p", &mgr->lock);
     if (status != PJ_SUCCESS)
 	return status;
 
+    /* Transmit buffers are not locked, so they all share one null lock
+     * instead of creating their own.
+     */
+    status = pj_lock_create_null_mutex(pool, "tdta%p", &mgr->tdata_lock);
+    if (status != PJ_SUCCESS) {
+	pj_lock_destroy(mgr->lock);
+	return status;
+    }
+
+#if PJSIP_TP_DATA_CACHE_SIZE
+    /* Without thread local storage the objects are simply not recycled.
+     * Without thread exit callbacks the free list of a thread that exits
+     * is kept until the transport manager is destroyed.
+     */
+    mgr->caches = (struct tp_data_cache*)
+		  pj_pool_calloc(pool, PJSIP_TP_DATA_CACHE_THREADS,
+				 sizeof(struct tp_data_cache));
+    for (i=0; i<PJSIP_TP_DATA_CACHE_THREADS; ++i)
+	mgr->caches[i].mgr = mgr;
+    status = pj_lock_create_simple_mutex(pool, "tpch%p", &mgr->cache_lock);
+    if (status == PJ_SUCCESS) {
+	status = pj_thread_local_alloc2(&mgr->cache_tls,
+					&tp_data_cache_on_thread_exit);
+	if (status == PJ_ENOTSUP)
+	    status = pj_thread_local_alloc(&mgr->cache_tls);
+    }
+    if (status != PJ_SUCCESS)
+	mgr->cache_tls = -1;
+#endif
+
 #if defined(PJ_DEBUG) && PJ_DEBUG!=0
     status = pj_atomic_create(pool, 0, &mgr->tdata_counter);
     if (status != PJ_SUCCESS) {
+    	pj_lock_destroy(mgr->tdata_lock);
     	pj_lock_destroy(mgr->lock);
     	return status;
     }
@@ -1518,6 +2679,35 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_destroy( pjsip_tpmgr *mgr )
 
     pj_lock_acquire(mgr->lock);
 
+    /*
+     * Detach connection pool members. Members which are not in the
+     * transport hash table (parallel connections to the same destination)
+     * are destroyed here.
+     */
+    itr = pj_hash_first(mgr->conn_pools, &itr_val);
+    while (itr != NULL) {
+	pj_hash_iterator_t *next;
+	struct conn_pool *cp;
+
+	cp = (struct conn_pool*) pj_hash_this(mgr->conn_pools, itr);
+
+	next = pj_hash_next(mgr->conn_pools, itr);
+
+	while (cp->cnt) {
+	    pjsip_transport *transport = cp->member[cp->cnt-1].tp;
+	    int key_len = sizeof(transport->key.type) + transport->addr_len;
+
+	    conn_pool_remove(mgr, transport, PJ_FALSE);
+	    if (pj_hash_get(mgr->table, &transport->key, key_len,
+			    NULL) != transport)
+	    {
+		destroy_transport(mgr, transport);
+	    }
+	}
+
+	itr = next;
+    }
+
     /*
      * Destroy all transports.
      */
@@ -1574,10 +2764,15 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_destroy( pjsip_tpmgr *mgr )
 	PJ_LOG(3,(THIS_FILE, "Cleaned up dangling transmit buffer(s)."));
     }
 
+#if PJSIP_TP_DATA_CACHE_SIZE
+    tp_data_cache_destroy(mgr);
+#endif
+
 #if defined(PJ_DEBUG) && PJ_DEBUG!=0
     pj_atomic_destroy(mgr->tdata_counter);
 #endif
 
+    pj_lock_destroy(mgr->tdata_lock);
     pj_lock_destroy(mgr->lock);
 
     /* Unregister mod_msg_print. */
@@ -1755,6 +2950,16 @@ PJ_DEF(pj_ssize_t) pjsip_tpmgr_receive_packet( pjsip_tpmgr *mgr,
 	    if (rdata->msg_info.via->rport_param == 0) {
 		rdata->msg_info.via->rport_param = rdata->pkt_info.src_port;
 	    }
+
+	    /* RFC 5923: reuse the connection for requests to the sent-by
+	     * address if the Via contains "alias" param.
+	     */
+	    if (pjsip_cfg()->endpt.accept_via_alias &&
+		(tr->flag & PJSIP_TRANSPORT_DATAGRAM) == 0 &&
+		tr->conn_pool == NULL)
+	    {
+		conn_pool_check_alias(mgr, rdata);
+	    }
 	} else {
 	    /* Drop malformed responses */
 	    if (rdata->msg_info.msg->line.status.code < 100 ||
@@ -1840,6 +3045,15 @@ PJ_DEF(pj_status_t) pjsip_tpmgr_acquire_transport2(pjsip_tpmgr *mgr,
 		       addr_string(remote),
 		       pj_sockaddr_get_port(remote)));
 
+    /* Select from the connection pool of the destination, if any. */
+    if ((sel == NULL || sel->type == PJSIP_TPSELECTOR_NONE) &&
+	pj_hash_count(mgr->conn_pools) != 0)
+    {
+	status = conn_pool_acquire(mgr, type, remote, addr_len, tdata, tp);
+	if (status != PJ_ENOTFOUND)
+	    return status;
+    }
+
     pj_lock_acquire(mgr->lock);
 
     /* If transport is specified, then just use it if it is suitable
@@ -2037,6 +3251,19 @@ PJ_DEF(void) pjsip_tpmgr_dump_transports(pjsip_tpmgr *mgr)
 		       pj_atomic_get(t->ref_cnt),
 		       (t->idle_timer.id ? " [idle]" : "")));
 
+	    if (t->get_queue_info) {
+		pjsip_transport_queue_info qi;
+
+		if (pjsip_transport_get_queue_info(t, &qi) == PJ_SUCCESS) {
+		    PJ_LOG(3, (THIS_FILE, "    tx queue: %u msg(s)/%lu bytes, "
+			       "in flight: %u msg(s)/%lu bytes, "
+			       "coalesced: %u, rejected: %u",
+			       qi.queued_cnt, (unsigned long)qi.queued_bytes,
+			       qi.inflight_cnt, (unsigned long)qi.inflight_bytes,
+			       qi.coalesced_cnt, qi.rejected_cnt));
+		}
+	    }
+
 	    itr = pj_hash_next(mgr->table, itr);
 	} while (itr);
     }
@@ -2145,14 +3372,25 @@ PJ_DEF(pj_status_t) pjsip_transport_add_state_listener (
     tp_data = (transport_data*)tp->data;
 
     /* Init the new listener entry. Use available empty slot, if any,
-     * otherwise allocate it using the transport pool.
+     * otherwise allocate more using the transport pool.
      */
-    if (!pj_list_empty(&tp_data->st_listeners_empty)) {
-	entry = tp_data->st_listeners_empty.next;
-	pj_list_erase(entry);
-    } else {
-	entry = PJ_POOL_ZALLOC_T(tp->pool, tp_state_listener);
+    if (pj_list_empty(&tp_data->st_listeners_empty)) {
+	/* Every transaction adds a listener, so a busy transport may need
+	 * tens of thousands of them. Allocate them in growing batches, to
+	 * avoid going through all the small blocks of the transport pool
+	 * for each new entry.
+	 */
+	unsigned i, cnt = tp_data->st_listener_cnt ?
+			  tp_data->st_listener_cnt : 8;
+
+	entry = (tp_state_listener*)
+		pj_pool_calloc(tp->pool, cnt, sizeof(tp_state_listener));
+	for (i=0; i<cnt; ++i)
+	    pj_list_push_back(&tp_data->st_listeners_empty, &entry[i]);
+	tp_data->st_listener_cnt += cnt;
     }
+    entry = tp_data->st_listeners_empty.next;
+    pj_list_erase(entry);
     entry->cb = cb;
     entry->user_data = user_data;
 
@@ -60,6 +60,7 @@ struct tcp_listener
     pj_sockaddr		     bound_addr;
     pj_qos_type		     qos_type;
     pj_qos_params	     qos_params;
+    pj_size_t		     max_tx_queue_bytes;
 };
 
 
@@ -114,6 +115,9 @@ struct tcp_transport
 
     /* Pending transmission list. */
     struct delayed_tdata     delayed_list;
+
+    /* Outgoing message queue. */
+    pjsip_tx_queue	     tx_queue;
 };
 
 
@@ -224,6 +228,7 @@ PJ_DEF(void) pjsip_tcp_transport_cfg_default(pjsip_tcp_transport_cfg *cfg,
     pj_sockaddr_init(cfg->af, &cfg->bind_addr, NULL, 0);
     cfg->async_cnt = 1;
     cfg->reuse_addr = PJSIP_TCP_TRANSPORT_REUSEADDR;
+    cfg->max_tx_queue_bytes = PJSIP_TCP_TX_QUEUE_MAX_BYTES;
 }
 
 
@@ -284,6 +289,7 @@ PJ_DEF(pj_status_t) pjsip_tcp_transport_start3(
     listener->qos_type = cfg->qos_type;
     pj_memcpy(&listener->qos_params, &cfg->qos_params,
 	      sizeof(cfg->qos_params));
+    listener->max_tx_queue_bytes = cfg->max_tx_queue_bytes;
 
     pj_ansi_strcpy(listener->factory.obj_name, "tcplis");
     if (listener->factory.type==PJSIP_TRANSPORT_TCP6)
@@ -533,6 +539,10 @@ static pj_status_t tcp_shutdown(pjsip_transport *transport);
 /* Called by transport manager to destroy transport */
 static pj_status_t tcp_destroy_transport(pjsip_transport *transport);
 
+/* Called by transport manager to get the outgoing queue info */
+static pj_status_t tcp_get_queue_info(pjsip_transport *transport,
+				      pjsip_transport_queue_info *info);
+
 /* Utility to destroy transport */
 static pj_status_t tcp_destroy(pjsip_transport *transport,
 			       pj_status_t reason);
@@ -549,6 +559,20 @@ static pj_bool_t on_data_sent(pj_activesock_t *asock,
 			      pj_ioqueue_op_key_t *send_key,
 			      pj_ssize_t sent);
 
+/* Outgoing queue callback to write data to the socket */
+static pj_status_t tcp_queue_send(pjsip_transport *transport,
+				  pj_ioqueue_op_key_t *op_key,
+				  const void *data,
+				  pj_ssize_t *size);
+
+/* Outgoing queue callback to check whether the socket can be written */
+static pj_bool_t tcp_queue_is_ready(pjsip_transport *transport);
+
+/* Notify the owner of a transmit data that the send has completed */
+static pj_bool_t tcp_tx_done(pjsip_transport *transport,
+			     pj_ioqueue_op_key_t *op_key,
+			     pj_ssize_t bytes_sent);
+
 /* Callback when connect completes */
 static pj_bool_t on_connect_complete(pj_activesock_t *asock,
 				     pj_status_t status);
@@ -556,6 +580,16 @@ static pj_bool_t on_connect_complete(pj_activesock_t *asock,
 /* TCP keep-alive timer callback */
 static void tcp_keep_alive_timer(pj_timer_heap_t *th, pj_timer_entry *e);
 
+/* Outgoing queue callbacks */
+static const pjsip_tx_queue_cb tcp_queue_cb =
+{
+    &tcp_queue_send,
+    &tcp_queue_is_ready,
+    &tcp_tx_done,
+    NULL,
+    NULL
+};
+
 /*
  * Common function to create TCP transport, called when pending accept() and
  * pending connect() complete.
@@ -632,6 +666,7 @@ static pj_status_t tcp_create( struct tcp_listener *listener,
     tcp->base.send_msg = &tcp_send_msg;
     tcp->base.do_shutdown = &tcp_shutdown;
     tcp->base.destroy = &tcp_destroy_transport;
+    tcp->base.get_queue_info = &tcp_get_queue_info;
 
     /* Create active socket */
     pj_activesock_cfg_default(&asock_cfg);
@@ -663,6 +698,11 @@ static pj_status_t tcp_create( struct tcp_listener *listener,
     pj_ioqueue_op_key_init(&tcp->ka_op_key.key, sizeof(pj_ioqueue_op_key_t));
     pj_strdup(tcp->base.pool, &tcp->ka_pkt, &ka_pkt);
 
+    /* Initialize outgoing message queue */
+    pjsip_tx_queue_init(&tcp->tx_queue, &tcp->base, &tcp_queue_cb,
+			listener->max_tx_queue_bytes,
+			PJSIP_TCP_TX_COALESCE_SIZE);
+
     /* Done setting up basic transport. */
     *p_tcp = tcp;
 
@@ -686,35 +726,25 @@ static void tcp_flush_pending_tx(struct tcp_transport *tcp)
     pj_lock_acquire(tcp->base.lock);
     while (!pj_list_empty(&tcp->delayed_list)) {
 	struct delayed_tdata *pending_tx;
-	pjsip_tx_data *tdata;
-	pj_ioqueue_op_key_t *op_key;
-	pj_ssize_t size;
-	pj_status_t status;
 
 	pending_tx = tcp->delayed_list.next;
 	pj_list_erase(pending_tx);
 
-	tdata = pending_tx->tdata_op_key->tdata;
-	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
         if (pending_tx->timeout.sec > 0 &&
             PJ_TIME_VAL_GT(now, pending_tx->timeout))
         {
             continue;
         }
 
-	/* send! */
-	size = tdata->buf.cur - tdata->buf.start;
-	status = pj_activesock_send(tcp->asock, op_key, tdata->buf.start, 
-				    &size, 0);
-	if (status != PJ_EPENDING) {
-            pj_lock_release(tcp->base.lock);
-	    on_data_sent(tcp->asock, op_key, size);
-            pj_lock_acquire(tcp->base.lock);
-	}
-
+	/* Move to the outgoing queue, so that messages accumulated during
+	 * connect() can be written together.
+	 */
+	pjsip_tx_queue_add(&tcp->tx_queue, pending_tx->tdata_op_key);
     }
     pj_lock_release(tcp->base.lock);
+
+    /* send! */
+    pjsip_tx_queue_flush(&tcp->tx_queue);
 }
 
 
@@ -770,9 +800,12 @@ static pj_status_t tcp_destroy(pjsip_transport *transport,
 
 	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
 
-	on_data_sent(tcp->asock, op_key, -reason);
+	tcp_tx_done(&tcp->base, op_key, -reason);
     }
 
+    /* Cancel all queued transmits */
+    pjsip_tx_queue_cancel(&tcp->tx_queue, reason);
+
     if (tcp->rdata.tp_info.pool) {
 	pj_pool_release(tcp->rdata.tp_info.pool);
 	tcp->rdata.tp_info.pool = NULL;
@@ -1089,6 +1122,23 @@ static pj_bool_t on_data_sent(pj_activesock_t *asock,
 {
     struct tcp_transport *tcp = (struct tcp_transport*) 
     				pj_activesock_get_user_data(asock);
+
+    if (op_key == &tcp->ka_op_key.key)
+	return tcp_tx_done(&tcp->base, op_key, bytes_sent);
+
+    return pjsip_tx_queue_on_data_sent(&tcp->tx_queue, op_key, bytes_sent);
+}
+
+
+/* 
+ * Notify the owner of the transmit data that the send has completed, and
+ * shutdown the transport on error.
+ */
+static pj_bool_t tcp_tx_done(pjsip_transport *transport,
+			     pj_ioqueue_op_key_t *op_key,
+			     pj_ssize_t bytes_sent)
+{
+    struct tcp_transport *tcp = (struct tcp_transport*)transport;
     pjsip_tx_data_op_key *tdata_op_key = (pjsip_tx_data_op_key*)op_key;
 
     /* Note that op_key may be the op_key from keep-alive, thus
@@ -1141,7 +1191,6 @@ static pj_status_t tcp_send_msg(pjsip_transport *transport,
 				pjsip_transport_callback callback)
 {
     struct tcp_transport *tcp = (struct tcp_transport*)transport;
-    pj_ssize_t size;
     pj_bool_t delayed = PJ_FALSE;
     pj_status_t status = PJ_SUCCESS;
 
@@ -1205,29 +1254,19 @@ static pj_status_t tcp_send_msg(pjsip_transport *transport,
     
     if (!delayed) {
 	/*
-	 * Transport is ready to go. Send the packet to ioqueue to be
-	 * sent asynchronously.
+	 * Transport is ready to go. Write the packet, or queue it if
+	 * another write is still in progress.
 	 */
-	size = tdata->buf.cur - tdata->buf.start;
-	status = pj_activesock_send(tcp->asock, 
-				    (pj_ioqueue_op_key_t*)&tdata->op_key,
-				    tdata->buf.start, &size, 0);
-
-	if (status != PJ_EPENDING) {
-	    /* Not pending (could be immediate success or error) */
-	    tdata->op_key.tdata = NULL;
-
-	    /* Shutdown transport on closure/errors */
-	    if (size <= 0) {
+	status = pjsip_tx_queue_send(&tcp->tx_queue, tdata);
 
-		PJ_LOG(5,(tcp->base.obj_name, "TCP send() error, sent=%d", 
-			  size));
-
-		if (status == PJ_SUCCESS) 
-		    status = PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
+	/* Shutdown transport on closure/errors */
+	if (status != PJ_SUCCESS && status != PJ_EPENDING &&
+	    status != PJSIP_ETPQUEUEFULL)
+	{
+	    PJ_LOG(5,(tcp->base.obj_name, "TCP send() error, status=%d",
+		      status));
 
-		tcp_init_shutdown(tcp, status);
-	    }
+	    tcp_init_shutdown(tcp, status);
 	}
     }
 
@@ -1235,6 +1274,46 @@ static pj_status_t tcp_send_msg(pjsip_transport *transport,
 }
 
 
+/* 
+ * This callback is called by transport manager to get the outgoing
+ * queue info.
+ */
+static pj_status_t tcp_get_queue_info(pjsip_transport *transport,
+				      pjsip_transport_queue_info *info)
+{
+    struct tcp_transport *tcp = (struct tcp_transport*)transport;
+
+    pjsip_tx_queue_get_info(&tcp->tx_queue, info);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Outgoing queue callback to write data to the socket.
+ */
+static pj_status_t tcp_queue_send(pjsip_transport *transport,
+				  pj_ioqueue_op_key_t *op_key,
+				  const void *data,
+				  pj_ssize_t *size)
+{
+    struct tcp_transport *tcp = (struct tcp_transport*)transport;
+
+    return pj_activesock_send(tcp->asock, op_key, data, size, 0);
+}
+
+
+/*
+ * Outgoing queue callback to check whether the socket can be written.
+ */
+static pj_bool_t tcp_queue_is_ready(pjsip_transport *transport)
+{
+    struct tcp_transport *tcp = (struct tcp_transport*)transport;
+
+    return !tcp->is_closing && !tcp->has_pending_connect;
+}
+
+
 /* 
  * This callback is called by transport manager to shutdown transport.
  */
@@ -1359,7 +1438,7 @@ static pj_bool_t on_connect_complete(pj_activesock_t *asock,
 
 	    op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
 
-	    on_data_sent(tcp->asock, op_key, -status);
+	    tcp_tx_done(&tcp->base, op_key, -status);
 	}
 
 	tcp_init_shutdown(tcp, status);
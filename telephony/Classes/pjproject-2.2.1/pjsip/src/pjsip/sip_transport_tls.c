@@ -106,6 +106,9 @@ struct tls_transport
 
     /* Pending transmission list. */
     struct delayed_tdata     delayed_list;
+
+    /* Outgoing message queue. */
+    pjsip_tx_queue	     tx_queue;
 };
 
 
@@ -557,6 +560,24 @@ static pj_status_t tls_shutdown(pjsip_transport *transport);
 /* Called by transport manager to destroy transport */
 static pj_status_t tls_destroy_transport(pjsip_transport *transport);
 
+/* Called by transport manager to get the outgoing queue info */
+static pj_status_t tls_get_queue_info(pjsip_transport *transport,
+				      pjsip_transport_queue_info *info);
+
+/* Outgoing queue callback to write data to the socket */
+static pj_status_t tls_queue_send(pjsip_transport *transport,
+				  pj_ioqueue_op_key_t *op_key,
+				  const void *data,
+				  pj_ssize_t *size);
+
+/* Outgoing queue callback to check whether the socket can be written */
+static pj_bool_t tls_queue_is_ready(pjsip_transport *transport);
+
+/* Notify the owner of a transmit data that the send has completed */
+static pj_bool_t tls_tx_done(pjsip_transport *transport,
+			     pj_ioqueue_op_key_t *op_key,
+			     pj_ssize_t bytes_sent);
+
 /* Utility to destroy transport */
 static pj_status_t tls_destroy(pjsip_transport *transport,
 			       pj_status_t reason);
@@ -568,6 +589,16 @@ static pj_bool_t on_connect_complete(pj_ssl_sock_t *ssock,
 /* TLS keep-alive timer callback */
 static void tls_keep_alive_timer(pj_timer_heap_t *th, pj_timer_entry *e);
 
+/* Outgoing queue callbacks */
+static const pjsip_tx_queue_cb tls_queue_cb =
+{
+    &tls_queue_send,
+    &tls_queue_is_ready,
+    &tls_tx_done,
+    NULL,
+    NULL
+};
+
 /*
  * Common function to create TLS transport, called when pending accept() and
  * pending connect() complete.
@@ -659,6 +690,7 @@ static pj_status_t tls_create( struct tls_listener *listener,
     tls->base.send_msg = &tls_send_msg;
     tls->base.do_shutdown = &tls_shutdown;
     tls->base.destroy = &tls_destroy_transport;
+    tls->base.get_queue_info = &tls_get_queue_info;
 
     tls->ssock = ssock;
 
@@ -675,6 +707,11 @@ static pj_status_t tls_create( struct tls_listener *listener,
     tls->ka_timer.cb = &tls_keep_alive_timer;
     pj_ioqueue_op_key_init(&tls->ka_op_key.key, sizeof(pj_ioqueue_op_key_t));
     pj_strdup(tls->base.pool, &tls->ka_pkt, &ka_pkt);
+
+    /* Initialize outgoing message queue */
+    pjsip_tx_queue_init(&tls->tx_queue, &tls->base, &tls_queue_cb,
+			listener->tls_setting.max_tx_queue_bytes,
+			PJSIP_TLS_TX_COALESCE_SIZE);
     
     /* Done setting up basic transport. */
     *p_tls = tls;
@@ -699,35 +736,25 @@ static void tls_flush_pending_tx(struct tls_transport *tls)
     pj_lock_acquire(tls->base.lock);
     while (!pj_list_empty(&tls->delayed_list)) {
 	struct delayed_tdata *pending_tx;
-	pjsip_tx_data *tdata;
-	pj_ioqueue_op_key_t *op_key;
-	pj_ssize_t size;
-	pj_status_t status;
 
 	pending_tx = tls->delayed_list.next;
 	pj_list_erase(pending_tx);
 
-	tdata = pending_tx->tdata_op_key->tdata;
-	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
-
         if (pending_tx->timeout.sec > 0 &&
             PJ_TIME_VAL_GT(now, pending_tx->timeout))
         {
             continue;
         }
 
-	/* send! */
-	size = tdata->buf.cur - tdata->buf.start;
-	status = pj_ssl_sock_send(tls->ssock, op_key, tdata->buf.start, 
-				  &size, 0);
-
-	if (status != PJ_EPENDING) {
-            pj_lock_release(tls->base.lock);
-	    on_data_sent(tls->ssock, op_key, size);
-            pj_lock_acquire(tls->base.lock);
-	}
+	/* Move to the outgoing queue, so that messages accumulated during
+	 * connect() can be written together.
+	 */
+	pjsip_tx_queue_add(&tls->tx_queue, pending_tx->tdata_op_key);
     }
     pj_lock_release(tls->base.lock);
+
+    /* send! */
+    pjsip_tx_queue_flush(&tls->tx_queue);
 }
 
 
@@ -783,9 +810,12 @@ static pj_status_t tls_destroy(pjsip_transport *transport,
 
 	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
 
-	on_data_sent(tls->ssock, op_key, -reason);
+	tls_tx_done(&tls->base, op_key, -reason);
     }
 
+    /* Cancel all queued transmits */
+    pjsip_tx_queue_cancel(&tls->tx_queue, reason);
+
     if (tls->rdata.tp_info.pool) {
 	pj_pool_release(tls->rdata.tp_info.pool);
 	tls->rdata.tp_info.pool = NULL;
@@ -1195,6 +1225,23 @@ static pj_bool_t on_data_sent(pj_ssl_sock_t *ssock,
 {
     struct tls_transport *tls = (struct tls_transport*) 
     				pj_ssl_sock_get_user_data(ssock);
+
+    if (op_key == &tls->ka_op_key.key)
+	return tls_tx_done(&tls->base, op_key, bytes_sent);
+
+    return pjsip_tx_queue_on_data_sent(&tls->tx_queue, op_key, bytes_sent);
+}
+
+
+/* 
+ * Notify the owner of the transmit data that the send has completed, and
+ * shutdown the transport on error.
+ */
+static pj_bool_t tls_tx_done(pjsip_transport *transport,
+			     pj_ioqueue_op_key_t *op_key,
+			     pj_ssize_t bytes_sent)
+{
+    struct tls_transport *tls = (struct tls_transport*)transport;
     pjsip_tx_data_op_key *tdata_op_key = (pjsip_tx_data_op_key*)op_key;
 
     /* Note that op_key may be the op_key from keep-alive, thus
@@ -1247,7 +1294,6 @@ static pj_status_t tls_send_msg(pjsip_transport *transport,
 				pjsip_transport_callback callback)
 {
     struct tls_transport *tls = (struct tls_transport*)transport;
-    pj_ssize_t size;
     pj_bool_t delayed = PJ_FALSE;
     pj_status_t status = PJ_SUCCESS;
 
@@ -1311,29 +1357,19 @@ static pj_status_t tls_send_msg(pjsip_transport *transport,
     
     if (!delayed) {
 	/*
-	 * Transport is ready to go. Send the packet to ioqueue to be
-	 * sent asynchronously.
+	 * Transport is ready to go. Write the packet, or queue it if
+	 * another write is still in progress.
 	 */
-	size = tdata->buf.cur - tdata->buf.start;
-	status = pj_ssl_sock_send(tls->ssock, 
-				    (pj_ioqueue_op_key_t*)&tdata->op_key,
-				    tdata->buf.start, &size, 0);
-
-	if (status != PJ_EPENDING) {
-	    /* Not pending (could be immediate success or error) */
-	    tdata->op_key.tdata = NULL;
-
-	    /* Shutdown transport on closure/errors */
-	    if (size <= 0) {
+	status = pjsip_tx_queue_send(&tls->tx_queue, tdata);
 
-		PJ_LOG(5,(tls->base.obj_name, "TLS send() error, sent=%d", 
-			  size));
-
-		if (status == PJ_SUCCESS) 
-		    status = PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
+	/* Shutdown transport on closure/errors */
+	if (status != PJ_SUCCESS && status != PJ_EPENDING &&
+	    status != PJSIP_ETPQUEUEFULL)
+	{
+	    PJ_LOG(5,(tls->base.obj_name, "TLS send() error, status=%d",
+		      status));
 
-		tls_init_shutdown(tls, status);
-	    }
+	    tls_init_shutdown(tls, status);
 	}
     }
 
@@ -1341,6 +1377,46 @@ static pj_status_t tls_send_msg(pjsip_transport *transport,
 }
 
 
+/* 
+ * This callback is called by transport manager to get the outgoing
+ * queue info.
+ */
+static pj_status_t tls_get_queue_info(pjsip_transport *transport,
+				      pjsip_transport_queue_info *info)
+{
+    struct tls_transport *tls = (struct tls_transport*)transport;
+
+    pjsip_tx_queue_get_info(&tls->tx_queue, info);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Outgoing queue callback to write data to the socket.
+ */
+static pj_status_t tls_queue_send(pjsip_transport *transport,
+				  pj_ioqueue_op_key_t *op_key,
+				  const void *data,
+				  pj_ssize_t *size)
+{
+    struct tls_transport *tls = (struct tls_transport*)transport;
+
+    return pj_ssl_sock_send(tls->ssock, op_key, data, size, 0);
+}
+
+
+/*
+ * Outgoing queue callback to check whether the socket can be written.
+ */
+static pj_bool_t tls_queue_is_ready(pjsip_transport *transport)
+{
+    struct tls_transport *tls = (struct tls_transport*)transport;
+
+    return !tls->is_closing && !tls->has_pending_connect;
+}
+
+
 /* 
  * This callback is called by transport manager to shutdown transport.
  */
@@ -1463,7 +1539,7 @@ static pj_bool_t on_connect_complete(pj_ssl_sock_t *ssock,
 
 	    op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
 
-	    on_data_sent(tls->ssock, op_key, -status);
+	    tls_tx_done(&tls->base, op_key, -status);
 	}
 
 	goto on_error;
@@ -1601,7 +1677,7 @@ static pj_bool_t on_connect_complete(pj_ssl_sock_t *ssock,
 
 	    op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
 
-	    on_data_sent(tls->ssock, op_key, -status);
+	    tls_tx_done(&tls->base, op_key, -status);
 	}
 
 	return PJ_FALSE;
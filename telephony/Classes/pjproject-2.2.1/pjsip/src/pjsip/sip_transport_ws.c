@@ -0,0 +1,2611 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include <pjsip/sip_transport_ws.h>
+#include <pjsip/sip_endpoint.h>
+#include <pjsip/sip_errno.h>
+#include <pjlib-util/base64.h>
+#include <pjlib-util/sha1.h>
+#include <pj/compat/socket.h>
+#include <pj/addr_resolv.h>
+#include <pj/activesock.h>
+#include <pj/ssl_sock.h>
+#include <pj/assert.h>
+#include <pj/ctype.h>
+#include <pj/lock.h>
+#include <pj/log.h>
+#include <pj/os.h>
+#include <pj/pool.h>
+#include <pj/rand.h>
+#include <pj/string.h>
+
+/* Only declare the API if PJ_HAS_TCP and PJSIP_HAS_WS_TRANSPORT are true */
+#if defined(PJ_HAS_TCP) && PJ_HAS_TCP!=0 && \
+    defined(PJSIP_HAS_WS_TRANSPORT) && PJSIP_HAS_WS_TRANSPORT!=0
+
+
+#define THIS_FILE	"sip_transport_ws.c"
+
+/* Secure WebSocket needs the SSL socket */
+#if defined(PJSIP_HAS_TLS_TRANSPORT) && PJSIP_HAS_TLS_TRANSPORT!=0
+#   define WS_HAS_WSS	1
+#else
+#   define WS_HAS_WSS	0
+#endif
+
+#define MAX_ASYNC_CNT	16
+#define POOL_LIS_INIT	512
+#define POOL_LIS_INC	512
+#define POOL_TP_INIT	512
+#define POOL_TP_INC	512
+
+/* The GUID appended to Sec-WebSocket-Key (RFC 6455 section 1.3) */
+#define WS_GUID		"258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+/* Largest frame header: 2 bytes + 64bit length + masking key */
+#define WS_MAX_HDR_LEN	14
+
+/* Largest control frame payload */
+#define WS_MAX_CTL_LEN	125
+
+/* Size of the buffer for the HTTP handshake messages */
+#define WS_HS_BUF_LEN	512
+
+/* Size of the buffer where outgoing frames are built */
+#define WS_TX_BUF_LEN	(PJSIP_MAX_PKT_LEN + WS_MAX_HDR_LEN)
+
+/* Frame opcodes */
+enum ws_opcode
+{
+    WS_OP_CONT	= 0x0,
+    WS_OP_TEXT	= 0x1,
+    WS_OP_BIN	= 0x2,
+    WS_OP_CLOSE	= 0x8,
+    WS_OP_PING	= 0x9,
+    WS_OP_PONG	= 0xA
+};
+
+struct ws_listener;
+struct ws_transport;
+
+
+/*
+ * This is the WebSocket listener, which is a "descendant" of pjsip_tpfactory
+ * (the SIP transport factory).
+ */
+struct ws_listener
+{
+    pjsip_tpfactory	     factory;
+    pj_bool_t		     is_registered;
+    pj_bool_t		     is_secure;
+    pjsip_endpoint	    *endpt;
+    pjsip_tpmgr		    *tpmgr;
+    pj_activesock_t	    *asock;
+    pj_ssl_sock_t	    *ssock;
+    pj_ssl_cert_t	    *cert;
+    pj_sockaddr		     bound_addr;
+    pj_qos_type		     qos_type;
+    pj_qos_params	     qos_params;
+    pj_size_t		     max_tx_queue_bytes;
+    pj_str_t		     path;
+    pjsip_tls_setting	     tls_setting;
+};
+
+
+/*
+ * This structure is used to keep delayed transmit operation in a list.
+ * A delayed transmission occurs when application sends tx_data when
+ * the TCP connect or the WebSocket handshake is still in progress. These
+ * delayed transmission will be "flushed" once the handshake completes
+ * (either successfully or with errors).
+ */
+struct delayed_tdata
+{
+    PJ_DECL_LIST_MEMBER(struct delayed_tdata);
+    pjsip_tx_data_op_key    *tdata_op_key;
+    pj_time_val              timeout;
+};
+
+
+/*
+ * This structure describes the WebSocket transport, and it's descendant of
+ * pjsip_transport.
+ */
+struct ws_transport
+{
+    pjsip_transport	     base;
+    pj_bool_t		     is_server;
+    pj_bool_t		     is_secure;
+    pj_bool_t		     verify_server;
+
+    pj_bool_t		     is_registered;
+    pj_bool_t		     is_closing;
+    pj_status_t		     close_reason;
+    pj_sock_t		     sock;
+    pj_activesock_t	    *asock;
+    pj_ssl_sock_t	    *ssock;
+
+    /* Set until both the connect() and the WebSocket opening handshake
+     * have completed.
+     */
+    pj_bool_t		     has_pending_connect;
+    pj_bool_t		     hs_done;
+
+    /* Opening handshake. */
+    pj_str_t		     path;
+    pj_str_t		     remote_host;
+    pjsip_tx_data_op_key     hs_op_key;
+    char		    *hs_buf;
+    pj_bool_t		     hs_rejected;
+    char		     hs_accept[29];
+
+    /* Control frame (pong or close) being sent. */
+    pjsip_tx_data_op_key     ctl_op_key;
+    char		     ctl_buf[WS_MAX_HDR_LEN + WS_MAX_CTL_LEN];
+    pj_bool_t		     ctl_pending;
+    pj_bool_t		     ctl_is_close;
+
+    /* Keep-alive timer, sending ping frames. */
+    pj_timer_entry	     ka_timer;
+    pj_time_val		     last_activity;
+    pjsip_tx_data_op_key     ka_op_key;
+    char		     ka_buf[WS_MAX_HDR_LEN];
+
+    /* WebSocket transport can only have one rdata! Incoming frames are
+     * read into this buffer, and the payload of each frame is unmasked
+     * and moved in place to reassemble the SIP message, which is then
+     * parsed from the same buffer.
+     */
+    pjsip_rx_data	     rdata;
+    pj_size_t		     rx_msg_len;
+    pj_bool_t		     rx_in_msg;
+
+    /* Pending transmission list. */
+    struct delayed_tdata     delayed_list;
+
+    /* Outgoing message queue. Every message is framed into the queue
+     * buffer before it is written.
+     */
+    pjsip_tx_queue	     tx_queue;
+};
+
+
+/****************************************************************************
+ * PROTOTYPES
+ */
+
+/* This callback is called when pending accept() operation completes. */
+static pj_bool_t on_accept_complete(pj_activesock_t *asock,
+				    pj_sock_t newsock,
+				    const pj_sockaddr_t *src_addr,
+				    int src_addr_len);
+
+/* This callback is called by transport manager to destroy listener */
+static pj_status_t lis_destroy(pjsip_tpfactory *factory);
+
+/* This callback is called by transport manager to create transport */
+static pj_status_t lis_create_transport(pjsip_tpfactory *factory,
+					pjsip_tpmgr *mgr,
+					pjsip_endpoint *endpt,
+					const pj_sockaddr *rem_addr,
+					int addr_len,
+					pjsip_tx_data *tdata,
+					pjsip_transport **transport);
+
+/* Common function to create and initialize transport */
+static pj_status_t ws_create(struct ws_listener *listener,
+			     pj_pool_t *pool,
+			     pj_sock_t sock,
+			     pj_ssl_sock_t *ssock,
+			     pj_bool_t is_server,
+			     const pj_sockaddr *local,
+			     const pj_sockaddr *remote,
+			     const pj_str_t *remote_name,
+			     struct ws_transport **p_ws);
+
+/* Called when the transport has been accepted or connected */
+static void ws_on_connected(struct ws_transport *ws);
+
+#if WS_HAS_WSS
+/* SSL socket callbacks */
+static pj_bool_t on_ssl_accept_complete(pj_ssl_sock_t *ssock,
+					pj_ssl_sock_t *new_ssock,
+					const pj_sockaddr_t *src_addr,
+					int src_addr_len);
+static pj_bool_t on_ssl_data_read(pj_ssl_sock_t *ssock,
+				  void *data,
+				  pj_size_t size,
+				  pj_status_t status,
+				  pj_size_t *remainder);
+static pj_bool_t on_ssl_data_sent(pj_ssl_sock_t *ssock,
+				  pj_ioqueue_op_key_t *op_key,
+				  pj_ssize_t sent);
+static pj_bool_t on_ssl_connect_complete(pj_ssl_sock_t *ssock,
+					 pj_status_t status);
+#endif
+
+
+static void ws_perror(const char *sender, const char *title,
+		      pj_status_t status)
+{
+    char errmsg[PJ_ERR_MSG_SIZE];
+
+    pj_strerror(status, errmsg, sizeof(errmsg));
+
+    PJ_LOG(1,(sender, "%s: %s [code=%d]", title, errmsg, status));
+}
+
+
+static void sockaddr_to_host_port( pj_pool_t *pool,
+				   pjsip_host_port *host_port,
+				   const pj_sockaddr *addr )
+{
+    host_port->host.ptr = (char*) pj_pool_alloc(pool, PJ_INET6_ADDRSTRLEN+4);
+    pj_sockaddr_print(addr, host_port->host.ptr, PJ_INET6_ADDRSTRLEN+4, 0);
+    host_port->host.slen = pj_ansi_strlen(host_port->host.ptr);
+    host_port->port = pj_sockaddr_get_port(addr);
+}
+
+
+static void ws_init_shutdown(struct ws_transport *ws, pj_status_t status)
+{
+    pjsip_tp_state_callback state_cb;
+
+    if (ws->close_reason == PJ_SUCCESS)
+	ws->close_reason = status;
+
+    if (ws->base.is_shutdown || ws->base.is_destroying)
+	return;
+
+    /* Prevent immediate transport destroy by application, as transport
+     * state notification callback may be stacked and transport instance
+     * must remain valid at any point in the callback.
+     */
+    pjsip_transport_add_ref(&ws->base);
+
+    /* Notify application of transport disconnected state */
+    state_cb = pjsip_tpmgr_get_state_cb(ws->base.tpmgr);
+    if (state_cb) {
+	pjsip_transport_state_info state_info;
+
+	pj_bzero(&state_info, sizeof(state_info));
+	state_info.status = ws->close_reason;
+	(*state_cb)(&ws->base, PJSIP_TP_STATE_DISCONNECTED, &state_info);
+    }
+
+    /* check again */
+    if (ws->base.is_shutdown || ws->base.is_destroying) {
+        pjsip_transport_dec_ref(&ws->base);
+	return;
+    }
+
+    /* We can not destroy the transport since high level objects may
+     * still keep reference to this transport. So we can only
+     * instruct transport manager to gracefully start the shutdown
+     * procedure for this transport.
+     */
+    pjsip_transport_shutdown(&ws->base);
+
+    /* Now, it is ok to destroy the transport. */
+    pjsip_transport_dec_ref(&ws->base);
+}
+
+
+/****************************************************************************
+ * Socket helpers. WS uses active socket while WSS uses SSL socket.
+ */
+
+static pj_status_t ws_sock_send(struct ws_transport *ws,
+				pj_ioqueue_op_key_t *op_key,
+				const void *data,
+				pj_ssize_t *size)
+{
+#if WS_HAS_WSS
+    if (ws->ssock)
+	return pj_ssl_sock_send(ws->ssock, op_key, data, size, 0);
+#endif
+    return pj_activesock_send(ws->asock, op_key, data, size, 0);
+}
+
+
+static void ws_sock_close(struct ws_transport *ws)
+{
+#if WS_HAS_WSS
+    if (ws->ssock) {
+	pj_ssl_sock_close(ws->ssock);
+	ws->ssock = NULL;
+    }
+#endif
+    if (ws->asock) {
+	pj_activesock_close(ws->asock);
+	ws->asock = NULL;
+	ws->sock = PJ_INVALID_SOCKET;
+    } else if (ws->sock != PJ_INVALID_SOCKET) {
+	pj_sock_close(ws->sock);
+	ws->sock = PJ_INVALID_SOCKET;
+    }
+}
+
+
+/****************************************************************************
+ * WebSocket framing and handshake helpers.
+ */
+
+/*
+ * Compute Sec-WebSocket-Accept for the key.
+ */
+PJ_DEF(pj_status_t) pjsip_ws_calc_accept(const pj_str_t *key, char buf[29])
+{
+    pj_sha1_context ctx;
+    pj_uint8_t digest[20];
+    int len = 29;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(key && buf, PJ_EINVAL);
+
+    pj_sha1_init(&ctx);
+    pj_sha1_update(&ctx, (const pj_uint8_t*)key->ptr, key->slen);
+    pj_sha1_update(&ctx, (const pj_uint8_t*)WS_GUID, sizeof(WS_GUID)-1);
+    pj_sha1_final(&ctx, digest);
+
+    status = pj_base64_encode(digest, sizeof(digest), buf, &len);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    buf[len] = '\0';
+    return PJ_SUCCESS;
+}
+
+
+/* Get the length of frame header for the payload length */
+static unsigned ws_frame_hdr_len(pj_size_t len, pj_bool_t mask)
+{
+    unsigned hdr_len = 2;
+
+    if (len > 0xFFFF)
+	hdr_len += 8;
+    else if (len > 125)
+	hdr_len += 2;
+
+    return mask ? hdr_len + 4 : hdr_len;
+}
+
+
+/*
+ * Write a single (FIN) frame with the payload to the buffer, masking the
+ * payload if required. The buffer must be large enough to hold the frame.
+ * Returns the frame length.
+ */
+static pj_size_t ws_build_frame(char *buf, unsigned opcode,
+				const char *payload, pj_size_t len,
+				pj_bool_t mask)
+{
+    pj_uint8_t *p = (pj_uint8_t*)buf;
+    pj_uint8_t mask_bit = (pj_uint8_t)(mask ? 0x80 : 0);
+
+    *p++ = (pj_uint8_t)(0x80 | opcode);
+
+    if (len > 0xFFFF) {
+	unsigned i;
+
+	*p++ = (pj_uint8_t)(mask_bit | 127);
+	for (i=0; i<8; ++i) {
+	    unsigned shift = (7-i) * 8;
+	    *p++ = (pj_uint8_t)(shift < sizeof(len)*8 ? (len >> shift) : 0);
+	}
+    } else if (len > 125) {
+	*p++ = (pj_uint8_t)(mask_bit | 126);
+	*p++ = (pj_uint8_t)(len >> 8);
+	*p++ = (pj_uint8_t)(len & 0xFF);
+    } else {
+	*p++ = (pj_uint8_t)(mask_bit | len);
+    }
+
+    if (mask) {
+	pj_uint32_t rnd = pj_rand();
+	pj_uint8_t *key = p;
+	pj_size_t i;
+
+	pj_memcpy(key, &rnd, 4);
+	p += 4;
+	for (i=0; i<len; ++i)
+	    p[i] = (pj_uint8_t)(payload[i] ^ key[i & 3]);
+    } else if (len) {
+	pj_memcpy(p, payload, len);
+    }
+
+    return (p - (pj_uint8_t*)buf) + len;
+}
+
+
+/* Find the end of HTTP header (the empty line) */
+static const char *ws_find_hdr_end(const char *buf, pj_size_t len)
+{
+    const char *p, *end = buf + len;
+
+    for (p=buf; p+4 <= end; ++p) {
+	if (p[0]=='\r' && p[1]=='\n' && p[2]=='\r' && p[3]=='\n')
+	    return p + 4;
+    }
+    return NULL;
+}
+
+
+/* Get the value of the HTTP header with the name */
+static pj_bool_t ws_get_hdr(const char *start, const char *end,
+			    const char *name, pj_str_t *value)
+{
+    pj_size_t name_len = pj_ansi_strlen(name);
+    const char *line;
+
+    /* Skip the start line */
+    for (line=start; line < end && *line != '\n'; ++line)
+	;
+
+    while (line < end) {
+	const char *eol, *p;
+
+	++line;
+	for (eol=line; eol < end && *eol != '\r' && *eol != '\n'; ++eol)
+	    ;
+
+	if ((pj_size_t)(eol - line) > name_len && line[name_len] == ':' &&
+	    pj_ansi_strnicmp(line, name, name_len) == 0)
+	{
+	    for (p=line+name_len+1; p < eol && (*p==' ' || *p=='\t'); ++p)
+		;
+	    value->ptr = (char*)p;
+	    value->slen = eol - p;
+	    while (value->slen && (p[value->slen-1]==' ' ||
+				   p[value->slen-1]=='\t'))
+	    {
+		--value->slen;
+	    }
+	    return PJ_TRUE;
+	}
+
+	for (line=eol; line < end && *line != '\n'; ++line)
+	    ;
+    }
+
+    return PJ_FALSE;
+}
+
+
+/* Check if comma separated header value contains the token */
+static pj_bool_t ws_hdr_has_token(const pj_str_t *value, const char *token)
+{
+    pj_size_t token_len = pj_ansi_strlen(token);
+    const char *p = value->ptr, *end = value->ptr + value->slen;
+
+    while (p < end) {
+	const char *t, *e;
+
+	while (p < end && (*p==' ' || *p=='\t' || *p==','))
+	    ++p;
+	for (t=p; p < end && *p != ','; ++p)
+	    ;
+	for (e=p; e > t && (e[-1]==' ' || e[-1]=='\t'); --e)
+	    ;
+
+	if ((pj_size_t)(e - t) == token_len &&
+	    pj_ansi_strnicmp(t, token, token_len) == 0)
+	{
+	    return PJ_TRUE;
+	}
+    }
+
+    return PJ_FALSE;
+}
+
+
+/*
+ * Initialize pjsip_ws_transport_cfg structure with default values.
+ */
+PJ_DEF(void) pjsip_ws_transport_cfg_default(pjsip_ws_transport_cfg *cfg,
+					    int af)
+{
+    pj_bzero(cfg, sizeof(*cfg));
+    cfg->af = af;
+    pj_sockaddr_init(cfg->af, &cfg->bind_addr, NULL, 0);
+    cfg->async_cnt = 1;
+    cfg->reuse_addr = PJSIP_TCP_TRANSPORT_REUSEADDR;
+    cfg->path = pj_str("/");
+    cfg->max_tx_queue_bytes = PJSIP_TCP_TX_QUEUE_MAX_BYTES;
+    pjsip_tls_setting_default(&cfg->tls_setting);
+}
+
+
+/****************************************************************************
+ * The WebSocket listener/transport factory.
+ */
+
+/*
+ * This is the public API to create, initialize, register, and start the
+ * WebSocket listener.
+ */
+PJ_DEF(pj_status_t) pjsip_ws_transport_start(pjsip_endpoint *endpt,
+					     const pjsip_ws_transport_cfg *cfg,
+					     pjsip_tpfactory **p_factory)
+{
+    pj_pool_t *pool;
+    pj_sock_t sock = PJ_INVALID_SOCKET;
+    struct ws_listener *listener;
+    pj_sockaddr *listener_addr;
+    unsigned async_cnt;
+    int addr_len;
+    pj_status_t status;
+
+    /* Sanity check */
+    PJ_ASSERT_RETURN(endpt && cfg && cfg->async_cnt, PJ_EINVAL);
+
+#if !WS_HAS_WSS
+    /* WSS requires TLS support */
+    if (cfg->secure)
+	return PJ_ENOTSUP;
+#endif
+
+    /* Verify that address given in a_name (if any) is valid */
+    if (cfg->addr_name.host.slen) {
+	pj_sockaddr tmp;
+
+	status = pj_sockaddr_init(cfg->af, &tmp, &cfg->addr_name.host,
+				  (pj_uint16_t)cfg->addr_name.port);
+	if (status != PJ_SUCCESS || !pj_sockaddr_has_addr(&tmp) ||
+	    (cfg->af==pj_AF_INET() &&
+	     tmp.ipv4.sin_addr.s_addr==PJ_INADDR_NONE))
+	{
+	    /* Invalid address */
+	    return PJ_EINVAL;
+	}
+    }
+
+    pool = pjsip_endpt_create_pool(endpt, "wslis", POOL_LIS_INIT,
+				   POOL_LIS_INC);
+    PJ_ASSERT_RETURN(pool, PJ_ENOMEM);
+
+
+    listener = PJ_POOL_ZALLOC_T(pool, struct ws_listener);
+    listener->factory.pool = pool;
+    listener->is_secure = cfg->secure;
+    if (cfg->secure) {
+	listener->factory.type = cfg->af==pj_AF_INET() ? PJSIP_TRANSPORT_WSS :
+							 PJSIP_TRANSPORT_WSS6;
+    } else {
+	listener->factory.type = cfg->af==pj_AF_INET() ? PJSIP_TRANSPORT_WS :
+							 PJSIP_TRANSPORT_WS6;
+    }
+    listener->factory.type_name = (char*)
+		pjsip_transport_get_type_name(listener->factory.type);
+    listener->factory.flag =
+	pjsip_transport_get_flag_from_type(listener->factory.type);
+    listener->qos_type = cfg->qos_type;
+    pj_memcpy(&listener->qos_params, &cfg->qos_params,
+	      sizeof(cfg->qos_params));
+    listener->max_tx_queue_bytes = cfg->max_tx_queue_bytes;
+    pj_strdup(pool, &listener->path, &cfg->path);
+    pjsip_tls_setting_copy(pool, &listener->tls_setting, &cfg->tls_setting);
+
+    pj_ansi_strcpy(listener->factory.obj_name,
+		   cfg->secure ? "wsslis" : "wslis");
+    if (cfg->af != pj_AF_INET())
+	pj_ansi_strcat(listener->factory.obj_name, "6");
+
+    status = pj_lock_create_recursive_mutex(pool, listener->factory.obj_name,
+					    &listener->factory.lock);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    async_cnt = cfg->async_cnt;
+    if (async_cnt > MAX_ASYNC_CNT)
+	async_cnt = MAX_ASYNC_CNT;
+
+    /* Bind address may be different than factory.local_addr because
+     * factory.local_addr will be resolved below.
+     */
+    pj_sockaddr_cp(&listener->bound_addr, &cfg->bind_addr);
+    listener_addr = &listener->factory.local_addr;
+    pj_sockaddr_cp(listener_addr, &cfg->bind_addr);
+
+    if (cfg->secure) {
+#if WS_HAS_WSS
+	pj_ssl_sock_param ssock_param;
+	pj_ssl_sock_info info;
+
+	/* Build SSL socket param */
+	pj_ssl_sock_param_default(&ssock_param);
+	ssock_param.sock_af = cfg->af;
+	ssock_param.cb.on_accept_complete = &on_ssl_accept_complete;
+	ssock_param.cb.on_data_read = &on_ssl_data_read;
+	ssock_param.cb.on_data_sent = &on_ssl_data_sent;
+	ssock_param.async_cnt = async_cnt;
+	ssock_param.ioqueue = pjsip_endpt_get_ioqueue(endpt);
+	ssock_param.require_client_cert =
+		listener->tls_setting.require_client_cert;
+	ssock_param.timeout = listener->tls_setting.timeout;
+	ssock_param.user_data = listener;
+	ssock_param.verify_peer = PJ_FALSE;
+	if (ssock_param.send_buffer_size < WS_TX_BUF_LEN)
+	    ssock_param.send_buffer_size = WS_TX_BUF_LEN;
+	if (ssock_param.read_buffer_size < PJSIP_MAX_PKT_LEN)
+	    ssock_param.read_buffer_size = PJSIP_MAX_PKT_LEN;
+	ssock_param.ciphers_num = listener->tls_setting.ciphers_num;
+	ssock_param.ciphers = listener->tls_setting.ciphers;
+	ssock_param.reuse_addr = cfg->reuse_addr;
+	ssock_param.qos_type = cfg->qos_type;
+	ssock_param.qos_ignore_error = listener->tls_setting.qos_ignore_error;
+	pj_memcpy(&ssock_param.qos_params, &cfg->qos_params,
+		  sizeof(ssock_param.qos_params));
+
+	switch(listener->tls_setting.method) {
+	case PJSIP_TLSV1_METHOD:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_TLS1;
+	    break;
+	case PJSIP_SSLV2_METHOD:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_SSL2;
+	    break;
+	case PJSIP_SSLV3_METHOD:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_SSL3;
+	    break;
+	case PJSIP_SSLV23_METHOD:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_SSL23;
+	    break;
+	default:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_DEFAULT;
+	    break;
+	}
+
+	/* Create SSL socket */
+	status = pj_ssl_sock_create(pool, &ssock_param, &listener->ssock);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	/* Check if certificate/CA list for SSL socket is set */
+	if (listener->tls_setting.cert_file.slen ||
+	    listener->tls_setting.ca_list_file.slen)
+	{
+	    status = pj_ssl_cert_load_from_files(pool,
+			    &listener->tls_setting.ca_list_file,
+			    &listener->tls_setting.cert_file,
+			    &listener->tls_setting.privkey_file,
+			    &listener->tls_setting.password,
+			    &listener->cert);
+	    if (status != PJ_SUCCESS)
+		goto on_error;
+
+	    status = pj_ssl_sock_set_certificate(listener->ssock, pool,
+						 listener->cert);
+	    if (status != PJ_SUCCESS)
+		goto on_error;
+	}
+
+	status = pj_ssl_sock_start_accept(listener->ssock, pool,
+					  listener_addr,
+					  pj_sockaddr_get_len(listener_addr));
+	if (status != PJ_SUCCESS && status != PJ_EPENDING)
+	    goto on_error;
+
+	/* Retrieve the bound address */
+	status = pj_ssl_sock_get_info(listener->ssock, &info);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+	pj_sockaddr_cp(listener_addr, &info.local_addr);
+#endif	/* WS_HAS_WSS */
+
+    } else {
+	pj_activesock_cfg asock_cfg;
+	pj_activesock_cb listener_cb;
+
+	/* Create socket */
+	status = pj_sock_socket(cfg->af, pj_SOCK_STREAM(), 0, &sock);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	/* Apply QoS, if specified */
+	status = pj_sock_apply_qos2(sock, cfg->qos_type, &cfg->qos_params,
+				    2, listener->factory.obj_name,
+				    "SIP WS listener socket");
+
+	/* Apply SO_REUSEADDR */
+	if (cfg->reuse_addr) {
+	    int enabled = 1;
+	    status = pj_sock_setsockopt(sock, pj_SOL_SOCKET(),
+					pj_SO_REUSEADDR(),
+					&enabled, sizeof(enabled));
+	    if (status != PJ_SUCCESS) {
+		PJ_PERROR(4,(listener->factory.obj_name, status,
+			     "Warning: error applying SO_REUSEADDR"));
+	    }
+	}
+
+	/* Bind socket */
+	status = pj_sock_bind(sock, listener_addr,
+			      pj_sockaddr_get_len(listener_addr));
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	/* Retrieve the bound address */
+	addr_len = pj_sockaddr_get_len(listener_addr);
+	status = pj_sock_getsockname(sock, listener_addr, &addr_len);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	/* Start listening to the address */
+	status = pj_sock_listen(sock, PJSIP_TCP_TRANSPORT_BACKLOG);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+
+	/* Create active socket */
+	pj_activesock_cfg_default(&asock_cfg);
+	asock_cfg.async_cnt = async_cnt;
+
+	pj_bzero(&listener_cb, sizeof(listener_cb));
+	listener_cb.on_accept_complete = &on_accept_complete;
+	status = pj_activesock_create(pool, sock, pj_SOCK_STREAM(),
+				      &asock_cfg,
+				      pjsip_endpt_get_ioqueue(endpt),
+				      &listener_cb, listener,
+				      &listener->asock);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    /* If published host/IP is specified, then use that address as the
+     * listener advertised address.
+     */
+    if (cfg->addr_name.host.slen) {
+	/* Copy the address */
+	listener->factory.addr_name = cfg->addr_name;
+	pj_strdup(listener->factory.pool, &listener->factory.addr_name.host,
+		  &cfg->addr_name.host);
+	listener->factory.addr_name.port = cfg->addr_name.port;
+
+    } else {
+	/* No published address is given, use the bound address */
+
+	/* If the address returns 0.0.0.0, use the default
+	 * interface address as the transport's address.
+	 */
+	if (!pj_sockaddr_has_addr(listener_addr)) {
+	    pj_sockaddr hostip;
+
+	    status = pj_gethostip(listener->bound_addr.addr.sa_family,
+	                          &hostip);
+	    if (status != PJ_SUCCESS)
+		goto on_error;
+
+	    pj_sockaddr_copy_addr(listener_addr, &hostip);
+	}
+
+	/* Save the address name */
+	sockaddr_to_host_port(listener->factory.pool,
+			      &listener->factory.addr_name,
+			      listener_addr);
+    }
+
+    /* If port is zero, get the bound port */
+    if (listener->factory.addr_name.port == 0) {
+	listener->factory.addr_name.port = pj_sockaddr_get_port(listener_addr);
+    }
+
+    pj_ansi_snprintf(listener->factory.obj_name,
+		     sizeof(listener->factory.obj_name),
+		     "%s:%d", (cfg->secure ? "wsslis" : "wslis"),
+		     listener->factory.addr_name.port);
+
+    /* Register to transport manager */
+    listener->endpt = endpt;
+    listener->tpmgr = pjsip_endpt_get_tpmgr(endpt);
+    listener->factory.create_transport2 = lis_create_transport;
+    listener->factory.destroy = lis_destroy;
+    listener->is_registered = PJ_TRUE;
+    status = pjsip_tpmgr_register_tpfactory(listener->tpmgr,
+					    &listener->factory);
+    if (status != PJ_SUCCESS) {
+	listener->is_registered = PJ_FALSE;
+	goto on_error;
+    }
+
+    /* Start pending accept() operations */
+    if (listener->asock) {
+	status = pj_activesock_start_accept(listener->asock, pool);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    PJ_LOG(4,(listener->factory.obj_name,
+	     "SIP %s listener ready for incoming connections at %.*s:%d",
+	     listener->factory.type_name,
+	     (int)listener->factory.addr_name.host.slen,
+	     listener->factory.addr_name.host.ptr,
+	     listener->factory.addr_name.port));
+
+    /* Return the pointer to user */
+    if (p_factory) *p_factory = &listener->factory;
+
+    return PJ_SUCCESS;
+
+on_error:
+    if (listener->asock==NULL && sock!=PJ_INVALID_SOCKET)
+	pj_sock_close(sock);
+    lis_destroy(&listener->factory);
+    return status;
+}
+
+
+/* This callback is called by transport manager to destroy listener */
+static pj_status_t lis_destroy(pjsip_tpfactory *factory)
+{
+    struct ws_listener *listener = (struct ws_listener *)factory;
+
+    if (listener->is_registered) {
+	pjsip_tpmgr_unregister_tpfactory(listener->tpmgr, &listener->factory);
+	listener->is_registered = PJ_FALSE;
+    }
+
+    if (listener->asock) {
+	pj_activesock_close(listener->asock);
+	listener->asock = NULL;
+    }
+
+#if WS_HAS_WSS
+    if (listener->ssock) {
+	pj_ssl_sock_close(listener->ssock);
+	listener->ssock = NULL;
+    }
+#endif
+
+    if (listener->factory.lock) {
+	pj_lock_destroy(listener->factory.lock);
+	listener->factory.lock = NULL;
+    }
+
+    if (listener->factory.pool) {
+	pj_pool_t *pool = listener->factory.pool;
+
+	PJ_LOG(4,(listener->factory.obj_name,  "SIP WebSocket listener "
+		  "destroyed"));
+
+	listener->factory.pool = NULL;
+	pj_pool_release(pool);
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/***************************************************************************/
+/*
+ * WebSocket Transport
+ */
+
+/*
+ * Prototypes.
+ */
+/* Called by transport manager to send message */
+static pj_status_t ws_send_msg(pjsip_transport *transport,
+			       pjsip_tx_data *tdata,
+			       const pj_sockaddr_t *rem_addr,
+			       int addr_len,
+			       void *token,
+			       pjsip_transport_callback callback);
+
+/* Called by transport manager to shutdown */
+static pj_status_t ws_shutdown(pjsip_transport *transport);
+
+/* Called by transport manager to destroy transport */
+static pj_status_t ws_destroy_transport(pjsip_transport *transport);
+
+/* Called by transport manager to get the outgoing queue info */
+static pj_status_t ws_get_queue_info(pjsip_transport *transport,
+				     pjsip_transport_queue_info *info);
+
+/* Utility to destroy transport */
+static pj_status_t ws_destroy(pjsip_transport *transport,
+			      pj_status_t reason);
+
+/* Callback on incoming data */
+static pj_bool_t on_data_read(pj_activesock_t *asock,
+			      void *data,
+			      pj_size_t size,
+			      pj_status_t status,
+			      pj_size_t *remainder);
+
+/* Callback when packet is sent */
+static pj_bool_t on_data_sent(pj_activesock_t *asock,
+			      pj_ioqueue_op_key_t *send_key,
+			      pj_ssize_t sent);
+
+/* Callback when connect completes */
+static pj_bool_t on_connect_complete(pj_activesock_t *asock,
+				     pj_status_t status);
+
+/* Common handlers for both active socket and SSL socket callbacks */
+static pj_bool_t ws_on_data_read(struct ws_transport *ws,
+				 void *data,
+				 pj_size_t size,
+				 pj_status_t status,
+				 pj_size_t *remainder);
+static pj_bool_t ws_on_data_sent(struct ws_transport *ws,
+				 pj_ioqueue_op_key_t *op_key,
+				 pj_ssize_t bytes_sent);
+static pj_bool_t ws_on_connect_complete(struct ws_transport *ws,
+					pj_status_t status);
+
+/* Notify the owner of a transmit data that the send has completed */
+static pj_bool_t ws_tx_done(pjsip_transport *transport,
+			    pj_ioqueue_op_key_t *op_key,
+			    pj_ssize_t bytes_sent);
+
+/* Outgoing queue callbacks */
+static pj_status_t ws_queue_send(pjsip_transport *transport,
+				 pj_ioqueue_op_key_t *op_key,
+				 const void *data,
+				 pj_ssize_t *size);
+static pj_bool_t ws_queue_is_ready(pjsip_transport *transport);
+static pj_size_t ws_queue_frame_len(pjsip_transport *transport,
+				    pj_size_t len);
+static pj_size_t ws_queue_build_frame(pjsip_transport *transport,
+				      char *buf, const char *msg,
+				      pj_size_t len);
+
+static const pjsip_tx_queue_cb ws_queue_cb =
+{
+    &ws_queue_send,
+    &ws_queue_is_ready,
+    &ws_tx_done,
+    &ws_queue_frame_len,
+    &ws_queue_build_frame
+};
+
+/* Fail all delayed transmits */
+static void ws_cancel_pending_tx(struct ws_transport *ws, pj_status_t reason);
+
+/* WebSocket keep-alive timer callback */
+static void ws_keep_alive_timer(pj_timer_heap_t *th, pj_timer_entry *e);
+
+/*
+ * Common function to create WebSocket transport, called when pending
+ * accept() and pending connect() complete.
+ */
+static pj_status_t ws_create( struct ws_listener *listener,
+			      pj_pool_t *pool,
+			      pj_sock_t sock,
+			      pj_ssl_sock_t *ssock,
+			      pj_bool_t is_server,
+			      const pj_sockaddr *local,
+			      const pj_sockaddr *remote,
+			      const pj_str_t *remote_name,
+			      struct ws_transport **p_ws)
+{
+    struct ws_transport *ws;
+    char print_addr[PJ_INET6_ADDRSTRLEN+10];
+    pj_status_t status;
+
+
+    PJ_ASSERT_RETURN(sock != PJ_INVALID_SOCKET || ssock, PJ_EINVAL);
+
+
+    if (pool == NULL) {
+	pool = pjsip_endpt_create_pool(listener->endpt, "ws",
+				       POOL_TP_INIT, POOL_TP_INC);
+	PJ_ASSERT_RETURN(pool != NULL, PJ_ENOMEM);
+    }
+
+    /*
+     * Create and initialize basic transport structure.
+     */
+    ws = PJ_POOL_ZALLOC_T(pool, struct ws_transport);
+    ws->is_server = is_server;
+    ws->is_secure = listener->is_secure;
+    ws->verify_server = listener->tls_setting.verify_server;
+    ws->sock = sock;
+    ws->ssock = ssock;
+    ws->has_pending_connect = PJ_TRUE;
+    pj_list_init(&ws->delayed_list);
+    pj_strdup(pool, &ws->path, &listener->path);
+    ws->base.pool = pool;
+
+    pj_ansi_snprintf(ws->base.obj_name, PJ_MAX_OBJ_NAME,
+		     (is_server ? "wss%p" :"wsc%p"), ws);
+
+    status = pj_atomic_create(pool, 0, &ws->base.ref_cnt);
+    if (status != PJ_SUCCESS) {
+	goto on_error;
+    }
+
+    status = pj_lock_create_recursive_mutex(pool, "ws", &ws->base.lock);
+    if (status != PJ_SUCCESS) {
+	goto on_error;
+    }
+
+    ws->base.key.type = listener->factory.type;
+    pj_sockaddr_cp(&ws->base.key.rem_addr, remote);
+    ws->base.type_name = (char*)pjsip_transport_get_type_name(
+				(pjsip_transport_type_e)ws->base.key.type);
+    ws->base.flag = pjsip_transport_get_flag_from_type(
+				(pjsip_transport_type_e)ws->base.key.type);
+
+    ws->base.info = (char*) pj_pool_alloc(pool, 64);
+    pj_ansi_snprintf(ws->base.info, 64, "%s to %s",
+                     ws->base.type_name,
+                     pj_sockaddr_print(remote, print_addr,
+                                       sizeof(print_addr), 3));
+
+    ws->base.addr_len = pj_sockaddr_get_len(remote);
+    pj_sockaddr_cp(&ws->base.local_addr, local);
+    sockaddr_to_host_port(pool, &ws->base.local_name, local);
+    sockaddr_to_host_port(pool, &ws->base.remote_name, remote);
+    ws->base.dir = is_server? PJSIP_TP_DIR_INCOMING : PJSIP_TP_DIR_OUTGOING;
+
+    /* Host name to be put in the Host header of the handshake */
+    if (remote_name && remote_name->slen)
+	pj_strdup(pool, &ws->remote_host, remote_name);
+    else
+	ws->remote_host = ws->base.remote_name.host;
+
+    ws->base.endpt = listener->endpt;
+    ws->base.tpmgr = listener->tpmgr;
+    ws->base.send_msg = &ws_send_msg;
+    ws->base.do_shutdown = &ws_shutdown;
+    ws->base.destroy = &ws_destroy_transport;
+    ws->base.get_queue_info = &ws_get_queue_info;
+
+    /* Create active socket for plain WebSocket */
+    if (!ssock) {
+	pj_activesock_cfg asock_cfg;
+	pj_activesock_cb ws_callback;
+
+	pj_activesock_cfg_default(&asock_cfg);
+	asock_cfg.async_cnt = 1;
+
+	pj_bzero(&ws_callback, sizeof(ws_callback));
+	ws_callback.on_data_read = &on_data_read;
+	ws_callback.on_data_sent = &on_data_sent;
+	ws_callback.on_connect_complete = &on_connect_complete;
+
+	status = pj_activesock_create(pool, sock, pj_SOCK_STREAM(),
+				      &asock_cfg,
+				      pjsip_endpt_get_ioqueue(listener->endpt),
+				      &ws_callback, ws, &ws->asock);
+	if (status != PJ_SUCCESS) {
+	    goto on_error;
+	}
+    }
+
+    /* Register transport to transport manager */
+    status = pjsip_transport_register(listener->tpmgr, &ws->base);
+    if (status != PJ_SUCCESS) {
+	goto on_error;
+    }
+
+    ws->is_registered = PJ_TRUE;
+
+    /* Initialize keep-alive timer */
+    ws->ka_timer.user_data = (void*)ws;
+    ws->ka_timer.cb = &ws_keep_alive_timer;
+    pj_ioqueue_op_key_init(&ws->ka_op_key.key, sizeof(pj_ioqueue_op_key_t));
+
+    /* Initialize op_keys for handshake, control frames and messages */
+    pj_ioqueue_op_key_init(&ws->hs_op_key.key, sizeof(pj_ioqueue_op_key_t));
+    pj_ioqueue_op_key_init(&ws->ctl_op_key.key, sizeof(pj_ioqueue_op_key_t));
+    ws->hs_buf = (char*) pj_pool_alloc(pool, WS_HS_BUF_LEN);
+
+    /* Initialize outgoing message queue */
+    pjsip_tx_queue_init(&ws->tx_queue, &ws->base, &ws_queue_cb,
+			listener->max_tx_queue_bytes, WS_TX_BUF_LEN);
+
+    /* Done setting up basic transport. */
+    *p_ws = ws;
+
+    PJ_LOG(4,(ws->base.obj_name, "%s %s transport created",
+	      ws->base.type_name, (ws->is_server ? "server" : "client")));
+
+    return PJ_SUCCESS;
+
+on_error:
+    ws_destroy(&ws->base, status);
+    return status;
+}
+
+
+/* Flush all delayed transmision once the handshake has completed. */
+static void ws_flush_pending_tx(struct ws_transport *ws)
+{
+    pj_time_val now;
+
+    pj_gettickcount(&now);
+    pj_lock_acquire(ws->base.lock);
+    while (!pj_list_empty(&ws->delayed_list)) {
+	struct delayed_tdata *pending_tx;
+
+	pending_tx = ws->delayed_list.next;
+	pj_list_erase(pending_tx);
+
+        if (pending_tx->timeout.sec > 0 &&
+            PJ_TIME_VAL_GT(now, pending_tx->timeout))
+        {
+            continue;
+        }
+
+	pjsip_tx_queue_add(&ws->tx_queue, pending_tx->tdata_op_key);
+    }
+    pj_lock_release(ws->base.lock);
+
+    /* send! */
+    pjsip_tx_queue_flush(&ws->tx_queue);
+}
+
+
+/* Fail all delayed transmits, e.g. when connect or handshake failed. */
+static void ws_cancel_pending_tx(struct ws_transport *ws, pj_status_t reason)
+{
+    while (!pj_list_empty(&ws->delayed_list)) {
+	struct delayed_tdata *pending_tx;
+	pj_ioqueue_op_key_t *op_key;
+
+	pending_tx = ws->delayed_list.next;
+	pj_list_erase(pending_tx);
+
+	op_key = (pj_ioqueue_op_key_t*)pending_tx->tdata_op_key;
+
+	ws_tx_done(&ws->base, op_key, -reason);
+    }
+}
+
+
+/* Called by transport manager to destroy transport */
+static pj_status_t ws_destroy_transport(pjsip_transport *transport)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+
+    /* Transport would have been unregistered by now since this callback
+     * is called by transport manager.
+     */
+    ws->is_registered = PJ_FALSE;
+
+    return ws_destroy(transport, ws->close_reason);
+}
+
+
+/* Destroy WebSocket transport */
+static pj_status_t ws_destroy(pjsip_transport *transport,
+			      pj_status_t reason)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+
+    if (ws->close_reason == 0)
+	ws->close_reason = reason;
+
+    if (ws->is_registered) {
+	ws->is_registered = PJ_FALSE;
+	pjsip_transport_destroy(transport);
+
+	/* pjsip_transport_destroy will recursively call this function
+	 * again.
+	 */
+	return PJ_SUCCESS;
+    }
+
+    /* Mark transport as closing */
+    ws->is_closing = PJ_TRUE;
+
+    /* Stop keep-alive timer. */
+    if (ws->ka_timer.id) {
+	pjsip_endpt_cancel_timer(ws->base.endpt, &ws->ka_timer);
+	ws->ka_timer.id = PJ_FALSE;
+    }
+
+    /* Cancel all delayed transmits */
+    ws_cancel_pending_tx(ws, reason);
+
+    /* Cancel all queued transmits */
+    pjsip_tx_queue_cancel(&ws->tx_queue, reason);
+
+    if (ws->rdata.tp_info.pool) {
+	pj_pool_release(ws->rdata.tp_info.pool);
+	ws->rdata.tp_info.pool = NULL;
+    }
+
+    ws_sock_close(ws);
+
+    if (ws->base.lock) {
+	pj_lock_destroy(ws->base.lock);
+	ws->base.lock = NULL;
+    }
+
+    if (ws->base.ref_cnt) {
+	pj_atomic_destroy(ws->base.ref_cnt);
+	ws->base.ref_cnt = NULL;
+    }
+
+    if (ws->base.pool) {
+	pj_pool_t *pool;
+
+	if (reason != PJ_SUCCESS) {
+	    char errmsg[PJ_ERR_MSG_SIZE];
+
+	    pj_strerror(reason, errmsg, sizeof(errmsg));
+	    PJ_LOG(4,(ws->base.obj_name,
+		      "WebSocket transport destroyed with reason %d: %s",
+		      reason, errmsg));
+
+	} else {
+
+	    PJ_LOG(4,(ws->base.obj_name,
+		      "WebSocket transport destroyed normally"));
+
+	}
+
+	pool = ws->base.pool;
+	ws->base.pool = NULL;
+	pj_pool_release(pool);
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * This utility function creates receive data buffers and start
+ * asynchronous recv() operations from the socket. It is called after
+ * accept() or connect() operation complete.
+ */
+static pj_status_t ws_start_read(struct ws_transport *ws)
+{
+    pj_pool_t *pool;
+    pj_uint32_t size;
+    pj_sockaddr *rem_addr;
+    void *readbuf[1];
+    pj_status_t status;
+
+    /* Init rdata */
+    pool = pjsip_endpt_create_pool(ws->base.endpt,
+				   "rtd%p",
+				   PJSIP_POOL_RDATA_LEN,
+				   PJSIP_POOL_RDATA_INC);
+    if (!pool) {
+	ws_perror(ws->base.obj_name, "Unable to create pool", PJ_ENOMEM);
+	return PJ_ENOMEM;
+    }
+
+    ws->rdata.tp_info.pool = pool;
+
+    ws->rdata.tp_info.transport = &ws->base;
+    ws->rdata.tp_info.tp_data = ws;
+    ws->rdata.tp_info.op_key.rdata = &ws->rdata;
+    pj_ioqueue_op_key_init(&ws->rdata.tp_info.op_key.op_key,
+			   sizeof(pj_ioqueue_op_key_t));
+
+    ws->rdata.pkt_info.src_addr = ws->base.key.rem_addr;
+    ws->rdata.pkt_info.src_addr_len = sizeof(ws->rdata.pkt_info.src_addr);
+    rem_addr = &ws->base.key.rem_addr;
+    pj_sockaddr_print(rem_addr, ws->rdata.pkt_info.src_name,
+                      sizeof(ws->rdata.pkt_info.src_name), 0);
+    ws->rdata.pkt_info.src_port = pj_sockaddr_get_port(rem_addr);
+
+    size = sizeof(ws->rdata.pkt_info.packet);
+    readbuf[0] = ws->rdata.pkt_info.packet;
+#if WS_HAS_WSS
+    if (ws->ssock) {
+	status = pj_ssl_sock_start_read2(ws->ssock, ws->base.pool, size,
+					 readbuf, 0);
+    } else
+#endif
+    {
+	status = pj_activesock_start_read2(ws->asock, ws->base.pool, size,
+					   readbuf, 0);
+    }
+    if (status != PJ_SUCCESS && status != PJ_EPENDING) {
+	PJ_LOG(4, (ws->base.obj_name,
+		   "Error starting read, status=%d",
+		   status));
+	return status;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/* This callback is called by transport manager for the WebSocket factory
+ * to create outgoing transport to the specified destination.
+ */
+static pj_status_t lis_create_transport(pjsip_tpfactory *factory,
+					pjsip_tpmgr *mgr,
+					pjsip_endpoint *endpt,
+					const pj_sockaddr *rem_addr,
+					int addr_len,
+					pjsip_tx_data *tdata,
+					pjsip_transport **p_transport)
+{
+    struct ws_listener *listener;
+    struct ws_transport *ws;
+    pj_sock_t sock = PJ_INVALID_SOCKET;
+    pj_ssl_sock_t *ssock = NULL;
+    pj_pool_t *pool;
+    pj_sockaddr local_addr;
+    pj_str_t remote_name;
+    pj_status_t status;
+
+    /* Sanity checks */
+    PJ_ASSERT_RETURN(factory && mgr && endpt && rem_addr &&
+		     addr_len && p_transport, PJ_EINVAL);
+
+    /* Check that address is a sockaddr_in or sockaddr_in6*/
+    PJ_ASSERT_RETURN((rem_addr->addr.sa_family == pj_AF_INET() &&
+		      addr_len == sizeof(pj_sockaddr_in)) ||
+		     (rem_addr->addr.sa_family == pj_AF_INET6() &&
+		      addr_len == sizeof(pj_sockaddr_in6)), PJ_EINVAL);
+
+
+    listener = (struct ws_listener*)factory;
+
+    /* Get remote host name from tdata */
+    if (tdata)
+	remote_name = tdata->dest_info.name;
+    else
+	pj_bzero(&remote_name, sizeof(remote_name));
+
+    pool = pjsip_endpt_create_pool(listener->endpt, "ws",
+				   POOL_TP_INIT, POOL_TP_INC);
+    PJ_ASSERT_RETURN(pool != NULL, PJ_ENOMEM);
+
+    /* Bind to listener's address and any port */
+    pj_bzero(&local_addr, sizeof(local_addr));
+    pj_sockaddr_cp(&local_addr, &listener->bound_addr);
+    pj_sockaddr_set_port(&local_addr, 0);
+
+    if (listener->is_secure) {
+#if WS_HAS_WSS
+	pj_ssl_sock_param ssock_param;
+
+	/* Build SSL socket param */
+	pj_ssl_sock_param_default(&ssock_param);
+	ssock_param.sock_af = rem_addr->addr.sa_family;
+	ssock_param.cb.on_connect_complete = &on_ssl_connect_complete;
+	ssock_param.cb.on_data_read = &on_ssl_data_read;
+	ssock_param.cb.on_data_sent = &on_ssl_data_sent;
+	ssock_param.async_cnt = 1;
+	ssock_param.ioqueue = pjsip_endpt_get_ioqueue(listener->endpt);
+	ssock_param.server_name = remote_name;
+	ssock_param.timeout = listener->tls_setting.timeout;
+	ssock_param.user_data = NULL; /* pending, must be set later */
+	ssock_param.verify_peer = PJ_FALSE;
+	if (ssock_param.send_buffer_size < WS_TX_BUF_LEN)
+	    ssock_param.send_buffer_size = WS_TX_BUF_LEN;
+	if (ssock_param.read_buffer_size < PJSIP_MAX_PKT_LEN)
+	    ssock_param.read_buffer_size = PJSIP_MAX_PKT_LEN;
+	ssock_param.ciphers_num = listener->tls_setting.ciphers_num;
+	ssock_param.ciphers = listener->tls_setting.ciphers;
+	ssock_param.qos_type = listener->qos_type;
+	ssock_param.qos_ignore_error = listener->tls_setting.qos_ignore_error;
+	pj_memcpy(&ssock_param.qos_params, &listener->qos_params,
+		  sizeof(ssock_param.qos_params));
+
+	switch(listener->tls_setting.method) {
+	case PJSIP_TLSV1_METHOD:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_TLS1;
+	    break;
+	case PJSIP_SSLV2_METHOD:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_SSL2;
+	    break;
+	case PJSIP_SSLV3_METHOD:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_SSL3;
+	    break;
+	case PJSIP_SSLV23_METHOD:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_SSL23;
+	    break;
+	default:
+	    ssock_param.proto = PJ_SSL_SOCK_PROTO_DEFAULT;
+	    break;
+	}
+
+	status = pj_ssl_sock_create(pool, &ssock_param, &ssock);
+	if (status != PJ_SUCCESS) {
+	    pj_pool_release(pool);
+	    return status;
+	}
+
+	/* Apply SSL certificate */
+	if (listener->cert) {
+	    status = pj_ssl_sock_set_certificate(ssock, pool, listener->cert);
+	    if (status != PJ_SUCCESS) {
+		pj_ssl_sock_close(ssock);
+		pj_pool_release(pool);
+		return status;
+	    }
+	}
+#else
+	pj_pool_release(pool);
+	return PJ_ENOTSUP;
+#endif
+
+    } else {
+	/* Create socket */
+	status = pj_sock_socket(rem_addr->addr.sa_family, pj_SOCK_STREAM(),
+				0, &sock);
+	if (status != PJ_SUCCESS) {
+	    pj_pool_release(pool);
+	    return status;
+	}
+
+	/* Apply QoS, if specified */
+	status = pj_sock_apply_qos2(sock, listener->qos_type,
+				    &listener->qos_params,
+				    2, listener->factory.obj_name,
+				    "outgoing SIP WS socket");
+
+	status = pj_sock_bind(sock, &local_addr,
+			      pj_sockaddr_get_len(&local_addr));
+	if (status != PJ_SUCCESS) {
+	    pj_sock_close(sock);
+	    pj_pool_release(pool);
+	    return status;
+	}
+
+	/* Get the local port */
+	addr_len = sizeof(local_addr);
+	status = pj_sock_getsockname(sock, &local_addr, &addr_len);
+	if (status != PJ_SUCCESS) {
+	    pj_sock_close(sock);
+	    pj_pool_release(pool);
+	    return status;
+	}
+    }
+
+    /* Initially set the address from the listener's address */
+    if (!pj_sockaddr_has_addr(&local_addr)) {
+	pj_sockaddr_copy_addr(&local_addr, &listener->factory.local_addr);
+    }
+
+    /* Create the transport descriptor */
+    status = ws_create(listener, pool, sock, ssock, PJ_FALSE, &local_addr,
+		       rem_addr, &remote_name, &ws);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    /* Start asynchronous connect() operation */
+#if WS_HAS_WSS
+    if (ws->ssock) {
+	/* Set the "pending" SSL socket user data */
+	pj_ssl_sock_set_user_data(ws->ssock, ws);
+
+	status = pj_ssl_sock_start_connect(ws->ssock, ws->base.pool,
+					   &local_addr, rem_addr,
+					   pj_sockaddr_get_len(rem_addr));
+    } else
+#endif
+    {
+	status = pj_activesock_start_connect(ws->asock, ws->base.pool,
+					     rem_addr,
+					     pj_sockaddr_get_len(rem_addr));
+    }
+
+    if (status == PJ_SUCCESS) {
+	ws_on_connect_complete(ws, PJ_SUCCESS);
+    } else if (status != PJ_EPENDING) {
+	ws_destroy(&ws->base, status);
+	return status;
+    }
+
+    PJ_LOG(4,(ws->base.obj_name,
+	      "%s transport %.*s:%d is connecting to %.*s:%d...",
+	      ws->base.type_name,
+	      (int)ws->base.local_name.host.slen,
+	      ws->base.local_name.host.ptr,
+	      ws->base.local_name.port,
+	      (int)ws->base.remote_name.host.slen,
+	      ws->base.remote_name.host.ptr,
+	      ws->base.remote_name.port));
+
+    /* Done */
+    *p_transport = &ws->base;
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Start receiving and waiting for the opening handshake once the
+ * connection has been accepted or connected.
+ */
+static void ws_on_connected(struct ws_transport *ws)
+{
+    pj_status_t status;
+
+    status = ws_start_read(ws);
+    if (status != PJ_SUCCESS) {
+	ws_cancel_pending_tx(ws, status);
+	ws_init_shutdown(ws, status);
+	return;
+    }
+
+    /* Start keep-alive timer */
+    if (PJSIP_WS_KEEP_ALIVE_INTERVAL) {
+	pj_time_val delay = { PJSIP_WS_KEEP_ALIVE_INTERVAL, 0 };
+	pjsip_endpt_schedule_timer(ws->base.endpt, &ws->ka_timer,
+				   &delay);
+	ws->ka_timer.id = PJ_TRUE;
+	pj_gettimeofday(&ws->last_activity);
+    }
+
+    /* Client initiates the opening handshake */
+    if (!ws->is_server) {
+	pj_uint8_t nonce[16];
+	char key[25];
+	int key_len = sizeof(key);
+	pj_str_t key_str;
+	pj_ssize_t size;
+	unsigned i;
+
+	for (i=0; i<sizeof(nonce); ++i)
+	    nonce[i] = (pj_uint8_t)pj_rand();
+	pj_base64_encode(nonce, sizeof(nonce), key, &key_len);
+	key[key_len] = '\0';
+
+	pj_strset(&key_str, key, key_len);
+	pjsip_ws_calc_accept(&key_str, ws->hs_accept);
+
+	size = pj_ansi_snprintf(ws->hs_buf, WS_HS_BUF_LEN,
+			"GET %.*s HTTP/1.1\r\n"
+			"Host: %s%.*s%s:%d\r\n"
+			"Upgrade: websocket\r\n"
+			"Connection: Upgrade\r\n"
+			"Sec-WebSocket-Key: %s\r\n"
+			"Sec-WebSocket-Version: 13\r\n"
+			"Sec-WebSocket-Protocol: sip\r\n"
+			"\r\n",
+			(ws->path.slen ? (int)ws->path.slen : 1),
+			(ws->path.slen ? ws->path.ptr : "/"),
+			(pj_strchr(&ws->remote_host, ':') ? "[" : ""),
+			(int)ws->remote_host.slen, ws->remote_host.ptr,
+			(pj_strchr(&ws->remote_host, ':') ? "]" : ""),
+			ws->base.remote_name.port,
+			key);
+	if (size <= 0 || size >= WS_HS_BUF_LEN) {
+	    ws_cancel_pending_tx(ws, PJ_ETOOBIG);
+	    ws_init_shutdown(ws, PJ_ETOOBIG);
+	    return;
+	}
+
+	status = ws_sock_send(ws, &ws->hs_op_key.key, ws->hs_buf, &size);
+	if (status != PJ_SUCCESS && status != PJ_EPENDING) {
+	    ws_perror(ws->base.obj_name, "Error sending WebSocket handshake",
+		      status);
+	    ws_cancel_pending_tx(ws, status);
+	    ws_init_shutdown(ws, status);
+	}
+    }
+}
+
+
+/*
+ * Mark the opening handshake as complete and start sending the messages
+ * queued in the meantime.
+ */
+static void ws_on_handshake_complete(struct ws_transport *ws)
+{
+    pjsip_tp_state_callback state_cb;
+
+    PJ_LOG(4,(ws->base.obj_name,
+	      "%s transport %.*s:%d is connected to %.*s:%d",
+	      ws->base.type_name,
+	      (int)ws->base.local_name.host.slen,
+	      ws->base.local_name.host.ptr,
+	      ws->base.local_name.port,
+	      (int)ws->base.remote_name.host.slen,
+	      ws->base.remote_name.host.ptr,
+	      ws->base.remote_name.port));
+
+    pj_lock_acquire(ws->base.lock);
+    ws->hs_done = PJ_TRUE;
+    ws->has_pending_connect = PJ_FALSE;
+    pj_lock_release(ws->base.lock);
+
+    /* Notify application of transport state connected */
+    state_cb = pjsip_tpmgr_get_state_cb(ws->base.tpmgr);
+    if (state_cb) {
+	pjsip_transport_state_info state_info;
+
+	pj_bzero(&state_info, sizeof(state_info));
+	(*state_cb)(&ws->base, PJSIP_TP_STATE_CONNECTED, &state_info);
+    }
+
+    /* Flush all pending send operations */
+    ws_flush_pending_tx(ws);
+}
+
+
+/*
+ * Process the HTTP Upgrade request received by server transport, and
+ * send the response.
+ */
+static pj_status_t ws_server_handshake(struct ws_transport *ws,
+				       const char *start, const char *end)
+{
+    const char *reject = NULL;
+    int reason_len;
+    pj_str_t key, value;
+    const char *path, *p;
+    pj_ssize_t size;
+    pj_status_t status;
+
+    /* Request line: GET <path> HTTP/1.1 */
+    if (end - start < 4 || pj_ansi_strncmp(start, "GET ", 4) != 0) {
+	reject = "400 Bad Request";
+	goto on_reject;
+    }
+
+    path = start + 4;
+    for (p=path; p < end && *p != ' ' && *p != '?' && *p != '\r'; ++p)
+	;
+    if (ws->path.slen && ((p - path) != ws->path.slen ||
+			  pj_ansi_strncmp(path, ws->path.ptr, p - path) != 0))
+    {
+	reject = "404 Not Found";
+	goto on_reject;
+    }
+
+    if (!ws_get_hdr(start, end, "Upgrade", &value) ||
+	!ws_hdr_has_token(&value, "websocket") ||
+	!ws_get_hdr(start, end, "Connection", &value) ||
+	!ws_hdr_has_token(&value, "Upgrade") ||
+	!ws_get_hdr(start, end, "Sec-WebSocket-Key", &key) ||
+	key.slen == 0 || key.slen > 64)
+    {
+	reject = "400 Bad Request";
+	goto on_reject;
+    }
+
+    if (!ws_get_hdr(start, end, "Sec-WebSocket-Version", &value) ||
+	pj_strcmp2(&value, "13") != 0)
+    {
+	reject = "426 Upgrade Required\r\nSec-WebSocket-Version: 13";
+	goto on_reject;
+    }
+
+    /* RFC 7118: the "sip" subprotocol must be negotiated */
+    if (!ws_get_hdr(start, end, "Sec-WebSocket-Protocol", &value) ||
+	!ws_hdr_has_token(&value, "sip"))
+    {
+	reject = "400 Bad Request";
+	goto on_reject;
+    }
+
+    pjsip_ws_calc_accept(&key, ws->hs_accept);
+
+    size = pj_ansi_snprintf(ws->hs_buf, WS_HS_BUF_LEN,
+			    "HTTP/1.1 101 Switching Protocols\r\n"
+			    "Upgrade: websocket\r\n"
+			    "Connection: Upgrade\r\n"
+			    "Sec-WebSocket-Accept: %s\r\n"
+			    "Sec-WebSocket-Protocol: sip\r\n"
+			    "\r\n",
+			    ws->hs_accept);
+
+    status = ws_sock_send(ws, &ws->hs_op_key.key, ws->hs_buf, &size);
+    if (status != PJ_SUCCESS && status != PJ_EPENDING)
+	return status;
+
+    return PJ_SUCCESS;
+
+on_reject:
+    for (reason_len=0; reject[reason_len] && reject[reason_len]!='\r';
+	 ++reason_len)
+	;
+
+    PJ_LOG(3,(ws->base.obj_name, "WebSocket handshake from %.*s:%d "
+	      "rejected: %.*s",
+	      (int)ws->base.remote_name.host.slen,
+	      ws->base.remote_name.host.ptr,
+	      ws->base.remote_name.port,
+	      reason_len, reject));
+
+    /* Send the error response, the transport will be shutdown once
+     * the response has been sent.
+     */
+    size = pj_ansi_snprintf(ws->hs_buf, WS_HS_BUF_LEN,
+			    "HTTP/1.1 %s\r\n"
+			    "Connection: close\r\n"
+			    "Content-Length: 0\r\n"
+			    "\r\n",
+			    reject);
+    ws->hs_rejected = PJ_TRUE;
+    status = ws_sock_send(ws, &ws->hs_op_key.key, ws->hs_buf, &size);
+    if (status == PJ_SUCCESS)
+	return PJSIP_EWSHANDSHAKE;
+
+    return (status == PJ_EPENDING) ? PJ_EPENDING : status;
+}
+
+
+/*
+ * Verify the HTTP response to our Upgrade request.
+ */
+static pj_status_t ws_client_handshake(struct ws_transport *ws,
+				       const char *start, const char *end)
+{
+    pj_str_t value;
+
+    /* Status line: HTTP/1.1 101 ... */
+    if (end - start < 12 || pj_ansi_strncmp(start, "HTTP/1.1 101", 12)) {
+	PJ_LOG(3,(ws->base.obj_name, "WebSocket handshake rejected: %.*s",
+		  (int)(pj_ansi_strchr(start, '\r') - start), start));
+	return PJSIP_EWSHANDSHAKE;
+    }
+
+    if (!ws_get_hdr(start, end, "Sec-WebSocket-Accept", &value) ||
+	pj_strcmp2(&value, ws->hs_accept) != 0)
+    {
+	PJ_LOG(3,(ws->base.obj_name, "WebSocket handshake failed: "
+		  "invalid Sec-WebSocket-Accept"));
+	return PJSIP_EWSHANDSHAKE;
+    }
+
+    if (!ws_get_hdr(start, end, "Sec-WebSocket-Protocol", &value) ||
+	pj_stricmp2(&value, "sip") != 0)
+    {
+	PJ_LOG(3,(ws->base.obj_name, "WebSocket handshake failed: "
+		  "server did not accept \"sip\" subprotocol"));
+	return PJSIP_EWSHANDSHAKE;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/* Send control frame (pong or close) */
+static void ws_send_ctl(struct ws_transport *ws, unsigned opcode,
+			const char *payload, pj_size_t len)
+{
+    pj_ssize_t size;
+    pj_status_t status;
+
+    pj_lock_acquire(ws->base.lock);
+    if (ws->ctl_pending) {
+	/* Previous control frame is still being sent, drop this one
+	 * unless it's close, in which case just close the connection.
+	 */
+	pj_lock_release(ws->base.lock);
+	if (opcode == WS_OP_CLOSE)
+	    ws_init_shutdown(ws, PJ_EEOF);
+	return;
+    }
+    ws->ctl_pending = PJ_TRUE;
+    ws->ctl_is_close = (opcode == WS_OP_CLOSE);
+    size = ws_build_frame(ws->ctl_buf, opcode, payload, len, !ws->is_server);
+    pj_lock_release(ws->base.lock);
+
+    status = ws_sock_send(ws, &ws->ctl_op_key.key, ws->ctl_buf, &size);
+    if (status != PJ_EPENDING)
+	ws_on_data_sent(ws, &ws->ctl_op_key.key,
+			(status == PJ_SUCCESS) ? size : -status);
+}
+
+
+/* Deliver reassembled message in the rdata buffer to transport manager */
+static void ws_deliver_msg(struct ws_transport *ws, pj_size_t len)
+{
+    pjsip_rx_data *rdata = &ws->rdata;
+    pj_size_t size_eaten;
+    char saved;
+
+    if (len == 0)
+	return;
+
+    /* Init pkt_info part. */
+    rdata->pkt_info.len = len;
+    rdata->pkt_info.zero = 0;
+    pj_gettimeofday(&rdata->pkt_info.timestamp);
+
+    /* Transport manager will NULL terminate the message, which would
+     * overwrite the next frame which may already be in the buffer.
+     */
+    saved = rdata->pkt_info.packet[len];
+
+    size_eaten = pjsip_tpmgr_receive_packet(rdata->tp_info.transport->tpmgr,
+					    rdata);
+
+    rdata->pkt_info.packet[len] = saved;
+
+    if (size_eaten != len) {
+	PJ_LOG(2,(ws->base.obj_name, "Dropping %d bytes of incomplete "
+		  "SIP message in WebSocket message from %s:%d",
+		  (int)(len - size_eaten), rdata->pkt_info.src_name,
+		  rdata->pkt_info.src_port));
+    }
+
+    /* Reset pool. */
+    pj_pool_reset(rdata->tp_info.pool);
+}
+
+
+/*
+ * Process WebSocket frames in the receive buffer. The buffer contains
+ * the payload of the (fragmented) message being reassembled, followed
+ * by the frames not yet processed. The payload of each data frame is
+ * unmasked in place and moved right after the previous payload, so the
+ * message ends up contiguous at the start of the buffer where it is
+ * parsed by the transport manager without further copying.
+ */
+static pj_bool_t ws_process_frames(struct ws_transport *ws,
+				   pj_size_t size,
+				   pj_size_t *remainder)
+{
+    pj_uint8_t *buf = (pj_uint8_t*) ws->rdata.pkt_info.packet;
+    pj_size_t w = ws->rx_msg_len;
+    pj_size_t r = ws->rx_msg_len;
+    pj_status_t status = PJ_SUCCESS;
+
+    while (size - r >= 2) {
+	pj_uint8_t *p = buf + r;
+	pj_bool_t fin = (p[0] & 0x80) != 0;
+	unsigned opcode = p[0] & 0x0F;
+	pj_bool_t masked = (p[1] & 0x80) != 0;
+	pj_size_t hdr_len = 2;
+	pj_uint64_t len = p[1] & 0x7F;
+	pj_uint8_t *payload;
+
+	if (len == 126)
+	    hdr_len += 2;
+	else if (len == 127)
+	    hdr_len += 8;
+	if (masked)
+	    hdr_len += 4;
+
+	if (size - r < hdr_len)
+	    break;
+
+	if (len == 126) {
+	    len = ((pj_uint64_t)p[2] << 8) | p[3];
+	} else if (len == 127) {
+	    unsigned i;
+	    len = 0;
+	    for (i=0; i<8; ++i)
+		len = (len << 8) | p[2+i];
+	}
+
+	/* Validate the frame. The most significant bit of the 64-bit
+	 * length must be zero (RFC 6455 section 5.2).
+	 */
+	if ((p[0] & 0x70) != 0 ||
+	    (len >> 63) != 0 ||
+	    (ws->is_server && !masked) ||
+	    ((opcode & 0x08) && (!fin || len > WS_MAX_CTL_LEN)) ||
+	    (opcode == WS_OP_CONT && !ws->rx_in_msg) ||
+	    ((opcode == WS_OP_TEXT || opcode == WS_OP_BIN) && ws->rx_in_msg) ||
+	    (opcode != WS_OP_CONT && opcode != WS_OP_TEXT &&
+	     opcode != WS_OP_BIN && opcode != WS_OP_CLOSE &&
+	     opcode != WS_OP_PING && opcode != WS_OP_PONG))
+	{
+	    status = PJSIP_EWSFRAME;
+	    break;
+	}
+
+	/* The whole frame must fit in the buffer after previous payload.
+	 * The length comes from the peer, compare it without overflowing.
+	 */
+	if (w + hdr_len > PJSIP_MAX_PKT_LEN ||
+	    len > (pj_uint64_t)(PJSIP_MAX_PKT_LEN - w - hdr_len))
+	{
+	    status = PJSIP_ERXOVERFLOW;
+	    break;
+	}
+
+	if (size - r < hdr_len + len)
+	    break;
+
+	/* Unmask the payload in place */
+	payload = p + hdr_len;
+	if (masked) {
+	    const pj_uint8_t *key = payload - 4;
+	    pj_size_t i;
+
+	    for (i=0; i<len; ++i)
+		payload[i] ^= key[i & 3];
+	}
+
+	r += hdr_len + (pj_size_t)len;
+
+	if (opcode == WS_OP_PING) {
+	    ws_send_ctl(ws, WS_OP_PONG, (const char*)payload, (pj_size_t)len);
+
+	} else if (opcode == WS_OP_CLOSE) {
+	    PJ_LOG(4,(ws->base.obj_name, "WebSocket close frame received"));
+	    ws_send_ctl(ws, WS_OP_CLOSE, (const char*)payload,
+			(len >= 2 ? 2 : 0));
+	    status = PJ_EEOF;
+	    break;
+
+	} else if (opcode != WS_OP_PONG) {
+	    /* Data frame: append the payload to the message */
+	    if (payload != buf + w)
+		pj_memmove(buf + w, payload, (pj_size_t)len);
+	    w += (pj_size_t)len;
+
+	    if (fin) {
+		ws->rx_in_msg = PJ_FALSE;
+		ws_deliver_msg(ws, w);
+		w = 0;
+
+		if (ws->is_closing)
+		    return PJ_FALSE;
+	    } else {
+		ws->rx_in_msg = PJ_TRUE;
+	    }
+	}
+    }
+
+    if (status != PJ_SUCCESS) {
+	if (status != PJ_EEOF) {
+	    ws_perror(ws->base.obj_name, "WebSocket receive error", status);
+	    ws_init_shutdown(ws, status);
+	    return PJ_FALSE;
+	}
+
+	/* Close frame, stop processing and wait until the close reply
+	 * has been sent.
+	 */
+	*remainder = 0;
+	ws->rx_msg_len = 0;
+	return PJ_TRUE;
+    }
+
+    /* Move the unprocessed frames after the reassembled payload */
+    if (size > r && r != w)
+	pj_memmove(buf + w, buf + r, size - r);
+
+    ws->rx_msg_len = w;
+    *remainder = w + (size - r);
+
+    return PJ_TRUE;
+}
+
+
+/*
+ * Common handler for incoming data.
+ */
+static pj_bool_t ws_on_data_read(struct ws_transport *ws,
+				 void *data,
+				 pj_size_t size,
+				 pj_status_t status,
+				 pj_size_t *remainder)
+{
+    pjsip_rx_data *rdata = &ws->rdata;
+
+    /* Don't do anything if transport is closing. */
+    if (ws->is_closing) {
+	ws->is_closing++;
+	return PJ_FALSE;
+    }
+
+    if (status != PJ_SUCCESS) {
+
+	/* Transport is closed */
+	PJ_LOG(4,(ws->base.obj_name, "WebSocket connection closed"));
+
+	if (!ws->hs_done)
+	    ws_cancel_pending_tx(ws, status);
+
+	ws_init_shutdown(ws, status);
+
+	return PJ_FALSE;
+    }
+
+    /* Mark this as an activity */
+    pj_gettimeofday(&ws->last_activity);
+
+    pj_assert((void*)rdata->pkt_info.packet == data);
+
+    if (!ws->hs_done) {
+	const char *end;
+	pj_size_t hs_len;
+
+	/* Ignore data until handshake response has been sent */
+	if (ws->hs_rejected) {
+	    *remainder = 0;
+	    return PJ_TRUE;
+	}
+
+	end = ws_find_hdr_end((const char*)data, size);
+	if (end == NULL) {
+	    if (size >= PJSIP_MAX_PKT_LEN) {
+		status = PJSIP_EWSHANDSHAKE;
+	    } else {
+		/* Need more data */
+		*remainder = size;
+		return PJ_TRUE;
+	    }
+	} else if (ws->is_server) {
+	    status = ws_server_handshake(ws, (const char*)data, end);
+	} else {
+	    status = ws_client_handshake(ws, (const char*)data, end);
+	}
+
+	if (status == PJ_EPENDING) {
+	    /* Rejected, wait until the response has been sent */
+	    *remainder = 0;
+	    return PJ_TRUE;
+	} else if (status != PJ_SUCCESS) {
+	    ws_cancel_pending_tx(ws, status);
+	    ws_init_shutdown(ws, status);
+	    return PJ_FALSE;
+	}
+
+	/* Handshake completed, process the frames that may follow */
+	hs_len = end - (const char*)data;
+	size -= hs_len;
+	if (size)
+	    pj_memmove(data, end, size);
+
+	ws_on_handshake_complete(ws);
+
+	if (ws->is_closing)
+	    return PJ_FALSE;
+    }
+
+    return ws_process_frames(ws, size, remainder);
+}
+
+
+/*
+ * Common handler for send completion.
+ */
+static pj_bool_t ws_on_data_sent(struct ws_transport *ws,
+				 pj_ioqueue_op_key_t *op_key,
+				 pj_ssize_t bytes_sent)
+{
+    if (op_key == &ws->tx_queue.op_key.key)
+	return pjsip_tx_queue_on_data_sent(&ws->tx_queue, op_key, bytes_sent);
+
+    if (op_key == &ws->hs_op_key.key && ws->hs_rejected) {
+	/* Handshake error response has been sent */
+	ws_init_shutdown(ws, PJSIP_EWSHANDSHAKE);
+	return PJ_FALSE;
+    }
+
+    if (op_key == &ws->ctl_op_key.key) {
+	pj_bool_t is_close;
+
+	pj_lock_acquire(ws->base.lock);
+	is_close = ws->ctl_is_close;
+	ws->ctl_pending = PJ_FALSE;
+	pj_lock_release(ws->base.lock);
+
+	if (is_close) {
+	    /* Closing handshake has completed */
+	    ws_init_shutdown(ws, PJ_EEOF);
+	    return PJ_FALSE;
+	}
+    }
+
+    /* Keep-alive, handshake or pong */
+    return ws_tx_done(&ws->base, op_key, bytes_sent);
+}
+
+
+/*
+ * Notify the owner of the transmit data that the send has completed, and
+ * shutdown the transport on error.
+ */
+static pj_bool_t ws_tx_done(pjsip_transport *transport,
+			    pj_ioqueue_op_key_t *op_key,
+			    pj_ssize_t bytes_sent)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+    pjsip_tx_data_op_key *tdata_op_key = (pjsip_tx_data_op_key*)op_key;
+
+    /* Note that op_key may be the op_key from keep-alive, handshake or
+     * control frame, thus it will not have tdata etc.
+     */
+
+    tdata_op_key->tdata = NULL;
+
+    if (tdata_op_key->callback) {
+	/*
+	 * Notify sip_transport.c that packet has been sent.
+	 */
+	if (bytes_sent == 0)
+	    bytes_sent = -PJ_RETURN_OS_ERROR(OSERR_ENOTCONN);
+
+	tdata_op_key->callback(&ws->base, tdata_op_key->token, bytes_sent);
+
+	/* Mark last activity time */
+	pj_gettimeofday(&ws->last_activity);
+
+    }
+
+    /* Check for error/closure */
+    if (bytes_sent <= 0) {
+	pj_status_t status;
+
+	PJ_LOG(5,(ws->base.obj_name, "WebSocket send() error, sent=%d",
+		  bytes_sent));
+
+	status = (bytes_sent == 0) ? PJ_RETURN_OS_ERROR(OSERR_ENOTCONN) :
+				     (pj_status_t)-bytes_sent;
+
+	ws_init_shutdown(ws, status);
+
+	return PJ_FALSE;
+    }
+
+    return PJ_TRUE;
+}
+
+
+/*
+ * This callback is called by transport manager to send SIP message
+ */
+static pj_status_t ws_send_msg(pjsip_transport *transport,
+			       pjsip_tx_data *tdata,
+			       const pj_sockaddr_t *rem_addr,
+			       int addr_len,
+			       void *token,
+			       pjsip_transport_callback callback)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+    pj_ssize_t size;
+
+    /* Sanity check */
+    PJ_ASSERT_RETURN(transport && tdata, PJ_EINVAL);
+
+    /* Check that there's no pending operation associated with the tdata */
+    PJ_ASSERT_RETURN(tdata->op_key.tdata == NULL, PJSIP_EPENDINGTX);
+
+    /* Check the address is supported */
+    PJ_ASSERT_RETURN(rem_addr && (addr_len==sizeof(pj_sockaddr_in) ||
+	                          addr_len==sizeof(pj_sockaddr_in6)),
+	             PJ_EINVAL);
+
+    /* The frame must fit in the transmit buffer */
+    size = tdata->buf.cur - tdata->buf.start;
+    if (size > PJSIP_MAX_PKT_LEN)
+	return PJSIP_EMSGTOOLONG;
+
+    /* Init op key. */
+    tdata->op_key.tdata = tdata;
+    tdata->op_key.token = token;
+    tdata->op_key.callback = callback;
+
+    pj_lock_acquire(ws->base.lock);
+
+    if (ws->has_pending_connect) {
+	struct delayed_tdata *delayed_tdata;
+
+	/*
+	 * connect() or the opening handshake is still in progress. Put the
+	 * transmit data to the delayed list, with timeout for requests (see
+	 * sip_transport_tcp.c).
+	 */
+	delayed_tdata = PJ_POOL_ZALLOC_T(tdata->pool,
+					 struct delayed_tdata);
+	delayed_tdata->tdata_op_key = &tdata->op_key;
+	if (tdata->msg && tdata->msg->type == PJSIP_REQUEST_MSG) {
+	    pj_gettickcount(&delayed_tdata->timeout);
+	    delayed_tdata->timeout.msec += pjsip_cfg()->tsx.td;
+	    pj_time_val_normalize(&delayed_tdata->timeout);
+	}
+
+	pj_list_push_back(&ws->delayed_list, delayed_tdata);
+
+	pj_lock_release(ws->base.lock);
+
+	return PJ_EPENDING;
+    }
+
+    pj_lock_release(ws->base.lock);
+
+    /* Queue the message. It is written right away if no other write is
+     * in progress.
+     */
+    return pjsip_tx_queue_send(&ws->tx_queue, tdata);
+}
+
+
+/*
+ * This callback is called by transport manager to get the outgoing
+ * queue info.
+ */
+static pj_status_t ws_get_queue_info(pjsip_transport *transport,
+				     pjsip_transport_queue_info *info)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+
+    pjsip_tx_queue_get_info(&ws->tx_queue, info);
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Outgoing queue callback to write data to the socket.
+ */
+static pj_status_t ws_queue_send(pjsip_transport *transport,
+				 pj_ioqueue_op_key_t *op_key,
+				 const void *data,
+				 pj_ssize_t *size)
+{
+    return ws_sock_send((struct ws_transport*)transport, op_key, data, size);
+}
+
+
+/*
+ * Outgoing queue callback to check whether the socket can be written.
+ */
+static pj_bool_t ws_queue_is_ready(pjsip_transport *transport)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+
+    return !ws->is_closing && !ws->has_pending_connect;
+}
+
+
+/*
+ * Outgoing queue callback to get the size of the text frame carrying
+ * a message.
+ */
+static pj_size_t ws_queue_frame_len(pjsip_transport *transport,
+				    pj_size_t len)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+
+    return ws_frame_hdr_len(len, !ws->is_server) + len;
+}
+
+
+/*
+ * Outgoing queue callback to frame a message (and mask it when we are
+ * the client).
+ */
+static pj_size_t ws_queue_build_frame(pjsip_transport *transport,
+				      char *buf, const char *msg,
+				      pj_size_t len)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+
+    return ws_build_frame(buf, WS_OP_TEXT, msg, len, !ws->is_server);
+}
+
+
+/*
+ * This callback is called by transport manager to shutdown transport.
+ */
+static pj_status_t ws_shutdown(pjsip_transport *transport)
+{
+    struct ws_transport *ws = (struct ws_transport*)transport;
+
+    /* Stop keep-alive timer. */
+    if (ws->ka_timer.id) {
+	pjsip_endpt_cancel_timer(ws->base.endpt, &ws->ka_timer);
+	ws->ka_timer.id = PJ_FALSE;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Common handler for connect() completion.
+ */
+static pj_bool_t ws_on_connect_complete(struct ws_transport *ws,
+					pj_status_t status)
+{
+    pj_sockaddr addr;
+    int addrlen;
+
+    /* Check connect() status */
+    if (status != PJ_SUCCESS) {
+
+	ws_perror(ws->base.obj_name, "WebSocket connect() error", status);
+
+	/* Cancel all delayed transmits */
+	ws_cancel_pending_tx(ws, status);
+
+	ws_init_shutdown(ws, status);
+	return PJ_FALSE;
+    }
+
+    /* Update (again) local address, just in case local address currently
+     * set is different now that the socket is connected.
+     */
+    addrlen = sizeof(addr);
+#if WS_HAS_WSS
+    if (ws->ssock) {
+	pj_ssl_sock_info ssl_info;
+
+	status = pj_ssl_sock_get_info(ws->ssock, &ssl_info);
+	if (status == PJ_SUCCESS) {
+	    pj_sockaddr_cp(&addr, &ssl_info.local_addr);
+
+	    /* Server certificate verification */
+	    if (ssl_info.verify_status && ws->verify_server) {
+		PJ_LOG(3,(ws->base.obj_name, "WSS server certificate "
+			  "verification failed (status=0x%x)",
+			  ssl_info.verify_status));
+		ws_cancel_pending_tx(ws, PJSIP_TLS_ECERTVERIF);
+		ws_init_shutdown(ws, PJSIP_TLS_ECERTVERIF);
+		return PJ_FALSE;
+	    }
+	}
+    } else
+#endif
+    {
+	status = pj_sock_getsockname(ws->sock, &addr, &addrlen);
+    }
+
+    if (status == PJ_SUCCESS) {
+	pj_sockaddr *tp_addr = &ws->base.local_addr;
+
+	if (pj_sockaddr_has_addr(&addr) &&
+	    pj_sockaddr_cmp(&addr, tp_addr) != 0)
+	{
+	    pj_sockaddr_cp(tp_addr, &addr);
+	    sockaddr_to_host_port(ws->base.pool, &ws->base.local_name,
+				  tp_addr);
+	}
+    }
+
+    /* Start reading and send the opening handshake */
+    ws_on_connected(ws);
+
+    return !ws->is_closing;
+}
+
+
+/*
+ * This callback is called by active socket when pending accept() operation
+ * has completed.
+ */
+static pj_bool_t on_accept_complete(pj_activesock_t *asock,
+				    pj_sock_t sock,
+				    const pj_sockaddr_t *src_addr,
+				    int src_addr_len)
+{
+    struct ws_listener *listener;
+    struct ws_transport *ws;
+    char addr[PJ_INET6_ADDRSTRLEN+10];
+    pj_sockaddr tmp_src_addr;
+    pj_status_t status;
+
+    PJ_UNUSED_ARG(src_addr_len);
+
+    listener = (struct ws_listener*) pj_activesock_get_user_data(asock);
+
+    PJ_ASSERT_RETURN(sock != PJ_INVALID_SOCKET, PJ_TRUE);
+
+    PJ_LOG(4,(listener->factory.obj_name,
+	      "WS listener %.*s:%d: got incoming connection "
+	      "from %s, sock=%d",
+	      (int)listener->factory.addr_name.host.slen,
+	      listener->factory.addr_name.host.ptr,
+	      listener->factory.addr_name.port,
+	      pj_sockaddr_print(src_addr, addr, sizeof(addr), 3),
+	      sock));
+
+    /* Apply QoS, if specified */
+    status = pj_sock_apply_qos2(sock, listener->qos_type,
+				&listener->qos_params,
+				2, listener->factory.obj_name,
+				"incoming SIP WS socket");
+
+    /* ws_create() expect pj_sockaddr, so copy src_addr to temporary var,
+     * just in case.
+     */
+    pj_bzero(&tmp_src_addr, sizeof(tmp_src_addr));
+    pj_sockaddr_cp(&tmp_src_addr, src_addr);
+
+    /*
+     * Incoming connection!
+     * Create WebSocket transport for the new socket, and wait for the
+     * opening handshake.
+     */
+    status = ws_create( listener, NULL, sock, NULL, PJ_TRUE,
+			&listener->factory.local_addr,
+			&tmp_src_addr, NULL, &ws);
+    if (status == PJ_SUCCESS)
+	ws_on_connected(ws);
+
+    return PJ_TRUE;
+}
+
+
+/*
+ * Active socket callbacks.
+ */
+static pj_bool_t on_data_read(pj_activesock_t *asock,
+			      void *data,
+			      pj_size_t size,
+			      pj_status_t status,
+			      pj_size_t *remainder)
+{
+    struct ws_transport *ws;
+
+    ws = (struct ws_transport*) pj_activesock_get_user_data(asock);
+    return ws_on_data_read(ws, data, size, status, remainder);
+}
+
+static pj_bool_t on_data_sent(pj_activesock_t *asock,
+			      pj_ioqueue_op_key_t *op_key,
+			      pj_ssize_t bytes_sent)
+{
+    struct ws_transport *ws;
+
+    ws = (struct ws_transport*) pj_activesock_get_user_data(asock);
+    return ws_on_data_sent(ws, op_key, bytes_sent);
+}
+
+static pj_bool_t on_connect_complete(pj_activesock_t *asock,
+				     pj_status_t status)
+{
+    struct ws_transport *ws;
+
+    ws = (struct ws_transport*) pj_activesock_get_user_data(asock);
+    return ws_on_connect_complete(ws, status);
+}
+
+
+#if WS_HAS_WSS
+/*
+ * SSL socket callbacks.
+ */
+static pj_bool_t on_ssl_accept_complete(pj_ssl_sock_t *ssock,
+					pj_ssl_sock_t *new_ssock,
+					const pj_sockaddr_t *src_addr,
+					int src_addr_len)
+{
+    struct ws_listener *listener;
+    struct ws_transport *ws;
+    pj_ssl_sock_info ssl_info;
+    char addr[PJ_INET6_ADDRSTRLEN+10];
+    pj_sockaddr tmp_src_addr;
+    pj_status_t status;
+
+    PJ_UNUSED_ARG(src_addr_len);
+
+    listener = (struct ws_listener*) pj_ssl_sock_get_user_data(ssock);
+
+    PJ_ASSERT_RETURN(new_ssock, PJ_TRUE);
+
+    PJ_LOG(4,(listener->factory.obj_name,
+	      "WSS listener %.*s:%d: got incoming connection from %s",
+	      (int)listener->factory.addr_name.host.slen,
+	      listener->factory.addr_name.host.ptr,
+	      listener->factory.addr_name.port,
+	      pj_sockaddr_print(src_addr, addr, sizeof(addr), 3)));
+
+    /* Reject client with certificate verification error if the
+     * verification is mandatory.
+     */
+    status = pj_ssl_sock_get_info(new_ssock, &ssl_info);
+    if (status != PJ_SUCCESS ||
+	(ssl_info.verify_status && listener->tls_setting.verify_client))
+    {
+	pj_ssl_sock_close(new_ssock);
+	return PJ_TRUE;
+    }
+
+    pj_bzero(&tmp_src_addr, sizeof(tmp_src_addr));
+    pj_sockaddr_cp(&tmp_src_addr, src_addr);
+
+    status = ws_create( listener, NULL, PJ_INVALID_SOCKET, new_ssock,
+			PJ_TRUE, &listener->factory.local_addr,
+			&tmp_src_addr, NULL, &ws);
+    if (status != PJ_SUCCESS)
+	return PJ_TRUE;
+
+    /* Set the "pending" SSL socket user data */
+    pj_ssl_sock_set_user_data(new_ssock, ws);
+
+    ws_on_connected(ws);
+
+    return PJ_TRUE;
+}
+
+static pj_bool_t on_ssl_data_read(pj_ssl_sock_t *ssock,
+				  void *data,
+				  pj_size_t size,
+				  pj_status_t status,
+				  pj_size_t *remainder)
+{
+    struct ws_transport *ws;
+
+    ws = (struct ws_transport*) pj_ssl_sock_get_user_data(ssock);
+    return ws_on_data_read(ws, data, size, status, remainder);
+}
+
+static pj_bool_t on_ssl_data_sent(pj_ssl_sock_t *ssock,
+				  pj_ioqueue_op_key_t *op_key,
+				  pj_ssize_t bytes_sent)
+{
+    struct ws_transport *ws;
+
+    ws = (struct ws_transport*) pj_ssl_sock_get_user_data(ssock);
+    return ws_on_data_sent(ws, op_key, bytes_sent);
+}
+
+static pj_bool_t on_ssl_connect_complete(pj_ssl_sock_t *ssock,
+					 pj_status_t status)
+{
+    struct ws_transport *ws;
+
+    ws = (struct ws_transport*) pj_ssl_sock_get_user_data(ssock);
+    return ws_on_connect_complete(ws, status);
+}
+#endif	/* WS_HAS_WSS */
+
+
+/* Transport keep-alive timer callback, sending ping frame */
+static void ws_keep_alive_timer(pj_timer_heap_t *th, pj_timer_entry *e)
+{
+    struct ws_transport *ws = (struct ws_transport*) e->user_data;
+    pj_time_val delay;
+    pj_time_val now;
+    pj_ssize_t size;
+    pj_status_t status;
+
+    PJ_UNUSED_ARG(th);
+
+    ws->ka_timer.id = PJ_TRUE;
+
+    pj_gettimeofday(&now);
+    PJ_TIME_VAL_SUB(now, ws->last_activity);
+
+    if ((now.sec > 0 && now.sec < PJSIP_WS_KEEP_ALIVE_INTERVAL) ||
+	!ws->hs_done)
+    {
+	/* There has been activity, so don't send keep-alive */
+	delay.sec = PJSIP_WS_KEEP_ALIVE_INTERVAL - now.sec;
+	if (delay.sec <= 0)
+	    delay.sec = PJSIP_WS_KEEP_ALIVE_INTERVAL;
+	delay.msec = 0;
+
+	pjsip_endpt_schedule_timer(ws->base.endpt, &ws->ka_timer,
+				   &delay);
+	ws->ka_timer.id = PJ_TRUE;
+	return;
+    }
+
+    PJ_LOG(5,(ws->base.obj_name, "Sending WebSocket ping to %.*s:%d",
+	      (int)ws->base.remote_name.host.slen,
+	      ws->base.remote_name.host.ptr,
+	      ws->base.remote_name.port));
+
+    /* Send the data */
+    size = ws_build_frame(ws->ka_buf, WS_OP_PING, NULL, 0, !ws->is_server);
+    status = ws_sock_send(ws, &ws->ka_op_key.key, ws->ka_buf, &size);
+
+    if (status != PJ_SUCCESS && status != PJ_EPENDING) {
+	ws_perror(ws->base.obj_name,
+		  "Error sending keep-alive packet", status);
+	ws_init_shutdown(ws, status);
+	return;
+    }
+
+    /* Register next keep-alive */
+    delay.sec = PJSIP_WS_KEEP_ALIVE_INTERVAL;
+    delay.msec = 0;
+
+    pjsip_endpt_schedule_timer(ws->base.endpt, &ws->ka_timer,
+			       &delay);
+    ws->ka_timer.id = PJ_TRUE;
+}
+
+
+#endif	/* PJ_HAS_TCP && PJSIP_HAS_WS_TRANSPORT */
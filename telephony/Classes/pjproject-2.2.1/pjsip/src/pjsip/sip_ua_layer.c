@@ -55,7 +55,9 @@ struct dlg_set_head
 };
 
 /* This struct represents a dialog set.
- * This is the value that will be put in the UA's hash table.
+ * This is the value that will be put in the UA's hash table. Dialogs
+ * created by a forked request share the Call-ID and local tag, hence
+ * they are kept together in the same entry.
  */
 struct dlg_set
 {
@@ -70,6 +72,20 @@ struct dlg_set
 };
 
 
+/* One stripe of the dialog table. Dialog sets are spread across the
+ * stripes by the hash of their Call-ID and local tag, and each stripe
+ * has its own mutex, so that lookups for unrelated dialogs done by
+ * different threads don't contend on a single lock.
+ */
+struct dlg_table_stripe
+{
+    pj_pool_t		*pool;
+    pj_mutex_t		*mutex;
+    pj_hash_table_t	*dlg_table;
+    struct dlg_set	 free_dlgset_nodes;
+};
+
+
 /*
  * Module interface.
  */
@@ -78,10 +94,8 @@ static struct user_agent
     pjsip_module	 mod;
     pj_pool_t		*pool;
     pjsip_endpoint	*endpt;
-    pj_mutex_t		*mutex;
-    pj_hash_table_t	*dlg_table;
     pjsip_ua_init_param  param;
-    struct dlg_set	 free_dlgset_nodes;
+    struct dlg_table_stripe stripes[PJSIP_UA_DLG_TABLE_STRIPES];
 
 } mod_ua = 
 {
@@ -109,8 +123,12 @@ static struct user_agent
  */
 static pj_status_t mod_ua_load(pjsip_endpoint *endpt)
 {
+    unsigned i, table_size;
     pj_status_t status;
 
+    PJ_ASSERT_RETURN((PJSIP_UA_DLG_TABLE_STRIPES &
+		      (PJSIP_UA_DLG_TABLE_STRIPES-1)) == 0, PJ_EBUG);
+
     /* Initialize the user agent. */
     mod_ua.endpt = endpt;
     mod_ua.pool = pjsip_endpt_create_pool( endpt, "ua%p", PJSIP_POOL_LEN_UA,
@@ -118,15 +136,33 @@ static pj_status_t mod_ua_load(pjsip_endpoint *endpt)
     if (mod_ua.pool == NULL)
 	return PJ_ENOMEM;
 
-    status = pj_mutex_create_recursive(mod_ua.pool, " ua%p", &mod_ua.mutex);
-    if (status != PJ_SUCCESS)
-	return status;
+    /* Create the dialog table stripes */
+    table_size = mod_ua.param.max_dlg_cnt ? mod_ua.param.max_dlg_cnt :
+					    PJSIP_MAX_DIALOG_COUNT;
+    table_size /= PJSIP_UA_DLG_TABLE_STRIPES;
+    if (table_size < 16)
+	table_size = 16;
 
-    mod_ua.dlg_table = pj_hash_create(mod_ua.pool, PJSIP_MAX_DIALOG_COUNT);
-    if (mod_ua.dlg_table == NULL)
-	return PJ_ENOMEM;
+    for (i=0; i<PJSIP_UA_DLG_TABLE_STRIPES; ++i) {
+	struct dlg_table_stripe *stripe = &mod_ua.stripes[i];
+
+	stripe->pool = pjsip_endpt_create_pool(endpt, "uadlg%p",
+					       PJSIP_POOL_LEN_UA,
+					       PJSIP_POOL_INC_UA);
+	if (stripe->pool == NULL)
+	    return PJ_ENOMEM;
+
+	status = pj_mutex_create_recursive(stripe->pool, " uadlg%p",
+					   &stripe->mutex);
+	if (status != PJ_SUCCESS)
+	    return status;
 
-    pj_list_init(&mod_ua.free_dlgset_nodes);
+	stripe->dlg_table = pj_hash_create(stripe->pool, table_size);
+	if (stripe->dlg_table == NULL)
+	    return PJ_ENOMEM;
+
+	pj_list_init(&stripe->free_dlgset_nodes);
+    }
 
     /* Initialize dialog lock. */
     status = pj_thread_local_alloc(&pjsip_dlg_lock_tls_id);
@@ -146,8 +182,22 @@ static pj_status_t mod_ua_load(pjsip_endpoint *endpt)
  */
 static pj_status_t mod_ua_unload(void)
 {
+    unsigned i;
+
     pj_thread_local_free(pjsip_dlg_lock_tls_id);
-    pj_mutex_destroy(mod_ua.mutex);
+
+    for (i=0; i<PJSIP_UA_DLG_TABLE_STRIPES; ++i) {
+	struct dlg_table_stripe *stripe = &mod_ua.stripes[i];
+
+	if (stripe->mutex) {
+	    pj_mutex_destroy(stripe->mutex);
+	    stripe->mutex = NULL;
+	}
+	if (stripe->pool) {
+	    pjsip_endpt_release_pool(mod_ua.endpt, stripe->pool);
+	    stripe->pool = NULL;
+	}
+    }
 
     /* Release pool */
     if (mod_ua.pool) {
@@ -256,21 +306,73 @@ PJ_DEF(void) pjsip_ua_create_dlg_set_key( pj_pool_t *pool,
 }
 */
 
+/*
+ * Calculate the hash value of dialog set key, which is the Call-ID
+ * (case-sensitive) and the local tag (case-insensitive). The value is
+ * never zero, since zero hash value would tell the hash table to
+ * calculate the hash by itself.
+ */
+static pj_uint32_t calc_dlg_set_hval(const pj_str_t *call_id,
+				     const pj_str_t *local_tag)
+{
+    pj_uint32_t hval;
+
+    hval = pj_hash_calc(0, call_id->ptr, (unsigned)call_id->slen);
+    hval = pj_hash_calc_tolower(hval, NULL, local_tag);
+    return hval ? hval : 1;
+}
+
+/*
+ * Get the dialog table stripe for the hash value. The low bits of the
+ * hash value select the bucket inside the stripe's hash table, so use
+ * the higher bits to select the stripe.
+ */
+PJ_INLINE(struct dlg_table_stripe*) get_stripe(pj_uint32_t hval)
+{
+    return &mod_ua.stripes[(hval >> 16) & (PJSIP_UA_DLG_TABLE_STRIPES-1)];
+}
+
+/*
+ * Lookup dialog set in the stripe. Stripe's mutex must be held.
+ */
+static struct dlg_set *find_dlg_set(struct dlg_table_stripe *stripe,
+				    const pj_str_t *call_id,
+				    const pj_str_t *local_tag,
+				    pj_uint32_t hval)
+{
+    struct dlg_set *dlg_set;
+
+    dlg_set = (struct dlg_set*)
+	      pj_hash_get_lower(stripe->dlg_table, local_tag->ptr,
+				(unsigned)local_tag->slen, &hval);
+
+    /* Only the local tag is stored as the hash key, so verify the
+     * Call-ID to rule out hash value collision.
+     */
+    if (dlg_set && pj_strcmp(&dlg_set->dlg_list.next->call_id->id,
+			     call_id) != 0)
+    {
+	return NULL;
+    }
+
+    return dlg_set;
+}
+
 /*
  * Acquire one dlg_set node to be put in the hash table.
- * This will first look in the free nodes list, then allocate
- * a new one from UA's pool when one is not available.
+ * This will first look in the stripe's free nodes list, then allocate
+ * a new one from the stripe's pool when one is not available.
  */
-static struct dlg_set *alloc_dlgset_node(void)
+static struct dlg_set *alloc_dlgset_node(struct dlg_table_stripe *stripe)
 {
     struct dlg_set *set;
 
-    if (!pj_list_empty(&mod_ua.free_dlgset_nodes)) {
-	set = mod_ua.free_dlgset_nodes.next;
+    if (!pj_list_empty(&stripe->free_dlgset_nodes)) {
+	set = stripe->free_dlgset_nodes.next;
 	pj_list_erase(set);
 	return set;
     } else {
-	set = PJ_POOL_ALLOC_T(mod_ua.pool, struct dlg_set);
+	set = PJ_POOL_ALLOC_T(stripe->pool, struct dlg_set);
 	return set;
     }
 }
@@ -282,6 +384,9 @@ static struct dlg_set *alloc_dlgset_node(void)
 PJ_DEF(pj_status_t) pjsip_ua_register_dlg( pjsip_user_agent *ua,
 					   pjsip_dialog *dlg )
 {
+    struct dlg_table_stripe *stripe;
+    pj_uint32_t hval;
+
     /* Sanity check. */
     PJ_ASSERT_RETURN(ua && dlg, PJ_EINVAL);
 
@@ -294,18 +399,18 @@ PJ_DEF(pj_status_t) pjsip_ua_register_dlg( pjsip_user_agent *ua,
     //		     (dlg->role==PJSIP_ROLE_UAS && dlg->remote.info->tag.slen
     //		      && dlg->remote.tag_hval != 0), PJ_EBUG);
 
-    /* Lock the user agent. */
-    pj_mutex_lock(mod_ua.mutex);
+    hval = calc_dlg_set_hval(&dlg->call_id->id, &dlg->local.info->tag);
+    stripe = get_stripe(hval);
+
+    /* Lock the stripe. */
+    pj_mutex_lock(stripe->mutex);
 
     /* For UAC, check if there is existing dialog in the same set. */
     if (dlg->role == PJSIP_ROLE_UAC) {
 	struct dlg_set *dlg_set;
 
-	dlg_set = (struct dlg_set*)
-		  pj_hash_get_lower( mod_ua.dlg_table,
-                                     dlg->local.info->tag.ptr, 
-			             (unsigned)dlg->local.info->tag.slen,
-			             &dlg->local.tag_hval);
+	dlg_set = find_dlg_set(stripe, &dlg->call_id->id,
+			       &dlg->local.info->tag, hval);
 
 	if (dlg_set) {
 	    /* This is NOT the first dialog in the dialog set. 
@@ -320,38 +425,37 @@ PJ_DEF(pj_status_t) pjsip_ua_register_dlg( pjsip_user_agent *ua,
 	    /* This is the first dialog in the dialog set. 
 	     * Create the dialog set and add this dialog to it.
 	     */
-	    dlg_set = alloc_dlgset_node();
+	    dlg_set = alloc_dlgset_node(stripe);
 	    pj_list_init(&dlg_set->dlg_list);
 	    pj_list_push_back(&dlg_set->dlg_list, dlg);
 
 	    dlg->dlg_set = dlg_set;
 
 	    /* Register the dialog set in the hash table. */
-	    pj_hash_set_np_lower(mod_ua.dlg_table, 
+	    pj_hash_set_np_lower(stripe->dlg_table, 
 			         dlg->local.info->tag.ptr,
                                  (unsigned)dlg->local.info->tag.slen,
-			         dlg->local.tag_hval, dlg_set->ht_entry,
-                                 dlg_set);
+			         hval, dlg_set->ht_entry, dlg_set);
 	}
 
     } else {
 	/* For UAS, create the dialog set with a single dialog as member. */
 	struct dlg_set *dlg_set;
 
-	dlg_set = alloc_dlgset_node();
+	dlg_set = alloc_dlgset_node(stripe);
 	pj_list_init(&dlg_set->dlg_list);
 	pj_list_push_back(&dlg_set->dlg_list, dlg);
 
 	dlg->dlg_set = dlg_set;
 
-	pj_hash_set_np_lower(mod_ua.dlg_table, 
+	pj_hash_set_np_lower(stripe->dlg_table, 
 		             dlg->local.info->tag.ptr,
                              (unsigned)dlg->local.info->tag.slen,
-		             dlg->local.tag_hval, dlg_set->ht_entry, dlg_set);
+		             hval, dlg_set->ht_entry, dlg_set);
     }
 
-    /* Unlock user agent. */
-    pj_mutex_unlock(mod_ua.mutex);
+    /* Unlock the stripe. */
+    pj_mutex_unlock(stripe->mutex);
 
     /* Done. */
     return PJ_SUCCESS;
@@ -361,8 +465,10 @@ PJ_DEF(pj_status_t) pjsip_ua_register_dlg( pjsip_user_agent *ua,
 PJ_DEF(pj_status_t) pjsip_ua_unregister_dlg( pjsip_user_agent *ua,
 					     pjsip_dialog *dlg )
 {
+    struct dlg_table_stripe *stripe;
     struct dlg_set *dlg_set;
     pjsip_dialog *d;
+    pj_uint32_t hval;
 
     /* Sanity-check arguments. */
     PJ_ASSERT_RETURN(ua && dlg, PJ_EINVAL);
@@ -370,8 +476,11 @@ PJ_DEF(pj_status_t) pjsip_ua_unregister_dlg( pjsip_user_agent *ua,
     /* Check that dialog has been registered. */
     PJ_ASSERT_RETURN(dlg->dlg_set, PJ_EINVALIDOP);
 
-    /* Lock user agent. */
-    pj_mutex_lock(mod_ua.mutex);
+    hval = calc_dlg_set_hval(&dlg->call_id->id, &dlg->local.info->tag);
+    stripe = get_stripe(hval);
+
+    /* Lock the stripe. */
+    pj_mutex_lock(stripe->mutex);
 
     /* Find this dialog from the dialog set. */
     dlg_set = (struct dlg_set*) dlg->dlg_set;
@@ -382,7 +491,7 @@ PJ_DEF(pj_status_t) pjsip_ua_unregister_dlg( pjsip_user_agent *ua,
 
     if (d != dlg) {
 	pj_assert(!"Dialog is not registered!");
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(stripe->mutex);
 	return PJ_EINVALIDOP;
     }
 
@@ -391,16 +500,15 @@ PJ_DEF(pj_status_t) pjsip_ua_unregister_dlg( pjsip_user_agent *ua,
 
     /* If dialog list is empty, remove the dialog set from the hash table. */
     if (pj_list_empty(&dlg_set->dlg_list)) {
-	pj_hash_set_lower(NULL, mod_ua.dlg_table, dlg->local.info->tag.ptr,
-		          (unsigned)dlg->local.info->tag.slen, 
-			  dlg->local.tag_hval, NULL);
+	pj_hash_set_lower(NULL, stripe->dlg_table, dlg->local.info->tag.ptr,
+		          (unsigned)dlg->local.info->tag.slen, hval, NULL);
 
 	/* Return dlg_set to free nodes. */
-	pj_list_push_back(&mod_ua.free_dlgset_nodes, dlg_set);
+	pj_list_push_back(&stripe->free_dlgset_nodes, dlg_set);
     }
 
-    /* Unlock user agent. */
-    pj_mutex_unlock(mod_ua.mutex);
+    /* Unlock the stripe. */
+    pj_mutex_unlock(stripe->mutex);
 
     /* Done. */
     return PJ_SUCCESS;
@@ -424,13 +532,17 @@ PJ_DEF(pjsip_dialog*) pjsip_tsx_get_dlg( pjsip_transaction *tsx )
  */
 PJ_DEF(unsigned) pjsip_ua_get_dlg_set_count(void)
 {
-    unsigned count;
+    unsigned i, count = 0;
 
     PJ_ASSERT_RETURN(mod_ua.endpt, 0);
 
-    pj_mutex_lock(mod_ua.mutex);
-    count = pj_hash_count(mod_ua.dlg_table);
-    pj_mutex_unlock(mod_ua.mutex);
+    for (i=0; i<PJSIP_UA_DLG_TABLE_STRIPES; ++i) {
+	struct dlg_table_stripe *stripe = &mod_ua.stripes[i];
+
+	pj_mutex_lock(stripe->mutex);
+	count += pj_hash_count(stripe->dlg_table);
+	pj_mutex_unlock(stripe->mutex);
+    }
 
     return count;
 }
@@ -444,21 +556,24 @@ PJ_DEF(pjsip_dialog*) pjsip_ua_find_dialog(const pj_str_t *call_id,
 					   const pj_str_t *remote_tag,
 					   pj_bool_t lock_dialog)
 {
+    struct dlg_table_stripe *stripe;
     struct dlg_set *dlg_set;
     pjsip_dialog *dlg;
+    pj_uint32_t hval;
 
     PJ_ASSERT_RETURN(call_id && local_tag && remote_tag, NULL);
 
-    /* Lock user agent. */
-    pj_mutex_lock(mod_ua.mutex);
+    hval = calc_dlg_set_hval(call_id, local_tag);
+    stripe = get_stripe(hval);
+
+    /* Lock the stripe. */
+    pj_mutex_lock(stripe->mutex);
 
     /* Lookup the dialog set. */
-    dlg_set = (struct dlg_set*)
-    	      pj_hash_get_lower(mod_ua.dlg_table, local_tag->ptr,
-                                (unsigned)local_tag->slen, NULL);
+    dlg_set = find_dlg_set(stripe, call_id, local_tag, hval);
     if (dlg_set == NULL) {
 	/* Not found */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(stripe->mutex);
 	return NULL;
     }
 
@@ -474,38 +589,34 @@ PJ_DEF(pjsip_dialog*) pjsip_ua_find_dialog(const pj_str_t *call_id,
 
     if (dlg == (pjsip_dialog*)&dlg_set->dlg_list) {
 	/* Not found */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(stripe->mutex);
 	return NULL;
     }
 
-    /* Dialog has been found. It SHOULD have the right Call-ID!! */
-    PJ_ASSERT_ON_FAIL(pj_strcmp(&dlg->call_id->id, call_id)==0, 
-			{pj_mutex_unlock(mod_ua.mutex); return NULL;});
-
     if (lock_dialog) {
 	if (pjsip_dlg_try_inc_lock(dlg) != PJ_SUCCESS) {
 
 	    /*
-	     * Unable to acquire dialog's lock while holding the user
-	     * agent's mutex. Release the UA mutex before retrying once
+	     * Unable to acquire dialog's lock while holding the stripe's
+	     * mutex. Release the stripe mutex before retrying once
 	     * more.
 	     *
 	     * THIS MAY CAUSE RACE CONDITION!
 	     */
 
-	    /* Unlock user agent. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    /* Unlock the stripe. */
+	    pj_mutex_unlock(stripe->mutex);
 	    /* Lock dialog */
 	    pjsip_dlg_inc_lock(dlg);
 
 	} else {
-	    /* Unlock user agent. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    /* Unlock the stripe. */
+	    pj_mutex_unlock(stripe->mutex);
 	}
 
     } else {
-	/* Unlock user agent. */
-	pj_mutex_unlock(mod_ua.mutex);
+	/* Unlock the stripe. */
+	pj_mutex_unlock(stripe->mutex);
     }
 
     return dlg;
@@ -513,9 +624,11 @@ PJ_DEF(pjsip_dialog*) pjsip_ua_find_dialog(const pj_str_t *call_id,
 
 
 /*
- * Find the first dialog in dialog set in hash table for an incoming message.
+ * Get the local tag of the dialog set for an incoming message. Together
+ * with the Call-ID of the message, this is the key to find the dialog
+ * set in the hash table.
  */
-static struct dlg_set *find_dlg_set_for_msg( pjsip_rx_data *rdata )
+static pj_bool_t get_dlg_set_key( pjsip_rx_data *rdata, pj_str_t *local_tag )
 {
     /* CANCEL message doesn't have To tag, so we must lookup the dialog
      * by finding the INVITE UAS transaction being cancelled.
@@ -524,10 +637,9 @@ static struct dlg_set *find_dlg_set_for_msg( pjsip_rx_data *rdata )
 
 	pjsip_dialog *dlg;
 
-	/* Create key for the rdata, but this time, use INVITE as the
-	 * method.
+	/* Match the rdata against transaction, but this time, use INVITE
+	 * as the method.
 	 */
-	pj_str_t key;
 	pjsip_role_e role;
 	pjsip_transaction *tsx;
 
@@ -536,49 +648,50 @@ static struct dlg_set *find_dlg_set_for_msg( pjsip_rx_data *rdata )
 	else
 	    role = PJSIP_ROLE_UAC;
 
-	pjsip_tsx_create_key(rdata->tp_info.pool, &key, role, 
-			     pjsip_get_invite_method(), rdata);
-
 	/* Lookup the INVITE transaction */
-	tsx = pjsip_tsx_layer_find_tsx(&key, PJ_TRUE);
+	tsx = pjsip_tsx_layer_find_rx_tsx(rdata, role,
+					  pjsip_get_invite_method(), PJ_TRUE);
 
 	/* We should find the dialog attached to the INVITE transaction */
 	if (tsx) {
 	    dlg = (pjsip_dialog*) tsx->mod_data[mod_ua.mod.id];
-	    pj_grp_lock_release(tsx->grp_lock);
 
 	    /* Dlg may be NULL on some extreme condition
-	     * (e.g. during debugging where initially there is a dialog)
+	     * (e.g. during debugging where initially there is a dialog).
+	     * The dialog can't be destroyed while the transaction is
+	     * locked, so copy the tag before releasing the lock.
 	     */
-	    return dlg ? (struct dlg_set*) dlg->dlg_set : NULL;
+	    if (dlg) {
+		pj_strdup(rdata->tp_info.pool, local_tag,
+			  &dlg->local.info->tag);
+	    }
+	    pj_grp_lock_release(tsx->grp_lock);
+
+	    return dlg != NULL;
 
 	} else {
-	    return NULL;
+	    return PJ_FALSE;
 	}
 
 
     } else {
-	pj_str_t *tag;
-	struct dlg_set *dlg_set;
-
 	if (rdata->msg_info.msg->type == PJSIP_REQUEST_MSG)
-	    tag = &rdata->msg_info.to->tag;
+	    *local_tag = rdata->msg_info.to->tag;
 	else
-	    tag = &rdata->msg_info.from->tag;
+	    *local_tag = rdata->msg_info.from->tag;
 
-	/* Lookup the dialog set. */
-	dlg_set = (struct dlg_set*)
-		  pj_hash_get_lower(mod_ua.dlg_table, tag->ptr, 
-				    (unsigned)tag->slen, NULL);
-	return dlg_set;
+	return PJ_TRUE;
     }
 }
 
 /* On received requests. */
 static pj_bool_t mod_ua_on_rx_request(pjsip_rx_data *rdata)
 {
+    struct dlg_table_stripe *stripe = NULL;
     struct dlg_set *dlg_set;
+    pj_str_t local_tag;
     pj_str_t *from_tag;
+    pj_uint32_t hval = 0;
     pjsip_dialog *dlg;
     pj_status_t status;
 
@@ -595,20 +708,32 @@ static pj_bool_t mod_ua_on_rx_request(pjsip_rx_data *rdata)
     if (rdata->msg_info.msg->line.req.method.id == PJSIP_REGISTER_METHOD)
 	return PJ_FALSE;
 
-retry_on_deadlock:
+    /* Get the dialog set key, based on the Call-ID and To tag header,
+     * and select the dialog table stripe.
+     */
+    if (get_dlg_set_key(rdata, &local_tag)) {
+	hval = calc_dlg_set_hval(&rdata->msg_info.cid->id, &local_tag);
+	stripe = get_stripe(hval);
+    }
 
-    /* Lock user agent before looking up the dialog hash table. */
-    pj_mutex_lock(mod_ua.mutex);
+retry_on_deadlock:
 
-    /* Lookup the dialog set, based on the To tag header. */
-    dlg_set = find_dlg_set_for_msg(rdata);
+    /* Lock the stripe before looking up the dialog hash table. */
+    if (stripe) {
+	pj_mutex_lock(stripe->mutex);
+	dlg_set = find_dlg_set(stripe, &rdata->msg_info.cid->id, &local_tag,
+			       hval);
+    } else {
+	dlg_set = NULL;
+    }
 
     /* If dialog is not found, respond with 481 (Call/Transaction
      * Does Not Exist).
      */
     if (dlg_set == NULL) {
 	/* Unable to find dialog. */
-	pj_mutex_unlock(mod_ua.mutex);
+	if (stripe)
+	    pj_mutex_unlock(stripe->mutex);
 
 	if (rdata->msg_info.msg->line.req.method.id != PJSIP_ACK_METHOD) {
 	    PJ_LOG(5,(THIS_FILE, 
@@ -649,7 +774,7 @@ retry_on_deadlock:
 
 	if (first_dlg->remote.info->tag.slen != 0) {
 	    /* Not found. Mulfunction UAC? */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    pj_mutex_unlock(stripe->mutex);
 
 	    if (rdata->msg_info.msg->line.req.method.id != PJSIP_ACK_METHOD) {
 		PJ_LOG(5,(THIS_FILE, 
@@ -678,16 +803,16 @@ retry_on_deadlock:
     status = pjsip_dlg_try_inc_lock(dlg);
     if (status != PJ_SUCCESS) {
 	/* Failed to acquire dialog mutex immediately, this could be 
-	 * because of deadlock. Release UA mutex, yield, and retry 
+	 * because of deadlock. Release stripe mutex, yield, and retry 
 	 * the whole thing once again.
 	 */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(stripe->mutex);
 	pj_thread_sleep(0);
 	goto retry_on_deadlock;
     }
 
     /* Done with processing in UA layer, release lock */
-    pj_mutex_unlock(mod_ua.mutex);
+    pj_mutex_unlock(stripe->mutex);
 
     /* Pass to dialog. */
     pjsip_dlg_on_rx_request(dlg, rdata);
@@ -704,9 +829,11 @@ retry_on_deadlock:
  */
 static pj_bool_t mod_ua_on_rx_response(pjsip_rx_data *rdata)
 {
+    struct dlg_table_stripe *stripe;
     pjsip_transaction *tsx;
     struct dlg_set *dlg_set;
     pjsip_dialog *dlg;
+    pj_uint32_t hval;
     pj_status_t status;
 
     /*
@@ -723,17 +850,35 @@ retry_on_deadlock:
 
     dlg = NULL;
 
-    /* Lock user agent dlg table before we're doing anything. */
-    pj_mutex_lock(mod_ua.mutex);
-
     /* Check if transaction is present. */
     tsx = pjsip_rdata_get_tsx(rdata);
     if (tsx) {
 	/* Check if dialog is present in the transaction. */
 	dlg = pjsip_tsx_get_dlg(tsx);
-	if (!dlg) {
-	    /* Unlock dialog hash table. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	if (!dlg)
+	    return PJ_FALSE;
+
+	/* Lock the stripe where the dialog set is registered. The hash is
+	 * calculated from the response, which carries the dialog's Call-ID
+	 * and local tag, since the dialog may only be accessed under the
+	 * stripe's mutex.
+	 */
+	hval = calc_dlg_set_hval(&rdata->msg_info.cid->id,
+				 &rdata->msg_info.from->tag);
+	stripe = get_stripe(hval);
+	pj_mutex_lock(stripe->mutex);
+
+	/* The response must belong to the dialog (and so to this stripe) */
+	if (pj_strcmp(&rdata->msg_info.cid->id, &dlg->call_id->id) != 0 ||
+	    pj_stricmp(&rdata->msg_info.from->tag,
+		       &dlg->local.info->tag) != 0)
+	{
+	    pj_mutex_unlock(stripe->mutex);
+	    PJ_LOG(4,(THIS_FILE, 
+		      "Ignored %s from %s:%d, Call-ID or From tag does not "
+		      "match the dialog",
+		      pjsip_rx_data_get_info(rdata),
+		      rdata->pkt_info.src_name, rdata->pkt_info.src_port));
 	    return PJ_FALSE;
 	}
 
@@ -759,22 +904,22 @@ retry_on_deadlock:
 	     * This must be some stateless response sent by other modules,
 	     * or a very late response.
 	     */
-	    /* Unlock dialog hash table. */
-	    pj_mutex_unlock(mod_ua.mutex);
 	    return PJ_FALSE;
 	}
 
 
 	/* Get the dialog set. */
-	dlg_set = (struct dlg_set*)
-		  pj_hash_get_lower(mod_ua.dlg_table, 
-			            rdata->msg_info.from->tag.ptr,
-			            (unsigned)rdata->msg_info.from->tag.slen,
-			            NULL);
+	hval = calc_dlg_set_hval(&rdata->msg_info.cid->id,
+				 &rdata->msg_info.from->tag);
+	stripe = get_stripe(hval);
+	pj_mutex_lock(stripe->mutex);
+
+	dlg_set = find_dlg_set(stripe, &rdata->msg_info.cid->id,
+			       &rdata->msg_info.from->tag, hval);
 
 	if (!dlg_set) {
 	    /* Unlock dialog hash table. */
-	    pj_mutex_unlock(mod_ua.mutex);
+	    pj_mutex_unlock(stripe->mutex);
 
 	    /* Strayed 2xx response!! */
 	    PJ_LOG(4,(THIS_FILE, 
@@ -844,7 +989,7 @@ retry_on_deadlock:
 		dlg = (*mod_ua.param.on_dlg_forked)(dlg_set->dlg_list.next, 
 						    rdata);
 		if (dlg == NULL) {
-		    pj_mutex_unlock(mod_ua.mutex);
+		    pj_mutex_unlock(stripe->mutex);
 		    return PJ_TRUE;
 		}
 	    } else {
@@ -888,15 +1033,15 @@ retry_on_deadlock:
     if (status != PJ_SUCCESS) {
 	/* Failed to acquire dialog mutex. This could indicate a deadlock
 	 * situation, and for safety, try to avoid deadlock by releasing
-	 * UA mutex, yield, and retry the whole processing once again.
+	 * stripe mutex, yield, and retry the whole processing once again.
 	 */
-	pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(stripe->mutex);
 	pj_thread_sleep(0);
 	goto retry_on_deadlock;
     }
 
     /* We're done with processing in the UA layer, we can release the mutex */
-    pj_mutex_unlock(mod_ua.mutex);
+    pj_mutex_unlock(stripe->mutex);
 
     /* Pass the response to the dialog. */
     pjsip_dlg_on_rx_response(dlg, rdata);
@@ -942,21 +1087,29 @@ PJ_DEF(void) pjsip_ua_dump(pj_bool_t detail)
 #if PJ_LOG_MAX_LEVEL >= 3
     pj_hash_iterator_t itbuf, *it;
     char dlginfo[128];
+    unsigned i, count;
+
+    count = pjsip_ua_get_dlg_set_count();
 
-    pj_mutex_lock(mod_ua.mutex);
+    PJ_LOG(3, (THIS_FILE, "Number of dialog sets: %u", count));
 
-    PJ_LOG(3, (THIS_FILE, "Number of dialog sets: %u", 
-			  pj_hash_count(mod_ua.dlg_table)));
+    if (!detail || count == 0)
+	return;
 
-    if (detail && pj_hash_count(mod_ua.dlg_table)) {
-	PJ_LOG(3, (THIS_FILE, "Dumping dialog sets:"));
-	it = pj_hash_first(mod_ua.dlg_table, &itbuf);
-	for (; it != NULL; it = pj_hash_next(mod_ua.dlg_table, it))  {
+    PJ_LOG(3, (THIS_FILE, "Dumping dialog sets:"));
+
+    for (i=0; i<PJSIP_UA_DLG_TABLE_STRIPES; ++i) {
+	struct dlg_table_stripe *stripe = &mod_ua.stripes[i];
+
+	pj_mutex_lock(stripe->mutex);
+
+	it = pj_hash_first(stripe->dlg_table, &itbuf);
+	for (; it != NULL; it = pj_hash_next(stripe->dlg_table, it))  {
 	    struct dlg_set *dlg_set;
 	    pjsip_dialog *dlg;
 	    const char *title;
 
-	    dlg_set = (struct dlg_set*) pj_hash_this(mod_ua.dlg_table, it);
+	    dlg_set = (struct dlg_set*) pj_hash_this(stripe->dlg_table, it);
 	    if (!dlg_set || pj_list_empty(&dlg_set->dlg_list)) continue;
 
 	    /* First dialog in dialog set. */
@@ -976,9 +1129,11 @@ PJ_DEF(void) pjsip_ua_dump(pj_bool_t detail)
 		dlg = dlg->next;
 	    }
 	}
-    }
 
-    pj_mutex_unlock(mod_ua.mutex);
+	pj_mutex_unlock(stripe->mutex);
+    }
+#else
+    PJ_UNUSED_ARG(detail);
 #endif
 }
 
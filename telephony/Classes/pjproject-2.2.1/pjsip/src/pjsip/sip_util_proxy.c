@@ -21,7 +21,9 @@
 #include <pjsip/sip_endpoint.h>
 #include <pjsip/sip_errno.h>
 #include <pjsip/sip_msg.h>
+#include <pjsip/sip_transport.h>
 #include <pj/assert.h>
+#include <pj/compat/stdarg.h>
 #include <pj/ctype.h>
 #include <pj/except.h>
 #include <pj/guid.h>
@@ -324,6 +326,495 @@ on_error:
 }
 
 
+/*
+ * Raw forwarding.
+ *
+ * The received packet is copied to the transmit buffer in one pass, with
+ * a small list of edits (replace range of the received message with new
+ * text) applied on the way. Insertions are edits with empty range.
+ */
+
+/* Maximum number of edits applied to a forwarded message */
+#define MAX_RAW_EDITS	    8
+
+/* Buffer size for a header line created by the proxy */
+#define RAW_LINE_LEN	    (PJSIP_MAX_URL_SIZE + 32)
+
+struct raw_edit
+{
+    int		 start;
+    int		 end;
+    pj_str_t	 text;
+};
+
+struct raw_fwd
+{
+    const char	    *buf;
+    int		     len;
+    unsigned	     cnt;
+    struct raw_edit  edit[MAX_RAW_EDITS];
+    pj_ssize_t	     text_len;
+};
+
+static void raw_init(struct raw_fwd *f, const pjsip_rx_data *rdata)
+{
+    f->buf = rdata->msg_info.msg_buf;
+    f->len = rdata->msg_info.len;
+    f->cnt = 0;
+    f->text_len = 0;
+}
+
+/* Add edit, keeping the list sorted by position. Edits at the same
+ * position are applied in the order they are added.
+ */
+static void raw_add_edit(struct raw_fwd *f, int start, int end,
+			 const pj_str_t *text)
+{
+    unsigned i;
+
+    pj_assert(f->cnt < MAX_RAW_EDITS && start <= end);
+
+    for (i=f->cnt; i>0 && f->edit[i-1].start > start; --i)
+	f->edit[i] = f->edit[i-1];
+
+    f->edit[i].start = start;
+    f->edit[i].end = end;
+    if (text) {
+	f->edit[i].text = *text;
+	f->text_len += text->slen;
+    } else {
+	f->edit[i].text.ptr = NULL;
+	f->edit[i].text.slen = 0;
+    }
+    ++f->cnt;
+}
+
+/* Print formatted text to the pool and add it as edit */
+static pj_status_t raw_add_printf(struct raw_fwd *f, pj_pool_t *pool,
+				  int start, int end,
+				  const char *fmt, ...)
+{
+    va_list arg;
+    pj_str_t text;
+    int len;
+
+    text.ptr = (char*) pj_pool_alloc(pool, RAW_LINE_LEN);
+
+    va_start(arg, fmt);
+    len = pj_ansi_vsnprintf(text.ptr, RAW_LINE_LEN, fmt, arg);
+    va_end(arg);
+
+    if (len < 0 || len >= RAW_LINE_LEN)
+	return PJSIP_EMSGTOOLONG;
+
+    text.slen = len;
+    raw_add_edit(f, start, end, &text);
+    return PJ_SUCCESS;
+}
+
+/* Get the start of the first value of the header line at pos */
+static int raw_value_start(const struct raw_fwd *f,
+			   const pjsip_rx_hdr_pos *pos)
+{
+    int i = pos->start;
+
+    while (i < pos->end && f->buf[i] != ':')
+	++i;
+    if (i < pos->end)
+	++i;
+    while (i < pos->end && (f->buf[i]==' ' || f->buf[i]=='\t'))
+	++i;
+    return i;
+}
+
+/* Find the end of the value starting at i: the position of the comma
+ * separating it from the next value, the first character in stop, or
+ * the end of the line (without trailing whitespace).
+ */
+static int raw_value_end(const struct raw_fwd *f, int i, int line_end,
+			 const char *stop)
+{
+    int start = i, angle = 0;
+    pj_bool_t quoted = PJ_FALSE;
+
+    for (; i < line_end; ++i) {
+	char c = f->buf[i];
+
+	if (quoted) {
+	    if (c == '\\' && i+1 < line_end)
+		++i;
+	    else if (c == '"')
+		quoted = PJ_FALSE;
+	} else if (c == '"') {
+	    quoted = PJ_TRUE;
+	} else if (c == '<') {
+	    ++angle;
+	} else if (c == '>') {
+	    if (angle) --angle;
+	} else if (angle == 0 && (c == ',' || (stop && pj_ansi_strchr(stop, c))))
+	{
+	    return i;
+	}
+    }
+
+    while (i > start && pj_isspace(f->buf[i-1]))
+	--i;
+    return i;
+}
+
+/* Add edit to remove the first value of the header line at pos, or the
+ * whole line when it only contains one value.
+ */
+static void raw_remove_first_value(struct raw_fwd *f,
+				   const pjsip_rx_hdr_pos *pos)
+{
+    int vstart, vend;
+
+    vstart = raw_value_start(f, pos);
+    vend = raw_value_end(f, vstart, pos->end, NULL);
+
+    if (vend < pos->end && f->buf[vend] == ',') {
+	/* Skip the comma and whitespace (including line folding) */
+	for (++vend; vend < pos->end && pj_isspace(f->buf[vend]); ++vend)
+	    ;
+	raw_add_edit(f, vstart, vend, NULL);
+    } else {
+	raw_add_edit(f, pos->start, pos->end, NULL);
+    }
+}
+
+/* Find parameter pname in value [i, vend), returning the range from the
+ * semicolon until the end of the parameter.
+ */
+static pj_bool_t raw_find_param(const struct raw_fwd *f, int i, int vend,
+				const pj_str_t *pname,
+				int *pstart, int *pend, pj_bool_t *has_value)
+{
+    while (i < vend) {
+	int name_start, name_end, end;
+
+	i = raw_value_end(f, i, vend, ";");
+	if (i >= vend || f->buf[i] != ';')
+	    break;
+
+	*pstart = i++;
+	while (i < vend && pj_isspace(f->buf[i]))
+	    ++i;
+	name_start = i;
+	while (i < vend && f->buf[i] != '=' && f->buf[i] != ';' &&
+	       !pj_isspace(f->buf[i]))
+	{
+	    ++i;
+	}
+	name_end = i;
+	end = raw_value_end(f, i, vend, ";");
+
+	if (name_end - name_start == pname->slen &&
+	    pj_ansi_strnicmp(f->buf + name_start, pname->ptr,
+			     pname->slen) == 0)
+	{
+	    *pend = end;
+	    *has_value = (pj_memchr(f->buf + name_end, '=',
+				    end - name_end) != NULL);
+	    return PJ_TRUE;
+	}
+	i = end;
+    }
+
+    return PJ_FALSE;
+}
+
+/* Copy the message with the edits to tdata's buffer and send it with
+ * the (already acquired) transport.
+ */
+static pj_status_t raw_send(pjsip_endpoint *endpt, struct raw_fwd *f,
+			    pjsip_tx_data *tdata, pjsip_transport *tr,
+			    const pj_sockaddr_t *addr, int addr_len,
+			    void *token, pjsip_tp_send_callback cb)
+{
+    pjsip_tpselector sel;
+    pj_size_t size;
+    char *p;
+    int cur = 0;
+    unsigned i;
+
+    size = f->len + f->text_len;
+    tdata->buf.start = (char*) pj_pool_alloc(tdata->pool, size + 1);
+    tdata->buf.end = tdata->buf.start + size + 1;
+
+    p = tdata->buf.start;
+    for (i=0; i<f->cnt; ++i) {
+	const struct raw_edit *e = &f->edit[i];
+
+	pj_assert(e->start >= cur);
+	pj_memcpy(p, f->buf + cur, e->start - cur);
+	p += e->start - cur;
+	if (e->text.slen) {
+	    pj_memcpy(p, e->text.ptr, e->text.slen);
+	    p += e->text.slen;
+	}
+	cur = e->end;
+    }
+    pj_memcpy(p, f->buf + cur, f->len - cur);
+    p += f->len - cur;
+    tdata->buf.cur = p;
+
+    /* Sending with the acquired transport can't fail to acquire, so
+     * tdata is always released by pjsip_tpmgr_send_raw().
+     */
+    pj_bzero(&sel, sizeof(sel));
+    sel.type = PJSIP_TPSELECTOR_TRANSPORT;
+    sel.u.transport = tr;
+
+    return pjsip_tpmgr_send_raw(pjsip_endpt_get_tpmgr(endpt),
+				(pjsip_transport_type_e)tr->key.type, &sel,
+				tdata, tdata->buf.start, p - tdata->buf.start,
+				addr, addr_len, token, cb);
+}
+
+/* Create tdata to hold the forwarded message */
+static pj_status_t raw_create_tdata(pjsip_endpoint *endpt,
+				    pjsip_tx_data **p_tdata)
+{
+    pj_status_t status;
+
+    status = pjsip_endpt_create_tdata(endpt, p_tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    (*p_tdata)->info = "raw fwd";
+    pjsip_tx_data_add_ref(*p_tdata);
+    return PJ_SUCCESS;
+}
+
+
+PJ_DEF(void) pjsip_fwd_raw_param_default(pjsip_fwd_raw_param *param)
+{
+    pj_bzero(param, sizeof(*param));
+    param->tp_type = PJSIP_TRANSPORT_UNSPECIFIED;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_endpt_fwd_raw_request(pjsip_endpoint *endpt,
+						pjsip_rx_data *rdata,
+						const pjsip_fwd_raw_param *param,
+						void *token,
+						pjsip_tp_send_callback cb)
+{
+    const pj_str_t STR_RECEIVED = { "received", 8 };
+    const pj_str_t STR_RPORT = { "rport", 5 };
+    const pjsip_rx_raw_pos *rp = &rdata->msg_info.raw_pos;
+    const pjsip_msg *msg = rdata->msg_info.msg;
+    pjsip_tx_data *tdata;
+    pjsip_transport *tr;
+    struct raw_fwd f;
+    pj_str_t branch;
+    const pj_str_t *host;
+    int vstart, vend, pstart, pend;
+    pj_bool_t has_value, ipv6;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(endpt && rdata && param && param->dst_addr_len,
+		     PJ_EINVAL);
+    PJ_ASSERT_RETURN(msg && msg->type == PJSIP_REQUEST_MSG,
+		     PJSIP_ENOTREQUESTMSG);
+
+    if (rp->hdr_start == 0 || rp->via.end == 0 || !rdata->msg_info.via)
+	return PJSIP_EMISSINGHDR;
+
+    if (rdata->msg_info.max_fwd && rdata->msg_info.max_fwd->ivalue <= 0)
+	return PJSIP_EINVALIDHDR;
+
+    status = pjsip_tpmgr_acquire_transport(pjsip_endpt_get_tpmgr(endpt),
+					   param->tp_type, &param->dst_addr,
+					   param->dst_addr_len, param->sel,
+					   &tr);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = raw_create_tdata(endpt, &tdata);
+    if (status != PJ_SUCCESS) {
+	pjsip_transport_dec_ref(tr);
+	return status;
+    }
+
+    raw_init(&f, rdata);
+
+    /* New Request-URI */
+    if (param->uri.slen) {
+	const pj_str_t *method = &msg->line.req.method.name;
+	status = raw_add_printf(&f, tdata->pool, 0, rp->hdr_start,
+				"%.*s %.*s SIP/2.0\r\n",
+				(int)method->slen, method->ptr,
+				(int)param->uri.slen, param->uri.ptr);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    /* Our Via, as the first header */
+    branch = param->branch;
+    if (branch.slen == 0)
+	branch = pjsip_calculate_branch_id(rdata);
+
+    host = &tr->local_name.host;
+    ipv6 = (pj_memchr(host->ptr, ':', host->slen) != NULL);
+    status = raw_add_printf(&f, tdata->pool, rp->hdr_start, rp->hdr_start,
+			    "Via: SIP/2.0/%s %s%.*s%s:%d%s%s;branch=%.*s\r\n",
+			    tr->type_name,
+			    (ipv6 ? "[" : ""),
+			    (int)host->slen, host->ptr,
+			    (ipv6 ? "]" : ""),
+			    tr->local_name.port,
+			    (pjsip_cfg()->endpt.disable_rport ? "" : ";rport"),
+			    ((pjsip_cfg()->endpt.req_has_via_alias &&
+			      (tr->flag & PJSIP_TRANSPORT_DATAGRAM) == 0) ?
+				";alias" : ""),
+			    (int)branch.slen, branch.ptr);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    /* Record-Route, on top of existing Record-Route headers */
+    if (param->record_route.slen) {
+	int pos = rp->record_route.end ? rp->record_route.start :
+					 rp->hdr_start;
+	status = raw_add_printf(&f, tdata->pool, pos, pos,
+				"Record-Route: %.*s\r\n",
+				(int)param->record_route.slen,
+				param->record_route.ptr);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    /* Decrement Max-Forwards, or add one (RFC 3261 section 16.6) */
+    if (rp->max_fwd.end && rdata->msg_info.max_fwd) {
+	status = raw_add_printf(&f, tdata->pool, rp->max_fwd.start,
+				rp->max_fwd.end, "Max-Forwards: %d\r\n",
+				rdata->msg_info.max_fwd->ivalue - 1);
+    } else {
+	status = raw_add_printf(&f, tdata->pool, rp->hdr_start,
+				rp->hdr_start, "Max-Forwards: 70\r\n");
+    }
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    /* Remove the top-most Route value */
+    if (param->strip_route && rp->route.end)
+	raw_remove_first_value(&f, &rp->route);
+
+    /* Update received and rport of the previous hop's Via, as the
+     * transport layer did to the parsed Via.
+     */
+    vstart = raw_value_start(&f, &rp->via);
+    vend = raw_value_end(&f, vstart, rp->via.end, NULL);
+
+    if (rdata->msg_info.via->rport_param > 0 &&
+	raw_find_param(&f, vstart, vend, &STR_RPORT, &pstart, &pend,
+		       &has_value) &&
+	!has_value)
+    {
+	status = raw_add_printf(&f, tdata->pool, pstart, pend, ";rport=%d",
+				rdata->msg_info.via->rport_param);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+    }
+
+    if (raw_find_param(&f, vstart, vend, &STR_RECEIVED, &pstart, &pend,
+		       &has_value))
+    {
+	status = raw_add_printf(&f, tdata->pool, pstart, pend,
+				";received=%s", rdata->pkt_info.src_name);
+    } else {
+	status = raw_add_printf(&f, tdata->pool, vend, vend,
+				";received=%s", rdata->pkt_info.src_name);
+    }
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
+    status = raw_send(endpt, &f, tdata, tr, &param->dst_addr,
+		      param->dst_addr_len, token, cb);
+    pjsip_transport_dec_ref(tr);
+    return status;
+
+on_error:
+    pjsip_tx_data_dec_ref(tdata);
+    pjsip_transport_dec_ref(tr);
+    return status;
+}
+
+
+PJ_DEF(pj_status_t) pjsip_endpt_fwd_raw_response(pjsip_endpoint *endpt,
+						 pjsip_rx_data *rdata,
+						 void *token,
+						 pjsip_tp_send_callback cb)
+{
+    const pjsip_msg *msg = rdata->msg_info.msg;
+    const pjsip_via_hdr *via;
+    pjsip_transport_type_e type;
+    pjsip_tx_data *tdata;
+    pjsip_transport *tr;
+    struct raw_fwd f;
+    pj_sockaddr addr;
+    pj_str_t host;
+    int port, af;
+    pj_status_t status;
+
+    PJ_ASSERT_RETURN(endpt && rdata, PJ_EINVAL);
+    PJ_ASSERT_RETURN(msg && msg->type == PJSIP_RESPONSE_MSG,
+		     PJSIP_ENOTRESPONSEMSG);
+
+    if (rdata->msg_info.raw_pos.via.end == 0 || !rdata->msg_info.via)
+	return PJSIP_EMISSINGHDR;
+
+    /* The response is sent to the next Via */
+    via = (const pjsip_via_hdr*)
+	  pjsip_msg_find_hdr(msg, PJSIP_H_VIA, rdata->msg_info.via->next);
+    if (!via)
+	return PJSIP_EMISSINGHDR;
+
+    type = pjsip_transport_get_type_from_name(&via->transport);
+    if (type == PJSIP_TRANSPORT_UNSPECIFIED)
+	return PJSIP_EUNSUPTRANSPORT;
+
+    host = via->recvd_param.slen ? via->recvd_param : via->sent_by.host;
+    port = via->rport_param > 0 ? via->rport_param : via->sent_by.port;
+    if (port == 0)
+	port = pjsip_transport_get_default_port_for_type(type);
+
+    if (pj_memchr(host.ptr, ':', host.slen)) {
+	af = pj_AF_INET6();
+	type = (pjsip_transport_type_e)(type | PJSIP_TRANSPORT_IPV6);
+    } else {
+	af = pj_AF_INET();
+    }
+
+    status = pj_sockaddr_init(af, &addr, &host, (pj_uint16_t)port);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = pjsip_tpmgr_acquire_transport(pjsip_endpt_get_tpmgr(endpt),
+					   type, &addr,
+					   pj_sockaddr_get_len(&addr),
+					   NULL, &tr);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    status = raw_create_tdata(endpt, &tdata);
+    if (status != PJ_SUCCESS) {
+	pjsip_transport_dec_ref(tr);
+	return status;
+    }
+
+    /* Remove our Via */
+    raw_init(&f, rdata);
+    raw_remove_first_value(&f, &rdata->msg_info.raw_pos.via);
+
+    status = raw_send(endpt, &f, tdata, tr, &addr,
+		      pj_sockaddr_get_len(&addr), token, cb);
+    pjsip_transport_dec_ref(tr);
+    return status;
+}
+
+
 static void digest2str(const unsigned char digest[], char *output)
 {
     int i;
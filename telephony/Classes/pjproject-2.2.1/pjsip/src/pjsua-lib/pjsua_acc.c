@@ -49,7 +49,7 @@ PJ_DEF(unsigned) pjsua_acc_get_count(void)
  */
 PJ_DEF(pj_bool_t) pjsua_acc_is_valid(pjsua_acc_id acc_id)
 {
-    return acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc) &&
+    return acc_id>=0 && acc_id<(int)pjsua_var.acc_max &&
 	   pjsua_var.acc[acc_id].valid;
 }
 
@@ -73,6 +73,175 @@ PJ_DEF(pjsua_acc_id) pjsua_acc_get_default(void)
 }
 
 
+/*
+ * Init account subsystem.
+ */
+pj_status_t pjsua_acc_subsys_init(const pjsua_config *cfg)
+{
+    unsigned i, max_acc;
+
+    max_acc = cfg->max_acc ? cfg->max_acc : PJSUA_MAX_ACC;
+
+    pjsua_var.acc = (pjsua_acc*)
+		    pj_pool_calloc(pjsua_var.pool, max_acc, sizeof(pjsua_acc));
+    pjsua_var.acc_ids = (pjsua_acc_id*)
+			pj_pool_calloc(pjsua_var.pool, max_acc,
+				       sizeof(pjsua_acc_id));
+    if (!pjsua_var.acc || !pjsua_var.acc_ids)
+	return PJ_ENOMEM;
+
+    for (i=0; i<max_acc; ++i) {
+	pj_status_t status;
+
+	pjsua_var.acc[i].index = i;
+	status = pj_mutex_create_simple(pjsua_var.pool, "acc%p",
+					&pjsua_var.acc[i].lock);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    for (i=0; i<PJSUA_ACC_IDX_CNT; ++i) {
+	pjsua_var.acc_idx[i] = pj_hash_create(pjsua_var.pool, max_acc);
+	if (!pjsua_var.acc_idx[i])
+	    return PJ_ENOMEM;
+    }
+
+    pjsua_var.acc_max = max_acc;
+
+    return PJ_SUCCESS;
+}
+
+
+/* Get the key of an account index. The key is allocated from the pool,
+ * unless it's just the user or the domain.
+ */
+static void acc_index_key(pj_pool_t *pool, pjsua_acc_idx_type type,
+			  const pj_str_t *user, const pj_str_t *host,
+			  int port, pj_str_t *key)
+{
+    pj_size_t len;
+
+    switch (type) {
+    case PJSUA_ACC_IDX_USER_DOMAIN:
+	/* The host can't have '@', so the key is unambiguous */
+	key->ptr = (char*) pj_pool_alloc(pool, user->slen + host->slen + 1);
+	key->slen = 0;
+	pj_strcat(key, user);
+	key->ptr[key->slen++] = '@';
+	pj_strcat(key, host);
+	break;
+    case PJSUA_ACC_IDX_DOMAIN:
+	*key = *host;
+	break;
+    case PJSUA_ACC_IDX_DOMAIN_PORT:
+	len = host->slen + 12;
+	key->ptr = (char*) pj_pool_alloc(pool, len);
+	key->slen = pj_ansi_snprintf(key->ptr, len, "%.*s:%d",
+				     (int)host->slen, host->ptr, port);
+	break;
+    default:
+	*key = *user;
+	break;
+    }
+}
+
+/* Whether account a is before account b in acc_ids */
+static pj_bool_t acc_index_precedes(const pjsua_acc *a, const pjsua_acc *b)
+{
+    if (a->cfg.priority != b->cfg.priority)
+	return a->cfg.priority > b->cfg.priority;
+    return a->idx_seq < b->idx_seq;
+}
+
+/* Find the first account with the key */
+static pjsua_acc *acc_index_get(pjsua_acc_idx_type type, const pj_str_t *key)
+{
+    return (pjsua_acc*) pj_hash_get_lower(pjsua_var.acc_idx[type], key->ptr,
+					  (unsigned)key->slen, NULL);
+}
+
+/* Make the account the first one with its key */
+static void acc_index_set_first(pjsua_acc_idx_type type, pjsua_acc *acc,
+				pjsua_acc *prev_first)
+{
+    pj_hash_table_t *ht = pjsua_var.acc_idx[type];
+
+    /* The entry refers to the key of its account, so replace it */
+    if (prev_first) {
+	pj_hash_set_np_lower(ht, prev_first->idx_key[type].ptr,
+			     (unsigned)prev_first->idx_key[type].slen, 0,
+			     NULL, NULL);
+    }
+    if (acc) {
+	pj_hash_set_np_lower(ht, acc->idx_key[type].ptr,
+			     (unsigned)acc->idx_key[type].slen, 0,
+			     acc->idx_entry[type], acc);
+    }
+}
+
+/* Add the account to the indexes, after it has been put to acc_ids. */
+static void acc_index_add(pjsua_acc *acc)
+{
+    unsigned type;
+
+    for (type=0; type<PJSUA_ACC_IDX_CNT; ++type) {
+	pjsua_acc *first, *prev;
+	pj_str_t *key = &acc->idx_key[type];
+
+	acc_index_key(acc->pool, (pjsua_acc_idx_type)type, &acc->user_part,
+		      &acc->srv_domain, acc->srv_port, key);
+	if (key->ptr == NULL)
+	    key->ptr = (char*)"";
+
+	first = acc_index_get((pjsua_acc_idx_type)type, key);
+	if (first == NULL || acc_index_precedes(acc, first)) {
+	    acc->idx_next[type] = first;
+	    acc_index_set_first((pjsua_acc_idx_type)type, acc, first);
+	    continue;
+	}
+
+	prev = first;
+	while (prev->idx_next[type] &&
+	       !acc_index_precedes(acc, prev->idx_next[type]))
+	{
+	    prev = prev->idx_next[type];
+	}
+	acc->idx_next[type] = prev->idx_next[type];
+	prev->idx_next[type] = acc;
+    }
+}
+
+/* Remove the account from the indexes. */
+static void acc_index_del(pjsua_acc *acc)
+{
+    unsigned type;
+
+    for (type=0; type<PJSUA_ACC_IDX_CNT; ++type) {
+	pjsua_acc *first;
+
+	if (acc->idx_key[type].ptr == NULL)
+	    continue;
+
+	first = acc_index_get((pjsua_acc_idx_type)type, &acc->idx_key[type]);
+	if (first == acc) {
+	    acc_index_set_first((pjsua_acc_idx_type)type, acc->idx_next[type],
+				acc);
+	} else if (first) {
+	    pjsua_acc *prev = first;
+
+	    while (prev->idx_next[type] && prev->idx_next[type] != acc)
+		prev = prev->idx_next[type];
+	    if (prev->idx_next[type] == acc)
+		prev->idx_next[type] = acc->idx_next[type];
+	}
+
+	acc->idx_next[type] = NULL;
+	acc->idx_key[type].ptr = NULL;
+	acc->idx_key[type].slen = 0;
+    }
+}
+
+
 /*
  * Copy account configuration.
  */
@@ -94,6 +263,7 @@ PJ_DEF(void) pjsua_acc_config_dup( pj_pool_t *pool,
     pj_strdup_with_null(pool, &dst->rfc5626_instance_id,
                         &src->rfc5626_instance_id);
     pj_strdup_with_null(pool, &dst->rfc5626_reg_id, &src->rfc5626_reg_id);
+    pj_strdup_with_null(pool, &dst->blf_list_uri, &src->blf_list_uri);
 
     dst->proxy_cnt = src->proxy_cnt;
     for (i=0; i<src->proxy_cnt; ++i)
@@ -366,7 +536,9 @@ static pj_status_t initialize_acc(unsigned acc_id)
     }
 
     /* Mark account as valid */
+    pj_mutex_lock(acc->lock);
     pjsua_var.acc[acc_id].valid = PJ_TRUE;
+    pj_mutex_unlock(acc->lock);
 
     /* Insert account ID into account ID array, sorted by priority */
     for (i=0; i<pjsua_var.acc_cnt; ++i) {
@@ -378,6 +550,10 @@ static pj_status_t initialize_acc(unsigned acc_id)
     }
     pj_array_insert(pjsua_var.acc_ids, sizeof(pjsua_var.acc_ids[0]),
 		    pjsua_var.acc_cnt, i, &acc_id);
+    acc->idx_seq = ++pjsua_var.acc_idx_seq;
+
+    /* Add to the indexes used to match requests to accounts */
+    acc_index_add(acc);
 
     return PJ_SUCCESS;
 }
@@ -395,7 +571,7 @@ PJ_DEF(pj_status_t) pjsua_acc_add( const pjsua_acc_config *cfg,
     pj_status_t status = PJ_SUCCESS;
 
     PJ_ASSERT_RETURN(cfg, PJ_EINVAL);
-    PJ_ASSERT_RETURN(pjsua_var.acc_cnt < PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(pjsua_var.acc_cnt < pjsua_var.acc_max,
 		     PJ_ETOOMANY);
 
     /* Must have a transport */
@@ -408,13 +584,13 @@ PJ_DEF(pj_status_t) pjsua_acc_add( const pjsua_acc_config *cfg,
     PJSUA_LOCK();
 
     /* Find empty account id. */
-    for (id=0; id < PJ_ARRAY_SIZE(pjsua_var.acc); ++id) {
+    for (id=0; id < pjsua_var.acc_max; ++id) {
 	if (pjsua_var.acc[id].valid == PJ_FALSE)
 	    break;
     }
 
     /* Expect to find a slot */
-    PJ_ASSERT_ON_FAIL(	id < PJ_ARRAY_SIZE(pjsua_var.acc), 
+    PJ_ASSERT_ON_FAIL(	id < pjsua_var.acc_max, 
 			{PJSUA_UNLOCK(); return PJ_EBUG;});
 
     acc = &pjsua_var.acc[id];
@@ -425,6 +601,10 @@ PJ_DEF(pj_status_t) pjsua_acc_add( const pjsua_acc_config *cfg,
     else
 	acc->pool = pjsua_pool_create("acc%p", 512, 256);
 
+    /* The line state tables were allocated from the pool */
+    pj_bzero(acc->sla_line_state, sizeof(acc->sla_line_state));
+    pj_bzero(acc->blf_line_state, sizeof(acc->blf_line_state));
+
     /* Copy config */
     pjsua_acc_config_dup(acc->pool, &pjsua_var.acc[id].cfg, cfg);
     
@@ -474,6 +654,9 @@ PJ_DEF(pj_status_t) pjsua_acc_add( const pjsua_acc_config *cfg,
 
     pjsua_var.acc_cnt++;
 
+    /* Bind the media transports of the RTP pool */
+    pjsua_rtp_pool_init(id);
+
     PJSUA_UNLOCK();
 
     PJ_LOG(4,(THIS_FILE, "Account %.*s added with id %d",
@@ -562,7 +745,7 @@ PJ_DEF(pj_status_t) pjsua_acc_add_local( pjsua_transport_id tid,
 PJ_DEF(pj_status_t) pjsua_acc_set_user_data(pjsua_acc_id acc_id,
 					    void *user_data)
 {
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max,
 		     PJ_EINVAL);
     PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, PJ_EINVALIDOP);
 
@@ -581,7 +764,7 @@ PJ_DEF(pj_status_t) pjsua_acc_set_user_data(pjsua_acc_id acc_id,
  */
 PJ_DEF(void*) pjsua_acc_get_user_data(pjsua_acc_id acc_id)
 {
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max,
 		     NULL);
     PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, NULL);
 
@@ -597,7 +780,7 @@ PJ_DEF(pj_status_t) pjsua_acc_del(pjsua_acc_id acc_id)
     pjsua_acc *acc;
     unsigned i;
 
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max,
 		     PJ_EINVAL);
     PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, PJ_EINVALIDOP);
 
@@ -642,6 +825,17 @@ PJ_DEF(pj_status_t) pjsua_acc_del(pjsua_acc_id acc_id)
     /* Delete server presence subscription */
     pjsua_pres_delete_acc(acc_id, 0);
 
+    /* Remove from the indexes, the keys are in the account pool */
+    acc_index_del(acc);
+
+    /* Close the idle media transports */
+    pjsua_rtp_pool_flush(acc_id);
+
+    /* Invalidate before releasing the pool, see pjsua_acc_get_info() */
+    pj_mutex_lock(acc->lock);
+    acc->valid = PJ_FALSE;
+    pj_mutex_unlock(acc->lock);
+
     /* Release account pool */
     if (acc->pool) {
 	pj_pool_release(acc->pool);
@@ -649,12 +843,13 @@ PJ_DEF(pj_status_t) pjsua_acc_del(pjsua_acc_id acc_id)
     }
 
     /* Invalidate */
-    acc->valid = PJ_FALSE;
     acc->contact.slen = 0;
     acc->reg_mapped_addr.slen = 0;
     pj_bzero(&acc->via_addr, sizeof(acc->via_addr));
     acc->via_tp = NULL;
     acc->next_rtp_port = 0;
+    pj_bzero(acc->sla_line_state, sizeof(acc->sla_line_state));
+    pj_bzero(acc->blf_line_state, sizeof(acc->blf_line_state));
 
     /* Remove from array */
     for (i=0; i<pjsua_var.acc_cnt; ++i) {
@@ -689,7 +884,7 @@ PJ_DEF(pj_status_t) pjsua_acc_get_config(pjsua_acc_id acc_id,
                                          pj_pool_t *pool,
                                          pjsua_acc_config *acc_cfg)
 {
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc)
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max
                      && pjsua_var.acc[acc_id].valid, PJ_EINVAL);
     //this now would not work due to corrupt header list
     //pj_memcpy(acc_cfg, &pjsua_var.acc[acc_id].cfg, sizeof(*acc_cfg));
@@ -777,9 +972,12 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
     pj_bool_t update_reg = PJ_FALSE;
     pj_bool_t unreg_first = PJ_FALSE;
     pj_bool_t update_mwi = PJ_FALSE;
+    pj_bool_t update_rtp_pool = PJ_FALSE;
+    pjsua_ice_config old_ice_cfg;
+    pjsua_turn_config old_turn_cfg;
     pj_status_t status = PJ_SUCCESS;
 
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max,
 		     PJ_EINVAL);
 
     PJ_LOG(4,(THIS_FILE, "Modifying accunt %d", acc_id));
@@ -905,9 +1103,14 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
 
     /* == Apply the new config == */
 
+    /* The index keys and order may change, re-add the account later */
+    acc_index_del(acc);
+
     /* Account ID. */
     if (id_name_addr && id_sip_uri) {
+	pj_mutex_lock(acc->lock);
 	pj_strdup_with_null(acc->pool, &acc->cfg.id, &cfg->id);
+	pj_mutex_unlock(acc->lock);
 	pj_strdup_with_null(acc->pool, &acc->display, &id_name_addr->display);
 	pj_strdup_with_null(acc->pool, &acc->user_part, &id_sip_uri->user);
 	pj_strdup_with_null(acc->pool, &acc->srv_domain, &id_sip_uri->host);
@@ -943,6 +1146,7 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
 	}
 	pj_array_insert(pjsua_var.acc_ids, sizeof(acc_id),
 			pjsua_var.acc_cnt, i, &acc_id);
+	acc->idx_seq = ++pjsua_var.acc_idx_seq;
     }
 
     /* MWI */
@@ -955,6 +1159,16 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
 	update_mwi = PJ_TRUE;
     }
 
+    /* Subscription refresh pacing */
+    if (acc->cfg.sub_refresh_rate != cfg->sub_refresh_rate ||
+	acc->cfg.sub_refresh_burst != cfg->sub_refresh_burst)
+    {
+	acc->cfg.sub_refresh_rate = cfg->sub_refresh_rate;
+	acc->cfg.sub_refresh_burst = cfg->sub_refresh_burst;
+	pjsua_acc_update_sub_refresh(acc_id);
+    }
+    acc->cfg.sub_refresh_jitter = cfg->sub_refresh_jitter;
+
     /* PIDF tuple ID */
     if (pj_strcmp(&acc->cfg.pidf_tuple_id, &cfg->pidf_tuple_id))
 	pj_strdup_with_null(acc->pool, &acc->cfg.pidf_tuple_id,
@@ -1246,19 +1460,26 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
     /* Registrar URI */
     if (pj_strcmp(&acc->cfg.reg_uri, &cfg->reg_uri)) {
 	if (cfg->reg_uri.slen) {
+	    pj_mutex_lock(acc->lock);
 	    pj_strdup_with_null(acc->pool, &acc->cfg.reg_uri, &cfg->reg_uri);
+	    pj_mutex_unlock(acc->lock);
 	    if (reg_sip_uri)
 		acc->srv_port = reg_sip_uri->port;
 	} else {
 	    /* Unregister if registration was set */
 	    if (acc->cfg.reg_uri.slen)
 		pjsua_acc_set_registration(acc->index, PJ_FALSE);
+	    pj_mutex_lock(acc->lock);
 	    pj_bzero(&acc->cfg.reg_uri, sizeof(acc->cfg.reg_uri));
+	    pj_mutex_unlock(acc->lock);
 	}
 	update_reg = PJ_TRUE;
 	unreg_first = PJ_TRUE;
     }
 
+    /* The account ID and registrar port have been applied */
+    acc_index_add(acc);
+
     /* SIP outbound setting */
     if (acc->cfg.use_rfc5626 != cfg->use_rfc5626 ||
 	pj_strcmp(&acc->cfg.rfc5626_instance_id, &cfg->rfc5626_instance_id) ||
@@ -1276,11 +1497,24 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
     acc->cfg.vid_stream_rc_cfg = cfg->vid_stream_rc_cfg;
 
     /* Media settings */
+    if (acc->cfg.rtp_pool_size != cfg->rtp_pool_size ||
+	acc->cfg.ice_prewarm_cnt != cfg->ice_prewarm_cnt ||
+	acc->cfg.rtp_cfg.port != cfg->rtp_cfg.port ||
+	acc->cfg.rtp_cfg.port_range != cfg->rtp_cfg.port_range ||
+	acc->cfg.rtp_cfg.qos_type != cfg->rtp_cfg.qos_type ||
+	acc->cfg.sip_stun_use != cfg->sip_stun_use)
+    {
+	update_rtp_pool = PJ_TRUE;
+    }
+    acc->cfg.rtp_pool_size = cfg->rtp_pool_size;
+    acc->cfg.ice_prewarm_cnt = cfg->ice_prewarm_cnt;
+
     if (pj_stricmp(&acc->cfg.rtp_cfg.public_addr, &cfg->rtp_cfg.public_addr) ||
 	pj_stricmp(&acc->cfg.rtp_cfg.bound_addr, &cfg->rtp_cfg.bound_addr))
     {
 	pjsua_transport_config_dup(acc->pool, &acc->cfg.rtp_cfg,
 				   &cfg->rtp_cfg);
+	update_rtp_pool = PJ_TRUE;
     } else {
 	/* ..to save memory by not using the pool */
 	acc->cfg.rtp_cfg =  cfg->rtp_cfg;
@@ -1296,6 +1530,7 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
     acc->cfg.media_stun_use = cfg->media_stun_use;
 
     /* ICE settings */
+    old_ice_cfg = acc->cfg.ice_cfg;
     acc->cfg.ice_cfg_use = cfg->ice_cfg_use;
     switch (acc->cfg.ice_cfg_use) {
     case PJSUA_ICE_CONFIG_USE_DEFAULT:
@@ -1310,7 +1545,11 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
 	break;
     }
 
+    if (acc->cfg.ice_cfg.enable_ice != old_ice_cfg.enable_ice)
+	update_rtp_pool = PJ_TRUE;
+
     /* TURN settings */
+    old_turn_cfg = acc->cfg.turn_cfg;
     acc->cfg.turn_cfg_use = cfg->turn_cfg_use;
     switch (acc->cfg.turn_cfg_use) {
     case PJSUA_TURN_CONFIG_USE_DEFAULT:
@@ -1326,11 +1565,29 @@ PJ_DEF(pj_status_t) pjsua_acc_modify( pjsua_acc_id acc_id,
 	break;
     }
 
+    /* Prewarmed ICE transports are gathered again with the new settings */
+    if (acc->cfg.ice_prewarm_cnt && acc->cfg.ice_cfg.enable_ice &&
+	(acc->cfg.ice_cfg.ice_max_host_cands!=old_ice_cfg.ice_max_host_cands ||
+	 acc->cfg.ice_cfg.ice_no_rtcp != old_ice_cfg.ice_no_rtcp ||
+	 pj_memcmp(&acc->cfg.ice_cfg.ice_opt, &old_ice_cfg.ice_opt,
+		   sizeof(old_ice_cfg.ice_opt)) ||
+	 acc->cfg.turn_cfg.enable_turn != old_turn_cfg.enable_turn ||
+	 acc->cfg.turn_cfg.turn_conn_type != old_turn_cfg.turn_conn_type ||
+	 pj_strcmp(&acc->cfg.turn_cfg.turn_server,
+		   &old_turn_cfg.turn_server)))
+    {
+	update_rtp_pool = PJ_TRUE;
+    }
+
     acc->cfg.use_srtp = cfg->use_srtp;
 
     /* Call hold type */
     acc->cfg.call_hold_type = cfg->call_hold_type;
 
+    /* Rebind the RTP pool with the new media settings */
+    if (update_rtp_pool)
+	pjsua_rtp_pool_init(acc_id);
+
     /* Unregister first */
     if (unreg_first) {
 	pjsua_acc_set_registration(acc->index, PJ_FALSE);
@@ -1368,7 +1625,7 @@ on_return:
 PJ_DEF(pj_status_t) pjsua_acc_set_online_status( pjsua_acc_id acc_id,
 						 pj_bool_t is_online)
 {
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max,
 		     PJ_EINVAL);
     PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, PJ_EINVALIDOP);
 
@@ -1376,8 +1633,10 @@ PJ_DEF(pj_status_t) pjsua_acc_set_online_status( pjsua_acc_id acc_id,
 	      acc_id, is_online));
     pj_log_push_indent();
 
+    pj_mutex_lock(pjsua_var.acc[acc_id].lock);
     pjsua_var.acc[acc_id].online_status = is_online;
     pj_bzero(&pjsua_var.acc[acc_id].rpid, sizeof(pjrpid_element));
+    pj_mutex_unlock(pjsua_var.acc[acc_id].lock);
     pjsua_pres_update_acc(acc_id, PJ_FALSE);
 
     pj_log_pop_indent();
@@ -1392,7 +1651,7 @@ PJ_DEF(pj_status_t) pjsua_acc_set_online_status2( pjsua_acc_id acc_id,
 						  pj_bool_t is_online,
 						  const pjrpid_element *pr)
 {
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max,
 		     PJ_EINVAL);
     PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, PJ_EINVALIDOP);
 
@@ -1400,10 +1659,10 @@ PJ_DEF(pj_status_t) pjsua_acc_set_online_status2( pjsua_acc_id acc_id,
     	      acc_id, is_online));
     pj_log_push_indent();
 
-    PJSUA_LOCK();
+    pj_mutex_lock(pjsua_var.acc[acc_id].lock);
     pjsua_var.acc[acc_id].online_status = is_online;
     pjrpid_element_dup(pjsua_var.acc[acc_id].pool, &pjsua_var.acc[acc_id].rpid, pr);
-    PJSUA_UNLOCK();
+    pj_mutex_unlock(pjsua_var.acc[acc_id].lock);
 
     pjsua_pres_update_acc(acc_id, PJ_TRUE);
     pj_log_pop_indent();
@@ -2110,6 +2369,7 @@ static void regc_cb(struct pjsip_regc_cbparam *param)
 {
 
     pjsua_acc *acc = (pjsua_acc*) param->token;
+    pj_time_val reg_next;
 
     PJSUA_LOCK();
 
@@ -2205,8 +2465,25 @@ static void regc_cb(struct pjsip_regc_cbparam *param)
 	PJ_LOG(4, (THIS_FILE, "SIP registration updated status=%d", param->code));
     }
 
+    /* Remember when the registration will be refreshed, so that
+     * pjsua_acc_get_info() doesn't need to lock the regc.
+     */
+    reg_next.sec = reg_next.msec = 0;
+    if (acc->regc) {
+	pjsip_regc_info regc_info;
+
+	pjsip_regc_get_info(acc->regc, &regc_info);
+	if (regc_info.next_reg > 0) {
+	    pj_gettimeofday(&reg_next);
+	    reg_next.sec += regc_info.next_reg;
+	}
+    }
+
+    pj_mutex_lock(acc->lock);
     acc->reg_last_err = param->status;
     acc->reg_last_code = param->code;
+    acc->reg_next = reg_next;
+    pj_mutex_unlock(acc->lock);
 
     /* Check if we need to auto retry registration. Basically, registration
      * failure codes triggering auto-retry are those of temporal failures
@@ -2434,7 +2711,7 @@ PJ_DEF(pj_status_t) pjsua_acc_set_registration( pjsua_acc_id acc_id,
     pj_status_t status = 0;
     pjsip_tx_data *tdata = 0;
 
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max,
 		     PJ_EINVAL);
     PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, PJ_EINVALIDOP);
 
@@ -2523,6 +2800,11 @@ PJ_DEF(pj_status_t) pjsua_acc_set_registration( pjsua_acc_id acc_id,
 	                           &tdata->via_tp);
         }
 
+	/* The refresh time is not known until the request completes */
+	pj_mutex_lock(acc->lock);
+	acc->reg_next.sec = acc->reg_next.msec = 0;
+	pj_mutex_unlock(acc->lock);
+
 	//pjsua_process_msg_data(tdata, NULL);
 	status = pjsip_regc_send( pjsua_var.acc[acc_id].regc, tdata );
     }
@@ -2568,14 +2850,17 @@ PJ_DEF(pj_status_t) pjsua_acc_get_info( pjsua_acc_id acc_id,
     
     pj_bzero(info, sizeof(pjsua_acc_info));
 
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc), 
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max, 
 		     PJ_EINVAL);
     PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, PJ_EINVALIDOP);
 
-    PJSUA_LOCK();
+    /* The account lock is enough, see the locking notes in
+     * pjsua_internal.h.
+     */
+    pj_mutex_lock(acc->lock);
     
     if (pjsua_var.acc[acc_id].valid == PJ_FALSE) {
-	PJSUA_UNLOCK();
+	pj_mutex_unlock(acc->lock);
 	return PJ_EINVALIDOP;
     }
 
@@ -2611,20 +2896,50 @@ PJ_DEF(pj_status_t) pjsua_acc_get_info( pjsua_acc_id acc_id,
     }
     
     if (acc->regc) {
-	pjsip_regc_info regc_info;
-	pjsip_regc_get_info(acc->regc, &regc_info);
-	info->expires = regc_info.next_reg;
+	if (acc->reg_next.sec) {
+	    pj_time_val now;
+
+	    pj_gettimeofday(&now);
+	    info->expires = acc->reg_next.sec - now.sec;
+	} else {
+	    info->expires = 0;
+	}
     } else {
 	info->expires = -1;
     }
 
-    PJSUA_UNLOCK();
+    pj_mutex_unlock(acc->lock);
 
     return PJ_SUCCESS;
 
 }
 
 
+/*
+ * Get the state of the RTP pool of the account.
+ */
+PJ_DEF(pj_status_t) pjsua_acc_get_rtp_pool_stat(pjsua_acc_id acc_id,
+						pjsua_rtp_pool_stat *stat)
+{
+    pjsua_acc *acc;
+
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max && stat,
+		     PJ_EINVAL);
+    PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, PJ_EINVALIDOP);
+
+    acc = &pjsua_var.acc[acc_id];
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+    pj_memcpy(stat, &acc->rtp_pool.stat, sizeof(*stat));
+    stat->size = acc->rtp_pool.id ? acc->rtp_pool.size : 0;
+    stat->idle = acc->rtp_pool.idle_cnt + acc->rtp_pool.ice_ready_cnt;
+    stat->gathering = acc->rtp_pool.ice_gathering_cnt;
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    return PJ_SUCCESS;
+}
+
+
 /*
  * Enum accounts all account ids.
  */
@@ -2637,7 +2952,7 @@ PJ_DEF(pj_status_t) pjsua_enum_accs(pjsua_acc_id ids[],
 
     PJSUA_LOCK();
 
-    for (i=0, c=0; c<*count && i<PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+    for (i=0, c=0; c<*count && i<pjsua_var.acc_max; ++i) {
 	if (!pjsua_var.acc[i].valid)
 	    continue;
 	ids[c] = i;
@@ -2664,7 +2979,7 @@ PJ_DEF(pj_status_t) pjsua_acc_enum_info( pjsua_acc_info info[],
 
     PJSUA_LOCK();
 
-    for (i=0, c=0; c<*count && i<PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+    for (i=0, c=0; c<*count && i<pjsua_var.acc_max; ++i) {
 	if (!pjsua_var.acc[i].valid)
 	    continue;
 
@@ -2690,6 +3005,7 @@ PJ_DEF(pjsua_acc_id) pjsua_acc_find_for_outgoing(const pj_str_t *url)
     pjsip_uri *uri;
     pjsip_sip_uri *sip_uri;
     pj_pool_t *tmp_pool;
+    pjsua_acc *acc;
     unsigned i;
 
     PJSUA_LOCK();
@@ -2709,14 +3025,14 @@ PJ_DEF(pjsua_acc_id) pjsua_acc_find_for_outgoing(const pj_str_t *url)
 	!PJSIP_URI_SCHEME_IS_SIPS(uri)) 
     {
 	/* Return the first account with proxy */
-	for (i=0; i<PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+	for (i=0; i<pjsua_var.acc_max; ++i) {
 	    if (!pjsua_var.acc[i].valid)
 		continue;
 	    if (!pj_list_empty(&pjsua_var.acc[i].route_set))
 		break;
 	}
 
-	if (i != PJ_ARRAY_SIZE(pjsua_var.acc)) {
+	if (i != pjsua_var.acc_max) {
 	    /* Found rather matching account */
 	    pj_pool_release(tmp_pool);
 	    PJSUA_UNLOCK();
@@ -2732,26 +3048,18 @@ PJ_DEF(pjsua_acc_id) pjsua_acc_find_for_outgoing(const pj_str_t *url)
     sip_uri = (pjsip_sip_uri*) pjsip_uri_get_uri(uri);
 
     /* Find matching domain AND port */
-    for (i=0; i<pjsua_var.acc_cnt; ++i) {
-	unsigned acc_id = pjsua_var.acc_ids[i];
-	if (pj_stricmp(&pjsua_var.acc[acc_id].srv_domain, &sip_uri->host)==0 &&
-	    pjsua_var.acc[acc_id].srv_port == sip_uri->port)
-	{
-	    pj_pool_release(tmp_pool);
-	    PJSUA_UNLOCK();
-	    return acc_id;
-	}
-    }
+    acc_index_key(tmp_pool, PJSUA_ACC_IDX_DOMAIN_PORT, NULL, &sip_uri->host,
+		  sip_uri->port, &tmp);
+    acc = acc_index_get(PJSUA_ACC_IDX_DOMAIN_PORT, &tmp);
 
     /* If no match, try to match the domain part only */
-    for (i=0; i<pjsua_var.acc_cnt; ++i) {
-	unsigned acc_id = pjsua_var.acc_ids[i];
-	if (pj_stricmp(&pjsua_var.acc[acc_id].srv_domain, &sip_uri->host)==0)
-	{
-	    pj_pool_release(tmp_pool);
-	    PJSUA_UNLOCK();
-	    return acc_id;
-	}
+    if (!acc)
+	acc = acc_index_get(PJSUA_ACC_IDX_DOMAIN, &sip_uri->host);
+
+    if (acc) {
+	pj_pool_release(tmp_pool);
+	PJSUA_UNLOCK();
+	return acc->index;
     }
 
 
@@ -2770,8 +3078,10 @@ PJ_DEF(pjsua_acc_id) pjsua_acc_find_for_incoming(pjsip_rx_data *rdata)
 {
     pjsip_uri *uri;
     pjsip_sip_uri *sip_uri;
+    pjsua_acc *acc;
+    pj_str_t key;
+    pjsip_transport_type_e tp_type;
     pjsua_acc_id id = PJSUA_INVALID_ID;
-    unsigned i;
 
     /* Check that there's at least one account configured */
     PJ_ASSERT_RETURN(pjsua_var.acc_cnt!=0, pjsua_var.default_acc);
@@ -2800,52 +3110,40 @@ PJ_DEF(pjsua_acc_id) pjsua_acc_find_for_incoming(pjsip_rx_data *rdata)
     sip_uri = (pjsip_sip_uri*)pjsip_uri_get_uri(uri);
 
     /* Find account which has matching username and domain. */
-    for (i=0; i < pjsua_var.acc_cnt; ++i) {
-	unsigned acc_id = pjsua_var.acc_ids[i];
-	pjsua_acc *acc = &pjsua_var.acc[acc_id];
-
-	if (acc->valid && pj_stricmp(&acc->user_part, &sip_uri->user)==0 &&
-	    pj_stricmp(&acc->srv_domain, &sip_uri->host)==0) 
-	{
-	    /* Match ! */
-	    id = acc_id;
-	    goto on_return;
-	}
+    acc_index_key(rdata->tp_info.pool, PJSUA_ACC_IDX_USER_DOMAIN,
+		  &sip_uri->user, &sip_uri->host, 0, &key);
+    acc = acc_index_get(PJSUA_ACC_IDX_USER_DOMAIN, &key);
+    if (acc) {
+	/* Match ! */
+	id = acc->index;
+	goto on_return;
     }
 
     /* No matching account, try match domain part only. */
-    for (i=0; i < pjsua_var.acc_cnt; ++i) {
-	unsigned acc_id = pjsua_var.acc_ids[i];
-	pjsua_acc *acc = &pjsua_var.acc[acc_id];
-
-	if (acc->valid && pj_stricmp(&acc->srv_domain, &sip_uri->host)==0) {
-	    /* Match ! */
-	    id = acc_id;
-	    goto on_return;
-	}
+    acc = acc_index_get(PJSUA_ACC_IDX_DOMAIN, &sip_uri->host);
+    if (acc) {
+	/* Match ! */
+	id = acc->index;
+	goto on_return;
     }
 
     /* No matching account, try match user part (and transport type) only. */
-    for (i=0; i < pjsua_var.acc_cnt; ++i) {
-	unsigned acc_id = pjsua_var.acc_ids[i];
-	pjsua_acc *acc = &pjsua_var.acc[acc_id];
-
-	if (acc->valid && pj_stricmp(&acc->user_part, &sip_uri->user)==0) {
-
-	    if (acc->cfg.transport_id != PJSUA_INVALID_ID) {
-		pjsip_transport_type_e type;
-		type = pjsip_transport_get_type_from_name(&sip_uri->transport_param);
-		if (type == PJSIP_TRANSPORT_UNSPECIFIED)
-		    type = PJSIP_TRANSPORT_UDP;
-
-		if (pjsua_var.tpdata[acc->cfg.transport_id].type != type)
-		    continue;
-	    }
+    tp_type = pjsip_transport_get_type_from_name(&sip_uri->transport_param);
+    if (tp_type == PJSIP_TRANSPORT_UNSPECIFIED)
+	tp_type = PJSIP_TRANSPORT_UDP;
 
-	    /* Match ! */
-	    id = acc_id;
-	    goto on_return;
+    for (acc = acc_index_get(PJSUA_ACC_IDX_USER, &sip_uri->user); acc;
+	 acc = acc->idx_next[PJSUA_ACC_IDX_USER])
+    {
+	if (acc->cfg.transport_id != PJSUA_INVALID_ID &&
+	    pjsua_var.tpdata[acc->cfg.transport_id].type != tp_type)
+	{
+	    continue;
 	}
+
+	/* Match ! */
+	id = acc->index;
+	goto on_return;
     }
 
 on_return:
@@ -3431,7 +3729,7 @@ void pjsua_acc_on_tp_state_changed(pjsip_transport *tp,
     /* Enumerate accounts using this transport and perform actions
      * based on the transport state.
      */
-    for (i = 0; i < PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+    for (i = 0; i < pjsua_var.acc_max; ++i) {
 	pjsua_acc *acc = &pjsua_var.acc[i];
 
 	/* Skip if this account is not valid OR auto re-registration
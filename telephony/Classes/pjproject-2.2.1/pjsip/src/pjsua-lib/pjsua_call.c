@@ -111,19 +111,15 @@ static void reinv_timer_cb(pj_timer_heap_t *th, pj_timer_entry *entry);
 /* Check and send reinvite for lock codec and ICE update */
 static pj_status_t process_pending_reinvite(pjsua_call *call);
 
-/*
- * Reset call descriptor.
- */
-static void reset_call(pjsua_call_id id)
+/* Init the media of the call, starting from the specified index. */
+static void reset_call_media(pjsua_call *call, unsigned start)
 {
-    pjsua_call *call = &pjsua_var.calls[id];
     unsigned i;
 
-    pj_bzero(call, sizeof(*call));
-    call->index = id;
-    call->last_text.ptr = call->last_text_buf_;
-    for (i=0; i<PJ_ARRAY_SIZE(call->media); ++i) {
+    for (i=start; i<call->med_max; ++i) {
 	pjsua_call_media *call_med = &call->media[i];
+
+	pj_bzero(call_med, sizeof(*call_med));
 	call_med->ssrc = pj_rand();
 	call_med->strm.a.conf_slot = PJSUA_INVALID_ID;
 	call_med->strm.v.cap_win_id = PJSUA_INVALID_ID;
@@ -132,9 +128,107 @@ static void reset_call(pjsua_call_id id)
 	call_med->idx = i;
 	call_med->tp_auto_del = PJ_TRUE;
     }
+}
+
+/*
+ * Reset call descriptor.
+ */
+static void reset_call(pjsua_call_id id)
+{
+    pjsua_call *call = &pjsua_var.calls[id];
+
+    pj_mutex_lock(call->lock);
+
+    /* Other threads may read the lock at any time, so it is kept, and so
+     * are the other fields of the slot (see pjsua_call).
+     */
+    pj_bzero(&call->index, (char*)(call+1) - (char*)&call->index);
+    call->index = id;
+    call->last_text.ptr = call->last_text_buf_;
+    reset_call_media(call, 0);
     pjsua_call_setting_default(&call->opt);
     pj_timer_entry_init(&call->reinv_timer, PJ_FALSE,
 			(void*)(pj_size_t)id, &reinv_timer_cb);
+
+    pj_mutex_unlock(call->lock);
+}
+
+
+/*
+ * Make room for the specified number of media in the call.
+ */
+pj_status_t pjsua_call_media_reserve(pjsua_call *call, unsigned cnt)
+{
+    pjsua_call_media *media, *media_prov;
+    unsigned start, max;
+
+    if (cnt <= call->med_max)
+	return PJ_SUCCESS;
+
+    if (cnt > PJSUA_MAX_CALL_MEDIA)
+	return PJ_ETOOMANY;
+
+    /* The media of the slot are allocated from its own pool, which is
+     * kept when the slot is reused.
+     */
+    if (call->med_pool == NULL) {
+	call->med_pool = pjsua_pool_create("callmed%p", 512, 512);
+	if (call->med_pool == NULL)
+	    return PJ_ENOMEM;
+    }
+
+    for (max = PJSUA_MIN_CALL_MEDIA; max < cnt; max *= 2)
+	;
+    if (max > PJSUA_MAX_CALL_MEDIA)
+	max = PJSUA_MAX_CALL_MEDIA;
+
+    media = (pjsua_call_media*)
+	    pj_pool_calloc(call->med_pool, max, sizeof(pjsua_call_media));
+    media_prov = (pjsua_call_media*)
+		 pj_pool_calloc(call->med_pool, max, sizeof(pjsua_call_media));
+    if (call->med_max) {
+	pj_memcpy(media, call->media, call->med_max * sizeof(media[0]));
+	pj_memcpy(media_prov, call->media_prov,
+		  call->med_max * sizeof(media[0]));
+    }
+
+    pj_mutex_lock(call->lock);
+    call->media = media;
+    call->media_prov = media_prov;
+    start = call->med_max;
+    call->med_max = max;
+    reset_call_media(call, start);
+    pj_memcpy(&call->media_prov[start], &call->media[start],
+	      (max - start) * sizeof(media[0]));
+    pj_mutex_unlock(call->lock);
+
+    PJ_LOG(5,(THIS_FILE, "Call %d: media capacity is now %d",
+	      call->index, max));
+
+    return PJ_SUCCESS;
+}
+
+
+/* Mark the start of call setup or teardown under PJSUA_LOCK(), during
+ * which the dialog of the call may be destroyed before the call is
+ * reset. See the locking notes in pjsua_internal.h.
+ */
+static void begin_slot_update(pjsua_call *call)
+{
+    pj_assert(PJSUA_LOCK_IS_LOCKED());
+
+    pj_mutex_lock(call->lock);
+    ++call->slot_update;
+    pj_mutex_unlock(call->lock);
+}
+
+/* Mark the end of call setup or teardown. */
+static void end_slot_update(pjsua_call *call)
+{
+    pj_mutex_lock(call->lock);
+    pj_assert(call->slot_update > 0);
+    --call->slot_update;
+    pj_mutex_unlock(call->lock);
 }
 
 
@@ -144,21 +238,36 @@ static void reset_call(pjsua_call_id id)
 pj_status_t pjsua_call_subsys_init(const pjsua_config *cfg)
 {
     pjsip_inv_callback inv_cb;
-    unsigned i;
+    unsigned i, max_calls;
     const pj_str_t str_norefersub = { "norefersub", 10 };
     pj_status_t status;
 
-    /* Init calls array. */
-    for (i=0; i<PJ_ARRAY_SIZE(pjsua_var.calls); ++i)
-	reset_call(i);
-
     /* Copy config */
     pjsua_config_dup(pjsua_var.pool, &pjsua_var.ua_cfg, cfg);
 
-    /* Verify settings */
-    if (pjsua_var.ua_cfg.max_calls >= PJSUA_MAX_CALLS) {
-	pjsua_var.ua_cfg.max_calls = PJSUA_MAX_CALLS;
+    /* Init calls array. The loops over the calls use max_calls, so it
+     * only counts the slots that have been initialized.
+     */
+    max_calls = pjsua_var.ua_cfg.max_calls;
+    pjsua_var.ua_cfg.max_calls = 0;
+    pjsua_var.calls = (pjsua_call*)
+		      pj_pool_calloc(pjsua_var.pool, max_calls,
+				     sizeof(pjsua_call));
+    pjsua_var.call_free = (pjsua_call_id*)
+			  pj_pool_calloc(pjsua_var.pool, max_calls,
+					 sizeof(pjsua_call_id));
+    for (i=0; i<max_calls; ++i) {
+	status = pj_mutex_create_simple(pjsua_var.pool, "call%p",
+					&pjsua_var.calls[i].lock);
+	if (status != PJ_SUCCESS)
+	    return status;
+
+	pjsua_var.ua_cfg.max_calls = i + 1;
+	reset_call(i);
+	pjsua_var.call_free[i] = i;
     }
+    pjsua_var.call_free_head = 0;
+    pjsua_var.call_free_cnt = max_calls;
 
     /* Check the route URI's and force loose route if required */
     for (i=0; i<pjsua_var.ua_cfg.outbound_proxy_cnt; ++i) {
@@ -249,49 +358,40 @@ PJ_DEF(pj_status_t) pjsua_enum_calls( pjsua_call_id ids[],
 }
 
 
-/* Allocate one call id */
+/* Allocate one call id. The free slots are kept in a FIFO, so that a
+ * slot is not reused until all other free slots have been used.
+ */
 static pjsua_call_id alloc_call_id(void)
 {
     pjsua_call_id cid;
 
-#if 1
-    /* New algorithm: round-robin */
-    if (pjsua_var.next_call_id >= (int)pjsua_var.ua_cfg.max_calls ||
-	pjsua_var.next_call_id < 0)
-    {
-	pjsua_var.next_call_id = 0;
-    }
+    if (pjsua_var.call_free_cnt == 0)
+	return PJSUA_INVALID_ID;
 
-    for (cid=pjsua_var.next_call_id;
-	 cid<(int)pjsua_var.ua_cfg.max_calls;
-	 ++cid)
-    {
-	if (pjsua_var.calls[cid].inv == NULL &&
-            pjsua_var.calls[cid].async_call.dlg == NULL)
-        {
-	    ++pjsua_var.next_call_id;
-	    return cid;
-	}
-    }
+    cid = pjsua_var.call_free[pjsua_var.call_free_head];
+    pjsua_var.call_free_head = (pjsua_var.call_free_head + 1) %
+			       pjsua_var.ua_cfg.max_calls;
+    --pjsua_var.call_free_cnt;
 
-    for (cid=0; cid < pjsua_var.next_call_id; ++cid) {
-	if (pjsua_var.calls[cid].inv == NULL &&
-            pjsua_var.calls[cid].async_call.dlg == NULL)
-        {
-	    ++pjsua_var.next_call_id;
-	    return cid;
-	}
-    }
+    pj_assert(!pjsua_var.calls[cid].allocated);
+    pjsua_var.calls[cid].allocated = PJ_TRUE;
 
-#else
-    /* Old algorithm */
-    for (cid=0; cid<(int)pjsua_var.ua_cfg.max_calls; ++cid) {
-	if (pjsua_var.calls[cid].inv == NULL)
-	    return cid;
-    }
-#endif
+    return cid;
+}
 
-    return PJSUA_INVALID_ID;
+/* Return the call id to the free slots. PJSUA_LOCK must be held. */
+static void free_call_id(pjsua_call_id cid)
+{
+    unsigned tail;
+
+    if (!pjsua_var.calls[cid].allocated)
+	return;
+
+    pjsua_var.calls[cid].allocated = PJ_FALSE;
+    tail = (pjsua_var.call_free_head + pjsua_var.call_free_cnt) %
+	   pjsua_var.ua_cfg.max_calls;
+    pjsua_var.call_free[tail] = cid;
+    ++pjsua_var.call_free_cnt;
 }
 
 /* Get signaling secure level.
@@ -374,6 +474,7 @@ on_make_call_med_tp_complete(pjsua_call_id call_id,
     pj_status_t status = (info? info->status: PJ_SUCCESS);
 
     PJSUA_LOCK();
+    begin_slot_update(call);
 
     /* Increment the dialog's lock otherwise when invite session creation
      * fails the dialog will be destroyed prematurely.
@@ -508,6 +609,7 @@ on_make_call_med_tp_complete(pjsua_call_id call_id,
     call->med_ch_cb = NULL;
 
     pjsip_dlg_dec_lock(dlg);
+    end_slot_update(call);
     PJSUA_UNLOCK();
 
     return PJ_SUCCESS;
@@ -531,12 +633,14 @@ on_error:
     if (call_id != -1) {
 	pjsua_media_channel_deinit(call_id);
 	reset_call(call_id);
+	free_call_id(call_id);
     }
 
     call->med_ch_cb = NULL;
 
     pjsua_check_snd_dev_idle();
 
+    end_slot_update(call);
     PJSUA_UNLOCK();
     return status;
 }
@@ -615,7 +719,7 @@ PJ_DEF(pj_status_t) pjsua_call_make_call(pjsua_acc_id acc_id,
 
 
     /* Check that account is valid */
-    PJ_ASSERT_RETURN(acc_id>=0 || acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 || acc_id<(int)pjsua_var.acc_max,
 		     PJ_EINVAL);
 
     /* Check arguments */
@@ -662,6 +766,7 @@ PJ_DEF(pj_status_t) pjsua_call_make_call(pjsua_acc_id acc_id,
     reset_call(call_id);
 
     call = &pjsua_var.calls[call_id];
+    begin_slot_update(call);
 
     /* Associate session with account */
     call->acc_id = acc_id;
@@ -781,6 +886,7 @@ PJ_DEF(pj_status_t) pjsua_call_make_call(pjsua_acc_id acc_id,
 
     pjsip_dlg_dec_lock(dlg);
     pj_pool_release(tmp_pool);
+    end_slot_update(call);
     PJSUA_UNLOCK();
 
     pj_log_pop_indent();
@@ -797,6 +903,8 @@ on_error:
     if (call_id != -1) {
 	pjsua_media_channel_deinit(call_id);
 	reset_call(call_id);
+	free_call_id(call_id);
+	end_slot_update(&pjsua_var.calls[call_id]);
     }
 
     pjsua_check_snd_dev_idle();
@@ -1079,6 +1187,7 @@ pj_bool_t pjsua_call_on_incoming(pjsip_rx_data *rdata)
     reset_call(call_id);
 
     call = &pjsua_var.calls[call_id];
+    begin_slot_update(call);
 
     /* Mark call start time. */
     pj_gettimeofday(&call->start_time);
@@ -1501,6 +1610,15 @@ pj_bool_t pjsua_call_on_incoming(pjsip_rx_data *rdata)
 
     /* This INVITE request has been handled. */
 on_return:
+    if (call_id != PJSUA_INVALID_ID) {
+	call = &pjsua_var.calls[call_id];
+
+	/* The call was not started */
+	if (call->inv == NULL && call->async_call.dlg == NULL)
+	    free_call_id(call_id);
+
+	end_slot_update(call);
+    }
     pj_log_pop_indent();
     PJSUA_UNLOCK();
     return PJ_TRUE;
@@ -1530,6 +1648,7 @@ pj_status_t acquire_call(const char *title,
     unsigned retry;
     pjsua_call *call = NULL;
     pj_bool_t has_pjsua_lock = PJ_FALSE;
+    pj_bool_t locked_pjsua;
     pj_status_t status = PJ_SUCCESS;
     pj_time_val time_start, timeout;
     pjsip_dialog *dlg = NULL;
@@ -1551,35 +1670,52 @@ pj_status_t acquire_call(const char *title,
         }
 
 	has_pjsua_lock = PJ_FALSE;
+	locked_pjsua = PJ_FALSE;
+	call = &pjsua_var.calls[call_id];
 
-	status = PJSUA_TRY_LOCK();
-	if (status != PJ_SUCCESS) {
-	    pj_thread_sleep(retry/10);
-	    continue;
+	/* The call lock is enough to find the dialog, unless the call is
+	 * being set up or torn down under PJSUA_LOCK.
+	 */
+	pj_mutex_lock(call->lock);
+	if (call->slot_update) {
+	    pj_mutex_unlock(call->lock);
+
+	    status = PJSUA_TRY_LOCK();
+	    if (status != PJ_SUCCESS) {
+		pj_thread_sleep(retry/10);
+		continue;
+	    }
+
+	    locked_pjsua = PJ_TRUE;
+	    pj_mutex_lock(call->lock);
 	}
 
 	has_pjsua_lock = PJ_TRUE;
-	call = &pjsua_var.calls[call_id];
+
         if (call->inv)
             dlg = call->inv->dlg;
         else
             dlg = call->async_call.dlg;
 
 	if (dlg == NULL) {
-	    PJSUA_UNLOCK();
+	    pj_mutex_unlock(call->lock);
+	    if (locked_pjsua)
+		PJSUA_UNLOCK();
 	    PJ_LOG(3,(THIS_FILE, "Invalid call_id %d in %s", call_id, title));
 	    return PJSIP_ESESSIONTERMINATED;
 	}
 
 	status = pjsip_dlg_try_inc_lock(dlg);
-	if (status != PJ_SUCCESS) {
+
+	pj_mutex_unlock(call->lock);
+	if (locked_pjsua)
 	    PJSUA_UNLOCK();
+
+	if (status != PJ_SUCCESS) {
 	    pj_thread_sleep(retry/10);
 	    continue;
 	}
 
-	PJSUA_UNLOCK();
-
 	break;
     }
 
@@ -1610,6 +1746,7 @@ PJ_DEF(pj_status_t) pjsua_call_get_info( pjsua_call_id call_id,
 {
     pjsua_call *call;
     pjsip_dialog *dlg;
+    pj_bool_t locked_pjsua = PJ_FALSE;
     unsigned mi;
 
     PJ_ASSERT_RETURN(call_id>=0 && call_id<(int)pjsua_var.ua_cfg.max_calls,
@@ -1617,15 +1754,25 @@ PJ_DEF(pj_status_t) pjsua_call_get_info( pjsua_call_id call_id,
 
     pj_bzero(info, sizeof(*info));
 
-    /* Use PJSUA_LOCK() instead of acquire_call():
+    /* Use the call lock instead of acquire_call():
      *  https://trac.pjsip.org/repos/ticket/1371
+     * It keeps the dialog attached to the call, unless the call is being
+     * set up or torn down under PJSUA_LOCK().
      */
-    PJSUA_LOCK();
-
     call = &pjsua_var.calls[call_id];
+    pj_mutex_lock(call->lock);
+    if (call->slot_update) {
+	pj_mutex_unlock(call->lock);
+	PJSUA_LOCK();
+	pj_mutex_lock(call->lock);
+	locked_pjsua = PJ_TRUE;
+    }
+
     dlg = (call->inv ? call->inv->dlg : call->async_call.dlg);
     if (!dlg) {
-	PJSUA_UNLOCK();
+	pj_mutex_unlock(call->lock);
+	if (locked_pjsua)
+	    PJSUA_UNLOCK();
 	return PJSIP_ESESSIONTERMINATED;
     }
 
@@ -1799,7 +1946,9 @@ PJ_DEF(pj_status_t) pjsua_call_get_info( pjsua_call_id call_id,
     }
     //YZhou
     info->answeredElsewhere = call->answeredElsewhere;
-    PJSUA_UNLOCK();
+    pj_mutex_unlock(call->lock);
+    if (locked_pjsua)
+	PJSUA_UNLOCK();
 
     return PJ_SUCCESS;
 }
@@ -3159,7 +3308,7 @@ static pj_bool_t check_ice_complete(pjsua_call *call, pj_bool_t *need_reinv)
 static pj_status_t process_pending_reinvite(pjsua_call *call)
 {
     const pj_str_t ST_UPDATE = {"UPDATE", 6};
-    pj_pool_t *pool = call->inv->pool_prov;
+    pj_pool_t *pool;
     pjsip_inv_session *inv = call->inv;
     pj_bool_t ice_need_reinv;
     pj_bool_t ice_completed;
@@ -3179,6 +3328,8 @@ static pj_status_t process_pending_reinvite(pjsua_call *call)
 	return PJMEDIA_SDPNEG_EINSTATE;
     }
 
+    pool = inv->pool_prov;
+
     /* Don't do this if call is disconnecting! */
     if (inv->state > PJSIP_INV_STATE_CONFIRMED || inv->cause >= 200)
     {
@@ -3569,13 +3720,16 @@ static void pjsua_call_on_state_changed(pjsip_inv_session *inv,
 	pjsua_media_channel_deinit(call->index);
 
 	/* Free call */
+	pj_mutex_lock(call->lock);
 	call->inv = NULL;
+	pj_mutex_unlock(call->lock);
 
 	pj_assert(pjsua_var.call_cnt > 0);
 	--pjsua_var.call_cnt;
 
 	/* Reset call */
 	reset_call(call->index);
+	free_call_id(call->index);
 
 	pjsua_check_snd_dev_idle();
 
@@ -56,9 +56,6 @@ static void init_data()
 
     pj_bzero(&pjsua_var, sizeof(pjsua_var));
 
-    for (i=0; i<PJ_ARRAY_SIZE(pjsua_var.acc); ++i)
-	pjsua_var.acc[i].index = i;
-    
     for (i=0; i<PJ_ARRAY_SIZE(pjsua_var.tpdata); ++i)
 	pjsua_var.tpdata[i].index = i;
 
@@ -69,6 +66,9 @@ static void init_data()
 
     pjsua_config_default(&pjsua_var.ua_cfg);
 
+    /* The call table is allocated by pjsua_call_subsys_init() */
+    pjsua_var.ua_cfg.max_calls = 0;
+
     for (i=0; i<PJSUA_MAX_VID_WINS; ++i) {
 	pjsua_vid_win_reset(i);
     }
@@ -104,6 +104,7 @@ PJ_DEF(void) pjsua_config_default(pjsua_config *cfg)
     pj_bzero(cfg, sizeof(*cfg));
 
     cfg->max_calls = ((PJSUA_MAX_CALLS) < 4) ? (PJSUA_MAX_CALLS) : 4;
+    cfg->max_acc = PJSUA_MAX_ACC;
     cfg->thread_cnt = 1;
     cfg->nat_type_in_sdp = 1;
     cfg->stun_ignore_failure = PJ_TRUE;
@@ -301,6 +302,11 @@ PJ_DEF(void) pjsua_acc_config_default(pjsua_acc_config *cfg)
     cfg->call_hold_type = PJSUA_CALL_HOLD_TYPE_DEFAULT;
     cfg->register_on_acc_add = PJ_TRUE;
     cfg->mwi_expires = PJSIP_MWI_DEFAULT_EXPIRES;
+    cfg->sub_refresh_rate = PJSUA_SUB_REFRESH_RATE;
+    cfg->sub_refresh_burst = PJSUA_SUB_REFRESH_BURST;
+    cfg->sub_refresh_jitter = PJSUA_SUB_REFRESH_JITTER;
+    cfg->rtp_pool_size = PJSUA_RTP_POOL_SIZE;
+    cfg->ice_prewarm_cnt = PJSUA_ICE_PREWARM_CNT;
 }
 
 PJ_DEF(void) pjsua_buddy_config_default(pjsua_buddy_config *cfg)
@@ -1031,6 +1037,11 @@ PJ_DEF(pj_status_t) pjsua_init( const pjsua_config *ua_cfg,
     }
     
 
+    /* Initialize PJSUA account subsystem: */
+    status = pjsua_acc_subsys_init(ua_cfg);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
     /* Initialize PJSUA call subsystem: */
     status = pjsua_call_subsys_init(ua_cfg);
     if (status != PJ_SUCCESS)
@@ -1569,8 +1580,14 @@ PJ_DEF(pj_status_t) pjsua_destroy2(unsigned flags)
 	    pjsua_media_channel_deinit(i);
 	}
 
+	/* Close the RTP pools of the accounts */
+	for (i=0; i<(int)pjsua_var.acc_max; ++i) {
+	    if (pjsua_var.acc[i].valid)
+		pjsua_rtp_pool_flush(i);
+	}
+
 	/* Set all accounts to offline */
-	for (i=0; i<(int)PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+	for (i=0; i<(int)pjsua_var.acc_max; ++i) {
 	    if (!pjsua_var.acc[i].valid)
 		continue;
 	    pjsua_var.acc[i].online_status = PJ_FALSE;
@@ -1585,7 +1602,7 @@ PJ_DEF(pj_status_t) pjsua_destroy2(unsigned flags)
 	 */
 	/* First stage, get the maximum wait time */
 	max_wait = 100;
-	for (i=0; i<(int)PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+	for (i=0; i<(int)pjsua_var.acc_max; ++i) {
 	    if (!pjsua_var.acc[i].valid)
 		continue;
 	    if (pjsua_var.acc[i].cfg.unpublish_max_wait_time_msec > max_wait)
@@ -1600,21 +1617,21 @@ PJ_DEF(pj_status_t) pjsua_destroy2(unsigned flags)
 	/* Second stage, wait for unpublications to complete */
 	for (i=0; i<(int)(max_wait/50); ++i) {
 	    unsigned j;
-	    for (j=0; j<PJ_ARRAY_SIZE(pjsua_var.acc); ++j) {
+	    for (j=0; j<pjsua_var.acc_max; ++j) {
 		if (!pjsua_var.acc[j].valid)
 		    continue;
 
 		if (pjsua_var.acc[j].publish_sess)
 		    break;
 	    }
-	    if (j != PJ_ARRAY_SIZE(pjsua_var.acc))
+	    if (j != pjsua_var.acc_max)
 		busy_sleep(50);
 	    else
 		break;
 	}
 
 	/* Third stage, forcefully destroy unfinished unpublications */
-	for (i=0; i<(int)PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+	for (i=0; i<(int)pjsua_var.acc_max; ++i) {
 	    if (pjsua_var.acc[i].publish_sess) {
 		pjsip_publishc_destroy(pjsua_var.acc[i].publish_sess);
 		pjsua_var.acc[i].publish_sess = NULL;
@@ -1622,7 +1639,7 @@ PJ_DEF(pj_status_t) pjsua_destroy2(unsigned flags)
 	}
 
 	/* Unregister all accounts */
-	for (i=0; i<(int)PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+	for (i=0; i<(int)pjsua_var.acc_max; ++i) {
 	    if (!pjsua_var.acc[i].valid)
 		continue;
 
@@ -1645,7 +1662,7 @@ PJ_DEF(pj_status_t) pjsua_destroy2(unsigned flags)
 	/* Wait until all unregistrations are done (ticket #364) */
 	/* First stage, get the maximum wait time */
 	max_wait = 100;
-	for (i=0; i<(int)PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+	for (i=0; i<(int)pjsua_var.acc_max; ++i) {
 	    if (!pjsua_var.acc[i].valid)
 		continue;
 	    if (pjsua_var.acc[i].cfg.unreg_timeout > max_wait)
@@ -1660,14 +1677,14 @@ PJ_DEF(pj_status_t) pjsua_destroy2(unsigned flags)
 	/* Second stage, wait for unregistrations to complete */
 	for (i=0; i<(int)(max_wait/50); ++i) {
 	    unsigned j;
-	    for (j=0; j<PJ_ARRAY_SIZE(pjsua_var.acc); ++j) {
+	    for (j=0; j<pjsua_var.acc_max; ++j) {
 		if (!pjsua_var.acc[j].valid)
 		    continue;
 
 		if (pjsua_var.acc[j].regc)
 		    break;
 	    }
-	    if (j != PJ_ARRAY_SIZE(pjsua_var.acc))
+	    if (j != pjsua_var.acc_max)
 		busy_sleep(50);
 	    else
 		break;
@@ -1703,7 +1720,7 @@ PJ_DEF(pj_status_t) pjsua_destroy2(unsigned flags)
 	}
 
 	/* Destroy accounts */
-	for (i=0; i<(int)PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+	for (i=0; i<(int)pjsua_var.acc_max; ++i) {
 	    if (pjsua_var.acc[i].pool) {
 		pj_pool_release(pjsua_var.acc[i].pool);
 		pjsua_var.acc[i].pool = NULL;
@@ -1722,6 +1739,36 @@ PJ_DEF(pj_status_t) pjsua_destroy2(unsigned flags)
         pjsua_var.timer_mutex = NULL;
     }
 
+    if (pjsua_var.sub_refresh_mutex) {
+	pj_mutex_destroy(pjsua_var.sub_refresh_mutex);
+	pjsua_var.sub_refresh_mutex = NULL;
+    }
+
+    if (pjsua_var.rtp_pool_mutex) {
+	pj_mutex_destroy(pjsua_var.rtp_pool_mutex);
+	pjsua_var.rtp_pool_mutex = NULL;
+    }
+
+    for (i=0; i<(int)pjsua_var.ua_cfg.max_calls; ++i) {
+	if (pjsua_var.calls[i].lock) {
+	    pj_mutex_destroy(pjsua_var.calls[i].lock);
+	    pjsua_var.calls[i].lock = NULL;
+	}
+	if (pjsua_var.calls[i].med_pool) {
+	    pj_pool_release(pjsua_var.calls[i].med_pool);
+	    pjsua_var.calls[i].med_pool = NULL;
+	}
+    }
+    pjsua_var.ua_cfg.max_calls = 0;
+    pjsua_var.calls = NULL;
+
+    for (i=0; i<(int)pjsua_var.acc_max; ++i) {
+	if (pjsua_var.acc[i].lock) {
+	    pj_mutex_destroy(pjsua_var.acc[i].lock);
+	    pjsua_var.acc[i].lock = NULL;
+	}
+    }
+
     /* Destroy pool and pool factory. */
     if (pjsua_var.pool) {
 	pj_pool_release(pjsua_var.pool);
@@ -3029,6 +3076,51 @@ PJ_DEF(void) pjsua_dump(pj_bool_t detail)
 	}
     }
 
+    PJ_LOG(3,(THIS_FILE, "Dumping call memory:"));
+    PJSUA_LOCK();
+    {
+	pj_size_t slot_size = 0, med_size = 0, sess_size = 0;
+	unsigned active = 0;
+
+	for (i=0; i<pjsua_var.ua_cfg.max_calls; ++i) {
+	    pjsua_call *call = &pjsua_var.calls[i];
+	    pjsip_dialog *dlg;
+	    pj_size_t call_med_size = 0, call_sess_size = 0;
+
+	    if (call->med_pool)
+		call_med_size = pj_pool_get_used_size(call->med_pool);
+	    slot_size += sizeof(*call);
+	    med_size += call_med_size;
+
+	    dlg = (call->inv ? call->inv->dlg : call->async_call.dlg);
+	    if (dlg == NULL)
+		continue;
+
+	    /* The invite session uses the pool of the dialog */
+	    call_sess_size = pj_pool_get_used_size(dlg->pool);
+	    if (call->inv) {
+		call_sess_size += pj_pool_get_used_size(call->inv->pool_prov);
+		call_sess_size += pj_pool_get_used_size(call->inv->pool_active);
+	    }
+	    sess_size += call_sess_size;
+	    ++active;
+
+	    PJ_LOG(3,(THIS_FILE, " Call %d: %u bytes (slot %u, %d/%d media %u, "
+				 "session %u)",
+		      i, (unsigned)(sizeof(*call) + call_med_size +
+				    call_sess_size),
+		      (unsigned)sizeof(*call), call->med_cnt, call->med_max,
+		      (unsigned)call_med_size, (unsigned)call_sess_size));
+	}
+
+	PJ_LOG(3,(THIS_FILE, " Total: %u bytes for %d calls in %d slots "
+			     "(slots %u, media %u, sessions %u)",
+		  (unsigned)(slot_size + med_size + sess_size), active,
+		  pjsua_var.ua_cfg.max_calls, (unsigned)slot_size,
+		  (unsigned)med_size, (unsigned)sess_size));
+    }
+    PJSUA_UNLOCK();
+
     pjsip_tsx_layer_dump(detail);
     pjsip_ua_dump(detail);
 
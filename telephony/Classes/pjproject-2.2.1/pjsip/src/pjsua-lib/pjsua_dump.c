@@ -1000,3 +1000,239 @@ PJ_DEF(pj_status_t) pjsua_call_dump( pjsua_call_id call_id,
     return PJ_SUCCESS;
 }
 
+
+
+/* Copy the statistics of one active media stream into a snapshot entry */
+static void snapshot_stream(const pjsua_call_media *call_med,
+			    pjsua_stream_snapshot *s)
+{
+#if PJSUA_MEDIA_HAS_PJMEDIA
+    pjmedia_rtcp_stat stat;
+    pjmedia_jb_state jb;
+    pj_status_t status;
+
+    if (call_med->type == PJMEDIA_TYPE_AUDIO) {
+	status = pjmedia_stream_get_stat(call_med->strm.a.stream, &stat);
+	if (status == PJ_SUCCESS)
+	    status = pjmedia_stream_get_stat_jbuf(call_med->strm.a.stream,
+						  &jb);
+#if defined(PJMEDIA_HAS_VIDEO) && (PJMEDIA_HAS_VIDEO != 0)
+    } else if (call_med->type == PJMEDIA_TYPE_VIDEO) {
+	status = pjmedia_vid_stream_get_stat(call_med->strm.v.stream, &stat);
+	if (status == PJ_SUCCESS)
+	    status = pjmedia_vid_stream_get_stat_jbuf(call_med->strm.v.stream,
+						      &jb);
+#endif
+    } else {
+	status = PJMEDIA_EINVALIMEDIATYPE;
+    }
+
+    if (status != PJ_SUCCESS)
+	return;
+
+    s->tx_pkt = stat.tx.pkt;
+    s->tx_bytes = stat.tx.bytes;
+    s->tx_loss = stat.tx.loss;
+    s->tx_jitter = stat.tx.jitter.last;
+    s->rx_pkt = stat.rx.pkt;
+    s->rx_bytes = stat.rx.bytes;
+    s->rx_loss = stat.rx.loss;
+    s->rx_discard = stat.rx.discard;
+    s->rx_reorder = stat.rx.reorder;
+    s->rx_dup = stat.rx.dup;
+    s->rx_jitter = stat.rx.jitter.last;
+    s->rx_jitter_max = stat.rx.jitter.max;
+    s->rtt = stat.rtt.last;
+    s->rtt_max = stat.rtt.max;
+
+    s->jb_size = jb.size;
+    s->jb_prefetch = jb.prefetch;
+    s->jb_avg_delay = jb.avg_delay;
+    s->jb_lost = jb.lost;
+    s->jb_discard = jb.discard;
+    s->jb_empty = jb.empty;
+
+#if defined(PJMEDIA_HAS_RTCP_XR) && (PJMEDIA_HAS_RTCP_XR != 0)
+    if (call_med->type == PJMEDIA_TYPE_AUDIO) {
+	pjmedia_rtcp_xr_stat xr;
+
+	if (pjmedia_stream_get_stat_xr(call_med->strm.a.stream,
+				       &xr) == PJ_SUCCESS &&
+	    xr.tx.voip_mtc.update.sec != 0)
+	{
+	    s->tx_mos_lq = xr.tx.voip_mtc.mos_lq;
+	    s->tx_r_factor = xr.tx.voip_mtc.r_factor;
+	}
+    }
+#endif
+
+#else
+    PJ_UNUSED_ARG(call_med);
+    PJ_UNUSED_ARG(s);
+#endif	/* PJSUA_MEDIA_HAS_PJMEDIA */
+}
+
+
+/*
+ * Take a snapshot of the statistics of all calls.
+ */
+PJ_DEF(pj_status_t) pjsua_stat_snapshot(pjsua_stat_snapshot_info *info,
+					pjsua_stream_snapshot streams[],
+					unsigned *count)
+{
+    pj_time_val now;
+    unsigned i, c, total, call_cnt;
+
+    PJ_ASSERT_RETURN(count && (streams || *count == 0), PJ_EINVAL);
+
+    pj_gettimeofday(&now);
+    c = total = call_cnt = 0;
+
+    /* The streams are protected by PJSUA_LOCK(), the invite session
+     * by the call lock.
+     */
+    PJSUA_LOCK();
+
+    for (i=0; i<pjsua_var.ua_cfg.max_calls; ++i) {
+	pjsua_call *call = &pjsua_var.calls[i];
+	pjsua_stream_snapshot tmpl;
+	unsigned mi, n;
+
+	if (!call->inv)
+	    continue;
+
+	pj_bzero(&tmpl, sizeof(tmpl));
+	tmpl.call_id = i;
+	tmpl.med_idx = -1;
+	tmpl.type = PJMEDIA_TYPE_NONE;
+	tmpl.tx_mos_lq = tmpl.tx_r_factor = 127;
+
+	pj_mutex_lock(call->lock);
+	if (!call->inv) {
+	    pj_mutex_unlock(call->lock);
+	    continue;
+	}
+	tmpl.call_state = call->inv->state;
+	tmpl.last_code = call->last_code;
+	tmpl.dlg_tsx_cnt = call->inv->dlg->tsx_count;
+	if (call->conn_time.sec != 0) {
+	    pj_time_val dur = now;
+	    PJ_TIME_VAL_SUB(dur, call->conn_time);
+	    tmpl.duration_msec = PJ_TIME_VAL_MSEC(dur);
+	}
+	pj_mutex_unlock(call->lock);
+
+	++call_cnt;
+
+	for (mi=0, n=0; mi<call->med_cnt; ++mi) {
+	    const pjsua_call_media *call_med = &call->media[mi];
+
+	    if (call_med->tp == NULL ||
+		(!call_med->strm.a.stream && !call_med->strm.v.stream))
+	    {
+		continue;
+	    }
+
+	    ++n;
+	    if (c < *count) {
+		streams[c] = tmpl;
+		streams[c].med_idx = mi;
+		streams[c].type = call_med->type;
+		snapshot_stream(call_med, &streams[c]);
+		++c;
+	    }
+	}
+
+	/* Still report the call when it has no active media */
+	if (n == 0) {
+	    ++n;
+	    if (c < *count)
+		streams[c++] = tmpl;
+	}
+	total += n;
+    }
+
+    PJSUA_UNLOCK();
+
+    *count = c;
+    if (info) {
+	info->timestamp = now;
+	info->call_cnt = call_cnt;
+	info->tsx_cnt = pjsip_tsx_layer_get_tsx_count();
+	info->stream_cnt = total;
+    }
+
+    return PJ_SUCCESS;
+}
+
+
+/*
+ * Print a statistics snapshot as JSON.
+ */
+PJ_DEF(int) pjsua_stat_snapshot_print_json(
+				    const pjsua_stat_snapshot_info *info,
+				    const pjsua_stream_snapshot streams[],
+				    unsigned count,
+				    char *buffer,
+				    unsigned maxlen)
+{
+    char *p = buffer, *end = buffer + maxlen;
+    unsigned i;
+    int len;
+
+#define PRINT_JSON(args)	\
+	    len = pj_ansi_snprintf args; \
+	    if (len < 0 || len >= end-p) \
+		return -1; \
+	    p += len
+
+    PJ_ASSERT_RETURN(info && (streams || count == 0) && buffer, -1);
+
+    PRINT_JSON((p, end-p, "{\"timestamp\":%ld.%03ld,\"calls\":%u,"
+			  "\"tsx\":%u,\"total\":%u,\"streams\":[",
+		(long)info->timestamp.sec, (long)info->timestamp.msec,
+		info->call_cnt, info->tsx_cnt, info->stream_cnt));
+
+    for (i=0; i<count; ++i) {
+	const pjsua_stream_snapshot *s = &streams[i];
+
+	PRINT_JSON((p, end-p,
+		    "%s{\"call\":%d,\"med\":%d,\"type\":\"%s\","
+		    "\"state\":\"%s\",\"code\":%d,\"duration\":%u,"
+		    "\"dlg_tsx\":%u,",
+		    (i ? "," : ""), s->call_id, s->med_idx,
+		    pjmedia_type_name(s->type),
+		    pjsip_inv_state_name(s->call_state), s->last_code,
+		    s->duration_msec, s->dlg_tsx_cnt));
+	PRINT_JSON((p, end-p,
+		    "\"tx\":{\"pkt\":%u,\"bytes\":%u,\"loss\":%u,"
+		    "\"jitter\":%u},"
+		    "\"rx\":{\"pkt\":%u,\"bytes\":%u,\"loss\":%u,"
+		    "\"discard\":%u,\"reorder\":%u,\"dup\":%u,"
+		    "\"jitter\":%u,\"jitter_max\":%u},"
+		    "\"rtt\":%u,\"rtt_max\":%u,",
+		    s->tx_pkt, s->tx_bytes, s->tx_loss, s->tx_jitter,
+		    s->rx_pkt, s->rx_bytes, s->rx_loss, s->rx_discard,
+		    s->rx_reorder, s->rx_dup, s->rx_jitter, s->rx_jitter_max,
+		    s->rtt, s->rtt_max));
+	PRINT_JSON((p, end-p,
+		    "\"jb\":{\"size\":%u,\"prefetch\":%u,\"avg_delay\":%u,"
+		    "\"lost\":%u,\"discard\":%u,\"empty\":%u}",
+		    s->jb_size, s->jb_prefetch, s->jb_avg_delay,
+		    s->jb_lost, s->jb_discard, s->jb_empty));
+	if (s->tx_mos_lq != 127) {
+	    PRINT_JSON((p, end-p, ",\"mos_lq\":%u.%u",
+			s->tx_mos_lq / 10, s->tx_mos_lq % 10));
+	}
+	if (s->tx_r_factor != 127) {
+	    PRINT_JSON((p, end-p, ",\"r_factor\":%u", s->tx_r_factor));
+	}
+	PRINT_JSON((p, end-p, "}"));
+    }
+
+    PRINT_JSON((p, end-p, "]}"));
+
+#undef PRINT_JSON
+
+    return (int)(p - buffer);
+}
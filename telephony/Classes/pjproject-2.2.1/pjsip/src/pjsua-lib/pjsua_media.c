@@ -44,6 +44,7 @@ static void pjsua_media_config_dup(pj_pool_t *pool,
  */
 pj_status_t pjsua_media_subsys_init(const pjsua_media_config *cfg)
 {
+    unsigned i;
     pj_status_t status;
 
     pj_log_push_indent();
@@ -110,6 +111,23 @@ pj_status_t pjsua_media_subsys_init(const pjsua_media_config *cfg)
 	goto on_error;
 #endif
 
+    /* RTP pools of the accounts */
+    status = pj_mutex_create_simple(pjsua_var.pool, "pjsua_rtppool",
+				    &pjsua_var.rtp_pool_mutex);
+    if (status != PJ_SUCCESS) {
+	pjsua_perror(THIS_FILE, "Unable to create mutex", status);
+	goto on_error;
+    }
+    pj_list_init(&pjsua_var.rtp_pool_free);
+    pj_list_init(&pjsua_var.ice_prewarm_free);
+    for (i=0; i<pjsua_var.acc_max; ++i) {
+	pjsua_rtp_pool *pool = &pjsua_var.acc[i].rtp_pool;
+
+	pj_list_init(&pool->idle);
+	pj_list_init(&pool->ice_gathering);
+	pj_list_init(&pool->ice_ready);
+    }
+
     pj_log_pop_indent();
     return PJ_SUCCESS;
 
@@ -228,7 +246,7 @@ pj_status_t pjsua_media_subsys_destroy(unsigned flags)
  * Create RTP and RTCP socket pair, and possibly resolve their public
  * address via STUN.
  */
-static pj_status_t create_rtp_rtcp_sock(pjsua_call_media *call_med,
+static pj_status_t create_rtp_rtcp_sock(pjsua_acc_id acc_id,
 					const pjsua_transport_config *cfg,
 					pjmedia_sock_info *skinfo)
 {
@@ -242,14 +260,14 @@ static pj_status_t create_rtp_rtcp_sock(pjsua_call_media *call_med,
     pj_sockaddr mapped_addr[2];
     pj_status_t status = PJ_SUCCESS;
     char addr_buf[PJ_INET6_ADDRSTRLEN+10];
-    pjsua_acc *acc = &pjsua_var.acc[call_med->call->acc_id];
+    pjsua_acc *acc = &pjsua_var.acc[acc_id];
     pj_sock_t sock[2];
 
     use_ipv6 = (acc->cfg.ipv6_media_use != PJSUA_IPV6_DISABLED);
     af = use_ipv6 ? pj_AF_INET6() : pj_AF_INET();
 
     /* Make sure STUN server resolution has completed */
-    if (!use_ipv6 && pjsua_sip_acc_is_using_stun(call_med->call->acc_id)) {
+    if (!use_ipv6 && pjsua_sip_acc_is_using_stun(acc_id)) {
 	status = resolve_stun_server(PJ_TRUE);
 	if (status != PJ_SUCCESS) {
 	    pjsua_perror(THIS_FILE, "Error resolving STUN server", status);
@@ -338,7 +356,7 @@ static pj_status_t create_rtp_rtcp_sock(pjsua_call_media *call_med,
 	 * If we're configured to use STUN, then find out the mapped address,
 	 * and make sure that the mapped RTCP port is adjacent with the RTP.
 	 */
-	if (!use_ipv6 && pjsua_sip_acc_is_using_stun(call_med->call->acc_id) &&
+	if (!use_ipv6 && pjsua_sip_acc_is_using_stun(acc_id) &&
 	    pjsua_var.stun_srv.addr.sa_family != 0)
 	{
 	    char ip_addr[32];
@@ -493,43 +511,295 @@ on_error:
     return status;
 }
 
-/* Create normal UDP media transports */
-static pj_status_t create_udp_media_transport(const pjsua_transport_config *cfg,
-					      pjsua_call_media *call_med)
+/* Create UDP media transport for the account */
+static pj_status_t create_udp_transport(pjsua_acc_id acc_id,
+					const pjsua_transport_config *cfg,
+					pjmedia_transport **p_tp)
 {
     pjmedia_sock_info skinfo;
     pj_status_t status;
 
-    status = create_rtp_rtcp_sock(call_med, cfg, &skinfo);
+    status = create_rtp_rtcp_sock(acc_id, cfg, &skinfo);
     if (status != PJ_SUCCESS) {
 	pjsua_perror(THIS_FILE, "Unable to create RTP/RTCP socket",
 		     status);
-	goto on_error;
+	return status;
     }
 
     status = pjmedia_transport_udp_attach(pjsua_var.med_endpt, NULL,
-					  &skinfo, 0, &call_med->tp);
+					  &skinfo, 0, p_tp);
     if (status != PJ_SUCCESS) {
 	pjsua_perror(THIS_FILE, "Unable to create media transport",
 		     status);
-	goto on_error;
+	return status;
     }
 
-    pjmedia_transport_simulate_lost(call_med->tp, PJMEDIA_DIR_ENCODING,
+    pjmedia_transport_simulate_lost(*p_tp, PJMEDIA_DIR_ENCODING,
 				    pjsua_var.media_cfg.tx_drop_pct);
 
-    pjmedia_transport_simulate_lost(call_med->tp, PJMEDIA_DIR_DECODING,
+    pjmedia_transport_simulate_lost(*p_tp, PJMEDIA_DIR_DECODING,
 				    pjsua_var.media_cfg.rx_drop_pct);
 
+    return PJ_SUCCESS;
+}
+
+/* Check if the transports of the account can be kept in its RTP pool.
+ * The address of the transport must not depend on the time it has been
+ * created, and pjsua must own the transport.
+ */
+static pj_bool_t rtp_pool_usable(pjsua_acc_id acc_id)
+{
+    pjsua_acc *acc = &pjsua_var.acc[acc_id];
+
+    return acc->cfg.rtp_pool_size > 0 &&
+	   !acc->cfg.ice_cfg.enable_ice &&
+	   !acc->cfg.allow_sdp_nat_rewrite &&
+	   !pjsua_sip_acc_is_using_stun(acc_id) &&
+	   pjsua_var.ua_cfg.cb.on_create_media_transport == NULL;
+}
+
+/* Add the transport to the RTP pool, rtp_pool_mutex must be held. */
+static void rtp_pool_add(pjsua_rtp_pool *pool, pjmedia_transport *tp,
+			 unsigned drain_msec)
+{
+    pjsua_rtp_pool_tp *e;
+
+    if (pj_list_empty(&pjsua_var.rtp_pool_free)) {
+	e = PJ_POOL_ZALLOC_T(pjsua_var.pool, pjsua_rtp_pool_tp);
+    } else {
+	e = pjsua_var.rtp_pool_free.next;
+	pj_list_erase(e);
+    }
+
+    e->tp = tp;
+    pj_gettickcount(&e->release);
+    e->release.msec += drain_msec;
+    pj_time_val_normalize(&e->release);
+
+    pj_list_push_back(&pool->idle, e);
+    ++pool->idle_cnt;
+}
+
+/* Take a drained transport from the RTP pool of the account. Returns the
+ * id of the pool, or zero if the account does not use the pool. The
+ * transport is NULL if the pool is exhausted.
+ */
+static unsigned rtp_pool_take(pjsua_acc_id acc_id, pjmedia_transport **p_tp)
+{
+    pjsua_rtp_pool *pool = &pjsua_var.acc[acc_id].rtp_pool;
+    unsigned id;
+
+    *p_tp = NULL;
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+
+    id = pool->id;
+    if (id) {
+	pjsua_rtp_pool_tp *e = pool->idle.next;
+	pj_time_val now;
+
+	pj_gettickcount(&now);
+	if (e != &pool->idle && PJ_TIME_VAL_GTE(now, e->release)) {
+	    *p_tp = e->tp;
+	    pj_list_erase(e);
+	    --pool->idle_cnt;
+	    pj_list_push_back(&pjsua_var.rtp_pool_free, e);
+	    ++pool->stat.taken;
+	} else {
+	    ++pool->stat.exhausted;
+	}
+    }
+
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    return id;
+}
+
+/* Return the transport to the RTP pool it was taken for, or close it if
+ * the pool is full or has been flushed since.
+ */
+static void rtp_pool_release(pjsua_acc_id acc_id, unsigned id,
+			     pjmedia_transport *tp)
+{
+    pjsua_acc *acc = &pjsua_var.acc[acc_id];
+    pj_bool_t kept = PJ_FALSE;
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+
+    if (acc->rtp_pool.id == id) {
+	if (acc->rtp_pool.idle_cnt < acc->rtp_pool.size) {
+	    rtp_pool_add(&acc->rtp_pool, tp, PJSUA_RTP_POOL_DRAIN_MSEC);
+	    ++acc->rtp_pool.stat.recycled;
+	    kept = PJ_TRUE;
+	} else {
+	    ++acc->rtp_pool.stat.discarded;
+	}
+    }
+
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    if (!kept)
+	pjmedia_transport_close(tp);
+}
+
+/* Give new contents to the RTP pool, and return the id of the contents */
+static unsigned rtp_pool_renew(pjsua_rtp_pool *pool, unsigned size)
+{
+    unsigned id;
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+    if (++pjsua_var.rtp_pool_seq == 0)
+	++pjsua_var.rtp_pool_seq;
+    id = pool->id = pjsua_var.rtp_pool_seq;
+    pool->size = size;
+    pj_bzero(&pool->stat, sizeof(pool->stat));
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    return id;
+}
+
+static pj_bool_t ice_prewarm_usable(pjsua_acc_id acc_id);
+static void ice_prewarm_timer_cb(pj_timer_heap_t *th, pj_timer_entry *te);
+
+/*
+ * Fill the RTP pool of the account.
+ */
+void pjsua_rtp_pool_init(pjsua_acc_id acc_id)
+{
+    pjsua_acc *acc = &pjsua_var.acc[acc_id];
+    unsigned i, id;
+
+    pjsua_rtp_pool_flush(acc_id);
+
+    if (ice_prewarm_usable(acc_id)) {
+	pj_time_val delay = { 0, 0 };
+
+	/* The ICE transports are gathered by the timer */
+	rtp_pool_renew(&acc->rtp_pool, acc->cfg.ice_prewarm_cnt);
+	pj_timer_entry_init(&acc->rtp_pool.ice_timer, 0,
+			    (void*)(pj_ssize_t)acc_id, &ice_prewarm_timer_cb);
+	pjsua_schedule_timer(&acc->rtp_pool.ice_timer, &delay);
+	return;
+    }
+
+    if (!rtp_pool_usable(acc_id))
+	return;
+
+    id = rtp_pool_renew(&acc->rtp_pool, acc->cfg.rtp_pool_size);
+
+    for (i=0; i<acc->cfg.rtp_pool_size; ++i) {
+	pjmedia_transport *tp;
+
+	if (create_udp_transport(acc_id, &acc->cfg.rtp_cfg, &tp)!=PJ_SUCCESS)
+	    break;
+
+	pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+	if (acc->rtp_pool.id == id) {
+	    rtp_pool_add(&acc->rtp_pool, tp, 0);
+	    tp = NULL;
+	}
+	pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+	if (tp) {
+	    pjmedia_transport_close(tp);
+	    break;
+	}
+    }
+
+    PJ_LOG(4,(THIS_FILE, "Account %d: %d media transports in RTP pool",
+	      acc_id, i));
+}
+
+/*
+ * Close the transports in the RTP pool of the account.
+ */
+void pjsua_rtp_pool_flush(pjsua_acc_id acc_id)
+{
+    pjsua_rtp_pool *pool = &pjsua_var.acc[acc_id].rtp_pool;
+    pjsua_rtp_pool_tp closing, *e;
+    pjsua_ice_prewarm_tp ice_closing, *ie;
+
+    if (pjsua_var.rtp_pool_mutex == NULL)
+	return;
+
+    if (pj_timer_entry_running(&pool->ice_timer))
+	pjsua_cancel_timer(&pool->ice_timer);
+
+    pj_list_init(&closing);
+    pj_list_init(&ice_closing);
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+    pool->id = 0;
+    pj_list_merge_last(&closing, &pool->idle);
+    pool->idle_cnt = 0;
+    pj_list_merge_last(&ice_closing, &pool->ice_gathering);
+    pj_list_merge_last(&ice_closing, &pool->ice_ready);
+    pool->ice_gathering_cnt = pool->ice_ready_cnt = 0;
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    if (pj_list_empty(&closing) && pj_list_empty(&ice_closing))
+	return;
+
+    for (e=closing.next; e!=&closing; e=e->next)
+	pjmedia_transport_close(e->tp);
+
+    for (ie=ice_closing.next; ie!=&ice_closing; ie=ie->next) {
+	if (ie->med.tp)
+	    pjmedia_transport_close(ie->med.tp);
+    }
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+    pj_list_merge_last(&pjsua_var.rtp_pool_free, &closing);
+    pj_list_merge_last(&pjsua_var.ice_prewarm_free, &ice_closing);
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+}
+
+/* Create normal UDP media transports, or take one from the RTP pool */
+static pj_status_t create_udp_media_transport(const pjsua_transport_config *cfg,
+					      pjsua_call_media *call_med)
+{
+    pjmedia_transport *tp;
+    unsigned pool_id;
+    pj_status_t status;
+
+    pool_id = rtp_pool_take(call_med->call->acc_id, &tp);
+    if (tp == NULL) {
+	status = create_udp_transport(call_med->call->acc_id, cfg, &tp);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    call_med->tp = tp;
+    call_med->rtp_pool_id = pool_id;
     call_med->tp_ready = PJ_SUCCESS;
 
     return PJ_SUCCESS;
+}
 
-on_error:
-    if (call_med->tp)
-	pjmedia_transport_close(call_med->tp);
+/* Close the media transport of the call media. The UDP transport of the
+ * RTP pool is returned to the pool instead.
+ */
+static void close_media_tp(pjsua_call_media *call_med)
+{
+    pjmedia_transport *tp = call_med->tp;
+    pjmedia_transport *tp_orig = call_med->tp_orig;
+    unsigned pool_id = call_med->rtp_pool_id;
 
-    return status;
+    call_med->tp = call_med->tp_orig = NULL;
+    call_med->rtp_pool_id = 0;
+
+    if (pool_id == 0) {
+	pjmedia_transport_close(tp);
+	return;
+    }
+
+    /* The SRTP adapter does not close the pooled transport */
+    if (tp_orig && tp_orig != tp)
+	pjmedia_transport_close(tp);
+    else
+	tp_orig = tp;
+
+    rtp_pool_release(call_med->call->acc_id, pool_id, tp_orig);
 }
 
 #if DISABLED_FOR_TICKET_1185
@@ -627,6 +897,41 @@ static void ice_failed_nego_cb(void *user_data)
 
 }
 
+/* The prewarmed ICE transport has gathered its candidates */
+static void ice_prewarm_on_init(pjsua_call_media *med,
+				pjmedia_transport *tp,
+				pj_status_t result)
+{
+    pjsua_ice_prewarm_tp *e;
+    pjsua_rtp_pool *pool;
+
+    e = (pjsua_ice_prewarm_tp*)((char*)med -
+				offsetof(pjsua_ice_prewarm_tp, med));
+    pool = &pjsua_var.acc[e->acc_id].rtp_pool;
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+
+    /* Ignore the transport if the pool has been flushed meanwhile */
+    if (e->pool_id == pool->id && e->med.tp_ready == PJ_EPENDING) {
+	e->med.tp = tp;
+	e->med.tp_ready = result;
+	if (result == PJ_SUCCESS) {
+	    pj_gettickcount(&e->ready);
+	    pj_list_erase(e);
+	    --pool->ice_gathering_cnt;
+	    pj_list_push_back(&pool->ice_ready, e);
+	    ++pool->ice_ready_cnt;
+	}
+    }
+
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    if (result != PJ_SUCCESS) {
+	PJ_PERROR(3,(THIS_FILE, result, "Error gathering prewarmed ICE "
+		     "transport %s", tp->name));
+    }
+}
+
 /* This callback is called when ICE negotiation completes */
 static void on_ice_complete(pjmedia_transport *tp, 
 			    pj_ice_strans_op op,
@@ -639,6 +944,13 @@ static void on_ice_complete(pjmedia_transport *tp,
 	return;
 
     call = call_med->call;
+
+    /* Prewarmed transport that has not been taken by a call yet */
+    if (call == NULL) {
+	if (op == PJ_ICE_STRANS_OP_INIT)
+	    ice_prewarm_on_init(call_med, tp, result);
+	return;
+    }
     
     switch (op) {
     case PJ_ICE_STRANS_OP_INIT:
@@ -718,21 +1030,24 @@ static pj_status_t parse_host_port(const pj_str_t *host_port,
     return PJ_SUCCESS;
 }
 
-/* Create ICE media transports (when ice is enabled) */
-static pj_status_t create_ice_media_transport(
-				const pjsua_transport_config *cfg,
-				pjsua_call_media *call_med,
-                                pj_bool_t async)
+/* Create ICE media transport for the account. The transport reports the
+ * result of the candidate gathering to on_ice_complete(), with call_med as
+ * its user data.
+ */
+static pj_status_t create_ice_transport(pjsua_acc_id acc_id,
+					const pjsua_transport_config *cfg,
+					pjsua_call_media *call_med,
+					const char *name,
+					pjmedia_transport **p_tp)
 {
     char stunip[PJ_INET6_ADDRSTRLEN];
     pjsua_acc_config *acc_cfg;
     pj_ice_strans_cfg ice_cfg;
     pjmedia_ice_cb ice_cb;
-    char name[32];
     unsigned comp_cnt;
     pj_status_t status;
 
-    acc_cfg = &pjsua_var.acc[call_med->call->acc_id].cfg;
+    acc_cfg = &pjsua_var.acc[acc_id].cfg;
 
     /* Make sure STUN server resolution has completed */
     status = resolve_stun_server(PJ_TRUE);
@@ -810,22 +1125,240 @@ static pj_status_t create_ice_media_transport(
 
     pj_bzero(&ice_cb, sizeof(pjmedia_ice_cb));
     ice_cb.on_ice_complete = &on_ice_complete;
-    pj_ansi_snprintf(name, sizeof(name), "icetp%02d", call_med->idx);
-    call_med->tp_ready = PJ_EPENDING;
 
     comp_cnt = 1;
     if (PJMEDIA_ADVERTISE_RTCP && !acc_cfg->ice_cfg.ice_no_rtcp)
 	++comp_cnt;
 
     status = pjmedia_ice_create3(pjsua_var.med_endpt, name, comp_cnt,
-				 &ice_cfg, &ice_cb, 0, call_med,
-				 &call_med->tp);
+				 &ice_cfg, &ice_cb, 0, call_med, p_tp);
     if (status != PJ_SUCCESS) {
 	pjsua_perror(THIS_FILE, "Unable to create ICE media transport",
 		     status);
-	goto on_error;
+	return status;
     }
 
+    return PJ_SUCCESS;
+}
+
+/* Check if the account keeps prewarmed ICE transports in its RTP pool */
+static pj_bool_t ice_prewarm_usable(pjsua_acc_id acc_id)
+{
+    pjsua_acc *acc = &pjsua_var.acc[acc_id];
+
+    return acc->cfg.ice_prewarm_cnt > 0 && acc->cfg.ice_cfg.enable_ice;
+}
+
+/* Start gathering the candidates of a new ICE transport for the RTP pool.
+ * PJSUA_LOCK must be held, so that the pool is not flushed meanwhile.
+ */
+static pj_status_t ice_prewarm_gather(pjsua_acc_id acc_id, unsigned id)
+{
+    pjsua_acc *acc = &pjsua_var.acc[acc_id];
+    pjsua_ice_prewarm_tp *e;
+    pjmedia_transport *tp = NULL;
+    char name[32];
+    pj_status_t status;
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+
+    if (pj_list_empty(&pjsua_var.ice_prewarm_free)) {
+	e = PJ_POOL_ZALLOC_T(pjsua_var.pool, pjsua_ice_prewarm_tp);
+    } else {
+	e = pjsua_var.ice_prewarm_free.next;
+	pj_list_erase(e);
+    }
+
+    pj_bzero(&e->med, sizeof(e->med));
+    e->med.type = PJMEDIA_TYPE_AUDIO;
+    e->med.tp_ready = PJ_EPENDING;
+    e->acc_id = acc_id;
+    e->pool_id = id;
+    pj_list_push_back(&acc->rtp_pool.ice_gathering, e);
+    ++acc->rtp_pool.ice_gathering_cnt;
+
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    /* The gathering may complete before the function returns */
+    pj_ansi_snprintf(name, sizeof(name), "icepw%02d", acc_id);
+    status = create_ice_transport(acc_id, &acc->cfg.rtp_cfg, &e->med,
+				  name, &tp);
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+    if (status == PJ_SUCCESS) {
+	e->med.tp = tp;
+    } else {
+	pj_list_erase(e);
+	--acc->rtp_pool.ice_gathering_cnt;
+	pj_list_push_back(&pjsua_var.ice_prewarm_free, e);
+    }
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    return status;
+}
+
+/* Gather the missing ICE transports of the RTP pool. PJSUA_LOCK must be
+ * held.
+ */
+static void ice_prewarm_fill(pjsua_acc_id acc_id)
+{
+    pjsua_rtp_pool *pool = &pjsua_var.acc[acc_id].rtp_pool;
+    unsigned id, cnt = 0;
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+    id = pool->id;
+    if (id && pool->size > pool->ice_gathering_cnt + pool->ice_ready_cnt)
+	cnt = pool->size - pool->ice_gathering_cnt - pool->ice_ready_cnt;
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    while (cnt--) {
+	if (ice_prewarm_gather(acc_id, id) != PJ_SUCCESS)
+	    break;
+    }
+}
+
+/* Deferred callback to replace the ICE transport taken from the pool */
+static void ice_prewarm_refill_cb(void *user_data)
+{
+    PJSUA_LOCK();
+    ice_prewarm_fill((pjsua_acc_id)(pj_ssize_t)user_data);
+    PJSUA_UNLOCK();
+}
+
+/* Periodic check of the prewarmed ICE transports of the account */
+static void ice_prewarm_timer_cb(pj_timer_heap_t *th, pj_timer_entry *te)
+{
+    pjsua_acc_id acc_id = (pjsua_acc_id)(pj_ssize_t)te->user_data;
+    pjsua_rtp_pool *pool = &pjsua_var.acc[acc_id].rtp_pool;
+    pjsua_ice_prewarm_tp closing, *e, *next;
+    pj_time_val now, delay;
+    pj_status_t status;
+
+    PJ_UNUSED_ARG(th);
+
+    PJSUA_LOCK();
+
+    /* The pool may have been flushed or initialized again meanwhile */
+    if (pool->id == 0 || pj_timer_entry_running(te)) {
+	PJSUA_UNLOCK();
+	return;
+    }
+
+    /* Close the transports that have failed, and the old ones */
+    pj_list_init(&closing);
+    pj_gettickcount(&now);
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+    for (e=pool->ice_gathering.next; e!=&pool->ice_gathering; e=next) {
+	next = e->next;
+	if (e->med.tp_ready != PJ_EPENDING) {
+	    pj_list_erase(e);
+	    --pool->ice_gathering_cnt;
+	    pj_list_push_back(&closing, e);
+	}
+    }
+    while (pool->ice_ready.next != &pool->ice_ready) {
+	e = pool->ice_ready.next;
+	if (now.sec - e->ready.sec < PJSUA_ICE_PREWARM_MAX_AGE)
+	    break;
+	pj_list_erase(e);
+	--pool->ice_ready_cnt;
+	pj_list_push_back(&closing, e);
+	++pool->stat.refreshed;
+    }
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    if (!pj_list_empty(&closing)) {
+	for (e=closing.next; e!=&closing; e=e->next) {
+	    if (e->med.tp)
+		pjmedia_transport_close(e->med.tp);
+	}
+
+	pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+	pj_list_merge_last(&pjsua_var.ice_prewarm_free, &closing);
+	pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+    }
+
+    /* The candidates can be gathered once the STUN server is resolved */
+    delay.sec = PJSUA_ICE_PREWARM_MAX_AGE / 2;
+    delay.msec = 0;
+
+    status = resolve_stun_server(PJ_FALSE);
+    if (status == PJ_SUCCESS)
+	ice_prewarm_fill(acc_id);
+    else if (status == PJ_EPENDING)
+	delay.sec = 1;
+
+    pjsua_schedule_timer(te, &delay);
+
+    PJSUA_UNLOCK();
+}
+
+/* Take a prewarmed ICE transport from the RTP pool of the account for the
+ * call media, and gather its replacement in the background.
+ */
+static pj_bool_t ice_prewarm_take(pjsua_call_media *call_med)
+{
+    pjsua_acc_id acc_id = call_med->call->acc_id;
+    pjsua_rtp_pool *pool = &pjsua_var.acc[acc_id].rtp_pool;
+    pj_bool_t taken = PJ_FALSE;
+
+    if (!ice_prewarm_usable(acc_id))
+	return PJ_FALSE;
+
+    pj_mutex_lock(pjsua_var.rtp_pool_mutex);
+
+    if (pool->id && !pj_list_empty(&pool->ice_ready)) {
+	pjsua_ice_prewarm_tp *e = pool->ice_ready.next;
+
+	pj_list_erase(e);
+	--pool->ice_ready_cnt;
+
+	/* From now on, the ICE callbacks of the transport go to the call */
+	call_med->tp = e->med.tp;
+	call_med->tp->user_data = call_med;
+
+	pj_list_push_back(&pjsua_var.ice_prewarm_free, e);
+	++pool->stat.taken;
+	taken = PJ_TRUE;
+    } else if (pool->id) {
+	++pool->stat.exhausted;
+    }
+
+    pj_mutex_unlock(pjsua_var.rtp_pool_mutex);
+
+    if (taken) {
+	pjsua_schedule_timer2(&ice_prewarm_refill_cb,
+			      (void*)(pj_ssize_t)acc_id, 0);
+    }
+
+    return taken;
+}
+
+/* Create ICE media transports (when ice is enabled), or take a prewarmed
+ * one from the RTP pool of the account.
+ */
+static pj_status_t create_ice_media_transport(
+				const pjsua_transport_config *cfg,
+				pjsua_call_media *call_med,
+                                pj_bool_t async)
+{
+    char name[32];
+    pj_status_t status;
+
+    if (ice_prewarm_take(call_med)) {
+	call_med->tp_result = call_med->tp_ready = PJ_SUCCESS;
+	goto on_ready;
+    }
+
+    pj_ansi_snprintf(name, sizeof(name), "icetp%02d", call_med->idx);
+    call_med->tp_ready = PJ_EPENDING;
+
+    status = create_ice_transport(call_med->call->acc_id, cfg, call_med,
+				  name, &call_med->tp);
+    if (status != PJ_SUCCESS)
+	goto on_error;
+
     /* Wait until transport is initialized, or time out */
     if (!async) {
 	pj_bool_t has_pjsua_lock = PJSUA_LOCK_IS_LOCKED();
@@ -860,6 +1393,7 @@ static pj_status_t create_ice_media_transport(
 	goto on_error;
     }
 
+on_ready:
     pjmedia_transport_simulate_lost(call_med->tp, PJMEDIA_DIR_ENCODING,
 				    pjsua_var.media_cfg.tx_drop_pct);
 
@@ -1246,7 +1780,7 @@ static pj_status_t call_media_init_cb(pjsua_call_media *call_med,
 
 	/* Always create SRTP adapter */
 	pjmedia_srtp_setting_default(&srtp_opt);
-	srtp_opt.close_member_tp = PJ_TRUE;
+	srtp_opt.close_member_tp = (call_med->rtp_pool_id == 0);
 
 	/* If media session has been ever established, let's use remote's 
 	 * preference in SRTP usage policy, especially when it is stricter.
@@ -1283,8 +1817,7 @@ static pj_status_t call_media_init_cb(pjsua_call_media *call_med,
 on_return:
     if (status != PJ_SUCCESS && call_med->tp) {
 	pjsua_set_media_tp_state(call_med, PJSUA_MED_TP_NULL);
-	pjmedia_transport_close(call_med->tp);
-	call_med->tp = NULL;
+	close_media_tp(call_med);
     }
 
     if (sip_err_code)
@@ -1532,8 +2065,7 @@ static void media_prov_clean_up(pjsua_call_id call_id, int idx)
 		pjmedia_transport_media_stop(call_med->tp);
 	    }
 	    pjsua_set_media_tp_state(call_med, PJSUA_MED_TP_NULL);
-	    pjmedia_transport_close(call_med->tp);
-	    call_med->tp = call_med->tp_orig = NULL;
+	    close_media_tp(call_med);
 	}
     }
 }
@@ -1600,7 +2132,10 @@ pj_status_t pjsua_media_channel_init(pjsua_call_id call_id,
     /* Init provisional media state */
     if (call->med_cnt == 0) {
 	/* New media session, just copy whole from call media state. */
-	pj_memcpy(call->media_prov, call->media, sizeof(call->media));
+	if (call->med_max) {
+	    pj_memcpy(call->media_prov, call->media,
+		      sizeof(call->media[0]) * call->med_max);
+	}
     } else {
 	/* Clean up any unused transports. Note that when local SDP reoffer
 	 * is rejected by remote, there may be any initialized transports that
@@ -1735,6 +2270,26 @@ pj_status_t pjsua_media_channel_init(pjsua_call_id call_id,
 	call->rem_offerer = PJ_FALSE;
     }
 
+    /* Make room for the media. The media of the call can only be moved
+     * while the call has no active media, as the media transports refer
+     * to them.
+     */
+    if (call->med_prov_cnt > call->med_max) {
+	if (call->med_cnt == 0)
+	    status = pjsua_call_media_reserve(call, call->med_prov_cnt);
+	else
+	    status = PJ_ETOOMANY;
+
+	if (status != PJ_SUCCESS) {
+	    PJ_PERROR(2,(THIS_FILE, status,
+			 "Call %d: unable to use %d media (capacity is %d)",
+			 call_id, call->med_prov_cnt, call->med_max));
+	    call->med_prov_cnt = call->med_cnt;
+	    if (sip_err_code) *sip_err_code = PJSIP_SC_NOT_ACCEPTABLE_HERE;
+	    goto on_error;
+	}
+    }
+
     if (call->med_prov_cnt == 0) {
 	/* Expecting at least one media */
 	if (sip_err_code) *sip_err_code = PJSIP_SC_NOT_ACCEPTABLE_HERE;
@@ -2294,8 +2849,7 @@ pj_status_t pjsua_media_channel_deinit(pjsua_call_id call_id)
 
 	if (call_med->tp) {
 	    pjsua_set_media_tp_state(call_med, PJSUA_MED_TP_NULL);
-	    pjmedia_transport_close(call_med->tp);
-	    call_med->tp = call_med->tp_orig = NULL;
+	    close_media_tp(call_med);
 	}
         call_med->tp_orig = NULL;
     }
@@ -2594,8 +3148,7 @@ pj_status_t pjsua_media_channel_update(pjsua_call_id call_id,
 	    /* Close the media transport */
 	    if (call_med->tp) {
 		pjsua_set_media_tp_state(call_med, PJSUA_MED_TP_NULL);
-		pjmedia_transport_close(call_med->tp);
-		call_med->tp = call_med->tp_orig = NULL;
+		close_media_tp(call_med);
 	    }
 	    continue;
 #if 0
@@ -2889,8 +3442,7 @@ pj_status_t pjsua_media_channel_update(pjsua_call_id call_id,
 	 */
 	if (local_sdp->media[mi]->desc.port==0 && call_med->tp) {
 	    pjsua_set_media_tp_state(call_med, PJSUA_MED_TP_NULL);
-	    pjmedia_transport_close(call_med->tp);
-	    call_med->tp = call_med->tp_orig = NULL;
+	    close_media_tp(call_med);
 	}
 
 	if (status != PJ_SUCCESS) {
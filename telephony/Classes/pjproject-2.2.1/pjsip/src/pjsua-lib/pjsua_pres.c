@@ -26,6 +26,7 @@
 
 static void subscribe_buddy_presence(pjsua_buddy_id buddy_id);
 static void unsubscribe_buddy_presence(pjsua_buddy_id buddy_id);
+static void sub_refresh_flush(pjsua_acc *acc, pj_bool_t send);
 
 
 /*
@@ -370,6 +371,7 @@ static void reset_buddy(pjsua_buddy_id id)
     pj_bzero(&pjsua_var.buddy[id], sizeof(pjsua_var.buddy[id]));
     pjsua_var.buddy[id].pool = pool;
     pjsua_var.buddy[id].index = id;
+    pjsua_var.buddy[id].acc_id = PJSUA_INVALID_ID;
 }
 
 
@@ -624,7 +626,7 @@ PJ_DEF(void) pjsua_pres_dump(pj_bool_t verbose)
 	
 	int count = 0;
 
-	for (acc_id=0; acc_id<PJ_ARRAY_SIZE(pjsua_var.acc); ++acc_id) {
+	for (acc_id=0; acc_id<pjsua_var.acc_max; ++acc_id) {
 
 	    if (!pjsua_var.acc[acc_id].valid)
 		continue;
@@ -665,7 +667,7 @@ PJ_DEF(void) pjsua_pres_dump(pj_bool_t verbose)
      */
     PJ_LOG(3,(THIS_FILE, "Dumping pjsua server subscriptions:"));
 
-    for (acc_id=0; acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc); ++acc_id) {
+    for (acc_id=0; acc_id<(int)pjsua_var.acc_max; ++acc_id) {
 
 	if (!pjsua_var.acc[acc_id].valid)
 	    continue;
@@ -1059,7 +1061,7 @@ PJ_DEF(pj_status_t) pjsua_pres_notify( pjsua_acc_id acc_id,
     PJ_ASSERT_RETURN(acc_id!=-1 && srv_pres, PJ_EINVAL);
 
     /* Check that account ID is valid */
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc),
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max,
 		     PJ_EINVAL);
     /* Check that account is valid */
     PJ_ASSERT_RETURN(pjsua_var.acc[acc_id].valid, PJ_EINVALIDOP);
@@ -1361,6 +1363,9 @@ pj_status_t pjsua_pres_init_acc(int acc_id)
     /* Init presence subscription */
     pj_list_init(&acc->pres_srv_list);
 
+    /* Init subscription refresh pacing */
+    pjsua_acc_update_sub_refresh(acc_id);
+
     return PJ_SUCCESS;
 }
 
@@ -1431,6 +1436,9 @@ void pjsua_pres_delete_acc(int acc_id, unsigned flags)
 
     /* Terminate presence publication, if any */
     pjsua_pres_unpublish(acc, flags);
+
+    /* Send the refreshes that are still waiting for their turn */
+    sub_refresh_flush(acc, (flags & PJSUA_DESTROY_NO_TX_MSG) == 0);
 }
 
 
@@ -1540,6 +1548,9 @@ static void pjsua_evsub_on_state( pjsip_evsub *sub, pjsip_event *event)
 
     PJ_UNUSED_ARG(event);
 
+    if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED)
+	pjsua_sub_refresh_cancel(sub);
+
     /* Note: #937: no need to acuire PJSUA_LOCK here. Since the buddy has
      *   a dialog attached to it, lock_buddy() will use the dialog
      *   lock, which we are currently holding!
@@ -1761,6 +1772,41 @@ static void pjsua_evsub_on_rx_notify(pjsip_evsub *sub,
 }
 
 
+/* Send presence subscription refresh, called by the refresh queue */
+static void pjsua_evsub_send_refresh(pjsip_evsub *sub)
+{
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    /* Buddy has been unsubscribed while the refresh was queued */
+    if (pjsip_evsub_get_mod_data(sub, pjsua_var.mod.id) == NULL)
+	return;
+
+    status = pjsip_pres_initiate(sub, -1, &tdata);
+    if (status == PJ_SUCCESS) {
+	pjsua_process_msg_data(tdata, NULL);
+	status = pjsip_pres_send_request(sub, tdata);
+    }
+    if (status != PJ_SUCCESS)
+	pjsua_perror(THIS_FILE, "Unable to refresh presence subscription",
+		     status);
+}
+
+
+/* Callback called when it's time to refresh the subscription */
+static void pjsua_evsub_on_client_refresh(pjsip_evsub *sub)
+{
+    pjsua_buddy *buddy;
+
+    buddy = (pjsua_buddy*) pjsip_evsub_get_mod_data(sub, pjsua_var.mod.id);
+    if (!buddy)
+	return;
+
+    pjsua_acc_sub_refresh(buddy->acc_id, sub, buddy->dlg,
+			  &pjsua_evsub_send_refresh);
+}
+
+
 /* It does what it says.. */
 static void subscribe_buddy_presence(pjsua_buddy_id buddy_id)
 {
@@ -1778,9 +1824,11 @@ static void subscribe_buddy_presence(pjsua_buddy_id buddy_id)
     pres_callback.on_evsub_state = &pjsua_evsub_on_state;
     pres_callback.on_tsx_state = &pjsua_evsub_on_tsx_state;
     pres_callback.on_rx_notify = &pjsua_evsub_on_rx_notify;
+    pres_callback.on_client_refresh = &pjsua_evsub_on_client_refresh;
 
     buddy = &pjsua_var.buddy[buddy_id];
     acc_id = pjsua_acc_find_for_outgoing(&buddy->uri);
+    buddy->acc_id = acc_id;
 
     acc = &pjsua_var.acc[acc_id];
 
@@ -1860,6 +1908,8 @@ static void subscribe_buddy_presence(pjsua_buddy_id buddy_id)
 	return;
     }
 
+    pjsip_evsub_set_refresh_jitter(buddy->sub, acc->cfg.sub_refresh_jitter);
+
     /* If account is locked to specific transport, then lock dialog
      * to this transport too.
      */
@@ -1942,6 +1992,9 @@ static void unsubscribe_buddy_presence(pjsua_buddy_id buddy_id)
     PJ_LOG(5,(THIS_FILE, "Buddy %d: unsubscribing..", buddy_id));
     pj_log_push_indent();
 
+    /* Don't let a queued refresh subscribe again */
+    pjsua_sub_refresh_cancel(buddy->sub);
+
     status = pjsip_pres_initiate( buddy->sub, 0, &tdata);
     if (status == PJ_SUCCESS) {
 	pjsua_process_msg_data(tdata, NULL);
@@ -1988,6 +2041,265 @@ static pj_status_t refresh_client_subscriptions(void)
     return PJ_SUCCESS;
 }
 
+/***************************************************************************
+ * Subscription refresh queue
+ *
+ * The refresh timers of client subscriptions fire when their interval is
+ * about to expire, so subscriptions that have been created at the same
+ * time (e.g. after the account has registered again) want to refresh at
+ * the same time. The timers are randomized by the jitter of the account,
+ * and the refreshes are paced with the token bucket of the account: the
+ * refreshes that exceed the rate are queued, and sent by the timer of the
+ * account when their turn comes.
+ *
+ * The queued refresh holds a session of the dialog, and it is sent with
+ * the dialog locked. Lock order is dialog, then sub_refresh_mutex.
+ */
+
+/* Schedule the queue timer for the first refresh in the queue.
+ * sub_refresh_mutex must be held.
+ */
+static void sub_refresh_schedule(pjsua_acc *acc, const pj_time_val *now)
+{
+    pj_time_val delay;
+
+    if (acc->sub_refresh_timer.id || pj_list_empty(&acc->sub_refresh_list))
+	return;
+
+    delay = acc->sub_refresh_list.next->departure;
+    if (PJ_TIME_VAL_GT(delay, *now)) {
+	PJ_TIME_VAL_SUB(delay, *now);
+    } else {
+	delay.sec = delay.msec = 0;
+    }
+
+    if (pjsip_endpt_schedule_timer(pjsua_var.endpt, &acc->sub_refresh_timer,
+				   &delay) == PJ_SUCCESS)
+    {
+	acc->sub_refresh_timer.id = PJ_TRUE;
+    }
+}
+
+/* Send (or drop) the refreshes in the busy list of the account. */
+static void sub_refresh_process(pjsua_acc *acc, pj_bool_t send)
+{
+    for (;;) {
+	pjsua_sub_refresh *r;
+	pjsip_dialog *dlg;
+	pjsip_evsub *sub;
+	pjsua_sub_refresh_cb cb;
+
+	/* Claim the first refresh that no other thread is sending */
+	pj_mutex_lock(pjsua_var.sub_refresh_mutex);
+	r = acc->sub_refresh_busy.next;
+	while (r != &acc->sub_refresh_busy && r->claimed)
+	    r = r->next;
+	if (r == &acc->sub_refresh_busy) {
+	    pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+	    break;
+	}
+	r->claimed = PJ_TRUE;
+	dlg = r->dlg;
+	pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+
+	/* The subscription may be terminated until we have the dialog
+	 * lock, in which case pjsua_sub_refresh_cancel() has cleared it.
+	 */
+	pjsip_dlg_inc_lock(dlg);
+
+	pj_mutex_lock(pjsua_var.sub_refresh_mutex);
+	sub = r->sub;
+	cb = r->cb;
+	pj_list_erase(r);
+	pj_list_push_back(&pjsua_var.sub_refresh_free, r);
+	pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+
+	if (sub && send)
+	    (*cb)(sub);
+
+	pjsip_dlg_dec_lock(dlg);
+	pjsip_dlg_dec_session(dlg, &pjsua_var.mod);
+    }
+}
+
+/* Timer callback to send the refreshes that are due */
+static void sub_refresh_timer_cb(pj_timer_heap_t *th, pj_timer_entry *entry)
+{
+    pjsua_acc *acc = (pjsua_acc*) entry->user_data;
+    pj_time_val now;
+
+    PJ_UNUSED_ARG(th);
+
+    pj_mutex_lock(pjsua_var.sub_refresh_mutex);
+
+    entry->id = PJ_FALSE;
+    pj_gettickcount(&now);
+
+    while (!pj_list_empty(&acc->sub_refresh_list) &&
+	   PJ_TIME_VAL_LTE(acc->sub_refresh_list.next->departure, now))
+    {
+	pjsua_sub_refresh *r = acc->sub_refresh_list.next;
+
+	pj_list_erase(r);
+	pj_list_push_back(&acc->sub_refresh_busy, r);
+    }
+
+    sub_refresh_schedule(acc, &now);
+
+    pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+
+    sub_refresh_process(acc, PJ_TRUE);
+}
+
+/* Queue the refresh of client subscription */
+void pjsua_acc_sub_refresh(pjsua_acc_id acc_id, pjsip_evsub *sub,
+			   pjsip_dialog *dlg, pjsua_sub_refresh_cb cb)
+{
+    pjsua_acc *acc;
+    pjsua_sub_refresh *r;
+    pj_time_val now;
+    unsigned delay;
+
+    if (acc_id < 0 || acc_id >= (int)pjsua_var.acc_max ||
+	pjsua_var.sub_refresh_mutex == NULL)
+    {
+	(*cb)(sub);
+	return;
+    }
+
+    acc = &pjsua_var.acc[acc_id];
+
+    pj_mutex_lock(pjsua_var.sub_refresh_mutex);
+
+    if (!acc->valid) {
+	pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+	(*cb)(sub);
+	return;
+    }
+
+    pj_gettickcount(&now);
+    delay = pjsip_evsub_pacer_reserve(&acc->sub_pacer, &now);
+
+    /* Send now if the rate allows, and nothing is waiting before us */
+    if (delay == 0 && pj_list_empty(&acc->sub_refresh_list)) {
+	pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+	(*cb)(sub);
+	return;
+    }
+
+    if (pj_list_empty(&pjsua_var.sub_refresh_free)) {
+	r = PJ_POOL_ZALLOC_T(pjsua_var.pool, pjsua_sub_refresh);
+    } else {
+	r = pjsua_var.sub_refresh_free.next;
+	pj_list_erase(r);
+    }
+
+    r->sub = sub;
+    r->dlg = dlg;
+    r->cb = cb;
+    r->claimed = PJ_FALSE;
+    r->departure.sec = 0;
+    r->departure.msec = delay;
+    pj_time_val_normalize(&r->departure);
+    PJ_TIME_VAL_ADD(r->departure, now);
+
+    /* Keep the dialog until the refresh is sent */
+    pjsip_dlg_inc_session(dlg, &pjsua_var.mod);
+
+    /* The departure times of the pacer are increasing, so the queue stays
+     * sorted.
+     */
+    pj_list_push_back(&acc->sub_refresh_list, r);
+    sub_refresh_schedule(acc, &now);
+
+    PJ_LOG(5,(THIS_FILE, "Acc %d: subscription refresh queued for %d ms",
+	      acc_id, delay));
+
+    pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+}
+
+/* Remove the queued refresh of the subscription */
+void pjsua_sub_refresh_cancel(pjsip_evsub *sub)
+{
+    pjsip_dialog *dlg = NULL;
+    unsigned i;
+
+    if (pjsua_var.sub_refresh_mutex == NULL)
+	return;
+
+    pj_mutex_lock(pjsua_var.sub_refresh_mutex);
+
+    for (i=0; i<pjsua_var.acc_max && !dlg; ++i) {
+	pjsua_acc *acc = &pjsua_var.acc[i];
+	pjsua_sub_refresh *r;
+
+	for (r=acc->sub_refresh_list.next; r!=&acc->sub_refresh_list;
+	     r=r->next)
+	{
+	    if (r->sub == sub) {
+		dlg = r->dlg;
+		pj_list_erase(r);
+		pj_list_push_back(&pjsua_var.sub_refresh_free, r);
+		break;
+	    }
+	}
+
+	/* The thread that sends it releases the dialog */
+	for (r=acc->sub_refresh_busy.next; r!=&acc->sub_refresh_busy;
+	     r=r->next)
+	{
+	    if (r->sub == sub)
+		r->sub = NULL;
+	}
+    }
+
+    pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+
+    /* We're holding the dialog lock, so the dialog is not destroyed yet */
+    if (dlg)
+	pjsip_dlg_dec_session(dlg, &pjsua_var.mod);
+}
+
+/* Apply subscription refresh settings of the account */
+void pjsua_acc_update_sub_refresh(pjsua_acc_id acc_id)
+{
+    pjsua_acc *acc = &pjsua_var.acc[acc_id];
+
+    if (pjsua_var.sub_refresh_mutex == NULL)
+	return;
+
+    pj_mutex_lock(pjsua_var.sub_refresh_mutex);
+    pjsip_evsub_pacer_init(&acc->sub_pacer, acc->cfg.sub_refresh_rate,
+			   acc->cfg.sub_refresh_burst);
+    pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+}
+
+/* Send or drop the queued refreshes of the account */
+static void sub_refresh_flush(pjsua_acc *acc, pj_bool_t send)
+{
+    if (pjsua_var.sub_refresh_mutex == NULL)
+	return;
+
+    pj_mutex_lock(pjsua_var.sub_refresh_mutex);
+
+    if (acc->sub_refresh_timer.id) {
+	pjsip_endpt_cancel_timer(pjsua_var.endpt, &acc->sub_refresh_timer);
+	acc->sub_refresh_timer.id = PJ_FALSE;
+    }
+
+    while (!pj_list_empty(&acc->sub_refresh_list)) {
+	pjsua_sub_refresh *r = acc->sub_refresh_list.next;
+
+	pj_list_erase(r);
+	pj_list_push_back(&acc->sub_refresh_busy, r);
+    }
+
+    pj_mutex_unlock(pjsua_var.sub_refresh_mutex);
+
+    sub_refresh_process(acc, send);
+}
+
+
 /***************************************************************************
  * MWI
  */
@@ -1998,6 +2310,9 @@ static void mwi_evsub_on_state( pjsip_evsub *sub, pjsip_event *event)
 
     PJ_UNUSED_ARG(event);
 
+    if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED)
+	pjsua_sub_refresh_cancel(sub);
+
     /* Note: #937: no need to acuire PJSUA_LOCK here. Since the buddy has
      *   a dialog attached to it, lock_buddy() will use the dialog
      *   lock, which we are currently holding!
@@ -2061,6 +2376,38 @@ static void mwi_evsub_on_rx_notify(pjsip_evsub *sub,
     pj_log_pop_indent();
 }
 
+/* Send MWI subscription refresh, called by the refresh queue */
+static void mwi_evsub_send_refresh(pjsip_evsub *sub)
+{
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    /* MWI has been disabled while the refresh was queued */
+    if (pjsip_evsub_get_mod_data(sub, pjsua_var.mod.id) == NULL)
+	return;
+
+    status = pjsip_mwi_initiate(sub, -1, &tdata);
+    if (status == PJ_SUCCESS) {
+	pjsua_process_msg_data(tdata, NULL);
+	status = pjsip_mwi_send_request(sub, tdata);
+    }
+    if (status != PJ_SUCCESS)
+	pjsua_perror(THIS_FILE, "Unable to refresh MWI subscription", status);
+}
+
+/* Callback called when it's time to refresh the subscription */
+static void mwi_evsub_on_client_refresh(pjsip_evsub *sub)
+{
+    pjsua_acc *acc;
+
+    acc = (pjsua_acc*) pjsip_evsub_get_mod_data(sub, pjsua_var.mod.id);
+    if (!acc)
+	return;
+
+    pjsua_acc_sub_refresh(acc->index, sub, acc->mwi_dlg,
+			  &mwi_evsub_send_refresh);
+}
+
 
 /* Event subscription callback. */
 static pjsip_evsub_user mwi_cb = 
@@ -2073,8 +2420,8 @@ static pjsip_evsub_user mwi_cb =
 
     &mwi_evsub_on_rx_notify,
 
-    NULL,   /* on_client_refresh: Use default behaviour, which is to 
-	     * refresh client subscription. */
+    &mwi_evsub_on_client_refresh, /* on_client_refresh: paced by the
+				   * account */
 
     NULL,   /* on_server_timeout: Use default behaviour, which is to send 
 	     * NOTIFY to terminate. 
@@ -2091,7 +2438,7 @@ pj_status_t pjsua_start_mwi(pjsua_acc_id acc_id, pj_bool_t force_renew)
 
     PJ_LOG(5,(THIS_FILE, "acc_id %d: pjsua_var.acc[acc_id].valid %d", pjsua_var.acc[acc_id].valid));
     
-    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)PJ_ARRAY_SIZE(pjsua_var.acc)
+    PJ_ASSERT_RETURN(acc_id>=0 && acc_id<(int)pjsua_var.acc_max
                      && pjsua_var.acc[acc_id].valid, PJ_EINVAL);
 
     acc = &pjsua_var.acc[acc_id];
@@ -2196,6 +2543,8 @@ pj_status_t pjsua_start_mwi(pjsua_acc_id acc_id, pj_bool_t force_renew)
 	goto on_return;
     }
 
+    pjsip_evsub_set_refresh_jitter(acc->mwi_sub, acc->cfg.sub_refresh_jitter);
+
     /* If account is locked to specific transport, then lock dialog
      * to this transport too.
      */
@@ -2357,7 +2706,7 @@ static void pres_timer_cb(pj_timer_heap_t *th,
     entry->id = PJ_FALSE;
 
     /* Retry failed PUBLISH and MWI SUBSCRIBE requests */
-    for (i=0; i<PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+    for (i=0; i<pjsua_var.acc_max; ++i) {
 	pjsua_acc *acc = &pjsua_var.acc[i];
 
 	/* Acc may not be ready yet, otherwise assertion will happen */
@@ -2403,6 +2752,26 @@ pj_status_t pjsua_pres_init()
 	reset_buddy(i);
     }
 
+    /* Init subscription refresh queues */
+    if (status == PJ_SUCCESS) {
+	status = pj_mutex_create_recursive(pjsua_var.pool, "pjsua_subref",
+					   &pjsua_var.sub_refresh_mutex);
+	if (status != PJ_SUCCESS) {
+	    pjsua_perror(THIS_FILE, "Unable to create mutex", status);
+	    return status;
+	}
+    }
+
+    pj_list_init(&pjsua_var.sub_refresh_free);
+    for (i=0; i<pjsua_var.acc_max; ++i) {
+	pjsua_acc *acc = &pjsua_var.acc[i];
+
+	pj_list_init(&acc->sub_refresh_list);
+	pj_list_init(&acc->sub_refresh_busy);
+	pj_timer_entry_init(&acc->sub_refresh_timer, PJ_FALSE, acc,
+			    &sub_refresh_timer_cb);
+    }
+
     return status;
 }
 
@@ -2449,7 +2818,7 @@ void pjsua_pres_shutdown(unsigned flags)
 	pjsua_var.pres_timer.id = PJ_FALSE;
     }
 
-    for (i=0; i<PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+    for (i=0; i<pjsua_var.acc_max; ++i) {
 	if (!pjsua_var.acc[i].valid)
 	    continue;
 	pjsua_pres_delete_acc(i, flags);
@@ -2462,7 +2831,7 @@ void pjsua_pres_shutdown(unsigned flags)
     if ((flags & PJSUA_DESTROY_NO_TX_MSG) == 0) {
 	refresh_client_subscriptions();
 
-	for (i=0; i<PJ_ARRAY_SIZE(pjsua_var.acc); ++i) {
+	for (i=0; i<pjsua_var.acc_max; ++i) {
 	    if (pjsua_var.acc[i].valid)
 		pjsua_pres_update_acc(i, PJ_FALSE);
 	}
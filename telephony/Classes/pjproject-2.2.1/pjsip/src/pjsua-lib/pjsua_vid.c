@@ -1532,7 +1532,7 @@ static pj_status_t call_add_video(pjsua_call *call,
     pj_status_t status;
 
     /* Verify media slot availability */
-    if (call->med_cnt == PJSUA_MAX_CALL_MEDIA)
+    if (call->med_cnt >= call->med_max)
 	return PJ_ETOOMANY;
 
     if (pjsua_call_media_is_changing(call)) {
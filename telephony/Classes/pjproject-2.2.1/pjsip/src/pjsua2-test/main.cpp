@@ -17,9 +17,117 @@
  * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
  */
 #include <pjsua2/endpoint.hpp>
+#include <pjsua2/account.hpp>
+#include <pjsua2/call.hpp>
 
 using namespace pj;
 
+#define THIS_FILE	"main.cpp"
+
+/* Number of simulated incoming calls in the callback benchmark */
+#define CB_BENCH_COUNT	20000
+
+static const char *invite_msg =
+    "INVITE sip:bob@127.0.0.1 SIP/2.0\r\n"
+    "Via: SIP/2.0/UDP 127.0.0.1:5080;rport;branch=z9hG4bKcbbench\r\n"
+    "Max-Forwards: 70\r\n"
+    "From: <sip:alice@127.0.0.1>;tag=cbbench\r\n"
+    "To: <sip:bob@127.0.0.1>\r\n"
+    "Contact: <sip:alice@127.0.0.1:5080>\r\n"
+    "Call-ID: cbbench@127.0.0.1\r\n"
+    "CSeq: 1 INVITE\r\n"
+    "Allow: PRACK, INVITE, ACK, BYE, CANCEL, UPDATE, INFO, SUBSCRIBE, "
+    "NOTIFY, REFER, MESSAGE, OPTIONS\r\n"
+    "Supported: replaces, 100rel, timer, norefersub\r\n"
+    "Session-Expires: 1800\r\n"
+    "Min-SE: 90\r\n"
+    "Content-Type: application/sdp\r\n"
+    "Content-Length: 228\r\n"
+    "\r\n"
+    "v=0\r\n"
+    "o=- 3587145226 3587145226 IN IP4 127.0.0.1\r\n"
+    "s=pjmedia\r\n"
+    "b=AS:84\r\n"
+    "t=0 0\r\n"
+    "a=X-nat:0\r\n"
+    "m=audio 4000 RTP/AVP 0 8 101\r\n"
+    "c=IN IP4 127.0.0.1\r\n"
+    "a=rtpmap:0 PCMU/8000\r\n"
+    "a=rtpmap:8 PCMA/8000\r\n"
+    "a=rtpmap:101 telephone-event/8000\r\n"
+    "a=sendrecv\r\n";
+
+/*
+ * Measure the cost of converting the callback parameters of one incoming
+ * call: the INVITE given to onIncomingCall() and the 180 response given to
+ * onCallState() in the SipEvent.
+ */
+static void cb_bench(bool read_msg)
+{
+    pj_pool_t *pool;
+    pjsip_rx_data *rdata;
+    pjsip_tx_data *tdata;
+    pj_sockaddr_in *src;
+    pj_str_t host = pj_str((char*)"127.0.0.1");
+    pj_timestamp t0, t1;
+    pj_size_t total = 0;
+    int len;
+
+    pool = pjsua_pool_create("cbbench", 4000, 4000);
+    rdata = PJ_POOL_ZALLOC_T(pool, pjsip_rx_data);
+    rdata->tp_info.pool = pool;
+    len = pj_ansi_snprintf(rdata->pkt_info.packet,
+			   sizeof(rdata->pkt_info.packet), "%s", invite_msg);
+    rdata->pkt_info.len = len;
+    src = &rdata->pkt_info.src_addr.ipv4;
+    pj_sockaddr_in_init(src, &host, 5080);
+    rdata->pkt_info.src_addr_len = sizeof(*src);
+    pj_list_init(&rdata->msg_info.parse_err);
+    rdata->msg_info.msg_buf = rdata->pkt_info.packet;
+    rdata->msg_info.len = len;
+
+    if (!pjsip_parse_rdata(rdata->msg_info.msg_buf, rdata->msg_info.len,
+			   rdata) ||
+	!pj_list_empty(&rdata->msg_info.parse_err) ||
+	pjsip_endpt_create_response(pjsua_get_pjsip_endpt(), rdata, 180,
+				    NULL, &tdata) != PJ_SUCCESS)
+    {
+	PJ_LOG(1,(THIS_FILE, "Error creating the benchmark messages"));
+	pj_pool_release(pool);
+	return;
+    }
+
+    pj_get_timestamp(&t0);
+    for (unsigned i = 0; i < CB_BENCH_COUNT; ++i) {
+	OnIncomingCallParam call_prm;
+	OnCallStateParam state_prm;
+	pjsip_event e;
+
+	call_prm.callId = 0;
+	call_prm.rdata.fromPj(*rdata);
+
+	PJSIP_EVENT_INIT_TX_MSG(e, tdata);
+	state_prm.e.fromPj(e);
+
+	if (read_msg) {
+	    total += call_prm.rdata.getWholeMsg().size();
+	    total += state_prm.e.body.txMsg.tdata.getWholeMsg().size();
+	}
+    }
+    pj_get_timestamp(&t1);
+
+    PJ_LOG(3,(THIS_FILE, "Callback parameters of %d incoming calls%s: "
+	      "%u ns per call (wholeMsg %s)", CB_BENCH_COUNT,
+	      (read_msg ? ", reading the messages" : ""),
+	      (unsigned)((pj_uint64_t)pj_elapsed_usec(&t0, &t1) * 1000 /
+			 CB_BENCH_COUNT),
+	      (PJSUA2_SIP_DATA_HAS_WHOLE_MSG ? "filled" : "on demand")));
+    PJ_UNUSED_ARG(total);
+
+    pjsip_tx_data_dec_ref(tdata);
+    pj_pool_release(pool);
+}
+
 int main(int argc, char *argv[])
 {
     Endpoint ep;
@@ -31,8 +139,11 @@ int main(int argc, char *argv[])
     ep.libCreate();
     ep.libInit(epCfg);
     ep.libStart();
+
+    cb_bench(false);
+    cb_bench(true);
+
     ep.libDestroy();
 
     return 0;
 }
-
@@ -82,7 +82,7 @@ void AccountSipConfig::readObject(const ContainerNode &node) throw(Error)
     while (creds_node.hasUnread()) {
 	AuthCredInfo cred;
 	cred.readObject(creds_node);
-	authCreds.push_back(cred);
+	authCreds.push_back(PJSUA2_MOVE(cred));
     }
 }
 
@@ -475,7 +475,7 @@ void AccountConfig::fromPj(const pjsua_acc_config &prm,
 	SipHeader new_hdr;
 	new_hdr.fromPj(hdr);
 
-	regConfig.headers.push_back(new_hdr);
+	regConfig.headers.push_back(PJSUA2_MOVE(new_hdr));
 
 	hdr = hdr->next;
     }
@@ -495,7 +495,7 @@ void AccountConfig::fromPj(const pjsua_acc_config &prm,
 	cred.akaOp	= pj2Str(src.ext.aka.op);
 	cred.akaAmf	= pj2Str(src.ext.aka.amf);
 
-	sipConfig.authCreds.push_back(cred);
+	sipConfig.authCreds.push_back(PJSUA2_MOVE(cred));
     }
     sipConfig.proxies.clear();
     for (i=0; i<prm.proxy_cnt; ++i) {
@@ -521,7 +521,7 @@ void AccountConfig::fromPj(const pjsua_acc_config &prm,
     while (hdr != &prm.sub_hdr_list) {
 	SipHeader new_hdr;
 	new_hdr.fromPj(hdr);
-	presConfig.headers.push_back(new_hdr);
+	presConfig.headers.push_back(PJSUA2_MOVE(new_hdr));
 	hdr = hdr->next;
     }
     presConfig.publishEnabled	= PJ2BOOL(prm.publish_enabled);
@@ -268,13 +268,13 @@ void CallInfo::fromPj(const pjsua_call_info &pci)
         CallMediaInfo med;
         
         med.fromPj(pci.media[mi]);
-        media.push_back(med);
+        media.push_back(PJSUA2_MOVE(med));
     }
     for (mi = 0; mi < pci.prov_media_cnt; mi++) {
         CallMediaInfo med;
         
         med.fromPj(pci.prov_media[mi]);
-        provMedia.push_back(med);
+        provMedia.push_back(PJSUA2_MOVE(med));
     }
 }
 
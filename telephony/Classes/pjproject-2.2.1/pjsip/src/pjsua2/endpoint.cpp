@@ -58,6 +58,7 @@ void UaConfig::fromPj(const pjsua_config &ua_cfg)
     unsigned i;
 
     this->maxCalls = ua_cfg.max_calls;
+    this->maxAcc = ua_cfg.max_acc;
     this->threadCnt = ua_cfg.thread_cnt;
     this->userAgent = pj2Str(ua_cfg.user_agent);
 
@@ -82,6 +83,7 @@ pjsua_config UaConfig::toPj() const
     pjsua_config_default(&pua_cfg);
 
     pua_cfg.max_calls = this->maxCalls;
+    pua_cfg.max_acc = this->maxAcc;
     pua_cfg.thread_cnt = this->threadCnt;
     pua_cfg.user_agent = str2Pj(this->userAgent);
 
@@ -110,6 +112,7 @@ void UaConfig::readObject(const ContainerNode &node) throw(Error)
     ContainerNode this_node = node.readContainer("UaConfig");
 
     NODE_READ_UNSIGNED( this_node, maxCalls);
+    NODE_READ_UNSIGNED( this_node, maxAcc);
     NODE_READ_UNSIGNED( this_node, threadCnt);
     NODE_READ_BOOL    ( this_node, mainThreadOnly);
     NODE_READ_STRINGV ( this_node, nameserver);
@@ -125,6 +128,7 @@ void UaConfig::writeObject(ContainerNode &node) const throw(Error)
     ContainerNode this_node = node.writeNewContainer("UaConfig");
 
     NODE_WRITE_UNSIGNED( this_node, maxCalls);
+    NODE_WRITE_UNSIGNED( this_node, maxAcc);
     NODE_WRITE_UNSIGNED( this_node, threadCnt);
     NODE_WRITE_BOOL    ( this_node, mainThreadOnly);
     NODE_WRITE_STRINGV ( this_node, nameserver);
@@ -608,12 +612,11 @@ void Endpoint::on_incoming_call(pjsua_acc_id acc_id, pjsua_call_id call_id,
 
     acc->onIncomingCall(prm);
 
-    /* disconnect if callback doesn't handle the call */
-    pjsua_call_info ci;
-
-    pjsua_call_get_info(call_id, &ci);
+    /* disconnect if callback doesn't handle the call, the full call info
+     * is not needed to check the state.
+     */
     if (!pjsua_call_get_user_data(call_id) &&
-	ci.state != PJSIP_INV_STATE_DISCONNECTED)
+	pjsua_call_is_active(call_id))
     {
 	pjsua_call_hangup(call_id, PJSIP_SC_INTERNAL_SERVER_ERROR, NULL, NULL);
     }
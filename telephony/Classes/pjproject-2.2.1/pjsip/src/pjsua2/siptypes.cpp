@@ -83,7 +83,7 @@ void readSipHeaders( const ContainerNode &node,
 	ContainerNode header_node = headers_node.readContainer("header");
 	hdr.hName = header_node.readString("hname");
 	hdr.hValue = header_node.readString("hvalue");
-	headers.push_back(hdr);
+	headers.push_back(PJSUA2_MOVE(hdr));
     }
 }
 
@@ -332,12 +332,25 @@ void SipRxData::fromPj(pjsip_rx_data &rdata)
     char straddr[PJ_INET6_ADDRSTRLEN+10];
 
     info	= pjsip_rx_data_get_info(&rdata);
+#if PJSUA2_SIP_DATA_HAS_WHOLE_MSG
     wholeMsg	= string(rdata.msg_info.msg_buf, rdata.msg_info.len);
+#else
+    wholeMsg.clear();
+#endif
     pj_sockaddr_print(&rdata.pkt_info.src_addr, straddr, sizeof(straddr), 3);
     srcAddress  = straddr;
     pjRxData    = (void *)&rdata;
 }
 
+string SipRxData::getWholeMsg() const
+{
+    if (wholeMsg.empty() && pjRxData) {
+	const pjsip_rx_data *rdata = (const pjsip_rx_data *)pjRxData;
+	return string(rdata->msg_info.msg_buf, rdata->msg_info.len);
+    }
+    return wholeMsg;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 
 void SipMediaType::fromPj(const pjsip_media_type &prm)
@@ -400,7 +413,7 @@ void SipMultipartPart::fromPj(const pjsip_multipart_part &prm) throw(Error)
     while (pj_hdr != &prm.hdr) {
 	SipHeader sh;
 	sh.fromPj(pj_hdr);
-	headers.push_back(sh);
+	headers.push_back(PJSUA2_MOVE(sh));
 	pj_hdr = pj_hdr->next;
     }
 
@@ -489,8 +502,12 @@ void SipTxData::fromPj(pjsip_tx_data &tdata)
     char straddr[PJ_INET6_ADDRSTRLEN+10];
     
     info	= pjsip_tx_data_get_info(&tdata);
+#if PJSUA2_SIP_DATA_HAS_WHOLE_MSG
     pjsip_tx_data_encode(&tdata);
     wholeMsg	= string(tdata.buf.start, tdata.buf.end - tdata.buf.start);
+#else
+    wholeMsg.clear();
+#endif
     if (pj_sockaddr_has_addr(&tdata.tp_info.dst_addr)) {
 	pj_sockaddr_print(&tdata.tp_info.dst_addr, straddr, sizeof(straddr), 3);
 	dstAddress  = straddr;
@@ -500,6 +517,17 @@ void SipTxData::fromPj(pjsip_tx_data &tdata)
     pjTxData    = (void *)&tdata;
 }
 
+string SipTxData::getWholeMsg() const
+{
+    if (wholeMsg.empty() && pjTxData) {
+	pjsip_tx_data *tdata = (pjsip_tx_data *)pjTxData;
+
+	pjsip_tx_data_encode(tdata);
+	return string(tdata->buf.start, tdata->buf.end - tdata->buf.start);
+    }
+    return wholeMsg;
+}
+
 SipTransaction::SipTransaction()
 : role(PJSIP_ROLE_UAC), statusCode(0), pjTransaction(NULL)
 {
@@ -534,7 +562,7 @@ void SipTxOption::fromPj(const pjsua_msg_data &prm) throw(Error)
     while (pj_hdr != &prm.hdr_list) {
 	SipHeader sh;
 	sh.fromPj(pj_hdr);
-	headers.push_back(sh);
+	headers.push_back(PJSUA2_MOVE(sh));
 	pj_hdr = pj_hdr->next;
     }
 
@@ -547,7 +575,7 @@ void SipTxOption::fromPj(const pjsua_msg_data &prm) throw(Error)
     while (pj_mp != &prm.multipart_parts) {
 	SipMultipartPart smp;
 	smp.fromPj(*pj_mp);
-	multipartParts.push_back(smp);
+	multipartParts.push_back(PJSUA2_MOVE(smp));
 	pj_mp = pj_mp->next;
     }
 }
@@ -22,6 +22,13 @@
 
 #define PJ2BOOL(var) ((var) != PJ_FALSE)
 
+#if PJSUA2_HAS_MOVE
+#   include <utility>
+#   define PJSUA2_MOVE(var) std::move(var)
+#else
+#   define PJSUA2_MOVE(var) (var)
+#endif
+
 namespace pj
 {
 using std::string;
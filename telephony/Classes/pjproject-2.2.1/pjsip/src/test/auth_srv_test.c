@@ -0,0 +1,584 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjlib.h>
+
+#define THIS_FILE   "auth_srv_test.c"
+
+#define REALM	    "pjsip.org"
+#define USER	    "alice"
+#define PASSWD	    "secret"
+#define NONCE	    "9ae9a4f6b2b0e9ed"
+#define URI	    "sip:pjsip.org"
+
+/* Delay of the stand-in credential store, in msec */
+#define STORE_DELAY 100
+
+
+/*
+ * A stand-in for a remote credential store, which completes the lookup
+ * after some delay from the endpoint's timer.
+ */
+static struct store
+{
+    pj_timer_entry	     timer;
+    pjsip_auth_srv_async_op *op;
+    pj_str_t		     acc_name;
+    char		     acc_buf[32];
+    unsigned		     lookup_cnt;
+} store;
+
+/* The result of the asynchronous verification */
+static struct result
+{
+    unsigned		     cb_cnt;
+    pj_status_t		     status;
+    int			     status_code;
+} result;
+
+
+static void store_timer_cb(pj_timer_heap_t *th, pj_timer_entry *entry)
+{
+    pjsip_auth_srv_async_op *op = store.op;
+
+    PJ_UNUSED_ARG(th);
+    PJ_UNUSED_ARG(entry);
+
+    store.op = NULL;
+
+    if (pj_strcmp2(&store.acc_name, USER) == 0) {
+	pjsip_cred_info cred;
+
+	pj_bzero(&cred, sizeof(cred));
+	cred.realm = pj_str(REALM);
+	cred.username = pj_str(USER);
+	cred.data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+	cred.data = pj_str(PASSWD);
+	pjsip_auth_srv_lookup_complete(op, PJ_SUCCESS, &cred);
+    } else {
+	pjsip_auth_srv_lookup_complete(op, PJSIP_EAUTHACCNOTFOUND, NULL);
+    }
+}
+
+static pj_status_t store_lookup(const pjsip_auth_lookup_cred_param *param,
+				pjsip_auth_srv_async_op *op)
+{
+    pj_time_val delay = { 0, STORE_DELAY };
+
+    /* Request must be valid for the duration of the lookup */
+    PJ_ASSERT_RETURN(param->rdata && param->rdata->msg_info.msg, PJ_EBUG);
+
+    if (store.op)
+	return PJ_EBUSY;
+
+    ++store.lookup_cnt;
+    store.op = op;
+    pj_strncpy(&store.acc_name, &param->acc_name, sizeof(store.acc_buf));
+
+    pj_timer_entry_init(&store.timer, 0, NULL, &store_timer_cb);
+    pjsip_endpt_schedule_timer(endpt, &store.timer, &delay);
+
+    return PJ_EPENDING;
+}
+
+static void verify_cb(pjsip_auth_srv *auth_srv, pjsip_rx_data *rdata,
+		      void *user_data, pj_status_t status, int status_code)
+{
+    PJ_UNUSED_ARG(auth_srv);
+    PJ_UNUSED_ARG(user_data);
+
+    if (rdata->msg_info.msg->line.req.method.id != PJSIP_REGISTER_METHOD)
+	status = PJ_EBUG;
+
+    ++result.cb_cnt;
+    result.status = status;
+    result.status_code = status_code;
+}
+
+
+/* Create the request, with Authorization header for the specified
+ * account and password, or without it if acc_name is NULL. The nonce
+ * count and qop are only included when nc is not NULL.
+ */
+static pjsip_rx_data *create_rdata2(pj_pool_t *pool, pjsip_transport *tp,
+				    const char *acc_name, const char *passwd,
+				    const pj_str_t *nonce, const char *nc)
+{
+    pjsip_rx_data *rdata;
+    char auth[320];
+    int len;
+
+    auth[0] = '\0';
+    if (acc_name) {
+	pjsip_cred_info cred;
+	pj_str_t uri = pj_str(URI);
+	pj_str_t realm = pj_str(REALM);
+	pj_str_t method = pj_str("REGISTER");
+	pj_str_t cnonce = pj_str("c0ffee"), qop = pj_str("auth");
+	pj_str_t nc_str;
+	char digest_buf[PJSIP_MD5STRLEN];
+	char qop_buf[64];
+	pj_str_t digest;
+
+	pj_bzero(&cred, sizeof(cred));
+	cred.realm = realm;
+	cred.username = pj_str((char*)acc_name);
+	cred.data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+	cred.data = pj_str((char*)passwd);
+
+	digest.ptr = digest_buf;
+	digest.slen = PJSIP_MD5STRLEN;
+	qop_buf[0] = '\0';
+	if (nc) {
+	    nc_str = pj_str((char*)nc);
+	    pjsip_auth_create_digest(&digest, nonce, &nc_str, &cnonce, &qop,
+				     &uri, &realm, &cred, &method);
+	    pj_ansi_snprintf(qop_buf, sizeof(qop_buf),
+			     ", qop=auth, nc=%s, cnonce=\"c0ffee\"", nc);
+	} else {
+	    pjsip_auth_create_digest(&digest, nonce, NULL, NULL, NULL, &uri,
+				     &realm, &cred, &method);
+	}
+
+	pj_ansi_snprintf(auth, sizeof(auth),
+			 "Authorization: Digest username=\"%s\", "
+			 "realm=\"" REALM "\", nonce=\"%.*s\", "
+			 "uri=\"" URI "\", response=\"%.*s\", "
+			 "algorithm=MD5%s\r\n",
+			 acc_name, (int)nonce->slen, nonce->ptr,
+			 (int)digest.slen, digest.ptr, qop_buf);
+    }
+
+    rdata = PJ_POOL_ZALLOC_T(pool, pjsip_rx_data);
+    rdata->tp_info.pool = pool;
+    rdata->tp_info.transport = tp;
+    len = pj_ansi_snprintf(rdata->pkt_info.packet,
+			   sizeof(rdata->pkt_info.packet),
+			   "REGISTER " URI " SIP/2.0\r\n"
+			   "Via: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bKauth\r\n"
+			   "From: <sip:" USER "@" REALM ">;tag=1234\r\n"
+			   "To: <sip:" USER "@" REALM ">\r\n"
+			   "Call-ID: auth-srv-test\r\n"
+			   "CSeq: 1 REGISTER\r\n"
+			   "%s"
+			   "Content-Length: 0\r\n"
+			   "\r\n",
+			   auth);
+    rdata->pkt_info.len = len;
+    pj_list_init(&rdata->msg_info.parse_err);
+    rdata->msg_info.msg_buf = rdata->pkt_info.packet;
+    rdata->msg_info.len = len;
+
+    if (!pjsip_parse_rdata(rdata->msg_info.msg_buf, rdata->msg_info.len,
+			   rdata) ||
+	!pj_list_empty(&rdata->msg_info.parse_err))
+    {
+	return NULL;
+    }
+
+    return rdata;
+}
+
+static pjsip_rx_data *create_rdata(pj_pool_t *pool, pjsip_transport *tp,
+				   const char *acc_name, const char *passwd)
+{
+    pj_str_t nonce = pj_str(NONCE);
+    return create_rdata2(pool, tp, acc_name, passwd, &nonce, NULL);
+}
+
+
+/* Verify asynchronously and wait for the result */
+static int verify(pjsip_auth_srv *auth_srv, pjsip_rx_data *rdata,
+		  pj_status_t *p_status, int *p_code, pj_bool_t *p_pending)
+{
+    pj_time_val timeout;
+    int code = 0;
+    pj_status_t status;
+
+    pj_bzero(&result, sizeof(result));
+    status = pjsip_auth_srv_verify_async(auth_srv, rdata, NULL, &verify_cb,
+					 &code);
+    *p_pending = (status == PJ_EPENDING);
+    if (status != PJ_EPENDING) {
+	*p_status = status;
+	*p_code = code;
+	return (result.cb_cnt == 0) ? 0 : -1;
+    }
+
+    /* Callback must not be called before the store completes */
+    if (result.cb_cnt != 0)
+	return -2;
+
+    pj_gettickcount(&timeout);
+    timeout.sec += 5;
+    while (result.cb_cnt == 0) {
+	pj_time_val now, delay = { 0, 10 };
+
+	pjsip_endpt_handle_events(endpt, &delay);
+	pj_gettickcount(&now);
+	if (PJ_TIME_VAL_GT(now, timeout))
+	    return -3;
+    }
+
+    if (result.cb_cnt != 1)
+	return -4;
+
+    *p_status = result.status;
+    *p_code = result.status_code;
+    return 0;
+}
+
+
+/* Synchronous lookup for the nonce test */
+static unsigned sync_lookup_cnt;
+
+static pj_status_t sync_lookup(pj_pool_t *pool, const pj_str_t *realm,
+			       const pj_str_t *acc_name,
+			       pjsip_cred_info *cred_info)
+{
+    PJ_UNUSED_ARG(pool);
+
+    ++sync_lookup_cnt;
+    if (pj_strcmp2(acc_name, USER) != 0)
+	return PJSIP_EAUTHACCNOTFOUND;
+
+    pj_bzero(cred_info, sizeof(*cred_info));
+    cred_info->realm = *realm;
+    cred_info->username = pj_str(USER);
+    cred_info->data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+    cred_info->data = pj_str(PASSWD);
+    return PJ_SUCCESS;
+}
+
+
+/* Verify the request with the nonce and check the result */
+static int verify_nonce(pjsip_auth_srv *auth_srv, pj_pool_t *pool,
+			pjsip_transport *tp, const char *passwd,
+			const pj_str_t *nonce, const char *nc,
+			pj_status_t expected_status, int expected_code)
+{
+    pjsip_rx_data *rdata;
+    pj_status_t status;
+    int code = 0;
+
+    rdata = create_rdata2(pool, tp, USER, passwd, nonce, nc);
+    if (!rdata)
+	return -1;
+
+    status = pjsip_auth_srv_verify(auth_srv, rdata, &code);
+    if (status != expected_status || code != expected_code) {
+	PJ_LOG(3,(THIS_FILE, "   error: nc=%s: got status %d code %d",
+		  (nc ? nc : "none"), status, code));
+	return -2;
+    }
+    return 0;
+}
+
+
+/* Nonce store: issued nonces are reusable until they expire, unknown
+ * nonces and replayed nonce counts are rejected as stale.
+ */
+static int nonce_test(pj_pool_t *pool, pjsip_transport *tp)
+{
+    pjsip_auth_srv auth_srv;
+    pjsip_auth_srv_init_param param;
+    pjsip_auth_srv_nonce_store *nonce_store = NULL;
+    pjsip_rx_data *noauth;
+    pjsip_tx_data *tdata = NULL;
+    pjsip_www_authenticate_hdr *hdr;
+    pj_str_t realm = pj_str(REALM);
+    pj_str_t unknown = pj_str(NONCE);
+    pj_str_t nonce;
+    char nonce_buf[PJSIP_AUTH_SRV_NONCE_MAX_LEN];
+    const pjsip_auth_srv_stat *stat = &auth_srv.stat;
+    pj_status_t status;
+    int rc;
+
+    PJ_LOG(3,(THIS_FILE, "  server nonce store test"));
+
+    status = pjsip_auth_srv_nonce_store_create(pool, 4, 1, &nonce_store);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create nonce store", status);
+	return -200;
+    }
+
+    pj_bzero(&param, sizeof(param));
+    param.realm = &realm;
+    param.nonce_store = nonce_store;
+    pjsip_auth_srv_init2(pool, &auth_srv, &param);
+    auth_srv.lookup = &sync_lookup;
+    sync_lookup_cnt = 0;
+
+    /* Issue the challenge */
+    noauth = create_rdata(pool, tp, NULL, NULL);
+    status = noauth ? pjsip_endpt_create_response(endpt, noauth, 401, NULL,
+						  &tdata) : PJ_ENOMEM;
+    if (status == PJ_SUCCESS) {
+	pj_str_t qop = pj_str("auth");
+	status = pjsip_auth_srv_challenge(&auth_srv, &qop, NULL, NULL,
+					  PJ_FALSE, tdata);
+    }
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create challenge", status);
+	rc = -210;
+	goto on_return;
+    }
+
+    hdr = (pjsip_www_authenticate_hdr*)
+	  pjsip_msg_find_hdr(tdata->msg, PJSIP_H_WWW_AUTHENTICATE, NULL);
+    nonce.ptr = nonce_buf;
+    pj_strncpy(&nonce, &hdr->challenge.digest.nonce, sizeof(nonce_buf));
+
+    /* Nonce that was never issued */
+    rc = verify_nonce(&auth_srv, pool, tp, PASSWD, &unknown, "00000001",
+		      PJSIP_EAUTHSTALENONCE, 401);
+    if (rc != 0 || sync_lookup_cnt != 0) {
+	rc = -220;
+	goto on_return;
+    }
+
+    /* First use of the nonce */
+    rc = verify_nonce(&auth_srv, pool, tp, PASSWD, &nonce, "00000001",
+		      PJ_SUCCESS, 200);
+    if (rc != 0) {
+	rc = -230;
+	goto on_return;
+    }
+
+    /* Replayed nonce count */
+    rc = verify_nonce(&auth_srv, pool, tp, PASSWD, &nonce, "00000001",
+		      PJSIP_EAUTHSTALENONCE, 401);
+    if (rc != 0) {
+	rc = -240;
+	goto on_return;
+    }
+
+    /* Reuse with next nonce count, and without qop */
+    rc = verify_nonce(&auth_srv, pool, tp, PASSWD, &nonce, "00000002",
+		      PJ_SUCCESS, 200);
+    if (rc == 0)
+	rc = verify_nonce(&auth_srv, pool, tp, PASSWD, &nonce, NULL,
+			  PJ_SUCCESS, 200);
+    if (rc != 0) {
+	rc = -250;
+	goto on_return;
+    }
+
+    /* Wrong password with valid nonce */
+    rc = verify_nonce(&auth_srv, pool, tp, "wrong", &nonce, "00000003",
+		      PJSIP_EAUTHINVALIDDIGEST, PJSIP_SC_FORBIDDEN);
+    if (rc != 0) {
+	rc = -260;
+	goto on_return;
+    }
+
+    /* Expired nonce */
+    pj_thread_sleep(1100);
+    rc = verify_nonce(&auth_srv, pool, tp, PASSWD, &nonce, "00000004",
+		      PJSIP_EAUTHSTALENONCE, 401);
+    if (rc != 0) {
+	rc = -270;
+	goto on_return;
+    }
+
+    if (stat->challenged != 1 || stat->accepted != 3 ||
+	stat->accepted_reused != 2 || stat->rejected != 1 ||
+	stat->stale != 3 || sync_lookup_cnt != 4)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: unexpected statistics: challenged=%u "
+		  "accepted=%u reused=%u rejected=%u stale=%u lookup=%u",
+		  stat->challenged, stat->accepted, stat->accepted_reused,
+		  stat->rejected, stat->stale, sync_lookup_cnt));
+	rc = -280;
+	goto on_return;
+    }
+
+    /* Nonce which the store can't keep is rejected */
+    {
+	char long_buf[PJSIP_AUTH_SRV_NONCE_MAX_LEN + 1];
+	pj_str_t long_nonce, empty = {NULL, 0};
+
+	pj_memset(long_buf, 'a', sizeof(long_buf));
+	long_nonce.ptr = long_buf;
+	long_nonce.slen = sizeof(long_buf);
+
+	if (pjsip_auth_srv_challenge(&auth_srv, NULL, &long_nonce, NULL,
+				     PJ_FALSE, tdata) != PJ_ETOOBIG ||
+	    pjsip_auth_srv_challenge(&auth_srv, NULL, &empty, NULL,
+				     PJ_FALSE, tdata) != PJ_EINVAL ||
+	    stat->challenged != 1)
+	{
+	    PJ_LOG(3,(THIS_FILE, "   error: unsupported nonce is accepted"));
+	    rc = -290;
+	    goto on_return;
+	}
+    }
+
+    rc = 0;
+
+on_return:
+    if (tdata)
+	pjsip_tx_data_dec_ref(tdata);
+    pjsip_auth_srv_nonce_store_destroy(nonce_store);
+    return rc;
+}
+
+
+int auth_srv_test(void)
+{
+    pj_pool_t *pool;
+    pjsip_transport *tp;
+    pj_sockaddr_in remote;
+    pjsip_auth_srv auth_srv;
+    pjsip_auth_srv_init_param param;
+    pjsip_auth_srv_cache *cache = NULL;
+    pjsip_rx_data *good, *bad, *unknown, *noauth;
+    pj_str_t realm = pj_str(REALM);
+    pj_status_t status;
+    pj_bool_t pending;
+    int code, rc;
+
+    PJ_LOG(3,(THIS_FILE, "  asynchronous server authentication test"));
+
+    pool = pjsip_endpt_create_pool(endpt, "authsrv", 4000, 4000);
+
+    /* Cloning rdata needs transport */
+    pj_sockaddr_in_init(&remote, 0, 0);
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_LOOP_DGRAM,
+					   &remote, sizeof(pj_sockaddr_in),
+					   NULL, &tp);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to get loop transport", status);
+	pj_pool_release(pool);
+	return -10;
+    }
+
+    good = create_rdata(pool, tp, USER, PASSWD);
+    bad = create_rdata(pool, tp, USER, "wrong");
+    unknown = create_rdata(pool, tp, "bob", PASSWD);
+    noauth = create_rdata(pool, tp, NULL, NULL);
+    if (!good || !bad || !unknown || !noauth) {
+	PJ_LOG(3,(THIS_FILE, "   error: unable to create request"));
+	rc = -20;
+	goto on_return;
+    }
+
+    status = pjsip_auth_srv_cache_create(pool, 4, 1, &cache);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create cache", status);
+	rc = -30;
+	goto on_return;
+    }
+
+    pj_bzero(&param, sizeof(param));
+    param.realm = &realm;
+    param.lookup_async = &store_lookup;
+    param.cache = cache;
+    pjsip_auth_srv_init2(pool, &auth_srv, &param);
+    pj_bzero(&store, sizeof(store));
+    store.acc_name.ptr = store.acc_buf;
+
+    /* Request without credential is challenged immediately */
+    rc = verify(&auth_srv, noauth, &status, &code, &pending);
+    if (rc != 0 || pending || status != PJSIP_EAUTHNOAUTH || code != 401) {
+	PJ_LOG(3,(THIS_FILE, "   error: no credential test failed (%d)", rc));
+	rc = -40;
+	goto on_return;
+    }
+
+    /* First request goes to the store */
+    rc = verify(&auth_srv, good, &status, &code, &pending);
+    if (rc != 0 || !pending || status != PJ_SUCCESS || code != 200 ||
+	store.lookup_cnt != 1)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: async lookup test failed (%d)", rc));
+	rc = -50;
+	goto on_return;
+    }
+
+    /* Next request is verified from the cache, without the store */
+    rc = verify(&auth_srv, good, &status, &code, &pending);
+    if (rc != 0 || pending || status != PJ_SUCCESS || store.lookup_cnt != 1) {
+	PJ_LOG(3,(THIS_FILE, "   error: cached lookup test failed (%d)", rc));
+	rc = -60;
+	goto on_return;
+    }
+
+    /* Wrong password is checked against the store again, and rejected */
+    rc = verify(&auth_srv, bad, &status, &code, &pending);
+    if (rc != 0 || !pending || status != PJSIP_EAUTHINVALIDDIGEST ||
+	code != PJSIP_SC_FORBIDDEN || store.lookup_cnt != 2)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: wrong password test failed (%d)", rc));
+	rc = -70;
+	goto on_return;
+    }
+
+    /* Unknown account */
+    rc = verify(&auth_srv, unknown, &status, &code, &pending);
+    if (rc != 0 || !pending || status != PJSIP_EAUTHACCNOTFOUND ||
+	code != PJSIP_SC_FORBIDDEN || store.lookup_cnt != 3)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: unknown account test failed (%d)", rc));
+	rc = -80;
+	goto on_return;
+    }
+
+    /* The credential fetched for the rejected request was cached again */
+    rc = verify(&auth_srv, good, &status, &code, &pending);
+    if (rc != 0 || pending || status != PJ_SUCCESS || store.lookup_cnt != 3) {
+	PJ_LOG(3,(THIS_FILE, "   error: cache refresh test failed (%d)", rc));
+	rc = -90;
+	goto on_return;
+    }
+
+    /* Entry expires after the TTL */
+    pj_thread_sleep(1100);
+    rc = verify(&auth_srv, good, &status, &code, &pending);
+    if (rc != 0 || !pending || status != PJ_SUCCESS || store.lookup_cnt != 4) {
+	PJ_LOG(3,(THIS_FILE, "   error: cache expiry test failed (%d)", rc));
+	rc = -100;
+	goto on_return;
+    }
+
+    /* Removed entry goes to the store again */
+    pjsip_auth_srv_cache_remove(cache, &realm, NULL);
+    rc = verify(&auth_srv, good, &status, &code, &pending);
+    if (rc != 0 || !pending || status != PJ_SUCCESS || store.lookup_cnt != 5) {
+	PJ_LOG(3,(THIS_FILE, "   error: cache remove test failed (%d)", rc));
+	rc = -110;
+	goto on_return;
+    }
+
+    rc = nonce_test(pool, tp);
+
+on_return:
+    if (store.op) {
+	pjsip_endpt_cancel_timer(endpt, &store.timer);
+	pjsip_auth_srv_lookup_complete(store.op, PJ_ECANCELLED, NULL);
+	store.op = NULL;
+    }
+    if (cache)
+	pjsip_auth_srv_cache_destroy(cache);
+    pjsip_transport_dec_ref(tp);
+    pj_pool_release(pool);
+    return rc;
+}
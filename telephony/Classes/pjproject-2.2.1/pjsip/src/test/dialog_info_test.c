@@ -0,0 +1,286 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjsip_simple.h>
+#include <pjsip-simple/errno.h>
+#include <pjlib.h>
+
+#define THIS_FILE	"dialog_info_test.c"
+
+#define ENTITY		"sip:101@127.0.0.1"
+
+/* Dialog-info document with an incoming early dialog and an outgoing
+ * confirmed dialog.
+ */
+static const char *doc_full =
+    "<?xml version=\"1.0\"?>\r\n"
+    "<dialog-info xmlns=\"urn:ietf:params:xml:ns:dialog-info\" "
+    "version=\"1\" state=\"full\" entity=\"" ENTITY "\">\r\n"
+    " <dialog id=\"d1\" call-id=\"c1\" direction=\"recipient\">\r\n"
+    "  <state>proceeding</state>\r\n"
+    "  <remote><identity display=\"Bob\">sip:bob@127.0.0.1</identity>"
+    "</remote>\r\n"
+    " </dialog>\r\n"
+    " <dialog id=\"d2\" call-id=\"c2\" direction=\"initiator\">\r\n"
+    "  <state>confirmed</state>\r\n"
+    "  <remote><target uri=\"sip:carol@127.0.0.1\"/></remote>\r\n"
+    " </dialog>\r\n"
+    "</dialog-info>\r\n";
+
+/* The early dialog has not changed */
+static const char *doc_partial_same =
+    "<?xml version=\"1.0\"?>\r\n"
+    "<dialog-info xmlns=\"urn:ietf:params:xml:ns:dialog-info\" "
+    "version=\"2\" state=\"partial\" entity=\"" ENTITY "\">\r\n"
+    " <dialog id=\"d1\" call-id=\"c1\" direction=\"recipient\">\r\n"
+    "  <state>early</state>\r\n"
+    "  <remote><identity display=\"Bob\">sip:bob@127.0.0.1</identity>"
+    "</remote>\r\n"
+    " </dialog>\r\n"
+    "</dialog-info>\r\n";
+
+/* The confirmed dialog has been terminated */
+static const char *doc_partial_term =
+    "<?xml version=\"1.0\"?>\r\n"
+    "<dialog-info xmlns=\"urn:ietf:params:xml:ns:dialog-info\" "
+    "version=\"3\" state=\"partial\" entity=\"" ENTITY "\">\r\n"
+    " <dialog id=\"d2\" call-id=\"c2\" direction=\"initiator\">\r\n"
+    "  <state>terminated</state>\r\n"
+    " </dialog>\r\n"
+    "</dialog-info>\r\n";
+
+/* Partial state after a missing version */
+static const char *doc_partial_gap =
+    "<?xml version=\"1.0\"?>\r\n"
+    "<dialog-info xmlns=\"urn:ietf:params:xml:ns:dialog-info\" "
+    "version=\"5\" state=\"partial\" entity=\"" ENTITY "\">\r\n"
+    " <dialog id=\"d3\" direction=\"initiator\">\r\n"
+    "  <state>confirmed</state>\r\n"
+    " </dialog>\r\n"
+    "</dialog-info>\r\n";
+
+/* Full state without dialogs */
+static const char *doc_full_idle =
+    "<?xml version=\"1.0\"?>\r\n"
+    "<dialog-info xmlns=\"urn:ietf:params:xml:ns:dialog-info\" "
+    "version=\"6\" state=\"full\" entity=\"" ENTITY "\">\r\n"
+    "</dialog-info>\r\n";
+
+
+static pjsip_msg_body *create_body(pj_pool_t *pool, const char *subtype,
+				   const char *doc)
+{
+    pj_str_t type = pj_str("application");
+    pj_str_t sub = pj_str((char*)subtype);
+    pj_str_t text = pj_str((char*)doc);
+
+    return pjsip_msg_body_create(pool, &type, &sub, &text);
+}
+
+static pj_status_t parse(pj_pool_t *pool, const char *doc,
+			 pjsip_dialog_info *info)
+{
+    return pjsip_dialog_info_parse(pool,
+				   create_body(pool, "dialog-info+xml", doc),
+				   info);
+}
+
+static int parse_test(pj_pool_t *pool)
+{
+    pjsip_dialog_info info;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  parse test"));
+
+    status = parse(pool, doc_full, &info);
+    if (status != PJ_SUCCESS)
+	return -10;
+    if (pj_strcmp2(&info.entity, ENTITY) != 0 || info.version != 1 ||
+	!info.full_state || info.dlg_cnt != 2)
+    {
+	return -20;
+    }
+    if (pj_strcmp2(&info.dlg[0].id, "d1") != 0 ||
+	info.dlg[0].state != PJSIP_DIALOG_INFO_EARLY ||
+	info.dlg[0].dir != PJSIP_DIALOG_INFO_DIR_RECIPIENT ||
+	pj_strcmp2(&info.dlg[0].remote, "sip:bob@127.0.0.1") != 0 ||
+	pj_strcmp2(&info.dlg[0].remote_name, "Bob") != 0)
+    {
+	return -30;
+    }
+    if (info.dlg[1].state != PJSIP_DIALOG_INFO_CONFIRMED ||
+	info.dlg[1].dir != PJSIP_DIALOG_INFO_DIR_INITIATOR ||
+	pj_strcmp2(&info.dlg[1].remote, "sip:carol@127.0.0.1") != 0 ||
+	info.dlg[1].remote_name.slen != 0)
+    {
+	return -40;
+    }
+
+    status = parse(pool, doc_partial_term, &info);
+    if (status != PJ_SUCCESS || info.full_state || info.version != 3 ||
+	info.dlg_cnt != 1 || info.dlg[0].state != PJSIP_DIALOG_INFO_IDLE)
+    {
+	return -50;
+    }
+
+    status = pjsip_dialog_info_parse(pool,
+				     create_body(pool, "pidf+xml", doc_full),
+				     &info);
+    if (status != PJSIP_SIMPLE_EBADCONTENT)
+	return -60;
+
+    status = parse(pool, "<presence/>", &info);
+    if (status != PJSIP_SIMPLE_EBADDLGINFO)
+	return -70;
+
+    status = parse(pool, "<dialog-info entity=\"" ENTITY "\"/>", &info);
+    if (status != PJSIP_SIMPLE_EBADDLGINFO)
+	return -80;
+
+    return 0;
+}
+
+static int apply(pj_pool_t *pool, pjsip_dialog_info_table *table,
+		 const char *doc, pj_status_t expected_status,
+		 pj_bool_t expected_changed)
+{
+    pjsip_dialog_info info;
+    pj_bool_t changed;
+    pj_status_t status;
+
+    status = parse(pool, doc, &info);
+    if (status != PJ_SUCCESS)
+	return -1;
+
+    status = pjsip_dialog_info_apply(table, &info, &changed);
+    if (status != expected_status) {
+	app_perror("    apply returned", status);
+	return -2;
+    }
+    if (changed != expected_changed)
+	return -3;
+
+    return 0;
+}
+
+static int state_test(pj_pool_t *pool)
+{
+    pjsip_dialog_info_table table;
+    pjsip_dialog_info_line_state st;
+    pjsip_dialog_info info;
+    pj_str_t id;
+    char buf[16];
+    unsigned i;
+
+    PJ_LOG(3,(THIS_FILE, "  state table test"));
+
+    pj_bzero(&table, sizeof(table));
+
+    /* Partial state is useless without full state */
+    if (apply(pool, &table, doc_partial_term, PJSIP_SIMPLE_EDLGINFOGAP,
+	      PJ_FALSE))
+    {
+	return -100;
+    }
+
+    /* Full state, the confirmed dialog determines the line state */
+    if (apply(pool, &table, doc_full, PJ_SUCCESS, PJ_TRUE))
+	return -110;
+    pjsip_dialog_info_get_line_state(&table, &st);
+    if (st.state != PJSIP_DIALOG_INFO_CONFIRMED ||
+	st.dir != PJSIP_DIALOG_INFO_DIR_INITIATOR ||
+	pj_strcmp2(&st.remote, "sip:carol@127.0.0.1") != 0)
+    {
+	return -120;
+    }
+
+    /* The same version again is discarded */
+    if (apply(pool, &table, doc_full, PJ_EIGNORED, PJ_FALSE))
+	return -130;
+
+    /* Update of the early dialog does not change the line */
+    if (apply(pool, &table, doc_partial_same, PJ_SUCCESS, PJ_FALSE))
+	return -140;
+
+    /* Termination of the confirmed dialog reveals the early one */
+    if (apply(pool, &table, doc_partial_term, PJ_SUCCESS, PJ_TRUE))
+	return -150;
+    pjsip_dialog_info_get_line_state(&table, &st);
+    if (st.state != PJSIP_DIALOG_INFO_EARLY ||
+	st.dir != PJSIP_DIALOG_INFO_DIR_RECIPIENT ||
+	pj_strcmp2(&st.remote, "sip:bob@127.0.0.1") != 0 ||
+	pj_strcmp2(&st.remote_name, "Bob") != 0 || table.dlg_cnt != 1)
+    {
+	return -160;
+    }
+
+    /* Missing version 4 leaves the table untouched */
+    if (apply(pool, &table, doc_partial_gap, PJSIP_SIMPLE_EDLGINFOGAP,
+	      PJ_FALSE))
+    {
+	return -170;
+    }
+    if (table.version != 3 || table.dlg_cnt != 1)
+	return -180;
+
+    /* Full state recovers */
+    if (apply(pool, &table, doc_full_idle, PJ_SUCCESS, PJ_TRUE))
+	return -190;
+    pjsip_dialog_info_get_line_state(&table, &st);
+    if (st.state != PJSIP_DIALOG_INFO_IDLE || table.dlg_cnt != 0)
+	return -200;
+
+    /* Dialogs beyond the capacity of the table are ignored */
+    if (parse(pool, doc_full, &info) != PJ_SUCCESS)
+	return -210;
+    info.version = 7;
+    info.dlg = (pjsip_dialog_info_dialog*)
+	       pj_pool_calloc(pool, PJSIP_DIALOG_INFO_MAX_DIALOGS + 2,
+			      sizeof(pjsip_dialog_info_dialog));
+    info.dlg_cnt = PJSIP_DIALOG_INFO_MAX_DIALOGS + 2;
+    for (i = 0; i < info.dlg_cnt; ++i) {
+	pj_ansi_snprintf(buf, sizeof(buf), "x%u", i);
+	pj_strdup2(pool, &id, buf);
+	info.dlg[i].id = id;
+	info.dlg[i].state = PJSIP_DIALOG_INFO_EARLY;
+    }
+    if (pjsip_dialog_info_apply(&table, &info, NULL) != PJ_SUCCESS)
+	return -220;
+    if (table.dlg_cnt != PJSIP_DIALOG_INFO_MAX_DIALOGS)
+	return -230;
+
+    return 0;
+}
+
+int dialog_info_test(void)
+{
+    pj_pool_t *pool;
+    int rc;
+
+    pool = pjsip_endpt_create_pool(endpt, "dlginfo", 4000, 4000);
+
+    rc = parse_test(pool);
+    if (rc == 0)
+	rc = state_test(pool);
+
+    pj_pool_release(pool);
+    return rc;
+}
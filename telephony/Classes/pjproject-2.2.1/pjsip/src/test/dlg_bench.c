@@ -0,0 +1,291 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjlib.h>
+
+#define THIS_FILE	"dlg_bench.c"
+
+/* Number of concurrent dialogs registered in the UA layer. Even numbered
+ * dialogs are subscriptions receiving NOTIFY (UAC), odd numbered ones
+ * are calls receiving re-INVITE (UAS).
+ */
+#ifndef DLG_BENCH_COUNT
+#   define DLG_BENCH_COUNT	200000
+#endif
+
+/* Every n-th subscription has a forked dialog in its dialog set */
+#define FORK_EVERY		8
+
+/* Number of in-dialog requests routed per thread */
+#define LOOKUP_COUNT		1000000
+
+/* Maximum number of threads routing requests concurrently */
+#define MAX_THREADS		4
+
+
+/* Routing key of incoming in-dialog request. For request received by
+ * the dialog, local tag is the To tag and remote tag is the From tag.
+ */
+struct route_key
+{
+    pj_str_t	     call_id;
+    pj_str_t	     to_tag;
+    pj_str_t	     from_tag;
+    pjsip_dialog    *dlg;
+};
+
+static struct route_key *keys;
+static unsigned key_cnt;
+
+struct bench_thread
+{
+    pj_thread_t	*thread;
+    unsigned	 seed;
+    unsigned	 err_cnt;
+};
+
+
+static pjsip_dialog *create_dlg(pj_pool_t *pool, pjsip_role_e role,
+				pjsip_cid_hdr *call_id,
+				pjsip_fromto_hdr *local,
+				const char *remote_tag)
+{
+    pjsip_dialog *dlg;
+
+    /* Only fields used by the UA layer dialog table are initialized */
+    dlg = PJ_POOL_ZALLOC_T(pool, pjsip_dialog);
+    dlg->role = role;
+    dlg->call_id = call_id;
+    dlg->local.info = local;
+    dlg->local.tag_hval = pj_hash_calc_tolower(0, NULL, &local->tag);
+    dlg->remote.info = PJ_POOL_ZALLOC_T(pool, pjsip_fromto_hdr);
+    pj_strdup2(pool, &dlg->remote.info->tag, remote_tag);
+
+    return dlg;
+}
+
+static pj_status_t register_dlgs(pj_pool_t *pool)
+{
+    unsigned i;
+
+    keys = (struct route_key*)
+	   pj_pool_zalloc(pool, (DLG_BENCH_COUNT + DLG_BENCH_COUNT/FORK_EVERY)
+				* sizeof(struct route_key));
+    key_cnt = 0;
+
+    for (i=0; i<DLG_BENCH_COUNT; ++i) {
+	pjsip_cid_hdr *call_id;
+	pjsip_fromto_hdr *local;
+	pjsip_role_e role;
+	char buf[64];
+	unsigned fork_cnt, j;
+
+	role = (i & 1) ? PJSIP_ROLE_UAS : PJSIP_ROLE_UAC;
+	fork_cnt = (role==PJSIP_ROLE_UAC && (i % FORK_EVERY)==0) ? 2 : 1;
+
+	call_id = PJ_POOL_ZALLOC_T(pool, pjsip_cid_hdr);
+	pj_ansi_snprintf(buf, sizeof(buf), "%08x-dlgbench@127.0.0.1", i);
+	pj_strdup2(pool, &call_id->id, buf);
+
+	local = PJ_POOL_ZALLOC_T(pool, pjsip_fromto_hdr);
+	pj_ansi_snprintf(buf, sizeof(buf), "lt%x", i);
+	pj_strdup2(pool, &local->tag, buf);
+
+	for (j=0; j<fork_cnt; ++j) {
+	    struct route_key *key = &keys[key_cnt++];
+	    pj_status_t status;
+
+	    pj_ansi_snprintf(buf, sizeof(buf), "rt%x-%d", i, j);
+	    key->dlg = create_dlg(pool, role, call_id, local, buf);
+	    key->call_id = call_id->id;
+	    key->to_tag = local->tag;
+	    key->from_tag = key->dlg->remote.info->tag;
+
+	    status = pjsip_ua_register_dlg(pjsip_ua_instance(), key->dlg);
+	    if (status != PJ_SUCCESS)
+		return status;
+	}
+    }
+
+    return PJ_SUCCESS;
+}
+
+static void unregister_dlgs(void)
+{
+    unsigned i;
+
+    for (i=0; i<key_cnt; ++i) {
+	if (keys[i].dlg->dlg_set)
+	    pjsip_ua_unregister_dlg(pjsip_ua_instance(), keys[i].dlg);
+    }
+}
+
+static int route_thread(void *arg)
+{
+    struct bench_thread *bt = (struct bench_thread*) arg;
+    unsigned i, seed = bt->seed;
+
+    for (i=0; i<LOOKUP_COUNT; ++i) {
+	struct route_key *key;
+	pjsip_dialog *dlg;
+
+	seed = seed * 1103515245 + 12345;
+	key = &keys[(seed >> 8) % key_cnt];
+
+	dlg = pjsip_ua_find_dialog(&key->call_id, &key->to_tag,
+				   &key->from_tag, PJ_FALSE);
+	if (dlg != key->dlg)
+	    ++bt->err_cnt;
+    }
+
+    return 0;
+}
+
+static int route_bench(pj_pool_t *pool, unsigned thread_cnt,
+		       unsigned *p_speed)
+{
+    struct bench_thread bt[MAX_THREADS];
+    pj_timestamp t1, t2, freq;
+    unsigned i, err_cnt = 0;
+    pj_status_t status;
+
+    pj_bzero(bt, sizeof(bt));
+    pj_get_timestamp(&t1);
+
+    for (i=0; i<thread_cnt; ++i) {
+	bt[i].seed = i + 1;
+	status = pj_thread_create(pool, "dlgbench", &route_thread, &bt[i],
+				  0, 0, &bt[i].thread);
+	if (status != PJ_SUCCESS) {
+	    app_perror("    error: unable to create thread", status);
+	    return -10;
+	}
+    }
+
+    for (i=0; i<thread_cnt; ++i) {
+	pj_thread_join(bt[i].thread);
+	pj_thread_destroy(bt[i].thread);
+	err_cnt += bt[i].err_cnt;
+    }
+
+    pj_get_timestamp(&t2);
+    pj_sub_timestamp(&t2, &t1);
+    pj_get_timestamp_freq(&freq);
+
+    if (err_cnt) {
+	PJ_LOG(3,(THIS_FILE, "    error: %d requests routed to wrong dialog",
+		  err_cnt));
+	return -20;
+    }
+
+    if (t2.u64 == 0) t2.u64 = 1;
+    *p_speed = (unsigned)(freq.u64 * thread_cnt * LOOKUP_COUNT / t2.u64);
+    return 0;
+}
+
+int dlg_bench(void)
+{
+    pj_pool_t *pool;
+    pj_bool_t ua_inited = PJ_FALSE;
+    unsigned i, set_cnt, speed;
+    pj_str_t bad_call_id = pj_str("unknown-dlgbench@127.0.0.1");
+    char desc[128];
+    int rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "   benchmarking in-dialog request routing with "
+			 "%d dialogs:", DLG_BENCH_COUNT));
+
+    /* Init UA layer, sized for the dialog count */
+    if (pjsip_ua_instance()->id == -1) {
+	pjsip_ua_init_param ua_param;
+
+	pj_bzero(&ua_param, sizeof(ua_param));
+	ua_param.max_dlg_cnt = DLG_BENCH_COUNT;
+	status = pjsip_ua_init_module(endpt, &ua_param);
+	if (status != PJ_SUCCESS) {
+	    app_perror("    error: unable to init UA layer", status);
+	    return -100;
+	}
+	ua_inited = PJ_TRUE;
+    }
+
+    pool = pjsip_endpt_create_pool(endpt, "dlgbench", 4*1024*1024,
+				   4*1024*1024);
+    set_cnt = pjsip_ua_get_dlg_set_count();
+
+    status = register_dlgs(pool);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to register dialog", status);
+	rc = -110;
+	goto on_return;
+    }
+
+    /* Forked dialogs must share the dialog set */
+    if (pjsip_ua_get_dlg_set_count() != set_cnt + DLG_BENCH_COUNT) {
+	PJ_LOG(3,(THIS_FILE, "    error: invalid dialog set count %d",
+		  pjsip_ua_get_dlg_set_count()));
+	rc = -120;
+	goto on_return;
+    }
+
+    /* Dialog must be matched by the Call-ID too */
+    if (pjsip_ua_find_dialog(&bad_call_id, &keys[0].to_tag,
+			     &keys[0].from_tag, PJ_FALSE) != NULL)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: dialog matched with wrong Call-ID"));
+	rc = -130;
+	goto on_return;
+    }
+
+    for (i=1; i<=MAX_THREADS; i*=2) {
+	PJ_LOG(3,(THIS_FILE, "    %d thread(s)..", i));
+
+	rc = route_bench(pool, i, &speed);
+	if (rc != 0)
+	    goto on_return;
+
+	PJ_LOG(3,(THIS_FILE, "    NOTIFY/re-INVITE routed at %d msg/sec with "
+			     "%d thread(s)", speed, i));
+
+	pj_ansi_sprintf(desc, "Number of in-dialog requests routed to one of "
+			      "%d dialogs per second with %d thread(s)",
+			      DLG_BENCH_COUNT, i);
+	if (i == 1)
+	    report_ival("dlg-route-per-sec", speed, "msg/sec", desc);
+	else if (i == MAX_THREADS)
+	    report_ival("dlg-route-mt-per-sec", speed, "msg/sec", desc);
+    }
+
+on_return:
+    unregister_dlgs();
+    if (rc == 0 && pjsip_ua_get_dlg_set_count() != set_cnt) {
+	PJ_LOG(3,(THIS_FILE, "    error: dialog sets are not unregistered"));
+	rc = -140;
+    }
+    pj_pool_release(pool);
+
+    /* Let other tests initialize the UA layer with their own settings */
+    if (ua_inited)
+	pjsip_ua_destroy();
+
+    return rc;
+}
@@ -21,3 +21,579 @@
 #include "test.h"
 #include <pjsip.h>
 
+#include <pjlib.h>
+
+#define THIS_FILE	"dlg_core_test.c"
+
+#define LOCAL_URI	"\"Alice\" <sip:alice@127.0.0.1>"
+#define LOCAL_CONTACT	"<sip:alice@127.0.0.1;transport=loop-dgram>"
+#define REMOTE_URI	"<sip:bob@example.com>"
+#define TARGET		"sip:bob@127.0.0.1;transport=loop-dgram"
+#define BENCH_COUNT	20000
+
+
+/* Dialog usage, which counts the responses */
+static pj_bool_t dlg_on_rx_response(pjsip_rx_data *rdata);
+
+static pjsip_module mod_dlg_test =
+{
+    NULL, NULL,				/* prev, next.		*/
+    { "mod-dlg-test", 12 },		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_APPLICATION,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    NULL,				/* on_rx_request()	*/
+    &dlg_on_rx_response,		/* on_rx_response()	*/
+};
+
+static unsigned rx_response_cnt;
+
+static pj_bool_t dlg_on_rx_response(pjsip_rx_data *rdata)
+{
+    PJ_UNUSED_ARG(rdata);
+    ++rx_response_cnt;
+    return PJ_TRUE;
+}
+
+/* The remote party, which answers the requests of the dialog before the
+ * UA layer sees them.
+ */
+static pj_bool_t peer_on_rx_request(pjsip_rx_data *rdata);
+
+static struct
+{
+    pjsip_module	mod;
+    pj_str_t		call_id;
+    const char	       *contact;	/* Contact to put in response	*/
+    const char	       *record_route;	/* Record-Route to put		*/
+    unsigned		rx_cnt;
+    char		rx_tag[32];	/* To tag of last request	*/
+    pj_bool_t		rx_route;	/* Last request had Route	*/
+} peer =
+{
+    {
+	NULL, NULL,				/* prev, next.		*/
+	{ "mod-dlg-peer", 12 },			/* Name.		*/
+	-1,					/* Id			*/
+	PJSIP_MOD_PRIORITY_UA_PROXY_LAYER-1,	/* Priority		*/
+	NULL,					/* load()		*/
+	NULL,					/* start()		*/
+	NULL,					/* stop()		*/
+	NULL,					/* unload()		*/
+	&peer_on_rx_request,			/* on_rx_request()	*/
+    }
+};
+
+static pj_bool_t peer_on_rx_request(pjsip_rx_data *rdata)
+{
+    pjsip_tx_data *tdata;
+    pjsip_to_hdr *to;
+    pj_str_t hname, hvalue;
+    pj_status_t status;
+
+    if (pj_strcmp(&rdata->msg_info.cid->id, &peer.call_id) != 0 ||
+	rdata->msg_info.msg->line.req.method.id == PJSIP_ACK_METHOD)
+    {
+	return PJ_FALSE;
+    }
+
+    ++peer.rx_cnt;
+    pj_ansi_snprintf(peer.rx_tag, sizeof(peer.rx_tag), "%.*s",
+		     (int)rdata->msg_info.to->tag.slen,
+		     rdata->msg_info.to->tag.ptr);
+    peer.rx_route = pjsip_msg_find_hdr(rdata->msg_info.msg, PJSIP_H_ROUTE,
+				       NULL) != NULL;
+
+    status = pjsip_endpt_create_response(endpt, rdata, 200, NULL, &tdata);
+    if (status != PJ_SUCCESS)
+	return PJ_TRUE;
+
+    /* Replace the tag generated for the initial request */
+    to = PJSIP_MSG_TO_HDR(tdata->msg);
+    if (rdata->msg_info.to->tag.slen == 0)
+	to->tag = pj_str("bobtag1");
+
+    if (peer.contact) {
+	hname = pj_str("Contact");
+	hvalue = pj_str((char*)peer.contact);
+	pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)
+			  pjsip_generic_string_hdr_create(tdata->pool, &hname,
+							  &hvalue));
+    }
+    if (peer.record_route) {
+	hname = pj_str("Record-Route");
+	hvalue = pj_str((char*)peer.record_route);
+	pjsip_msg_add_hdr(tdata->msg, (pjsip_hdr*)
+			  pjsip_generic_string_hdr_create(tdata->pool, &hname,
+							  &hvalue));
+    }
+
+    pjsip_endpt_send_response2(endpt, rdata, tdata, NULL, NULL);
+    return PJ_TRUE;
+}
+
+/* Send SUBSCRIBE within the dialog, and wait until it is answered with
+ * the Contact and Record-Route.
+ */
+static int exchange(pjsip_dialog *dlg, const char *contact,
+		    const char *record_route)
+{
+    const pj_str_t name = { "SUBSCRIBE", 9 };
+    pjsip_method subscribe;
+    pjsip_tx_data *tdata;
+    unsigned i;
+
+    peer.contact = contact;
+    peer.record_route = record_route;
+    peer.rx_cnt = 0;
+    rx_response_cnt = 0;
+
+    pjsip_method_init_np(&subscribe, (pj_str_t*)&name);
+    if (pjsip_dlg_create_request(dlg, &subscribe, -1, &tdata) != PJ_SUCCESS)
+	return -1;
+
+    if (pjsip_dlg_send_request(dlg, tdata, -1, NULL) != PJ_SUCCESS)
+	return -2;
+
+    for (i=0; i<50 && rx_response_cnt == 0; ++i)
+	flush_events(100);
+
+    if (peer.rx_cnt != 1 || rx_response_cnt != 1 ||
+	dlg->state != PJSIP_DIALOG_STATE_ESTABLISHED)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: SUBSCRIBE not answered"));
+	return -3;
+    }
+    return 0;
+}
+
+/* Wait until the transactions of the dialog are terminated. */
+static void wait_tsx(pjsip_dialog *dlg)
+{
+    unsigned i;
+
+    for (i=0; i<100 && dlg->tsx_count; ++i)
+	flush_events(100);
+}
+
+/* Create the request the way pjsip_dlg_create_request() does without
+ * the template.
+ */
+static pj_status_t create_ref_request(pjsip_dialog *dlg,
+				      const pjsip_method *method,
+				      int cseq,
+				      pjsip_tx_data **p_tdata)
+{
+    pjsip_route_hdr *route;
+    pj_status_t status;
+
+    status = pjsip_endpt_create_request_from_hdr(endpt, method, dlg->target,
+						 dlg->local.info,
+						 dlg->remote.info,
+						 pjsip_method_creates_dialog(method) ?
+						    dlg->local.contact : NULL,
+						 dlg->call_id, cseq, NULL,
+						 p_tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    for (route=dlg->route_set.next; route!=&dlg->route_set;
+	 route=route->next)
+    {
+	pjsip_route_hdr *r;
+	r = (pjsip_route_hdr*) pjsip_hdr_shallow_clone((*p_tdata)->pool,
+						       route);
+	pjsip_routing_hdr_set_route(r);
+	pjsip_msg_add_hdr((*p_tdata)->msg, (pjsip_hdr*)r);
+    }
+
+    return PJ_SUCCESS;
+}
+
+/* Check that the request created by the dialog is printed exactly like
+ * the reference request.
+ */
+static int compare_request(pjsip_dialog *dlg, const pjsip_method *method,
+			   const char *expected)
+{
+    pjsip_tx_data *tdata, *ref;
+    char buf1[PJSIP_MAX_PKT_LEN], buf2[PJSIP_MAX_PKT_LEN];
+    pj_ssize_t len1, len2;
+    pj_status_t status;
+    int rc = 0;
+
+    status = pjsip_dlg_create_request(dlg, method, 10, &tdata);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to create request", status);
+	return -10;
+    }
+
+    status = create_ref_request(dlg, method, 10, &ref);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to create reference request", status);
+	pjsip_tx_data_dec_ref(tdata);
+	return -20;
+    }
+
+    len1 = pjsip_msg_print(tdata->msg, buf1, sizeof(buf1));
+    len2 = pjsip_msg_print(ref->msg, buf2, sizeof(buf2));
+    if (len1 <= 0 || len1 != len2 || pj_memcmp(buf1, buf2, len1) != 0) {
+	PJ_LOG(3,(THIS_FILE, "    error: %.*s request mismatch:\n%.*s\n"
+			     "    expecting:\n%.*s",
+		  (int)method->name.slen, method->name.ptr,
+		  (int)len1, buf1, (int)len2, buf2));
+	rc = -30;
+    } else if (expected) {
+	buf1[len1] = '\0';
+	if (pj_ansi_strstr(buf1, expected) == NULL) {
+	    PJ_LOG(3,(THIS_FILE, "    error: \"%s\" not found in:\n%s",
+		      expected, buf1));
+	    rc = -40;
+	}
+    }
+
+    pjsip_tx_data_dec_ref(tdata);
+    pjsip_tx_data_dec_ref(ref);
+    return rc;
+}
+
+static int set_route(pjsip_dialog *dlg, const char *route_str)
+{
+    pjsip_route_hdr route_set, *route;
+    pj_str_t hname = pj_str("Route");
+    pj_str_t value;
+
+    pj_list_init(&route_set);
+    pj_strdup2(dlg->pool, &value, route_str);
+    route = (pjsip_route_hdr*)
+	    pjsip_parse_hdr(dlg->pool, &hname, value.ptr, value.slen, NULL);
+    if (!route)
+	return -50;
+
+    pj_list_push_back(&route_set, route);
+    return pjsip_dlg_set_route_set(dlg, &route_set) == PJ_SUCCESS ? 0 : -60;
+}
+
+static int req_tpl_test(pjsip_dialog *dlg)
+{
+    pjsip_method subscribe, update;
+    pjsip_tx_data *tdata;
+    pjsip_from_hdr *from;
+    pjsip_hdr *to, *to_clone;
+    pjsip_param *param;
+    char buf[PJSIP_MAX_PKT_LEN];
+    pj_str_t name1 = pj_str("SUBSCRIBE"), name2 = pj_str("UPDATE");
+    int len, rc;
+
+    PJ_LOG(3,(THIS_FILE, "   in-dialog request template test"));
+
+    pjsip_method_init_np(&subscribe, &name1);
+    pjsip_method_init_np(&update, &name2);
+
+    /* Request before the dialog is established doesn't use template */
+    rc = compare_request(dlg, &pjsip_options_method, NULL);
+    if (rc != 0)
+	return rc;
+    if (dlg->req_tpl != NULL)
+	return -70;
+
+    /* Established dialog */
+    rc = exchange(dlg, "<sip:bob@127.0.0.1;transport=loop-dgram>",
+		  "<sip:127.0.0.1;transport=loop-dgram;lr>");
+    if (rc != 0)
+	return rc - 100;
+
+    rc = compare_request(dlg, &pjsip_options_method, ";tag=bobtag1");
+    if (rc == 0)
+	rc = compare_request(dlg, &subscribe, LOCAL_CONTACT);
+    if (rc == 0)
+	rc = compare_request(dlg, &update, "Route: <sip:127.0.0.1;");
+    if (rc != 0)
+	return rc - 100;
+    if (dlg->req_tpl == NULL) {
+	PJ_LOG(3,(THIS_FILE, "    error: template is not used"));
+	return -190;
+    }
+
+    /* Target refresh with request created from the template */
+    rc = exchange(dlg, "<sip:bob2@127.0.0.1;transport=loop-dgram>", NULL);
+    if (rc != 0)
+	return rc - 200;
+    if (pj_ansi_strcmp(peer.rx_tag, "bobtag1") != 0 || !peer.rx_route)
+	return -210;
+
+    rc = compare_request(dlg, &pjsip_options_method, "OPTIONS sip:bob2@");
+    if (rc != 0)
+	return rc - 200;
+
+    /* Route set change */
+    rc = set_route(dlg, "<sip:proxy1.example.com;lr>");
+    if (rc == 0)
+	rc = compare_request(dlg, &pjsip_options_method, "proxy1.example.com");
+    if (rc == 0)
+	rc = set_route(dlg, "<sip:proxy2.example.com;lr>");
+    if (rc == 0)
+	rc = compare_request(dlg, &subscribe, "proxy2.example.com");
+    if (rc != 0)
+	return rc - 300;
+
+    /* In place modification with explicit invalidation */
+    pj_strset2(&((pjsip_sip_uri*)pjsip_uri_get_uri(dlg->target))->user,
+	       "carol");
+    pjsip_dlg_invalidate_req_tpl(dlg);
+    rc = compare_request(dlg, &pjsip_options_method, "sip:carol@");
+    if (rc != 0)
+	return rc - 400;
+
+    /* Changed request header prints its own value, and the template
+     * is not affected.
+     */
+    if (pjsip_dlg_create_request(dlg, &pjsip_options_method, -1,
+				 &tdata) != PJ_SUCCESS)
+    {
+	return -500;
+    }
+    PJSIP_MSG_TO_HDR(tdata->msg)->tag = pj_str("modified");
+    from = PJSIP_MSG_FROM_HDR(tdata->msg);
+    param = PJ_POOL_ALLOC_T(tdata->pool, pjsip_param);
+    param->name = pj_str("x-test");
+    param->value = pj_str("1");
+    pj_list_push_back(&from->other_param, param);
+    len = (int)pjsip_msg_print(tdata->msg, buf, sizeof(buf)-1);
+    pjsip_tx_data_dec_ref(tdata);
+    if (len <= 0)
+	return -510;
+    buf[len] = '\0';
+    if (pj_ansi_strstr(buf, ";tag=modified") == NULL ||
+	pj_ansi_strstr(buf, ";x-test=1") == NULL)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: changed request printed as:\n%s",
+		  buf));
+	return -520;
+    }
+    rc = compare_request(dlg, &pjsip_options_method, ";tag=bobtag1");
+    if (rc != 0)
+	return rc - 500;
+
+    /* Full clone of template header must print its own value */
+    if (pjsip_dlg_create_request(dlg, &pjsip_options_method, -1,
+				 &tdata) != PJ_SUCCESS)
+    {
+	return -600;
+    }
+    to = (pjsip_hdr*) PJSIP_MSG_TO_HDR(tdata->msg);
+    to_clone = (pjsip_hdr*) pjsip_hdr_clone(tdata->pool, to);
+    ((pjsip_to_hdr*)to_clone)->tag = pj_str("modified");
+    len = pjsip_hdr_print_on(to_clone, buf, sizeof(buf)-1);
+    pjsip_tx_data_dec_ref(tdata);
+    if (len <= 0)
+	return -610;
+    buf[len] = '\0';
+    if (pj_ansi_strstr(buf, ";tag=modified") == NULL) {
+	PJ_LOG(3,(THIS_FILE, "    error: clone printed as %s", buf));
+	return -620;
+    }
+
+    return 0;
+}
+
+static int req_tpl_bench(pjsip_dialog *dlg)
+{
+    pj_timestamp t1, t2, freq;
+    unsigned i, j, speed[2];
+    char desc[128];
+
+    PJ_LOG(3,(THIS_FILE, "   benchmarking in-dialog request creation:"));
+
+    pj_get_timestamp_freq(&freq);
+
+    /* 0: dialog template, 1: reference */
+    for (j=0; j<2; ++j) {
+	pj_get_timestamp(&t1);
+	for (i=0; i<BENCH_COUNT; ++i) {
+	    pjsip_tx_data *tdata;
+	    char buf[PJSIP_MAX_PKT_LEN];
+	    pj_status_t status;
+
+	    if (j == 0) {
+		status = pjsip_dlg_create_request(dlg, &pjsip_options_method,
+						  i, &tdata);
+	    } else {
+		status = create_ref_request(dlg, &pjsip_options_method, i,
+					    &tdata);
+	    }
+	    if (status != PJ_SUCCESS)
+		return -650;
+
+	    pjsip_msg_print(tdata->msg, buf, sizeof(buf));
+	    pjsip_tx_data_dec_ref(tdata);
+	}
+	pj_get_timestamp(&t2);
+	pj_sub_timestamp(&t2, &t1);
+	if (t2.u64 == 0) t2.u64 = 1;
+	speed[j] = (unsigned)(freq.u64 * BENCH_COUNT / t2.u64);
+    }
+
+    PJ_LOG(3,(THIS_FILE, "    Created and printed at %d requests/sec "
+			 "(%d requests/sec without template)",
+			 speed[0], speed[1]));
+
+    pj_ansi_sprintf(desc, "Number of in-dialog requests created and "
+			  "printed from dialog's request template per second");
+    report_ival("create-dlg-request-per-sec", speed[0], "req/sec", desc);
+
+    return 0;
+}
+
+/* Request must stay intact after its dialog is destroyed, and it must
+ * hold the only reference to the template. The dialog's session is
+ * released here, which destroys the dialog.
+ */
+static int req_outlive_test(pjsip_dialog *dlg)
+{
+    pjsip_dialog *dlg2;
+    pjsip_tx_data *tdata;
+    pjsip_to_hdr *to;
+    pj_grp_lock_t *grp_lock;
+    pj_str_t local_uri = pj_str("<sip:carol@example.com>");
+    pj_str_t remote_uri = pj_str("<sip:dave@example.com>");
+    pj_str_t target = pj_str("sip:dave@127.0.0.3");
+    char buf1[PJSIP_MAX_PKT_LEN], buf2[PJSIP_MAX_PKT_LEN];
+    pj_ssize_t len1, len2;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "   request outliving its dialog test"));
+
+    if (pjsip_dlg_create_request(dlg, &pjsip_options_method, -1,
+				 &tdata) != PJ_SUCCESS)
+    {
+	pjsip_dlg_dec_session(dlg, &mod_dlg_test);
+	return -700;
+    }
+    grp_lock = tdata->shared_grp_lock;
+    if (!grp_lock) {
+	pjsip_tx_data_dec_ref(tdata);
+	pjsip_dlg_dec_session(dlg, &mod_dlg_test);
+	return -705;
+    }
+    len1 = pjsip_msg_print(tdata->msg, buf1, sizeof(buf1));
+
+    /* Destroy the dialog, and reuse its memory with another one */
+    pjsip_dlg_dec_session(dlg, &mod_dlg_test);
+    if (pjsip_dlg_create_uac(pjsip_ua_instance(), &local_uri, NULL,
+			     &remote_uri, &target, &dlg2) == PJ_SUCCESS)
+    {
+	pjsip_dlg_inc_session(dlg2, &mod_dlg_test);
+	pjsip_dlg_dec_session(dlg2, &mod_dlg_test);
+    }
+
+    len2 = pjsip_msg_print(tdata->msg, buf2, sizeof(buf2));
+    to = PJSIP_MSG_TO_HDR(tdata->msg);
+    if (len1 <= 0 || len1 != len2 || pj_memcmp(buf1, buf2, len1) != 0) {
+	PJ_LOG(3,(THIS_FILE, "    error: request changed:\n%.*s\n"
+			     "    was:\n%.*s",
+		  (int)len2, buf2, (int)len1, buf1));
+	rc = -710;
+    } else if (pj_strcmp2(&to->tag, "bobtag1") != 0) {
+	rc = -720;
+    } else if (pj_grp_lock_get_ref(grp_lock) != 1) {
+	PJ_LOG(3,(THIS_FILE, "    error: template has %d references",
+		  pj_grp_lock_get_ref(grp_lock)));
+	rc = -730;
+    }
+
+    pjsip_tx_data_dec_ref(tdata);
+    return rc;
+}
+
+int dlg_core_test(void)
+{
+    pjsip_dialog *dlg;
+    pjsip_transport *loop;
+    pj_sockaddr_in addr;
+    pj_bool_t ua_inited = PJ_FALSE;
+    pj_str_t local_uri = pj_str(LOCAL_URI);
+    pj_str_t local_contact = pj_str(LOCAL_CONTACT);
+    pj_str_t remote_uri = pj_str(REMOTE_URI);
+    pj_str_t target = pj_str(TARGET);
+    pj_status_t status;
+    int rc;
+
+    if (pjsip_ua_instance()->id == -1) {
+	status = pjsip_ua_init_module(endpt, NULL);
+	if (status != PJ_SUCCESS) {
+	    app_perror("   error: unable to init UA layer", status);
+	    return -1;
+	}
+	ua_inited = PJ_TRUE;
+    }
+
+    /* The loop transport must not deliver synchronously, otherwise the
+     * response arrives before the client transaction has been started.
+     */
+    pj_sockaddr_in_init(&addr, NULL, 0);
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_LOOP_DGRAM,
+					   &addr, sizeof(addr), NULL, &loop);
+    if (status != PJ_SUCCESS) {
+	PJ_LOG(3,(THIS_FILE, "   error: loop transport is not configured!"));
+	rc = -2;
+	goto on_return;
+    }
+    pjsip_loop_set_delay(loop, 1);
+
+    status = pjsip_endpt_register_module(endpt, &peer.mod);
+    if (status == PJ_SUCCESS) {
+	status = pjsip_endpt_register_module(endpt, &mod_dlg_test);
+	if (status != PJ_SUCCESS)
+	    pjsip_endpt_unregister_module(endpt, &peer.mod);
+    }
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to register module", status);
+	rc = -3;
+	goto on_release;
+    }
+
+    status = pjsip_dlg_create_uac(pjsip_ua_instance(), &local_uri,
+				  &local_contact, &remote_uri, &target, &dlg);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create dialog", status);
+	rc = -4;
+	goto on_unregister;
+    }
+
+    /* Keep the dialog alive across pjsip_dlg_dec_lock(), and receive
+     * the responses.
+     */
+    pjsip_dlg_inc_session(dlg, &mod_dlg_test);
+    pjsip_dlg_add_usage(dlg, &mod_dlg_test, NULL);
+    peer.call_id = dlg->call_id->id;
+
+    rc = req_tpl_test(dlg);
+    if (rc == 0)
+	rc = req_tpl_bench(dlg);
+
+    /* Let the transactions finish before the dialog is destroyed */
+    wait_tsx(dlg);
+
+    /* This destroys the dialog */
+    if (rc == 0)
+	rc = req_outlive_test(dlg);
+    else
+	pjsip_dlg_dec_session(dlg, &mod_dlg_test);
+
+on_unregister:
+    pjsip_endpt_unregister_module(endpt, &mod_dlg_test);
+    pjsip_endpt_unregister_module(endpt, &peer.mod);
+
+on_release:
+    pjsip_loop_set_delay(loop, 0);
+    pjsip_transport_dec_ref(loop);
+
+on_return:
+    if (ua_inited)
+	pjsip_ua_destroy();
+    return rc;
+}
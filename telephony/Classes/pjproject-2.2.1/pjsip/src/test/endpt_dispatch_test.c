@@ -0,0 +1,468 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjlib.h>
+
+#define THIS_FILE	"endpt_dispatch_test.c"
+
+#define WORKER_CNT	4
+#define CALL_CNT	8
+#define MSG_PER_CALL	50
+#define TARGET		"sip:dispatch@127.0.0.1:5060;transport=loop-dgram"
+#define CALL_ID_PREFIX	"dispatch-test-"
+#define TSX_TARGET	"sip:dispatch-tsx@127.0.0.1:5060;transport=loop-dgram"
+#define TSX_CALL_ID	CALL_ID_PREFIX "tsx"
+
+
+static pj_bool_t on_rx_request(pjsip_rx_data *rdata);
+static pj_status_t on_tx_request(pjsip_tx_data *tdata);
+
+static pjsip_module mod_dispatch_test =
+{
+    NULL, NULL,				/* prev, next.		*/
+    { "mod-dispatch-test", 17 },	/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_TSX_LAYER-1,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &on_rx_request,			/* on_rx_request()	*/
+    NULL,				/* on_rx_response()	*/
+    &on_tx_request,			/* on_tx_request.	*/
+    NULL,				/* on_tx_response()	*/
+    NULL,				/* on_tsx_state()	*/
+};
+
+static struct test_state
+{
+    pj_mutex_t	*mutex;
+    int		 worker[CALL_CNT];
+    int		 last_cseq[CALL_CNT];
+    unsigned	 rx_cnt;
+    int		 err;
+    int		 job_worker;
+    int		 timer_worker;
+    unsigned	 cancelled_cnt;
+    unsigned	 tsx_tx_cnt;
+    int		 tsx_retx_worker;
+
+    /* Stopping the dispatcher under traffic */
+    pj_bool_t	 traffic;
+    pj_bool_t	 traffic_quit;
+    unsigned	 worker_rx_cnt;
+    unsigned	 direct_rx_cnt;
+} state;
+
+
+static pj_bool_t on_rx_request(pjsip_rx_data *rdata)
+{
+    pjsip_sip_uri *uri;
+    pj_str_t call_id = rdata->msg_info.cid->id;
+    pj_str_t prefix = pj_str(CALL_ID_PREFIX);
+    pj_str_t idx_str;
+    int worker, idx, cseq;
+
+    uri = (pjsip_sip_uri*) pjsip_uri_get_uri(rdata->msg_info.msg->line.req.uri);
+    if (pj_strcmp2(&uri->user, "dispatch") != 0)
+	return PJ_FALSE;
+
+    worker = pjsip_endpt_get_current_worker(endpt);
+    cseq = rdata->msg_info.cseq->cseq;
+
+    if (state.traffic) {
+	pj_mutex_lock(state.mutex);
+	if (worker >= 0)
+	    ++state.worker_rx_cnt;
+	else
+	    ++state.direct_rx_cnt;
+	pj_mutex_unlock(state.mutex);
+	return PJ_TRUE;
+    }
+
+    idx_str.ptr = call_id.ptr + prefix.slen;
+    idx_str.slen = call_id.slen - prefix.slen;
+    idx = (int)pj_strtoul(&idx_str);
+
+    pj_mutex_lock(state.mutex);
+    if (worker < 0 || idx < 0 || idx >= CALL_CNT) {
+	state.err = -10;
+    } else if (state.worker[idx] == -1) {
+	state.worker[idx] = worker;
+    } else if (state.worker[idx] != worker) {
+	/* Same dialog must always be processed by the same worker */
+	state.err = -20;
+    }
+    if (!state.err && cseq != state.last_cseq[idx] + 1) {
+	/* Messages of a dialog must be processed in order */
+	state.err = -30;
+    }
+    if (!state.err)
+	state.last_cseq[idx] = cseq;
+    ++state.rx_cnt;
+    pj_mutex_unlock(state.mutex);
+
+    return PJ_TRUE;
+}
+
+/* Record the worker that retransmits the request of the transaction */
+static pj_status_t on_tx_request(pjsip_tx_data *tdata)
+{
+    pjsip_cid_hdr *cid = PJSIP_MSG_CID_HDR(tdata->msg);
+
+    if (!cid || pj_strcmp2(&cid->id, TSX_CALL_ID) != 0)
+	return PJ_SUCCESS;
+
+    pj_mutex_lock(state.mutex);
+    if (++state.tsx_tx_cnt == 2)
+	state.tsx_retx_worker = pjsip_endpt_get_current_worker(endpt);
+    pj_mutex_unlock(state.mutex);
+
+    return PJ_SUCCESS;
+}
+
+static void job_cb(pjsip_endpoint *ept, void *user_data)
+{
+    PJ_UNUSED_ARG(user_data);
+    state.job_worker = pjsip_endpt_get_current_worker(ept);
+}
+
+static void timer_cb(pjsip_endpoint *ept, pjsip_worker_timer *timer)
+{
+    PJ_UNUSED_ARG(timer);
+    state.timer_worker = pjsip_endpt_get_current_worker(ept);
+}
+
+static void cancelled_timer_cb(pjsip_endpoint *ept, pjsip_worker_timer *timer)
+{
+    PJ_UNUSED_ARG(ept);
+    PJ_UNUSED_ARG(timer);
+    ++state.cancelled_cnt;
+}
+
+
+static pj_status_t send_msg(int call_idx, int cseq)
+{
+    pj_str_t target = pj_str(TARGET);
+    pj_str_t from = pj_str("<sip:alice@127.0.0.1>");
+    pj_str_t call_id;
+    char call_id_buf[32];
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    pj_ansi_snprintf(call_id_buf, sizeof(call_id_buf), CALL_ID_PREFIX "%d",
+		     call_idx);
+    call_id = pj_str(call_id_buf);
+
+    status = pjsip_endpt_create_request(endpt, pjsip_get_options_method(),
+					&target, &from, &target, NULL,
+					&call_id, cseq, NULL, &tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    return pjsip_endpt_send_request_stateless(endpt, tdata, NULL, NULL);
+}
+
+
+/* Keep sending requests until told to quit */
+static int PJ_THREAD_FUNC traffic_thread(void *arg)
+{
+    int cseq;
+
+    PJ_UNUSED_ARG(arg);
+
+    for (cseq=1; !state.traffic_quit; ++cseq) {
+	unsigned i;
+
+	for (i=0; i<CALL_CNT; ++i)
+	    send_msg(i, cseq);
+	pj_thread_sleep(1);
+    }
+
+    return 0;
+}
+
+/* Stop the dispatcher while the loop transport keeps delivering
+ * messages from another thread.
+ */
+static int stop_under_traffic_test(void)
+{
+    pj_pool_t *pool;
+    pjsip_endpt_dispatcher_param param;
+    pj_thread_t *thread;
+    unsigned worker_rx_cnt;
+    int rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  stopping dispatcher under traffic"));
+
+    state.traffic = PJ_TRUE;
+    state.traffic_quit = PJ_FALSE;
+
+    pjsip_endpt_dispatcher_param_default(&param);
+    param.worker_cnt = WORKER_CNT;
+    status = pjsip_endpt_start_dispatcher(endpt, &param);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to start dispatcher", status);
+	state.traffic = PJ_FALSE;
+	return -220;
+    }
+
+    pool = pjsip_endpt_create_pool(endpt, "dsptraffic", 512, 512);
+    status = pj_thread_create(pool, "dsptraffic", &traffic_thread, NULL,
+			      0, 0, &thread);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create thread", status);
+	pjsip_endpt_stop_dispatcher(endpt);
+	pj_pool_release(pool);
+	state.traffic = PJ_FALSE;
+	return -225;
+    }
+
+    flush_events(100);
+    pjsip_endpt_stop_dispatcher(endpt);
+
+    pj_mutex_lock(state.mutex);
+    worker_rx_cnt = state.worker_rx_cnt;
+    pj_mutex_unlock(state.mutex);
+
+    flush_events(100);
+    state.traffic_quit = PJ_TRUE;
+    pj_thread_join(thread);
+    pj_thread_destroy(thread);
+    flush_events(100);
+
+    if (worker_rx_cnt == 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: no message was processed by the "
+			     "workers"));
+	rc = -230;
+    } else if (state.worker_rx_cnt != worker_rx_cnt) {
+	PJ_LOG(3,(THIS_FILE, "   error: worker processed a message after "
+			     "the dispatcher was stopped"));
+	rc = -235;
+    } else if (state.direct_rx_cnt == 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: no message was processed after "
+			     "the dispatcher was stopped"));
+	rc = -240;
+    }
+
+    state.traffic = PJ_FALSE;
+    pj_pool_release(pool);
+    return rc;
+}
+
+
+int endpt_dispatch_test(void)
+{
+    pj_pool_t *pool;
+    pjsip_endpt_dispatcher_param param;
+    pjsip_worker_timer timer, cancelled_timer;
+    pjsip_transaction *tsx = NULL;
+    pjsip_tx_data *tdata;
+    pj_str_t key;
+    pj_time_val timeout, delay;
+    unsigned i, used_cnt;
+    int cseq, rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  endpoint worker dispatcher test"));
+
+    pj_bzero(&state, sizeof(state));
+    for (i=0; i<CALL_CNT; ++i)
+	state.worker[i] = -1;
+    state.job_worker = state.timer_worker = state.tsx_retx_worker = -2;
+
+    pool = pjsip_endpt_create_pool(endpt, "dsptest", 512, 512);
+    status = pj_mutex_create_simple(pool, "dsptest", &state.mutex);
+    if (status != PJ_SUCCESS) {
+	pj_pool_release(pool);
+	return -100;
+    }
+
+    status = pjsip_endpt_register_module(endpt, &mod_dispatch_test);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to register module", status);
+	pj_mutex_destroy(state.mutex);
+	pj_pool_release(pool);
+	return -110;
+    }
+
+    pjsip_endpt_dispatcher_param_default(&param);
+    param.worker_cnt = WORKER_CNT;
+    status = pjsip_endpt_start_dispatcher(endpt, &param);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to start dispatcher", status);
+	rc = -120;
+	goto on_return;
+    }
+
+    if (pjsip_endpt_get_worker_cnt(endpt) != WORKER_CNT ||
+	pjsip_endpt_get_current_worker(endpt) != -1)
+    {
+	rc = -130;
+	goto on_return;
+    }
+
+    /* Interleave messages of the dialogs */
+    for (cseq=1; cseq<=MSG_PER_CALL; ++cseq) {
+	for (i=0; i<CALL_CNT; ++i) {
+	    status = send_msg(i, cseq);
+	    if (status != PJ_SUCCESS) {
+		app_perror("   error: unable to send request", status);
+		rc = -140;
+		goto on_return;
+	    }
+	}
+    }
+
+    /* Job and timer keyed with Call-ID of the first and second dialog */
+    key = pj_str(CALL_ID_PREFIX "0");
+    status = pjsip_endpt_dispatch_job(endpt, &key, &job_cb, NULL);
+    if (status != PJ_SUCCESS) {
+	rc = -150;
+	goto on_return;
+    }
+
+    delay.sec = 0;
+    delay.msec = 50;
+    key = pj_str(CALL_ID_PREFIX "1");
+    pjsip_worker_timer_init(&timer, NULL, &timer_cb);
+    pjsip_worker_timer_init(&cancelled_timer, NULL, &cancelled_timer_cb);
+    pjsip_endpt_schedule_worker_timer(endpt, &timer, &key, &delay);
+    pjsip_endpt_schedule_worker_timer(endpt, &cancelled_timer, &key, &delay);
+    pjsip_endpt_cancel_worker_timer(endpt, &cancelled_timer);
+
+    /* Transaction created outside the workers, nobody answers it so its
+     * retransmission timer fires.
+     */
+    key = pj_str(TSX_CALL_ID);
+    {
+	pj_str_t target = pj_str(TSX_TARGET);
+	pj_str_t from = pj_str("<sip:alice@127.0.0.1>");
+
+	status = pjsip_endpt_create_request(endpt, pjsip_get_options_method(),
+					    &target, &from, &target, NULL,
+					    &key, -1, NULL, &tdata);
+	if (status == PJ_SUCCESS) {
+	    status = pjsip_tsx_create_uac(NULL, tdata, &tsx);
+	    if (status != PJ_SUCCESS)
+		pjsip_tx_data_dec_ref(tdata);
+	}
+	if (status == PJ_SUCCESS)
+	    status = pjsip_tsx_send_msg(tsx, NULL);
+	if (status != PJ_SUCCESS) {
+	    app_perror("   error: unable to send transaction", status);
+	    rc = -155;
+	    goto on_return;
+	}
+    }
+
+    /* Wait until everything is processed */
+    pj_gettickcount(&timeout);
+    timeout.sec += 5;
+    for (;;) {
+	pj_time_val now, poll_delay = { 0, 10 };
+
+	pjsip_endpt_handle_events(endpt, &poll_delay);
+
+	pj_mutex_lock(state.mutex);
+	if (state.rx_cnt == CALL_CNT * MSG_PER_CALL &&
+	    state.job_worker != -2 && state.timer_worker != -2 &&
+	    state.tsx_retx_worker != -2)
+	{
+	    pj_mutex_unlock(state.mutex);
+	    break;
+	}
+	pj_mutex_unlock(state.mutex);
+
+	pj_gettickcount(&now);
+	if (PJ_TIME_VAL_GT(now, timeout)) {
+	    PJ_LOG(3,(THIS_FILE, "   error: timed out, received %d",
+		      state.rx_cnt));
+	    rc = -160;
+	    goto on_return;
+	}
+    }
+
+    if (state.err) {
+	PJ_LOG(3,(THIS_FILE, "   error: message serialization failed (%d)",
+		  state.err));
+	rc = -170;
+	goto on_return;
+    }
+
+    if (state.job_worker != state.worker[0] ||
+	state.timer_worker != state.worker[1] ||
+	state.cancelled_cnt != 0)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: job/timer ran in wrong worker"));
+	rc = -180;
+	goto on_return;
+    }
+
+    if (state.tsx_retx_worker != pjsip_endpt_get_key_worker(endpt, &key)) {
+	PJ_LOG(3,(THIS_FILE, "   error: transaction timer ran in worker %d",
+		  state.tsx_retx_worker));
+	rc = -185;
+	goto on_return;
+    }
+
+    /* Dialogs should be spread across workers */
+    for (i=0, used_cnt=0; i<WORKER_CNT; ++i) {
+	unsigned j;
+	for (j=0; j<CALL_CNT; ++j) {
+	    if (state.worker[j] == (int)i) {
+		++used_cnt;
+		break;
+	    }
+	}
+    }
+    if (used_cnt < 2) {
+	PJ_LOG(3,(THIS_FILE, "   error: only %d worker is used", used_cnt));
+	rc = -190;
+	goto on_return;
+    }
+
+on_return:
+    if (tsx) {
+	pjsip_tsx_terminate(tsx, PJSIP_SC_REQUEST_TERMINATED);
+	flush_events(100);
+    }
+    pjsip_endpt_stop_dispatcher(endpt);
+    if (pjsip_endpt_get_worker_cnt(endpt) != 0 && rc == 0)
+	rc = -200;
+
+    /* Without dispatcher, jobs are run by the caller */
+    if (rc == 0) {
+	state.job_worker = -2;
+	pjsip_endpt_dispatch_job(endpt, NULL, &job_cb, NULL);
+	if (state.job_worker != -1)
+	    rc = -210;
+    }
+
+    if (rc == 0)
+	rc = stop_under_traffic_test();
+
+    pjsip_endpt_unregister_module(endpt, &mod_dispatch_test);
+    pj_mutex_destroy(state.mutex);
+    pj_pool_release(pool);
+    return rc;
+}
@@ -0,0 +1,319 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjlib.h>
+
+#define THIS_FILE	"endpt_mod_stat_test.c"
+
+#define MSG_CNT		20
+#define SLOW_USEC	2000
+#define TARGET		"sip:modstat@127.0.0.1;transport=loop-dgram"
+#define CALL_ID_PREFIX	"modstat-test-"
+
+
+static pj_bool_t on_slow_rx_request(pjsip_rx_data *rdata);
+static pj_bool_t on_rx_request(pjsip_rx_data *rdata);
+static pj_bool_t on_rx_response(pjsip_rx_data *rdata);
+
+/* Slow module, sees the messages before the test module */
+static pjsip_module mod_slow =
+{
+    NULL, NULL,				/* prev, next.		*/
+    { "mod-modstat-slow", 16 },		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_TSX_LAYER-2,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &on_slow_rx_request,		/* on_rx_request()	*/
+    NULL,				/* on_rx_response()	*/
+    NULL,				/* on_tx_request.	*/
+    NULL,				/* on_tx_response()	*/
+    NULL,				/* on_tsx_state()	*/
+};
+
+/* Test module, responds to the requests and consumes the responses */
+static pjsip_module mod_test =
+{
+    NULL, NULL,				/* prev, next.		*/
+    { "mod-modstat-test", 16 },		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_TSX_LAYER-1,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &on_rx_request,			/* on_rx_request()	*/
+    &on_rx_response,			/* on_rx_response()	*/
+    NULL,				/* on_tx_request.	*/
+    NULL,				/* on_tx_response()	*/
+    NULL,				/* on_tsx_state()	*/
+};
+
+static unsigned resp_cnt;
+
+
+static pj_bool_t is_test_msg(pjsip_rx_data *rdata)
+{
+    pj_str_t prefix = pj_str(CALL_ID_PREFIX);
+
+    return rdata->msg_info.cid->id.slen > prefix.slen &&
+	   pj_strncmp(&rdata->msg_info.cid->id, &prefix, prefix.slen) == 0;
+}
+
+/* Busy wait, sleeping would be too coarse on some platforms */
+static void spin(unsigned usec)
+{
+    pj_timestamp start, now;
+
+    pj_get_timestamp(&start);
+    do {
+	pj_get_timestamp(&now);
+    } while (pj_elapsed_usec(&start, &now) < usec);
+}
+
+static pj_bool_t on_slow_rx_request(pjsip_rx_data *rdata)
+{
+    if (is_test_msg(rdata))
+	spin(SLOW_USEC);
+
+    return PJ_FALSE;
+}
+
+static pj_bool_t on_rx_request(pjsip_rx_data *rdata)
+{
+    if (!is_test_msg(rdata))
+	return PJ_FALSE;
+
+    pjsip_endpt_respond_stateless(endpt, rdata, 200, NULL, NULL, NULL);
+    return PJ_TRUE;
+}
+
+static pj_bool_t on_rx_response(pjsip_rx_data *rdata)
+{
+    if (!is_test_msg(rdata))
+	return PJ_FALSE;
+
+    ++resp_cnt;
+    return PJ_TRUE;
+}
+
+
+/* Send OPTIONS requests and wait for the responses. */
+static int send_requests(unsigned cnt)
+{
+    pj_str_t target = pj_str(TARGET);
+    pj_str_t from = pj_str("<sip:alice@127.0.0.1>");
+    unsigned i, last = resp_cnt + cnt;
+    pj_time_val timeout;
+
+    for (i=0; i<cnt; ++i) {
+	char call_id_buf[32];
+	pj_str_t call_id;
+	pjsip_tx_data *tdata;
+	pj_status_t status;
+
+	pj_ansi_snprintf(call_id_buf, sizeof(call_id_buf),
+			 CALL_ID_PREFIX "%u", resp_cnt + i);
+	call_id = pj_str(call_id_buf);
+
+	status = pjsip_endpt_create_request(endpt, pjsip_get_options_method(),
+					    &target, &from, &target, NULL,
+					    &call_id, -1, NULL, &tdata);
+	if (status != PJ_SUCCESS) {
+	    app_perror("   error: unable to create request", status);
+	    return -10;
+	}
+
+	status = pjsip_endpt_send_request_stateless(endpt, tdata, NULL, NULL);
+	if (status != PJ_SUCCESS) {
+	    app_perror("   error: unable to send request", status);
+	    return -20;
+	}
+    }
+
+    pj_gettickcount(&timeout);
+    timeout.sec += 3;
+    while (resp_cnt < last) {
+	pj_time_val now, poll_delay = { 0, 10 };
+
+	pjsip_endpt_handle_events(endpt, &poll_delay);
+
+	pj_gettickcount(&now);
+	if (PJ_TIME_VAL_GT(now, timeout)) {
+	    PJ_LOG(3,(THIS_FILE, "   error: only %u of %u responses received",
+		      cnt - (last - resp_cnt), cnt));
+	    return -30;
+	}
+    }
+
+    return 0;
+}
+
+
+/* Send the requests from another thread, which records its own
+ * statistics.
+ */
+static int send_thread_proc(void *arg)
+{
+    *(int*)arg = send_requests(MSG_CNT);
+    return 0;
+}
+
+
+int endpt_mod_stat_test(void)
+{
+    pjsip_endpt_mod_stat stat;
+    pj_pool_t *pool = NULL;
+    pj_thread_t *thread;
+    pj_status_t status;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  module latency statistics test"));
+
+    resp_cnt = 0;
+
+    if (pjsip_endpt_register_module(endpt, &mod_slow) != PJ_SUCCESS ||
+	pjsip_endpt_register_module(endpt, &mod_test) != PJ_SUCCESS)
+    {
+	rc = -100;
+	goto on_return;
+    }
+
+    /* Nothing is recorded while the statistics are off */
+    rc = send_requests(2);
+    if (rc != 0)
+	goto on_return;
+
+    status = pjsip_endpt_enable_mod_stat(endpt, PJ_TRUE);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to enable statistics", status);
+	rc = -110;
+	goto on_return;
+    }
+
+    pjsip_endpt_get_mod_stat(endpt, &mod_slow, PJSIP_REQUEST_MSG,
+			     PJSIP_OPTIONS_METHOD, &stat);
+    if (stat.count != 0) {
+	rc = -120;
+	goto on_return;
+    }
+
+    rc = send_requests(MSG_CNT);
+    if (rc != 0)
+	goto on_return;
+
+    /* The slow module sees all requests without consuming them */
+    pjsip_endpt_get_mod_stat(endpt, &mod_slow, PJSIP_REQUEST_MSG,
+			     PJSIP_OPTIONS_METHOD, &stat);
+    PJ_LOG(3,(THIS_FILE, "   slow module: count=%u, consumed=%u, avg=%u, "
+			 "p50=%u, p90=%u, p99=%u, max=%u usec",
+	      stat.count, stat.consumed, stat.avg, stat.p50, stat.p90,
+	      stat.p99, stat.max));
+    if (stat.count != MSG_CNT || stat.consumed != 0) {
+	rc = -130;
+	goto on_return;
+    }
+    /* Buckets are 25% wide, so p50 may be reported below SLOW_USEC */
+    if (stat.avg < SLOW_USEC || stat.p50 < SLOW_USEC * 3 / 4 ||
+	stat.p50 > stat.p90 || stat.p90 > stat.p99 || stat.p99 > stat.max)
+    {
+	rc = -140;
+	goto on_return;
+    }
+
+    /* The test module consumes all requests and responses */
+    pjsip_endpt_get_mod_stat(endpt, &mod_test, PJSIP_REQUEST_MSG,
+			     PJSIP_OPTIONS_METHOD, &stat);
+    if (stat.count != MSG_CNT || stat.consumed != MSG_CNT) {
+	rc = -150;
+	goto on_return;
+    }
+    pjsip_endpt_get_mod_stat(endpt, &mod_test, PJSIP_RESPONSE_MSG,
+			     PJSIP_OTHER_METHOD, &stat);
+    if (stat.count != MSG_CNT || stat.consumed != MSG_CNT) {
+	rc = -160;
+	goto on_return;
+    }
+
+    /* Other methods are not affected */
+    pjsip_endpt_get_mod_stat(endpt, &mod_test, PJSIP_REQUEST_MSG,
+			     PJSIP_INVITE_METHOD, &stat);
+    if (stat.count != 0) {
+	rc = -170;
+	goto on_return;
+    }
+
+    /* Statistics of other threads are added up */
+    pool = pjsip_endpt_create_pool(endpt, "modstat", 512, 512);
+    rc = -175;
+    status = pj_thread_create(pool, "modstat", &send_thread_proc, &rc,
+			      0, 0, &thread);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create thread", status);
+	goto on_return;
+    }
+    pj_thread_join(thread);
+    pj_thread_destroy(thread);
+    if (rc != 0)
+	goto on_return;
+
+    pjsip_endpt_get_mod_stat(endpt, &mod_test, PJSIP_REQUEST_MSG,
+			     PJSIP_OPTIONS_METHOD, &stat);
+    if (stat.count != MSG_CNT * 2 || stat.consumed != MSG_CNT * 2) {
+	rc = -176;
+	goto on_return;
+    }
+
+    pjsip_endpt_dump(endpt, PJ_FALSE);
+
+    /* Switching off keeps the statistics */
+    pjsip_endpt_enable_mod_stat(endpt, PJ_FALSE);
+    rc = send_requests(2);
+    if (rc != 0)
+	goto on_return;
+
+    pjsip_endpt_get_mod_stat(endpt, &mod_slow, PJSIP_REQUEST_MSG,
+			     PJSIP_OPTIONS_METHOD, &stat);
+    if (stat.count != MSG_CNT * 2) {
+	rc = -180;
+	goto on_return;
+    }
+
+    pjsip_endpt_reset_mod_stat(endpt);
+    pjsip_endpt_get_mod_stat(endpt, &mod_slow, PJSIP_REQUEST_MSG,
+			     PJSIP_OPTIONS_METHOD, &stat);
+    if (stat.count != 0 || stat.max != 0) {
+	rc = -190;
+	goto on_return;
+    }
+
+on_return:
+    if (pool)
+	pjsip_endpt_release_pool(endpt, pool);
+    pjsip_endpt_enable_mod_stat(endpt, PJ_FALSE);
+    if (mod_test.id != -1)
+	pjsip_endpt_unregister_module(endpt, &mod_test);
+    if (mod_slow.id != -1)
+	pjsip_endpt_unregister_module(endpt, &mod_slow);
+    return rc;
+}
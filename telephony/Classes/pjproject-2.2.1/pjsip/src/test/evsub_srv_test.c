@@ -0,0 +1,435 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjsip_ua.h>
+#include <pjsip_simple.h>
+#include <pjlib.h>
+
+#define THIS_FILE	"evsub_srv_test.c"
+
+#define EVENT		"x-evsrv-test"
+#define MAX_PENDING	4
+#define RES1_CNT	15
+#define RES2_CNT	5
+#define RES3_CNT	2
+#define WATCHER_CNT	(RES1_CNT + RES2_CNT + RES3_CNT)
+#define SHORT_EXPIRES	2
+
+/* Subscriber side of a watcher */
+struct watcher
+{
+    pjsip_evsub	*sub;
+    unsigned	 notify_cnt;
+    char	 body[16];
+    pj_bool_t	 terminated;
+    char	 reason[16];
+};
+
+static struct watcher watchers[WATCHER_CNT];
+static int watched_cnt;
+static int unwatched_cnt;
+
+
+static struct watcher *find_watcher(pjsip_evsub *sub)
+{
+    unsigned i;
+
+    for (i=0; i<WATCHER_CNT; ++i) {
+	if (watchers[i].sub == sub)
+	    return &watchers[i];
+    }
+    return NULL;
+}
+
+static void uac_on_evsub_state(pjsip_evsub *sub, pjsip_event *event)
+{
+    struct watcher *w = find_watcher(sub);
+    const pj_str_t *reason;
+
+    PJ_UNUSED_ARG(event);
+
+    if (!w || pjsip_evsub_get_state(sub) != PJSIP_EVSUB_STATE_TERMINATED)
+	return;
+
+    reason = pjsip_evsub_get_termination_reason(sub);
+    pj_ansi_snprintf(w->reason, sizeof(w->reason), "%.*s",
+		     (int)reason->slen, reason->ptr);
+    w->terminated = PJ_TRUE;
+    w->sub = NULL;
+}
+
+static void uac_on_rx_notify(pjsip_evsub *sub, pjsip_rx_data *rdata,
+			     int *p_st_code, pj_str_t **p_st_text,
+			     pjsip_hdr *res_hdr, pjsip_msg_body **p_body)
+{
+    struct watcher *w = find_watcher(sub);
+    pjsip_msg_body *body = rdata->msg_info.msg->body;
+
+    PJ_UNUSED_ARG(p_st_code);
+    PJ_UNUSED_ARG(p_st_text);
+    PJ_UNUSED_ARG(res_hdr);
+    PJ_UNUSED_ARG(p_body);
+
+    if (!w)
+	return;
+
+    ++w->notify_cnt;
+    if (body) {
+	pj_ansi_snprintf(w->body, sizeof(w->body), "%.*s",
+			 (int)body->len, (char*)body->data);
+    } else {
+	w->body[0] = '\0';
+    }
+}
+
+/* Don't refresh, let the server expire the subscriptions */
+static void uac_on_client_refresh(pjsip_evsub *sub)
+{
+    PJ_UNUSED_ARG(sub);
+}
+
+static pjsip_evsub_user uac_cb =
+{
+    &uac_on_evsub_state,
+    NULL,
+    NULL,
+    &uac_on_rx_notify,
+    &uac_on_client_refresh,
+    NULL
+};
+
+static void on_watched(pjsip_evsub_srv *srv, const pj_str_t *resource,
+		       pj_bool_t watched)
+{
+    PJ_UNUSED_ARG(srv);
+    PJ_UNUSED_ARG(resource);
+
+    if (watched)
+	++watched_cnt;
+    else
+	++unwatched_cnt;
+}
+
+
+static int subscribe(unsigned idx, const char *res, unsigned expires)
+{
+    char local[64], target[64];
+    pj_str_t local_uri, target_uri, event = pj_str(EVENT);
+    pjsip_dialog *dlg;
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    pj_ansi_snprintf(local, sizeof(local),
+		     "<sip:w%u@127.0.0.1;transport=loop-dgram>", idx);
+    pj_ansi_snprintf(target, sizeof(target),
+		     "sip:%s@127.0.0.1;transport=loop-dgram", res);
+    local_uri = pj_str(local);
+    target_uri = pj_str(target);
+
+    status = pjsip_dlg_create_uac(pjsip_ua_instance(), &local_uri,
+				  &local_uri, &target_uri, &target_uri, &dlg);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create dialog", status);
+	return -10;
+    }
+
+    pj_bzero(&watchers[idx], sizeof(watchers[idx]));
+    status = pjsip_evsub_create_uac(dlg, &uac_cb, &event, 0,
+				    &watchers[idx].sub);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create subscription", status);
+	pjsip_dlg_terminate(dlg);
+	return -20;
+    }
+
+    status = pjsip_evsub_initiate(watchers[idx].sub, NULL, expires, &tdata);
+    if (status == PJ_SUCCESS)
+	status = pjsip_evsub_send_request(watchers[idx].sub, tdata);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to send SUBSCRIBE", status);
+	return -30;
+    }
+
+    return 0;
+}
+
+/* Wait until all watchers in the range have the body, or are terminated
+ * if body is NULL.
+ */
+static int wait_watchers(unsigned first, unsigned cnt, const char *body,
+			 unsigned min_notify, unsigned msec)
+{
+    pj_time_val timeout;
+
+    pj_gettickcount(&timeout);
+    timeout.msec += msec;
+    pj_time_val_normalize(&timeout);
+
+    for (;;) {
+	pj_time_val now, poll_delay = { 0, 10 };
+	unsigned i;
+
+	for (i=first; i<first+cnt; ++i) {
+	    struct watcher *w = &watchers[i];
+
+	    if (body == NULL) {
+		if (!w->terminated)
+		    break;
+	    } else if (w->terminated || w->notify_cnt < min_notify ||
+		       pj_ansi_strcmp(w->body, body) != 0)
+	    {
+		break;
+	    }
+	}
+	if (i == first+cnt)
+	    return 0;
+
+	pj_gettickcount(&now);
+	if (PJ_TIME_VAL_GT(now, timeout)) {
+	    PJ_LOG(3,(THIS_FILE, "   error: watcher %u: notify=%u body=\"%s\" "
+				 "terminated=%d", i, watchers[i].notify_cnt,
+		      watchers[i].body, watchers[i].terminated));
+	    return -1;
+	}
+
+	pjsip_endpt_handle_events(endpt, &poll_delay);
+    }
+}
+
+
+int evsub_srv_test(void)
+{
+    pjsip_evsub_srv_param param;
+    pjsip_evsub_srv *srv = NULL, *srv2;
+    pjsip_evsub_srv_stat stat;
+    pj_str_t res1 = pj_str("res1@127.0.0.1");
+    pj_str_t res3 = pj_str("res3@127.0.0.1");
+    pj_str_t body;
+    unsigned i, notify_cnt[WATCHER_CNT];
+    pjsip_tx_data *tdata;
+    pjsip_transport *loop;
+    pj_sockaddr_in addr;
+    pj_status_t status;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  event subscription server test"));
+
+    /* The loop transport must not deliver synchronously, otherwise the
+     * response arrives before the client transaction has been started.
+     */
+    pj_sockaddr_in_init(&addr, NULL, 0);
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_LOOP_DGRAM,
+					   &addr, sizeof(addr), NULL, &loop);
+    if (status != PJ_SUCCESS) {
+	PJ_LOG(3,(THIS_FILE, "   error: loop transport is not configured!"));
+	return -90;
+    }
+    pjsip_loop_set_delay(loop, 1);
+
+    if (init_evsub_modules() != 0) {
+	rc = -100;
+	goto on_return;
+    }
+
+    watched_cnt = unwatched_cnt = 0;
+    pj_bzero(watchers, sizeof(watchers));
+
+    pjsip_evsub_srv_param_default(&param);
+    param.event = pj_str(EVENT);
+    param.content_type = pj_str("text/plain");
+    param.expires = 60;
+    param.max_pending = MAX_PENDING;
+    param.cb.on_watched = &on_watched;
+
+    status = pjsip_evsub_srv_create(endpt, &param, &srv);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create server", status);
+	rc = -120;
+	goto on_return;
+    }
+
+    status = pjsip_evsub_srv_create(endpt, &param, &srv2);
+    if (status != PJ_EEXISTS) {
+	rc = -130;
+	goto on_return;
+    }
+
+    /* The state of res1 is set before anyone subscribes */
+    body = pj_str("v0");
+    pjsip_evsub_srv_set_state(srv, &res1, &body);
+
+    for (i=0; i<WATCHER_CNT; ++i) {
+	if (i < RES1_CNT)
+	    rc = subscribe(i, "res1", 60);
+	else if (i < RES1_CNT + RES2_CNT)
+	    rc = subscribe(i, "res2", 60);
+	else
+	    rc = subscribe(i, "res3", SHORT_EXPIRES);
+	if (rc != 0)
+	    goto on_return;
+    }
+
+    /* Initial NOTIFY, res2 and res3 have no state yet */
+    if (wait_watchers(0, RES1_CNT, "v0", 1, 3000) != 0 ||
+	wait_watchers(RES1_CNT, RES2_CNT + RES3_CNT, "", 1, 3000) != 0)
+    {
+	rc = -140;
+	goto on_return;
+    }
+    flush_events(100);
+
+    pjsip_evsub_srv_get_stat(srv, &stat);
+    if (stat.watchers != WATCHER_CNT || stat.resources != 3 ||
+	stat.pending != 0 || stat.queued != 0 ||
+	watched_cnt != 3 ||
+	pjsip_evsub_srv_get_watcher_count(srv, &res1) != RES1_CNT)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: watchers=%u resources=%u watched=%d",
+		  stat.watchers, stat.resources, watched_cnt));
+	rc = -150;
+	goto on_return;
+    }
+
+    /* Quick changes are coalesced, and only res1 watchers are notified */
+    for (i=0; i<WATCHER_CNT; ++i)
+	notify_cnt[i] = watchers[i].notify_cnt;
+
+    body = pj_str("v1");
+    pjsip_evsub_srv_set_state(srv, &res1, &body);
+    body = pj_str("v2");
+    pjsip_evsub_srv_set_state(srv, &res1, &body);
+    body = pj_str("v3");
+    pjsip_evsub_srv_set_state(srv, &res1, &body);
+
+    pjsip_evsub_srv_get_stat(srv, &stat);
+    if (stat.pending > MAX_PENDING ||
+	stat.pending + stat.queued != RES1_CNT)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: pending=%u queued=%u",
+		  stat.pending, stat.queued));
+	rc = -160;
+	goto on_return;
+    }
+
+    if (wait_watchers(0, RES1_CNT, "v3", 0, 3000) != 0) {
+	rc = -170;
+	goto on_return;
+    }
+    flush_events(100);
+
+    for (i=0; i<WATCHER_CNT; ++i) {
+	unsigned cnt = watchers[i].notify_cnt - notify_cnt[i];
+
+	if ((i < RES1_CNT && (cnt < 1 || cnt > 2)) ||
+	    (i >= RES1_CNT && cnt != 0))
+	{
+	    PJ_LOG(3,(THIS_FILE, "   error: watcher %u got %u NOTIFY",
+		      i, cnt));
+	    rc = -180;
+	    goto on_return;
+	}
+    }
+
+    pjsip_evsub_srv_get_stat(srv, &stat);
+    PJ_LOG(3,(THIS_FILE, "   %u NOTIFY sent, %u changes coalesced",
+	      stat.notify_sent, stat.coalesced));
+    if (stat.coalesced == 0 || stat.pending != 0 || stat.queued != 0) {
+	rc = -190;
+	goto on_return;
+    }
+
+    /* Refresh gets the current state again */
+    notify_cnt[0] = watchers[0].notify_cnt;
+    status = pjsip_evsub_initiate(watchers[0].sub, NULL, 60, &tdata);
+    if (status == PJ_SUCCESS)
+	status = pjsip_evsub_send_request(watchers[0].sub, tdata);
+    if (status != PJ_SUCCESS ||
+	wait_watchers(0, 1, "v3", notify_cnt[0] + 1, 3000) != 0)
+    {
+	rc = -200;
+	goto on_return;
+    }
+
+    /* Unsubscribe */
+    status = pjsip_evsub_initiate(watchers[1].sub, NULL, 0, &tdata);
+    if (status == PJ_SUCCESS)
+	status = pjsip_evsub_send_request(watchers[1].sub, tdata);
+    if (status != PJ_SUCCESS || wait_watchers(1, 1, NULL, 0, 3000) != 0) {
+	rc = -210;
+	goto on_return;
+    }
+    if (pjsip_evsub_srv_get_watcher_count(srv, &res1) != RES1_CNT - 1) {
+	rc = -220;
+	goto on_return;
+    }
+
+    /* res3 watchers don't refresh, so the server expires them */
+    if (wait_watchers(RES1_CNT + RES2_CNT, RES3_CNT, NULL, 0,
+		      (SHORT_EXPIRES + 3) * 1000) != 0)
+    {
+	rc = -230;
+	goto on_return;
+    }
+    for (i=RES1_CNT + RES2_CNT; i<WATCHER_CNT; ++i) {
+	if (pj_ansi_strcmp(watchers[i].reason, "timeout") != 0) {
+	    rc = -240;
+	    goto on_return;
+	}
+    }
+
+    pjsip_evsub_srv_get_stat(srv, &stat);
+    if (stat.expired != RES3_CNT || unwatched_cnt != 1 ||
+	stat.resources != 2 ||
+	pjsip_evsub_srv_get_watcher_count(srv, &res3) != 0)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: expired=%u unwatched=%d resources=%u",
+		  stat.expired, unwatched_cnt, stat.resources));
+	rc = -250;
+	goto on_return;
+    }
+
+    /* Destroying the server terminates the rest */
+    pjsip_evsub_srv_destroy(srv);
+    srv = NULL;
+
+    if (wait_watchers(0, WATCHER_CNT, NULL, 0, 3000) != 0) {
+	rc = -260;
+	goto on_return;
+    }
+    if (pj_ansi_strcmp(watchers[0].reason, "noresource") != 0 ||
+	unwatched_cnt != 1)
+    {
+	rc = -270;
+	goto on_return;
+    }
+
+on_return:
+    if (srv)
+	pjsip_evsub_srv_destroy(srv);
+    for (i=0; i<WATCHER_CNT; ++i) {
+	if (watchers[i].sub)
+	    pjsip_evsub_terminate(watchers[i].sub, PJ_FALSE);
+    }
+    flush_events(500);
+    pjsip_loop_set_delay(loop, 0);
+    pjsip_transport_dec_ref(loop);
+    return rc;
+}
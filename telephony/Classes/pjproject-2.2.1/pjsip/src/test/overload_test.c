@@ -0,0 +1,358 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjlib.h>
+
+#define THIS_FILE	"overload_test.c"
+
+#define INTERVAL	10
+#define TSX_CNT		6
+#define REJECT_CNT	10
+#define RETRY_AFTER	10
+#define TARGET		"sip:overload@127.0.0.1;transport=loop-dgram"
+#define CALL_ID_PREFIX	"overload-test-"
+
+
+static pj_bool_t on_rx_request(pjsip_rx_data *rdata);
+static pj_bool_t on_rx_response(pjsip_rx_data *rdata);
+
+static pjsip_module mod_overload_test =
+{
+    NULL, NULL,				/* prev, next.		*/
+    { "mod-overload-test", 17 },	/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_TSX_LAYER-1,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &on_rx_request,			/* on_rx_request()	*/
+    &on_rx_response,			/* on_rx_response()	*/
+    NULL,				/* on_tx_request.	*/
+    NULL,				/* on_tx_response()	*/
+    NULL,				/* on_tsx_state()	*/
+};
+
+static struct test_state
+{
+    unsigned	req_cnt;
+    unsigned	resp_cnt;
+    int		last_code;
+    int		retry_after;
+    int		oc;
+} state;
+
+
+static pj_bool_t is_test_msg(pjsip_rx_data *rdata)
+{
+    pj_str_t prefix = pj_str(CALL_ID_PREFIX);
+
+    return rdata->msg_info.cid->id.slen > prefix.slen &&
+	   pj_strncmp(&rdata->msg_info.cid->id, &prefix, prefix.slen) == 0;
+}
+
+static pj_bool_t on_rx_request(pjsip_rx_data *rdata)
+{
+    if (!is_test_msg(rdata))
+	return PJ_FALSE;
+
+    ++state.req_cnt;
+    pjsip_endpt_respond_stateless(endpt, rdata, 200, NULL, NULL, NULL);
+    return PJ_TRUE;
+}
+
+static pj_bool_t on_rx_response(pjsip_rx_data *rdata)
+{
+    const pj_str_t STR_OC = { "oc", 2 };
+    pjsip_retry_after_hdr *retry_after;
+    pjsip_param *oc;
+
+    if (!is_test_msg(rdata))
+	return PJ_FALSE;
+
+    state.last_code = rdata->msg_info.msg->line.status.code;
+
+    retry_after = (pjsip_retry_after_hdr*)
+		  pjsip_msg_find_hdr(rdata->msg_info.msg,
+				     PJSIP_H_RETRY_AFTER, NULL);
+    state.retry_after = retry_after ? retry_after->ivalue : -1;
+
+    oc = pjsip_param_find(&rdata->msg_info.via->other_param, &STR_OC);
+    state.oc = (oc && oc->value.slen) ? (int)pj_strtoul(&oc->value) : -1;
+
+    ++state.resp_cnt;
+    return PJ_TRUE;
+}
+
+
+/* Send new (or in-dialog) request with RFC 7339 "oc" Via parameter and
+ * wait for the response.
+ */
+static int send_request(int cseq, pj_bool_t in_dialog)
+{
+    pj_str_t target = pj_str(TARGET);
+    pj_str_t from = pj_str("<sip:alice@127.0.0.1>");
+    pj_str_t to = pj_str("<sip:overload@127.0.0.1>");
+    pj_str_t call_id;
+    char call_id_buf[32];
+    pjsip_tx_data *tdata;
+    pjsip_via_hdr *via;
+    pjsip_param *oc;
+    unsigned resp_cnt = state.resp_cnt;
+    pj_time_val timeout;
+    pj_status_t status;
+
+    pj_ansi_snprintf(call_id_buf, sizeof(call_id_buf), CALL_ID_PREFIX "%d",
+		     cseq);
+    call_id = pj_str(call_id_buf);
+
+    status = pjsip_endpt_create_request(endpt, pjsip_get_options_method(),
+					&target, &from, &to, NULL,
+					&call_id, cseq, NULL, &tdata);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create request", status);
+	return -10;
+    }
+
+    if (in_dialog)
+	PJSIP_MSG_TO_HDR(tdata->msg)->tag = pj_str("bob");
+
+    via = (pjsip_via_hdr*) pjsip_msg_find_hdr(tdata->msg, PJSIP_H_VIA, NULL);
+    oc = PJ_POOL_ZALLOC_T(tdata->pool, pjsip_param);
+    oc->name = pj_str("oc");
+    pj_list_push_back(&via->other_param, oc);
+
+    status = pjsip_endpt_send_request_stateless(endpt, tdata, NULL, NULL);
+    if (status != PJ_SUCCESS)
+	return -20;
+
+    pj_gettickcount(&timeout);
+    timeout.sec += 2;
+    while (state.resp_cnt == resp_cnt) {
+	pj_time_val now, poll_delay = { 0, 10 };
+
+	pjsip_endpt_handle_events(endpt, &poll_delay);
+
+	pj_gettickcount(&now);
+	if (PJ_TIME_VAL_GT(now, timeout))
+	    return -30;
+    }
+
+    return 0;
+}
+
+/* Poll until the overload level reaches the specified value. */
+static int wait_level(unsigned level)
+{
+    pjsip_overload_stat stat;
+    pj_time_val timeout;
+
+    pj_gettickcount(&timeout);
+    timeout.sec += 3;
+    for (;;) {
+	pj_time_val now, poll_delay = { 0, INTERVAL };
+
+	pjsip_endpt_handle_events(endpt, &poll_delay);
+
+	pjsip_overload_get_stat(&stat);
+	if (stat.level == level)
+	    return 0;
+
+	pj_gettickcount(&now);
+	if (PJ_TIME_VAL_GT(now, timeout)) {
+	    PJ_LOG(3,(THIS_FILE, "   error: level is %d%% instead of %d%%",
+		      stat.level, level));
+	    return -1;
+	}
+    }
+}
+
+
+int overload_test(void)
+{
+    pjsip_overload_param param;
+    pjsip_overload_stat stat;
+    pjsip_endpt_load load0, load1;
+    pjsip_tx_data *request = NULL;
+    pjsip_transaction *tsx[TSX_CNT];
+    pj_str_t target = pj_str(TARGET);
+    pj_str_t from = pj_str("<sip:alice@127.0.0.1>");
+    unsigned i, req_cnt;
+    int cseq = 0, rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "  overload control test"));
+
+    pj_bzero(&state, sizeof(state));
+    pj_bzero(tsx, sizeof(tsx));
+
+    status = pjsip_endpt_register_module(endpt, &mod_overload_test);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to register module", status);
+	return -100;
+    }
+
+    /* Without overload control the endpoint doesn't count its load */
+    pjsip_endpt_get_load(endpt, &load0);
+    rc = send_request(++cseq, PJ_FALSE);
+    pjsip_endpt_get_load(endpt, &load1);
+    if (rc != 0 || load1.poll_cnt != load0.poll_cnt ||
+	load1.rx_msg_cnt != load0.rx_msg_cnt)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: load counted without overload "
+		  "control (%d)", rc));
+	pjsip_endpt_unregister_module(endpt, &mod_overload_test);
+	return -105;
+    }
+
+    /* Only the transaction count is used as overload indicator */
+    pjsip_overload_param_default(&param);
+    param.interval = INTERVAL;
+    param.max_tsx_cnt = pjsip_tsx_layer_get_tsx_count() + 2;
+    param.max_latency = 0;
+    param.max_busy_poll = 0;
+    param.retry_after = RETRY_AFTER;
+    param.feedback = PJ_TRUE;
+    status = pjsip_overload_init_module(endpt, &param);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to init overload control", status);
+	pjsip_endpt_unregister_module(endpt, &mod_overload_test);
+	return -110;
+    }
+
+    /* Not overloaded */
+    rc = send_request(++cseq, PJ_FALSE);
+    if (rc != 0 || state.last_code != 200 || state.oc != 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: request not admitted (%d/%d/%d)",
+		  rc, state.last_code, state.oc));
+	rc = -120;
+	goto on_return;
+    }
+
+    /* Create transactions beyond the maximum */
+    status = pjsip_endpt_create_request(endpt, pjsip_get_options_method(),
+					&target, &from, &target, NULL, NULL,
+					-1, NULL, &request);
+    if (status != PJ_SUCCESS) {
+	rc = -130;
+	goto on_return;
+    }
+
+    for (i=0; i<TSX_CNT; ++i) {
+	pjsip_via_hdr *via;
+
+	status = pjsip_tsx_create_uac(NULL, request, &tsx[i]);
+	if (status != PJ_SUCCESS) {
+	    app_perror("   error: unable to create transaction", status);
+	    rc = -140;
+	    goto on_return;
+	}
+	via = (pjsip_via_hdr*) pjsip_msg_find_hdr(request->msg, PJSIP_H_VIA,
+						  NULL);
+	via->branch_param.slen = 0;
+    }
+
+    if (wait_level(100) != 0) {
+	rc = -150;
+	goto on_return;
+    }
+
+    /* New requests must be rejected before reaching the application */
+    req_cnt = state.req_cnt;
+    for (i=0; i<REJECT_CNT; ++i) {
+	rc = send_request(++cseq, PJ_FALSE);
+	if (rc != 0 || state.last_code != PJSIP_SC_SERVICE_UNAVAILABLE ||
+	    state.retry_after < RETRY_AFTER || state.oc != 100)
+	{
+	    PJ_LOG(3,(THIS_FILE, "   error: request not rejected "
+		      "(%d/%d/%d/%d)", rc, state.last_code,
+		      state.retry_after, state.oc));
+	    rc = -160;
+	    goto on_return;
+	}
+    }
+    if (state.req_cnt != req_cnt) {
+	rc = -170;
+	goto on_return;
+    }
+
+    /* In-dialog requests are still admitted */
+    rc = send_request(++cseq, PJ_TRUE);
+    if (rc != 0 || state.last_code != 200 || state.req_cnt != req_cnt+1) {
+	PJ_LOG(3,(THIS_FILE, "   error: in-dialog request not admitted"));
+	rc = -180;
+	goto on_return;
+    }
+
+    /* Level must fall once the load is gone */
+    for (i=0; i<TSX_CNT; ++i) {
+	pjsip_tsx_terminate(tsx[i], PJSIP_SC_REQUEST_TERMINATED);
+	tsx[i] = NULL;
+    }
+    pj_timer_heap_poll(pjsip_endpt_get_timer_heap(endpt), NULL);
+
+    if (wait_level(0) != 0) {
+	rc = -190;
+	goto on_return;
+    }
+
+    rc = send_request(++cseq, PJ_FALSE);
+    if (rc != 0 || state.last_code != 200) {
+	PJ_LOG(3,(THIS_FILE, "   error: request not admitted after overload"));
+	rc = -200;
+	goto on_return;
+    }
+
+    pjsip_overload_get_stat(&stat);
+    if (stat.rejected != REJECT_CNT || stat.admitted != 2) {
+	PJ_LOG(3,(THIS_FILE, "   error: invalid stat (admitted=%d, "
+		  "rejected=%d)", stat.admitted, stat.rejected));
+	rc = -210;
+	goto on_return;
+    }
+
+on_return:
+    for (i=0; i<TSX_CNT; ++i) {
+	if (tsx[i])
+	    pjsip_tsx_terminate(tsx[i], PJSIP_SC_REQUEST_TERMINATED);
+    }
+    pj_timer_heap_poll(pjsip_endpt_get_timer_heap(endpt), NULL);
+    if (request)
+	pjsip_tx_data_dec_ref(request);
+
+    pjsip_endpt_unregister_module(endpt, pjsip_overload_instance());
+    if (rc == 0 && pjsip_overload_get_stat(&stat) != PJ_EINVALIDOP)
+	rc = -220;
+
+    /* The module can be registered again, with its counters reset */
+    if (rc == 0) {
+	if (pjsip_overload_init_module(endpt, &param) != PJ_SUCCESS ||
+	    pjsip_overload_get_stat(&stat) != PJ_SUCCESS ||
+	    stat.admitted != 0 || stat.rejected != 0)
+	{
+	    rc = -230;
+	}
+	pjsip_endpt_unregister_module(endpt, pjsip_overload_instance());
+    }
+
+    pjsip_endpt_unregister_module(endpt, &mod_overload_test);
+    return rc;
+}
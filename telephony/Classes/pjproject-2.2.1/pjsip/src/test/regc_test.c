@@ -95,6 +95,7 @@ static struct registrar
     pjsip_module	    mod;
     struct registrar_cfg    cfg;
     unsigned		    response_cnt;
+    pjsip_auth_srv	   *auth_srv;	    /* verify with this server	*/
 } registrar = 
 {
     {
@@ -129,12 +130,33 @@ static pj_bool_t regs_rx_request(pjsip_rx_data *rdata)
 
     pj_list_init(&hdr_list);
 
+    if (registrar.auth_srv) {
+	status = pjsip_auth_srv_verify(registrar.auth_srv, rdata, &code);
+	if (status != PJ_SUCCESS) {
+	    pjsip_tx_data *tdata;
+	    pj_str_t qop = pj_str("auth");
+	    pj_bool_t stale = (status == PJSIP_EAUTHSTALENONCE);
+
+	    status = pjsip_endpt_create_response(endpt, rdata, 401, NULL,
+						 &tdata);
+	    pj_assert(status == PJ_SUCCESS);
+	    status = pjsip_auth_srv_challenge(registrar.auth_srv, &qop, NULL,
+					      NULL, stale, tdata);
+	    pj_assert(status == PJ_SUCCESS);
+	    status = pjsip_endpt_send_response2(endpt, rdata, tdata,
+						NULL, NULL);
+	    pj_assert(status == PJ_SUCCESS);
+	    return PJ_TRUE;
+	}
+    }
+
     if (registrar.cfg.authenticate && 
 	pjsip_msg_find_hdr(msg, PJSIP_H_AUTHORIZATION, NULL)==NULL) 
     {
 	pjsip_generic_string_hdr *hwww;
 	const pj_str_t hname = pj_str("WWW-Authenticate");
-	const pj_str_t hvalue = pj_str("Digest realm=\"test\"");
+	const pj_str_t hvalue = pj_str("Digest realm=\"test\", "
+				       "nonce=\"1234567890\"");
 
 	hwww = pjsip_generic_string_hdr_create(rdata->tp_info.pool, &hname, 
 					       &hvalue);
@@ -735,6 +757,363 @@ static int auth_send_error(const pj_str_t *registrar_uri,
 
 
 
+/************************************************************************/
+/* Bulk registration client */
+#define BULK_LINES  20
+#define BULK_EXPIRES 60
+
+static struct
+{
+    unsigned	cb_cnt;
+    unsigned	state_cnt[PJSIP_REGC_BULK_UNREGISTERING+1];
+    unsigned	max_pending;
+    int		last_code;
+} bulk_result;
+
+static void bulk_cb(const pjsip_regc_bulk_cbparam *param)
+{
+    pjsip_regc_bulk_stat stat;
+
+    ++bulk_result.cb_cnt;
+    ++bulk_result.state_cnt[param->state];
+    bulk_result.last_code = param->code;
+
+    pjsip_regc_bulk_get_stat(param->bulk, &stat);
+    if (stat.pending > bulk_result.max_pending)
+	bulk_result.max_pending = stat.pending;
+}
+
+/* Wait until the callback has been called cnt times */
+static int bulk_wait(unsigned cnt)
+{
+    unsigned i;
+
+    for (i=0; i<100 && bulk_result.cb_cnt < cnt; ++i)
+	flush_events(100);
+
+    if (bulk_result.cb_cnt != cnt) {
+	PJ_LOG(3,(THIS_FILE, "    error: expecting %d callbacks, got %d",
+		  cnt, bulk_result.cb_cnt));
+	return -1;
+    }
+    return 0;
+}
+
+static pj_status_t bulk_create(const pj_str_t *registrar_uri,
+			       unsigned max_pending,
+			       pjsip_regc_bulk **p_bulk)
+{
+    pjsip_regc_bulk_param param;
+    pjsip_cred_info cred;
+    unsigned i;
+    pj_status_t status;
+
+    pjsip_regc_bulk_param_default(&param);
+    param.registrar = *registrar_uri;
+    param.contact_host = pj_str("127.0.0.1:5999");
+    param.expires = BULK_EXPIRES;
+    param.max_pending = max_pending;
+    param.on_state = &bulk_cb;
+
+    status = pjsip_regc_bulk_create(endpt, &param, BULK_LINES, p_bulk);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    pj_bzero(&cred, sizeof(cred));
+    cred.scheme = pj_str("digest");
+    cred.data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+    cred.data = pj_str("password");
+
+    for (i=0; i<BULK_LINES; ++i) {
+	char user[16];
+	pj_str_t tmp;
+	unsigned index;
+
+	pj_ansi_snprintf(user, sizeof(user), "bulk%02u", i);
+	tmp = pj_str(user);
+	cred.username = tmp;
+	status = pjsip_regc_bulk_add(*p_bulk, &tmp, &cred, NULL, &index);
+	if (status != PJ_SUCCESS || index != i) {
+	    pjsip_regc_bulk_destroy(*p_bulk);
+	    return status ? status : PJ_EBUG;
+	}
+    }
+
+    pj_bzero(&bulk_result, sizeof(bulk_result));
+    return PJ_SUCCESS;
+}
+
+/* Register and unregister many lines. Each line is challenged on its
+ * first registration, and the unregistration is authorized in advance.
+ */
+static int bulk_register_test(const pj_str_t *registrar_uri)
+{
+    enum { MAX_PENDING = 4 };
+    struct registrar_cfg server_cfg = 
+	/* respond	code	auth	  contact  exp_prm  expires more_contacts */
+	{ PJ_TRUE,	200,	PJ_TRUE,  EXACT,   BULK_EXPIRES, 0, {NULL, 0}};
+    pjsip_regc_bulk *bulk;
+    pjsip_regc_bulk_stat stat;
+    pjsip_regc_bulk_info info;
+    pj_str_t user = pj_str("bulk99");
+    pj_status_t status;
+    int ret = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  bulk registration"));
+
+    pj_memcpy(&registrar.cfg, &server_cfg, sizeof(server_cfg));
+    registrar.response_cnt = 0;
+
+    status = bulk_create(registrar_uri, MAX_PENDING, &bulk);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error creating bulk client", status);
+	return -800;
+    }
+
+    if (pjsip_regc_bulk_add(bulk, &user, NULL, NULL, NULL) != PJ_ETOOMANY) {
+	ret = -805;
+	goto on_return;
+    }
+
+    pjsip_regc_bulk_start(bulk, 0);
+    if (bulk_wait(BULK_LINES) != 0) {
+	ret = -810;
+	goto on_return;
+    }
+
+    pjsip_regc_bulk_get_stat(bulk, &stat);
+    PJ_LOG(3,(THIS_FILE, "    %u registered with %u requests, %u challenged",
+	      stat.registered, stat.requests, stat.challenged));
+    if (stat.registered != BULK_LINES ||
+	bulk_result.state_cnt[PJSIP_REGC_BULK_REGISTERED] != BULK_LINES ||
+	registrar.response_cnt != BULK_LINES)
+    {
+	ret = -820;
+	goto on_return;
+    }
+    /* Only the first request of each line is challenged */
+    if (stat.challenged != BULK_LINES || stat.requests != BULK_LINES * 2) {
+	ret = -830;
+	goto on_return;
+    }
+    if (bulk_result.max_pending > MAX_PENDING || stat.resolved != 1) {
+	ret = -840;
+	goto on_return;
+    }
+
+    /* Refresh is before expiration, within the jitter */
+    pjsip_regc_bulk_get_info(bulk, BULK_LINES-1, &info);
+    if (info.state != PJSIP_REGC_BULK_REGISTERED || info.code != 200 ||
+	info.expires < BULK_EXPIRES-1 || info.expires > BULK_EXPIRES ||
+	info.next_reg > BULK_EXPIRES - PJSIP_REGISTER_CLIENT_DELAY_BEFORE_REFRESH ||
+	info.next_reg < (BULK_EXPIRES - PJSIP_REGISTER_CLIENT_DELAY_BEFORE_REFRESH) *
+			(100 - PJSIP_REGC_BULK_JITTER) / 100 - 1)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: state=%d, expires=%u, next_reg=%d",
+		  info.state, info.expires, info.next_reg));
+	ret = -850;
+	goto on_return;
+    }
+
+    /* Unregister all */
+    pjsip_regc_bulk_unregister(bulk, -1);
+    if (bulk_wait(BULK_LINES * 2) != 0) {
+	ret = -860;
+	goto on_return;
+    }
+
+    pjsip_regc_bulk_get_stat(bulk, &stat);
+    pjsip_regc_bulk_get_info(bulk, 0, &info);
+    if (bulk_result.state_cnt[PJSIP_REGC_BULK_IDLE] != BULK_LINES ||
+	stat.registered != 0 || stat.requests != BULK_LINES * 2 +
+						  stat.challenged ||
+	info.state != PJSIP_REGC_BULK_IDLE || info.expires != 0 ||
+	info.next_reg != -1)
+    {
+	ret = -870;
+	goto on_return;
+    }
+
+on_return:
+    pjsip_regc_bulk_destroy(bulk);
+    return ret;
+}
+
+static pj_status_t bulk_auth_lookup(pj_pool_t *pool, const pj_str_t *realm,
+				    const pj_str_t *acc_name,
+				    pjsip_cred_info *cred_info)
+{
+    PJ_UNUSED_ARG(pool);
+
+    if (acc_name->slen < 4 || pj_memcmp(acc_name->ptr, "bulk", 4) != 0)
+	return PJSIP_EAUTHACCNOTFOUND;
+
+    pj_bzero(cred_info, sizeof(*cred_info));
+    cred_info->realm = *realm;
+    cred_info->username = *acc_name;
+    cred_info->data_type = PJSIP_CRED_DATA_PLAIN_PASSWD;
+    cred_info->data = pj_str("password");
+    return PJ_SUCCESS;
+}
+
+/* Register and unregister many lines with several requests in progress,
+ * against a registrar which verifies the digest and rejects the nonce
+ * count that has been used with the nonce.
+ */
+static int bulk_auth_test(const pj_str_t *registrar_uri)
+{
+    enum { MAX_PENDING = 8 };
+    struct registrar_cfg server_cfg = 
+	/* respond	code	auth	  contact  exp_prm  expires more_contacts */
+	{ PJ_TRUE,	200,	PJ_FALSE, EXACT,   BULK_EXPIRES, 0, {NULL, 0}};
+    pjsip_auth_srv auth_srv;
+    pjsip_auth_srv_init_param param;
+    pjsip_auth_srv_nonce_store *nonce_store;
+    pj_str_t realm = pj_str("bulk");
+    pj_pool_t *pool;
+    pjsip_regc_bulk *bulk = NULL;
+    pjsip_regc_bulk_stat stat;
+    pj_status_t status;
+    int ret = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  bulk registration with digest verification"));
+
+    pool = pjsip_endpt_create_pool(endpt, "regcbulk", 1000, 1000);
+    status = pjsip_auth_srv_nonce_store_create(pool, BULK_LINES * 2,
+					       BULK_EXPIRES, &nonce_store);
+    if (status != PJ_SUCCESS) {
+	pj_pool_release(pool);
+	return -1000;
+    }
+
+    pj_bzero(&param, sizeof(param));
+    param.realm = &realm;
+    param.nonce_store = nonce_store;
+    pjsip_auth_srv_init2(pool, &auth_srv, &param);
+    auth_srv.lookup = &bulk_auth_lookup;
+
+    pj_memcpy(&registrar.cfg, &server_cfg, sizeof(server_cfg));
+    registrar.response_cnt = 0;
+    registrar.auth_srv = &auth_srv;
+
+    status = bulk_create(registrar_uri, MAX_PENDING, &bulk);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error creating bulk client", status);
+	ret = -1010;
+	goto on_return;
+    }
+
+    pjsip_regc_bulk_start(bulk, 0);
+    if (bulk_wait(BULK_LINES) != 0) {
+	ret = -1020;
+	goto on_return;
+    }
+
+    pjsip_regc_bulk_get_stat(bulk, &stat);
+    PJ_LOG(3,(THIS_FILE, "    %u registered with %u requests, %u challenged, "
+	      "%u stale", stat.registered, stat.requests, stat.challenged,
+	      auth_srv.stat.stale));
+    if (stat.registered != BULK_LINES || stat.challenged != BULK_LINES ||
+	stat.requests != BULK_LINES * 2 || bulk_result.max_pending < 2 ||
+	bulk_result.max_pending > MAX_PENDING ||
+	auth_srv.stat.accepted != BULK_LINES || auth_srv.stat.stale != 0)
+    {
+	ret = -1030;
+	goto on_return;
+    }
+
+    /* The unregistration reuses the nonce with the next nonce count */
+    pjsip_regc_bulk_unregister(bulk, -1);
+    if (bulk_wait(BULK_LINES * 2) != 0) {
+	ret = -1040;
+	goto on_return;
+    }
+
+    pjsip_regc_bulk_get_stat(bulk, &stat);
+    if (bulk_result.state_cnt[PJSIP_REGC_BULK_IDLE] != BULK_LINES ||
+	stat.challenged != BULK_LINES || stat.requests != BULK_LINES * 3 ||
+	auth_srv.stat.accepted_reused != BULK_LINES ||
+	auth_srv.stat.stale != 0)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: %u requests, %u challenged, "
+		  "%u reused, %u stale", stat.requests, stat.challenged,
+		  auth_srv.stat.accepted_reused, auth_srv.stat.stale));
+	ret = -1050;
+	goto on_return;
+    }
+
+on_return:
+    if (bulk)
+	pjsip_regc_bulk_destroy(bulk);
+    registrar.auth_srv = NULL;
+    pjsip_auth_srv_nonce_store_destroy(nonce_store);
+    pj_pool_release(pool);
+    return ret;
+}
+
+/* Registrar rejects the lines, and destroying with requests in progress */
+static int bulk_error_test(const pj_str_t *registrar_uri)
+{
+    struct registrar_cfg server_cfg = 
+	/* respond	code	auth	  contact  exp_prm expires more_contacts */
+	{ PJ_TRUE,	403,	PJ_FALSE, NONE,    0,	    0,	    {NULL, 0}};
+    pjsip_regc_bulk *bulk;
+    pjsip_regc_bulk_stat stat;
+    pjsip_regc_bulk_info info;
+    pj_status_t status;
+    int ret = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  bulk registration error"));
+
+    pj_memcpy(&registrar.cfg, &server_cfg, sizeof(server_cfg));
+
+    status = bulk_create(registrar_uri, PJSIP_REGC_BULK_MAX_PENDING, &bulk);
+    if (status != PJ_SUCCESS)
+	return -900;
+
+    pjsip_regc_bulk_start(bulk, 0);
+    if (bulk_wait(BULK_LINES) != 0) {
+	pjsip_regc_bulk_destroy(bulk);
+	return -910;
+    }
+
+    pjsip_regc_bulk_get_stat(bulk, &stat);
+    pjsip_regc_bulk_get_info(bulk, 0, &info);
+    if (stat.failed != BULK_LINES || stat.pending != 0 ||
+	bulk_result.last_code != 403 || info.code != 403 ||
+	info.state != PJSIP_REGC_BULK_FAILED ||
+	info.next_reg > PJSIP_REGC_BULK_RETRY_INTERVAL ||
+	info.next_reg < PJSIP_REGC_BULK_RETRY_INTERVAL *
+			(100 - PJSIP_REGC_BULK_JITTER) / 100 - 1)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: failed=%u, code=%d, next_reg=%d",
+		  stat.failed, info.code, info.next_reg));
+	pjsip_regc_bulk_destroy(bulk);
+	return -920;
+    }
+    pjsip_regc_bulk_destroy(bulk);
+
+    /* No callback after destroy */
+    status = bulk_create(registrar_uri, PJSIP_REGC_BULK_MAX_PENDING, &bulk);
+    if (status != PJ_SUCCESS)
+	return -930;
+
+    send_mod.count = 0;
+    pjsip_regc_bulk_start(bulk, 0);
+    pjsip_regc_bulk_destroy(bulk);
+    flush_events(500);
+
+    if (send_mod.count == 0) {
+	ret = -940;
+    } else if (bulk_result.cb_cnt != 0) {
+	PJ_LOG(3,(THIS_FILE, "    error: callback called after destroy"));
+	ret = -950;
+    }
+
+    return ret;
+}
+
+
 /************************************************************************/
 enum
 {
@@ -1148,6 +1527,19 @@ int regc_test(void)
     if (rc != 0)
 	goto on_return;
 
+    /* Bulk registration */
+    rc = bulk_register_test(&registrar_uri);
+    if (rc != 0)
+	goto on_return;
+
+    rc = bulk_auth_test(&registrar_uri);
+    if (rc != 0)
+	goto on_return;
+
+    rc = bulk_error_test(&registrar_uri);
+    if (rc != 0)
+	goto on_return;
+
 on_return:
     if (registrar.mod.id != -1) {
 	pjsip_endpt_unregister_module(endpt, &registrar.mod);
@@ -0,0 +1,721 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjsip_ua.h>
+#include <pjsip_simple.h>
+#include <pjsip-simple/errno.h>
+#include <pjlib.h>
+
+#define THIS_FILE	"rls_test.c"
+
+#define EVENT		"dialog"
+#define LIST_URI	"sip:blf-list@127.0.0.1"
+#define RES_CNT		3
+
+static const char *res_uri[RES_CNT] =
+{
+    "sip:101@127.0.0.1",
+    "sip:102@127.0.0.1",
+    "sip:103@127.0.0.1"
+};
+
+/* Subscriber side. The state of each resource is the dialog state from
+ * the dialog-info part, "pending" if the resource has no state yet, or
+ * empty if it has never been notified.
+ */
+static struct subscriber
+{
+    pjsip_evsub	*sub;
+    unsigned	 notify_cnt;
+    pj_status_t	 parse_status;
+    unsigned	 version;
+    pj_bool_t	 full_state;
+    unsigned	 res_cnt;
+    char	 state[RES_CNT][16];
+    pj_bool_t	 terminated;
+} subscriber;
+
+/* Stand-in resource list server */
+static struct rls
+{
+    pjsip_evsub	*sub;
+    unsigned	 rejected;
+    unsigned	 accepted;
+} rls;
+
+
+/*
+ * Create resource list notification body. The state of a resource is the
+ * dialog state, or "" if the RLS has no state for it yet. Resources with
+ * NULL state are not included.
+ */
+static pjsip_msg_body *create_list_body(pj_pool_t *pool, unsigned version,
+					pj_bool_t full_state,
+					const char *state[RES_CNT])
+{
+    pj_str_t STR_CONTENT_ID = { "Content-ID", 10 };
+    pj_str_t STR_APPLICATION = { "application", 11 };
+    pj_str_t STR_RLMI_XML = { "rlmi+xml", 8 };
+    pj_str_t STR_DIALOG_XML = { "dialog-info+xml", 15 };
+    pjsip_media_type ctype;
+    pjsip_msg_body *mp;
+    pjsip_multipart_part *part;
+    pjsip_param *param;
+    pj_str_t text, cid;
+    char *rlmi;
+    int len = 0;
+    unsigned i;
+
+    pjsip_media_type_init2(&ctype, "multipart", "related");
+    param = PJ_POOL_ZALLOC_T(pool, pjsip_param);
+    param->name = pj_str("type");
+    param->value = pj_str("\"application/rlmi+xml\"");
+    pj_list_push_back(&ctype.param, param);
+    param = PJ_POOL_ZALLOC_T(pool, pjsip_param);
+    param->name = pj_str("start");
+    param->value = pj_str("\"<list@127.0.0.1>\"");
+    pj_list_push_back(&ctype.param, param);
+
+    mp = pjsip_multipart_create(pool, &ctype, NULL);
+
+    rlmi = (char*) pj_pool_alloc(pool, 1024);
+    len = pj_ansi_snprintf(rlmi, 1024,
+			   "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\r\n"
+			   "<list xmlns=\"urn:ietf:params:xml:ns:rlmi\" "
+			   "uri=\"" LIST_URI "\" version=\"%u\" "
+			   "fullState=\"%s\">\r\n",
+			   version, (full_state ? "true" : "false"));
+    for (i=0; i<RES_CNT; ++i) {
+	if (state[i] == NULL)
+	    continue;
+
+	if (state[i][0] == '\0') {
+	    len += pj_ansi_snprintf(rlmi+len, 1024-len,
+				    " <resource uri=\"%s\">"
+				    "<name>Ext %u</name>"
+				    "<instance id=\"i%u\" state=\"pending\"/>"
+				    "</resource>\r\n",
+				    res_uri[i], i, i);
+	} else {
+	    len += pj_ansi_snprintf(rlmi+len, 1024-len,
+				    " <resource uri=\"%s\">"
+				    "<name>Ext %u</name>"
+				    "<instance id=\"i%u\" state=\"active\" "
+				    "cid=\"r%u.%u@127.0.0.1\"/>"
+				    "</resource>\r\n",
+				    res_uri[i], i, i, i, version);
+	}
+    }
+    len += pj_ansi_snprintf(rlmi+len, 1024-len, "</list>\r\n");
+
+    /* The root part */
+    part = pjsip_multipart_create_part(pool);
+    text = pj_str(rlmi);
+    part->body = pjsip_msg_body_create(pool, &STR_APPLICATION,
+				       &STR_RLMI_XML, &text);
+    cid = pj_str("<list@127.0.0.1>");
+    pj_list_push_back(&part->hdr,
+		      pjsip_generic_string_hdr_create(pool, &STR_CONTENT_ID,
+						      &cid));
+    pjsip_multipart_add_part(pool, mp, part);
+
+    for (i=0; i<RES_CNT; ++i) {
+	char *buf;
+
+	if (state[i] == NULL || state[i][0] == '\0')
+	    continue;
+
+	buf = (char*) pj_pool_alloc(pool, 256);
+	pj_ansi_snprintf(buf, 256,
+			 "<?xml version=\"1.0\"?>\r\n"
+			 "<dialog-info xmlns=\"urn:ietf:params:xml:ns:"
+			 "dialog-info\" version=\"%u\" state=\"full\" "
+			 "entity=\"%s\"><dialog id=\"d%u\">"
+			 "<state>%s</state></dialog></dialog-info>\r\n",
+			 version, res_uri[i], i, state[i]);
+
+	part = pjsip_multipart_create_part(pool);
+	text = pj_str(buf);
+	part->body = pjsip_msg_body_create(pool, &STR_APPLICATION,
+					   &STR_DIALOG_XML, &text);
+	buf = (char*) pj_pool_alloc(pool, 32);
+	pj_ansi_snprintf(buf, 32, "<r%u.%u@127.0.0.1>", i, version);
+	cid = pj_str(buf);
+	pj_list_push_back(&part->hdr,
+			  pjsip_generic_string_hdr_create(pool,
+							  &STR_CONTENT_ID,
+							  &cid));
+	pjsip_multipart_add_part(pool, mp, part);
+    }
+
+    return mp;
+}
+
+/* Get the dialog state from dialog-info body */
+static void get_dialog_state(const pjsip_msg_body *body, char *state,
+			     unsigned size)
+{
+    pj_str_t text, tag = pj_str("<state>");
+    char *p, *end;
+
+    text.ptr = (char*)body->data;
+    text.slen = body->len;
+
+    state[0] = '\0';
+    p = pj_strstr(&text, &tag);
+    if (!p)
+	return;
+    p += tag.slen;
+    end = p;
+    while (end < text.ptr + text.slen && *end != '<')
+	++end;
+
+    pj_ansi_snprintf(state, size, "%.*s", (int)(end - p), p);
+}
+
+static int check_list(const pjsip_rlmi_list *list, unsigned version,
+		      pj_bool_t full_state, const char *state[RES_CNT])
+{
+    unsigned i, cnt = 0;
+
+    if (pj_strcmp2(&list->uri, LIST_URI) != 0 ||
+	list->version != version || list->full_state != full_state)
+    {
+	return -1;
+    }
+
+    for (i=0; i<RES_CNT; ++i) {
+	const pjsip_rlmi_resource *res;
+	char dlg_state[16];
+
+	if (state[i] == NULL)
+	    continue;
+
+	if (cnt == list->res_cnt)
+	    return -2;
+	res = &list->res[cnt++];
+	if (pj_strcmp2(&res->uri, res_uri[i]) != 0)
+	    return -2;
+
+	if (state[i][0] == '\0') {
+	    if (pj_strcmp2(&res->state, "pending") != 0 || res->body)
+		return -3;
+	    continue;
+	}
+
+	if (pj_strcmp2(&res->state, "active") != 0 || res->body == NULL)
+	    return -4;
+	get_dialog_state(res->body, dlg_state, sizeof(dlg_state));
+	if (pj_ansi_strcmp(dlg_state, state[i]) != 0)
+	    return -5;
+    }
+
+    return (cnt == list->res_cnt) ? 0 : -6;
+}
+
+/* Parse notification bodies without the network */
+static int parse_test(void)
+{
+    const char *state[RES_CNT] = { "confirmed", "early", "" };
+    pjsip_msg_body *mp, *raw;
+    pjsip_rlmi_list list;
+    pj_str_t text, type, subtype;
+    pj_pool_t *pool;
+    char *buf;
+    int len, rc = 0;
+    pj_status_t status;
+
+    pool = pjsip_endpt_create_pool(endpt, "rlstest", 4000, 4000);
+
+    /* Parsed multipart body, as created by the application */
+    mp = create_list_body(pool, 7, PJ_TRUE, state);
+    status = pjsip_rlmi_parse(pool, mp, &list);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to parse list body", status);
+	rc = -10;
+	goto on_return;
+    }
+    rc = check_list(&list, 7, PJ_TRUE, state);
+    if (rc != 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: check_list() returned %d", rc));
+	rc = -20;
+	goto on_return;
+    }
+    if (pj_strcmp2(&list.res[1].name, "Ext 1") != 0) {
+	rc = -30;
+	goto on_return;
+    }
+
+    /* The same body as raw text */
+    buf = (char*) pj_pool_alloc(pool, 4000);
+    len = mp->print_body(mp, buf, 4000);
+    if (len <= 0) {
+	rc = -40;
+	goto on_return;
+    }
+    text.ptr = buf;
+    text.slen = len;
+    raw = pjsip_msg_body_create(pool, &mp->content_type.type,
+				&mp->content_type.subtype, &text);
+    pjsip_param_clone(pool, &raw->content_type.param,
+		      &mp->content_type.param);
+    status = pjsip_rlmi_parse(pool, raw, &list);
+    if (status != PJ_SUCCESS || check_list(&list, 7, PJ_TRUE, state) != 0) {
+	rc = -50;
+	goto on_return;
+    }
+
+    /* Not a resource list notification */
+    text = pj_str("<dialog-info/>");
+    type = pj_str("application");
+    subtype = pj_str("dialog-info+xml");
+    raw = pjsip_msg_body_create(pool, &type, &subtype, &text);
+    if (pjsip_rlmi_parse(pool, raw, &list) != PJSIP_SIMPLE_EBADCONTENT) {
+	rc = -60;
+	goto on_return;
+    }
+
+    /* Multipart body without RLMI root */
+    mp = pjsip_multipart_create(pool, &mp->content_type, NULL);
+    {
+	pjsip_multipart_part *part = pjsip_multipart_create_part(pool);
+
+	part->body = pjsip_msg_body_create(pool, &type, &subtype, &text);
+	pjsip_multipart_add_part(pool, mp, part);
+    }
+    if (pjsip_rlmi_parse(pool, mp, &list) != PJSIP_SIMPLE_EBADRLMI) {
+	rc = -70;
+	goto on_return;
+    }
+
+on_return:
+    pjsip_endpt_release_pool(endpt, pool);
+    return rc;
+}
+
+
+/*
+ * Subscriber callbacks.
+ */
+static void uac_on_evsub_state(pjsip_evsub *sub, pjsip_event *event)
+{
+    PJ_UNUSED_ARG(event);
+
+    if (sub == subscriber.sub &&
+	pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED)
+    {
+	subscriber.terminated = PJ_TRUE;
+	subscriber.sub = NULL;
+    }
+}
+
+static void uac_on_rx_notify(pjsip_evsub *sub, pjsip_rx_data *rdata,
+			     int *p_st_code, pj_str_t **p_st_text,
+			     pjsip_hdr *res_hdr, pjsip_msg_body **p_body)
+{
+    pjsip_msg_body *body = rdata->msg_info.msg->body;
+    pjsip_rlmi_list list;
+    unsigned i, j;
+
+    PJ_UNUSED_ARG(p_st_code);
+    PJ_UNUSED_ARG(p_st_text);
+    PJ_UNUSED_ARG(res_hdr);
+    PJ_UNUSED_ARG(p_body);
+
+    if (sub != subscriber.sub || !body)
+	return;
+
+    ++subscriber.notify_cnt;
+    subscriber.parse_status = pjsip_rlmi_parse(rdata->tp_info.pool, body,
+					       &list);
+    if (subscriber.parse_status != PJ_SUCCESS)
+	return;
+
+    subscriber.version = list.version;
+    subscriber.full_state = list.full_state;
+    subscriber.res_cnt = list.res_cnt;
+
+    for (j=0; j<list.res_cnt; ++j) {
+	for (i=0; i<RES_CNT; ++i) {
+	    if (pj_strcmp2(&list.res[j].uri, res_uri[i]) != 0)
+		continue;
+
+	    if (list.res[j].body) {
+		get_dialog_state(list.res[j].body, subscriber.state[i],
+				 sizeof(subscriber.state[i]));
+	    } else {
+		pj_ansi_snprintf(subscriber.state[i],
+				 sizeof(subscriber.state[i]), "%.*s",
+				 (int)list.res[j].state.slen,
+				 list.res[j].state.ptr);
+	    }
+	}
+    }
+}
+
+static pjsip_evsub_user uac_cb =
+{
+    &uac_on_evsub_state,
+    NULL,
+    NULL,
+    &uac_on_rx_notify,
+    NULL,
+    NULL
+};
+
+
+/*
+ * Stand-in RLS.
+ */
+static void rls_on_evsub_state(pjsip_evsub *sub, pjsip_event *event)
+{
+    PJ_UNUSED_ARG(event);
+
+    if (sub == rls.sub &&
+	pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED)
+    {
+	rls.sub = NULL;
+    }
+}
+
+static void rls_on_rx_refresh(pjsip_evsub *sub, pjsip_rx_data *rdata,
+			      int *p_st_code, pj_str_t **p_st_text,
+			      pjsip_hdr *res_hdr, pjsip_msg_body **p_body)
+{
+    pjsip_tx_data *tdata;
+
+    PJ_UNUSED_ARG(rdata);
+    PJ_UNUSED_ARG(p_st_code);
+    PJ_UNUSED_ARG(p_st_text);
+    PJ_UNUSED_ARG(res_hdr);
+    PJ_UNUSED_ARG(p_body);
+
+    if (pjsip_evsub_get_state(sub) == PJSIP_EVSUB_STATE_TERMINATED &&
+	pjsip_evsub_notify(sub, PJSIP_EVSUB_STATE_TERMINATED, NULL, NULL,
+			   &tdata) == PJ_SUCCESS)
+    {
+	pjsip_evsub_send_request(sub, tdata);
+    }
+}
+
+static pjsip_evsub_user rls_cb =
+{
+    &rls_on_evsub_state,
+    NULL,
+    &rls_on_rx_refresh,
+    NULL,
+    NULL,
+    NULL
+};
+
+static pj_status_t rls_notify(unsigned version, pj_bool_t full_state,
+			      const char *state[RES_CNT])
+{
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    status = pjsip_evsub_notify(rls.sub, PJSIP_EVSUB_STATE_ACTIVE, NULL,
+				NULL, &tdata);
+    if (status != PJ_SUCCESS)
+	return status;
+
+    tdata->msg->body = create_list_body(tdata->pool, version, full_state,
+					state);
+    return pjsip_evsub_send_request(rls.sub, tdata);
+}
+
+static pj_bool_t rls_on_rx_request(pjsip_rx_data *rdata)
+{
+    const pj_str_t STR_EVENTLIST = { "eventlist", 9 };
+    const char *state[RES_CNT] = { "confirmed", "early", "" };
+    pj_str_t contact = pj_str("<" LIST_URI ";transport=loop-dgram>");
+    pjsip_msg *msg = rdata->msg_info.msg;
+    pjsip_supported_hdr *sup_hdr;
+    pjsip_dialog *dlg;
+    pj_bool_t eventlist = PJ_FALSE;
+    pj_status_t status;
+    unsigned i;
+
+    if (pjsip_method_cmp(&msg->line.req.method,
+			 &pjsip_subscribe_method) != 0)
+    {
+	return PJ_FALSE;
+    }
+
+    /* A resource list server must reject subscribers that don't support
+     * resource lists (RFC 4662 section 5).
+     */
+    sup_hdr = (pjsip_supported_hdr*)
+	      pjsip_msg_find_hdr(msg, PJSIP_H_SUPPORTED, NULL);
+    for (i=0; sup_hdr && i<sup_hdr->count; ++i) {
+	if (pj_stricmp(&sup_hdr->values[i], &STR_EVENTLIST) == 0)
+	    eventlist = PJ_TRUE;
+    }
+    if (!eventlist) {
+	pjsip_hdr hdr_list;
+	pjsip_require_hdr *req_hdr;
+
+	pj_list_init(&hdr_list);
+	req_hdr = pjsip_require_hdr_create(rdata->tp_info.pool);
+	req_hdr->count = 1;
+	req_hdr->values[0] = STR_EVENTLIST;
+	pj_list_push_back(&hdr_list, req_hdr);
+
+	++rls.rejected;
+	pjsip_endpt_respond_stateless(endpt, rdata, 421, NULL, &hdr_list,
+				      NULL);
+	return PJ_TRUE;
+    }
+
+    status = pjsip_dlg_create_uas(pjsip_ua_instance(), rdata, &contact, &dlg);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create UAS dialog", status);
+	pjsip_endpt_respond_stateless(endpt, rdata, 500, NULL, NULL, NULL);
+	return PJ_TRUE;
+    }
+
+    pjsip_dlg_inc_lock(dlg);
+
+    status = pjsip_evsub_create_uas(dlg, &rls_cb, rdata, 0, &rls.sub);
+    if (status == PJ_SUCCESS)
+	status = pjsip_evsub_accept(rls.sub, rdata, 200, NULL);
+    if (status == PJ_SUCCESS) {
+	++rls.accepted;
+	status = rls_notify(1, PJ_TRUE, state);
+    }
+    if (status != PJ_SUCCESS)
+	app_perror("   error: unable to serve the list", status);
+
+    pjsip_dlg_dec_lock(dlg);
+    return PJ_TRUE;
+}
+
+static pjsip_module mod_rls =
+{
+    NULL, NULL,				/* prev, next.		*/
+    { "mod-rls-test", 12 },		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_APPLICATION,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &rls_on_rx_request,			/* on_rx_request()	*/
+    NULL,				/* on_rx_response()	*/
+    NULL,				/* on_tx_request.	*/
+    NULL,				/* on_tx_response()	*/
+    NULL,				/* on_tsx_state()	*/
+};
+
+
+static int subscribe(pj_bool_t eventlist)
+{
+    pj_str_t local_uri = pj_str("<sip:console@127.0.0.1;transport=loop-dgram>");
+    pj_str_t target_uri = pj_str(LIST_URI ";transport=loop-dgram");
+    pj_str_t event = pj_str(EVENT);
+    pj_str_t content_type = pj_str("application/dialog-info+xml");
+    pjsip_dialog *dlg;
+    pjsip_tx_data *tdata;
+    pj_status_t status;
+
+    pj_bzero(&subscriber, sizeof(subscriber));
+
+    status = pjsip_dlg_create_uac(pjsip_ua_instance(), &local_uri,
+				  &local_uri, &target_uri, &target_uri, &dlg);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create dialog", status);
+	return -10;
+    }
+
+    status = pjsip_evsub_create_uac(dlg, &uac_cb, &event, 0,
+				    &subscriber.sub);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create subscription", status);
+	pjsip_dlg_terminate(dlg);
+	return -20;
+    }
+
+    status = pjsip_evsub_initiate(subscriber.sub, NULL, 60, &tdata);
+    if (status == PJ_SUCCESS && eventlist)
+	status = pjsip_rlmi_add_subscribe_hdr(tdata, &content_type);
+    if (status == PJ_SUCCESS)
+	status = pjsip_evsub_send_request(subscriber.sub, tdata);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to send SUBSCRIBE", status);
+	return -30;
+    }
+
+    return 0;
+}
+
+/* Wait until the subscriber has received the NOTIFY, or is terminated
+ * if notify_cnt is zero.
+ */
+static int wait_subscriber(unsigned notify_cnt, unsigned msec)
+{
+    pj_time_val timeout;
+
+    pj_gettickcount(&timeout);
+    timeout.msec += msec;
+    pj_time_val_normalize(&timeout);
+
+    for (;;) {
+	pj_time_val now, poll_delay = { 0, 10 };
+
+	if ((notify_cnt == 0 && subscriber.terminated) ||
+	    (notify_cnt != 0 && subscriber.notify_cnt >= notify_cnt))
+	{
+	    return 0;
+	}
+
+	pj_gettickcount(&now);
+	if (PJ_TIME_VAL_GT(now, timeout)) {
+	    PJ_LOG(3,(THIS_FILE, "   error: notify=%u terminated=%d",
+		      subscriber.notify_cnt, subscriber.terminated));
+	    return -1;
+	}
+
+	pjsip_endpt_handle_events(endpt, &poll_delay);
+    }
+}
+
+
+int rls_test(void)
+{
+    const char *partial[RES_CNT] = { NULL, "terminated", NULL };
+    pj_str_t event = pj_str(EVENT);
+    pj_str_t accept = pj_str("application/dialog-info+xml");
+    pjsip_transport *loop = NULL;
+    pjsip_tx_data *tdata;
+    pj_sockaddr_in addr;
+    pj_status_t status;
+    int rc;
+
+    PJ_LOG(3,(THIS_FILE, "  resource list subscription test"));
+
+    rc = parse_test();
+    if (rc != 0)
+	return rc;
+
+    /* The loop transport must not deliver synchronously, otherwise the
+     * response arrives before the client transaction has been started.
+     */
+    pj_sockaddr_in_init(&addr, NULL, 0);
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_LOOP_DGRAM,
+					   &addr, sizeof(addr), NULL, &loop);
+    if (status != PJ_SUCCESS) {
+	PJ_LOG(3,(THIS_FILE, "   error: loop transport is not configured!"));
+	return -90;
+    }
+    pjsip_loop_set_delay(loop, 1);
+
+    if (init_evsub_modules() != 0) {
+	rc = -100;
+	goto on_return;
+    }
+
+    pj_bzero(&rls, sizeof(rls));
+    status = pjsip_endpt_register_module(endpt, &mod_rls);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to register module", status);
+	rc = -110;
+	goto on_return;
+    }
+    if (!pjsip_evsub_has_pkg(&event)) {
+	status = pjsip_evsub_register_pkg(&mod_rls, &event, 600, 1, &accept);
+	if (status != PJ_SUCCESS) {
+	    rc = -120;
+	    goto on_return;
+	}
+    }
+
+    /* Plain subscription to the list is rejected */
+    rc = subscribe(PJ_FALSE);
+    if (rc != 0)
+	goto on_return;
+    if (wait_subscriber(0, 3000) != 0 || rls.rejected != 1 ||
+	subscriber.notify_cnt != 0)
+    {
+	rc = -130;
+	goto on_return;
+    }
+
+    /* Resource list subscription gets the full state of the list */
+    rc = subscribe(PJ_TRUE);
+    if (rc != 0)
+	goto on_return;
+    if (wait_subscriber(1, 3000) != 0 || rls.accepted != 1) {
+	rc = -140;
+	goto on_return;
+    }
+    if (subscriber.parse_status != PJ_SUCCESS ||
+	subscriber.version != 1 || !subscriber.full_state ||
+	subscriber.res_cnt != RES_CNT ||
+	pj_ansi_strcmp(subscriber.state[0], "confirmed") != 0 ||
+	pj_ansi_strcmp(subscriber.state[1], "early") != 0 ||
+	pj_ansi_strcmp(subscriber.state[2], "pending") != 0)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: status=%d version=%u states=%s,%s,%s",
+		  subscriber.parse_status, subscriber.version,
+		  subscriber.state[0], subscriber.state[1],
+		  subscriber.state[2]));
+	rc = -150;
+	goto on_return;
+    }
+
+    /* Partial notification only carries the resource that has changed */
+    status = rls_notify(2, PJ_FALSE, partial);
+    if (status != PJ_SUCCESS || wait_subscriber(2, 3000) != 0) {
+	rc = -160;
+	goto on_return;
+    }
+    if (subscriber.parse_status != PJ_SUCCESS ||
+	subscriber.version != 2 || subscriber.full_state ||
+	subscriber.res_cnt != 1 ||
+	pj_ansi_strcmp(subscriber.state[0], "confirmed") != 0 ||
+	pj_ansi_strcmp(subscriber.state[1], "terminated") != 0 ||
+	pj_ansi_strcmp(subscriber.state[2], "pending") != 0)
+    {
+	rc = -170;
+	goto on_return;
+    }
+
+    /* Unsubscribe */
+    status = pjsip_evsub_initiate(subscriber.sub, NULL, 0, &tdata);
+    if (status == PJ_SUCCESS)
+	status = pjsip_evsub_send_request(subscriber.sub, tdata);
+    if (status != PJ_SUCCESS || wait_subscriber(0, 3000) != 0) {
+	rc = -180;
+	goto on_return;
+    }
+
+on_return:
+    if (subscriber.sub)
+	pjsip_evsub_terminate(subscriber.sub, PJ_FALSE);
+    if (rls.sub)
+	pjsip_evsub_terminate(rls.sub, PJ_FALSE);
+    flush_events(500);
+    if (mod_rls.id != -1)
+	pjsip_endpt_unregister_module(endpt, &mod_rls);
+    pjsip_loop_set_delay(loop, 0);
+    pjsip_transport_dec_ref(loop);
+    return rc;
+}
@@ -0,0 +1,208 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+#include "test.h"
+#include <pjsip.h>
+#include <pjsip_simple.h>
+#include <pjlib.h>
+
+#define THIS_FILE	"sub_refresh_test.c"
+
+/* Simulated subscriptions, all accepted at the same time (e.g. after the
+ * phones have registered again).
+ */
+#define SUB_COUNT	2000
+#define EXPIRES		3600
+
+/* Scheduler settings */
+#define JITTER		20
+#define RATE		5
+#define BURST		5
+
+
+static int pacer_test(void)
+{
+    pjsip_evsub_pacer pacer;
+    pj_time_val now = { 100, 0 };
+    unsigned i, delay;
+
+    PJ_LOG(3,(THIS_FILE, "  pacer test"));
+
+    /* Disabled pacer never delays */
+    pjsip_evsub_pacer_init(&pacer, 0, 0);
+    for (i=0; i<100; ++i) {
+	if (pjsip_evsub_pacer_reserve(&pacer, &now) != 0)
+	    return -10;
+    }
+
+    /* Burst is sent now, the rest are spaced by the rate */
+    pjsip_evsub_pacer_init(&pacer, 10, 3);
+    for (i=0; i<3; ++i) {
+	if (pjsip_evsub_pacer_reserve(&pacer, &now) != 0)
+	    return -20;
+    }
+    delay = pjsip_evsub_pacer_reserve(&pacer, &now);
+    if (delay != 100)
+	return -30;
+    delay = pjsip_evsub_pacer_reserve(&pacer, &now);
+    if (delay != 200)
+	return -40;
+
+    /* After being idle, the bucket is full again */
+    now.sec += 10;
+    for (i=0; i<3; ++i) {
+	if (pjsip_evsub_pacer_reserve(&pacer, &now) != 0)
+	    return -50;
+    }
+    if (pjsip_evsub_pacer_reserve(&pacer, &now) == 0)
+	return -60;
+
+    return 0;
+}
+
+static int jitter_test(void)
+{
+    unsigned i, base = EXPIRES - PJSIP_EVSUB_TIME_UAC_REFRESH;
+
+    PJ_LOG(3,(THIS_FILE, "  jitter test"));
+
+    for (i=0; i<1000; ++i) {
+	unsigned t;
+
+	t = pjsip_evsub_calc_refresh_delay(EXPIRES, 0);
+	if (t > base || t < base - 10)
+	    return -100;
+
+	t = pjsip_evsub_calc_refresh_delay(EXPIRES, JITTER);
+	if (t > base || t < base - base * JITTER / 100)
+	    return -110;
+    }
+
+    /* Short intervals are not reduced below zero */
+    if (pjsip_evsub_calc_refresh_delay(3, JITTER) > 3)
+	return -120;
+
+    return 0;
+}
+
+static int cmp_unsigned(const void *a, const void *b)
+{
+    unsigned x = *(const unsigned*)a, y = *(const unsigned*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+/* Run the refreshes of the subscriptions in virtual time, and return the
+ * peak number of SUBSCRIBE requests in one second.
+ */
+static int simulate(unsigned jitter, unsigned rate, unsigned burst,
+		    unsigned *time_ms, unsigned *counts, unsigned *peak,
+		    unsigned *last_ms)
+{
+    pjsip_evsub_pacer pacer;
+    unsigned i;
+
+    for (i=0; i<SUB_COUNT; ++i)
+	time_ms[i] = pjsip_evsub_calc_refresh_delay(EXPIRES, jitter) * 1000;
+
+    /* The refresh queue sees the refreshes in the order of their timers */
+    qsort(time_ms, SUB_COUNT, sizeof(time_ms[0]), &cmp_unsigned);
+
+    pjsip_evsub_pacer_init(&pacer, rate, burst);
+    pj_bzero(counts, EXPIRES * sizeof(counts[0]));
+    *peak = *last_ms = 0;
+
+    for (i=0; i<SUB_COUNT; ++i) {
+	pj_time_val now;
+	unsigned depart;
+
+	now.sec = time_ms[i] / 1000;
+	now.msec = time_ms[i] % 1000;
+
+	depart = time_ms[i] + pjsip_evsub_pacer_reserve(&pacer, &now);
+
+	/* The refresh must be sent before the subscription expires */
+	if (depart >= EXPIRES * 1000)
+	    return -200;
+
+	if (++counts[depart / 1000] > *peak)
+	    *peak = counts[depart / 1000];
+	if (depart > *last_ms)
+	    *last_ms = depart;
+    }
+
+    return 0;
+}
+
+static int simulation_test(pj_pool_t *pool)
+{
+    unsigned *time_ms, *counts;
+    unsigned peak_legacy, peak_paced, last_legacy, last_paced;
+    int rc;
+
+    PJ_LOG(3,(THIS_FILE, "  refresh simulation: %d subscriptions, "
+			 "expires=%d", SUB_COUNT, EXPIRES));
+
+    time_ms = (unsigned*) pj_pool_calloc(pool, SUB_COUNT, sizeof(unsigned));
+    counts = (unsigned*) pj_pool_calloc(pool, EXPIRES, sizeof(unsigned));
+
+    /* Each subscription refreshes on its own timer */
+    rc = simulate(0, 0, 0, time_ms, counts, &peak_legacy, &last_legacy);
+    if (rc != 0)
+	return rc;
+
+    /* Jittered timers and paced queue */
+    rc = simulate(JITTER, RATE, BURST, time_ms, counts, &peak_paced,
+		  &last_paced);
+    if (rc != 0)
+	return rc - 10;
+
+    PJ_LOG(3,(THIS_FILE, "   without scheduler: peak %u SUBSCRIBE/s, "
+			 "last refresh at %u s", peak_legacy,
+			 last_legacy / 1000));
+    PJ_LOG(3,(THIS_FILE, "   with scheduler (jitter %d%%, %d/s, burst %d): "
+			 "peak %u SUBSCRIBE/s, last refresh at %u s",
+	      JITTER, RATE, BURST, peak_paced, last_paced / 1000));
+
+    /* The token bucket allows the burst plus the rate in any second */
+    if (peak_paced > RATE + BURST)
+	return -230;
+
+    /* Without jitter the refreshes collapse into ten seconds */
+    if (peak_legacy < SUB_COUNT / 10 / 2 || peak_paced * 10 > peak_legacy)
+	return -240;
+
+    return 0;
+}
+
+int sub_refresh_test(void)
+{
+    pj_pool_t *pool;
+    int rc;
+
+    pool = pjsip_endpt_create_pool(endpt, "subref", 4000, 4000);
+
+    rc = pacer_test();
+    if (rc == 0)
+	rc = jitter_test();
+    if (rc == 0)
+	rc = simulation_test(pool);
+
+    pj_pool_release(pool);
+    return rc;
+}
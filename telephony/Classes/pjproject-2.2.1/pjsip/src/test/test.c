@@ -23,6 +23,8 @@
 #include <pjlib.h>
 #include <pjlib-util.h>
 #include <pjsip.h>
+#include <pjsip_ua.h>
+#include <pjsip_simple.h>
 
 #define THIS_FILE   "test.c"
 
@@ -87,6 +89,26 @@ void flush_events(unsigned duration)
     }
 }
 
+/* The user agent and event subscription modules can only be initialized
+ * once, so the tests that need them share this.
+ */
+int init_evsub_modules(void)
+{
+    static pj_bool_t evsub_initialized;
+
+    if (pjsip_ua_instance()->id == -1 &&
+	pjsip_ua_init_module(endpt, NULL) != PJ_SUCCESS)
+    {
+	return -1;
+    }
+    if (!evsub_initialized) {
+	if (pjsip_evsub_init_module(endpt) != PJ_SUCCESS)
+	    return -2;
+	evsub_initialized = PJ_TRUE;
+    }
+    return 0;
+}
+
 pj_status_t register_static_modules(pj_size_t *count, pjsip_module **modules)
 {
     PJ_UNUSED_ARG(modules);
@@ -313,6 +335,30 @@ int test_main(void)
     DO_TEST(tsx_bench());
 #endif
 
+#if INCLUDE_DLG_BENCH
+    DO_TEST(dlg_bench());
+#endif
+
+#if INCLUDE_DLG_CORE_TEST
+    DO_TEST(dlg_core_test());
+#endif
+
+#if INCLUDE_AUTH_SRV_TEST
+    DO_TEST(auth_srv_test());
+#endif
+
+#if INCLUDE_DISPATCH_TEST
+    DO_TEST(endpt_dispatch_test());
+#endif
+
+#if INCLUDE_OVERLOAD_TEST
+    DO_TEST(overload_test());
+#endif
+
+#if INCLUDE_MOD_STAT_TEST
+    DO_TEST(endpt_mod_stat_test());
+#endif
+
 #if INCLUDE_UDP_TEST
     DO_TEST(transport_udp_test());
 #endif
@@ -325,6 +371,10 @@ int test_main(void)
     DO_TEST(transport_tcp_test());
 #endif
 
+#if INCLUDE_WS_TEST
+    DO_TEST(transport_ws_test());
+#endif
+
 #if INCLUDE_RESOLVE_TEST
     DO_TEST(resolve_test());
 #endif
@@ -369,6 +419,22 @@ int test_main(void)
     DO_TEST(regc_test());
 #endif
 
+#if INCLUDE_EVSUB_SRV_TEST
+    DO_TEST(evsub_srv_test());
+#endif
+
+#if INCLUDE_RLS_TEST
+    DO_TEST(rls_test());
+#endif
+
+#if INCLUDE_DIALOG_INFO_TEST
+    DO_TEST(dialog_info_test());
+#endif
+
+#if INCLUDE_SUB_REFRESH_TEST
+    DO_TEST(sub_refresh_test());
+#endif
+
     /*
      * Better be last because it recreates the endpt
      */
@@ -43,6 +43,7 @@ extern pj_caching_pool caching_pool;
 #define INCLUDE_TSX_GROUP	    1
 #define INCLUDE_INV_GROUP	    1
 #define INCLUDE_REGC_GROUP	    1
+#define INCLUDE_SIMPLE_GROUP	    1
 
 #define INCLUDE_BENCHMARKS	    1
 
@@ -60,14 +61,25 @@ extern pj_caching_pool caching_pool;
 #define INCLUDE_MULTIPART_TEST	INCLUDE_MESSAGING_GROUP
 #define INCLUDE_TXDATA_TEST	INCLUDE_MESSAGING_GROUP
 #define INCLUDE_TSX_BENCH	INCLUDE_MESSAGING_GROUP
+#define INCLUDE_DLG_BENCH	INCLUDE_MESSAGING_GROUP
+#define INCLUDE_DLG_CORE_TEST	INCLUDE_MESSAGING_GROUP
+#define INCLUDE_AUTH_SRV_TEST	INCLUDE_MESSAGING_GROUP
+#define INCLUDE_DISPATCH_TEST	INCLUDE_MESSAGING_GROUP
+#define INCLUDE_OVERLOAD_TEST	INCLUDE_MESSAGING_GROUP
+#define INCLUDE_MOD_STAT_TEST	INCLUDE_MESSAGING_GROUP
 #define INCLUDE_UDP_TEST	INCLUDE_TRANSPORT_GROUP
 #define INCLUDE_LOOP_TEST	INCLUDE_TRANSPORT_GROUP
 #define INCLUDE_TCP_TEST	INCLUDE_TRANSPORT_GROUP
+#define INCLUDE_WS_TEST		INCLUDE_TRANSPORT_GROUP
 #define INCLUDE_RESOLVE_TEST	INCLUDE_TRANSPORT_GROUP
 #define INCLUDE_TSX_TEST	INCLUDE_TSX_GROUP
 #define INCLUDE_TSX_DESTROY_TEST INCLUDE_TSX_GROUP
 #define INCLUDE_INV_OA_TEST	INCLUDE_INV_GROUP
 #define INCLUDE_REGC_TEST	INCLUDE_REGC_GROUP
+#define INCLUDE_EVSUB_SRV_TEST	INCLUDE_SIMPLE_GROUP
+#define INCLUDE_RLS_TEST	INCLUDE_SIMPLE_GROUP
+#define INCLUDE_DIALOG_INFO_TEST INCLUDE_SIMPLE_GROUP
+#define INCLUDE_SUB_REFRESH_TEST INCLUDE_SIMPLE_GROUP
 
 
 /* The tests */
@@ -77,12 +89,23 @@ int msg_err_test(void);
 int multipart_test(void);
 int txdata_test(void);
 int tsx_bench(void);
+int dlg_bench(void);
+int dlg_core_test(void);
+int auth_srv_test(void);
+int endpt_dispatch_test(void);
+int overload_test(void);
+int endpt_mod_stat_test(void);
 int tsx_destroy_test(void);
 int transport_udp_test(void);
 int transport_loop_test(void);
 int transport_tcp_test(void);
+int transport_ws_test(void);
 int resolve_test(void);
 int regc_test(void);
+int evsub_srv_test(void);
+int rls_test(void);
+int dialog_info_test(void);
+int sub_refresh_test(void);
 
 struct tsx_test_param
 {
@@ -118,6 +141,7 @@ void app_perror(const char *msg, pj_status_t status);
 int  init_msg_logger(void);
 int  msg_logger_set_enabled(pj_bool_t enabled);
 void flush_events(unsigned duration);
+int  init_evsub_modules(void);
 
 
 void report_ival(const char *name, int value, const char *valname, const char *desc);
@@ -115,6 +115,228 @@ static int datagram_loop_test()
     return 0;
 }
 
+/*
+ * Raw forwarding test: forward request and response with
+ * pjsip_endpt_fwd_raw_request()/pjsip_endpt_fwd_raw_response() to the
+ * loop transport, and check the text of the forwarded messages.
+ */
+#define RAW_FWD_CALL_ID	"raw-fwd-test"
+
+static pj_bool_t raw_fwd_on_rx(pjsip_rx_data *rdata);
+static char raw_fwd_buf[PJSIP_MAX_PKT_LEN];
+static int  raw_fwd_type;
+
+static pjsip_module raw_fwd_module = 
+{
+    NULL, NULL,				/* prev and next	*/
+    { "Raw-Fwd-Test", 12},		/* Name.		*/
+    -1,					/* Id			*/
+    PJSIP_MOD_PRIORITY_TSX_LAYER-1,	/* Priority		*/
+    NULL,				/* load()		*/
+    NULL,				/* start()		*/
+    NULL,				/* stop()		*/
+    NULL,				/* unload()		*/
+    &raw_fwd_on_rx,			/* on_rx_request()	*/
+    &raw_fwd_on_rx,			/* on_rx_response()	*/
+    NULL,				/* on_tsx_state()	*/
+};
+
+static pj_bool_t raw_fwd_on_rx(pjsip_rx_data *rdata)
+{
+    if (pj_strcmp2(&rdata->msg_info.cid->id, RAW_FWD_CALL_ID) != 0)
+	return PJ_FALSE;
+
+    pj_memcpy(raw_fwd_buf, rdata->msg_info.msg_buf, rdata->msg_info.len);
+    raw_fwd_buf[rdata->msg_info.len] = '\0';
+    raw_fwd_type = rdata->msg_info.msg->type + 1;
+    return PJ_TRUE;
+}
+
+/* Parse msg as if it was received from src_name:src_port */
+static pjsip_rx_data *raw_fwd_create_rdata(pj_pool_t *pool, const char *msg,
+					   const char *src_name, int src_port)
+{
+    pjsip_rx_data *rdata;
+
+    rdata = PJ_POOL_ZALLOC_T(pool, pjsip_rx_data);
+    rdata->tp_info.pool = pool;
+    pj_ansi_strcpy(rdata->pkt_info.packet, msg);
+    rdata->pkt_info.len = pj_ansi_strlen(msg);
+    pj_ansi_strcpy(rdata->pkt_info.src_name, src_name);
+    rdata->pkt_info.src_port = src_port;
+    pj_list_init(&rdata->msg_info.parse_err);
+    rdata->msg_info.msg_buf = rdata->pkt_info.packet;
+    rdata->msg_info.len = (int)rdata->pkt_info.len;
+
+    if (!pjsip_parse_rdata(rdata->msg_info.msg_buf, rdata->msg_info.len,
+			   rdata) ||
+	!pj_list_empty(&rdata->msg_info.parse_err))
+    {
+	return NULL;
+    }
+
+    /* Update the top Via as the transport layer does */
+    if (rdata->msg_info.msg->type == PJSIP_REQUEST_MSG) {
+	pj_strdup2(pool, &rdata->msg_info.via->recvd_param, src_name);
+	if (rdata->msg_info.via->rport_param == 0)
+	    rdata->msg_info.via->rport_param = src_port;
+    }
+
+    return rdata;
+}
+
+static int raw_fwd_wait(int type)
+{
+    pj_time_val timeout, now;
+
+    pj_gettimeofday(&timeout);
+    timeout.sec += 2;
+    do {
+	pj_time_val poll = { 0, 10 };
+	pjsip_endpt_handle_events(endpt, &poll);
+	pj_gettimeofday(&now);
+    } while (raw_fwd_type != type + 1 && PJ_TIME_VAL_LT(now, timeout));
+
+    return raw_fwd_type == type + 1 ? 0 : -1;
+}
+
+static int raw_fwd_test(void)
+{
+    static const char *req = 
+	"OPTIONS sip:bob@example.com SIP/2.0\r\n"
+	"Via: SIP/2.0/UDP 10.0.0.1:5070;rport;branch=z9hG4bKraw-fwd-client\r\n"
+	"Max-Forwards: 10\r\n"
+	"Route: <sip:proxy.example.com;lr>, <sip:next.example.com;lr>\r\n"
+	"Record-Route: <sip:rr.example.com;lr>\r\n"
+	"From: <sip:alice@example.com>;tag=1234\r\n"
+	"To: <sip:bob@example.com>\r\n"
+	"Call-ID: " RAW_FWD_CALL_ID "\r\n"
+	"CSeq: 1 OPTIONS\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+    static const char *res = 
+	"SIP/2.0 200 OK\r\n"
+	"Via: SIP/2.0/LOOP-DGRAM 130.0.0.1:5060;branch=z9hG4bKraw-fwd-proxy, "
+	"SIP/2.0/LOOP-DGRAM 130.0.0.2:5070;branch=z9hG4bKraw-fwd-client;"
+	"received=130.0.0.3;rport=5071\r\n"
+	"From: <sip:alice@example.com>;tag=1234\r\n"
+	"To: <sip:bob@example.com>;tag=5678\r\n"
+	"Call-ID: " RAW_FWD_CALL_ID "\r\n"
+	"CSeq: 1 OPTIONS\r\n"
+	"Content-Length: 0\r\n"
+	"\r\n";
+    static const char *req_line =
+	"OPTIONS sip:carol@130.0.0.1;transport=loop-dgram SIP/2.0\r\n"
+	"Via: SIP/2.0/LOOP-DGRAM ";
+    static const char *req_expected[] = {
+	"Via: SIP/2.0/UDP 10.0.0.1:5070;rport=5070;"
+	    "branch=z9hG4bKraw-fwd-client;received=10.0.0.1\r\n",
+	";branch=z9hG4bKraw-fwd-proxy\r\n",
+	"Max-Forwards: 9\r\n",
+	"Record-Route: <sip:proxy.example.com;lr>\r\n"
+	    "Record-Route: <sip:rr.example.com;lr>\r\n",
+	"\r\nRoute: <sip:next.example.com;lr>\r\n",
+    };
+    pjsip_fwd_raw_param param;
+    pjsip_rx_data *rdata;
+    pj_sockaddr_in addr;
+    pj_pool_t *pool;
+    unsigned i;
+    pj_status_t status;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "testing raw forwarding"));
+
+    status = pjsip_endpt_register_module(endpt, &raw_fwd_module);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to register module", status);
+	return -200;
+    }
+
+    pool = pjsip_endpt_create_pool(endpt, "rawfwd", 8000, 4000);
+
+    /* Request */
+    rdata = raw_fwd_create_rdata(pool, req, "10.0.0.1", 5070);
+    if (!rdata) {
+	rc = -210;
+	goto on_return;
+    }
+
+    pjsip_fwd_raw_param_default(&param);
+    param.tp_type = PJSIP_TRANSPORT_LOOP_DGRAM;
+    pj_sockaddr_in_init(&addr, NULL, 5060);
+    pj_memcpy(&param.dst_addr, &addr, sizeof(addr));
+    param.dst_addr_len = sizeof(addr);
+    param.uri = pj_str("sip:carol@130.0.0.1;transport=loop-dgram");
+    param.branch = pj_str("z9hG4bKraw-fwd-proxy");
+    param.strip_route = PJ_TRUE;
+    param.record_route = pj_str("<sip:proxy.example.com;lr>");
+
+    raw_fwd_type = 0;
+    status = pjsip_endpt_fwd_raw_request(endpt, rdata, &param, NULL, NULL);
+    if (status != PJ_SUCCESS && status != PJ_EPENDING) {
+	app_perror("   error: unable to forward request", status);
+	rc = -220;
+	goto on_return;
+    }
+
+    if (raw_fwd_wait(PJSIP_REQUEST_MSG) != 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: forwarded request not received"));
+	rc = -230;
+	goto on_return;
+    }
+
+    if (pj_ansi_strncmp(raw_fwd_buf, req_line,
+			pj_ansi_strlen(req_line)) != 0)
+    {
+	rc = -240;
+    }
+    for (i=0; rc==0 && i<PJ_ARRAY_SIZE(req_expected); ++i) {
+	if (pj_ansi_strstr(raw_fwd_buf, req_expected[i]) == NULL)
+	    rc = -250 - i;
+    }
+    if (rc != 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: invalid forwarded request:\n%s",
+		  raw_fwd_buf));
+	goto on_return;
+    }
+
+    /* Response */
+    rdata = raw_fwd_create_rdata(pool, res, "130.0.0.1", 5060);
+    if (!rdata) {
+	rc = -260;
+	goto on_return;
+    }
+
+    raw_fwd_type = 0;
+    status = pjsip_endpt_fwd_raw_response(endpt, rdata, NULL, NULL);
+    if (status != PJ_SUCCESS && status != PJ_EPENDING) {
+	app_perror("   error: unable to forward response", status);
+	rc = -270;
+	goto on_return;
+    }
+
+    if (raw_fwd_wait(PJSIP_RESPONSE_MSG) != 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: forwarded response not received"));
+	rc = -280;
+	goto on_return;
+    }
+
+    if (pj_ansi_strstr(raw_fwd_buf, "\r\nVia: SIP/2.0/LOOP-DGRAM "
+		       "130.0.0.2:5070;branch=z9hG4bKraw-fwd-client;") == NULL ||
+	pj_ansi_strstr(raw_fwd_buf, "raw-fwd-proxy") != NULL)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: invalid forwarded response:\n%s",
+		  raw_fwd_buf));
+	rc = -290;
+    }
+
+on_return:
+    pj_pool_release(pool);
+    pjsip_endpt_unregister_module(endpt, &raw_fwd_module);
+    return rc;
+}
+
 int transport_loop_test(void)
 {
     int status;
@@ -123,5 +345,9 @@ int transport_loop_test(void)
     if (status != 0)
 	return status;
 
+    status = raw_fwd_test();
+    if (status != 0)
+	return status;
+
     return 0;
 }
@@ -29,6 +29,365 @@
  * TCP transport test.
  */
 #if PJ_HAS_TCP
+
+/*
+ * Connection pool test: standby connections, selection from the pool,
+ * and RFC 5923 alias of incoming connection.
+ */
+static int conn_pool_test(const pj_sockaddr_in *lis_addr)
+{
+    pjsip_tpmgr *tpmgr = pjsip_endpt_get_tpmgr(endpt);
+    pjsip_tpmgr_conn_pool_cfg cfg;
+    pjsip_tpmgr_conn_pool_info info;
+    pjsip_transport *tp, *tp2;
+    pj_sockaddr_in alias_addr;
+    pj_bool_t saved_accept_alias;
+    char req[512];
+    pj_sock_t sock;
+    pj_ssize_t size;
+    pj_status_t status;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "   connection pool test.."));
+
+    /* Pool of max 3 connections with 2 standby connections */
+    pjsip_tpmgr_conn_pool_cfg_default(&cfg);
+    cfg.max_conn = 3;
+    cfg.min_conn = 2;
+    status = pjsip_tpmgr_set_conn_pool(tpmgr, PJSIP_TRANSPORT_TCP, lis_addr,
+				       sizeof(*lis_addr), &cfg);
+    if (status != PJ_SUCCESS) {
+	app_perror("   Error: unable to set connection pool", status);
+	return -200;
+    }
+
+    status = pjsip_tpmgr_get_conn_pool_info(tpmgr, PJSIP_TRANSPORT_TCP,
+					    lis_addr, sizeof(*lis_addr),
+					    &info);
+    if (status != PJ_SUCCESS || info.conn_cnt != 2 || info.standby_cnt != 2)
+	return -205;
+
+    flush_events(500);
+
+    /* Idle pool must not grow, acquire must return pool member */
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_TCP,
+					   lis_addr, sizeof(*lis_addr),
+					   NULL, &tp);
+    if (status != PJ_SUCCESS)
+	return -210;
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_TCP,
+					   lis_addr, sizeof(*lis_addr),
+					   NULL, &tp2);
+    if (status != PJ_SUCCESS) {
+	pjsip_transport_dec_ref(tp);
+	return -215;
+    }
+
+    pjsip_tpmgr_get_conn_pool_info(tpmgr, PJSIP_TRANSPORT_TCP, lis_addr,
+				   sizeof(*lis_addr), &info);
+    if (tp->conn_pool == NULL || tp2->conn_pool == NULL ||
+	info.conn_cnt != 2)
+    {
+	rc = -220;
+    }
+    pjsip_transport_dec_ref(tp);
+    pjsip_transport_dec_ref(tp2);
+    if (rc != 0)
+	return rc;
+
+    /* Release standby connections and close them */
+    cfg.min_conn = 0;
+    pjsip_tpmgr_set_conn_pool(tpmgr, PJSIP_TRANSPORT_TCP, lis_addr,
+			      sizeof(*lis_addr), &cfg);
+    pjsip_tpmgr_get_conn_pool_info(tpmgr, PJSIP_TRANSPORT_TCP, lis_addr,
+				   sizeof(*lis_addr), &info);
+    if (info.standby_cnt != 0)
+	return -225;
+
+    while (info.conn_cnt) {
+	status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_TCP,
+					       lis_addr, sizeof(*lis_addr),
+					       NULL, &tp);
+	if (status != PJ_SUCCESS)
+	    return -230;
+	pjsip_transport_shutdown(tp);
+	pjsip_transport_dec_ref(tp);
+	pjsip_tpmgr_get_conn_pool_info(tpmgr, PJSIP_TRANSPORT_TCP, lis_addr,
+				       sizeof(*lis_addr), &info);
+    }
+
+    status = pjsip_tpmgr_set_conn_pool(tpmgr, PJSIP_TRANSPORT_TCP, lis_addr,
+				       sizeof(*lis_addr), NULL);
+    if (status != PJ_SUCCESS)
+	return -235;
+    if (pjsip_tpmgr_get_conn_pool_info(tpmgr, PJSIP_TRANSPORT_TCP, lis_addr,
+				       sizeof(*lis_addr), &info) != PJ_ENOTFOUND)
+	return -240;
+
+    flush_events(500);
+
+    /* Incoming connection with Via alias must be reused for requests to
+     * the sent-by address.
+     */
+    saved_accept_alias = pjsip_cfg()->endpt.accept_via_alias;
+    pjsip_cfg()->endpt.accept_via_alias = PJ_TRUE;
+
+    pj_memcpy(&alias_addr, lis_addr, sizeof(alias_addr));
+    alias_addr.sin_port = pj_htons(50999);
+
+    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_STREAM(), 0, &sock);
+    if (status != PJ_SUCCESS) {
+	rc = -245;
+	goto on_return;
+    }
+
+    status = pj_sock_connect(sock, lis_addr, sizeof(*lis_addr));
+    if (status != PJ_SUCCESS) {
+	pj_sock_close(sock);
+	rc = -250;
+	goto on_return;
+    }
+
+    size = pj_ansi_snprintf(req, sizeof(req),
+			    "OPTIONS sip:%s:%d;transport=tcp SIP/2.0\r\n"
+			    "Via: SIP/2.0/TCP %s:50999;branch=z9hG4bKalias;alias\r\n"
+			    "From: <sip:alice@%s>;tag=1234\r\n"
+			    "To: <sip:bob@%s>\r\n"
+			    "Call-ID: conn-pool-alias-test\r\n"
+			    "CSeq: 1 OPTIONS\r\n"
+			    "Max-Forwards: 70\r\n"
+			    "Content-Length: 0\r\n"
+			    "\r\n",
+			    pj_inet_ntoa(lis_addr->sin_addr),
+			    pj_ntohs(lis_addr->sin_port),
+			    pj_inet_ntoa(lis_addr->sin_addr),
+			    pj_inet_ntoa(lis_addr->sin_addr),
+			    pj_inet_ntoa(lis_addr->sin_addr));
+    status = pj_sock_send(sock, req, &size, 0);
+    if (status != PJ_SUCCESS) {
+	pj_sock_close(sock);
+	rc = -255;
+	goto on_return;
+    }
+
+    flush_events(500);
+
+    status = pjsip_tpmgr_get_conn_pool_info(tpmgr, PJSIP_TRANSPORT_TCP,
+					    &alias_addr, sizeof(alias_addr),
+					    &info);
+    if (status != PJ_SUCCESS || info.conn_cnt != 1 || !info.is_alias) {
+	PJ_LOG(3,(THIS_FILE, "   error: incoming connection not aliased"));
+	pj_sock_close(sock);
+	rc = -260;
+	goto on_return;
+    }
+
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_TCP,
+					   &alias_addr, sizeof(alias_addr),
+					   NULL, &tp);
+    if (status != PJ_SUCCESS || tp->dir != PJSIP_TP_DIR_INCOMING) {
+	if (status == PJ_SUCCESS)
+	    pjsip_transport_dec_ref(tp);
+	pj_sock_close(sock);
+	rc = -265;
+	goto on_return;
+    }
+    pjsip_transport_dec_ref(tp);
+
+    /* Alias is removed when the connection is closed */
+    pj_sock_close(sock);
+    flush_events(500);
+
+    if (pjsip_tpmgr_get_conn_pool_info(tpmgr, PJSIP_TRANSPORT_TCP,
+				       &alias_addr, sizeof(alias_addr),
+				       &info) != PJ_ENOTFOUND)
+    {
+	rc = -270;
+    }
+
+on_return:
+    pjsip_cfg()->endpt.accept_via_alias = saved_accept_alias;
+    return rc;
+}
+
+/*
+ * Outgoing queue test: with the peer not reading, messages sent while a
+ * write is pending are queued until the queue limit is reached, after
+ * which sending fails with PJSIP_ETPQUEUEFULL.
+ */
+enum { QUEUE_MAX_BYTES = 100000, QUEUE_PKT_LEN = 65536 };
+
+static int queue_pending_cnt;
+
+static void queue_send_cb(void *token, pjsip_tx_data *tdata,
+			  pj_ssize_t bytes_sent)
+{
+    PJ_UNUSED_ARG(token);
+    PJ_UNUSED_ARG(tdata);
+    PJ_UNUSED_ARG(bytes_sent);
+
+    --queue_pending_cnt;
+}
+
+static int queue_full_test(void)
+{
+    pjsip_tpmgr *tpmgr = pjsip_endpt_get_tpmgr(endpt);
+    pjsip_tcp_transport_cfg cfg;
+    pjsip_tpfactory *tpfactory;
+    pjsip_tpselector sel;
+    pjsip_transport *tp = NULL;
+    pjsip_transport_queue_info qi;
+    pj_sockaddr_in addr;
+    int addr_len = sizeof(addr);
+    pj_sock_t lsock = PJ_INVALID_SOCKET, sock = PJ_INVALID_SOCKET;
+    char *pkt;
+    int i, rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "   outgoing queue test.."));
+
+    /* Peer which accepts the connection but doesn't read from it */
+    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_STREAM(), 0, &lsock);
+    if (status != PJ_SUCCESS)
+	return -300;
+
+    pj_sockaddr_in_init(&addr, NULL, 0);
+    addr.sin_addr.s_addr = pj_htonl(0x7F000001);
+    if (pj_sock_bind(lsock, &addr, sizeof(addr)) != PJ_SUCCESS ||
+	pj_sock_getsockname(lsock, &addr, &addr_len) != PJ_SUCCESS ||
+	pj_sock_listen(lsock, 1) != PJ_SUCCESS)
+    {
+	pj_sock_close(lsock);
+	return -305;
+    }
+
+    /* Listener with small outgoing queue */
+    pjsip_tcp_transport_cfg_default(&cfg, pj_AF_INET());
+    cfg.max_tx_queue_bytes = QUEUE_MAX_BYTES;
+    status = pjsip_tcp_transport_start3(endpt, &cfg, &tpfactory);
+    if (status != PJ_SUCCESS) {
+	app_perror("   Error: unable to start TCP transport", status);
+	pj_sock_close(lsock);
+	return -310;
+    }
+
+    pj_bzero(&sel, sizeof(sel));
+    sel.type = PJSIP_TPSELECTOR_LISTENER;
+    sel.u.listener = tpfactory;
+    status = pjsip_tpmgr_acquire_transport(tpmgr, PJSIP_TRANSPORT_TCP,
+					   &addr, sizeof(addr), &sel, &tp);
+    if (status != PJ_SUCCESS) {
+	rc = -315;
+	goto on_return;
+    }
+
+    /* Wait until connected */
+    flush_events(500);
+
+    pkt = (char*) pj_pool_alloc(tp->pool, QUEUE_PKT_LEN);
+    pj_memset(pkt, 'x', QUEUE_PKT_LEN);
+
+    sel.type = PJSIP_TPSELECTOR_TRANSPORT;
+    sel.u.transport = tp;
+
+    /* Fill the socket buffer until the write becomes pending */
+    for (i=0; i<4096; ++i) {
+	status = pjsip_tpmgr_send_raw(tpmgr, PJSIP_TRANSPORT_TCP, &sel,
+				      NULL, pkt, QUEUE_PKT_LEN, &addr,
+				      sizeof(addr), NULL, &queue_send_cb);
+	if (status == PJ_EPENDING) {
+	    ++queue_pending_cnt;
+	    break;
+	}
+	if (status != PJ_SUCCESS) {
+	    app_perror("   Error: send failed", status);
+	    rc = -320;
+	    goto on_return;
+	}
+    }
+    if (status != PJ_EPENDING) {
+	rc = -325;
+	goto on_return;
+    }
+
+    /* The next message is queued */
+    status = pjsip_tpmgr_send_raw(tpmgr, PJSIP_TRANSPORT_TCP, &sel,
+				  NULL, pkt, QUEUE_PKT_LEN, &addr,
+				  sizeof(addr), NULL, &queue_send_cb);
+    if (status != PJ_EPENDING) {
+	rc = -330;
+	goto on_return;
+    }
+    ++queue_pending_cnt;
+
+    /* And the one after that would exceed the limit */
+    status = pjsip_tpmgr_send_raw(tpmgr, PJSIP_TRANSPORT_TCP, &sel,
+				  NULL, pkt, QUEUE_PKT_LEN, &addr,
+				  sizeof(addr), NULL, &queue_send_cb);
+    if (status != PJSIP_ETPQUEUEFULL) {
+	if (status == PJ_EPENDING)
+	    ++queue_pending_cnt;
+	PJ_LOG(3,(THIS_FILE, "   error: expecting PJSIP_ETPQUEUEFULL, "
+		  "got %d", status));
+	rc = -335;
+	goto on_return;
+    }
+
+    status = pjsip_transport_get_queue_info(tp, &qi);
+    if (status != PJ_SUCCESS) {
+	rc = -340;
+	goto on_return;
+    }
+    if (qi.rejected_cnt != 1 || qi.queued_cnt != 1 ||
+	qi.queued_bytes != QUEUE_PKT_LEN || qi.inflight_cnt != 1 ||
+	qi.max_queued_bytes != QUEUE_MAX_BYTES)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: invalid queue info: rejected=%u "
+		  "queued=%u/%lu inflight=%u max=%lu", qi.rejected_cnt,
+		  qi.queued_cnt, (unsigned long)qi.queued_bytes,
+		  qi.inflight_cnt, (unsigned long)qi.max_queued_bytes));
+	rc = -345;
+	goto on_return;
+    }
+
+on_return:
+    /* Drain the connection so that the pending writes complete */
+    if (tp && pj_sock_accept(lsock, &sock, NULL, NULL) == PJ_SUCCESS) {
+	for (i=0; i<1000 && queue_pending_cnt > 0; ++i) {
+	    pj_fd_set_t rset;
+	    pj_time_val timeout = {0, 10};
+	    char buf[8192];
+	    pj_ssize_t len;
+
+	    PJ_FD_ZERO(&rset);
+	    PJ_FD_SET(sock, &rset);
+	    while (pj_sock_select(sock+1, &rset, NULL, NULL, &timeout) > 0) {
+		len = sizeof(buf);
+		if (pj_sock_recv(sock, buf, &len, 0) != PJ_SUCCESS || len <= 0)
+		    break;
+		PJ_FD_ZERO(&rset);
+		PJ_FD_SET(sock, &rset);
+	    }
+	    flush_events(10);
+	}
+	if (queue_pending_cnt != 0 && rc == 0)
+	    rc = -350;
+    }
+
+    if (tp) {
+	pjsip_transport_shutdown(tp);
+	pjsip_transport_dec_ref(tp);
+    }
+    if (sock != PJ_INVALID_SOCKET)
+	pj_sock_close(sock);
+    pj_sock_close(lsock);
+    flush_events(500);
+
+    pjsip_tpmgr_unregister_tpfactory(tpmgr, tpfactory);
+
+    return rc;
+}
+
 int transport_tcp_test(void)
 {
     enum { SEND_RECV_LOOP = 8 };
@@ -126,6 +485,13 @@ int transport_tcp_test(void)
     if (pj_atomic_get(tcp->ref_cnt) != 1)
 	return -80;
 
+    /* Connection pool test */
+    status = conn_pool_test(&rem_addr);
+    if (status != 0) {
+	pjsip_transport_dec_ref(tcp);
+	return status;
+    }
+
     /* Destroy this transport. */
     pjsip_transport_dec_ref(tcp);
 
@@ -140,6 +506,11 @@ int transport_tcp_test(void)
     if (status != PJ_SUCCESS)
 	return -95;
 
+    /* Outgoing queue test, with its own listener */
+    status = queue_full_test();
+    if (status != 0)
+	return status;
+
     /* Flush events. */
     PJ_LOG(3,(THIS_FILE, "   Flushing events, 1 second..."));
     flush_events(1000);
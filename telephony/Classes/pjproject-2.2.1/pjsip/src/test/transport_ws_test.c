@@ -0,0 +1,457 @@
+/* $Id$ */
+/*
+ * Copyright (C) 2008-2011 Teluu Inc. (http://www.teluu.com)
+ * Copyright (C) 2003-2008 Benny Prijono <benny@prijono.org>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#include "test.h"
+#include <pjsip.h>
+#include <pjlib.h>
+
+#define THIS_FILE   "transport_ws_test.c"
+
+
+/*
+ * WebSocket transport test.
+ */
+#if PJ_HAS_TCP && PJSIP_HAS_WS_TRANSPORT
+
+/* Sample handshake from RFC 6455 section 1.2 */
+#define SAMPLE_KEY	"dGhlIHNhbXBsZSBub25jZQ=="
+#define SAMPLE_ACCEPT	"s3pPLMBiTxaQ9kYGzzhZRbK+xOo="
+
+/* Receive from the raw client socket while polling the endpoint. */
+static int raw_recv(pj_sock_t sock, char *buf, pj_ssize_t size)
+{
+    int i;
+
+    for (i=0; i<40; ++i) {
+	pj_fd_set_t rset;
+	pj_time_val timeout = { 0, 0 };
+
+	flush_events(50);
+
+	PJ_FD_ZERO(&rset);
+	PJ_FD_SET(sock, &rset);
+	if (pj_sock_select(sock+1, &rset, NULL, NULL, &timeout) > 0) {
+	    pj_status_t status = pj_sock_recv(sock, buf, &size, 0);
+	    return (status == PJ_SUCCESS) ? (int)size : -1;
+	}
+    }
+
+    return -1;
+}
+
+/* Send masked frame from the raw client socket. */
+static pj_status_t raw_send_frame(pj_sock_t sock, unsigned opcode,
+				  const char *payload, unsigned len)
+{
+    static const pj_uint8_t key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    char frame[6 + 125];
+    pj_ssize_t size;
+    unsigned i;
+
+    pj_assert(len <= 125);
+
+    frame[0] = (char)(0x80 | opcode);
+    frame[1] = (char)(0x80 | len);
+    pj_memcpy(frame+2, key, 4);
+    for (i=0; i<len; ++i)
+	frame[6+i] = (char)(payload[i] ^ key[i & 3]);
+
+    size = 6 + len;
+    return pj_sock_send(sock, frame, &size, 0);
+}
+
+/*
+ * Perform the opening handshake, ping and closing handshake with a raw
+ * socket acting as WebSocket client.
+ */
+static int raw_client_test(const pj_sockaddr_in *addr)
+{
+    const char *req = "GET / HTTP/1.1\r\n"
+		      "Host: localhost\r\n"
+		      "Upgrade: websocket\r\n"
+		      "Connection: Upgrade\r\n"
+		      "Sec-WebSocket-Key: " SAMPLE_KEY "\r\n"
+		      "Sec-WebSocket-Version: 13\r\n"
+		      "Sec-WebSocket-Protocol: sip\r\n"
+		      "\r\n";
+    pj_str_t key = pj_str(SAMPLE_KEY);
+    char accept[29];
+    char buf[512];
+    pj_sock_t sock;
+    pj_ssize_t size;
+    int len, rc = 0;
+    pj_status_t status;
+
+    /* Check the accept calculation with RFC 6455 sample */
+    status = pjsip_ws_calc_accept(&key, accept);
+    if (status != PJ_SUCCESS || pj_ansi_strcmp(accept, SAMPLE_ACCEPT) != 0)
+	return -110;
+
+    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_STREAM(), 0, &sock);
+    if (status != PJ_SUCCESS)
+	return -120;
+
+    status = pj_sock_connect(sock, addr, sizeof(*addr));
+    if (status != PJ_SUCCESS) {
+	app_perror("   Error: unable to connect to WS listener", status);
+	rc = -125;
+	goto on_return;
+    }
+
+    size = pj_ansi_strlen(req);
+    status = pj_sock_send(sock, req, &size, 0);
+    if (status != PJ_SUCCESS) {
+	rc = -130;
+	goto on_return;
+    }
+
+    len = raw_recv(sock, buf, sizeof(buf)-1);
+    if (len <= 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: no handshake response"));
+	rc = -135;
+	goto on_return;
+    }
+    buf[len] = '\0';
+
+    if (pj_ansi_strncmp(buf, "HTTP/1.1 101", 12) != 0 ||
+	pj_ansi_strstr(buf, "Sec-WebSocket-Accept: " SAMPLE_ACCEPT) == NULL ||
+	pj_ansi_strstr(buf, "Sec-WebSocket-Protocol: sip") == NULL)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: invalid handshake response:\n%s",
+		  buf));
+	rc = -140;
+	goto on_return;
+    }
+
+    /* Ping must be answered with pong carrying the same payload */
+    status = raw_send_frame(sock, 0x9, "hello", 5);
+    if (status != PJ_SUCCESS) {
+	rc = -145;
+	goto on_return;
+    }
+
+    len = raw_recv(sock, buf, sizeof(buf));
+    if (len != 7 || (pj_uint8_t)buf[0] != 0x8A || buf[1] != 5 ||
+	pj_memcmp(buf+2, "hello", 5) != 0)
+    {
+	PJ_LOG(3,(THIS_FILE, "   error: invalid pong response (len=%d)",
+		  len));
+	rc = -150;
+	goto on_return;
+    }
+
+    /* Close must be echoed */
+    status = raw_send_frame(sock, 0x8, "\x03\xe8", 2);
+    if (status != PJ_SUCCESS) {
+	rc = -155;
+	goto on_return;
+    }
+
+    len = raw_recv(sock, buf, sizeof(buf));
+    if (len < 2 || (pj_uint8_t)buf[0] != 0x88) {
+	PJ_LOG(3,(THIS_FILE, "   error: invalid close response (len=%d)",
+		  len));
+	rc = -160;
+	goto on_return;
+    }
+
+on_return:
+    pj_sock_close(sock);
+    flush_events(200);
+    return rc;
+}
+
+/*
+ * Handshake with the wrong resource path must be rejected.
+ */
+static int raw_reject_test(const pj_sockaddr_in *addr)
+{
+    const char *req = "GET /other HTTP/1.1\r\n"
+		      "Host: localhost\r\n"
+		      "Upgrade: websocket\r\n"
+		      "Connection: Upgrade\r\n"
+		      "Sec-WebSocket-Key: " SAMPLE_KEY "\r\n"
+		      "Sec-WebSocket-Version: 13\r\n"
+		      "Sec-WebSocket-Protocol: sip\r\n"
+		      "\r\n";
+    char buf[512];
+    pj_sock_t sock;
+    pj_ssize_t size;
+    int len, rc = 0;
+    pj_status_t status;
+
+    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_STREAM(), 0, &sock);
+    if (status != PJ_SUCCESS)
+	return -170;
+
+    status = pj_sock_connect(sock, addr, sizeof(*addr));
+    if (status != PJ_SUCCESS) {
+	rc = -175;
+	goto on_return;
+    }
+
+    size = pj_ansi_strlen(req);
+    status = pj_sock_send(sock, req, &size, 0);
+    if (status != PJ_SUCCESS) {
+	rc = -180;
+	goto on_return;
+    }
+
+    len = raw_recv(sock, buf, sizeof(buf)-1);
+    if (len <= 0) {
+	rc = -185;
+	goto on_return;
+    }
+    buf[len] = '\0';
+
+    if (pj_ansi_strncmp(buf, "HTTP/1.1 404", 12) != 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: expecting 404 response:\n%s", buf));
+	rc = -190;
+	goto on_return;
+    }
+
+on_return:
+    pj_sock_close(sock);
+    flush_events(200);
+    return rc;
+}
+
+/*
+ * Frames with a 64-bit length that would overflow the receive buffer
+ * arithmetic must be rejected and the connection closed.
+ */
+static int raw_bad_length_test(const pj_sockaddr_in *addr,
+			       pj_uint64_t frame_len)
+{
+    const char *req = "GET / HTTP/1.1\r\n"
+		      "Host: localhost\r\n"
+		      "Upgrade: websocket\r\n"
+		      "Connection: Upgrade\r\n"
+		      "Sec-WebSocket-Key: " SAMPLE_KEY "\r\n"
+		      "Sec-WebSocket-Version: 13\r\n"
+		      "Sec-WebSocket-Protocol: sip\r\n"
+		      "\r\n";
+    char buf[512];
+    pj_uint8_t frame[14 + 16];
+    pj_sock_t sock;
+    pj_ssize_t size;
+    int i, len, rc = 0;
+    pj_status_t status;
+
+    status = pj_sock_socket(pj_AF_INET(), pj_SOCK_STREAM(), 0, &sock);
+    if (status != PJ_SUCCESS)
+	return -200;
+
+    status = pj_sock_connect(sock, addr, sizeof(*addr));
+    if (status != PJ_SUCCESS) {
+	rc = -205;
+	goto on_return;
+    }
+
+    size = pj_ansi_strlen(req);
+    status = pj_sock_send(sock, req, &size, 0);
+    if (status != PJ_SUCCESS) {
+	rc = -210;
+	goto on_return;
+    }
+
+    len = raw_recv(sock, buf, sizeof(buf)-1);
+    if (len <= 0 || pj_ansi_strncmp(buf, "HTTP/1.1 101", 12) != 0) {
+	rc = -215;
+	goto on_return;
+    }
+
+    /* Masked binary frame with the 127 length form */
+    pj_bzero(frame, sizeof(frame));
+    frame[0] = 0x82;
+    frame[1] = 0x80 | 127;
+    for (i=0; i<8; ++i)
+	frame[2+i] = (pj_uint8_t)(frame_len >> (56 - i*8));
+
+    size = sizeof(frame);
+    status = pj_sock_send(sock, frame, &size, 0);
+    if (status != PJ_SUCCESS) {
+	rc = -220;
+	goto on_return;
+    }
+
+    /* The server must close the connection */
+    len = raw_recv(sock, buf, sizeof(buf));
+    if (len != 0) {
+	PJ_LOG(3,(THIS_FILE, "   error: connection not closed on invalid "
+			     "frame length (len=%d)", len));
+	rc = -225;
+	goto on_return;
+    }
+
+on_return:
+    pj_sock_close(sock);
+    flush_events(200);
+    return rc;
+}
+
+int transport_ws_test(void)
+{
+    enum { SEND_RECV_LOOP = 8 };
+    pjsip_ws_transport_cfg cfg;
+    pjsip_tpfactory *tpfactory;
+    pjsip_transport *ws;
+    pj_sockaddr_in rem_addr;
+    pj_status_t status;
+    char url[PJSIP_MAX_URL_SIZE];
+    int rtt[SEND_RECV_LOOP], min_rtt;
+    int i, pkt_lost;
+
+    /* Start WS listener on arbitrary port. */
+    pjsip_ws_transport_cfg_default(&cfg, pj_AF_INET());
+    status = pjsip_ws_transport_start(endpt, &cfg, &tpfactory);
+    if (status != PJ_SUCCESS) {
+	app_perror("   Error: unable to start WS transport", status);
+	return -10;
+    }
+
+
+    /* Get the listener address */
+    status = pj_sockaddr_in_init(&rem_addr, &tpfactory->addr_name.host,
+				 (pj_uint16_t)tpfactory->addr_name.port);
+    if (status != PJ_SUCCESS) {
+	app_perror("   Error: possibly invalid WS address name", status);
+	return -14;
+    }
+
+    pj_ansi_sprintf(url, "sip:alice@%s:%d;transport=ws",
+		    pj_inet_ntoa(rem_addr.sin_addr),
+		    pj_ntohs(rem_addr.sin_port));
+
+    /* Test the handshake and control frames with raw client socket */
+    status = raw_client_test(&rem_addr);
+    if (status != 0)
+	return status;
+
+    status = raw_reject_test(&rem_addr);
+    if (status != 0)
+	return status;
+
+    /* Length with the most significant bit set, and lengths that wrap
+     * around when the header length is added.
+     */
+    status = raw_bad_length_test(&rem_addr, PJ_UINT64(0x8000000000000010));
+    if (status == 0)
+	status = raw_bad_length_test(&rem_addr,
+				     PJ_UINT64(0xFFFFFFFFFFFFFFF2));
+    if (status == 0)
+	status = raw_bad_length_test(&rem_addr,
+				     PJ_UINT64(0x7FFFFFFFFFFFFFFF));
+    if (status != 0)
+	return status;
+
+
+    /* Acquire one WS transport. */
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_WS,
+					   &rem_addr, sizeof(rem_addr),
+					   NULL, &ws);
+    if (status != PJ_SUCCESS || ws == NULL) {
+	app_perror("   Error: unable to acquire WS transport", status);
+	return -17;
+    }
+
+    /* After pjsip_endpt_acquire_transport, WS transport must have
+     * reference counter 1.
+     */
+    if (pj_atomic_get(ws->ref_cnt) != 1)
+	return -20;
+
+    /* Test basic transport attributes */
+    status = generic_transport_test(ws);
+    if (status != PJ_SUCCESS)
+	return status;
+
+
+    /* Check again that reference counter is 1. */
+    if (pj_atomic_get(ws->ref_cnt) != 1)
+	return -40;
+
+    /* Load test */
+    if (transport_load_test(url) != 0)
+	return -60;
+
+    /* Basic transport's send/receive loopback test. */
+    for (i=0; i<SEND_RECV_LOOP; ++i) {
+	status = transport_send_recv_test(PJSIP_TRANSPORT_WS, ws, url, &rtt[i]);
+
+	if (status != 0) {
+	    pjsip_transport_dec_ref(ws);
+	    flush_events(500);
+	    return -72;
+	}
+    }
+
+    min_rtt = 0xFFFFFFF;
+    for (i=0; i<SEND_RECV_LOOP; ++i)
+	if (rtt[i] < min_rtt) min_rtt = rtt[i];
+
+    report_ival("ws-rtt-usec", min_rtt, "usec",
+		"Best WebSocket transport round trip time, in microseconds "
+		"(time from sending request until response is received. "
+		"Tests were performed on local machine only, and after "
+		"WebSocket connection has been established by previous test)");
+
+
+    /* Multi-threaded round-trip test. */
+    status = transport_rt_test(PJSIP_TRANSPORT_WS, ws, url, &pkt_lost);
+    if (status != 0) {
+	pjsip_transport_dec_ref(ws);
+	return status;
+    }
+
+    if (pkt_lost != 0)
+	PJ_LOG(3,(THIS_FILE, "   note: %d packet(s) was lost", pkt_lost));
+
+    /* Check again that reference counter is still 1. */
+    if (pj_atomic_get(ws->ref_cnt) != 1)
+	return -80;
+
+    /* Destroy this transport. */
+    pjsip_transport_dec_ref(ws);
+
+    /* Force destroy this transport. */
+    status = pjsip_transport_destroy(ws);
+    if (status != PJ_SUCCESS)
+	return -90;
+
+    /* Unregister factory */
+    status = pjsip_tpmgr_unregister_tpfactory(pjsip_endpt_get_tpmgr(endpt),
+					      tpfactory);
+    if (status != PJ_SUCCESS)
+	return -95;
+
+    /* Flush events. */
+    PJ_LOG(3,(THIS_FILE, "   Flushing events, 1 second..."));
+    flush_events(1000);
+
+    /* Done */
+    return 0;
+}
+#else	/* PJ_HAS_TCP && PJSIP_HAS_WS_TRANSPORT */
+int transport_ws_test(void)
+{
+    return 0;
+}
+#endif	/* PJ_HAS_TCP && PJSIP_HAS_WS_TRANSPORT */
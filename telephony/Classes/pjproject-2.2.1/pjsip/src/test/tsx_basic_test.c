@@ -72,6 +72,105 @@ static int tsx_layer_test(void)
     return 0;
 }
 
+/* Two UAC transactions whose branches carry the same hash must both be
+ * registered and found.
+ */
+static int key_collision_test(void)
+{
+    pj_str_t target, from, key1, key2;
+    pjsip_tx_data *tdata1, *tdata2;
+    pjsip_transaction *tsx1, *tsx2;
+    pjsip_via_hdr *via;
+    pj_status_t status;
+    int rc = 0;
+
+    PJ_LOG(3,(THIS_FILE, "  transaction key collision test"));
+
+    target = pj_str(TARGET_URI);
+    from = pj_str(FROM_URI);
+
+    status = pjsip_endpt_create_request(endpt, &pjsip_options_method,
+					&target, &from, &target, NULL, NULL,
+					-1, NULL, &tdata1);
+    if (status != PJ_SUCCESS) {
+	app_perror("  error: unable to create request", status);
+	return -150;
+    }
+
+    status = pjsip_endpt_create_request(endpt, &pjsip_options_method,
+					&target, &from, &target, NULL, NULL,
+					-1, NULL, &tdata2);
+    if (status != PJ_SUCCESS) {
+	app_perror("  error: unable to create request", status);
+	pjsip_tx_data_dec_ref(tdata1);
+	return -151;
+    }
+
+    status = pjsip_tsx_create_uac(NULL, tdata1, &tsx1);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create transaction", status);
+	pjsip_tx_data_dec_ref(tdata1);
+	pjsip_tx_data_dec_ref(tdata2);
+	return -152;
+    }
+
+    /* Same prefix and hash digits as the first branch, different rest */
+    via = (pjsip_via_hdr*)
+	  pjsip_msg_find_hdr(tdata2->msg, PJSIP_H_VIA, NULL);
+    if (!via) {
+	via = pjsip_via_hdr_create(tdata2->pool);
+	pjsip_msg_insert_first_hdr(tdata2->msg, (pjsip_hdr*)via);
+    }
+    via->branch_param.ptr = (char*)pj_pool_alloc(tdata2->pool, 64);
+    pj_memcpy(via->branch_param.ptr, tsx1->branch.ptr, 25);
+    pj_memcpy(via->branch_param.ptr + 25, "collision", 9);
+    via->branch_param.slen = 34;
+
+    status = pjsip_tsx_create_uac(NULL, tdata2, &tsx2);
+    if (status != PJ_SUCCESS) {
+	app_perror("   error: unable to create colliding transaction",
+		   status);
+	pjsip_tsx_terminate(tsx1, PJSIP_SC_REQUEST_TERMINATED);
+	flush_events(500);
+	pjsip_tx_data_dec_ref(tdata1);
+	pjsip_tx_data_dec_ref(tdata2);
+	return -153;
+    }
+
+    pj_strdup(tdata1->pool, &key1, &tsx1->transaction_key);
+    pj_strdup(tdata2->pool, &key2, &tsx2->transaction_key);
+
+    if (tsx1->bin_key.hval != tsx2->bin_key.hval ||
+	tsx1->bin_key.hval2 != tsx2->bin_key.hval2)
+    {
+	rc = -154;
+    } else if (pjsip_tsx_layer_find_tsx(&key1, PJ_FALSE) != tsx1) {
+	rc = -155;
+    } else if (pjsip_tsx_layer_find_tsx(&key2, PJ_FALSE) != tsx2) {
+	rc = -156;
+    }
+
+    /* The second one must still be found after the first one is gone */
+    pjsip_tsx_terminate(tsx1, PJSIP_SC_REQUEST_TERMINATED);
+    flush_events(500);
+    if (rc == 0 && pjsip_tsx_layer_find_tsx(&key2, PJ_FALSE) != tsx2)
+	rc = -157;
+
+    pjsip_tsx_terminate(tsx2, PJSIP_SC_REQUEST_TERMINATED);
+    flush_events(500);
+
+    if (rc == 0 && (pjsip_tsx_layer_find_tsx(&key1, PJ_FALSE) != NULL ||
+		    pjsip_tsx_layer_find_tsx(&key2, PJ_FALSE) != NULL))
+    {
+	rc = -158;
+    }
+
+    pjsip_tx_data_dec_ref(tdata1);
+    pjsip_tx_data_dec_ref(tdata2);
+
+    return rc;
+}
+
 /* Double terminate test. */
 static int double_terminate(void)
 {
@@ -149,6 +248,10 @@ int tsx_basic_test(struct tsx_test_param *param)
     if (status != 0)
 	return status;
 
+    status = key_collision_test();
+    if (status != 0)
+	return status;
+
     status = double_terminate();
     if (status != 0)
 	return status;
@@ -199,11 +199,130 @@ on_error:
 
 
 
+/*
+ * Benchmark matching of responses against UAC transactions, using the
+ * string key (pjsip_tsx_create_key() + pjsip_tsx_layer_find_tsx()) and
+ * the binary key (pjsip_tsx_layer_find_rx_tsx()).
+ */
+static int uac_match_bench(unsigned working_set, pj_timestamp *p_str_elapsed,
+			   pj_timestamp *p_bin_elapsed)
+{
+    unsigned i;
+    pjsip_tx_data *request;
+    pjsip_transaction **tsx;
+    pj_pool_t *pool;
+    pjsip_rx_data rdata;
+    pj_timestamp t1, t2;
+    pjsip_via_hdr *via;
+    pj_status_t status;
+
+    /* Create the request first. */
+    pj_str_t str_target = pj_str("sip:someuser@someprovider.com");
+    pj_str_t str_from = pj_str("\"Local User\" <sip:localuser@serviceprovider.com>");
+    pj_str_t str_to = pj_str("\"Remote User\" <sip:remoteuser@serviceprovider.com>");
+    pj_str_t str_contact = str_from;
+
+    status = pjsip_endpt_create_request(endpt, &pjsip_invite_method,
+					&str_target, &str_from, &str_to,
+					&str_contact, NULL, -1, NULL,
+					&request);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to create request", status);
+	return status;
+    }
+
+    via = (pjsip_via_hdr*) pjsip_msg_find_hdr(request->msg, PJSIP_H_VIA,
+					      NULL);
+
+    /* Pool for the string keys */
+    pool = pjsip_endpt_create_pool(endpt, "tsxmatch", 4000, 4000);
+
+    /* Create transaction array */
+    tsx = (pjsip_transaction**) pj_pool_zalloc(request->pool, working_set * sizeof(pj_pool_t*));
+
+    pj_bzero(&mod_tsx_user, sizeof(mod_tsx_user));
+    mod_tsx_user.id = -1;
+
+    for (i=0; i<working_set; ++i) {
+	status = pjsip_tsx_create_uac(&mod_tsx_user, request, &tsx[i]);
+	if (status != PJ_SUCCESS)
+	    goto on_error;
+	/* Reset branch param */
+	via->branch_param.slen = 0;
+    }
+
+    /* Create "dummy" rdata for the response from the request */
+    pj_bzero(&rdata, sizeof(pjsip_rx_data));
+    rdata.tp_info.pool = pool;
+    rdata.msg_info.msg = request->msg;
+    rdata.msg_info.from = (pjsip_from_hdr*) pjsip_msg_find_hdr(request->msg, PJSIP_H_FROM, NULL);
+    rdata.msg_info.to = (pjsip_to_hdr*) pjsip_msg_find_hdr(request->msg, PJSIP_H_TO, NULL);
+    rdata.msg_info.cseq = (pjsip_cseq_hdr*) pjsip_msg_find_hdr(request->msg, PJSIP_H_CSEQ, NULL);
+    rdata.msg_info.cid = (pjsip_cid_hdr*) pjsip_msg_find_hdr(request->msg, PJSIP_H_CALL_ID, NULL);
+    rdata.msg_info.via = via;
+
+    /* Benchmark string key */
+    pj_get_timestamp(&t1);
+    for (i=0; i<working_set; ++i) {
+	pj_str_t key;
+
+	via->branch_param = tsx[i]->branch;
+	pjsip_tsx_create_key(pool, &key, PJSIP_ROLE_UAC,
+			     &rdata.msg_info.cseq->method, &rdata);
+	if (pjsip_tsx_layer_find_tsx(&key, PJ_FALSE) != tsx[i]) {
+	    PJ_LOG(3,(THIS_FILE, "    error: string key lookup mismatch"));
+	    status = -10;
+	    goto on_error;
+	}
+    }
+    pj_get_timestamp(&t2);
+    pj_sub_timestamp(&t2, &t1);
+    p_str_elapsed->u64 = t2.u64;
+
+    /* Benchmark binary key */
+    pj_get_timestamp(&t1);
+    for (i=0; i<working_set; ++i) {
+	via->branch_param = tsx[i]->branch;
+	if (pjsip_tsx_layer_find_rx_tsx(&rdata, PJSIP_ROLE_UAC,
+					&rdata.msg_info.cseq->method,
+					PJ_FALSE) != tsx[i])
+	{
+	    PJ_LOG(3,(THIS_FILE, "    error: binary key lookup mismatch"));
+	    status = -20;
+	    goto on_error;
+	}
+    }
+    pj_get_timestamp(&t2);
+    pj_sub_timestamp(&t2, &t1);
+    p_bin_elapsed->u64 = t2.u64;
+
+    status = PJ_SUCCESS;
+
+on_error:
+    via->branch_param.slen = 0;
+    for (i=0; i<working_set; ++i) {
+	if (tsx[i]) {
+	    pj_timer_heap_t *th;
+
+	    pjsip_tsx_terminate(tsx[i], 601);
+	    tsx[i] = NULL;
+
+	    th = pjsip_endpt_get_timer_heap(endpt);
+	    pj_timer_heap_poll(th, NULL);
+	}
+    }
+    pjsip_tx_data_dec_ref(request);
+    pj_pool_release(pool);
+    flush_events(2000);
+    return status;
+}
+
+
 int tsx_bench(void)
 {
     enum { WORKING_SET=10000, REPEAT = 4 };
     unsigned i, speed;
-    pj_timestamp usec[REPEAT], min, freq;
+    pj_timestamp usec[REPEAT], usec2[REPEAT], min, min2, freq;
     char desc[250];
     int status;
 
@@ -290,6 +409,52 @@ int tsx_bench(void)
     report_ival("create-uas-tsx-per-sec", 
 		speed, "tsx/sec", desc);
 
+
+
+    /*
+     * Benchmark response matching
+     */
+    PJ_LOG(3,(THIS_FILE, "   benchmarking response matching:"));
+    for (i=0; i<REPEAT; ++i) {
+	PJ_LOG(3,(THIS_FILE, "    test %d of %d..",
+		  i+1, REPEAT));
+	status = uac_match_bench(WORKING_SET, &usec[i], &usec2[i]);
+	if (status != PJ_SUCCESS)
+	    return status;
+    }
+
+    min.u64 = min2.u64 = PJ_UINT64(0xFFFFFFFFFFFFFFF);
+    for (i=0; i<REPEAT; ++i) {
+	if (usec[i].u64 < min.u64) min.u64 = usec[i].u64;
+	if (usec2[i].u64 < min2.u64) min2.u64 = usec2[i].u64;
+    }
+    if (min.u64 == 0) min.u64 = 1;
+    if (min2.u64 == 0) min2.u64 = 1;
+
+    /* Write speed */
+    speed = (unsigned)(freq.u64 * WORKING_SET / min.u64);
+    PJ_LOG(3,(THIS_FILE, "    String key matched at %d msg/sec", speed));
+
+    pj_ansi_sprintf(desc, "Number of responses that can be matched per second "
+			  "with <tt>pjsip_tsx_create_key()</tt> and "
+			  "<tt>pjsip_tsx_layer_find_tsx()</tt>, against %d "
+			  "UAC transactions.",
+			  WORKING_SET);
+
+    report_ival("match-str-key-per-sec", 
+		speed, "msg/sec", desc);
+
+    speed = (unsigned)(freq.u64 * WORKING_SET / min2.u64);
+    PJ_LOG(3,(THIS_FILE, "    Binary key matched at %d msg/sec", speed));
+
+    pj_ansi_sprintf(desc, "Number of responses that can be matched per second "
+			  "with <tt>pjsip_tsx_layer_find_rx_tsx()</tt>, against "
+			  "%d UAC transactions.",
+			  WORKING_SET);
+
+    report_ival("match-bin-key-per-sec", 
+		speed, "msg/sec", desc);
+
     return PJ_SUCCESS;
 }
 
@@ -771,6 +771,266 @@ on_error:
 }
 
 
+/*
+ * tdata/rdata allocation benchmark. Objects are created and released in
+ * batches, so the timing includes the release of the objects.
+ */
+static int alloc_bench(pjsip_rx_data *rdata, pj_timestamp *p_tdata_elapsed,
+		       pj_timestamp *p_rdata_elapsed)
+{
+    enum { COUNT = 100 };
+    unsigned i, j;
+    pjsip_tx_data *tdata[COUNT];
+    pjsip_rx_data *clone[COUNT];
+    pj_timestamp t1, t2;
+    pj_status_t status;
+
+    p_tdata_elapsed->u64 = p_rdata_elapsed->u64 = 0;
+
+    for (i=0; i<LOOP; i+=COUNT) {
+	pj_get_timestamp(&t1);
+
+	for (j=0; j<COUNT; ++j) {
+	    status = pjsip_tx_data_create(pjsip_endpt_get_tpmgr(endpt),
+					  &tdata[j]);
+	    if (status != PJ_SUCCESS) {
+		app_perror("    error: unable to create tdata", status);
+		while (j > 0)
+		    pjsip_tx_data_dec_ref(tdata[--j]);
+		return -410;
+	    }
+	    pjsip_tx_data_add_ref(tdata[j]);
+	}
+	for (j=0; j<COUNT; ++j)
+	    pjsip_tx_data_dec_ref(tdata[j]);
+
+	pj_get_timestamp(&t2);
+	pj_sub_timestamp(&t2, &t1);
+	pj_add_timestamp(p_tdata_elapsed, &t2);
+
+	pj_get_timestamp(&t1);
+
+	for (j=0; j<COUNT; ++j) {
+	    status = pjsip_rx_data_clone(rdata, 0, &clone[j]);
+	    if (status != PJ_SUCCESS) {
+		app_perror("    error: unable to clone rdata", status);
+		while (j > 0)
+		    pjsip_rx_data_free_cloned(clone[--j]);
+		return -420;
+	    }
+	}
+	for (j=0; j<COUNT; ++j)
+	    pjsip_rx_data_free_cloned(clone[j]);
+
+	pj_get_timestamp(&t2);
+	pj_sub_timestamp(&t2, &t1);
+	pj_add_timestamp(p_rdata_elapsed, &t2);
+    }
+
+    return PJ_SUCCESS;
+}
+
+#if PJSIP_TP_DATA_CACHE_SIZE
+/*
+ * Thread that checks that it gets its own tdata free list, i.e. that the
+ * pool of a released tdata is kept instead of returned to the factory.
+ */
+static int cache_thread_proc(void *arg)
+{
+    int *p_rc = (int*)arg;
+    pjsip_tx_data *tdata;
+    pj_size_t used_count;
+
+    if (pjsip_tx_data_create(pjsip_endpt_get_tpmgr(endpt), &tdata) !=
+	PJ_SUCCESS)
+    {
+	*p_rc = -360;
+	return 0;
+    }
+    used_count = caching_pool.used_count;
+    pjsip_tx_data_add_ref(tdata);
+    pjsip_tx_data_dec_ref(tdata);
+
+    *p_rc = (caching_pool.used_count == used_count) ? 0 : -361;
+    return 0;
+}
+
+static void probe_tls_destructor(void *value)
+{
+    PJ_UNUSED_ARG(value);
+}
+
+/*
+ * Check that the free lists of exited threads are given to new threads.
+ */
+static int txdata_cache_thread_test(void)
+{
+    pj_pool_t *pool;
+    long tls;
+    unsigned i;
+    int rc = 0;
+    pj_status_t status;
+
+    /* Free lists are only handed over where thread exit is reported */
+    status = pj_thread_local_alloc2(&tls, &probe_tls_destructor);
+    if (status == PJ_ENOTSUP)
+	return 0;
+    if (status != PJ_SUCCESS)
+	return -362;
+    pj_thread_local_free(tls);
+
+    PJ_LOG(3,(THIS_FILE, "   tdata free list handover test"));
+
+    pool = pjsip_endpt_create_pool(endpt, "txcache", 512, 512);
+    for (i=0; i<PJSIP_TP_DATA_CACHE_THREADS+2 && rc==0; ++i) {
+	pj_thread_t *thread;
+
+	rc = -363;
+	status = pj_thread_create(pool, "txcache", &cache_thread_proc, &rc,
+				  0, 0, &thread);
+	if (status != PJ_SUCCESS) {
+	    app_perror("    error: unable to create thread", status);
+	    break;
+	}
+	pj_thread_join(thread);
+	pj_thread_destroy(thread);
+	if (rc != 0) {
+	    PJ_LOG(3,(THIS_FILE, "    error: thread %d has no free list "
+		      "(rc=%d)", i, rc));
+	}
+    }
+    pjsip_endpt_release_pool(endpt, pool);
+
+    return rc;
+}
+#endif	/* PJSIP_TP_DATA_CACHE_SIZE */
+
+/*
+ * Check that released tdata is recycled in a clean state and benchmark
+ * tdata/rdata allocation.
+ */
+static int txdata_alloc_test(void)
+{
+    enum { REPEAT = 4 };
+    pj_str_t str_target = pj_str("sip:someuser@someprovider.com");
+    pj_str_t str_from = pj_str("\"Local User\" <sip:localuser@serviceprovider.com>");
+    pj_str_t str_to = pj_str("\"Remote User\" <sip:remoteuser@serviceprovider.com>");
+    pj_timestamp tdata_usec[REPEAT], rdata_usec[REPEAT], tdata_min, rdata_min;
+    pj_timestamp freq;
+    pj_sockaddr_in remote;
+    pjsip_transport *tp;
+    pjsip_tx_data *request, *tdata;
+    pjsip_rx_data rdata;
+    pj_pool_t *pool;
+    unsigned i, speed;
+    int rc = 0;
+    pj_status_t status;
+
+    PJ_LOG(3,(THIS_FILE, "   tdata/rdata allocation test"));
+
+    /* Released tdata must be reusable and in clean state */
+    status = pjsip_endpt_create_request(endpt, &pjsip_invite_method,
+					&str_target, &str_from, &str_to,
+					&str_from, NULL, -1, NULL, &request);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to create request", status);
+	return -300;
+    }
+    pool = request->pool;
+    pjsip_tx_data_dec_ref(request);
+
+    status = pjsip_tx_data_create(pjsip_endpt_get_tpmgr(endpt), &tdata);
+    if (status != PJ_SUCCESS)
+	return -310;
+#if PJSIP_TP_DATA_CACHE_SIZE
+    if (tdata->pool != pool) {
+	PJ_LOG(3,(THIS_FILE, "    error: tdata pool is not recycled"));
+	pjsip_tx_data_dec_ref(tdata);
+	return -320;
+    }
+#else
+    PJ_UNUSED_ARG(pool);
+#endif
+    if (tdata->msg != NULL || pj_atomic_get(tdata->ref_cnt) != 0 ||
+	tdata->buf.start != NULL || tdata->tp_info.transport != NULL)
+    {
+	PJ_LOG(3,(THIS_FILE, "    error: recycled tdata is not clean"));
+	pjsip_tx_data_add_ref(tdata);
+	pjsip_tx_data_dec_ref(tdata);
+	return -330;
+    }
+    pjsip_tx_data_add_ref(tdata);
+    pjsip_tx_data_dec_ref(tdata);
+
+#if PJSIP_TP_DATA_CACHE_SIZE
+    rc = txdata_cache_thread_test();
+    if (rc != 0)
+	return rc;
+#endif
+
+    /* Cloning rdata needs transport */
+    pj_sockaddr_in_init(&remote, 0, 0);
+    status = pjsip_endpt_acquire_transport(endpt, PJSIP_TRANSPORT_LOOP_DGRAM,
+					   &remote, sizeof(pj_sockaddr_in),
+					   NULL, &tp);
+    if (status != PJ_SUCCESS) {
+	app_perror("    error: unable to get loop transport", status);
+	return -340;
+    }
+
+    status = pjsip_endpt_create_request(endpt, &pjsip_invite_method,
+					&str_target, &str_from, &str_to,
+					&str_from, NULL, -1, NULL, &request);
+    if (status != PJ_SUCCESS) {
+	pjsip_transport_dec_ref(tp);
+	return -350;
+    }
+
+    /* Create "dummy" rdata from the request */
+    pj_bzero(&rdata, sizeof(pjsip_rx_data));
+    rdata.tp_info.pool = request->pool;
+    rdata.tp_info.transport = tp;
+    rdata.msg_info.msg = request->msg;
+
+    PJ_LOG(3,(THIS_FILE, "   benchmarking tdata/rdata allocation:"));
+    for (i=0; i<REPEAT; ++i) {
+	PJ_LOG(3,(THIS_FILE, "    test %d of %d..", i+1, REPEAT));
+	rc = alloc_bench(&rdata, &tdata_usec[i], &rdata_usec[i]);
+	if (rc != 0)
+	    goto on_return;
+    }
+
+    tdata_min.u64 = rdata_min.u64 = PJ_UINT64(0xFFFFFFFFFFFFFFF);
+    for (i=0; i<REPEAT; ++i) {
+	if (tdata_usec[i].u64 < tdata_min.u64) tdata_min.u64 = tdata_usec[i].u64;
+	if (rdata_usec[i].u64 < rdata_min.u64) rdata_min.u64 = rdata_usec[i].u64;
+    }
+    if (tdata_min.u64 == 0) tdata_min.u64 = 1;
+    if (rdata_min.u64 == 0) rdata_min.u64 = 1;
+
+    pj_get_timestamp_freq(&freq);
+
+    speed = (unsigned)(freq.u64 * LOOP / tdata_min.u64);
+    PJ_LOG(3,(THIS_FILE, "    tdata allocated and released at %d objects/sec",
+	      speed));
+    report_ival("tdata-alloc-per-sec", speed, "obj/sec",
+		"Number of transmit buffers that can be created and destroyed "
+		"per second with <tt>pjsip_tx_data_create()</tt>");
+
+    speed = (unsigned)(freq.u64 * LOOP / rdata_min.u64);
+    PJ_LOG(3,(THIS_FILE, "    rdata cloned and released at %d objects/sec",
+	      speed));
+    report_ival("rdata-clone-per-sec", speed, "obj/sec",
+		"Number of receive buffers that can be cloned and freed "
+		"per second with <tt>pjsip_rx_data_clone()</tt>");
+
+on_return:
+    pjsip_tx_data_dec_ref(request);
+    pjsip_transport_dec_ref(tp);
+    return rc;
+}
+
+
 int txdata_test(void)
 {
     enum { REPEAT = 4 };
@@ -796,6 +1056,10 @@ int txdata_test(void)
     if (status != 0)
 	return status;
 
+    status = txdata_alloc_test();
+    if (status != 0)
+	return status;
+
 
     /*
      * Benchmark create_request()